@@ -30,6 +30,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "fmacros.h"
 #include <stdio.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -60,6 +61,45 @@
     #endif
 #endif
 
+/* The io_uring backend can be selected at runtime in place of the default
+ * one, see aeUseIouring(). It needs the io_uring definitions of Linux 5.11
+ * or newer. */
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if !defined(IORING_FEAT_EXT_ARG) || !defined(__NR_io_uring_setup)
+#undef HAVE_IO_URING
+#endif
+#endif
+#ifdef HAVE_IO_URING
+#include "ae_iouring.c"
+#endif
+
+/* 多路复用层的操作表 */
+/* Operations of a multiplexing layer. */
+typedef struct aeApi {
+    int (*create)(aeEventLoop *eventLoop);
+    int (*resize)(aeEventLoop *eventLoop, int setsize);
+    void (*free)(aeEventLoop *eventLoop);
+    int (*addEvent)(aeEventLoop *eventLoop, int fd, int mask);
+    void (*delEvent)(aeEventLoop *eventLoop, int fd, int mask);
+    int (*poll)(aeEventLoop *eventLoop, struct timeval *tvp);
+    char *(*name)(void);
+    int (*batchIO)(aeEventLoop *eventLoop, aeIORequest *reqs, int count);
+} aeApi;
+
+static const aeApi aeDefaultApi = {
+    aeApiCreate, aeApiResize, aeApiFree, aeApiAddEvent, aeApiDelEvent,
+    aeApiPoll, aeApiName, NULL
+};
+
+#ifdef HAVE_IO_URING
+static const aeApi aeIouringApi = {
+    aeIouringCreate, aeIouringResize, aeIouringFree, aeIouringAddEvent,
+    aeIouringDelEvent, aeIouringPoll, aeIouringName, aeIouringBatchIO
+};
+#endif
+
 /* 创建事件循环 */
 aeEventLoop *aeCreateEventLoop(int setsize) {
     aeEventLoop *eventLoop;
@@ -71,13 +111,18 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     if (eventLoop->events == NULL || eventLoop->fired == NULL) goto err;
     eventLoop->setsize = setsize;
     eventLoop->lastTime = time(NULL);
-    eventLoop->timeEventHead = NULL;
+    eventLoop->timeEvents = NULL;
+    eventLoop->timeEventsCount = 0;
+    eventLoop->timeEventsSize = 0;
+    eventLoop->timeEventFired = NULL;
+    eventLoop->timeEventDeleted = NULL;
     eventLoop->timeEventNextId = 0;
     eventLoop->stop = 0;
     eventLoop->maxfd = -1;
     eventLoop->beforesleep = NULL;
     eventLoop->aftersleep = NULL;
-    if (aeApiCreate(eventLoop) == -1) goto err;
+    eventLoop->api = &aeDefaultApi;
+    if (eventLoop->api->create(eventLoop) == -1) goto err;
     /* Events with mask == AE_NONE are not set. So let's initialize the
      * vector with it. */
     for (i = 0; i < setsize; i++)
@@ -112,7 +157,7 @@ int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
 
     if (setsize == eventLoop->setsize) return AE_OK;
     if (eventLoop->maxfd >= setsize) return AE_ERR;
-    if (aeApiResize(eventLoop,setsize) == -1) return AE_ERR;
+    if (eventLoop->api->resize(eventLoop,setsize) == -1) return AE_ERR;
 
     eventLoop->events = zrealloc(eventLoop->events,sizeof(aeFileEvent)*setsize);
     eventLoop->fired = zrealloc(eventLoop->fired,sizeof(aeFiredEvent)*setsize);
@@ -127,9 +172,24 @@ int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
 
 /* 删除事件体 */
 void aeDeleteEventLoop(aeEventLoop *eventLoop) {
-    aeApiFree(eventLoop);
+    aeTimeEvent *te, *next;
+    int j;
+
+    eventLoop->api->free(eventLoop);
     zfree(eventLoop->events);
     zfree(eventLoop->fired);
+
+    /* Free the time events. Finalizers are not called, like for file
+     * events the caller owns the client data. */
+    for (j = 0; j < eventLoop->timeEventsCount; j++)
+        zfree(eventLoop->timeEvents[j]);
+    zfree(eventLoop->timeEvents);
+    te = eventLoop->timeEventDeleted;
+    while(te) {
+        next = te->next;
+        zfree(te);
+        te = next;
+    }
     zfree(eventLoop);
 }
 
@@ -148,7 +208,7 @@ int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask,
     }
     aeFileEvent *fe = &eventLoop->events[fd];
 
-    if (aeApiAddEvent(eventLoop, fd, mask) == -1)
+    if (eventLoop->api->addEvent(eventLoop, fd, mask) == -1)
         return AE_ERR;
     fe->mask |= mask;
     if (mask & AE_READABLE) fe->rfileProc = proc;
@@ -165,7 +225,7 @@ void aeDeleteFileEvent(aeEventLoop *eventLoop, int fd, int mask)
     aeFileEvent *fe = &eventLoop->events[fd];
     if (fe->mask == AE_NONE) return;
 
-    aeApiDelEvent(eventLoop, fd, mask);
+    eventLoop->api->delEvent(eventLoop, fd, mask);
     fe->mask = fe->mask & (~mask);
     if (fd == eventLoop->maxfd && fe->mask == AE_NONE) {
         /* Update the max fd */
@@ -210,74 +270,171 @@ static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms)
     *ms = when_ms;
 }
 
-/* 创建时间事件 并添加在定时器链表的头部 */
+/* Timers are kept in a binary min-heap ordered by deadline, so that adding
+ * a timer is O(log(N)) and finding the nearest one is O(1). Every timer
+ * remembers its position in the heap in order to be removed in O(log(N)). */
+/* 定时器保存在按触发时间排序的最小堆中 */
+static int aeTimeEventBefore(aeTimeEvent *a, aeTimeEvent *b) {
+    return a->when_sec < b->when_sec ||
+           (a->when_sec == b->when_sec && a->when_ms < b->when_ms);
+}
+
+static void aeTimeHeapSet(aeEventLoop *eventLoop, int index, aeTimeEvent *te) {
+    eventLoop->timeEvents[index] = te;
+    te->index = index;
+}
+
+static void aeTimeHeapUp(aeEventLoop *eventLoop, int index) {
+    aeTimeEvent *te = eventLoop->timeEvents[index];
+
+    while(index > 0) {
+        int parent = (index-1)/2;
+        if (!aeTimeEventBefore(te,eventLoop->timeEvents[parent])) break;
+        aeTimeHeapSet(eventLoop,index,eventLoop->timeEvents[parent]);
+        index = parent;
+    }
+    aeTimeHeapSet(eventLoop,index,te);
+}
+
+static void aeTimeHeapDown(aeEventLoop *eventLoop, int index) {
+    aeTimeEvent *te = eventLoop->timeEvents[index];
+    int count = eventLoop->timeEventsCount;
+
+    while(1) {
+        int child = index*2+1;
+        if (child >= count) break;
+        if (child+1 < count &&
+            aeTimeEventBefore(eventLoop->timeEvents[child+1],
+                              eventLoop->timeEvents[child])) child++;
+        if (!aeTimeEventBefore(eventLoop->timeEvents[child],te)) break;
+        aeTimeHeapSet(eventLoop,index,eventLoop->timeEvents[child]);
+        index = child;
+    }
+    aeTimeHeapSet(eventLoop,index,te);
+}
+
+static void aeTimeHeapInsert(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    if (eventLoop->timeEventsCount == eventLoop->timeEventsSize) {
+        eventLoop->timeEventsSize = eventLoop->timeEventsSize ?
+                                    eventLoop->timeEventsSize*2 : 16;
+        eventLoop->timeEvents = zrealloc(eventLoop->timeEvents,
+            sizeof(aeTimeEvent*)*eventLoop->timeEventsSize);
+    }
+    aeTimeHeapSet(eventLoop,eventLoop->timeEventsCount++,te);
+    aeTimeHeapUp(eventLoop,te->index);
+}
+
+static void aeTimeHeapRemove(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    int index = te->index;
+    aeTimeEvent *last = eventLoop->timeEvents[--eventLoop->timeEventsCount];
+
+    te->index = -1;
+    if (last == te) return;
+    aeTimeHeapSet(eventLoop,index,last);
+    aeTimeHeapUp(eventLoop,index);
+    aeTimeHeapDown(eventLoop,last->index);
+}
+
+/* 创建时间事件 并添加到定时器堆中 */
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc)
 {
-    long long id = eventLoop->timeEventNextId++;
+    aeTimeEvent *te = aeCreateTimeEventRef(eventLoop,milliseconds,proc,
+                                           clientData,finalizerProc);
+    return te ? te->id : AE_ERR;
+}
+
+/* Like aeCreateTimeEvent(), but return the time event itself. Callers that
+ * keep it can delete it with aeDeleteTimeEventRef() without searching the
+ * heap, as long as the event did not fire with AE_NOMORE or was deleted. */
+aeTimeEvent *aeCreateTimeEventRef(aeEventLoop *eventLoop,
+        long long milliseconds, aeTimeProc *proc, void *clientData,
+        aeEventFinalizerProc *finalizerProc)
+{
     aeTimeEvent *te;
 
     te = zmalloc(sizeof(*te));
-    if (te == NULL) return AE_ERR;
-    te->id = id;
+    if (te == NULL) return NULL;
+    te->id = eventLoop->timeEventNextId++;
     aeAddMillisecondsToNow(milliseconds,&te->when_sec,&te->when_ms);
     te->timeProc = proc;
     te->finalizerProc = finalizerProc;
     te->clientData = clientData;
-    te->next = eventLoop->timeEventHead;
-    eventLoop->timeEventHead = te;
-    return id;
+    te->next = NULL;
+    aeTimeHeapInsert(eventLoop,te);
+    return te;
 }
 
-/* 删除定时器事件，将其标注为 */
+/* Delete a time event. The finalizer is called later, in the next
+ * processTimeEvents() pass, as callers may still use the client data.
+ * Timers that are running, or already fired in the current pass, are
+ * just marked as deleted and released when the pass ends.
+ *
+ * Finding the timer by ID is O(N): callers deleting many timers should
+ * keep the time event and use aeDeleteTimeEventRef(), that is O(log(N)). */
+/* 删除定时器事件，其finalizer在下次处理定时器时调用 */
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    while(te) {
-        if (te->id == id) {
-            te->id = AE_DELETED_EVENT_ID;
-            return AE_OK;
-        }
-        te = te->next;
+    aeTimeEvent *te;
+    int j;
+
+    if (id < 0) return AE_ERR;
+    for (j = 0; j < eventLoop->timeEventsCount; j++) {
+        te = eventLoop->timeEvents[j];
+        if (te->id == id) return aeDeleteTimeEventRef(eventLoop,te);
+    }
+    for (te = eventLoop->timeEventFired; te; te = te->next) {
+        if (te->id == id) return aeDeleteTimeEventRef(eventLoop,te);
     }
     return AE_ERR; /* NO event with the specified ID found */
 }
 
+/* Delete the time event 'te' returned by aeCreateTimeEventRef(). */
+int aeDeleteTimeEventRef(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    if (te->id == AE_DELETED_EVENT_ID) return AE_ERR;
+    te->id = AE_DELETED_EVENT_ID;
+    if (te->index != -1) {
+        aeTimeHeapRemove(eventLoop,te);
+        te->next = eventLoop->timeEventDeleted;
+        eventLoop->timeEventDeleted = te;
+    }
+    return AE_OK;
+}
+
 /* Search the first timer to fire.
  * This operation is useful to know how many time the select can be
  * put in sleep without to delay any event.
  * If there are no timers NULL is returned.
  *
- * Note that's O(N) since time events are unsorted.
- * Possible optimizations (not needed by Redis so far, but...):
- * 1) Insert the event in order, so that the nearest is just the head.
- *    Much better but still insertion or deletion of timers is O(N).
- * 2) Use a skiplist to have this operation as O(1) and insertion as O(log(N)).
- */
-/* 在时间事件链表中，找到离当前事件最近的事件 */
+ * This is O(1) since the timers are kept in a min-heap. */
+/* 返回离当前时间最近的定时器，即堆顶 */
 static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    aeTimeEvent *nearest = NULL;
-
-    while(te) {
-        if (!nearest || te->when_sec < nearest->when_sec ||
-                (te->when_sec == nearest->when_sec &&
-                 te->when_ms < nearest->when_ms))
-            nearest = te;
-        te = te->next;
-    }
-    return nearest;
+    if (eventLoop->timeEventsCount == 0) return NULL;
+    return eventLoop->timeEvents[0];
 }
 
 /* Process time events */
 /* 处理定时器事件 */
 static int processTimeEvents(aeEventLoop *eventLoop) {
     int processed = 0; /* 记录触发定时器的个数 */
-    aeTimeEvent *te, *prev;
+    aeTimeEvent *te, *next, *fired;
     long long maxId;
     time_t now = time(NULL); /* 当前时间 */
+    int j;
+
+    /* Call the finalizer of events deleted since the last pass. */
+    /* 释放已经被删除的定时器 */
+    te = eventLoop->timeEventDeleted;
+    eventLoop->timeEventDeleted = NULL;
+    while(te) {
+        next = te->next;
+        if (te->finalizerProc)
+            te->finalizerProc(eventLoop, te->clientData);
+        zfree(te);
+        te = next;
+    }
 
     /* If the system clock is moved to the future, and then set back to the
      * right value, time events may be delayed in a random way. Often this
@@ -286,66 +443,66 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
      * Here we try to detect system clock skews, and force all the time
      * events to be processed ASAP when this happens: the idea is that
      * processing events earlier is less dangerous than delaying them
-     * indefinitely, and practice suggests it is. */
+     * indefinitely, and practice suggests it is. Since all the deadlines
+     * become the same the heap property still holds. */
     if (now < eventLoop->lastTime) {
-        te = eventLoop->timeEventHead;
-        while(te) {
-            te->when_sec = 0;
-            te = te->next;
+        for (j = 0; j < eventLoop->timeEventsCount; j++) {
+            eventLoop->timeEvents[j]->when_sec = 0;
+            eventLoop->timeEvents[j]->when_ms = 0;
         }
     }
     eventLoop->lastTime = now; /* 更新时间戳 */
 
-    prev = NULL;
-    te = eventLoop->timeEventHead;
+    /* Every timer fired in this pass is moved to the fired list and only
+     * put back in the heap once the pass is over, so that a timer is never
+     * processed twice in the same pass, even if it is rescheduled with a
+     * zero period. Timers already in the fired list belong to an outer
+     * pass, if any, and are left alone. */
+    fired = eventLoop->timeEventFired;
     maxId = eventLoop->timeEventNextId-1;
-    while(te) {
+    while(eventLoop->timeEventsCount) {
         long now_sec, now_ms;
-        long long id;
+        int retval;
 
-        /* Remove events scheduled for deletion. */
-        /* 移除已经被标记尾删除的定时器 */
+        te = eventLoop->timeEvents[0];
+        aeGetTime(&now_sec, &now_ms); /* 获取当前时间 */
+        /* 堆顶的定时器还没到期，说明没有定时器需要触发 */
+        if (now_sec < te->when_sec ||
+            (now_sec == te->when_sec && now_ms < te->when_ms)) break;
+
+        aeTimeHeapRemove(eventLoop,te);
+        te->next = eventLoop->timeEventFired;
+        eventLoop->timeEventFired = te;
+
+        /* Make sure we don't process time events created by time events in
+         * this iteration. */
+        if (te->id > maxId) continue;
+
+        retval = te->timeProc(eventLoop, te->id, te->clientData); /* 触发事件的回调函数 */
+        processed++; /* 记录触发的定时器个数 */
+        /* 如果返回值不是AE_NOMORE 则需要重新添加该定时器 否则标记该定时器为删除状态 */
+        if (te->id == AE_DELETED_EVENT_ID) continue;
+        if (retval != AE_NOMORE) {
+            aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
+        } else {
+            te->id = AE_DELETED_EVENT_ID;
+        }
+    }
+
+    /* Put the fired timers back in the heap, or release them. */
+    te = eventLoop->timeEventFired;
+    eventLoop->timeEventFired = fired;
+    while(te != fired) {
+        next = te->next;
+        te->next = NULL;
         if (te->id == AE_DELETED_EVENT_ID) {
-            aeTimeEvent *next = te->next;
-            if (prev == NULL)
-                eventLoop->timeEventHead = te->next;
-            else
-                prev->next = te->next;
             if (te->finalizerProc)
                 te->finalizerProc(eventLoop, te->clientData);
             zfree(te);
-            te = next;
-            continue;
-        }
-
-        /* Make sure we don't process time events created by time events in
-         * this iteration. Note that this check is currently useless: we always
-         * add new timers on the head, however if we change the implementation
-         * detail, this check may be useful again: we keep it here for future
-         * defense. */
-        if (te->id > maxId) {
-            te = te->next;
-            continue;
-        }
-        aeGetTime(&now_sec, &now_ms); /* 获取当前时间 */
-        /* 当前时间大于等于定时器设置的时间 触发定时器 */
-        if (now_sec > te->when_sec ||
-            (now_sec == te->when_sec && now_ms >= te->when_ms))
-        {
-            int retval;
-
-            id = te->id;
-            retval = te->timeProc(eventLoop, id, te->clientData); /* 触发事件的回调函数 */
-            processed++; /* 记录触发的定时器个数 */
-            /* 如果返回值不是AE_NOMORE 则需要重新添加该定时器 否则标记该定时器为删除状态，下次轮询删除掉 */
-            if (retval != AE_NOMORE) {
-                aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
-            } else {
-                te->id = AE_DELETED_EVENT_ID;
-            }
+        } else {
+            aeTimeHeapInsert(eventLoop,te);
         }
-        prev = te;
-        te = te->next;
+        te = next;
     }
     return processed;
 }
@@ -422,7 +579,7 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
         /* 调用多路复用的阻塞接口，最多阻塞timeout时长，或者当有就绪事件时返回 */
         /* Call the multiplexing API, will return only on timeout or when
          * some event fires. */
-        numevents = aeApiPoll(eventLoop, tvp);
+        numevents = eventLoop->api->poll(eventLoop, tvp);
 
         /* 唤醒后的回掉函数不为空，并且设置了call的标志，则在唤醒后调用回掉函数 */
         /* After sleep callback. */
@@ -493,8 +650,53 @@ void aeMain(aeEventLoop *eventLoop) {
 }
 
 /* 获取实现 */
-char *aeGetApiName(void) {
-    return aeApiName();
+char *aeGetApiName(aeEventLoop *eventLoop) {
+    return eventLoop->api->name();
+}
+
+/* 切换到io_uring后端 */
+/* Switch the event loop to the io_uring backend. Must be called before any
+ * file event is created. Returns AE_ERR, leaving the event loop untouched,
+ * if io_uring is not supported by this build or by the running kernel. */
+int aeUseIouring(aeEventLoop *eventLoop) {
+#ifdef HAVE_IO_URING
+    void *olddata = eventLoop->apidata, *newdata;
+
+    if (eventLoop->maxfd != -1) return AE_ERR;
+    if (aeIouringApi.create(eventLoop) == -1) {
+        eventLoop->apidata = olddata;
+        return AE_ERR;
+    }
+    /* Release the old backend, that expects its own apidata. */
+    newdata = eventLoop->apidata;
+    eventLoop->apidata = olddata;
+    eventLoop->api->free(eventLoop);
+    eventLoop->apidata = newdata;
+    eventLoop->api = &aeIouringApi;
+    return AE_OK;
+#else
+    AE_NOTUSED(eventLoop);
+    return AE_ERR;
+#endif
+}
+
+/* Return true if the backend can run many reads and writes with a single
+ * system call via aeBatchIO(). */
+int aeCanBatchIO(aeEventLoop *eventLoop) {
+    return eventLoop->api->batchIO != NULL;
+}
+
+/* 批量读写 */
+/* Run the 'count' socket reads and writes described by 'reqs' at once,
+ * storing in the 'res' field of every request the number of bytes
+ * transferred or -errno. Requests never block: a socket that is not ready
+ * reports -EAGAIN. Returns AE_ERR if the batch could not be run, in that
+ * case the results are undefined and the caller should fall back to plain
+ * read(2) and write(2). */
+int aeBatchIO(aeEventLoop *eventLoop, aeIORequest *reqs, int count) {
+    if (eventLoop->api->batchIO == NULL) return AE_ERR;
+    if (count == 0) return AE_OK;
+    return eventLoop->api->batchIO(eventLoop,reqs,count);
 }
 
 /* 设置阻塞前的回调函数 */
@@ -506,3 +708,108 @@ void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep
 void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep) {
     eventLoop->aftersleep = aftersleep;
 }
+
+#ifdef REDIS_TEST
+#include <assert.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define UNUSED(x) (void)(x)
+#define TEST(name) printf("test — %s\n", name);
+
+static int aeTestReads;
+
+static void aeTestReadHandler(aeEventLoop *eventLoop, int fd, void *clientData,
+                              int mask)
+{
+    char c;
+    UNUSED(eventLoop);
+    UNUSED(clientData);
+    UNUSED(mask);
+    assert(read(fd,&c,1) == 1);
+    aeTestReads++;
+}
+
+int aeTest(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+#ifdef HAVE_IO_URING
+    aeEventLoop *el = aeCreateEventLoop(64);
+    aeIouringState *state;
+    int sv[2], j;
+
+    if (aeUseIouring(el) == AE_ERR) {
+        printf("io_uring is not supported by this kernel, skipping\n");
+        aeDeleteEventLoop(el);
+        return 0;
+    }
+    state = el->apidata;
+    assert(socketpair(AF_UNIX,SOCK_STREAM,0,sv) == 0);
+
+    TEST("io_uring: polls keep firing across the generation wrap") {
+        state->gen[sv[0]] = AE_IOURING_UD_SEQ_MASK-3;
+        assert(aeCreateFileEvent(el,sv[0],AE_READABLE,
+                                 aeTestReadHandler,NULL) == AE_OK);
+        aeTestReads = 0;
+        for (j = 0; j < 8; j++) {
+            assert(write(sv[1],"x",1) == 1);
+            aeProcessEvents(el,AE_FILE_EVENTS);
+            assert(aeTestReads == j+1);
+            assert(state->gen[sv[0]] <= AE_IOURING_UD_SEQ_MASK);
+        }
+        assert(state->gen[sv[0]] < 8);
+    }
+
+    TEST("io_uring: cancelled polls across the generation wrap") {
+        state->gen[sv[0]] = AE_IOURING_UD_SEQ_MASK-3;
+        aeTestReads = 0;
+        for (j = 0; j < 8; j++) {
+            /* Adding and removing the writable event cancels the poll. */
+            aeCreateFileEvent(el,sv[0],AE_WRITABLE,aeTestReadHandler,NULL);
+            aeDeleteFileEvent(el,sv[0],AE_WRITABLE);
+            assert(write(sv[1],"x",1) == 1);
+            aeProcessEvents(el,AE_FILE_EVENTS);
+            assert(aeTestReads == j+1);
+        }
+        aeDeleteFileEvent(el,sv[0],AE_READABLE);
+    }
+
+    TEST("io_uring: batches across the sequence number wrap") {
+        char out[3] = "abc", in[3];
+        struct iovec wiov[3], riov;
+        aeIORequest reqs[3];
+
+        state->batch_seq = AE_IOURING_UD_SEQ_MASK-2;
+        for (j = 0; j < 6; j++) {
+            int k;
+
+            for (k = 0; k < 3; k++) {
+                wiov[k].iov_base = out+k;
+                wiov[k].iov_len = 1;
+                reqs[k].fd = sv[1];
+                reqs[k].write = 1;
+                reqs[k].iov = wiov+k;
+                reqs[k].iovcnt = 1;
+            }
+            assert(aeBatchIO(el,reqs,3) == AE_OK);
+            for (k = 0; k < 3; k++) assert(reqs[k].res == 1);
+
+            riov.iov_base = in;
+            riov.iov_len = sizeof(in);
+            reqs[0].fd = sv[0];
+            reqs[0].write = 0;
+            reqs[0].iov = &riov;
+            reqs[0].iovcnt = 1;
+            assert(aeBatchIO(el,reqs,1) == AE_OK);
+            assert(reqs[0].res == 3 && memcmp(in,out,3) == 0);
+            assert(state->batch_seq <= AE_IOURING_UD_SEQ_MASK);
+        }
+    }
+
+    close(sv[0]);
+    close(sv[1]);
+    aeDeleteEventLoop(el);
+#endif
+    return 0;
+}
+#endif
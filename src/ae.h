@@ -34,6 +34,9 @@
 #define __AE_H__
 
 #include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #define AE_OK 0
 #define AE_ERR -1
@@ -80,7 +83,8 @@ typedef struct aeTimeEvent {
     aeTimeProc *timeProc; /* 时间处理器 */
     aeEventFinalizerProc *finalizerProc;
     void *clientData;
-    struct aeTimeEvent *next;
+    int index; /* Position in the timers heap, -1 if not in the heap. */ /* 在堆中的位置 */
+    struct aeTimeEvent *next; /* Link in the fired or deleted lists. */
 } aeTimeEvent;
 
 /* A fired event */
@@ -90,6 +94,17 @@ typedef struct aeFiredEvent {
     int mask;
 } aeFiredEvent;
 
+/* A socket read or write for aeBatchIO() */
+/* 批量读写请求 */
+typedef struct aeIORequest {
+    int fd;
+    int write;          /* Non zero to write 'iov', zero to read into it. */
+    struct iovec *iov;
+    int iovcnt;
+    ssize_t res;        /* Bytes transferred, or -errno. */
+    struct msghdr msg;  /* Private, used by the backend. */
+} aeIORequest;
+
 /* State of an event based program */
 /* 事件循环的主体状态 */
 typedef struct aeEventLoop {
@@ -99,11 +114,16 @@ typedef struct aeEventLoop {
     time_t lastTime;     /* Used to detect system clock skew */ /* 上次处理的时间戳 */
     aeFileEvent *events; /* Registered events */ /* 注册事件 */
     aeFiredEvent *fired; /* Fired events */ /* 触发事件 */
-    aeTimeEvent *timeEventHead;
+    aeTimeEvent **timeEvents; /* Min-heap of timers ordered by deadline */ /* 按触发时间排序的最小堆 */
+    int timeEventsCount; /* Number of timers in the heap */
+    int timeEventsSize;  /* Allocated heap slots */
+    aeTimeEvent *timeEventFired; /* Timers fired in the current pass */
+    aeTimeEvent *timeEventDeleted; /* Timers waiting for their finalizer */
     int stop; /* 标记是否结束 */
     void *apidata; /* This is used for polling API specific data */ /* 具体的实现方法的api数据 */
     aeBeforeSleepProc *beforesleep;
     aeBeforeSleepProc *aftersleep;
+    const struct aeApi *api; /* Multiplexing layer in use. */ /* 使用的多路复用层 */
 } aeEventLoop;
 
 /* Prototypes */
@@ -117,14 +137,25 @@ int aeGetFileEvents(aeEventLoop *eventLoop, int fd);
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc);
+aeTimeEvent *aeCreateTimeEventRef(aeEventLoop *eventLoop,
+        long long milliseconds, aeTimeProc *proc, void *clientData,
+        aeEventFinalizerProc *finalizerProc);
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id);
+int aeDeleteTimeEventRef(aeEventLoop *eventLoop, aeTimeEvent *te);
 int aeProcessEvents(aeEventLoop *eventLoop, int flags);
 int aeWait(int fd, int mask, long long milliseconds);
 void aeMain(aeEventLoop *eventLoop);
-char *aeGetApiName(void);
+char *aeGetApiName(aeEventLoop *eventLoop);
+int aeUseIouring(aeEventLoop *eventLoop);
+int aeCanBatchIO(aeEventLoop *eventLoop);
+int aeBatchIO(aeEventLoop *eventLoop, aeIORequest *reqs, int count);
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
 void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep);
 int aeGetSetSize(aeEventLoop *eventLoop);
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
 
+#ifdef REDIS_TEST
+int aeTest(int argc, char *argv[]);
+#endif
+
 #endif
@@ -0,0 +1,594 @@
+/* Linux io_uring based ae.c module
+ *
+ * io_uring 事件循环后端: 文件描述符的可读可写状态通过一次性的 POLL_ADD 请求
+ * 获得, 所有的注册, 修改, 删除以及重新注册都在下一次等待时与等待本身合并为一次
+ * io_uring_enter() 系统调用. 此外 aeBatchIO() 可以用一次系统调用完成多个客户端
+ * 的读写.
+ *
+ * Readiness is obtained with one shot IORING_OP_POLL_ADD requests: adding,
+ * modifying and removing events, as well as arming again the descriptors
+ * that fired in the previous iteration, only queues submissions, that are
+ * sent to the kernel together with the wait for new completions in a single
+ * io_uring_enter() call per event loop iteration. Level triggered semantics
+ * are preserved since a descriptor is polled again after its handlers ran.
+ *
+ * On top of that aeIouringBatchIO() runs the reads and writes of many
+ * clients with a single system call, see aeBatchIO() in ae.c.
+ *
+ * The ring is driven directly with the io_uring_setup(2) and
+ * io_uring_enter(2) system calls, so no external library is needed. The
+ * backend requires IORING_FEAT_NODROP and IORING_FEAT_EXT_ARG (Linux 5.11):
+ * when they are missing aeIouringCreate() fails and the caller keeps the
+ * default backend.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#define AE_IOURING_SQ_ENTRIES 4096
+#define AE_IOURING_CQ_MAX_ENTRIES 65536
+
+/* Consecutive io_uring_enter() failures after which aeIouringBatchIO()
+ * gives up on the requests that did not complete. */
+#define AE_IOURING_BATCH_RETRIES 16
+
+/* Result of the batch requests still waiting for their completion: cqe->res
+ * is a 32 bit value, so this can't be a real result. */
+#define AE_IOURING_RES_PENDING ((ssize_t)INT32_MIN-1)
+
+/* The user_data of a completion tells what it refers to: polls carry the
+ * file descriptor and its generation, so that the completions of polls
+ * that were later modified or removed can be recognized and dropped.
+ * Requests of aeIouringBatchIO() carry their index in the batch and the
+ * sequence number of the batch, so that completions of a batch we gave up
+ * on are dropped too. Generations and sequence numbers wrap at 30 bits:
+ * they are stored in bits 32-61, and must never reach the tag bits. */
+#define AE_IOURING_UD_BATCH (1ULL<<63)
+#define AE_IOURING_UD_REMOVE (1ULL<<62)
+#define AE_IOURING_UD_SEQ_MASK ((1U<<30)-1)
+#define AE_IOURING_UD_POLL(fd,gen) \
+    (((uint64_t)((gen)&AE_IOURING_UD_SEQ_MASK)<<32)|(uint32_t)(fd))
+#define AE_IOURING_UD_BATCHREQ(seq,j) \
+    (AE_IOURING_UD_BATCH|AE_IOURING_UD_POLL(j,seq))
+#define AE_IOURING_UD_SEQ(ud) \
+    ((uint32_t)((ud)>>32) & AE_IOURING_UD_SEQ_MASK)
+
+typedef struct aeIouringState {
+    int ringfd;
+    /* Submission queue. */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries, sq_pending;
+    struct io_uring_sqe *sqes;
+    /* Completion queue. */
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    /* Per file descriptor poll state. */
+    int *armed;             /* Mask of the pending poll, AE_NONE if none. */
+    uint32_t *gen;          /* Generation of the pending poll (30 bits). */
+    int *rearm;             /* Descriptors that fired, to poll again. */
+    int rearm_count;
+    char *inrearm;          /* Is the descriptor already in 'rearm'? */
+    aeFiredEvent *stash;    /* Events harvested while waiting for a batch. */
+    int stash_count, stash_size;
+    uint32_t batch_seq;     /* Sequence number of the last batch (30 bits). */
+    int setsize;            /* Size of the per descriptor arrays. */
+    int forks;              /* aeIouringForks when the ring was created. */
+} aeIouringState;
+
+/* The rings are shared memory: after fork() a child process that uses the
+ * event loop must not touch the ring of the parent, so we count the forks
+ * and the child switches to a private ring, see aeIouringGetState(). */
+static volatile int aeIouringForks = 0;
+static pthread_once_t aeIouringAtForkOnce = PTHREAD_ONCE_INIT;
+
+static void aeIouringAtForkChild(void) {
+    aeIouringForks++;
+}
+
+static void aeIouringRegisterAtFork(void) {
+    pthread_atfork(NULL,NULL,aeIouringAtForkChild);
+}
+
+static int aeIouringSetup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup,entries,p);
+}
+
+static int aeIouringEnter(int ringfd, unsigned to_submit,
+                          unsigned min_complete, unsigned flags,
+                          void *arg, size_t argsz)
+{
+    return (int) syscall(__NR_io_uring_enter,ringfd,to_submit,min_complete,
+                         flags,arg,argsz);
+}
+
+static void aeIouringUnmap(aeIouringState *state) {
+    if (state->sqes) munmap(state->sqes,state->sqes_size);
+    if (state->cq_ring && state->cq_ring != state->sq_ring)
+        munmap(state->cq_ring,state->cq_ring_size);
+    if (state->sq_ring) munmap(state->sq_ring,state->sq_ring_size);
+}
+
+static int aeIouringResize(aeEventLoop *eventLoop, int setsize) {
+    aeIouringState *state = eventLoop->apidata;
+    int j, k;
+
+    /* Forget the descriptors that don't fit anymore. */
+    for (j = 0, k = 0; j < state->rearm_count; j++)
+        if (state->rearm[j] < setsize) state->rearm[k++] = state->rearm[j];
+    state->rearm_count = k;
+    for (j = 0, k = 0; j < state->stash_count; j++)
+        if (state->stash[j].fd < setsize) state->stash[k++] = state->stash[j];
+    state->stash_count = k;
+    state->armed = zrealloc(state->armed,sizeof(int)*setsize);
+    state->gen = zrealloc(state->gen,sizeof(uint32_t)*setsize);
+    state->rearm = zrealloc(state->rearm,sizeof(int)*setsize);
+    state->inrearm = zrealloc(state->inrearm,setsize);
+    for (j = state->setsize; j < setsize; j++) {
+        state->armed[j] = AE_NONE;
+        state->gen[j] = 0;
+        state->inrearm[j] = 0;
+    }
+    state->setsize = setsize;
+    return 0;
+}
+
+static int aeIouringCreate(aeEventLoop *eventLoop) {
+    aeIouringState *state = zcalloc(sizeof(aeIouringState));
+    struct io_uring_params p;
+    unsigned cq_entries = AE_IOURING_SQ_ENTRIES;
+    int j;
+
+    /* Every descriptor has at most one pending poll, plus the completions
+     * of the requests that cancel them. The kernel refuses completion
+     * queues smaller than the submission queue. */
+    while (cq_entries < (unsigned)eventLoop->setsize*2 &&
+           cq_entries < AE_IOURING_CQ_MAX_ENTRIES) cq_entries <<= 1;
+    pthread_once(&aeIouringAtForkOnce,aeIouringRegisterAtFork);
+    state->forks = aeIouringForks;
+    memset(&p,0,sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+    state->ringfd = aeIouringSetup(AE_IOURING_SQ_ENTRIES,&p);
+    if (state->ringfd == -1) goto err;
+    if (!(p.features & IORING_FEAT_NODROP) ||
+        !(p.features & IORING_FEAT_EXT_ARG)) goto err;
+
+    state->sq_ring_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    state->cq_ring_size = p.cq_off.cqes +
+                          p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (state->cq_ring_size > state->sq_ring_size)
+            state->sq_ring_size = state->cq_ring_size;
+        state->cq_ring_size = state->sq_ring_size;
+    }
+    state->sq_ring = mmap(NULL,state->sq_ring_size,PROT_READ|PROT_WRITE,
+                          MAP_SHARED|MAP_POPULATE,state->ringfd,
+                          IORING_OFF_SQ_RING);
+    if (state->sq_ring == MAP_FAILED) {
+        state->sq_ring = NULL;
+        goto err;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        state->cq_ring = state->sq_ring;
+    } else {
+        state->cq_ring = mmap(NULL,state->cq_ring_size,PROT_READ|PROT_WRITE,
+                              MAP_SHARED|MAP_POPULATE,state->ringfd,
+                              IORING_OFF_CQ_RING);
+        if (state->cq_ring == MAP_FAILED) {
+            state->cq_ring = NULL;
+            goto err;
+        }
+    }
+    state->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL,state->sqes_size,PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE,state->ringfd,
+                       IORING_OFF_SQES);
+    if (state->sqes == MAP_FAILED) {
+        state->sqes = NULL;
+        goto err;
+    }
+
+    state->sq_head = (unsigned*)((char*)state->sq_ring + p.sq_off.head);
+    state->sq_tail = (unsigned*)((char*)state->sq_ring + p.sq_off.tail);
+    state->sq_mask = (unsigned*)((char*)state->sq_ring + p.sq_off.ring_mask);
+    state->sq_array = (unsigned*)((char*)state->sq_ring + p.sq_off.array);
+    state->sq_entries = p.sq_entries;
+    state->cq_head = (unsigned*)((char*)state->cq_ring + p.cq_off.head);
+    state->cq_tail = (unsigned*)((char*)state->cq_ring + p.cq_off.tail);
+    state->cq_mask = (unsigned*)((char*)state->cq_ring + p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe*)((char*)state->cq_ring +
+                                         p.cq_off.cqes);
+    /* The index array never changes: slot N always uses the N-th sqe. */
+    for (j = 0; j < (int)p.sq_entries; j++) state->sq_array[j] = j;
+
+    eventLoop->apidata = state;
+    aeIouringResize(eventLoop,eventLoop->setsize);
+    return 0;
+
+err:
+    aeIouringUnmap(state);
+    if (state->ringfd != -1) close(state->ringfd);
+    zfree(state);
+    return -1;
+}
+
+static void aeIouringFree(aeEventLoop *eventLoop) {
+    aeIouringState *state = eventLoop->apidata;
+
+    aeIouringUnmap(state);
+    close(state->ringfd);
+    zfree(state->armed);
+    zfree(state->gen);
+    zfree(state->rearm);
+    zfree(state->inrearm);
+    zfree(state->stash);
+    zfree(state);
+}
+
+static void aeIouringQueuePoll(aeIouringState *state, int fd, int mask);
+
+/* Return the state of the event loop. In a child process that forked after
+ * the ring was created, create a private ring and poll again the registered
+ * descriptors first. */
+static aeIouringState *aeIouringGetState(aeEventLoop *eventLoop) {
+    aeIouringState *state = eventLoop->apidata;
+    int fd;
+
+    if (state->forks == aeIouringForks) return state;
+    aeIouringFree(eventLoop);
+    if (aeIouringCreate(eventLoop) == -1) {
+        /* Without a ring the child can't serve its clients. */
+        fprintf(stderr,"Can't create an io_uring instance after fork\n");
+        _exit(1);
+    }
+    state = eventLoop->apidata;
+    for (fd = 0; fd <= eventLoop->maxfd; fd++) {
+        if (eventLoop->events[fd].mask != AE_NONE)
+            aeIouringQueuePoll(state,fd,eventLoop->events[fd].mask);
+    }
+    return state;
+}
+
+/* Send the queued submissions to the kernel without waiting. */
+static void aeIouringFlush(aeIouringState *state) {
+    while (state->sq_pending) {
+        int ret = aeIouringEnter(state->ringfd,state->sq_pending,0,0,NULL,0);
+
+        if (ret >= 0) {
+            state->sq_pending -= ret;
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            break;
+        }
+    }
+}
+
+/* Return a cleared submission queue entry, flushing the queue if full. */
+static struct io_uring_sqe *aeIouringGetSqe(aeIouringState *state) {
+    unsigned tail = *state->sq_tail;
+    struct io_uring_sqe *sqe;
+
+    if (tail - __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE) ==
+        state->sq_entries)
+    {
+        aeIouringFlush(state);
+    }
+    sqe = state->sqes + (tail & *state->sq_mask);
+    memset(sqe,0,sizeof(*sqe));
+    __atomic_store_n(state->sq_tail,tail+1,__ATOMIC_RELEASE);
+    state->sq_pending++;
+    return sqe;
+}
+
+static void aeIouringQueuePoll(aeIouringState *state, int fd, int mask) {
+    struct io_uring_sqe *sqe;
+    uint32_t events = 0;
+
+    if (mask & AE_READABLE) events |= POLLIN;
+    if (mask & AE_WRITABLE) events |= POLLOUT;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    events = (events << 16) | (events >> 16);
+#endif
+    /* The sqe is filled after aeIouringGetSqe() advanced the tail, that is
+     * fine since the kernel only reads it on the next io_uring_enter(). */
+    sqe = aeIouringGetSqe(state);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = AE_IOURING_UD_POLL(fd,state->gen[fd]);
+    state->armed[fd] = mask;
+}
+
+/* Cancel the pending poll of 'fd', if any. Its completion, if already
+ * generated, is dropped thanks to the new generation. */
+static void aeIouringCancelPoll(aeIouringState *state, int fd) {
+    struct io_uring_sqe *sqe;
+
+    if (state->armed[fd] != AE_NONE) {
+        sqe = aeIouringGetSqe(state);
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = AE_IOURING_UD_POLL(fd,state->gen[fd]);
+        sqe->user_data = AE_IOURING_UD_REMOVE;
+        state->armed[fd] = AE_NONE;
+    }
+    state->gen[fd] = (state->gen[fd]+1) & AE_IOURING_UD_SEQ_MASK;
+}
+
+static int aeIouringAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeIouringState *state = aeIouringGetState(eventLoop);
+
+    mask |= eventLoop->events[fd].mask; /* Merge old events */
+    if (state->armed[fd] == mask) return 0;
+    aeIouringCancelPoll(state,fd);
+    aeIouringQueuePoll(state,fd,mask);
+    return 0;
+}
+
+static void aeIouringDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeIouringState *state = aeIouringGetState(eventLoop);
+    int mask = eventLoop->events[fd].mask & (~delmask);
+
+    aeIouringCancelPoll(state,fd);
+    if (mask != AE_NONE) {
+        aeIouringQueuePoll(state,fd,mask);
+    } else {
+        /* A pending poll holds a reference to the file: cancel it now, so
+         * that the socket is really closed as soon as the caller closes the
+         * descriptor, like with the other backends. */
+        aeIouringFlush(state);
+    }
+}
+
+/* Consume the completion of a poll, storing the event in 'fired' if it
+ * still refers to the current poll of the descriptor. Returns 1 if an event
+ * was stored. */
+static int aeIouringPollCompleted(aeIouringState *state,
+                                  struct io_uring_cqe *cqe,
+                                  aeFiredEvent *fired)
+{
+    int fd = (int)(uint32_t)cqe->user_data;
+    uint32_t gen = AE_IOURING_UD_SEQ(cqe->user_data);
+    int mask = 0;
+
+    /* Completions of polls that were modified or removed, possibly of a
+     * descriptor past a reduced set size, are dropped. */
+    if (fd >= state->setsize || gen != state->gen[fd] ||
+        state->armed[fd] == AE_NONE) return 0;
+    if (cqe->res < 0) {
+        /* Report the error to both handlers, they'll see it on I/O. */
+        mask = state->armed[fd];
+    } else {
+        if (cqe->res & POLLIN) mask |= AE_READABLE;
+        if (cqe->res & POLLOUT) mask |= AE_WRITABLE;
+        if (cqe->res & POLLERR) mask |= AE_WRITABLE;
+        if (cqe->res & POLLHUP) mask |= AE_WRITABLE;
+    }
+    state->armed[fd] = AE_NONE;
+    state->gen[fd] = (state->gen[fd]+1) & AE_IOURING_UD_SEQ_MASK;
+    if (!state->inrearm[fd]) {
+        state->inrearm[fd] = 1;
+        state->rearm[state->rearm_count++] = fd;
+    }
+    fired->fd = fd;
+    fired->mask = mask;
+    return 1;
+}
+
+/* Poll again the descriptors that fired in the previous iteration and are
+ * still registered: this keeps epoll's level triggered semantics. */
+static void aeIouringRearm(aeEventLoop *eventLoop) {
+    aeIouringState *state = eventLoop->apidata;
+    int j;
+
+    for (j = 0; j < state->rearm_count; j++) {
+        int fd = state->rearm[j], mask;
+
+        state->inrearm[fd] = 0;
+        mask = eventLoop->events[fd].mask;
+        if (mask != AE_NONE && state->armed[fd] == AE_NONE)
+            aeIouringQueuePoll(state,fd,mask);
+    }
+    state->rearm_count = 0;
+}
+
+static int aeIouringPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeIouringState *state = aeIouringGetState(eventLoop);
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned head, tail, min_complete;
+    int numevents = 0, ret;
+
+    aeIouringRearm(eventLoop);
+
+    /* Events harvested by aeIouringBatchIO() come first. What doesn't fit
+     * is kept for the next call. */
+    numevents = state->stash_count < eventLoop->setsize ?
+                state->stash_count : eventLoop->setsize;
+    if (numevents) {
+        memcpy(eventLoop->fired,state->stash,sizeof(aeFiredEvent)*numevents);
+        state->stash_count -= numevents;
+        memmove(state->stash,state->stash+numevents,
+                sizeof(aeFiredEvent)*state->stash_count);
+    }
+
+    /* Submit and wait with a single system call. Don't wait if we already
+     * have something to report. */
+    memset(&arg,0,sizeof(arg));
+    if (tvp) {
+        ts.tv_sec = tvp->tv_sec;
+        ts.tv_nsec = tvp->tv_usec*1000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    min_complete = numevents == 0 &&
+                   (tvp == NULL || tvp->tv_sec || tvp->tv_usec);
+    ret = aeIouringEnter(state->ringfd,state->sq_pending,min_complete,
+                         IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,
+                         &arg,sizeof(arg));
+    if (ret >= 0) state->sq_pending -= ret;
+
+    /* Harvest. Completions past the set size are left in the ring for the
+     * next call. */
+    head = *state->cq_head;
+    tail = __atomic_load_n(state->cq_tail,__ATOMIC_ACQUIRE);
+    while (head != tail && numevents < eventLoop->setsize) {
+        struct io_uring_cqe *cqe = state->cqes + (head & *state->cq_mask);
+
+        if (!(cqe->user_data & (AE_IOURING_UD_BATCH|AE_IOURING_UD_REMOVE)))
+            numevents += aeIouringPollCompleted(state,cqe,
+                                                eventLoop->fired+numevents);
+        head++;
+    }
+    __atomic_store_n(state->cq_head,head,__ATOMIC_RELEASE);
+    return numevents;
+}
+
+/* Store the event of a poll completion harvested by aeIouringBatchIO(),
+ * growing the stash if needed: dropping it would leave the descriptor
+ * without a pending poll. */
+static void aeIouringStashCompleted(aeIouringState *state,
+                                    struct io_uring_cqe *cqe)
+{
+    if (state->stash_count == state->stash_size) {
+        state->stash_size = state->stash_size ? state->stash_size*2 : 64;
+        state->stash = zrealloc(state->stash,
+                                sizeof(aeFiredEvent)*state->stash_size);
+    }
+    state->stash_count +=
+        aeIouringPollCompleted(state,cqe,state->stash+state->stash_count);
+}
+
+/* Run the 'count' reads and writes in 'reqs' with a single system call,
+ * waiting for all of them. Sockets are never waited for: like a non
+ * blocking read or write, a request returns -EAGAIN if the socket is not
+ * ready.
+ *
+ * If io_uring_enter() keeps failing, the requests the kernel didn't see are
+ * taken back and performed with plain readv(2) and writev(2), and the ones
+ * it saw but did not complete yet fail with the error of io_uring_enter().
+ * Their late completions are dropped thanks to the batch sequence number. */
+static int aeIouringBatchIO(aeEventLoop *eventLoop, aeIORequest *reqs,
+                            int count)
+{
+    aeIouringState *state = aeIouringGetState(eventLoop);
+    int j, done = 0, failures = 0;
+    uint32_t seq;
+
+    state->batch_seq = (state->batch_seq+1) & AE_IOURING_UD_SEQ_MASK;
+    seq = state->batch_seq;
+    for (j = 0; j < count; j++) {
+        aeIORequest *req = reqs+j;
+        struct io_uring_sqe *sqe = aeIouringGetSqe(state);
+
+        memset(&req->msg,0,sizeof(req->msg));
+        req->msg.msg_iov = req->iov;
+        req->msg.msg_iovlen = req->iovcnt;
+        sqe->opcode = req->write ? IORING_OP_SENDMSG : IORING_OP_RECVMSG;
+        sqe->fd = req->fd;
+        sqe->addr = (uint64_t)(uintptr_t)&req->msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_DONTWAIT;
+        sqe->user_data = AE_IOURING_UD_BATCHREQ(seq,j);
+        req->res = AE_IOURING_RES_PENDING;
+    }
+
+    while (done < count) {
+        unsigned head, tail;
+        int ret;
+
+        ret = aeIouringEnter(state->ringfd,state->sq_pending,count-done,
+                             IORING_ENTER_GETEVENTS,NULL,0);
+        if (ret >= 0) {
+            state->sq_pending -= ret;
+            failures = 0;
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            /* If the kernel didn't see the requests yet we can take them
+             * back, so that the caller can perform them on its own. */
+            if (done == 0 && state->sq_pending >= (unsigned)count) {
+                __atomic_store_n(state->sq_tail,*state->sq_tail-count,
+                                 __ATOMIC_RELEASE);
+                state->sq_pending -= count;
+                return AE_ERR;
+            }
+            if (++failures == AE_IOURING_BATCH_RETRIES) break;
+        }
+
+        head = *state->cq_head;
+        tail = __atomic_load_n(state->cq_tail,__ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe *cqe = state->cqes + (head & *state->cq_mask);
+
+            if (cqe->user_data & AE_IOURING_UD_BATCH) {
+                j = (int)(uint32_t)cqe->user_data;
+                if (AE_IOURING_UD_SEQ(cqe->user_data) == seq &&
+                    j < count && reqs[j].res == AE_IOURING_RES_PENDING)
+                {
+                    reqs[j].res = cqe->res;
+                    done++;
+                }
+            } else if (!(cqe->user_data & AE_IOURING_UD_REMOVE)) {
+                aeIouringStashCompleted(state,cqe);
+            }
+            head++;
+        }
+        __atomic_store_n(state->cq_head,head,__ATOMIC_RELEASE);
+    }
+
+    if (done < count) {
+        int err = errno;
+        /* The last 'sq_pending' submissions are ours and were never seen by
+         * the kernel: take them back and perform them here. */
+        unsigned taken = state->sq_pending < (unsigned)count ?
+                         state->sq_pending : (unsigned)count;
+
+        __atomic_store_n(state->sq_tail,*state->sq_tail-taken,
+                         __ATOMIC_RELEASE);
+        state->sq_pending -= taken;
+        for (j = 0; j < count; j++) {
+            aeIORequest *req = reqs+j;
+            ssize_t nbytes;
+
+            if (req->res != AE_IOURING_RES_PENDING) continue;
+            if (j < count-(int)taken) {
+                req->res = -err;
+                continue;
+            }
+            nbytes = req->write ? writev(req->fd,req->iov,req->iovcnt) :
+                                  readv(req->fd,req->iov,req->iovcnt);
+            req->res = nbytes < 0 ? -errno : nbytes;
+        }
+    }
+    return AE_OK;
+}
+
+static char *aeIouringName(void) {
+    return "io_uring";
+}
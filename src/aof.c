@@ -42,6 +42,11 @@
 
 void aofUpdateCurrentSize(void);
 void aofClosePipes(void);
+static sds aofFilePath(sds file_name);
+static void aofUpdateMultiPartSize(void);
+static int aofRewriteOpenIncrFile(void);
+static void aofRewriteDropIncrFile(void);
+static int aofRewriteInstallBase(char *tmpfile);
 
 /* ----------------------------------------------------------------------------
  * AOF rewrite buffer implementation.
@@ -206,10 +211,16 @@ void aof_background_fsync(int fd) {
 /* Called when the user switches from "appendonly yes" to "appendonly no"
  * at runtime using the CONFIG command. */
 void stopAppendOnly(void) {
+    int old_aof_state = server.aof_state;
+
     serverAssert(server.aof_state != AOF_OFF);
-    flushAppendOnlyFile(1);
-    aof_fsync(server.aof_fd);
-    close(server.aof_fd);
+    /* With the multi part AOF the file is only opened when the first rewrite
+     * starts. */
+    if (server.aof_fd != -1) {
+        flushAppendOnlyFile(1);
+        aof_fsync(server.aof_fd);
+        close(server.aof_fd);
+    }
 
     server.aof_fd = -1;
     server.aof_selected_db = -1;
@@ -228,8 +239,15 @@ void stopAppendOnly(void) {
         aofRemoveTempFile(server.aof_child_pid);
         server.aof_child_pid = -1;
         server.aof_rewrite_time_start = -1;
-        /* close pipes used for IPC between the two processes. */
-        aofClosePipes();
+        if (server.aof_multi_part) {
+            /* The incr file opened for the first rewrite is not listed in
+             * the manifest: nothing refers to it any longer. */
+            if (old_aof_state == AOF_WAIT_REWRITE) aofRewriteDropIncrFile();
+            server.aof_rewrite_incr_seq = -1;
+        } else {
+            /* close pipes used for IPC between the two processes. */
+            aofClosePipes();
+        }
     }
 }
 
@@ -237,34 +255,39 @@ void stopAppendOnly(void) {
  * at runtime using the CONFIG command. */
 int startAppendOnly(void) {
     char cwd[MAXPATHLEN]; /* Current working dir path for error messages. */
-    int newfd;
+    int newfd = -1;
 
-    newfd = open(server.aof_filename,O_WRONLY|O_APPEND|O_CREAT,0644);
     serverAssert(server.aof_state == AOF_OFF);
-    if (newfd == -1) {
-        char *cwdp = getcwd(cwd,MAXPATHLEN);
+    /* The multi part AOF opens a new incr file when the rewrite starts. */
+    if (!server.aof_multi_part) {
+        newfd = open(server.aof_filename,O_WRONLY|O_APPEND|O_CREAT,0644);
+        if (newfd == -1) {
+            char *cwdp = getcwd(cwd,MAXPATHLEN);
 
-        serverLog(LL_WARNING,
-            "Redis needs to enable the AOF but can't open the "
-            "append only file %s (in server root dir %s): %s",
-            server.aof_filename,
-            cwdp ? cwdp : "unknown",
-            strerror(errno));
-        return C_ERR;
+            serverLog(LL_WARNING,
+                "Redis needs to enable the AOF but can't open the "
+                "append only file %s (in server root dir %s): %s",
+                server.aof_filename,
+                cwdp ? cwdp : "unknown",
+                strerror(errno));
+            return C_ERR;
+        }
     }
+    /* We switch on AOF, and wait for the rewrite to be complete in order to
+     * append data on disk. The state is set before the rewrite starts since
+     * the multi part AOF checks it to open the incr file. */
+    server.aof_state = AOF_WAIT_REWRITE;
     if (server.rdb_child_pid != -1) {
         server.aof_rewrite_scheduled = 1;
         serverLog(LL_WARNING,"AOF was enabled but there is already a child process saving an RDB file on disk. An AOF background was scheduled to start when possible.");
     } else if (rewriteAppendOnlyFileBackground() == C_ERR) {
-        close(newfd);
+        server.aof_state = AOF_OFF;
+        if (newfd != -1) close(newfd);
         serverLog(LL_WARNING,"Redis needs to enable the AOF but can't trigger a background AOF rewrite operation. Check the above logs for more info about the error.");
         return C_ERR;
     }
-    /* We correctly switched on AOF, now wait for the rewrite to be complete
-     * in order to append data on disk. */
-    server.aof_state = AOF_WAIT_REWRITE;
     server.aof_last_fsync = server.unixtime;
-    server.aof_fd = newfd;
+    if (!server.aof_multi_part) server.aof_fd = newfd;
     return C_OK;
 }
 
@@ -398,7 +421,11 @@ void flushAppendOnlyFile(int force) {
                                        (long long)sdslen(server.aof_buf));
             }
 
-            if (ftruncate(server.aof_fd, server.aof_current_size) == -1) {
+            off_t fd_size = server.aof_multi_part ?
+                            server.aof_last_incr_size :
+                            server.aof_current_size;
+
+            if (ftruncate(server.aof_fd, fd_size) == -1) {
                 if (can_log) {
                     serverLog(LL_WARNING, "Could not remove short write "
                              "from the append-only file.  Redis may refuse "
@@ -431,6 +458,7 @@ void flushAppendOnlyFile(int force) {
              * was no way to undo it with ftruncate(2). */
             if (nwritten > 0) {
                 server.aof_current_size += nwritten;
+                server.aof_last_incr_size += nwritten;
                 sdsrange(server.aof_buf,nwritten,-1);
             }
             return; /* We'll try again on the next call... */
@@ -445,6 +473,7 @@ void flushAppendOnlyFile(int force) {
         }
     }
     server.aof_current_size += nwritten;
+    server.aof_last_incr_size += nwritten;
 
     /* Re-use AOF buffer when it is small enough. The maximum comes from the
      * arena size of 4k minus some overhead (but is otherwise arbitrary). */
@@ -592,14 +621,18 @@ void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int a
     /* Append to the AOF buffer. This will be flushed on disk just before
      * of re-entering the event loop, so before the client will get a
      * positive reply about the operation performed. */
-    if (server.aof_state == AOF_ON)
+    if (server.aof_state == AOF_ON ||
+        (server.aof_multi_part && server.aof_fd != -1))
         server.aof_buf = sdscatlen(server.aof_buf,buf,sdslen(buf));
 
     /* If a background append only file rewriting is in progress we want to
      * accumulate the differences between the child DB and the current one
      * in a buffer, so that when the child process will do its work we
-     * can append the differences to the new append only file. */
-    if (server.aof_child_pid != -1)
+     * can append the differences to the new append only file.
+     *
+     * The multi part AOF doesn't need it: the differences are the incr file
+     * opened when the rewrite started, that is kept after the new base. */
+    if (server.aof_child_pid != -1 && !server.aof_multi_part)
         aofRewriteBufferAppend((unsigned char*)buf,sdslen(buf));
 
     sdsfree(buf);
@@ -622,17 +655,21 @@ struct client *createFakeClient(void) {
     c->argc = 0;
     c->argv = NULL;
     c->bufpos = 0;
+    c->buf_usable_size = 0;
+    c->buf_peak = 0;
+    c->buf = NULL;
     c->flags = 0;
     c->btype = BLOCKED_NONE;
     /* We set the fake client as a slave waiting for the synchronization
      * so that Redis will not try to send replies to this client. */
     c->replstate = SLAVE_STATE_WAIT_BGSAVE_START;
     c->reply = listCreate();
+    c->reply_unref = NULL;
     c->reply_bytes = 0;
     c->obuf_soft_limit_reached_time = 0;
     c->watched_keys = listCreate();
     c->peerid = NULL;
-    listSetFreeMethod(c->reply,decrRefCountVoid);
+    listSetFreeMethod(c->reply,freeClientReplyValue);
     listSetDupMethod(c->reply,dupClientReplyValue);
     initClientMultiState(c);
     return c;
@@ -656,8 +693,12 @@ void freeFakeClient(struct client *c) {
 
 /* Replay the append log file. On success C_OK is returned. On non fatal
  * error (the append only file is zero-length) C_ERR is returned. On
- * fatal error an error message is logged and the program exists. */
-int loadAppendOnlyFile(char *filename) {
+ * fatal error an error message is logged and the program exists.
+ *
+ * 'last' is false for the files of a multi part AOF that are followed by
+ * other files: those can't be truncated when aof-load-truncated is set,
+ * since the commands of the next files depend on the missing ones. */
+static int loadAppendOnlyFile(char *filename, int last) {
     struct client *fakeClient;
     FILE *fp = fopen(filename,"r");
     struct redis_stat sb;
@@ -805,7 +846,7 @@ readerr: /* Read error. If feof(fp) is true, fall through to unexpected EOF. */
     }
 
 uxeof: /* Unexpected AOF end of file. */
-    if (server.aof_load_truncated) {
+    if (server.aof_load_truncated && last) {
         serverLog(LL_WARNING,"!!! Warning: short read while loading the AOF file !!!");
         serverLog(LL_WARNING,"!!! Truncating the AOF at offset %llu !!!",
             (unsigned long long) valid_up_to);
@@ -839,6 +880,39 @@ fmterr: /* Format error. */
     exit(1);
 }
 
+/* Load the AOF: the single append only file, or the files listed in the
+ * manifest of the multi part AOF, that are replayed one after the other.
+ * Returns C_OK if something was loaded, C_ERR if the AOF is empty. Fatal
+ * errors are handled like in loadAppendOnlyFile(). */
+int loadAppendOnlyFiles(void) {
+    aofManifest *am = server.aof_manifest;
+    int loaded = 0, left;
+    listIter li;
+    listNode *ln;
+    sds path;
+
+    if (!server.aof_multi_part)
+        return loadAppendOnlyFile(server.aof_filename,1);
+
+    left = (am->base != NULL) + listLength(am->incr_list);
+    if (am->base) {
+        path = aofFilePath(am->base->file_name);
+        if (loadAppendOnlyFile(path,--left == 0) == C_OK) loaded = 1;
+        sdsfree(path);
+    }
+    listRewind(am->incr_list,&li);
+    while((ln = listNext(&li))) {
+        aofInfo *ai = listNodeValue(ln);
+
+        path = aofFilePath(ai->file_name);
+        if (loadAppendOnlyFile(path,--left == 0) == C_OK) loaded = 1;
+        sdsfree(path);
+    }
+    aofUpdateCurrentSize();
+    server.aof_rewrite_base_size = server.aof_current_size;
+    return loaded ? C_OK : C_ERR;
+}
+
 /* ----------------------------------------------------------------------------
  * AOF rewrite
  * ------------------------------------------------------------------------- */
@@ -913,6 +987,24 @@ int rewriteSetObject(rio *r, robj *key, robj *o) {
             if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
         }
+    } else if (o->encoding == OBJ_ENCODING_ROARING) {
+        roaringIterator ri;
+        int64_t llval;
+
+        roaringInitIterator(o->ptr,&ri);
+        while(roaringNext(&ri,&llval)) {
+            if (count == 0) {
+                int cmd_items = (items > AOF_REWRITE_ITEMS_PER_CMD) ?
+                    AOF_REWRITE_ITEMS_PER_CMD : items;
+
+                if (rioWriteBulkCount(r,'*',2+cmd_items) == 0) return 0;
+                if (rioWriteBulkString(r,"SADD",4) == 0) return 0;
+                if (rioWriteBulkObject(r,key) == 0) return 0;
+            }
+            if (rioWriteBulkLongLong(r,llval) == 0) return 0;
+            if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
+            items--;
+        }
     } else if (o->encoding == OBJ_ENCODING_HT) {
         dictIterator *di = dictGetIterator(o->ptr);
         dictEntry *de;
@@ -943,7 +1035,7 @@ int rewriteSetObject(rio *r, robj *key, robj *o) {
 int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
     long long count = 0, items = zsetLength(o);
 
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = o->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -951,13 +1043,13 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
         long long vll;
         double score;
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         serverAssert(eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
 
         while (eptr != NULL) {
-            serverAssert(ziplistGet(eptr,&vstr,&vlen,&vll));
+            vstr = lpGetValue(eptr,&vlen,&vll);
             score = zzlGetScore(sptr);
 
             if (count == 0) {
@@ -978,14 +1070,16 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
             if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
         }
-    } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (o->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = o->ptr;
-        dictIterator *di = dictGetIterator(zs->dict);
-        dictEntry *de;
+        zbtCursor cur;
+        int valid = zbtFirst(zs->zbt,&cur);
 
-        while((de = dictNext(di)) != NULL) {
-            sds ele = dictGetKey(de);
-            double *score = dictGetVal(de);
+        /* Emit the members in score order: reloading the file appends to
+         * the tree, which fills every leaf. */
+        while(valid) {
+            sds ele = zbtCursorEntry(&cur)->ele;
+            double score = zbtCursorEntry(&cur)->score;
 
             if (count == 0) {
                 int cmd_items = (items > AOF_REWRITE_ITEMS_PER_CMD) ?
@@ -995,12 +1089,12 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
                 if (rioWriteBulkString(r,"ZADD",4) == 0) return 0;
                 if (rioWriteBulkObject(r,key) == 0) return 0;
             }
-            if (rioWriteBulkDouble(r,*score) == 0) return 0;
+            if (rioWriteBulkDouble(r,score) == 0) return 0;
             if (rioWriteBulkString(r,ele,sdslen(ele)) == 0) return 0;
             if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
+            valid = zbtNext(&cur);
         }
-        dictReleaseIterator(di);
     } else {
         serverPanic("Unknown sorted zset encoding");
     }
@@ -1014,12 +1108,12 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
  *
  * The function returns 0 on error, non-zero on success. */
 static int rioWriteHashIteratorCursor(rio *r, hashTypeIterator *hi, int what) {
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+        hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
         if (vstr)
             return rioWriteBulkString(r, (char*)vstr, vlen);
         else
@@ -1084,6 +1178,9 @@ ssize_t aofReadDiffFromParent(void) {
     char buf[65536]; /* Default pipe buffer size on most Linux systems. */
     ssize_t nread, total = 0;
 
+    /* No pipe with the multi part AOF, see feedAppendOnlyFile(). */
+    if (server.aof_multi_part) return 0;
+
     while ((nread =
             read(server.aof_pipe_read_data_from_parent,buf,sizeof(buf))) > 0) {
         server.aof_child_diff = sdscatlen(server.aof_child_diff,buf,nread);
@@ -1199,6 +1296,7 @@ int rewriteAppendOnlyFile(char *filename) {
 
     if (server.aof_use_rdb_preamble) {
         int error;
+        aof.codec = server.rdb_compression_codec;
         if (rdbSaveRio(&aof,&error,RDB_SAVE_AOF_PREAMBLE,NULL) == C_ERR) {
             errno = error;
             goto werr;
@@ -1207,6 +1305,10 @@ int rewriteAppendOnlyFile(char *filename) {
         if (rewriteAppendOnlyFileRio(&aof) == C_ERR) goto werr;
     }
 
+    /* The multi part AOF has no differences to read from the parent, they
+     * are written to the incr file opened when the rewrite started. */
+    if (server.aof_multi_part) goto done;
+
     /* Do an initial slow fsync here while the parent is still sending
      * data, in order to make the next final fsync faster. */
     if (fflush(fp) == EOF) goto werr;
@@ -1252,6 +1354,7 @@ int rewriteAppendOnlyFile(char *filename) {
     if (rioWrite(&aof,server.aof_child_diff,sdslen(server.aof_child_diff)) == 0)
         goto werr;
 
+done:
     /* Make sure data will not remain on the OS's output buffers */
     if (fflush(fp) == EOF) goto werr;
     if (fsync(fileno(fp)) == -1) goto werr;
@@ -1369,7 +1472,11 @@ int rewriteAppendOnlyFileBackground(void) {
     long long start;
 
     if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
-    if (aofCreatePipes() != C_OK) return C_ERR;
+    if (server.aof_multi_part) {
+        if (aofRewriteOpenIncrFile() != C_OK) return C_ERR;
+    } else {
+        if (aofCreatePipes() != C_OK) return C_ERR;
+    }
     openChildInfoPipe();
     start = ustime();
     if ((childpid = fork()) == 0) {
@@ -1404,7 +1511,13 @@ int rewriteAppendOnlyFileBackground(void) {
             serverLog(LL_WARNING,
                 "Can't rewrite append only file in background: fork: %s",
                 strerror(errno));
-            aofClosePipes();
+            if (server.aof_multi_part) {
+                if (server.aof_state == AOF_WAIT_REWRITE)
+                    aofRewriteDropIncrFile();
+                server.aof_rewrite_incr_seq = -1;
+            } else {
+                aofClosePipes();
+            }
             return C_ERR;
         }
         serverLog(LL_NOTICE,
@@ -1453,7 +1566,9 @@ void aofUpdateCurrentSize(void) {
     mstime_t latency;
 
     latencyStartMonitor(latency);
-    if (redis_fstat(server.aof_fd,&sb) == -1) {
+    if (server.aof_multi_part) {
+        aofUpdateMultiPartSize();
+    } else if (redis_fstat(server.aof_fd,&sb) == -1) {
         serverLog(LL_WARNING,"Unable to obtain the AOF file length. stat: %s",
             strerror(errno));
     } else {
@@ -1466,7 +1581,28 @@ void aofUpdateCurrentSize(void) {
 /* A background append only file rewriting (BGREWRITEAOF) terminated its work.
  * Handle this. */
 void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
-    if (!bysignal && exitcode == 0) {
+    if (!bysignal && exitcode == 0 && server.aof_multi_part) {
+        char tmpfile[256];
+        mstime_t latency;
+
+        serverLog(LL_NOTICE,
+            "Background AOF rewrite terminated with success");
+        snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof",
+            (int)server.aof_child_pid);
+        latencyStartMonitor(latency);
+        if (aofRewriteInstallBase(tmpfile) == C_ERR) goto cleanup;
+        latencyEndMonitor(latency);
+        latencyAddSampleIfNeeded("aof-rename",latency);
+
+        aofUpdateCurrentSize();
+        server.aof_rewrite_base_size = server.aof_current_size;
+        server.aof_lastbgrewrite_status = C_OK;
+        serverLog(LL_NOTICE, "Background AOF rewrite finished successfully");
+        /* Change state from WAIT_REWRITE to ON if needed: the commands
+         * were already appended to the incr file opened at the start. */
+        if (server.aof_state == AOF_WAIT_REWRITE)
+            server.aof_state = AOF_ON;
+    } else if (!bysignal && exitcode == 0) {
         int newfd, oldfd;
         char tmpfile[256];
         long long now = ustime();
@@ -1603,7 +1739,12 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
     }
 
 cleanup:
-    aofClosePipes();
+    if (server.aof_multi_part) {
+        if (server.aof_state == AOF_WAIT_REWRITE) aofRewriteDropIncrFile();
+        server.aof_rewrite_incr_seq = -1;
+    } else {
+        aofClosePipes();
+    }
     aofRewriteBufferReset();
     aofRemoveTempFile(server.aof_child_pid);
     server.aof_child_pid = -1;
@@ -1613,3 +1754,534 @@ cleanup:
     if (server.aof_state == AOF_WAIT_REWRITE)
         server.aof_rewrite_scheduled = 1;
 }
+
+/* ----------------------------------------------------------------------------
+ * Multi part AOF
+ *
+ * With aof-multi-part enabled the AOF is a set of files inside the
+ * appenddirname directory:
+ *
+ * <appendfilename>.<seq>.base.rdb  The dataset when the last rewrite started,
+ *                                  written by the rewrite child (.aof if it
+ *                                  was written without the RDB preamble).
+ * <appendfilename>.<seq>.incr.aof  The commands appended since then.
+ * <appendfilename>.manifest        The files to load, in order.
+ *
+ * 一次重写开始时, 父进程只需要把写入切换到一个新的增量文件: 子进程写出的基础
+ * 文件加上从此以后的增量文件就是完整的数据集, 所以不再需要重写缓冲区, 也不需要
+ * 通过管道把差异发给子进程, 重写结束时主线程只需要重命名文件并更新manifest.
+ *
+ * A rewrite just switches the writes to a new incr file before forking: the
+ * base written by the child plus the incr files opened from then on rebuild
+ * the dataset. So there is no rewrite buffer to accumulate in the parent and
+ * send to the child, and nothing to write in the event loop when the child
+ * is done: installing the new base is a rename and a new manifest, that is
+ * always replaced atomically.
+ * ------------------------------------------------------------------------- */
+
+#define AOF_MANIFEST_MAX_LINE 1024
+
+static aofInfo *aofInfoCreate(sds file_name, long long file_seq,
+                              int file_type)
+{
+    aofInfo *ai = zmalloc(sizeof(*ai));
+
+    ai->file_name = file_name;
+    ai->file_seq = file_seq;
+    ai->file_type = file_type;
+    return ai;
+}
+
+static void aofInfoFree(void *ptr) {
+    aofInfo *ai = ptr;
+
+    sdsfree(ai->file_name);
+    zfree(ai);
+}
+
+static aofInfo *aofInfoDup(aofInfo *ai) {
+    return aofInfoCreate(sdsdup(ai->file_name),ai->file_seq,ai->file_type);
+}
+
+static aofManifest *aofManifestCreate(void) {
+    aofManifest *am = zcalloc(sizeof(*am));
+
+    am->incr_list = listCreate();
+    listSetFreeMethod(am->incr_list,aofInfoFree);
+    return am;
+}
+
+static void aofManifestFree(aofManifest *am) {
+    if (am->base) aofInfoFree(am->base);
+    listRelease(am->incr_list);
+    zfree(am);
+}
+
+static aofManifest *aofManifestDup(aofManifest *am) {
+    aofManifest *dup = aofManifestCreate();
+    listIter li;
+    listNode *ln;
+
+    if (am->base) dup->base = aofInfoDup(am->base);
+    listRewind(am->incr_list,&li);
+    while((ln = listNext(&li)))
+        listAddNodeTail(dup->incr_list,aofInfoDup(listNodeValue(ln)));
+    dup->curr_base_file_seq = am->curr_base_file_seq;
+    dup->curr_incr_file_seq = am->curr_incr_file_seq;
+    return dup;
+}
+
+/* Path of a file of the multi part AOF. */
+static sds aofFilePath(sds file_name) {
+    return sdscatfmt(sdsempty(),"%s/%S",server.aof_dirname,file_name);
+}
+
+static sds aofManifestFileName(void) {
+    return sdscatfmt(sdsempty(),"%s.manifest",server.aof_filename);
+}
+
+static sds aofBaseFileName(long long seq, int rdb) {
+    return sdscatfmt(sdsempty(),"%s.%I.base.%s",server.aof_filename,seq,
+                     rdb ? "rdb" : "aof");
+}
+
+static sds aofIncrFileName(long long seq) {
+    return sdscatfmt(sdsempty(),"%s.%I.incr.aof",server.aof_filename,seq);
+}
+
+/* Serialize the manifest, one file per line, base first:
+ *
+ * file appendonly.aof.2.base.rdb seq 2 type b
+ * file appendonly.aof.5.incr.aof seq 5 type i */
+static sds aofManifestToString(aofManifest *am) {
+    sds s = sdsempty();
+    listIter li;
+    listNode *ln;
+
+    if (am->base) {
+        s = sdscatprintf(s,"file %s seq %lld type %c\n",am->base->file_name,
+                         am->base->file_seq,am->base->file_type);
+    }
+    listRewind(am->incr_list,&li);
+    while((ln = listNext(&li))) {
+        aofInfo *ai = listNodeValue(ln);
+
+        s = sdscatprintf(s,"file %s seq %lld type %c\n",ai->file_name,
+                         ai->file_seq,ai->file_type);
+    }
+    return s;
+}
+
+static int aofCreateDir(void) {
+    if (mkdir(server.aof_dirname,0755) == -1 && errno != EEXIST) {
+        serverLog(LL_WARNING,"Can't create the AOF directory %s: %s",
+            server.aof_dirname, strerror(errno));
+        return C_ERR;
+    }
+    return C_OK;
+}
+
+/* Load the manifest of the multi part AOF in server.aof_manifest. A
+ * missing manifest is an empty AOF, an invalid one is a fatal error. */
+void aofLoadManifestFromDisk(void) {
+    aofManifest *am = aofManifestCreate();
+    sds name = aofManifestFileName();
+    sds path = aofFilePath(name);
+    char buf[AOF_MANIFEST_MAX_LINE+1];
+    const char *err = NULL;
+    int linenum = 0;
+    FILE *fp;
+
+    server.aof_manifest = am;
+    if ((fp = fopen(path,"r")) == NULL) {
+        if (errno != ENOENT) {
+            serverLog(LL_WARNING,"Fatal error: can't open the AOF manifest "
+                "%s for reading: %s", path, strerror(errno));
+            exit(1);
+        }
+        goto done;
+    }
+
+    while(fgets(buf,sizeof(buf),fp) != NULL) {
+        sds line, *argv, file_name = NULL;
+        long long file_seq = 0;
+        int argc, j, file_type = 0;
+        size_t len = strlen(buf);
+
+        linenum++;
+        if (len == 0 || buf[len-1] != '\n') {
+            err = "Line too long or truncated";
+            goto loaderr;
+        }
+        line = sdstrim(sdsnew(buf)," \t\r\n");
+        if (line[0] == '#' || line[0] == '\0') {
+            sdsfree(line);
+            continue;
+        }
+        argv = sdssplitargs(line,&argc);
+        sdsfree(line);
+        if (argv == NULL || argc % 2) {
+            if (argv) sdsfreesplitres(argv,argc);
+            err = "Invalid line";
+            goto loaderr;
+        }
+        for (j = 0; j < argc; j += 2) {
+            if (!strcasecmp(argv[j],"file")) {
+                if (!pathIsBaseName(argv[j+1])) break;
+                file_name = argv[j+1];
+            } else if (!strcasecmp(argv[j],"seq")) {
+                if (string2ll(argv[j+1],sdslen(argv[j+1]),&file_seq) == 0)
+                    break;
+            } else if (!strcasecmp(argv[j],"type")) {
+                if (sdslen(argv[j+1]) != 1) break;
+                file_type = argv[j+1][0];
+            }
+            /* Unknown fields are skipped. */
+        }
+        if (j != argc || file_name == NULL || file_seq <= 0 ||
+            (file_type != AOF_FILE_TYPE_BASE &&
+             file_type != AOF_FILE_TYPE_INCR))
+        {
+            sdsfreesplitres(argv,argc);
+            err = "Invalid file description";
+            goto loaderr;
+        }
+
+        if (file_type == AOF_FILE_TYPE_BASE) {
+            if (am->base) {
+                sdsfreesplitres(argv,argc);
+                err = "More than one base file";
+                goto loaderr;
+            }
+            am->base = aofInfoCreate(sdsdup(file_name),file_seq,file_type);
+            am->curr_base_file_seq = file_seq;
+        } else {
+            if (file_seq <= am->curr_incr_file_seq) {
+                sdsfreesplitres(argv,argc);
+                err = "Incr files out of order";
+                goto loaderr;
+            }
+            listAddNodeTail(am->incr_list,
+                aofInfoCreate(sdsdup(file_name),file_seq,file_type));
+            am->curr_incr_file_seq = file_seq;
+        }
+        sdsfreesplitres(argv,argc);
+    }
+    if (ferror(fp)) {
+        err = strerror(errno);
+        goto loaderr;
+    }
+    fclose(fp);
+
+done:
+    sdsfree(name);
+    sdsfree(path);
+    return;
+
+loaderr:
+    serverLog(LL_WARNING,"Fatal error reading the AOF manifest %s, "
+        "line %d: %s", path, linenum, err);
+    exit(1);
+}
+
+/* Replace the manifest on disk with 'am': it is written to a temp file that
+ * is renamed over the old manifest, and the directory is synced so that the
+ * files renamed in it before are durable as well. */
+static int aofPersistManifest(aofManifest *am) {
+    sds name = aofManifestFileName();
+    sds tmp_name = sdscatfmt(sdsempty(),"temp-%S",name);
+    sds path = aofFilePath(name);
+    sds tmp_path = aofFilePath(tmp_name);
+    sds content = aofManifestToString(am);
+    int fd = -1, dirfd, retval = C_ERR;
+
+    if (aofCreateDir() == C_ERR) goto cleanup;
+    if ((fd = open(tmp_path,O_WRONLY|O_CREAT|O_TRUNC,0644)) == -1 ||
+        aofWrite(fd,content,sdslen(content)) != (ssize_t)sdslen(content) ||
+        aof_fsync(fd) == -1)
+    {
+        serverLog(LL_WARNING,"Error writing the AOF manifest %s: %s",
+            tmp_path, strerror(errno));
+        goto cleanup;
+    }
+    close(fd);
+    fd = -1;
+    if (rename(tmp_path,path) == -1) {
+        serverLog(LL_WARNING,"Error renaming the AOF manifest %s into %s: %s",
+            tmp_path, path, strerror(errno));
+        goto cleanup;
+    }
+    if ((dirfd = open(server.aof_dirname,O_RDONLY)) != -1) {
+        fsync(dirfd);
+        close(dirfd);
+    }
+    retval = C_OK;
+
+cleanup:
+    if (fd != -1) close(fd);
+    if (retval == C_ERR) unlink(tmp_path);
+    sdsfree(name);
+    sdsfree(tmp_name);
+    sdsfree(path);
+    sdsfree(tmp_path);
+    sdsfree(content);
+    return retval;
+}
+
+/* Delete a file no longer listed in the manifest. Like the overwritten
+ * single AOF, it is still open while unlinked, so that the actual removal
+ * happens when the background thread closes it. */
+static void aofDelFile(sds file_name) {
+    sds path = aofFilePath(file_name);
+    int fd = open(path,O_RDONLY|O_NONBLOCK);
+
+    if (unlink(path) == -1 && errno != ENOENT) {
+        serverLog(LL_WARNING,"Can't remove the old AOF file %s: %s",
+            path, strerror(errno));
+    }
+    if (fd != -1) bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)fd,NULL,NULL);
+    sdsfree(path);
+}
+
+/* Called at startup: load the manifest and, if AOF is on, open the last incr
+ * file to append to, creating it if needed. An existing single AOF file
+ * becomes the base of the multi part AOF. */
+void aofOpenIfNeededOnServerStart(void) {
+    aofManifest *am;
+    aofInfo *incr;
+    sds legacy_path = NULL, path;
+    int persist = 0;
+
+    aofLoadManifestFromDisk();
+    if (server.aof_state != AOF_ON) return;
+
+    am = server.aof_manifest;
+    if (aofCreateDir() == C_ERR) exit(1);
+    if (am->base == NULL && listLength(am->incr_list) == 0 &&
+        access(server.aof_filename,F_OK) == 0)
+    {
+        /* The old file is linked as the base, and removed only once the
+         * manifest listing it is on disk. */
+        sds name = aofBaseFileName(++am->curr_base_file_seq,0);
+
+        legacy_path = aofFilePath(name);
+        unlink(legacy_path);
+        if (link(server.aof_filename,legacy_path) == -1) {
+            serverLog(LL_WARNING,"Can't link the append only file %s as %s: "
+                "%s", server.aof_filename, legacy_path, strerror(errno));
+            exit(1);
+        }
+        am->base = aofInfoCreate(name,am->curr_base_file_seq,
+                                 AOF_FILE_TYPE_BASE);
+        serverLog(LL_NOTICE,"Using the append only file %s as the base of "
+            "the multi part AOF in %s", server.aof_filename,
+            server.aof_dirname);
+        persist = 1;
+    }
+    if (listLength(am->incr_list) == 0) {
+        am->curr_incr_file_seq++;
+        listAddNodeTail(am->incr_list,
+            aofInfoCreate(aofIncrFileName(am->curr_incr_file_seq),
+                          am->curr_incr_file_seq,AOF_FILE_TYPE_INCR));
+        persist = 1;
+    }
+
+    incr = listNodeValue(listLast(am->incr_list));
+    path = aofFilePath(incr->file_name);
+    server.aof_fd = open(path,O_WRONLY|O_APPEND|O_CREAT,0644);
+    if (server.aof_fd == -1) {
+        serverLog(LL_WARNING,"Can't open the append-only file %s: %s",
+            path, strerror(errno));
+        exit(1);
+    }
+    sdsfree(path);
+    if (persist && aofPersistManifest(am) == C_ERR) exit(1);
+    if (legacy_path) {
+        unlink(server.aof_filename);
+        sdsfree(legacy_path);
+    }
+}
+
+/* Called before forking the rewrite child: the writes are switched to a new
+ * incr file, so that the base written by the child contains everything that
+ * was written before it.
+ *
+ * When the rewrite enables the AOF (AOF_WAIT_REWRITE) the new file is listed
+ * in the manifest only once the base is installed, since the files listed
+ * before may be stale. */
+static int aofRewriteOpenIncrFile(void) {
+    aofManifest *am = server.aof_manifest;
+    long long seq = am->curr_incr_file_seq+1;
+    sds name, path;
+    int fd;
+
+    server.aof_rewrite_incr_seq = -1;
+    if (server.aof_state == AOF_OFF) return C_OK;
+    if (aofCreateDir() == C_ERR) return C_ERR;
+
+    name = aofIncrFileName(seq);
+    path = aofFilePath(name);
+    if ((fd = open(path,O_WRONLY|O_APPEND|O_CREAT|O_TRUNC,0644)) == -1) {
+        serverLog(LL_WARNING,"Can't open the new AOF incr file %s: %s",
+            path, strerror(errno));
+        sdsfree(name);
+        sdsfree(path);
+        return C_ERR;
+    }
+
+    if (server.aof_state == AOF_ON) {
+        aofManifest *new_am = aofManifestDup(am);
+
+        listAddNodeTail(new_am->incr_list,
+            aofInfoCreate(sdsdup(name),seq,AOF_FILE_TYPE_INCR));
+        new_am->curr_incr_file_seq = seq;
+        if (aofPersistManifest(new_am) == C_ERR) {
+            aofManifestFree(new_am);
+            close(fd);
+            unlink(path);
+            sdsfree(name);
+            sdsfree(path);
+            return C_ERR;
+        }
+        aofManifestFree(am);
+        server.aof_manifest = new_am;
+
+        /* What was written until now goes to the previous file, that is
+         * synced (unless appendfsync is no) and closed in background. */
+        flushAppendOnlyFile(1);
+        bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)server.aof_fd,
+            (void*)(long)(server.aof_fsync != AOF_FSYNC_NO),NULL);
+    } else {
+        am->curr_incr_file_seq = seq;
+    }
+    server.aof_fd = fd;
+    server.aof_last_incr_size = 0;
+    server.aof_selected_db = -1; /* Every incr file starts with a SELECT. */
+    server.aof_rewrite_incr_seq = seq;
+    sdsfree(name);
+    sdsfree(path);
+    return C_OK;
+}
+
+/* Discard the incr file opened by a rewrite that should have enabled the AOF
+ * (AOF_WAIT_REWRITE), when it fails or is stopped. The next rewrite opens a
+ * new one. */
+static void aofRewriteDropIncrFile(void) {
+    sds name, path;
+
+    if (server.aof_rewrite_incr_seq == -1) return;
+    if (server.aof_fd != -1) {
+        close(server.aof_fd);
+        server.aof_fd = -1;
+    }
+    sdsclear(server.aof_buf);
+    name = aofIncrFileName(server.aof_rewrite_incr_seq);
+    path = aofFilePath(name);
+    unlink(path);
+    sdsfree(name);
+    sdsfree(path);
+    server.aof_rewrite_incr_seq = -1;
+}
+
+/* Install the base written by the rewrite child in 'tmpfile': the new
+ * manifest lists it, followed by the incr files opened since the rewrite
+ * started. The files listed before are deleted. */
+static int aofRewriteInstallBase(char *tmpfile) {
+    aofManifest *am = aofManifestDup(server.aof_manifest);
+    list *history = listCreate();
+    long long seq = ++am->curr_base_file_seq;
+    char sig[5];
+    int rdb = 0;
+    sds name, path;
+    listIter li;
+    listNode *ln;
+    FILE *fp;
+
+    listSetFreeMethod(history,aofInfoFree);
+    if ((fp = fopen(tmpfile,"r")) != NULL) {
+        rdb = fread(sig,1,5,fp) == 5 && memcmp(sig,"REDIS",5) == 0;
+        fclose(fp);
+    }
+    name = aofBaseFileName(seq,rdb);
+    path = aofFilePath(name);
+    if (aofCreateDir() == C_ERR || rename(tmpfile,path) == -1) {
+        serverLog(LL_WARNING,
+            "Error trying to rename the temporary AOF file %s into %s: %s",
+            tmpfile, path, strerror(errno));
+        goto err;
+    }
+
+    if (am->base) listAddNodeTail(history,am->base);
+    am->base = aofInfoCreate(name,seq,AOF_FILE_TYPE_BASE);
+    name = NULL;
+    listRewind(am->incr_list,&li);
+    while((ln = listNext(&li))) {
+        aofInfo *ai = listNodeValue(ln);
+
+        if (server.aof_rewrite_incr_seq == -1 ||
+            ai->file_seq < server.aof_rewrite_incr_seq)
+        {
+            listAddNodeTail(history,aofInfoDup(ai));
+            listDelNode(am->incr_list,ln);
+        }
+    }
+    if (server.aof_state == AOF_WAIT_REWRITE &&
+        server.aof_rewrite_incr_seq != -1)
+    {
+        listAddNodeTail(am->incr_list,
+            aofInfoCreate(aofIncrFileName(server.aof_rewrite_incr_seq),
+                          server.aof_rewrite_incr_seq,AOF_FILE_TYPE_INCR));
+    }
+    if (aofPersistManifest(am) == C_ERR) {
+        unlink(path);
+        goto err;
+    }
+    aofManifestFree(server.aof_manifest);
+    server.aof_manifest = am;
+
+    listRewind(history,&li);
+    while((ln = listNext(&li))) {
+        aofInfo *ai = listNodeValue(ln);
+        aofDelFile(ai->file_name);
+    }
+    listRelease(history);
+    sdsfree(path);
+    return C_OK;
+
+err:
+    aofManifestFree(am);
+    listRelease(history);
+    if (name) sdsfree(name);
+    sdsfree(path);
+    return C_ERR;
+}
+
+/* Update server.aof_current_size with the size of all the files listed in
+ * the manifest, and server.aof_last_incr_size with the size of the incr
+ * file being written. */
+static void aofUpdateMultiPartSize(void) {
+    aofManifest *am = server.aof_manifest;
+    struct redis_stat sb;
+    off_t size = 0;
+    listIter li;
+    listNode *ln;
+    sds path;
+
+    if (am->base) {
+        path = aofFilePath(am->base->file_name);
+        if (redis_stat(path,&sb) != -1) size += sb.st_size;
+        sdsfree(path);
+    }
+    listRewind(am->incr_list,&li);
+    while((ln = listNext(&li))) {
+        aofInfo *ai = listNodeValue(ln);
+
+        path = aofFilePath(ai->file_name);
+        if (redis_stat(path,&sb) != -1) size += sb.st_size;
+        sdsfree(path);
+    }
+    server.aof_current_size = size;
+    server.aof_last_incr_size = 0;
+    if (server.aof_fd != -1 && redis_fstat(server.aof_fd,&sb) != -1)
+        server.aof_last_incr_size = sb.st_size;
+}
@@ -8,6 +8,12 @@
  * atomicDecr(var,count) -- Decrement the atomic counter
  * atomicGet(var,dstvar) -- Fetch the atomic counter value
  * atomicSet(var,value)  -- Set the atomic counter value
+ * atomicGetWithSync(var,dstvar) -- Like atomicGet() but with a full barrier
+ * atomicSetWithSync(var,value)  -- Like atomicSet() but with a full barrier
+ *
+ * The "WithSync" variants are needed when the counter is used to hand off
+ * other memory between threads (see the threaded I/O in networking.c),
+ * since the plain variants use relaxed ordering.
  *
  * The variable 'var' should also have a declared mutex with the same
  * name and the "_mutex" postfix, for instance:
@@ -80,6 +86,11 @@
     dstvar = __atomic_load_n(&var,__ATOMIC_RELAXED); \
 } while(0)
 #define atomicSet(var,value) __atomic_store_n(&var,value,__ATOMIC_RELAXED)
+#define atomicGetWithSync(var,dstvar) do { \
+    dstvar = __atomic_load_n(&var,__ATOMIC_SEQ_CST); \
+} while(0)
+#define atomicSetWithSync(var,value) \
+    __atomic_store_n(&var,value,__ATOMIC_SEQ_CST)
 #define REDIS_ATOMIC_API "atomic-builtin"
 
 #elif defined(HAVE_ATOMIC)
@@ -96,6 +107,9 @@
 #define atomicSet(var,value) do { \
     while(!__sync_bool_compare_and_swap(&var,var,value)); \
 } while(0)
+/* The __sync builtins are already full barriers. */
+#define atomicGetWithSync(var,dstvar) atomicGet(var,dstvar)
+#define atomicSetWithSync(var,value) atomicSet(var,value)
 #define REDIS_ATOMIC_API "sync-builtin"
 
 #else
@@ -127,6 +141,8 @@
     var = value; \
     pthread_mutex_unlock(&var ## _mutex); \
 } while(0)
+#define atomicGetWithSync(var,dstvar) atomicGet(var,dstvar)
+#define atomicSetWithSync(var,value) atomicSet(var,value)
 #define REDIS_ATOMIC_API "pthread-mutex"
 
 #endif
@@ -0,0 +1,143 @@
+/* Pluggable compression codecs, see codec.h.
+ *
+ * 压缩和解压可以在多个线程中进行(rdb分段编码线程, rdb加载线程), zstd的上下文
+ * 比较大, 所以每个线程各自缓存一份, 在线程退出时释放.
+ *
+ * Compression may run in several threads at once (the RDB segment encoders,
+ * the RDB loader thread, the main thread). Zstd contexts are large and slow
+ * to create, so every thread caches its own pair of contexts, released when
+ * the thread exits.
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include "codec.h"
+#include "lzf.h"
+#include "lz4.h"
+#define ZSTD_STATIC_LINKING_ONLY /* For ZSTD_f_zstd1_magicless. */
+#include "zstd.h"
+#include "zmalloc.h"
+
+typedef struct codecZstdState {
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+} codecZstdState;
+
+static pthread_key_t codec_zstd_key;
+static pthread_once_t codec_zstd_once = PTHREAD_ONCE_INIT;
+
+static void codecZstdFreeState(void *ptr) {
+    codecZstdState *state = ptr;
+
+    ZSTD_freeCCtx(state->cctx);
+    ZSTD_freeDCtx(state->dctx);
+    zfree(state);
+}
+
+static void codecZstdCreateKey(void) {
+    pthread_key_create(&codec_zstd_key,codecZstdFreeState);
+}
+
+/* Return the zstd contexts of the calling thread, creating them the first
+ * time.
+ *
+ * Values compressed in RDB files and list nodes are small and their length
+ * is always stored beside them, so the frames are written without magic
+ * number, content size and dictionary ID, saving up to 12 bytes each. */
+static codecZstdState *codecZstdGetState(void) {
+    codecZstdState *state;
+
+    pthread_once(&codec_zstd_once,codecZstdCreateKey);
+    state = pthread_getspecific(codec_zstd_key);
+    if (state == NULL) {
+        state = zcalloc(sizeof(*state));
+        pthread_setspecific(codec_zstd_key,state);
+    }
+    return state;
+}
+
+/* Compress 'srclen' bytes at 'src' into 'dst' with the given codec. Returns
+ * the compressed length, or 0 if the result doesn't fit in 'dstlen' bytes
+ * (callers pass a buffer smaller than the input to store data that doesn't
+ * compress as it is), or on error. */
+size_t codecCompress(int codec, const void *src, size_t srclen, void *dst,
+                     size_t dstlen)
+{
+    switch(codec) {
+    case CODEC_LZF:
+        if (srclen > UINT_MAX) return 0;
+        if (dstlen > UINT_MAX) dstlen = UINT_MAX;
+        return lzf_compress(src,srclen,dst,dstlen);
+    case CODEC_LZ4: {
+        int clen;
+
+        if (srclen > LZ4_MAX_INPUT_SIZE) return 0;
+        if (dstlen > INT_MAX) dstlen = INT_MAX;
+        clen = LZ4_compress_default(src,dst,srclen,dstlen);
+        return clen > 0 ? (size_t)clen : 0;
+    }
+    case CODEC_ZSTD: {
+        codecZstdState *state = codecZstdGetState();
+        size_t clen;
+
+        if (state->cctx == NULL) {
+            if ((state->cctx = ZSTD_createCCtx()) == NULL) return 0;
+            ZSTD_CCtx_setParameter(state->cctx,ZSTD_c_compressionLevel,
+                                   CODEC_ZSTD_LEVEL);
+            ZSTD_CCtx_setParameter(state->cctx,ZSTD_c_format,
+                                   ZSTD_f_zstd1_magicless);
+            ZSTD_CCtx_setParameter(state->cctx,ZSTD_c_contentSizeFlag,0);
+            ZSTD_CCtx_setParameter(state->cctx,ZSTD_c_dictIDFlag,0);
+        }
+        clen = ZSTD_compress2(state->cctx,dst,dstlen,src,srclen);
+        return ZSTD_isError(clen) ? 0 : clen;
+    }
+    default:
+        return 0;
+    }
+}
+
+/* Decompress 'srclen' bytes at 'src' into 'dst', that can hold 'dstlen'
+ * bytes. Returns the decompressed length, or 0 if the data is corrupted or
+ * doesn't fit in 'dst'. */
+size_t codecDecompress(int codec, const void *src, size_t srclen, void *dst,
+                       size_t dstlen)
+{
+    switch(codec) {
+    case CODEC_LZF:
+        if (srclen > UINT_MAX) return 0;
+        if (dstlen > UINT_MAX) dstlen = UINT_MAX;
+        return lzf_decompress(src,srclen,dst,dstlen);
+    case CODEC_LZ4: {
+        int len;
+
+        if (srclen > INT_MAX) return 0;
+        if (dstlen > INT_MAX) dstlen = INT_MAX;
+        len = LZ4_decompress_safe(src,dst,srclen,dstlen);
+        return len > 0 ? (size_t)len : 0;
+    }
+    case CODEC_ZSTD: {
+        codecZstdState *state = codecZstdGetState();
+        size_t len;
+
+        if (state->dctx == NULL) {
+            if ((state->dctx = ZSTD_createDCtx()) == NULL) return 0;
+            ZSTD_DCtx_setParameter(state->dctx,ZSTD_d_format,
+                                   ZSTD_f_zstd1_magicless);
+        }
+        len = ZSTD_decompressDCtx(state->dctx,dst,dstlen,src,srclen);
+        return ZSTD_isError(len) ? 0 : len;
+    }
+    default:
+        return 0;
+    }
+}
+
+const char *codecName(int codec) {
+    switch(codec) {
+    case CODEC_LZF: return "lzf";
+    case CODEC_LZ4: return "lz4";
+    case CODEC_ZSTD: return "zstd";
+    default: return "unknown";
+    }
+}
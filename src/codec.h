@@ -0,0 +1,34 @@
+/* Pluggable compression codecs.
+ *
+ * 可插拔的压缩算法: rdb中的字符串以及quicklist的压缩节点都通过这里压缩和解压,
+ * 每种用途可以单独配置所使用的算法.
+ *
+ * RDB strings and compressed quicklist nodes are compressed through this
+ * small layer, so that every use can select its own codec:
+ *
+ * LZF  - the historical codec, the only one older servers can read.
+ * LZ4  - compresses and decompresses several times faster than LZF.
+ * ZSTD - much better ratio, for cold data and snapshots.
+ */
+
+#ifndef __CODEC_H
+#define __CODEC_H
+
+#include <stddef.h>
+
+#define CODEC_LZF 0
+#define CODEC_LZ4 1
+#define CODEC_ZSTD 2
+#define CODEC_MAX CODEC_ZSTD
+
+/* Zstd compression level: the library default, a good trade off between
+ * speed and ratio. */
+#define CODEC_ZSTD_LEVEL 3
+
+size_t codecCompress(int codec, const void *src, size_t srclen, void *dst,
+                     size_t dstlen);
+size_t codecDecompress(int codec, const void *src, size_t srclen, void *dst,
+                       size_t dstlen);
+const char *codecName(int codec);
+
+#endif
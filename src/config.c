@@ -91,6 +91,13 @@ configEnum aof_fsync_enum[] = {
     {NULL, 0}
 };
 
+configEnum compression_codec_enum[] = {
+    {"lzf", CODEC_LZF},
+    {"lz4", CODEC_LZ4},
+    {"zstd", CODEC_ZSTD},
+    {NULL, 0}
+};
+
 /* Output buffer limits presets. */
 clientBufferLimitsConfig clientBufferLimitsDefaults[CLIENT_TYPE_OBUF_COUNT] = {
     {0, 0, 0}, /* normal */
@@ -309,6 +316,21 @@ void loadServerConfigFromString(char *config) {
             if (server.dbnum < 1) {
                 err = "Invalid number of databases"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"io-threads") && argc == 2) {
+            server.io_threads_num = atoi(argv[1]);
+            if (server.io_threads_num < 1 ||
+                server.io_threads_num > IO_THREADS_MAX_NUM)
+            {
+                err = "Invalid number of I/O threads"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"io-threads-do-reads") && argc == 2) {
+            if ((server.io_threads_do_reads = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"io-uring") && argc == 2) {
+            if ((server.io_uring = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"include") && argc == 2) {
             loadServerConfig(argv[1],NULL);
         } else if (!strcasecmp(argv[0],"maxclients") && argc == 2) {
@@ -410,6 +432,37 @@ void loadServerConfigFromString(char *config) {
             if ((server.rdb_checksum = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"rdb-threaded-loading") && argc == 2) {
+            if ((server.rdb_threaded_loading = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-forkless-save") && argc == 2) {
+            if ((server.rdb_forkless_save = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-compression-codec") && argc == 2) {
+            server.rdb_compression_codec =
+                configEnumGetValue(compression_codec_enum,argv[1]);
+            if (server.rdb_compression_codec == INT_MIN) {
+                err = "argument must be 'lzf', 'lz4' or 'zstd'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"repl-diskless-compression-codec") &&
+                   argc == 2)
+        {
+            server.repl_diskless_compression_codec =
+                configEnumGetValue(compression_codec_enum,argv[1]);
+            if (server.repl_diskless_compression_codec == INT_MIN) {
+                err = "argument must be 'lzf', 'lz4' or 'zstd'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-segment-threads") && argc == 2) {
+            server.rdb_segment_threads = atoi(argv[1]);
+            if (server.rdb_segment_threads < 1 ||
+                server.rdb_segment_threads > RDB_SEGMENT_THREADS_MAX_NUM)
+            {
+                err = "Invalid number of RDB segment threads"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"activerehashing") && argc == 2) {
             if ((server.activerehashing = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -494,6 +547,17 @@ void loadServerConfigFromString(char *config) {
             if ((server.aof_use_rdb_preamble = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"aof-multi-part") && argc == 2) {
+            if ((server.aof_multi_part = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"appenddirname") && argc == 2) {
+            if (!pathIsBaseName(argv[1])) {
+                err = "appenddirname can't be a path, just a dirname";
+                goto loaderr;
+            }
+            zfree(server.aof_dirname);
+            server.aof_dirname = zstrdup(argv[1]);
         } else if (!strcasecmp(argv[0],"requirepass") && argc == 2) {
             if (strlen(argv[1]) > CONFIG_AUTHPASS_MAX_LEN) {
                 err = "Password is longer than CONFIG_AUTHPASS_MAX_LEN";
@@ -540,24 +604,46 @@ void loadServerConfigFromString(char *config) {
                 err = "active-defrag-cycle-max must be between 1 and 99";
                 goto loaderr;
             }
-        } else if (!strcasecmp(argv[0],"hash-max-ziplist-entries") && argc == 2) {
-            server.hash_max_ziplist_entries = memtoll(argv[1], NULL);
-        } else if (!strcasecmp(argv[0],"hash-max-ziplist-value") && argc == 2) {
-            server.hash_max_ziplist_value = memtoll(argv[1], NULL);
+        } else if ((!strcasecmp(argv[0],"hash-max-listpack-entries") ||
+                    !strcasecmp(argv[0],"hash-max-ziplist-entries")) && argc == 2)
+        {
+            server.hash_max_listpack_entries = memtoll(argv[1], NULL);
+        } else if ((!strcasecmp(argv[0],"hash-max-listpack-value") ||
+                    !strcasecmp(argv[0],"hash-max-ziplist-value")) && argc == 2)
+        {
+            server.hash_max_listpack_value = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"list-max-ziplist-entries") && argc == 2){
             /* DEAD OPTION */
         } else if (!strcasecmp(argv[0],"list-max-ziplist-value") && argc == 2) {
             /* DEAD OPTION */
-        } else if (!strcasecmp(argv[0],"list-max-ziplist-size") && argc == 2) {
-            server.list_max_ziplist_size = atoi(argv[1]);
+        } else if ((!strcasecmp(argv[0],"list-max-listpack-size") ||
+                    !strcasecmp(argv[0],"list-max-ziplist-size")) && argc == 2)
+        {
+            server.list_max_listpack_size = atoi(argv[1]);
         } else if (!strcasecmp(argv[0],"list-compress-depth") && argc == 2) {
             server.list_compress_depth = atoi(argv[1]);
+        } else if (!strcasecmp(argv[0],"list-compression-codec") && argc == 2) {
+            server.list_compression_codec =
+                configEnumGetValue(compression_codec_enum,argv[1]);
+            if (server.list_compression_codec == INT_MIN) {
+                err = "argument must be 'lzf', 'lz4' or 'zstd'";
+                goto loaderr;
+            }
+            quicklistSetCompressionCodec(server.list_compression_codec);
         } else if (!strcasecmp(argv[0],"set-max-intset-entries") && argc == 2) {
             server.set_max_intset_entries = memtoll(argv[1], NULL);
-        } else if (!strcasecmp(argv[0],"zset-max-ziplist-entries") && argc == 2) {
-            server.zset_max_ziplist_entries = memtoll(argv[1], NULL);
-        } else if (!strcasecmp(argv[0],"zset-max-ziplist-value") && argc == 2) {
-            server.zset_max_ziplist_value = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"set-roaring-encoding") && argc == 2) {
+            if ((server.set_roaring_encoding = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if ((!strcasecmp(argv[0],"zset-max-listpack-entries") ||
+                    !strcasecmp(argv[0],"zset-max-ziplist-entries")) && argc == 2)
+        {
+            server.zset_max_listpack_entries = memtoll(argv[1], NULL);
+        } else if ((!strcasecmp(argv[0],"zset-max-listpack-value") ||
+                    !strcasecmp(argv[0],"zset-max-ziplist-value")) && argc == 2)
+        {
+            server.zset_max_listpack_value = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"hll-sparse-max-bytes") && argc == 2) {
             server.hll_sparse_max_bytes = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"rename-command") && argc == 3) {
@@ -644,6 +730,11 @@ void loadServerConfigFromString(char *config) {
                    argc == 2)
         {
             server.slowlog_log_slower_than = strtoll(argv[1],NULL,10);
+        } else if (!strcasecmp(argv[0],"slowlog-log-queue-delay-slower-than") &&
+                   argc == 2)
+        {
+            server.slowlog_log_queue_delay_slower_than =
+                strtoll(argv[1],NULL,10);
         } else if (!strcasecmp(argv[0],"latency-monitor-threshold") &&
                    argc == 2)
         {
@@ -652,6 +743,19 @@ void loadServerConfigFromString(char *config) {
                 err = "The latency threshold can't be negative";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"latency-tracking") && argc == 2) {
+            if ((server.latency_tracking = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"latency-tracking-info-percentiles")) {
+            sds list = sdsjoin(argv+1,argc-1," ");
+            int retval = latencySetInfoPercentiles(list);
+
+            sdsfree(list);
+            if (retval == C_ERR) {
+                err = "Invalid latency percentiles, must be between 0 and 100";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"slowlog-max-len") && argc == 2) {
             server.slowlog_max_len = strtoll(argv[1],NULL,10);
         } else if (!strcasecmp(argv[0],"client-output-buffer-limit") &&
@@ -987,6 +1091,8 @@ void configSetCommand(client *c) {
 
         if (flags == -1) goto badfmt;
         server.notify_keyspace_events = flags;
+    } config_set_special_field("latency-tracking-info-percentiles") {
+        if (latencySetInfoPercentiles(o->ptr) == C_ERR) goto badfmt;
     } config_set_special_field("slave-announce-ip") {
         zfree(server.slave_announce_ip);
         server.slave_announce_ip = ((char*)o->ptr)[0] ? zstrdup(o->ptr) : NULL;
@@ -995,6 +1101,12 @@ void configSetCommand(client *c) {
      * config_set_bool_field(name,var). */
     } config_set_bool_field(
       "rdbcompression", server.rdb_compression) {
+    } config_set_bool_field(
+      "latency-tracking", server.latency_tracking) {
+    } config_set_bool_field(
+      "rdb-threaded-loading", server.rdb_threaded_loading) {
+    } config_set_bool_field(
+      "rdb-forkless-save", server.rdb_forkless_save) {
     } config_set_bool_field(
       "repl-disable-tcp-nodelay",server.repl_disable_tcp_nodelay) {
     } config_set_bool_field(
@@ -1035,6 +1147,8 @@ void configSetCommand(client *c) {
       "lazyfree-lazy-expire",server.lazyfree_lazy_expire) {
     } config_set_bool_field(
       "lazyfree-lazy-server-del",server.lazyfree_lazy_server_del) {
+    } config_set_bool_field(
+      "set-roaring-encoding",server.set_roaring_encoding) {
     } config_set_bool_field(
       "slave-lazy-flush",server.repl_slave_lazy_flush) {
     } config_set_bool_field(
@@ -1065,25 +1179,37 @@ void configSetCommand(client *c) {
     } config_set_numerical_field(
       "auto-aof-rewrite-percentage",server.aof_rewrite_perc,0,LLONG_MAX){
     } config_set_numerical_field(
-      "hash-max-ziplist-entries",server.hash_max_ziplist_entries,0,LLONG_MAX) {
+      "hash-max-listpack-entries",server.hash_max_listpack_entries,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "hash-max-ziplist-entries",server.hash_max_listpack_entries,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "hash-max-listpack-value",server.hash_max_listpack_value,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "hash-max-ziplist-value",server.hash_max_listpack_value,0,LLONG_MAX) {
     } config_set_numerical_field(
-      "hash-max-ziplist-value",server.hash_max_ziplist_value,0,LLONG_MAX) {
+      "list-max-listpack-size",server.list_max_listpack_size,INT_MIN,INT_MAX) {
     } config_set_numerical_field(
-      "list-max-ziplist-size",server.list_max_ziplist_size,INT_MIN,INT_MAX) {
+      "list-max-ziplist-size",server.list_max_listpack_size,INT_MIN,INT_MAX) {
     } config_set_numerical_field(
       "list-compress-depth",server.list_compress_depth,0,INT_MAX) {
     } config_set_numerical_field(
       "set-max-intset-entries",server.set_max_intset_entries,0,LLONG_MAX) {
     } config_set_numerical_field(
-      "zset-max-ziplist-entries",server.zset_max_ziplist_entries,0,LLONG_MAX) {
+      "zset-max-listpack-entries",server.zset_max_listpack_entries,0,LLONG_MAX) {
     } config_set_numerical_field(
-      "zset-max-ziplist-value",server.zset_max_ziplist_value,0,LLONG_MAX) {
+      "zset-max-ziplist-entries",server.zset_max_listpack_entries,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "zset-max-listpack-value",server.zset_max_listpack_value,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "zset-max-ziplist-value",server.zset_max_listpack_value,0,LLONG_MAX) {
     } config_set_numerical_field(
       "hll-sparse-max-bytes",server.hll_sparse_max_bytes,0,LLONG_MAX) {
     } config_set_numerical_field(
       "lua-time-limit",server.lua_time_limit,0,LLONG_MAX) {
     } config_set_numerical_field(
       "slowlog-log-slower-than",server.slowlog_log_slower_than,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "slowlog-log-queue-delay-slower-than",server.slowlog_log_queue_delay_slower_than,-1,LLONG_MAX) {
     } config_set_numerical_field(
       "slowlog-max-len",ll,0,LLONG_MAX) {
       /* Cast to unsigned. */
@@ -1118,6 +1244,8 @@ void configSetCommand(client *c) {
       "cluster-migration-barrier",server.cluster_migration_barrier,0,LLONG_MAX){
     } config_set_numerical_field(
       "cluster-slave-validity-factor",server.cluster_slave_validity_factor,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "rdb-segment-threads",server.rdb_segment_threads,1,RDB_SEGMENT_THREADS_MAX_NUM) {
     } config_set_numerical_field(
       "hz",server.hz,0,LLONG_MAX) {
         /* Hz is more an hint from the user, so we accept values out of range
@@ -1157,6 +1285,13 @@ void configSetCommand(client *c) {
       "maxmemory-policy",server.maxmemory_policy,maxmemory_policy_enum) {
     } config_set_enum_field(
       "appendfsync",server.aof_fsync,aof_fsync_enum) {
+    } config_set_enum_field(
+      "rdb-compression-codec",server.rdb_compression_codec,compression_codec_enum) {
+    } config_set_enum_field(
+      "repl-diskless-compression-codec",server.repl_diskless_compression_codec,compression_codec_enum) {
+    } config_set_enum_field(
+      "list-compression-codec",server.list_compression_codec,compression_codec_enum) {
+        quicklistSetCompressionCodec(server.list_compression_codec);
 
     /* Everyhing else is an error... */
     } config_set_else {
@@ -1222,6 +1357,7 @@ void configGetCommand(client *c) {
 
     /* String values */
     config_get_string_field("dbfilename",server.rdb_filename);
+    config_get_string_field("appenddirname",server.aof_dirname);
     config_get_string_field("requirepass",server.requirepass);
     config_get_string_field("masterauth",server.masterauth);
     config_get_string_field("cluster-announce-ip",server.cluster_announce_ip);
@@ -1247,25 +1383,37 @@ void configGetCommand(client *c) {
             server.aof_rewrite_perc);
     config_get_numerical_field("auto-aof-rewrite-min-size",
             server.aof_rewrite_min_size);
+    config_get_numerical_field("hash-max-listpack-entries",
+            server.hash_max_listpack_entries);
     config_get_numerical_field("hash-max-ziplist-entries",
-            server.hash_max_ziplist_entries);
+            server.hash_max_listpack_entries);
+    config_get_numerical_field("hash-max-listpack-value",
+            server.hash_max_listpack_value);
     config_get_numerical_field("hash-max-ziplist-value",
-            server.hash_max_ziplist_value);
+            server.hash_max_listpack_value);
+    config_get_numerical_field("list-max-listpack-size",
+            server.list_max_listpack_size);
     config_get_numerical_field("list-max-ziplist-size",
-            server.list_max_ziplist_size);
+            server.list_max_listpack_size);
     config_get_numerical_field("list-compress-depth",
             server.list_compress_depth);
     config_get_numerical_field("set-max-intset-entries",
             server.set_max_intset_entries);
+    config_get_numerical_field("zset-max-listpack-entries",
+            server.zset_max_listpack_entries);
     config_get_numerical_field("zset-max-ziplist-entries",
-            server.zset_max_ziplist_entries);
+            server.zset_max_listpack_entries);
+    config_get_numerical_field("zset-max-listpack-value",
+            server.zset_max_listpack_value);
     config_get_numerical_field("zset-max-ziplist-value",
-            server.zset_max_ziplist_value);
+            server.zset_max_listpack_value);
     config_get_numerical_field("hll-sparse-max-bytes",
             server.hll_sparse_max_bytes);
     config_get_numerical_field("lua-time-limit",server.lua_time_limit);
     config_get_numerical_field("slowlog-log-slower-than",
             server.slowlog_log_slower_than);
+    config_get_numerical_field("slowlog-log-queue-delay-slower-than",
+            server.slowlog_log_queue_delay_slower_than);
     config_get_numerical_field("latency-monitor-threshold",
             server.latency_monitor_threshold);
     config_get_numerical_field("slowlog-max-len",
@@ -1275,6 +1423,7 @@ void configGetCommand(client *c) {
     config_get_numerical_field("cluster-announce-bus-port",server.cluster_announce_bus_port);
     config_get_numerical_field("tcp-backlog",server.tcp_backlog);
     config_get_numerical_field("databases",server.dbnum);
+    config_get_numerical_field("io-threads",server.io_threads_num);
     config_get_numerical_field("repl-ping-slave-period",server.repl_ping_slave_period);
     config_get_numerical_field("repl-timeout",server.repl_timeout);
     config_get_numerical_field("repl-backlog-size",server.repl_backlog_size);
@@ -1286,6 +1435,7 @@ void configGetCommand(client *c) {
     config_get_numerical_field("min-slaves-to-write",server.repl_min_slaves_to_write);
     config_get_numerical_field("min-slaves-max-lag",server.repl_min_slaves_max_lag);
     config_get_numerical_field("hz",server.hz);
+    config_get_numerical_field("rdb-segment-threads",server.rdb_segment_threads);
     config_get_numerical_field("cluster-node-timeout",server.cluster_node_timeout);
     config_get_numerical_field("cluster-migration-barrier",server.cluster_migration_barrier);
     config_get_numerical_field("cluster-slave-validity-factor",server.cluster_slave_validity_factor);
@@ -1306,7 +1456,12 @@ void configGetCommand(client *c) {
     config_get_bool_field("daemonize", server.daemonize);
     config_get_bool_field("rdbcompression", server.rdb_compression);
     config_get_bool_field("rdbchecksum", server.rdb_checksum);
+    config_get_bool_field("rdb-threaded-loading", server.rdb_threaded_loading);
+    config_get_bool_field("rdb-forkless-save", server.rdb_forkless_save);
     config_get_bool_field("activerehashing", server.activerehashing);
+    config_get_bool_field("io-threads-do-reads", server.io_threads_do_reads);
+    config_get_bool_field("io-uring", server.io_uring);
+    config_get_bool_field("latency-tracking", server.latency_tracking);
     config_get_bool_field("activedefrag", server.active_defrag_enabled);
     config_get_bool_field("protected-mode", server.protected_mode);
     config_get_bool_field("repl-disable-tcp-nodelay",
@@ -1319,12 +1474,16 @@ void configGetCommand(client *c) {
             server.aof_load_truncated);
     config_get_bool_field("aof-use-rdb-preamble",
             server.aof_use_rdb_preamble);
+    config_get_bool_field("aof-multi-part",
+            server.aof_multi_part);
     config_get_bool_field("lazyfree-lazy-eviction",
             server.lazyfree_lazy_eviction);
     config_get_bool_field("lazyfree-lazy-expire",
             server.lazyfree_lazy_expire);
     config_get_bool_field("lazyfree-lazy-server-del",
             server.lazyfree_lazy_server_del);
+    config_get_bool_field("set-roaring-encoding",
+            server.set_roaring_encoding);
     config_get_bool_field("slave-lazy-flush",
             server.repl_slave_lazy_flush);
 
@@ -1339,6 +1498,12 @@ void configGetCommand(client *c) {
             server.aof_fsync,aof_fsync_enum);
     config_get_enum_field("syslog-facility",
             server.syslog_facility,syslog_facility_enum);
+    config_get_enum_field("rdb-compression-codec",
+            server.rdb_compression_codec,compression_codec_enum);
+    config_get_enum_field("repl-diskless-compression-codec",
+            server.repl_diskless_compression_codec,compression_codec_enum);
+    config_get_enum_field("list-compression-codec",
+            server.list_compression_codec,compression_codec_enum);
 
     /* Everything we can't handle with macros follows. */
 
@@ -1357,6 +1522,14 @@ void configGetCommand(client *c) {
         addReplyBulkCString(c,buf);
         matches++;
     }
+    if (stringmatch(pattern,"latency-tracking-info-percentiles",1)) {
+        sds buf = latencyGetInfoPercentiles();
+
+        addReplyBulkCString(c,"latency-tracking-info-percentiles");
+        addReplyBulkCString(c,buf);
+        sdsfree(buf);
+        matches++;
+    }
     if (stringmatch(pattern,"save",1)) {
         sds buf = sdsempty();
         int j;
@@ -1733,6 +1906,17 @@ void rewriteConfigSaveOption(struct rewriteConfigState *state) {
     rewriteConfigMarkAsProcessed(state,"save");
 }
 
+/* Rewrite the latency-tracking-info-percentiles option. */
+void rewriteConfigLatencyPercentilesOption(struct rewriteConfigState *state) {
+    char *option = "latency-tracking-info-percentiles";
+    sds list = latencyGetInfoPercentiles();
+    sds line = sdscatprintf(sdsempty(),"%s %s",option,list);
+    int force = strcmp(list,CONFIG_DEFAULT_LATENCY_TRACKING_INFO_PERCENTILES);
+
+    sdsfree(list);
+    rewriteConfigRewriteLine(state,option,line,force);
+}
+
 /* Rewrite the dir option, always using absolute paths.*/
 void rewriteConfigDirOption(struct rewriteConfigState *state) {
     char cwd[1024];
@@ -1982,9 +2166,15 @@ int rewriteConfig(char *path) {
     rewriteConfigSyslogfacilityOption(state);
     rewriteConfigSaveOption(state);
     rewriteConfigNumericalOption(state,"databases",server.dbnum,CONFIG_DEFAULT_DBNUM);
+    rewriteConfigNumericalOption(state,"io-threads",server.io_threads_num,CONFIG_DEFAULT_IO_THREADS_NUM);
+    rewriteConfigYesNoOption(state,"io-threads-do-reads",server.io_threads_do_reads,CONFIG_DEFAULT_IO_THREADS_DO_READS);
+    rewriteConfigYesNoOption(state,"io-uring",server.io_uring,CONFIG_DEFAULT_IO_URING);
     rewriteConfigYesNoOption(state,"stop-writes-on-bgsave-error",server.stop_writes_on_bgsave_err,CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR);
     rewriteConfigYesNoOption(state,"rdbcompression",server.rdb_compression,CONFIG_DEFAULT_RDB_COMPRESSION);
     rewriteConfigYesNoOption(state,"rdbchecksum",server.rdb_checksum,CONFIG_DEFAULT_RDB_CHECKSUM);
+    rewriteConfigYesNoOption(state,"rdb-threaded-loading",server.rdb_threaded_loading,CONFIG_DEFAULT_RDB_THREADED_LOADING);
+    rewriteConfigNumericalOption(state,"rdb-segment-threads",server.rdb_segment_threads,CONFIG_DEFAULT_RDB_SEGMENT_THREADS);
+    rewriteConfigYesNoOption(state,"rdb-forkless-save",server.rdb_forkless_save,CONFIG_DEFAULT_RDB_FORKLESS_SAVE);
     rewriteConfigStringOption(state,"dbfilename",server.rdb_filename,CONFIG_DEFAULT_RDB_FILENAME);
     rewriteConfigDirOption(state);
     rewriteConfigSlaveofOption(state);
@@ -2019,7 +2209,11 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"active-defrag-cycle-max",server.active_defrag_cycle_max,CONFIG_DEFAULT_DEFRAG_CYCLE_MAX);
     rewriteConfigYesNoOption(state,"appendonly",server.aof_state != AOF_OFF,0);
     rewriteConfigStringOption(state,"appendfilename",server.aof_filename,CONFIG_DEFAULT_AOF_FILENAME);
+    rewriteConfigStringOption(state,"appenddirname",server.aof_dirname,CONFIG_DEFAULT_AOF_DIRNAME);
     rewriteConfigEnumOption(state,"appendfsync",server.aof_fsync,aof_fsync_enum,CONFIG_DEFAULT_AOF_FSYNC);
+    rewriteConfigEnumOption(state,"rdb-compression-codec",server.rdb_compression_codec,compression_codec_enum,CONFIG_DEFAULT_RDB_COMPRESSION_CODEC);
+    rewriteConfigEnumOption(state,"repl-diskless-compression-codec",server.repl_diskless_compression_codec,compression_codec_enum,CONFIG_DEFAULT_REPL_DISKLESS_COMPRESSION_CODEC);
+    rewriteConfigEnumOption(state,"list-compression-codec",server.list_compression_codec,compression_codec_enum,OBJ_LIST_COMPRESSION_CODEC);
     rewriteConfigYesNoOption(state,"no-appendfsync-on-rewrite",server.aof_no_fsync_on_rewrite,CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE);
     rewriteConfigNumericalOption(state,"auto-aof-rewrite-percentage",server.aof_rewrite_perc,AOF_REWRITE_PERC);
     rewriteConfigBytesOption(state,"auto-aof-rewrite-min-size",server.aof_rewrite_min_size,AOF_REWRITE_MIN_SIZE);
@@ -2031,16 +2225,27 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"cluster-migration-barrier",server.cluster_migration_barrier,CLUSTER_DEFAULT_MIGRATION_BARRIER);
     rewriteConfigNumericalOption(state,"cluster-slave-validity-factor",server.cluster_slave_validity_factor,CLUSTER_DEFAULT_SLAVE_VALIDITY);
     rewriteConfigNumericalOption(state,"slowlog-log-slower-than",server.slowlog_log_slower_than,CONFIG_DEFAULT_SLOWLOG_LOG_SLOWER_THAN);
+    rewriteConfigNumericalOption(state,"slowlog-log-queue-delay-slower-than",server.slowlog_log_queue_delay_slower_than,CONFIG_DEFAULT_SLOWLOG_LOG_QUEUE_DELAY_SLOWER_THAN);
     rewriteConfigNumericalOption(state,"latency-monitor-threshold",server.latency_monitor_threshold,CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD);
+    rewriteConfigYesNoOption(state,"latency-tracking",server.latency_tracking,CONFIG_DEFAULT_LATENCY_TRACKING);
+    rewriteConfigLatencyPercentilesOption(state);
     rewriteConfigNumericalOption(state,"slowlog-max-len",server.slowlog_max_len,CONFIG_DEFAULT_SLOWLOG_MAX_LEN);
     rewriteConfigNotifykeyspaceeventsOption(state);
-    rewriteConfigNumericalOption(state,"hash-max-ziplist-entries",server.hash_max_ziplist_entries,OBJ_HASH_MAX_ZIPLIST_ENTRIES);
-    rewriteConfigNumericalOption(state,"hash-max-ziplist-value",server.hash_max_ziplist_value,OBJ_HASH_MAX_ZIPLIST_VALUE);
-    rewriteConfigNumericalOption(state,"list-max-ziplist-size",server.list_max_ziplist_size,OBJ_LIST_MAX_ZIPLIST_SIZE);
+    rewriteConfigNumericalOption(state,"hash-max-listpack-entries",server.hash_max_listpack_entries,OBJ_HASH_MAX_LISTPACK_ENTRIES);
+    rewriteConfigNumericalOption(state,"hash-max-listpack-value",server.hash_max_listpack_value,OBJ_HASH_MAX_LISTPACK_VALUE);
+    rewriteConfigNumericalOption(state,"list-max-listpack-size",server.list_max_listpack_size,OBJ_LIST_MAX_LISTPACK_SIZE);
     rewriteConfigNumericalOption(state,"list-compress-depth",server.list_compress_depth,OBJ_LIST_COMPRESS_DEPTH);
     rewriteConfigNumericalOption(state,"set-max-intset-entries",server.set_max_intset_entries,OBJ_SET_MAX_INTSET_ENTRIES);
-    rewriteConfigNumericalOption(state,"zset-max-ziplist-entries",server.zset_max_ziplist_entries,OBJ_ZSET_MAX_ZIPLIST_ENTRIES);
-    rewriteConfigNumericalOption(state,"zset-max-ziplist-value",server.zset_max_ziplist_value,OBJ_ZSET_MAX_ZIPLIST_VALUE);
+    rewriteConfigYesNoOption(state,"set-roaring-encoding",server.set_roaring_encoding,CONFIG_DEFAULT_SET_ROARING_ENCODING);
+    rewriteConfigNumericalOption(state,"zset-max-listpack-entries",server.zset_max_listpack_entries,OBJ_ZSET_MAX_LISTPACK_ENTRIES);
+    rewriteConfigNumericalOption(state,"zset-max-listpack-value",server.zset_max_listpack_value,OBJ_ZSET_MAX_LISTPACK_VALUE);
+    /* The ziplist names are aliases of the listpack options above: drop
+     * them from the rewritten file. */
+    rewriteConfigMarkAsProcessed(state,"hash-max-ziplist-entries");
+    rewriteConfigMarkAsProcessed(state,"hash-max-ziplist-value");
+    rewriteConfigMarkAsProcessed(state,"list-max-ziplist-size");
+    rewriteConfigMarkAsProcessed(state,"zset-max-ziplist-entries");
+    rewriteConfigMarkAsProcessed(state,"zset-max-ziplist-value");
     rewriteConfigNumericalOption(state,"hll-sparse-max-bytes",server.hll_sparse_max_bytes,CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES);
     rewriteConfigYesNoOption(state,"activerehashing",server.activerehashing,CONFIG_DEFAULT_ACTIVE_REHASHING);
     rewriteConfigYesNoOption(state,"activedefrag",server.active_defrag_enabled,CONFIG_DEFAULT_ACTIVE_DEFRAG);
@@ -2050,6 +2255,7 @@ int rewriteConfig(char *path) {
     rewriteConfigYesNoOption(state,"aof-rewrite-incremental-fsync",server.aof_rewrite_incremental_fsync,CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC);
     rewriteConfigYesNoOption(state,"aof-load-truncated",server.aof_load_truncated,CONFIG_DEFAULT_AOF_LOAD_TRUNCATED);
     rewriteConfigYesNoOption(state,"aof-use-rdb-preamble",server.aof_use_rdb_preamble,CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE);
+    rewriteConfigYesNoOption(state,"aof-multi-part",server.aof_multi_part,CONFIG_DEFAULT_AOF_MULTI_PART);
     rewriteConfigEnumOption(state,"supervised",server.supervised_mode,supervised_mode_enum,SUPERVISED_NONE);
     rewriteConfigYesNoOption(state,"lazyfree-lazy-eviction",server.lazyfree_lazy_eviction,CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION);
     rewriteConfigYesNoOption(state,"lazyfree-lazy-expire",server.lazyfree_lazy_expire,CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE);
@@ -76,6 +76,20 @@
 #define HAVE_EPOLL 1
 #endif
 
+/* io_uring, selectable at runtime, see aeUseIouring(). */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+/* AVX2 kernels, compiled with target attributes and selected at runtime
+ * with __builtin_cpu_supports(). */
+#if defined(__x86_64__) && ((defined(__GNUC__) && __GNUC__ >= 5) || \
+                            (defined(__clang__) && __clang_major__ >= 4))
+#define HAVE_AVX2 1
+#endif
+
 #if (defined(__APPLE__) && defined(MAC_OS_X_VERSION_10_6)) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
 #define HAVE_KQUEUE 1
 #endif
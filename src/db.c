@@ -144,6 +144,7 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
  * Returns the linked value object if the key exists or NULL if the key
  * does not exist in the specified DB. */
 robj *lookupKeyWrite(redisDb *db, robj *key) {
+    if (rdbForklessSaveInProgress()) rdbSaveForklessKeyWillChange(db,key->ptr);
     expireIfNeeded(db,key);
     return lookupKey(db,key,LOOKUP_NONE);
 }
@@ -161,14 +162,26 @@ robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply) {
 }
 
 /* Add the key to the DB. It's up to the caller to increment the reference
- * counter of the value if needed.
+ * counter of the value if needed. The key name is copied inside the dict
+ * entry, so the caller retains ownership of 'key'.
  *
  * The program is aborted if the key already exists. */
 void dbAdd(redisDb *db, robj *key, robj *val) {
-    sds copy = sdsdup(key->ptr);
-    int retval = dictAdd(db->dict, copy, val);
+    int was_rehashing = dictIsRehashing(db->dict);
+    mstime_t latency;
+
+    if (rdbForklessSaveInProgress()) rdbSaveForklessKeyAdded(db,key->ptr);
+    latencyStartMonitor(latency);
+    dictEntry *de = dictAddRaw(db->dict, key->ptr, NULL);
+    latencyEndMonitor(latency);
+    /* Adding the key may have started a rehashing, allocating the new
+     * table: report it as a rehashing phase. */
+    if (!was_rehashing && dictIsRehashing(db->dict))
+        latencyAddSampleIfNeeded("rehash-expand",latency);
 
-    serverAssertWithInfo(NULL,key,retval == DICT_OK);
+    serverAssertWithInfo(NULL,key,de != NULL);
+    dictSetVal(db->dict, de, val);
+    dbEntrySetExpire(de, -1);
     if (val->type == OBJ_LIST) signalListAsReady(db, key);
     if (server.cluster_enabled) slotToKeyAdd(key);
  }
@@ -179,6 +192,7 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
  *
  * The program is aborted if the key was not already present. */
 void dbOverwrite(redisDb *db, robj *key, robj *val) {
+    if (rdbForklessSaveInProgress()) rdbSaveForklessKeyWillChange(db,key->ptr);
     dictEntry *de = dictFind(db->dict,key->ptr);
 
     serverAssertWithInfo(NULL,key,de != NULL);
@@ -234,7 +248,7 @@ robj *dbRandomKey(redisDb *db) {
 
         key = dictGetKey(de);
         keyobj = createStringObject(key,sdslen(key));
-        if (dictFind(db->expires,key)) {
+        if (dbEntryGetExpire(de) != -1) {
             if (expireIfNeeded(db,keyobj)) {
                 decrRefCount(keyobj);
                 continue; /* search for another key. This expired. */
@@ -247,10 +261,14 @@ robj *dbRandomKey(redisDb *db) {
 /* 同步删除键，同时删除过期字典和键空间字典中的值 */
 /* Delete a key, value, and associated expiration entry if any, from the DB */
 int dbSyncDelete(redisDb *db, robj *key) {
-    /* Deleting an entry from the expires dict will not free the sds of
-     * the key, because it is shared with the main dictionary. */
-    if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
-    if (dictDelete(db->dict,key->ptr) == DICT_OK) {
+    if (rdbForklessSaveInProgress()) rdbSaveForklessKeyWillChange(db,key->ptr);
+    dictEntry *de = dictUnlink(db->dict,key->ptr);
+    if (de) {
+        /* The expires index references the key name stored in the entry:
+         * drop it before releasing the entry. */
+        long long when = dbEntryGetExpire(de);
+        if (when != -1) expiresIndexDel(db,dictGetKey(de),when);
+        dictFreeUnlinkedEntry(db->dict,de);
         if (server.cluster_enabled) slotToKeyDel(key);
         return 1;
     } else {
@@ -325,6 +343,7 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
         errno = EINVAL;
         return -1;
     }
+    if (rdbForklessSaveInProgress()) rdbSaveForklessDbWillChange(dbnum);
 
     for (j = 0; j < server.dbnum; j++) {
         if (dbnum != -1 && dbnum != j) continue;
@@ -333,7 +352,8 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
             emptyDbAsync(&server.db[j]);
         } else {
             dictEmpty(server.db[j].dict,callback);
-            dictEmpty(server.db[j].expires,callback);
+            ttlWheelRelease(server.db[j].expires);
+            server.db[j].expires = expiresIndexCreate(server.db[j].dict);
         }
     }
     if (server.cluster_enabled) {
@@ -417,12 +437,12 @@ void flushallCommand(client *c) {
 
     if (getFlushCommandFlags(c,&flags) == C_ERR) return;
     signalFlushedDb(-1);
+    /* 先终止正在进行的 BGSAVE：无 fork 快照不必再把整个数据集写入文件。
+     * Kill the running BGSAVE first: a fork-less snapshot would otherwise
+     * write the whole dataset out before it is flushed. */
+    if (server.rdb_child_pid != -1) killRDBChild();
     server.dirty += emptyDb(-1,flags,NULL);
     addReply(c,shared.ok);
-    if (server.rdb_child_pid != -1) {
-        kill(server.rdb_child_pid,SIGUSR1);
-        rdbRemoveTempFile(server.rdb_child_pid);
-    }
     if (server.saveparamslen > 0) {
         /* Normally rdbSave() will reset dirty, but we don't want this here
          * as otherwise FLUSHALL will not be replicated nor put into the AOF. */
@@ -554,7 +574,7 @@ void scanCallback(void *privdata, const dictEntry *de) {
     } else if (o->type == OBJ_ZSET) {
         sds sdskey = dictGetKey(de);
         key = createStringObject(sdskey,sdslen(sdskey));
-        val = createStringObjectFromLongDouble(*(double*)dictGetVal(de),0);
+        val = createStringObjectFromLongDouble(dictGetDoubleVal(de),0);
     } else {
         serverPanic("Type not handled in SCAN callback.");
     }
@@ -643,7 +663,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
 
     /* Step 2: Iterate the collection.
      *
-     * Note that if the object is encoded with a ziplist, intset, or any other
+     * Note that if the object is encoded with a listpack, intset, or any other
      * representation that is not a hash table, we are sure that it is also
      * composed of a small number of elements. So to avoid taking state we
      * just return everything inside the object in a single call, setting the
@@ -658,7 +678,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     } else if (o->type == OBJ_HASH && o->encoding == OBJ_ENCODING_HT) {
         ht = o->ptr;
         count *= 2; /* We return key / value for this type. */
-    } else if (o->type == OBJ_ZSET && o->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (o->type == OBJ_ZSET && o->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = o->ptr;
         ht = zs->dict;
         count *= 2; /* We return key / value for this type. */
@@ -682,6 +702,24 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         } while (cursor &&
               maxiterations-- &&
               listLength(keys) < (unsigned long)count);
+    } else if (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_ROARING) {
+        /* Roaring sets are large but ordered: the cursor is the next
+         * member to return, biased so that the smallest member is 0. */
+        roaringIterator ri;
+        int64_t ll;
+        uint64_t next = cursor;
+
+        roaringInitIterator(o->ptr,&ri);
+        roaringIteratorSeek(&ri,(int64_t)(next ^ (1ULL<<63)));
+        cursor = 0;
+        while (listLength(keys) < (unsigned long)count &&
+               roaringNext(&ri,&ll))
+        {
+            listAddNodeTail(keys,createStringObjectFromLongLong(ll));
+            cursor = ((uint64_t)ll ^ (1ULL<<63)) + 1;
+        }
+        /* Signal the end when there is nothing left past this call. */
+        if (!roaringNext(&ri,&ll)) cursor = 0;
     } else if (o->type == OBJ_SET) {
         int pos = 0;
         int64_t ll;
@@ -690,17 +728,17 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
             listAddNodeTail(keys,createStringObjectFromLongLong(ll));
         cursor = 0;
     } else if (o->type == OBJ_HASH || o->type == OBJ_ZSET) {
-        unsigned char *p = ziplistIndex(o->ptr,0);
+        unsigned char *p = lpFirst(o->ptr);
         unsigned char *vstr;
         unsigned int vlen;
         long long vll;
 
         while(p) {
-            ziplistGet(p,&vstr,&vlen,&vll);
+            vstr = lpGetValue(p,&vlen,&vll);
             listAddNodeTail(keys,
                 (vstr != NULL) ? createStringObject((char*)vstr,vlen) :
                                  createStringObjectFromLongLong(vll));
-            p = ziplistNext(o->ptr,p);
+            p = lpNext(o->ptr,p);
         }
         cursor = 0;
     } else {
@@ -970,6 +1008,10 @@ int dbSwapDatabases(int id1, int id2) {
     if (id1 < 0 || id1 >= server.dbnum ||
         id2 < 0 || id2 >= server.dbnum) return C_ERR;
     if (id1 == id2) return C_OK;
+    if (rdbForklessSaveInProgress()) {
+        rdbSaveForklessDbWillChange(id1);
+        rdbSaveForklessDbWillChange(id2);
+    }
     redisDb aux = server.db[id1];
     redisDb *db1 = &server.db[id1], *db2 = &server.db[id2];
 
@@ -1029,13 +1071,60 @@ void swapdbCommand(client *c) {
 
 /*-----------------------------------------------------------------------------
  * Expires API
+ *
+ * The expire time of a key is stored in the metadata of its entry in the
+ * main dict (see dbEntryGetExpire()), so that reading it costs no additional
+ * lookup. Keys with an expire set are also indexed in db->expires, a timing
+ * wheel (see ttlwheel.c) bucketing them by expire time, so that the active
+ * expire cycle can reclaim keys in the order they expire instead of sampling
+ * them at random.
+ *
+ * The wheel stores the pointer to the key name stored in the main dict
+ * entry, taking a single pointer per key: the index does not hold a second
+ * copy of the key, but the key must be removed from it before the entry is
+ * released.
  *----------------------------------------------------------------------------*/
 
+/* 过期索引级联时通过键空间字典读取键的过期时间 */
+/* The wheel reads the expire of a key from the keyspace it was created for.
+ * The keyspace and its wheel are always replaced and swapped together. */
+static long long expiresIndexGetExpire(void *key, void *privdata) {
+    dictEntry *de = dictFind(privdata,key);
+
+    serverAssert(de != NULL && dictGetKey(de) == key);
+    return dbEntryGetExpire(de);
+}
+
+/* Create the expires index of the keyspace 'keyspace'. */
+ttlWheel *expiresIndexCreate(dict *keyspace) {
+    return ttlWheelCreate(expiresIndexGetExpire,keyspace);
+}
+
+/* Add the key name 'key', that must be the one stored in the main dict
+ * entry, expiring at 'when', to the expires index. */
+void expiresIndexAdd(redisDb *db, sds key, long long when) {
+    ttlWheelAdd(db->expires,key,when,mstime());
+}
+
+/* Remove the key name 'key' expiring at 'when' from the expires index.
+ * 'key' is only used as a pointer value, so it is valid to call this
+ * function after the key name was moved or released. */
+void expiresIndexDel(redisDb *db, sds key, long long when) {
+    ttlWheelDel(db->expires,key,when,mstime());
+}
+
 int removeExpire(redisDb *db, robj *key) {
+    if (rdbForklessSaveInProgress()) rdbSaveForklessKeyWillChange(db,key->ptr);
     /* An expire may only be removed if there is a corresponding entry in the
      * main dict. Otherwise, the key will never be freed. */
-    serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
-    return dictDelete(db->expires,key->ptr) == DICT_OK;
+    dictEntry *de = dictFind(db->dict,key->ptr);
+    serverAssertWithInfo(NULL,key,de != NULL);
+
+    long long when = dbEntryGetExpire(de);
+    if (when == -1) return 0;
+    expiresIndexDel(db,dictGetKey(de),when);
+    dbEntrySetExpire(de,-1);
+    return 1;
 }
 
 /* Set an expire to the specified key. If the expire is set in the context
@@ -1043,13 +1132,18 @@ int removeExpire(redisDb *db, robj *key) {
  * to NULL. The 'when' parameter is the absolute unix time in milliseconds
  * after which the key will no longer be considered valid. */
 void setExpire(client *c, redisDb *db, robj *key, long long when) {
-    dictEntry *kde, *de;
+    dictEntry *de;
 
-    /* Reuse the sds from the main dict in the expire dict */
-    kde = dictFind(db->dict,key->ptr);
-    serverAssertWithInfo(NULL,key,kde != NULL);
-    de = dictAddOrFind(db->expires,dictGetKey(kde));
-    dictSetSignedIntegerVal(de,when);
+    if (rdbForklessSaveInProgress()) rdbSaveForklessKeyWillChange(db,key->ptr);
+    /* The expire is stored in the main dict entry. */
+    de = dictFind(db->dict,key->ptr);
+    serverAssertWithInfo(NULL,key,de != NULL);
+    long long old = dbEntryGetExpire(de);
+    if (old != when) {
+        if (old != -1) expiresIndexDel(db,dictGetKey(de),old);
+        expiresIndexAdd(db,dictGetKey(de),when);
+        dbEntrySetExpire(de,when);
+    }
 
     int writable_slave = server.masterhost && server.repl_slave_ro == 0;
     if (c && writable_slave && !(c->flags & CLIENT_MASTER))
@@ -1062,16 +1156,12 @@ void setExpire(client *c, redisDb *db, robj *key, long long when) {
 long long getExpire(redisDb *db, robj *key) {
     dictEntry *de;
 
-    /* 过期字典是空的 或者在该字典没有找到过期键，则返回-1 */
+    /* 没有任何过期键 或者键不存在，则返回-1 */
     /* No expire? return ASAP */
-    if (dictSize(db->expires) == 0 ||
-       (de = dictFind(db->expires,key->ptr)) == NULL) return -1;
-
-    /* 再次确认，如果一个键在过期字典空，那就一定在键空间字典中 */
-    /* The entry was found in the expire dict, this means it should also
-     * be present in the main dict (safety check). */
-    serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
-    return dictGetSignedIntegerVal(de); /* 返回过期时间 */
+    if (ttlWheelSize(db->expires) == 0 ||
+       (de = dictFind(db->dict,key->ptr)) == NULL) return -1;
+
+    return dbEntryGetExpire(de); /* 返回过期时间 */
 }
 
 /* 告知从库和aof文件，数据库的键过期了 */
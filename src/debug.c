@@ -174,7 +174,7 @@ void computeDatasetDigest(unsigned char *final) {
             } else if (o->type == OBJ_ZSET) {
                 unsigned char eledigest[20];
 
-                if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+                if (o->encoding == OBJ_ENCODING_LISTPACK) {
                     unsigned char *zl = o->ptr;
                     unsigned char *eptr, *sptr;
                     unsigned char *vstr;
@@ -182,13 +182,13 @@ void computeDatasetDigest(unsigned char *final) {
                     long long vll;
                     double score;
 
-                    eptr = ziplistIndex(zl,0);
+                    eptr = lpSeek(zl,0);
                     serverAssert(eptr != NULL);
-                    sptr = ziplistNext(zl,eptr);
+                    sptr = lpNext(zl,eptr);
                     serverAssert(sptr != NULL);
 
                     while (eptr != NULL) {
-                        serverAssert(ziplistGet(eptr,&vstr,&vlen,&vll));
+                        vstr = lpGetValue(eptr,&vlen,&vll);
                         score = zzlGetScore(sptr);
 
                         memset(eledigest,0,20);
@@ -204,16 +204,16 @@ void computeDatasetDigest(unsigned char *final) {
                         xorDigest(digest,eledigest,20);
                         zzlNext(zl,&eptr,&sptr);
                     }
-                } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+                } else if (o->encoding == OBJ_ENCODING_BTREE) {
                     zset *zs = o->ptr;
                     dictIterator *di = dictGetIterator(zs->dict);
                     dictEntry *de;
 
                     while((de = dictNext(di)) != NULL) {
                         sds sdsele = dictGetKey(de);
-                        double *score = dictGetVal(de);
+                        double score = dictGetDoubleVal(de);
 
-                        snprintf(buf,sizeof(buf),"%.17g",*score);
+                        snprintf(buf,sizeof(buf),"%.17g",score);
                         memset(eledigest,0,20);
                         mixDigest(eledigest,sdsele,sdslen(sdsele));
                         mixDigest(eledigest,buf,strlen(buf));
@@ -291,7 +291,7 @@ void debugCommand(client *c) {
         blen++; addReplyStatus(c,
         "sdslen <key> -- Show low level SDS string info representing key and value.");
         blen++; addReplyStatus(c,
-        "ziplist <key> -- Show low level info about the ziplist encoding.");
+        "listpack <key> -- Show low level info about the listpack encoding.");
         blen++; addReplyStatus(c,
         "populate <count> [prefix] [size] -- Create <count> string keys named key:<num>. If a prefix is specified is used instead of the 'key' prefix.");
         blen++; addReplyStatus(c,
@@ -353,7 +353,7 @@ void debugCommand(client *c) {
     } else if (!strcasecmp(c->argv[1]->ptr,"loadaof")) {
         if (server.aof_state == AOF_ON) flushAppendOnlyFile(1);
         emptyDb(-1,EMPTYDB_NO_FLAGS,NULL);
-        if (loadAppendOnlyFile(server.aof_filename) != C_OK) {
+        if (loadAppendOnlyFiles() != C_OK) {
             addReply(c,shared.err);
             return;
         }
@@ -386,8 +386,8 @@ void debugCommand(client *c) {
             used = snprintf(nextra, remaining, " ql_avg_node:%.2f", avg);
             nextra += used;
             remaining -= used;
-            /* Add quicklist fill level / max ziplist size */
-            used = snprintf(nextra, remaining, " ql_ziplist_max:%d", ql->fill);
+            /* Add quicklist fill level / max listpack size */
+            used = snprintf(nextra, remaining, " ql_listpack_max:%d", ql->fill);
             nextra += used;
             remaining -= used;
             /* Add isCompressed? */
@@ -432,22 +432,22 @@ void debugCommand(client *c) {
                 "val_sds_len:%lld, val_sds_avail:%lld, val_zmalloc: %lld",
                 (long long) sdslen(key),
                 (long long) sdsavail(key),
-                (long long) sdsZmallocSize(key),
+                (long long) sdsAllocSize(key),
                 (long long) sdslen(val->ptr),
                 (long long) sdsavail(val->ptr),
                 (long long) getStringObjectSdsUsedMemory(val));
         }
-    } else if (!strcasecmp(c->argv[1]->ptr,"ziplist") && c->argc == 3) {
+    } else if (!strcasecmp(c->argv[1]->ptr,"listpack") && c->argc == 3) {
         robj *o;
 
         if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nokeyerr))
                 == NULL) return;
 
-        if (o->encoding != OBJ_ENCODING_ZIPLIST) {
-            addReplyError(c,"Not an sds encoded string.");
+        if (o->encoding != OBJ_ENCODING_LISTPACK) {
+            addReplyError(c,"Not a listpack encoded object.");
         } else {
-            ziplistRepr(o->ptr);
-            addReplyStatus(c,"Ziplist structure printed on stdout");
+            lpRepr(o->ptr);
+            addReplyStatus(c,"Listpack structure printed on stdout");
         }
     } else if (!strcasecmp(c->argv[1]->ptr,"populate") &&
                c->argc >= 3 && c->argc <= 5) {
@@ -546,9 +546,10 @@ void debugCommand(client *c) {
         dictGetStats(buf,sizeof(buf),server.db[dbid].dict);
         stats = sdscat(stats,buf);
 
-        stats = sdscatprintf(stats,"[Expires HT]\n");
-        dictGetStats(buf,sizeof(buf),server.db[dbid].expires);
-        stats = sdscat(stats,buf);
+        stats = sdscatprintf(stats,"[Expires index]\n");
+        stats = sdscatprintf(stats,"Timing wheel with %llu keys in %llu buckets\n",
+            (unsigned long long) ttlWheelSize(server.db[dbid].expires),
+            (unsigned long long) raxSize(server.db[dbid].expires->buckets));
 
         addReplyBulkSds(c,stats);
     } else if (!strcasecmp(c->argv[1]->ptr,"change-repl-id") && c->argc == 2) {
@@ -620,8 +621,8 @@ void serverLogObjectDebugInfo(const robj *o) {
         serverLog(LL_WARNING,"Hash size: %d", (int) hashTypeLength(o));
     } else if (o->type == OBJ_ZSET) {
         serverLog(LL_WARNING,"Sorted set size: %d", (int) zsetLength(o));
-        if (o->encoding == OBJ_ENCODING_SKIPLIST)
-            serverLog(LL_WARNING,"Skiplist level: %d", (int) ((const zset*)o->ptr)->zsl->level);
+        if (o->encoding == OBJ_ENCODING_BTREE)
+            serverLog(LL_WARNING,"B+tree height: %d", ((const zset*)o->ptr)->zbt->height);
     }
 }
 
@@ -1064,6 +1065,7 @@ void sigsegvHandler(int sig, siginfo_t *info, void *secret) {
     /* Test memory */
     serverLogRaw(LL_WARNING|LL_RAW, "\n------ FAST MEMORY TEST ------\n");
     bioKillThreads();
+    killIOThreads();
     if (memtest_test_linux_anonymous_maps()) {
         serverLogRaw(LL_WARNING|LL_RAW,
             "!!! MEMORY ERROR DETECTED! Check your memory ASAP !!!\n");
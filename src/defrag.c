@@ -187,86 +187,20 @@ int dictDefragTables(dict** dictRef) {
     return defragged;
 }
 
-/* Internal function used by zslDefrag */
-void zslUpdateNode(zskiplist *zsl, zskiplistNode *oldnode, zskiplistNode *newnode, zskiplistNode **update) {
-    int i;
-    for (i = 0; i < zsl->level; i++) {
-        if (update[i]->level[i].forward == oldnode)
-            update[i]->level[i].forward = newnode;
-    }
-    serverAssert(zsl->header!=oldnode);
-    if (newnode->level[0].forward) {
-        serverAssert(newnode->level[0].forward->backward==oldnode);
-        newnode->level[0].forward->backward = newnode;
-    } else {
-        serverAssert(zsl->tail==oldnode);
-        zsl->tail = newnode;
-    }
-}
-
-/* Defrag helper for sorted set.
- * Update the robj pointer, defrag the skiplist struct and return the new score
- * reference. We may not access oldele pointer (not even the pointer stored in
- * the skiplist), as it was already freed. Newele may be null, in which case we
- * only need to defrag the skiplist, but not update the obj pointer.
- * When return value is non-NULL, it is the score reference that must be updated
- * in the dict record. */
-double *zslDefrag(zskiplist *zsl, double score, sds oldele, sds newele) {
-    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x, *newx;
-    int i;
-    sds ele = newele? newele: oldele;
-
-    /* find the skiplist node referring to the object that was moved,
-     * and all pointers that need to be updated if we'll end up moving the skiplist node. */
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        while (x->level[i].forward &&
-            x->level[i].forward->ele != oldele && /* make sure not to access the
-                                                     ->obj pointer if it matches
-                                                     oldele */
-            (x->level[i].forward->score < score ||
-                (x->level[i].forward->score == score &&
-                sdscmp(x->level[i].forward->ele,ele) < 0)))
-            x = x->level[i].forward;
-        update[i] = x;
-    }
-
-    /* update the robj pointer inside the skip list record. */
-    x = x->level[0].forward;
-    serverAssert(x && score == x->score && x->ele==oldele);
-    if (newele)
-        x->ele = newele;
-
-    /* try to defrag the skiplist record itself */
-    newx = activeDefragAlloc(x);
-    if (newx) {
-        zslUpdateNode(zsl, x, newx, update);
-        return &newx->score;
-    }
-    return NULL;
-}
-
-/* Utility function that replaces an old key pointer in the dictionary with a
- * new pointer. Additionally, we try to defrag the dictEntry in that dict.
- * Oldkey mey be a dead pointer and should not be accessed (we get a
- * pre-calculated hash value). Newkey may be null if the key pointer wasn't
- * moved. Return value is the the dictEntry if found, or NULL if not found.
- * NOTE: this is very ugly code, but it let's us avoid the complication of
- * doing a scan on another dict. */
-dictEntry* replaceSateliteDictKeyPtrAndOrDefragDictEntry(dict *d, sds oldkey, sds newkey, unsigned int hash, int *defragged) {
-    dictEntry **deref = dictFindEntryRefByPtrAndHash(d, oldkey, hash);
-    if (deref) {
-        dictEntry *de = *deref;
-        dictEntry *newde = activeDefragAlloc(de);
-        if (newde) {
-            de = *deref = newde;
-            (*defragged)++;
-        }
-        if (newkey)
-            de->key = newkey;
-        return de;
-    }
-    return NULL;
+/* Defrag helper for sorted set members, called by zbtDefrag() on every
+ * member of the B+tree. The member is also the key of its hash table entry,
+ * which is looked up before the SDS string is moved, since we may not access
+ * the old string afterwards. Returns the new string, or NULL if it was not
+ * moved. */
+sds zsetDefragEle(sds ele, void *privdata) {
+    dict *d = privdata;
+    dictEntry *de = dictFind(d,ele);
+    sds newele;
+
+    serverAssert(de != NULL);
+    if ((newele = activeDefragSds(ele)))
+        de->key = newele;
+    return newele;
 }
 
 /* for each key we scan in the main dict, this function will attempt to defrag
@@ -279,18 +213,28 @@ int defragKey(redisDb *db, dictEntry *de) {
     dict *d;
     dictIterator *di;
     int defragged = 0;
-    sds newsds;
-
-    /* Try to defrag the key name. */
-    newsds = activeDefragSds(keysds);
-    if (newsds)
-        defragged++, de->key = newsds;
-    if (dictSize(db->expires)) {
-         /* Dirty code:
-          * I can't search in db->expires for that key after i already released
-          * the pointer it holds it won't be able to do the string compare */
-        uint64_t hash = dictGetHash(db->dict, de->key);
-        replaceSateliteDictKeyPtrAndOrDefragDictEntry(db->expires, keysds, newsds, hash, &defragged);
+    sds newsds = NULL;
+
+    /* The key name is embedded in the dict entry: try to move the entry
+     * as a whole, fixing the reference held by its bucket. This is safe
+     * while scanning since dictScan() fetches the next entry before
+     * calling us. */
+    dictEntry **deref = dictFindEntryRefByPtrAndHash(db->dict, keysds, dictEntryHash(de));
+    if (deref) {
+        size_t keyoff = (char*)keysds - (char*)de;
+        dictEntry *newde = activeDefragAlloc(de);
+        if (newde) {
+            de = *deref = newde;
+            de->key = newsds = (char*)newde + keyoff;
+            defragged++;
+
+            /* The expires index references the key name by pointer. */
+            long long when = dbEntryGetExpire(de);
+            if (when != -1) {
+                expiresIndexDel(db, keysds, when);
+                expiresIndexAdd(db, newsds, when);
+            }
+        }
     }
 
     /* Try to defrag robj and / or string value. */
@@ -321,11 +265,11 @@ int defragKey(redisDb *db, dictEntry *de) {
                     node = newnode;
                     defragged++;
                 }
-                if ((newzl = activeDefragAlloc(node->zl)))
-                    defragged++, node->zl = newzl;
+                if ((newzl = activeDefragAlloc(node->entry)))
+                    defragged++, node->entry = newzl;
                 node = node->next;
             }
-        } else if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
+        } else if (ob->encoding == OBJ_ENCODING_LISTPACK) {
             if ((newzl = activeDefragAlloc(ob->ptr)))
                 defragged++, ob->ptr = newzl;
         } else {
@@ -348,45 +292,50 @@ int defragKey(redisDb *db, dictEntry *de) {
             intset *newis = activeDefragAlloc(is);
             if (newis)
                 defragged++, ob->ptr = newis;
+        } else if (ob->encoding == OBJ_ENCODING_ROARING) {
+            roaring *r = ob->ptr, *newr;
+            roaringContainer *newc;
+            void *newdata;
+            uint32_t k;
+
+            if ((newr = activeDefragAlloc(r)))
+                defragged++, ob->ptr = r = newr;
+            if (r->c && (newc = activeDefragAlloc(r->c)))
+                defragged++, r->c = newc;
+            for (k = 0; k < r->len; k++) {
+                if ((newdata = activeDefragAlloc(r->c[k].data)))
+                    defragged++, r->c[k].data = newdata;
+            }
         } else {
             serverPanic("Unknown set encoding");
         }
     } else if (ob->type == OBJ_ZSET) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (ob->encoding == OBJ_ENCODING_LISTPACK) {
             if ((newzl = activeDefragAlloc(ob->ptr)))
                 defragged++, ob->ptr = newzl;
-        } else if (ob->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (ob->encoding == OBJ_ENCODING_BTREE) {
             zset *zs = (zset*)ob->ptr;
             zset *newzs;
-            zskiplist *newzsl;
-            struct zskiplistNode *newheader;
+            zbtree *newzbt;
             if ((newzs = activeDefragAlloc(zs)))
                 defragged++, ob->ptr = zs = newzs;
-            if ((newzsl = activeDefragAlloc(zs->zsl)))
-                defragged++, zs->zsl = newzsl;
-            if ((newheader = activeDefragAlloc(zs->zsl->header)))
-                defragged++, zs->zsl->header = newheader;
+            if ((newzbt = activeDefragAlloc(zs->zbt)))
+                defragged++, zs->zbt = newzbt;
+            /* Nodes and members. The scores are stored by value in the
+             * hash table, so nothing there references the tree nodes. */
+            defragged += zbtDefrag(zs->zbt,activeDefragAlloc,zsetDefragEle,
+                                   zs->dict);
             d = zs->dict;
             di = dictGetIterator(d);
-            while((de = dictNext(di)) != NULL) {
-                double* newscore;
-                sds sdsele = dictGetKey(de);
-                if ((newsds = activeDefragSds(sdsele)))
-                    defragged++, de->key = newsds;
-                newscore = zslDefrag(zs->zsl, *(double*)dictGetVal(de), sdsele, newsds);
-                if (newscore) {
-                    dictSetVal(d, de, newscore);
-                    defragged++;
-                }
+            while((de = dictNext(di)) != NULL)
                 defragged += dictIterDefragEntry(di);
-            }
             dictReleaseIterator(di);
             dictDefragTables(&zs->dict);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (ob->type == OBJ_HASH) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (ob->encoding == OBJ_ENCODING_LISTPACK) {
             if ((newzl = activeDefragAlloc(ob->ptr)))
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_HT) {
@@ -62,6 +62,15 @@
 static int dict_can_resize = 1; /* 标记字典是否可收缩 */
 static unsigned int dict_force_resize_ratio = 5; /* 达到这个概率时，可强制进行resize */
 
+/* An entry matches the key we are looking for if it is the same pointer, or
+ * if the key compare function says so. When the hash is cached inside the
+ * entry (see storeHash in dictType), entries in the same bucket with another
+ * hash are skipped without accessing their key, saving a cache miss. */
+#define dictEntryMatches(d, he, key, h) \
+    ((key) == (he)->key || \
+     ((!(d)->type->storeHash || dictEntryHash(he) == (h)) && \
+      dictCompareKeys(d, key, (he)->key)))
+
 /* -------------------------- private prototypes ---------------------------- */
 
 static int _dictExpandIfNeeded(dict *ht);
@@ -221,8 +230,11 @@ int dictRehash(dict *d, int n) {
             uint64_t h;
 
             nextde = de->next;
-            /* Get the index in the new hash table */
-            h = dictHashKey(d, de->key) & d->ht[1].sizemask;
+            /* Get the index in the new hash table. When the hash is cached
+             * in the entry we don't need to access the key at all. */
+            h = (d->type->storeHash ? dictEntryHash(de) :
+                                      dictHashKey(d, de->key));
+            h &= d->ht[1].sizemask;
             de->next = d->ht[1].table[h];
             d->ht[1].table[h] = de;
             d->ht[0].used--;
@@ -257,6 +269,14 @@ long long timeInMilliseconds(void) {
     return (((long long)tv.tv_sec)*1000)+(tv.tv_usec/1000);
 }
 
+/* 获取微秒级别的时间戳 */
+long long timeInMicroseconds(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
 /* 在指定时间内进行rehash */
 /* Rehash for an amount of time between ms milliseconds and ms+1 milliseconds */
 int dictRehashMilliseconds(dict *d, int ms) {
@@ -270,6 +290,30 @@ int dictRehashMilliseconds(dict *d, int ms) {
     return rehashes;
 }
 
+/* 在指定的微秒数内进行rehash，每次检查时间之间的步数会逐渐减小 */
+/* Rehash for about 'us' microseconds. This is like dictRehashMilliseconds()
+ * but with a finer granularity, so that callers running many times per
+ * second can use a small time budget. We check the clock every 'step'
+ * buckets, starting with 100 buckets and halving the step when a batch alone
+ * used more than a quarter of the budget (as it happens when the buckets
+ * contain long chains), so that we don't overshoot the budget by much.
+ *
+ * Returns the number of buckets rehashed (or visited, since empty buckets
+ * count as steps too). */
+int dictRehashMicroseconds(dict *d, long long us) {
+    long long start = timeInMicroseconds(), last = start, now;
+    int rehashes = 0, step = 100;
+
+    while(dictRehash(d,step)) {
+        rehashes += step;
+        now = timeInMicroseconds();
+        if (now-start > us) break;
+        if (step > 1 && (now-last)*4 > us) step /= 2;
+        last = now;
+    }
+    return rehashes;
+}
+
 /* This function performs just a step of rehashing, and only if there are
  * no safe iterators bound to our hash table. When we have iterators in the
  * middle of a rehashing we can't mess with the two hash tables otherwise
@@ -320,6 +364,8 @@ dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing)
     long index;
     dictEntry *entry;
     dictht *ht;
+    uint64_t hash;
+    size_t hashsize, metasize;
 
     /* 判断当前是否正在rehash */
     if (dictIsRehashing(d)) _dictRehashStep(d);
@@ -327,7 +373,8 @@ dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing)
     /* 获取新元素的下标，如果元素已经存在，返回-1 */
     /* Get the index of the new element, or -1 if
      * the element already exists. */
-    if ((index = _dictKeyIndex(d, key, dictHashKey(d,key), existing)) == -1)
+    hash = dictHashKey(d,key);
+    if ((index = _dictKeyIndex(d, key, hash, existing)) == -1)
         return NULL;
 
     /* 申请内存，存储监键值对
@@ -340,14 +387,27 @@ dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing)
      * system it is more likely that recently added entries are accessed
      * more frequently. */
     ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
-    entry = zmalloc(sizeof(*entry));
+    hashsize = dictHashBytes(d);
+    metasize = dictMetadataSize(d);
+    if (d->type->keyEmbedLen) {
+        /* 键直接拷贝到实体的附加数据之后，与实体共用一块内存，释放实体时一起释放 */
+        /* The key is copied right after the entry metadata, in the same
+         * allocation, and is released together with the entry. */
+        entry = zmalloc(sizeof(*entry)+hashsize+metasize+
+                        d->type->keyEmbedLen(key));
+        entry->key = d->type->keyEmbed((char*)entry->metadata+hashsize+metasize,
+                                       key);
+    } else {
+        entry = zmalloc(sizeof(*entry)+hashsize+metasize);
+        /* 设置该实体的键 */
+        /* Set the hash entry fields. */
+        dictSetKey(d, entry, key);
+    }
+    if (metasize) memset(dictMetadata(d,entry),0,metasize);
+    if (hashsize) dictEntryHash(entry) = hash;
     entry->next = ht->table[index];
     ht->table[index] = entry;
     ht->used++;
-
-    /* 设置该实体的键 */
-    /* Set the hash entry fields. */
-    dictSetKey(d, entry, key);
     return entry;
 }
 
@@ -419,7 +479,7 @@ static dictEntry *dictGenericDelete(dict *d, const void *key, int nofree) {
         he = d->ht[table].table[idx];
         prevHe = NULL;
         while(he) {
-            if (key==he->key || dictCompareKeys(d, key, he->key)) {
+            if (dictEntryMatches(d, he, key, h)) {
                 /* Unlink the element from the list */
                 if (prevHe)
                     prevHe->next = he->next;
@@ -536,7 +596,7 @@ dictEntry *dictFind(dict *d, const void *key)
         idx = h & d->ht[table].sizemask;
         he = d->ht[table].table[idx];
         while(he) {
-            if (key==he->key || dictCompareKeys(d, key, he->key))
+            if (dictEntryMatches(d, he, key, h))
                 return he;
             he = he->next;
         }
@@ -964,6 +1024,20 @@ unsigned long dictScan(dict *d,
     return v;
 }
 
+/* 判断一个哈希值为hash的元素所在的桶是否已经被游标v之前的dictScan()调用扫描过了.
+ * 仅在扫描期间哈希表没有缩小时成立.
+ * Return true if the bucket of an element with the given hash was already
+ * visited by the dictScan() calls that returned the cursor 'v'. This holds
+ * as long as the table didn't shrink since the scan started: buckets are
+ * visited in the order of their reversed index, so a bucket was visited if
+ * its reversed index is smaller than the reversed cursor. */
+int dictScanCursorPassed(dict *d, unsigned long v, uint64_t hash) {
+    unsigned long m = d->ht[0].sizemask;
+
+    if (dictIsRehashing(d) && d->ht[1].sizemask > m) m = d->ht[1].sizemask;
+    return rev(hash & m) < rev(v & m);
+}
+
 /* ------------------------- private functions ------------------------------ */
 
 /* 判断字典是否需要扩容 */
@@ -1035,7 +1109,7 @@ static long _dictKeyIndex(dict *d, const void *key, uint64_t hash, dictEntry **e
         he = d->ht[table].table[idx];
         while(he) {
             /* 判断key是否已经存在，如果存在，使existing指向该实体 */
-            if (key==he->key || dictCompareKeys(d, key, he->key)) {
+            if (dictEntryMatches(d, he, key, hash)) {
                 if (existing) *existing = he;
                 return -1; /* 存在返回-1 */
             }
@@ -54,8 +54,15 @@ typedef struct dictEntry {
         double d;
     } v; /* v用于保存值，可以是具体值或者值的指针 */
     struct dictEntry *next; /* next指向链表下一个节点 */
+    union {
+        void *ptr;
+        uint64_t u64;
+        int64_t s64;
+    } metadata[]; /* 实体的附加数据: storeHash时先保存键的哈希值，之后是entryMetadataBytes字节的数据 */
 } dictEntry;
 
+struct dict;
+
 /* 字典的类型结构 */
 typedef struct dictType {
     uint64_t (*hashFunction)(const void *key); /* 哈希函数 */
@@ -64,6 +71,10 @@ typedef struct dictType {
     int (*keyCompare)(void *privdata, const void *key1, const void *key2); /* 键比较 */
     void (*keyDestructor)(void *privdata, void *key); /* 键析构 */
     void (*valDestructor)(void *privdata, void *obj); /* 值析构 */
+    size_t (*keyEmbedLen)(const void *key); /* 键嵌入dictEntry时所需的字节数，为NULL时不嵌入 */
+    void *(*keyEmbed)(void *buf, const void *key); /* 将键拷贝到buf中，返回嵌入后的键 */
+    size_t (*entryMetadataBytes)(struct dict *d); /* 每个实体附加数据的字节数，为NULL时没有附加数据 */
+    int storeHash; /* 为1时实体中缓存键的哈希值，比较键和rehash时不必访问键本身 */
 } dictType;
 
 /* 哈希表结构 */
@@ -159,6 +170,13 @@ typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
 #define dictGetSignedIntegerVal(he) ((he)->v.s64) /* 获取哈希实体的有符号的整数值 */
 #define dictGetUnsignedIntegerVal(he) ((he)->v.u64) /* 获取哈希实体的无符号整数值 */
 #define dictGetDoubleVal(he) ((he)->v.d) /* 获取哈希实体的浮点数值 */
+/* Dicts whose type sets storeHash keep the hash of the key in the first
+ * metadata slot of their entries, before the metadata of the type. */
+#define dictEntryHash(he) ((he)->metadata[0].u64) /* 获取实体缓存的键的哈希值，仅storeHash时可用 */
+#define dictHashBytes(d) ((d)->type->storeHash ? sizeof(uint64_t) : 0) /* 实体中缓存哈希值所需的字节数 */
+#define dictMetadata(d, he) ((void*)((char*)(he)->metadata + dictHashBytes(d))) /* 获取哈希实体附加数据的地址 */
+#define dictMetadataSize(d) ((d)->type->entryMetadataBytes \
+                             ? (d)->type->entryMetadataBytes(d) : 0) /* 获取实体附加数据的字节数 */
 #define dictSlots(d) ((d)->ht[0].size+(d)->ht[1].size) /* 获取整个字典的存储大小 */
 #define dictSize(d) ((d)->ht[0].used+(d)->ht[1].used) /* 获取整个字典已使用的存储大小 */
 #define dictIsRehashing(d) ((d)->rehashidx != -1) /* 判断字典是不是在rehash过程中 */
@@ -191,9 +209,11 @@ void dictEnableResize(void);
 void dictDisableResize(void);
 int dictRehash(dict *d, int n);
 int dictRehashMilliseconds(dict *d, int ms);
+int dictRehashMicroseconds(dict *d, long long us);
 void dictSetHashFunctionSeed(uint8_t *seed);
 uint8_t *dictGetHashFunctionSeed(void);
 unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn, dictScanBucketFunction *bucketfn, void *privdata);
+int dictScanCursorPassed(dict *d, unsigned long v, uint64_t hash);
 uint64_t dictGetHash(dict *d, const void *key);
 dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, uint64_t hash);
 
@@ -160,11 +160,33 @@ void evictionPoolAlloc(void) {
  * idle time are on the left, and keys with the higher idle time on the
  * right. */
 
-void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
+/* Sample up to 'count' keys with an expire set in 'db', storing their
+ * entries of the main dictionary in 'samples'. With the volatile-ttl policy
+ * we just take the keys of the first buckets of the expires index, that are
+ * the ones that will expire sooner, otherwise keys are sampled from a bucket
+ * picked at random. The number of sampled keys is returned. */
+int evictionSampleVolatileKeys(redisDb *db, dictEntry **samples, int count) {
+    void *keys[count];
+    int j, sampled;
+
+    sampled = ttlWheelSample(db->expires,keys,count,
+                    server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL);
+    for (j = 0; j < sampled; j++) {
+        samples[j] = dictFind(db->dict,keys[j]);
+        serverAssert(samples[j] != NULL);
+    }
+    return sampled;
+}
+
+void evictionPoolPopulate(int dbid, struct evictionPoolEntry *pool) {
     int j, k, count;
+    redisDb *db = server.db+dbid;
     dictEntry *samples[server.maxmemory_samples];
 
-    count = dictGetSomeKeys(sampledict,samples,server.maxmemory_samples);
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS)
+        count = dictGetSomeKeys(db->dict,samples,server.maxmemory_samples);
+    else
+        count = evictionSampleVolatileKeys(db,samples,server.maxmemory_samples);
     for (j = 0; j < count; j++) {
         unsigned long long idle;
         sds key;
@@ -173,14 +195,7 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
 
         de = samples[j];
         key = dictGetKey(de);
-
-        /* If the dictionary we are sampling from is not the main
-         * dictionary (but the expires one) we need to lookup the key
-         * again in the key dictionary to obtain the value object. */
-        if (server.maxmemory_policy != MAXMEMORY_VOLATILE_TTL) {
-            if (sampledict != keydict) de = dictFind(keydict, key);
-            o = dictGetVal(de);
-        }
+        o = dictGetVal(de);
 
         /* Calculate the idle time according to the policy. This is called
          * idle just because the code initially handled LRU, but is in fact
@@ -198,7 +213,7 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
             idle = 255-LFUDecrAndReturn(o);
         } else if (server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
             /* In this case the sooner the expire the better. */
-            idle = ULLONG_MAX - (long)dictGetVal(de);
+            idle = ULLONG_MAX - (long)dbEntryGetExpire(de);
         } else {
             serverPanic("Unknown eviction policy in evictionPoolPopulate()");
         }
@@ -409,7 +424,6 @@ int freeMemoryIfNeeded(void) {
         sds bestkey = NULL;
         int bestdbid;
         redisDb *db;
-        dict *dict;
         dictEntry *de;
 
         if (server.maxmemory_policy & (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU) ||
@@ -425,10 +439,10 @@ int freeMemoryIfNeeded(void) {
                  * every DB. */
                 for (i = 0; i < server.dbnum; i++) {
                     db = server.db+i;
-                    dict = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
-                            db->dict : db->expires;
-                    if ((keys = dictSize(dict)) != 0) {
-                        evictionPoolPopulate(i, dict, db->dict, pool);
+                    keys = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
+                            dictSize(db->dict) : ttlWheelSize(db->expires);
+                    if (keys != 0) {
+                        evictionPoolPopulate(i, pool);
                         total_keys += keys;
                     }
                 }
@@ -439,13 +453,12 @@ int freeMemoryIfNeeded(void) {
                     if (pool[k].key == NULL) continue;
                     bestdbid = pool[k].dbid;
 
-                    if (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) {
-                        de = dictFind(server.db[pool[k].dbid].dict,
-                            pool[k].key);
-                    } else {
-                        de = dictFind(server.db[pool[k].dbid].expires,
-                            pool[k].key);
-                    }
+                    de = dictFind(server.db[pool[k].dbid].dict,
+                        pool[k].key);
+                    /* With the volatile policies the key is only a valid
+                     * pick if it still has an expire set. */
+                    if (de && !(server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) &&
+                        dbEntryGetExpire(de) == -1) de = NULL;
 
                     /* Remove the entry from the pool. */
                     if (pool[k].key != pool[k].cached)
@@ -475,14 +488,15 @@ int freeMemoryIfNeeded(void) {
             for (i = 0; i < server.dbnum; i++) {
                 j = (++next_db) % server.dbnum;
                 db = server.db+j;
-                dict = (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM) ?
-                        db->dict : db->expires;
-                if (dictSize(dict) != 0) {
-                    de = dictGetRandomKey(dict);
-                    bestkey = dictGetKey(de);
-                    bestdbid = j;
-                    break;
+                if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM) {
+                    if (dictSize(db->dict) == 0) continue;
+                    de = dictGetRandomKey(db->dict);
+                } else {
+                    if (!evictionSampleVolatileKeys(db,&de,1)) continue;
                 }
+                bestkey = dictGetKey(de);
+                bestdbid = j;
+                break;
             }
         }
 
@@ -42,7 +42,7 @@
 
 /* Helper function for the activeExpireCycle() function.
  * This function will try to expire the key that is stored in the hash table
- * entry 'de' of the 'expires' hash table of a Redis database.
+ * entry 'de' of the main hash table of a Redis database.
  *
  * If the key is found to be expired, it is removed from the database and
  * 1 is returned. Otherwise no operation is performed and 0 is returned.
@@ -52,8 +52,8 @@
  * The parameter 'now' is the current time in milliseconds as is passed
  * to the function to avoid too many gettimeofday() syscalls. */
 int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
-    long long t = dictGetSignedIntegerVal(de);
-    if (now > t) {
+    long long t = dbEntryGetExpire(de);
+    if (t != -1 && now > t) {
         sds key = dictGetKey(de);
         robj *keyobj = createStringObject(key,sdslen(key));
 
@@ -72,10 +72,12 @@ int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
     }
 }
 
-/* Try to expire a few timed out keys. The algorithm used is adaptive and
- * will use few CPU cycles if there are few expiring keys, otherwise
- * it will get more aggressive to avoid that too much memory is used by
- * keys that can be removed from the keyspace.
+/* Try to expire a few timed out keys. Since db->expires buckets the keys by
+ * expire time, the keys already expired are always in the first buckets of
+ * the index: we reclaim them in about the order they expired, at most a
+ * level 0 bucket span (TW_SPAN(0) milliseconds) late, and we can stop
+ * visiting a DB as soon as the index has no more keys due, so that little
+ * CPU is used when there are few expiring keys.
  *
  * No more than CRON_DBS_PER_CALL databases are tested at every
  * iteration.
@@ -141,83 +143,73 @@ void activeExpireCycle(int type) {
         timelimit = ACTIVE_EXPIRE_CYCLE_FAST_DURATION; /* in microseconds. */
 
     for (j = 0; j < dbs_per_call && timelimit_exit == 0; j++) {
-        int expired;
         redisDb *db = server.db+(current_db % server.dbnum);
+        long long now = mstime();
 
         /* Increment the DB now so we are sure if we run out of time
          * in the current DB we'll restart from the next. This allows to
          * distribute the time evenly across DBs. */
         current_db++;
 
-        /* Continue to expire if at the end of the cycle more than 25%
-         * of the keys were expired. */
-        do {
-            unsigned long num, slots;
-            long long now, ttl_sum;
-            int ttl_samples;
-            iteration++;
+        /* If there is nothing to expire try next DB ASAP. */
+        if (ttlWheelSize(db->expires) == 0) {
+            db->avg_ttl = 0;
+            continue;
+        }
 
-            /* If there is nothing to expire try next DB ASAP. */
-            if ((num = dictSize(db->expires)) == 0) {
-                db->avg_ttl = 0;
-                break;
-            }
-            slots = dictSlots(db->expires);
-            now = mstime();
-
-            /* When there are less than 1% filled slots getting random
-             * keys is expensive, so stop here waiting for better times...
-             * The dictionary will be resized asap. */
-            if (num && slots > DICT_HT_INITIAL_SIZE &&
-                (num*100/slots < 1)) break;
-
-            /* The main collection cycle. Sample random keys among keys
-             * with an expire set, checking for expired ones. */
-            expired = 0;
-            ttl_sum = 0;
-            ttl_samples = 0;
-
-            if (num > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP)
-                num = ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP;
-
-            while (num--) {
-                dictEntry *de;
-                long long ttl;
-
-                if ((de = dictGetRandomKey(db->expires)) == NULL) break;
-                ttl = dictGetSignedIntegerVal(de)-now;
-                if (activeExpireCycleTryExpire(db,de,now)) expired++;
-                if (ttl > 0) {
-                    /* We want the average TTL of keys yet not expired. */
-                    ttl_sum += ttl;
-                    ttl_samples++;
-                }
-            }
+        /* Expire the keys due until the index has no more. Keys of coarse
+         * buckets are moved to finer ones as their expire time gets close:
+         * this is accounted as an iteration too. */
+        while(1) {
+            void *key;
+            dictEntry *de;
 
-            /* Update the average TTL stats for this database. */
-            if (ttl_samples) {
-                long long avg_ttl = ttl_sum/ttl_samples;
-
-                /* Do a simple running average with a few samples.
-                 * We just use the current estimate with a weight of 2%
-                 * and the previous estimate with a weight of 98%. */
-                if (db->avg_ttl == 0) db->avg_ttl = avg_ttl;
-                db->avg_ttl = (db->avg_ttl/50)*49 + (avg_ttl/50);
+            iteration++;
+            if (!ttlWheelNext(db->expires,now,&key)) break;
+            if (key != NULL) {
+                de = dictFind(db->dict,key);
+                serverAssert(de != NULL && dictGetKey(de) == key);
+                activeExpireCycleTryExpire(db,de,now);
             }
 
             /* We can't block forever here even if there are many keys to
              * expire. So after a given amount of milliseconds return to the
              * caller waiting for the other active expire cycle. */
-            if ((iteration & 0xf) == 0) { /* check once every 16 iterations. */
+            if ((iteration % ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP) == 0) {
                 elapsed = ustime()-start;
                 if (elapsed > timelimit) {
                     timelimit_exit = 1;
                     break;
                 }
             }
-            /* We don't repeat the cycle if there are less than 25% of keys
-             * found expired in the current DB. */
-        } while (expired > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP/4);
+        }
+
+        /* Update the average TTL stats for this database sampling a few
+         * keys at random among the ones yet not expired. We just use the
+         * current estimate with a weight of 2% and the previous estimate
+         * with a weight of 98%. */
+        if (type == ACTIVE_EXPIRE_CYCLE_SLOW && ttlWheelSize(db->expires)) {
+            long long ttl_sum = 0;
+            int ttl_samples = 0, k;
+
+            for (k = 0; k < ACTIVE_EXPIRE_CYCLE_TTL_SAMPLES; k++) {
+                long long when;
+                void *key;
+
+                if (!ttlWheelSample(db->expires,&key,1,0)) continue;
+                when = dbEntryGetExpire(dictFind(db->dict,key));
+                if (when > now) {
+                    ttl_sum += when-now;
+                    ttl_samples++;
+                }
+            }
+            if (ttl_samples) {
+                long long avg_ttl = ttl_sum/ttl_samples;
+
+                if (db->avg_ttl == 0) db->avg_ttl = avg_ttl;
+                db->avg_ttl = (db->avg_ttl/50)*49 + (avg_ttl/50);
+            }
+        }
     }
 
     elapsed = ustime()-start;
@@ -281,9 +273,11 @@ void expireSlaveKeys(void) {
         while(dbids && dbid < server.dbnum) {
             if ((dbids & 1) != 0) {
                 redisDb *db = server.db+dbid;
-                dictEntry *expire = dictFind(db->expires,keyname);
+                dictEntry *expire = dictFind(db->dict,keyname);
                 int expired = 0;
 
+                if (expire && dbEntryGetExpire(expire) == -1) expire = NULL;
+
                 if (expire &&
                     activeExpireCycleTryExpire(server.db+dbid,expire,start))
                 {
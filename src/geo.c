@@ -229,7 +229,7 @@ int geoGetPointsInRange(robj *zobj, double min, double max, double lon, double l
     size_t origincount = ga->used;
     sds member;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr = NULL;
@@ -242,7 +242,7 @@ int geoGetPointsInRange(robj *zobj, double min, double max, double lon, double l
             return 0;
         }
 
-        sptr = ziplistNext(zl, eptr);
+        sptr = lpNext(zl, eptr);
         while (eptr) {
             score = zzlGetScore(sptr);
 
@@ -250,34 +250,33 @@ int geoGetPointsInRange(robj *zobj, double min, double max, double lon, double l
             if (!zslValueLteMax(score, &range))
                 break;
 
-            /* We know the element exists. ziplistGet should always succeed */
-            ziplistGet(eptr, &vstr, &vlen, &vlong);
+            vstr = lpGetValue(eptr, &vlen, &vlong);
             member = (vstr == NULL) ? sdsfromlonglong(vlong) :
                                       sdsnewlen(vstr,vlen);
             if (geoAppendIfWithinRadius(ga,lon,lat,radius,score,member)
                 == C_ERR) sdsfree(member);
             zzlNext(zl, &eptr, &sptr);
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
-        zskiplist *zsl = zs->zsl;
-        zskiplistNode *ln;
+        zbtCursor cur;
+        int valid;
 
-        if ((ln = zslFirstInRange(zsl, &range)) == NULL) {
+        if (!(valid = zbtFirstInRange(zs->zbt, &range, &cur))) {
             /* Nothing exists starting at our min.  No results. */
             return 0;
         }
 
-        while (ln) {
-            sds ele = ln->ele;
-            /* Abort when the node is no longer in range. */
-            if (!zslValueLteMax(ln->score, &range))
+        while (valid) {
+            zbtEntry *e = zbtCursorEntry(&cur);
+            /* Abort when the entry is no longer in range. */
+            if (!zslValueLteMax(e->score, &range))
                 break;
 
-            ele = sdsdup(ele);
-            if (geoAppendIfWithinRadius(ga,lon,lat,radius,ln->score,ele)
+            sds ele = sdsdup(e->ele);
+            if (geoAppendIfWithinRadius(ga,lon,lat,radius,e->score,ele)
                 == C_ERR) sdsfree(ele);
-            ln = ln->level[0].forward;
+            valid = zbtNext(&cur);
         }
     }
     return ga->used - origincount;
@@ -643,20 +642,19 @@ void georadiusGeneric(client *c, int flags) {
         }
 
         for (i = 0; i < returned_items; i++) {
-            zskiplistNode *znode;
             geoPoint *gp = ga->array+i;
             gp->dist /= conversion; /* Fix according to unit. */
             double score = storedist ? gp->dist : gp->score;
             size_t elelen = sdslen(gp->member);
 
             if (maxelelen < elelen) maxelelen = elelen;
-            znode = zslInsert(zs->zsl,score,gp->member);
-            serverAssert(dictAdd(zs->dict,gp->member,&znode->score) == DICT_OK);
+            zbtInsert(zs->zbt,score,gp->member);
+            zsetDictAdd(zs->dict,gp->member,score);
             gp->member = NULL;
         }
 
         if (returned_items) {
-            zsetConvertToZiplistIfNeeded(zobj,maxelelen);
+            zsetConvertToListpackIfNeeded(zobj,maxelelen);
             setKey(c->db,storekey,zobj);
             decrRefCount(zobj);
             notifyKeyspaceEvent(NOTIFY_LIST,"georadiusstore",storekey,
@@ -34,6 +34,10 @@
 #include <stdint.h>
 #include <math.h>
 
+#ifdef HAVE_AVX2
+#include <immintrin.h>
+#endif
+
 /* The Redis HyperLogLog implementation is based on the following ideas:
  *
  * * The use of a 64 bit hash function as proposed in [1], in order to don't
@@ -514,7 +518,7 @@ int hllDenseAdd(uint8_t *registers, unsigned char *ele, size_t elesize) {
  * PE is an array with a pre-computer table of values 2^-reg indexed by reg.
  * As a side effect the integer pointed by 'ezp' is set to the number
  * of zero registers. */
-double hllDenseSum(uint8_t *registers, double *PE, int *ezp) {
+static double hllDenseSumScalar(uint8_t *registers, double *PE, int *ezp) {
     double E = 0;
     int j, ez = 0;
 
@@ -570,6 +574,159 @@ double hllDenseSum(uint8_t *registers, double *PE, int *ezp) {
     return E;
 }
 
+/* Unpack 'count' registers, a multiple of 4, of the dense representation
+ * into one byte each, or merge them into 'max' setting max[i] to the
+ * greatest of the two values. Every 3 bytes hold 4 registers. */
+static void hllDenseUnpackScalar(uint8_t *raw, const uint8_t *r, int count) {
+    for (int j = 0; j < count; j += 4, r += 3) {
+        uint32_t w = r[0] | (r[1] << 8) | (r[2] << 16);
+        raw[j] = w & 63;
+        raw[j+1] = (w >> 6) & 63;
+        raw[j+2] = (w >> 12) & 63;
+        raw[j+3] = w >> 18;
+    }
+}
+
+static void hllMergeDenseScalar(uint8_t *max, const uint8_t *r, int count) {
+    uint8_t raw[4];
+
+    for (int j = 0; j < count; j += 4, r += 3) {
+        hllDenseUnpackScalar(raw,r,4);
+        /* No branches: which value is greater is unpredictable. */
+        for (int k = 0; k < 4; k++)
+            max[j+k] = raw[k] > max[j+k] ? raw[k] : max[j+k];
+    }
+}
+
+/* Pack HLL_REGISTERS registers of one byte each into the dense
+ * representation, the reverse of hllDenseUnpackScalar(). */
+static void hllDensePack(uint8_t *registers, const uint8_t *raw) {
+    if (HLL_REGISTERS % 4 == 0 && HLL_BITS == 6) {
+        uint8_t *r = registers;
+        for (int j = 0; j < HLL_REGISTERS; j += 4, r += 3) {
+            uint32_t w = raw[j] | (raw[j+1] << 6) | (raw[j+2] << 12) |
+                         ((uint32_t)raw[j+3] << 18);
+            r[0] = w & 0xff;
+            r[1] = (w >> 8) & 0xff;
+            r[2] = w >> 16;
+        }
+    } else {
+        for (int j = 0; j < HLL_REGISTERS; j++)
+            HLL_DENSE_SET_REGISTER(registers,j,raw[j]);
+    }
+}
+
+#ifdef HAVE_AVX2
+/* 向量化的寄存器解包: 一次把24个字节中的32个6位寄存器展开成32个字节.
+ *
+ * Unpack the 32 registers stored in the 24 bytes at 'r', one per byte.
+ * The load starts 4 bytes before 'r', so that each 128 bit lane gets the
+ * 12 bytes of 16 registers: 4 readable bytes must precede 'r', like the
+ * header of a dense HLL, and 4 more must follow the 24 bytes. */
+__attribute__((target("avx2")))
+static inline __m256i hllDenseUnpackAVX2(const uint8_t *r) {
+    const __m256i shuffle = _mm256_setr_epi8(
+        4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15, -1,
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    __m256i w = _mm256_shuffle_epi8(
+        _mm256_loadu_si256((const __m256i*)(r-4)),shuffle);
+
+    /* Every 32 bit word now holds 4 registers in its low 24 bits: move
+     * register k from bit 6*k to byte k. */
+    __m256i r0 = _mm256_and_si256(w,_mm256_set1_epi32(0x3f));
+    __m256i r1 = _mm256_and_si256(_mm256_slli_epi32(w,2),
+                                  _mm256_set1_epi32(0x3f00));
+    __m256i r2 = _mm256_and_si256(_mm256_slli_epi32(w,4),
+                                  _mm256_set1_epi32(0x3f0000));
+    __m256i r3 = _mm256_and_si256(_mm256_slli_epi32(w,6),
+                                  _mm256_set1_epi32(0x3f000000));
+    return _mm256_or_si256(_mm256_or_si256(r0,r1),_mm256_or_si256(r2,r3));
+}
+
+/* Return 2^-reg for the 4 registers of one byte each at 'p', building the
+ * exponent of the doubles from the registers: 2^0 for empty registers. */
+__attribute__((target("avx2")))
+static inline __m256d hllPow2NegAVX2(const uint8_t *p) {
+    int32_t w;
+
+    memcpy(&w,p,sizeof(w));
+    __m256i reg = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(w));
+    __m256i exp = _mm256_sub_epi64(_mm256_set1_epi64x(1023),reg);
+    return _mm256_castsi256_pd(_mm256_slli_epi64(exp,52));
+}
+
+/* hllRawSum() for registers of one byte each: 32 registers per iteration,
+ * summed in four independent accumulators. */
+__attribute__((target("avx2")))
+static double hllRawSumAVX2(uint8_t *registers, int *ezp) {
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd(),
+            acc2 = _mm256_setzero_pd(), acc3 = _mm256_setzero_pd();
+    int ez = 0;
+
+    for (int j = 0; j < HLL_REGISTERS; j += 32) {
+        uint8_t *r = registers+j;
+        __m256i v = _mm256_loadu_si256((__m256i*)r);
+        ez += __builtin_popcount(_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(v,_mm256_setzero_si256())));
+        acc0 = _mm256_add_pd(acc0,hllPow2NegAVX2(r));
+        acc1 = _mm256_add_pd(acc1,hllPow2NegAVX2(r+4));
+        acc2 = _mm256_add_pd(acc2,hllPow2NegAVX2(r+8));
+        acc3 = _mm256_add_pd(acc3,hllPow2NegAVX2(r+12));
+        acc0 = _mm256_add_pd(acc0,hllPow2NegAVX2(r+16));
+        acc1 = _mm256_add_pd(acc1,hllPow2NegAVX2(r+20));
+        acc2 = _mm256_add_pd(acc2,hllPow2NegAVX2(r+24));
+        acc3 = _mm256_add_pd(acc3,hllPow2NegAVX2(r+28));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes,_mm256_add_pd(_mm256_add_pd(acc0,acc1),
+                                         _mm256_add_pd(acc2,acc3)));
+    *ezp = ez;
+    return (lanes[0]+lanes[1])+(lanes[2]+lanes[3]);
+}
+
+/* The last 32 registers are handled by the scalar code, as unpacking them
+ * would read past the end of the dense representation. */
+__attribute__((target("avx2")))
+static void hllDenseUnpackAVX2All(uint8_t *raw, const uint8_t *registers) {
+    int j;
+
+    for (j = 0; j < HLL_REGISTERS-32; j += 32)
+        _mm256_storeu_si256((__m256i*)(raw+j),
+                            hllDenseUnpackAVX2(registers+j/4*3));
+    hllDenseUnpackScalar(raw+j,registers+j/4*3,32);
+}
+
+__attribute__((target("avx2")))
+static void hllMergeDenseAVX2(uint8_t *max, const uint8_t *registers) {
+    int j;
+
+    for (j = 0; j < HLL_REGISTERS-32; j += 32) {
+        __m256i *m = (__m256i*)(max+j);
+        __m256i regs = hllDenseUnpackAVX2(registers+j/4*3);
+        _mm256_storeu_si256(m,_mm256_max_epu8(_mm256_loadu_si256(m),regs));
+    }
+    hllMergeDenseScalar(max+j,registers+j/4*3,32);
+}
+
+/* The AVX2 kernels assume the default 16384 registers of 6 bits. */
+static int hllUseAVX2(void) {
+    return HLL_REGISTERS == 16384 && HLL_BITS == 6 &&
+           __builtin_cpu_supports("avx2");
+}
+#endif
+
+double hllDenseSum(uint8_t *registers, double *PE, int *ezp) {
+#ifdef HAVE_AVX2
+    if (hllUseAVX2()) {
+        uint8_t raw[HLL_REGISTERS];
+        hllDenseUnpackAVX2All(raw,registers);
+        return hllRawSumAVX2(raw,ezp);
+    }
+#endif
+    return hllDenseSumScalar(registers,PE,ezp);
+}
+
 /* ================== Sparse representation implementation  ================= */
 
 /* Convert the HLL with sparse representation given as input in its dense
@@ -953,6 +1110,10 @@ double hllRawSum(uint8_t *registers, double *PE, int *ezp) {
     uint64_t *word = (uint64_t*) registers;
     uint8_t *bytes;
 
+#ifdef HAVE_AVX2
+    if (hllUseAVX2()) return hllRawSumAVX2(registers,ezp);
+#endif
+
     for (j = 0; j < HLL_REGISTERS/8; j++) {
         if (*word == 0) {
             ez += 8;
@@ -1059,6 +1220,16 @@ int hllMerge(uint8_t *max, robj *hll) {
     if (hdr->encoding == HLL_DENSE) {
         uint8_t val;
 
+#ifdef HAVE_AVX2
+        if (hllUseAVX2()) {
+            hllMergeDenseAVX2(max,hdr->registers);
+            return C_OK;
+        }
+#endif
+        if (HLL_REGISTERS % 4 == 0 && HLL_BITS == 6) {
+            hllMergeDenseScalar(max,hdr->registers,HLL_REGISTERS);
+            return C_OK;
+        }
         for (i = 0; i < HLL_REGISTERS; i++) {
             HLL_DENSE_GET_REGISTER(val,hdr->registers,i);
             if (val > max[i]) max[i] = val;
@@ -1346,13 +1517,19 @@ void pfmergeCommand(client *c) {
     }
 
     /* Write the resulting HLL to the destination HLL registers and
-     * invalidate the cached value. */
-    for (j = 0; j < HLL_REGISTERS; j++) {
-        if (max[j] == 0) continue;
-        hdr = o->ptr;
-        switch(hdr->encoding) {
-        case HLL_DENSE: hllDenseSet(hdr->registers,j,max[j]); break;
-        case HLL_SPARSE: hllSparseSet(o,j,max[j]); break;
+     * invalidate the cached value. The destination was merged too, so
+     * dense registers can be overwritten all at once. */
+    hdr = o->ptr;
+    if (hdr->encoding == HLL_DENSE) {
+        hllDensePack(hdr->registers,max);
+    } else {
+        for (j = 0; j < HLL_REGISTERS; j++) {
+            if (max[j] == 0) continue;
+            hdr = o->ptr;
+            switch(hdr->encoding) {
+            case HLL_DENSE: hllDenseSet(hdr->registers,j,max[j]); break;
+            case HLL_SPARSE: hllSparseSet(o,j,max[j]); break;
+            }
         }
     }
     hdr = o->ptr; /* o->ptr may be different now, as a side effect of
@@ -1407,7 +1584,70 @@ void pfselftestCommand(client *c) {
         }
     }
 
-    /* Test 2: approximation error.
+    /* Test 2: register kernels.
+     * Merging, summing and packing the registers, with vectorized kernels
+     * when the CPU supports them, must agree with the register access
+     * macros, including for the last registers of the representation. */
+    double PE[64];
+    for (i = 0; i < 64; i++) PE[i] = 1.0/(1ULL << i);
+    for (j = 0; j < HLL_TEST_CYCLES/10; j++) {
+        uint8_t max[HLL_REGISTERS], expected[HLL_REGISTERS];
+        double E = 0, rawE = 0, sum;
+        int ez = 0, rawez = 0, sumez;
+        robj hll;
+
+        /* Mostly small values like in real HLLs, and some empty ones. */
+        for (i = 0; i < HLL_REGISTERS; i++) {
+            unsigned int r = rand() % 8 ? rand() % 24 : 0;
+            if (j % 2) r = rand() & HLL_REGISTER_MAX;
+
+            HLL_DENSE_SET_REGISTER(hdr->registers,i,r);
+            if (r == 0) ez++;
+            E += PE[r];
+            max[i] = rand() % 4 ? 0 : rand() & HLL_REGISTER_MAX;
+            expected[i] = r > max[i] ? r : max[i];
+            if (expected[i] == 0) rawez++;
+            rawE += PE[expected[i]];
+        }
+
+        sum = hllDenseSum(hdr->registers,PE,&sumez);
+        if (sumez != ez || fabs(sum-E) > E*1e-12) {
+            addReplyErrorFormat(c,
+                "TESTFAILED Dense sum is %.17g (%d empty) instead of %.17g (%d)",
+                sum, sumez, E, ez);
+            goto cleanup;
+        }
+
+        initStaticStringObject(hll,bitcounters);
+        hllMerge(max,&hll);
+        if (memcmp(max,expected,HLL_REGISTERS) != 0) {
+            addReplyError(c, "TESTFAILED Dense merge disagrees");
+            goto cleanup;
+        }
+
+        sum = hllRawSum(max,PE,&sumez);
+        if (sumez != rawez || fabs(sum-rawE) > rawE*1e-12) {
+            addReplyErrorFormat(c,
+                "TESTFAILED Raw sum is %.17g (%d empty) instead of %.17g (%d)",
+                sum, sumez, rawE, rawez);
+            goto cleanup;
+        }
+
+        hllDensePack(hdr->registers,max);
+        for (i = 0; i < HLL_REGISTERS; i++) {
+            unsigned int val;
+
+            HLL_DENSE_GET_REGISTER(val,hdr->registers,i);
+            if (val != expected[i]) {
+                addReplyErrorFormat(c,
+                    "TESTFAILED Packed register %d should be %d but is %d",
+                    i, (int) expected[i], (int) val);
+                goto cleanup;
+            }
+        }
+    }
+
+    /* Test 3: approximation error.
      * The test adds unique elements and check that the estimated value
      * is always reasonable bounds.
      *
@@ -35,6 +35,20 @@
 #include "zmalloc.h"
 #include "endianconv.h"
 
+/* The SIMD block scan reads the contents array as native integers, so it
+ * is only used on little endian hosts where no byte swapping is needed. */
+#if defined(__SSE2__) && BYTE_ORDER == LITTLE_ENDIAN
+#include <emmintrin.h>
+#define INTSET_SIMD 1
+#endif
+
+/* 二分查找在剩余元素不超过一个块时停止, 块内用一次向量比较定位 */
+/* Searches narrow the range down to one block of INTSET_BLOCK_BYTES bytes
+ * with a binary search (or galloping), and then locate the value in the
+ * block with a single vector compare instead of a few more mispredicted
+ * branches. */
+#define INTSET_BLOCK_BYTES 32
+
 /* 整数结合的三中编码，分别表示用来存储16位，32位，64位整数 */
 /* Note that these encodings are ordered, so:
  * INTSET_ENC_INT16 < INTSET_ENC_INT32 < INTSET_ENC_INT64. */
@@ -115,6 +129,81 @@ static intset *intsetResize(intset *is, uint32_t len) {
     return is;
 }
 
+/* Return the number of elements lower than 'value' among the block of
+ * INTSET_BLOCK_BYTES bytes starting at 'pos'. The caller makes sure the
+ * whole block is inside the intset. */
+static uint32_t intsetBlockRank(intset *is, uint32_t pos, int64_t value) {
+    uint32_t enc = intrev32ifbe(is->encoding);
+    uint32_t n = INTSET_BLOCK_BYTES/enc, j;
+
+    /* Values out of the range of the encoding are greater or lower than
+     * any element, and would not survive the truncation below. */
+    if (_intsetValueEncoding(value) > enc) return value > 0 ? n : 0;
+
+#ifdef INTSET_SIMD
+    if (enc == INTSET_ENC_INT16) {
+        const __m128i *p = (const __m128i*)(((int16_t*)is->contents)+pos);
+        __m128i v = _mm_set1_epi16((int16_t)value);
+        uint32_t lo = _mm_movemask_epi8(_mm_cmplt_epi16(_mm_loadu_si128(p),v));
+        uint32_t hi = _mm_movemask_epi8(_mm_cmplt_epi16(_mm_loadu_si128(p+1),v));
+        uint32_t mask = lo | hi << 16;
+        /* Elements are sorted, so the lower ones are a prefix of the
+         * block, and every element sets two bits of the mask. */
+        return __builtin_popcount(mask)/2;
+    } else if (enc == INTSET_ENC_INT32) {
+        const __m128i *p = (const __m128i*)(((int32_t*)is->contents)+pos);
+        __m128i v = _mm_set1_epi32((int32_t)value);
+        uint32_t lo = _mm_movemask_epi8(_mm_cmplt_epi32(_mm_loadu_si128(p),v));
+        uint32_t hi = _mm_movemask_epi8(_mm_cmplt_epi32(_mm_loadu_si128(p+1),v));
+        uint32_t mask = lo | hi << 16;
+        return __builtin_popcount(mask)/4;
+    }
+#endif
+    for (j = 0; j < n; j++)
+        if (_intsetGetEncoded(is,pos+j,enc) >= value) break;
+    return j;
+}
+
+/* Return the position of the first element greater than or equal to
+ * 'value', that the caller knows to be in the range [lo,hi]: all the
+ * elements before 'lo' are lower than 'value', the one at 'hi' (if any)
+ * is not. */
+static uint32_t intsetLowerBound(intset *is, uint32_t lo, uint32_t hi,
+                                 int64_t value) {
+    uint32_t len = intrev32ifbe(is->length);
+    uint32_t n = INTSET_BLOCK_BYTES/intrev32ifbe(is->encoding);
+
+    while (hi - lo > n) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (_intsetGet(is,mid) < value) lo = mid+1;
+        else hi = mid;
+    }
+    if (len >= n) {
+        /* Scan a whole block ending inside the intset: the elements before
+         * 'lo' it may include are lower than 'value' and counted too. */
+        uint32_t start = (lo + n <= len) ? lo : len - n;
+        return start + intsetBlockRank(is,start,value);
+    }
+    while (lo < hi && _intsetGet(is,lo) < value) lo++;
+    return lo;
+}
+
+/* Like intsetLowerBound(), for the sequential lookups of a merge: the first
+ * element greater than or equal to 'value' is searched starting at 'from',
+ * with steps that double until one is past it. A close element costs as
+ * much as a block scan, a far one a logarithmic number of steps. */
+static uint32_t intsetGallop(intset *is, uint32_t from, int64_t value) {
+    uint32_t len = intrev32ifbe(is->length);
+    uint32_t step = INTSET_BLOCK_BYTES/intrev32ifbe(is->encoding);
+
+    if (from >= len) return len;
+    while (from + step < len && _intsetGet(is,from+step) < value) {
+        from += step+1;
+        step <<= 1;
+    }
+    return intsetLowerBound(is,from,from+step < len ? from+step : len,value);
+}
+
 /* 查找给定的值是否在集合中，如果找到返回1，并将位置保存在pos中返回，如果没有找到，返回0，并将可以插入的位置
  * 保存在pos中返回
  */
@@ -123,8 +212,8 @@ static intset *intsetResize(intset *is, uint32_t len) {
  * the value is not present in the intset and sets "pos" to the position
  * where "value" can be inserted. */
 static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
-    int min = 0, max = intrev32ifbe(is->length)-1, mid = -1;
-    int64_t cur = -1;
+    uint32_t mid;
+    int64_t cur;
 
     /* 数组是空，那肯定找不到了 */
     /* The value can never be found when the set is empty */
@@ -146,27 +235,13 @@ static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
         }
     }
 
-    /* 使用二分查找 */
-    while(max >= min) {
-        mid = ((unsigned int)min + (unsigned int)max) >> 1;
-        cur = _intsetGet(is,mid);
-        if (value > cur) {
-            min = mid+1;
-        } else if (value < cur) {
-            max = mid-1;
-        } else {
-            break;
-        }
-    }
-
-    /* 如果相等那就是找到了，如果还没找到，那要是插入该值的话，那就是最小的哪个位置了 */
-    if (value == cur) {
-        if (pos) *pos = mid;
-        return 1;
-    } else {
-        if (pos) *pos = min;
-        return 0;
-    }
+    /* 二分查找, 最后一个块用向量比较 */
+    /* The value is not greater than the last element, so the lower bound
+     * is always a valid position. */
+    mid = intsetLowerBound(is,0,intrev32ifbe(is->length)-1,value);
+    cur = _intsetGet(is,mid);
+    if (pos) *pos = mid;
+    return value == cur;
 }
 
 /* 将当前整数集合升级，并将新的值保存在其中 */
@@ -312,6 +387,98 @@ uint32_t intsetLen(const intset *is) {
     return intrev32ifbe(is->length);
 }
 
+/* Return a new intset with the elements that are both in 'a' and 'b'.
+ * Every element of the smaller set is searched in the larger one
+ * galloping from the position of the previous match, so that the cost is
+ * linear for sets of similar size and logarithmic in the larger one for
+ * very different sizes. */
+intset *intsetIntersect(intset *a, intset *b) {
+    uint32_t i, j = 0, n = 0, lena, lenb;
+    intset *r;
+
+    if (intsetLen(a) > intsetLen(b)) {
+        intset *tmp = a;
+        a = b;
+        b = tmp;
+    }
+    lena = intsetLen(a);
+    lenb = intsetLen(b);
+
+    /* Common elements fit the smaller of the two encodings. */
+    r = intsetNew();
+    r->encoding = (intrev32ifbe(a->encoding) < intrev32ifbe(b->encoding)) ?
+        a->encoding : b->encoding;
+    r = intsetResize(r,lena);
+    for (i = 0; i < lena && j < lenb; i++) {
+        int64_t v = _intsetGet(a,i);
+        j = intsetGallop(b,j,v);
+        if (j < lenb && _intsetGet(b,j) == v) {
+            _intsetSet(r,n++,v);
+            j++;
+        }
+    }
+    r->length = intrev32ifbe(n);
+    return intsetResize(r,n);
+}
+
+/* Return a new intset with the elements of 'a' that are not in 'b'. */
+intset *intsetDifference(intset *a, intset *b) {
+    uint32_t i, j = 0, n = 0, lena = intsetLen(a), lenb = intsetLen(b);
+    uint32_t enc = intrev32ifbe(a->encoding);
+    intset *r = intsetNew();
+
+    r->encoding = a->encoding;
+    r = intsetResize(r,lena);
+    for (i = 0; i < lena && j < lenb; i++) {
+        int64_t v = _intsetGet(a,i);
+        j = intsetGallop(b,j,v);
+        if (j < lenb && _intsetGet(b,j) == v)
+            j++;
+        else
+            _intsetSet(r,n++,v);
+    }
+    /* Nothing left in 'b' to remove: copy the tail of 'a' as it is. */
+    memcpy(r->contents+(size_t)n*enc,a->contents+(size_t)i*enc,
+           (size_t)(lena-i)*enc);
+    n += lena-i;
+    r->length = intrev32ifbe(n);
+    return intsetResize(r,n);
+}
+
+/* Return a new intset with the elements of both 'a' and 'b', merging the
+ * two sorted arrays. */
+intset *intsetUnion(intset *a, intset *b) {
+    uint32_t i = 0, j = 0, n = 0, lena = intsetLen(a), lenb = intsetLen(b);
+    intset *r = intsetNew();
+
+    r->encoding = (intrev32ifbe(a->encoding) > intrev32ifbe(b->encoding)) ?
+        a->encoding : b->encoding;
+    r = intsetResize(r,lena+lenb);
+    while (i < lena && j < lenb) {
+        int64_t va = _intsetGet(a,i), vb = _intsetGet(b,j);
+        if (va <= vb) {
+            _intsetSet(r,n++,va);
+            i++;
+            if (va == vb) j++;
+        } else {
+            _intsetSet(r,n++,vb);
+            j++;
+        }
+    }
+    while (i < lena) _intsetSet(r,n++,_intsetGet(a,i++));
+    while (j < lenb) _intsetSet(r,n++,_intsetGet(b,j++));
+    r->length = intrev32ifbe(n);
+    return intsetResize(r,n);
+}
+
+/* Return a copy of the intset. */
+intset *intsetDup(intset *is) {
+    size_t len = intsetBlobLen(is);
+    intset *copy = zmalloc(len);
+    memcpy(copy,is,len);
+    return copy;
+}
+
 /* 获取集合所占用的字节数 */
 /* Return intset blob size in bytes. */
 size_t intsetBlobLen(intset *is) {
@@ -369,7 +536,7 @@ static intset *createSet(int bits, int size) {
 }
 
 static void checkConsistency(intset *is) {
-    for (uint32_t i = 0; i < (intrev32ifbe(is->length)-1); i++) {
+    for (uint32_t i = 0; i+1 < intrev32ifbe(is->length); i++) {
         uint32_t encoding = intrev32ifbe(is->encoding);
 
         if (encoding == INTSET_ENC_INT16) {
@@ -524,6 +691,90 @@ int intsetTest(int argc, char **argv) {
         ok();
     }
 
+    printf("Search against a linear scan: "); {
+        int64_t ranges[] = {100, 30000, 2000000, 5000000000LL};
+        for (int r = 0; r < 4; r++) {
+            for (int size = 0; size < 200; size += 7) {
+                is = intsetNew();
+                for (i = 0; i < size; i++)
+                    is = intsetAdd(is,rand() % ranges[r] - ranges[r]/2,NULL);
+                for (i = 0; i < 200; i++) {
+                    int64_t v = rand() % (ranges[r]+10) - ranges[r]/2 - 5;
+                    uint32_t pos, expected = 0;
+                    while (expected < intsetLen(is) &&
+                           _intsetGet(is,expected) < v) expected++;
+                    uint8_t found = intsetSearch(is,v,&pos);
+                    assert(pos == expected);
+                    assert(found == (expected < intsetLen(is) &&
+                                     _intsetGet(is,expected) == v));
+                }
+                zfree(is);
+            }
+        }
+        ok();
+    }
+
+    printf("Intersection, union and difference: "); {
+        int64_t ranges[] = {1000, 100000, 5000000000LL};
+        for (int iter = 0; iter < 300; iter++) {
+            int64_t ra = ranges[rand()%3], rb = ranges[rand()%3];
+            int sizea = rand() % 500, sizeb = rand() % (iter % 2 ? 50 : 5000);
+            intset *a = intsetNew(), *b = intsetNew(), *res;
+            int64_t v;
+
+            for (i = 0; i < sizea; i++) a = intsetAdd(a,rand() % ra - ra/2,NULL);
+            for (i = 0; i < sizeb; i++) b = intsetAdd(b,rand() % rb - rb/2,NULL);
+
+            uint32_t inter = 0, diff = 0;
+            for (uint32_t j = 0; intsetGet(a,j,&v); j++) {
+                if (intsetFind(b,v)) inter++; else diff++;
+            }
+
+            res = intsetIntersect(a,b);
+            assert(intsetLen(res) == inter);
+            for (uint32_t j = 0; intsetGet(res,j,&v); j++)
+                assert(intsetFind(a,v) && intsetFind(b,v));
+            checkConsistency(res);
+            zfree(res);
+
+            res = intsetDifference(a,b);
+            assert(intsetLen(res) == diff);
+            for (uint32_t j = 0; intsetGet(res,j,&v); j++)
+                assert(intsetFind(a,v) && !intsetFind(b,v));
+            checkConsistency(res);
+            zfree(res);
+
+            res = intsetUnion(a,b);
+            assert(intsetLen(res) == intsetLen(b)+diff);
+            for (uint32_t j = 0; intsetGet(res,j,&v); j++)
+                assert(intsetFind(a,v) || intsetFind(b,v));
+            checkConsistency(res);
+            zfree(res);
+            zfree(a);
+            zfree(b);
+        }
+        ok();
+    }
+
+    printf("Intersection benchmark: "); {
+        intset *a = intsetNew(), *b = intsetNew(), *res;
+        long long start;
+
+        for (i = 0; i < 100000; i++) {
+            a = intsetAdd(a,i*2,NULL);
+            b = intsetAdd(b,i*3,NULL);
+        }
+        start = usec();
+        for (i = 0; i < 100; i++) {
+            res = intsetIntersect(a,b);
+            zfree(res);
+        }
+        printf("100 intersections of 100000 elements sets, %lldusec\n",
+               usec()-start);
+        zfree(a);
+        zfree(b);
+    }
+
     return 0;
 }
 #endif
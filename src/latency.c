@@ -34,6 +34,7 @@
  */
 
 #include "server.h"
+#include <math.h>
 
 /* Dictionary type for latency events. */
 int dictStringKeyCompare(void *privdata, const void *key1, const void *key2) {
@@ -149,6 +150,86 @@ int latencyResetEvent(char *event_to_reset) {
     return resets;
 }
 
+/* ------------------------ Command latency histograms ---------------------- */
+
+/* Create an empty latency histogram. Histograms are created on demand the
+ * first time a command is called, see call(). */
+struct latencyHistogram *latencyHistogramCreate(void) {
+    return zcalloc(sizeof(struct latencyHistogram));
+}
+
+/* Return the highest value that is recorded in the specified bucket. */
+uint64_t latencyHistogramBucketMax(int bucket) {
+    int group = bucket / LATENCY_HIST_SUB_BUCKETS;
+    uint64_t sub = bucket % LATENCY_HIST_SUB_BUCKETS;
+
+    if (group == 0) return sub;
+    return ((LATENCY_HIST_SUB_BUCKETS+sub+1) << (group-1)) - 1;
+}
+
+/* Set the percentiles reported by INFO latencystats from a space separated
+ * list like "50 99 99.9". Returns C_ERR without changing the current
+ * percentiles if the list is not valid. */
+int latencySetInfoPercentiles(const char *list) {
+    int count, j;
+    sds *argv = sdssplitlen(list,strlen(list)," ",1,&count);
+    double *percentiles = zmalloc(sizeof(double)*(count ? count : 1));
+    int valid = 0;
+
+    for (j = 0; j < count; j++) {
+        char *eptr;
+
+        if (sdslen(argv[j]) == 0) continue;
+        percentiles[valid] = strtod(argv[j],&eptr);
+        if (eptr[0] != '\0' || percentiles[valid] < 0 ||
+            percentiles[valid] > 100 || isnan(percentiles[valid]))
+        {
+            sdsfreesplitres(argv,count);
+            zfree(percentiles);
+            return C_ERR;
+        }
+        valid++;
+    }
+    sdsfreesplitres(argv,count);
+    zfree(server.latency_tracking_info_percentiles);
+    server.latency_tracking_info_percentiles = percentiles;
+    server.latency_tracking_info_percentiles_len = valid;
+    return C_OK;
+}
+
+/* Return the INFO percentiles as a space separated list. */
+sds latencyGetInfoPercentiles(void) {
+    sds list = sdsempty();
+    int j;
+
+    for (j = 0; j < server.latency_tracking_info_percentiles_len; j++) {
+        if (j) list = sdscatlen(list," ",1);
+        list = sdscatprintf(list,"%g",
+            server.latency_tracking_info_percentiles[j]);
+    }
+    return list;
+}
+
+/* Return the value at the specified percentile (0-100) of the histogram,
+ * that is, the highest value of the bucket the percentile falls into,
+ * capped to the max recorded value. */
+uint64_t latencyHistogramPercentile(struct latencyHistogram *h, double percentile) {
+    uint64_t target, seen = 0;
+    int j;
+
+    if (h->count == 0) return 0;
+    target = (uint64_t)ceil(percentile/100*h->count);
+    if (target == 0) target = 1;
+    for (j = 0; j < LATENCY_HIST_BUCKETS; j++) {
+        seen += h->buckets[j];
+        if (seen >= target) {
+            uint64_t value = latencyHistogramBucketMax(j);
+            return value < h->max ? value : h->max;
+        }
+    }
+    return h->max;
+}
+
 /* ------------------------ Latency reporting (doctor) ---------------------- */
 
 /* Analyze the samples avaialble for a given event and return a structure
@@ -364,6 +445,12 @@ sds createLatencyReport(void) {
             advices += 2;
         }
 
+        /* Active rehashing of the keyspace. */
+        if (!strcasecmp(event,"rehash-cron")) {
+            advise_hz = 1;
+            advices++;
+        }
+
         /* Eviction cycle. */
         if (!strcasecmp(event,"eviction-del")) {
             advise_large_objects = 1;
@@ -557,12 +644,76 @@ sds latencyCommandGenSparkeline(char *event, struct latencyTimeSeries *ts) {
     return graph;
 }
 
+/* latencyCommand() helper to produce the reply of LATENCY HISTOGRAM for
+ * a single command: the number of calls, and the cumulative number of calls
+ * that took up to every power of two microseconds, up to the slowest one.
+ * Only the powers of two where the count changes are reported. */
+void latencyCommandReplyWithHistogram(client *c, struct redisCommand *cmd) {
+    struct latencyHistogram *h = cmd->latency_histogram;
+    void *replylen;
+    uint64_t bound = 1, seen = 0, reported = 0;
+    int j = 0, pairs = 0;
+
+    addReplyBulkCString(c,cmd->name);
+    addReplyMultiBulkLen(c,4);
+    addReplyBulkCString(c,"calls");
+    addReplyLongLong(c,h->count);
+    addReplyBulkCString(c,"histogram_usec");
+    replylen = addDeferredMultiBulkLength(c);
+    while (reported < h->count) {
+        while (j < LATENCY_HIST_BUCKETS && latencyHistogramBucketMax(j) <= bound)
+            seen += h->buckets[j++];
+        if (seen != reported) {
+            addReplyLongLong(c,bound);
+            addReplyLongLong(c,seen);
+            reported = seen;
+            pairs++;
+        }
+        bound <<= 1;
+    }
+    setDeferredMultiBulkLength(c,replylen,pairs*2);
+}
+
+/* latencyCommand() helper for LATENCY HISTOGRAM: reply with the histogram
+ * of the specified commands, or of every command called so far if no
+ * command is given. Unknown commands, and commands never called since the
+ * last CONFIG RESETSTAT, are skipped. */
+void latencyCommandReplyWithHistograms(client *c) {
+    void *replylen = addDeferredMultiBulkLength(c);
+    struct redisCommand *cmd;
+    int j, count = 0;
+
+    if (c->argc == 2) {
+        dictIterator *di = dictGetIterator(server.commands);
+        dictEntry *de;
+
+        while((de = dictNext(di)) != NULL) {
+            cmd = dictGetVal(de);
+            if (!cmd->latency_histogram || !cmd->latency_histogram->count)
+                continue;
+            latencyCommandReplyWithHistogram(c,cmd);
+            count++;
+        }
+        dictReleaseIterator(di);
+    } else {
+        for (j = 2; j < c->argc; j++) {
+            cmd = lookupCommandOrOriginal(c->argv[j]->ptr);
+            if (!cmd || !cmd->latency_histogram ||
+                !cmd->latency_histogram->count) continue;
+            latencyCommandReplyWithHistogram(c,cmd);
+            count++;
+        }
+    }
+    setDeferredMultiBulkLength(c,replylen,count*2);
+}
+
 /* LATENCY command implementations.
  *
  * LATENCY SAMPLES: return time-latency samples for the specified event.
  * LATENCY LATEST: return the latest latency for all the events classes.
  * LATENCY DOCTOR: returns an human readable analysis of instance latency.
  * LATENCY GRAPH: provide an ASCII graph of the latency of the specified event.
+ * LATENCY HISTOGRAM: return the latency histogram of the specified commands.
  */
 void latencyCommand(client *c) {
     struct latencyTimeSeries *ts;
@@ -598,6 +749,9 @@ void latencyCommand(client *c) {
 
         addReplyBulkCBuffer(c,report,sdslen(report));
         sdsfree(report);
+    } else if (!strcasecmp(c->argv[1]->ptr,"histogram") && c->argc >= 2) {
+        /* LATENCY HISTOGRAM [command ...] */
+        latencyCommandReplyWithHistograms(c);
     } else if (!strcasecmp(c->argv[1]->ptr,"reset") && c->argc >= 2) {
         /* LATENCY RESET */
         if (c->argc == 2) {
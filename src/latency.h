@@ -61,7 +61,50 @@ struct latencyStats {
     time_t period;          /* Number of seconds since first event and now. */
 };
 
+/* Latency histogram of a command, with logarithmic buckets each split in
+ * LATENCY_HIST_SUB_BUCKETS linear sub buckets, in the spirit of HDR
+ * histograms: values are recorded in microseconds with a relative error
+ * below 1/LATENCY_HIST_SUB_BUCKETS, so that tail percentiles like the
+ * p99.9 can be reported with a fixed amount of memory. */
+#define LATENCY_HIST_SUB_BITS 5
+#define LATENCY_HIST_SUB_BUCKETS (1<<LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_MAX_BITS 36 /* Max value is 2^36 usec, about 19 hours. */
+#define LATENCY_HIST_MAX_VALUE ((1ULL<<LATENCY_HIST_MAX_BITS)-1)
+#define LATENCY_HIST_BUCKETS \
+    ((LATENCY_HIST_MAX_BITS-LATENCY_HIST_SUB_BITS+1)*LATENCY_HIST_SUB_BUCKETS)
+
+struct latencyHistogram {
+    uint64_t count; /* Number of recorded values. */
+    uint64_t max;   /* Max recorded value. */
+    uint64_t buckets[LATENCY_HIST_BUCKETS];
+};
+
+/* Return the bucket of the value 'usec'. Values smaller than the number of
+ * sub buckets have a bucket each, then every power of two range is split
+ * in LATENCY_HIST_SUB_BUCKETS buckets. */
+static inline int latencyHistogramBucket(uint64_t usec) {
+    int msb, shift;
+
+    if (usec < LATENCY_HIST_SUB_BUCKETS) return usec;
+    if (usec > LATENCY_HIST_MAX_VALUE) usec = LATENCY_HIST_MAX_VALUE;
+    msb = 63 - __builtin_clzll(usec);
+    shift = msb - LATENCY_HIST_SUB_BITS;
+    return (shift+1)*LATENCY_HIST_SUB_BUCKETS +
+           (int)(usec >> shift) - LATENCY_HIST_SUB_BUCKETS;
+}
+
+static inline void latencyHistogramRecord(struct latencyHistogram *h, uint64_t usec) {
+    h->buckets[latencyHistogramBucket(usec)]++;
+    h->count++;
+    if (usec > h->max) h->max = usec;
+}
+
 void latencyMonitorInit(void);
+struct latencyHistogram *latencyHistogramCreate(void);
+uint64_t latencyHistogramBucketMax(int bucket);
+uint64_t latencyHistogramPercentile(struct latencyHistogram *h, double percentile);
+int latencySetInfoPercentiles(const char *list);
+sds latencyGetInfoPercentiles(void);
 void latencyAddSample(char *event, mstime_t latency);
 int THPIsEnabled(void);
 
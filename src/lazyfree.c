@@ -35,9 +35,12 @@ size_t lazyfreeGetFreeEffort(robj *obj) {
     } else if (obj->type == OBJ_SET && obj->encoding == OBJ_ENCODING_HT) {
         dict *ht = obj->ptr;
         return dictSize(ht);
-    } else if (obj->type == OBJ_ZSET && obj->encoding == OBJ_ENCODING_SKIPLIST){
+    } else if (obj->type == OBJ_SET && obj->encoding == OBJ_ENCODING_ROARING) {
+        roaring *r = obj->ptr;
+        return r->len; /* One allocation per container. */
+    } else if (obj->type == OBJ_ZSET && obj->encoding == OBJ_ENCODING_BTREE){
         zset *zs = obj->ptr;
-        return zs->zsl->length;
+        return zbtLength(zs->zbt);
     } else if (obj->type == OBJ_HASH && obj->encoding == OBJ_ENCODING_HT) {
         dict *ht = obj->ptr;
         return dictSize(ht);
@@ -52,16 +55,14 @@ size_t lazyfreeGetFreeEffort(robj *obj) {
  * will be reclaimed in a different bio.c thread. */
 #define LAZYFREE_THRESHOLD 64
 int dbAsyncDelete(redisDb *db, robj *key) {
-    /* Deleting an entry from the expires dict will not free the sds of
-     * the key, because it is shared with the main dictionary. */
-    if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
-
     /* If the value is composed of a few allocations, to free in a lazy way
      * is actually just slower... So under a certain limit we just free
      * the object synchronously. */
+    if (rdbForklessSaveInProgress()) rdbSaveForklessKeyWillChange(db,key->ptr);
     dictEntry *de = dictUnlink(db->dict,key->ptr);
     if (de) {
         robj *val = dictGetVal(de);
+        long long when = dbEntryGetExpire(de);
         size_t free_effort = lazyfreeGetFreeEffort(val);
 
         /* If releasing the object is too much work, do it in the background
@@ -77,6 +78,10 @@ int dbAsyncDelete(redisDb *db, robj *key) {
             bioCreateBackgroundJob(BIO_LAZY_FREE,val,NULL,NULL);
             dictSetVal(db->dict,de,NULL);
         }
+
+        /* The expires index references the key name stored in the entry:
+         * drop it before releasing the entry. */
+        if (when != -1) expiresIndexDel(db,dictGetKey(de),when);
     }
 
     /* Release the key-val pair, or just the key if we set the val
@@ -94,11 +99,13 @@ int dbAsyncDelete(redisDb *db, robj *key) {
  * create a new empty set of hash tables and scheduling the old ones for
  * lazy freeing. */
 void emptyDbAsync(redisDb *db) {
-    dict *oldht1 = db->dict, *oldht2 = db->expires;
+    dict *oldht = db->dict;
+    ttlWheel *oldexpires = db->expires;
+    unshareClientsReplyObjects();
     db->dict = dictCreate(&dbDictType,NULL);
-    db->expires = dictCreate(&keyptrDictType,NULL);
-    atomicIncr(lazyfree_objects,dictSize(oldht1));
-    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,oldht1,oldht2);
+    db->expires = expiresIndexCreate(db->dict);
+    atomicIncr(lazyfree_objects,dictSize(oldht));
+    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,oldht,oldexpires);
 }
 
 /* Empty the slots-keys map of Redis CLuster by creating a new empty one
@@ -125,10 +132,10 @@ void lazyfreeFreeObjectFromBioThread(robj *o) {
  * when the database was logically deleted. 'sl' is a skiplist used by
  * Redis Cluster in order to take the hash slots -> keys mapping. This
  * may be NULL if Redis Cluster is disabled. */
-void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2) {
-    size_t numkeys = dictSize(ht1);
-    dictRelease(ht1);
-    dictRelease(ht2);
+void lazyfreeFreeDatabaseFromBioThread(dict *ht, ttlWheel *expires) {
+    size_t numkeys = dictSize(ht);
+    dictRelease(ht);
+    ttlWheelRelease(expires);
     atomicDecr(lazyfree_objects,numkeys);
 }
 
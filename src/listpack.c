@@ -0,0 +1,1189 @@
+/* Listpack -- A list of strings serialization format
+ *
+ * 内存布局 / Layout:
+ *
+ * <total-bytes> <num-elements> <entry> <entry> ... <entry> <end>
+ *
+ * total-bytes  : 32 bit unsigned, little endian, size of the whole listpack.
+ * num-elements : 16 bit unsigned, number of entries. When the count does
+ *                not fit (65535 or more) the field is set to 65535 and the
+ *                real length is computed by walking the listpack.
+ * end          : a single 0xFF byte.
+ *
+ * Every entry is <encoding+data> <backlen>. The encoding byte tells both
+ * the type and the size of the data:
+ *
+ * 0xxxxxxx                       7 bit unsigned integer
+ * 10xxxxxx <data>                string, length up to 63
+ * 110xxxxx yyyyyyyy              13 bit signed integer
+ * 1110xxxx yyyyyyyy <data>       string, length up to 4095
+ * 11110000 <4 bytes len> <data>  string, length up to 2^32-1
+ * 11110001 <2 bytes>             16 bit signed integer
+ * 11110010 <3 bytes>             24 bit signed integer
+ * 11110011 <4 bytes>             32 bit signed integer
+ * 11110100 <8 bytes>             64 bit signed integer
+ *
+ * backlen is the size of <encoding+data>, stored in 7 bit groups from the
+ * most significant to the least significant one. Every byte but the first
+ * has its high bit set, so reading it backward from the last byte of the
+ * entry we know when to stop: this is what makes lpPrev() possible without
+ * a prevlen field in the next entry.
+ *
+ * 与ziplist不同, 修改一个entry永远不会改变它后面entry的大小.
+ * Unlike the ziplist, changing an entry never changes the size of the
+ * entries that follow it, so there are no cascade updates.
+ */
+
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "zmalloc.h"
+#include "util.h"
+#include "listpack.h"
+#include "redisassert.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define UNUSED(V) ((void) V)
+
+/* Without a way to ask the allocator for the usable size we can't know
+ * about any slack, so we just realloc every time the listpack grows. */
+#ifdef HAVE_MALLOC_SIZE
+#define lp_malloc_size(p) zmalloc_size(p)
+#else
+#define lp_malloc_size(p) lpGetTotalBytes(p)
+#endif
+
+#define LP_HDR_SIZE 6       /* 32 bit total len + 16 bit number of elements. */
+#define LP_HDR_NUMELE_UNKNOWN UINT16_MAX
+#define LP_MAX_INT_ENCODING_LEN 9
+#define LP_MAX_BACKLEN_SIZE 5
+#define LP_ENCODING_INT 0
+#define LP_ENCODING_STRING 1
+
+#define LP_ENCODING_7BIT_UINT 0
+#define LP_ENCODING_7BIT_UINT_MASK 0x80
+#define LP_ENCODING_IS_7BIT_UINT(byte) (((byte)&LP_ENCODING_7BIT_UINT_MASK)==LP_ENCODING_7BIT_UINT)
+
+#define LP_ENCODING_6BIT_STR 0x80
+#define LP_ENCODING_6BIT_STR_MASK 0xC0
+#define LP_ENCODING_IS_6BIT_STR(byte) (((byte)&LP_ENCODING_6BIT_STR_MASK)==LP_ENCODING_6BIT_STR)
+
+#define LP_ENCODING_13BIT_INT 0xC0
+#define LP_ENCODING_13BIT_INT_MASK 0xE0
+#define LP_ENCODING_IS_13BIT_INT(byte) (((byte)&LP_ENCODING_13BIT_INT_MASK)==LP_ENCODING_13BIT_INT)
+
+#define LP_ENCODING_12BIT_STR 0xE0
+#define LP_ENCODING_12BIT_STR_MASK 0xF0
+#define LP_ENCODING_IS_12BIT_STR(byte) (((byte)&LP_ENCODING_12BIT_STR_MASK)==LP_ENCODING_12BIT_STR)
+
+#define LP_ENCODING_16BIT_INT 0xF1
+#define LP_ENCODING_24BIT_INT 0xF2
+#define LP_ENCODING_32BIT_INT 0xF3
+#define LP_ENCODING_64BIT_INT 0xF4
+#define LP_ENCODING_32BIT_STR 0xF0
+
+#define LP_EOF 0xFF
+
+#define LP_ENCODING_6BIT_STR_LEN(p) ((p)[0] & 0x3F)
+#define LP_ENCODING_12BIT_STR_LEN(p) ((((p)[0] & 0xF) << 8) | (p)[1])
+#define LP_ENCODING_32BIT_STR_LEN(p) (((uint32_t)(p)[1]<<0) | \
+                                      ((uint32_t)(p)[2]<<8) | \
+                                      ((uint32_t)(p)[3]<<16) | \
+                                      ((uint32_t)(p)[4]<<24))
+
+#define lpGetTotalBytes(p)           (((uint32_t)(p)[0]<<0) | \
+                                      ((uint32_t)(p)[1]<<8) | \
+                                      ((uint32_t)(p)[2]<<16) | \
+                                      ((uint32_t)(p)[3]<<24))
+
+#define lpGetNumElements(p)          (((uint32_t)(p)[4]<<0) | \
+                                      ((uint32_t)(p)[5]<<8))
+#define lpSetTotalBytes(p,v) do { \
+    (p)[0] = (v)&0xff; \
+    (p)[1] = ((v)>>8)&0xff; \
+    (p)[2] = ((v)>>16)&0xff; \
+    (p)[3] = ((v)>>24)&0xff; \
+} while(0)
+
+#define lpSetNumElements(p,v) do { \
+    (p)[4] = (v)&0xff; \
+    (p)[5] = ((v)>>8)&0xff; \
+} while(0)
+
+/* ---------------------------- Encoding helpers ---------------------------- */
+
+/* Encode the integer 'v' into 'intenc' using the smallest possible encoding,
+ * storing the number of bytes used in '*enclen'. */
+static inline void lpEncodeIntegerGetType(int64_t v, unsigned char *intenc, uint64_t *enclen) {
+    if (v >= 0 && v <= 127) {
+        intenc[0] = v;
+        *enclen = 1;
+    } else if (v >= -4096 && v <= 4095) {
+        if (v < 0) v = ((int64_t)1<<13)+v;
+        intenc[0] = (v>>8)|LP_ENCODING_13BIT_INT;
+        intenc[1] = v&0xff;
+        *enclen = 2;
+    } else if (v >= -32768 && v <= 32767) {
+        if (v < 0) v = ((int64_t)1<<16)+v;
+        intenc[0] = LP_ENCODING_16BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = v>>8;
+        *enclen = 3;
+    } else if (v >= -8388608 && v <= 8388607) {
+        if (v < 0) v = ((int64_t)1<<24)+v;
+        intenc[0] = LP_ENCODING_24BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = (v>>8)&0xff;
+        intenc[3] = v>>16;
+        *enclen = 4;
+    } else if (v >= -2147483648LL && v <= 2147483647LL) {
+        if (v < 0) v = ((int64_t)1<<32)+v;
+        intenc[0] = LP_ENCODING_32BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = (v>>8)&0xff;
+        intenc[3] = (v>>16)&0xff;
+        intenc[4] = v>>24;
+        *enclen = 5;
+    } else {
+        uint64_t uv = v;
+        intenc[0] = LP_ENCODING_64BIT_INT;
+        intenc[1] = uv&0xff;
+        intenc[2] = (uv>>8)&0xff;
+        intenc[3] = (uv>>16)&0xff;
+        intenc[4] = (uv>>24)&0xff;
+        intenc[5] = (uv>>32)&0xff;
+        intenc[6] = (uv>>40)&0xff;
+        intenc[7] = (uv>>48)&0xff;
+        intenc[8] = uv>>56;
+        *enclen = 9;
+    }
+}
+
+/* Return LP_ENCODING_INT if 'ele' can be represented as an integer, in that
+ * case the encoded integer is written in 'intenc'. Otherwise return
+ * LP_ENCODING_STRING. In both cases '*enclen' is set to the number of bytes
+ * of the encoding plus the data, without the backlen. */
+static inline int lpEncodeGetType(unsigned char *ele, uint32_t size, unsigned char *intenc, uint64_t *enclen) {
+    long long v;
+    if (size > 0 && size <= 20 && string2ll((char*)ele,size,&v)) {
+        lpEncodeIntegerGetType(v,intenc,enclen);
+        return LP_ENCODING_INT;
+    } else {
+        if (size < 64) *enclen = 1+size;
+        else if (size < 4096) *enclen = 2+size;
+        else *enclen = 5+(uint64_t)size;
+        return LP_ENCODING_STRING;
+    }
+}
+
+/* Store the backlen 'l' in 'buf', returning the number of bytes used.
+ * With buf set to NULL only the number of bytes is returned. */
+static inline unsigned long lpEncodeBacklen(unsigned char *buf, uint64_t l) {
+    if (l <= 127) {
+        if (buf) buf[0] = l;
+        return 1;
+    } else if (l < 16383) {
+        if (buf) {
+            buf[0] = l>>7;
+            buf[1] = (l&127)|128;
+        }
+        return 2;
+    } else if (l < 2097151) {
+        if (buf) {
+            buf[0] = l>>14;
+            buf[1] = ((l>>7)&127)|128;
+            buf[2] = (l&127)|128;
+        }
+        return 3;
+    } else if (l < 268435455) {
+        if (buf) {
+            buf[0] = l>>21;
+            buf[1] = ((l>>14)&127)|128;
+            buf[2] = ((l>>7)&127)|128;
+            buf[3] = (l&127)|128;
+        }
+        return 4;
+    } else {
+        if (buf) {
+            buf[0] = l>>28;
+            buf[1] = ((l>>21)&127)|128;
+            buf[2] = ((l>>14)&127)|128;
+            buf[3] = ((l>>7)&127)|128;
+            buf[4] = (l&127)|128;
+        }
+        return 5;
+    }
+}
+
+/* Decode the backlen whose last byte is pointed by 'p'. Returns UINT64_MAX
+ * if the encoding is invalid. */
+static inline uint64_t lpDecodeBacklen(unsigned char *p) {
+    uint64_t val = 0;
+    uint64_t shift = 0;
+    do {
+        val |= (uint64_t)(p[0] & 127) << shift;
+        if (!(p[0] & 128)) break;
+        shift += 7;
+        p--;
+        if (shift > 28) return UINT64_MAX;
+    } while(1);
+    return val;
+}
+
+/* Write the encoding header of a string of 'len' bytes, returning the
+ * number of bytes used. */
+static inline uint32_t lpEncodeStringHeader(unsigned char *buf, uint32_t len) {
+    if (len < 64) {
+        buf[0] = len | LP_ENCODING_6BIT_STR;
+        return 1;
+    } else if (len < 4096) {
+        buf[0] = (len >> 8) | LP_ENCODING_12BIT_STR;
+        buf[1] = len & 0xff;
+        return 2;
+    } else {
+        buf[0] = LP_ENCODING_32BIT_STR;
+        buf[1] = len & 0xff;
+        buf[2] = (len >> 8) & 0xff;
+        buf[3] = (len >> 16) & 0xff;
+        buf[4] = (len >> 24) & 0xff;
+        return 5;
+    }
+}
+
+/* Write the string encoding header followed by the string itself. */
+static inline void lpEncodeString(unsigned char *buf, unsigned char *s, uint32_t len) {
+    uint32_t hdrlen = lpEncodeStringHeader(buf,len);
+    memcpy(buf+hdrlen,s,len);
+}
+
+/* Return the size of the encoding plus data of the entry at 'p', without
+ * the backlen. Returns 0 for an invalid encoding byte. */
+static inline uint32_t lpCurrentEncodedSizeUnsafe(unsigned char *p) {
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) return 1;
+    if (LP_ENCODING_IS_6BIT_STR(p[0])) return 1+LP_ENCODING_6BIT_STR_LEN(p);
+    if (LP_ENCODING_IS_13BIT_INT(p[0])) return 2;
+    if (LP_ENCODING_IS_12BIT_STR(p[0])) return 2+LP_ENCODING_12BIT_STR_LEN(p);
+    switch(p[0]) {
+    case LP_ENCODING_16BIT_INT: return 3;
+    case LP_ENCODING_24BIT_INT: return 4;
+    case LP_ENCODING_32BIT_INT: return 5;
+    case LP_ENCODING_64BIT_INT: return 9;
+    case LP_ENCODING_32BIT_STR: return 5+LP_ENCODING_32BIT_STR_LEN(p);
+    case LP_EOF: return 1;
+    }
+    return 0;
+}
+
+/* Return how many bytes of the entry at 'p' must be readable in order to
+ * call lpCurrentEncodedSizeUnsafe() on it. */
+static inline uint32_t lpCurrentEncodedSizeBytes(unsigned char *p) {
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) return 1;
+    if (LP_ENCODING_IS_6BIT_STR(p[0])) return 1;
+    if (LP_ENCODING_IS_13BIT_INT(p[0])) return 1;
+    if (LP_ENCODING_IS_12BIT_STR(p[0])) return 2;
+    if (p[0] == LP_ENCODING_32BIT_STR) return 5;
+    return 1;
+}
+
+/* Return the pointer to the byte just after the entry at 'p'. */
+static inline unsigned char *lpSkip(unsigned char *p) {
+    unsigned long entrylen = lpCurrentEncodedSizeUnsafe(p);
+    entrylen += lpEncodeBacklen(NULL,entrylen);
+    return p+entrylen;
+}
+
+/* ------------------------------ Public API -------------------------------- */
+
+/* Create a new empty listpack. 'capacity' is a hint of the number of bytes
+ * to preallocate, pass 0 to allocate just the header and the terminator. */
+unsigned char *lpNew(size_t capacity) {
+    unsigned char *lp = zmalloc(capacity > LP_HDR_SIZE+1 ? capacity : LP_HDR_SIZE+1);
+    lpSetTotalBytes(lp,LP_HDR_SIZE+1);
+    lpSetNumElements(lp,0);
+    lp[LP_HDR_SIZE] = LP_EOF;
+    return lp;
+}
+
+void lpFree(unsigned char *lp) {
+    zfree(lp);
+}
+
+/* Release the memory preallocated beyond the used bytes, if any. */
+unsigned char *lpShrinkToFit(unsigned char *lp) {
+    size_t size = lpGetTotalBytes(lp);
+    if (size < lp_malloc_size(lp)) {
+        return zrealloc(lp, size);
+    } else {
+        return lp;
+    }
+}
+
+/* Return the first entry, or NULL if the listpack is empty. */
+unsigned char *lpFirst(unsigned char *lp) {
+    unsigned char *p = lp + LP_HDR_SIZE;
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+/* Return the entry after 'p', or NULL if 'p' is the last entry. */
+unsigned char *lpNext(unsigned char *lp, unsigned char *p) {
+    UNUSED(lp);
+    p = lpSkip(p);
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+/* Return the entry before 'p', or NULL if 'p' is the first entry. 'p' may
+ * also point to the terminator, in that case the last entry is returned. */
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p) {
+    if (p-lp == LP_HDR_SIZE) return NULL;
+    p--; /* Seek the last byte of the previous entry backlen. */
+    uint64_t prevlen = lpDecodeBacklen(p);
+    prevlen += lpEncodeBacklen(NULL,prevlen);
+    return p-prevlen+1;
+}
+
+/* Return the last entry, or NULL if the listpack is empty. */
+unsigned char *lpLast(unsigned char *lp) {
+    unsigned char *p = lp+lpGetTotalBytes(lp)-1; /* Seek EOF element. */
+    return lpPrev(lp,p);
+}
+
+/* Return the number of entries. When the header counter saturated the
+ * listpack is scanned, and the header fixed if the count fits again. */
+unsigned long lpLength(unsigned char *lp) {
+    uint32_t numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN) return numele;
+
+    uint32_t count = 0;
+    unsigned char *p = lpFirst(lp);
+    while(p) {
+        count++;
+        p = lpNext(lp,p);
+    }
+    if (count < LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp,count);
+    return count;
+}
+
+/* Return the entry at 'p'. For a string entry a pointer to the string is
+ * returned and '*count' is set to its length. For an integer entry, if
+ * 'intbuf' is not NULL the integer is converted into 'intbuf' as a string,
+ * 'intbuf' is returned and '*count' is set to the string length; otherwise
+ * NULL is returned and '*count' is set to the integer value itself. */
+unsigned char *lpGet(unsigned char *p, int64_t *count, unsigned char *intbuf) {
+    int64_t val;
+    uint64_t uval, negstart, negmax;
+
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) {
+        negstart = UINT64_MAX; /* 7 bit ints are always positive. */
+        negmax = 0;
+        uval = p[0] & 0x7f;
+    } else if (LP_ENCODING_IS_6BIT_STR(p[0])) {
+        *count = LP_ENCODING_6BIT_STR_LEN(p);
+        return p+1;
+    } else if (LP_ENCODING_IS_13BIT_INT(p[0])) {
+        uval = ((p[0]&0x1f)<<8) | p[1];
+        negstart = (uint64_t)1<<12;
+        negmax = 8191;
+    } else if (p[0] == LP_ENCODING_16BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8;
+        negstart = (uint64_t)1<<15;
+        negmax = UINT16_MAX;
+    } else if (p[0] == LP_ENCODING_24BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16;
+        negstart = (uint64_t)1<<23;
+        negmax = UINT32_MAX>>8;
+    } else if (p[0] == LP_ENCODING_32BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16 |
+               (uint64_t)p[4]<<24;
+        negstart = (uint64_t)1<<31;
+        negmax = UINT32_MAX;
+    } else if (p[0] == LP_ENCODING_64BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16 |
+               (uint64_t)p[4]<<24 |
+               (uint64_t)p[5]<<32 |
+               (uint64_t)p[6]<<40 |
+               (uint64_t)p[7]<<48 |
+               (uint64_t)p[8]<<56;
+        negstart = (uint64_t)1<<63;
+        negmax = UINT64_MAX;
+    } else if (LP_ENCODING_IS_12BIT_STR(p[0])) {
+        *count = LP_ENCODING_12BIT_STR_LEN(p);
+        return p+2;
+    } else if (p[0] == LP_ENCODING_32BIT_STR) {
+        *count = LP_ENCODING_32BIT_STR_LEN(p);
+        return p+5;
+    } else {
+        uval = 12345678900000000ULL + p[0];
+        negstart = UINT64_MAX;
+        negmax = 0;
+    }
+
+    /* Convert the two's complement representation into a signed value. */
+    if (uval >= negstart) {
+        uval = negmax-uval;
+        val = uval;
+        val = -val-1;
+    } else {
+        val = uval;
+    }
+
+    if (intbuf) {
+        *count = ll2string((char*)intbuf,LP_INTBUF_SIZE,(long long)val);
+        return intbuf;
+    } else {
+        *count = val;
+        return NULL;
+    }
+}
+
+/* Same as lpGet() but with an interface close to ziplistGet(): returns the
+ * string pointer and sets '*slen' for strings, or returns NULL and sets
+ * '*lval' for integers. */
+unsigned char *lpGetValue(unsigned char *p, unsigned int *slen, long long *lval) {
+    unsigned char *vstr;
+    int64_t ele_len;
+
+    vstr = lpGet(p,&ele_len,NULL);
+    if (vstr) {
+        *slen = ele_len;
+    } else {
+        *lval = ele_len;
+    }
+    return vstr;
+}
+
+/* Insert, delete or replace the entry at 'p'.
+ *
+ * Either 'elestr' (a string that will be stored as an integer when
+ * possible) or 'eleint' (an already encoded integer of 'size' bytes) is
+ * inserted before or after 'p', or replaces the entry at 'p', according
+ * to 'where'. When both are NULL the entry at 'p' is deleted.
+ *
+ * If 'newp' is not NULL it is set to the address of the inserted entry, or
+ * for a delete to the entry that took the place of the deleted one (NULL if
+ * the deleted entry was the last one).
+ *
+ * Returns the listpack, that may have been reallocated, or NULL if the
+ * result would be larger than 4GB. */
+static unsigned char *lpInsert(unsigned char *lp, unsigned char *elestr, unsigned char *eleint,
+                               uint32_t size, unsigned char *p, int where, unsigned char **newp)
+{
+    unsigned char intenc[LP_MAX_INT_ENCODING_LEN];
+    unsigned char backlen[LP_MAX_BACKLEN_SIZE];
+    uint64_t enclen;
+    int delete = (elestr == NULL && eleint == NULL);
+    int enctype;
+
+    /* A delete is a replace with an empty element. */
+    if (delete) where = LP_REPLACE;
+
+    /* Inserting after an element is inserting before the next one. */
+    if (where == LP_AFTER) {
+        p = lpSkip(p);
+        where = LP_BEFORE;
+    }
+
+    /* Remember the offset, 'p' is invalidated by the realloc. */
+    unsigned long poff = p-lp;
+
+    if (elestr) {
+        enctype = lpEncodeGetType(elestr,size,intenc,&enclen);
+        if (enctype == LP_ENCODING_INT) eleint = intenc;
+    } else if (eleint) {
+        enctype = LP_ENCODING_INT;
+        enclen = size;
+    } else {
+        enctype = -1;
+        enclen = 0;
+    }
+
+    unsigned long backlen_size = (!delete) ? lpEncodeBacklen(backlen,enclen) : 0;
+    uint64_t old_listpack_bytes = lpGetTotalBytes(lp);
+    uint32_t replaced_len = 0;
+    if (where == LP_REPLACE) {
+        replaced_len = lpCurrentEncodedSizeUnsafe(p);
+        replaced_len += lpEncodeBacklen(NULL,replaced_len);
+    }
+
+    uint64_t new_listpack_bytes = old_listpack_bytes + enclen + backlen_size
+                                  - replaced_len;
+    if (new_listpack_bytes > UINT32_MAX) return NULL;
+
+    unsigned char *dst = lp + poff;
+
+    /* Grow before moving the tail, shrink after. */
+    if (new_listpack_bytes > old_listpack_bytes &&
+        new_listpack_bytes > lp_malloc_size(lp)) {
+        lp = zrealloc(lp,new_listpack_bytes);
+        dst = lp + poff;
+    }
+
+    if (where == LP_BEFORE) {
+        memmove(dst+enclen+backlen_size,dst,old_listpack_bytes-poff);
+    } else { /* LP_REPLACE. */
+        memmove(dst+enclen+backlen_size,
+                dst+replaced_len,
+                old_listpack_bytes-poff-replaced_len);
+    }
+
+    if (new_listpack_bytes < old_listpack_bytes) {
+        lp = zrealloc(lp,new_listpack_bytes);
+        dst = lp + poff;
+    }
+
+    if (newp) {
+        *newp = dst;
+        if (delete && dst[0] == LP_EOF) *newp = NULL;
+    }
+    if (!delete) {
+        if (enctype == LP_ENCODING_INT) {
+            memcpy(dst,eleint,enclen);
+        } else {
+            lpEncodeString(dst,elestr,size);
+        }
+        dst += enclen;
+        memcpy(dst,backlen,backlen_size);
+    }
+
+    /* Update the header. */
+    if (where != LP_REPLACE || delete) {
+        uint32_t num_elements = lpGetNumElements(lp);
+        if (num_elements != LP_HDR_NUMELE_UNKNOWN) {
+            if (!delete)
+                lpSetNumElements(lp,num_elements+1);
+            else
+                lpSetNumElements(lp,num_elements-1);
+        }
+    }
+    lpSetTotalBytes(lp,new_listpack_bytes);
+    return lp;
+}
+
+unsigned char *lpInsertString(unsigned char *lp, unsigned char *s, uint32_t slen,
+                              unsigned char *p, int where, unsigned char **newp)
+{
+    return lpInsert(lp,s,NULL,slen,p,where,newp);
+}
+
+unsigned char *lpInsertInteger(unsigned char *lp, long long lval,
+                               unsigned char *p, int where, unsigned char **newp)
+{
+    uint64_t enclen;
+    unsigned char intenc[LP_MAX_INT_ENCODING_LEN];
+    lpEncodeIntegerGetType(lval,intenc,&enclen);
+    return lpInsert(lp,NULL,intenc,enclen,p,where,newp);
+}
+
+unsigned char *lpAppend(unsigned char *lp, unsigned char *s, uint32_t slen) {
+    unsigned char *eofptr = lp + lpGetTotalBytes(lp) - 1;
+    return lpInsertString(lp,s,slen,eofptr,LP_BEFORE,NULL);
+}
+
+unsigned char *lpAppendInteger(unsigned char *lp, long long lval) {
+    unsigned char *eofptr = lp + lpGetTotalBytes(lp) - 1;
+    return lpInsertInteger(lp,lval,eofptr,LP_BEFORE,NULL);
+}
+
+unsigned char *lpPrepend(unsigned char *lp, unsigned char *s, uint32_t slen) {
+    unsigned char *p = lpFirst(lp);
+    if (!p) return lpAppend(lp,s,slen);
+    return lpInsertString(lp,s,slen,p,LP_BEFORE,NULL);
+}
+
+unsigned char *lpPrependInteger(unsigned char *lp, long long lval) {
+    unsigned char *p = lpFirst(lp);
+    if (!p) return lpAppendInteger(lp,lval);
+    return lpInsertInteger(lp,lval,p,LP_BEFORE,NULL);
+}
+
+/* Replace the entry at '*p', that is updated to the new entry. */
+unsigned char *lpReplace(unsigned char *lp, unsigned char **p, unsigned char *s, uint32_t slen) {
+    return lpInsertString(lp,s,slen,*p,LP_REPLACE,p);
+}
+
+unsigned char *lpReplaceInteger(unsigned char *lp, unsigned char **p, long long lval) {
+    return lpInsertInteger(lp,lval,*p,LP_REPLACE,p);
+}
+
+/* Delete the entry at 'p'. If 'newp' is not NULL it is set to the next
+ * entry, or NULL if the deleted entry was the last one. */
+unsigned char *lpDelete(unsigned char *lp, unsigned char *p, unsigned char **newp) {
+    return lpInsert(lp,NULL,NULL,0,p,LP_REPLACE,newp);
+}
+
+/* Delete 'num' consecutive entries starting at '*p', with a single memmove.
+ * '*p' is updated to the entry that follows the deleted ones, or NULL. */
+unsigned char *lpDeleteRangeWithEntry(unsigned char *lp, unsigned char **p, unsigned long num) {
+    size_t bytes = lpBytes(lp);
+    unsigned long deleted = 0;
+    unsigned char *eofptr = lp + bytes - 1;
+    unsigned char *first, *tail;
+    first = tail = *p;
+
+    if (num == 0) return lp;
+
+    while (num--) {
+        deleted++;
+        tail = lpSkip(tail);
+        if (tail[0] == LP_EOF) break;
+    }
+
+    unsigned long poff = first-lp;
+
+    memmove(first,tail,eofptr-tail+1);
+    lpSetTotalBytes(lp,bytes-(tail-first));
+    uint32_t numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN)
+        lpSetNumElements(lp,numele-deleted);
+    lp = lpShrinkToFit(lp);
+
+    *p = lp+poff;
+    if ((*p)[0] == LP_EOF) *p = NULL;
+    return lp;
+}
+
+/* Delete 'num' entries starting at 'index' (negative counts from the tail). */
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num) {
+    unsigned char *p;
+    uint32_t numele = lpGetNumElements(lp);
+
+    if (num == 0) return lp;
+    if ((p = lpSeek(lp,index)) == NULL) return lp;
+
+    /* When everything up to the end goes away just move the terminator. */
+    if (numele != LP_HDR_NUMELE_UNKNOWN && index < 0) index = (long)numele+index;
+    if (numele != LP_HDR_NUMELE_UNKNOWN && (numele-(unsigned long)index) <= num) {
+        p[0] = LP_EOF;
+        lpSetTotalBytes(lp,p-lp+1);
+        lpSetNumElements(lp,index);
+        lp = lpShrinkToFit(lp);
+    } else {
+        lp = lpDeleteRangeWithEntry(lp,&p,num);
+    }
+    return lp;
+}
+
+/* Merge listpacks 'first' and 'second' by appending 'second' to 'first'.
+ * The larger of the two is reallocated to hold the result, the other one
+ * is freed and its pointer set to NULL. Returns the merged listpack, or
+ * NULL if the merge is not possible. */
+unsigned char *lpMerge(unsigned char **first, unsigned char **second) {
+    if (first == NULL || *first == NULL || second == NULL || *second == NULL)
+        return NULL;
+    if (*first == *second) return NULL;
+
+    size_t first_bytes = lpBytes(*first);
+    unsigned long first_len = lpLength(*first);
+    size_t second_bytes = lpBytes(*second);
+    unsigned long second_len = lpLength(*second);
+
+    int append;
+    unsigned char *source, *target;
+    size_t target_bytes, source_bytes;
+    if (first_len >= second_len) {
+        target = *first;
+        target_bytes = first_bytes;
+        source = *second;
+        source_bytes = second_bytes;
+        append = 1;
+    } else {
+        target = *second;
+        target_bytes = second_bytes;
+        source = *first;
+        source_bytes = first_bytes;
+        append = 0;
+    }
+
+    /* Both headers and one of the terminators go away. */
+    unsigned long long lpbytes = (unsigned long long)first_bytes + second_bytes
+                                 - LP_HDR_SIZE - 1;
+    if (lpbytes > UINT32_MAX) return NULL;
+    unsigned long lplength = first_len + second_len;
+    lplength = lplength < LP_HDR_NUMELE_UNKNOWN ? lplength : LP_HDR_NUMELE_UNKNOWN;
+
+    target = zrealloc(target,lpbytes);
+    if (append) {
+        /* [target entries][source entries + EOF] */
+        memcpy(target+target_bytes-1,
+               source+LP_HDR_SIZE,
+               source_bytes-LP_HDR_SIZE);
+    } else {
+        /* [source entries][target entries + EOF] */
+        memmove(target+source_bytes-1,
+                target+LP_HDR_SIZE,
+                target_bytes-LP_HDR_SIZE);
+        memcpy(target+LP_HDR_SIZE,
+               source+LP_HDR_SIZE,
+               source_bytes-LP_HDR_SIZE-1);
+    }
+    lpSetNumElements(target,lplength);
+    lpSetTotalBytes(target,lpbytes);
+
+    if (append) {
+        zfree(*second);
+        *second = NULL;
+        *first = target;
+    } else {
+        zfree(*first);
+        *first = NULL;
+        *second = target;
+    }
+    return target;
+}
+
+/* Return the total number of bytes used by the listpack. */
+size_t lpBytes(unsigned char *lp) {
+    return lpGetTotalBytes(lp);
+}
+
+/* Return the entry at 'index', negative indexes count from the tail.
+ * Returns NULL when out of range. The listpack is walked from the nearest
+ * end when the length is known. */
+unsigned char *lpSeek(unsigned char *lp, long index) {
+    int forward = 1;
+    unsigned char *p;
+
+    uint32_t numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN) {
+        if (index < 0) index = (long)numele+index;
+        if (index < 0) return NULL;
+        if (index >= (long)numele) return NULL;
+        if (index > (long)numele/2) {
+            forward = 0;
+            index -= numele;
+        }
+    } else {
+        if (index < 0) forward = 0;
+    }
+
+    if (forward) {
+        p = lpFirst(lp);
+        while (index > 0 && p) {
+            p = lpNext(lp,p);
+            index--;
+        }
+    } else {
+        p = lpLast(lp);
+        while (index < -1 && p) {
+            p = lpPrev(lp,p);
+            index++;
+        }
+    }
+    return p;
+}
+
+/* Return 1 if the entry at 'p' is equal to the string 's'. Integer entries
+ * compare equal to their canonical string representation. */
+unsigned int lpCompare(unsigned char *p, unsigned char *s, uint32_t slen) {
+    unsigned char buf[LP_INTBUF_SIZE];
+    unsigned char *value;
+    int64_t sz;
+
+    if (p[0] == LP_EOF) return 0;
+    value = lpGet(p,&sz,buf);
+    return (slen == sz) && memcmp(value,s,slen) == 0;
+}
+
+/* Number of bytes of the encoded search string lpFind() compares at once. */
+#define LP_FIND_PREFIX 16
+
+/* Return 1 if the first 'len' bytes at 'p' are equal to the ones of
+ * 'needle', with 'len' at most LP_FIND_PREFIX. The caller makes sure that
+ * LP_FIND_PREFIX bytes can be read at 'p'. SSE2 is part of x86-64, so no
+ * runtime check is needed to use it. */
+static inline int lpFindPrefixMatch(unsigned char *p, unsigned char *needle, uint32_t len) {
+#if defined(__SSE2__)
+    __m128i a = _mm_loadu_si128((const __m128i*)p);
+    __m128i b = _mm_loadu_si128((const __m128i*)needle);
+    unsigned int eq = _mm_movemask_epi8(_mm_cmpeq_epi8(a,b));
+    unsigned int mask = (1U<<len)-1;
+    return (eq & mask) == mask;
+#else
+    return memcmp(p,needle,len) == 0;
+#endif
+}
+
+/* Find the entry equal to 's' starting at 'p', comparing only one entry
+ * every 'skip'+1 (e.g. 1 to look only at the fields of a hash).
+ *
+ * Entries are always stored with the smallest encoding that fits them, so
+ * the entry we look for has exactly the bytes of 's' encoded as an entry.
+ * We encode 's' once and then compare raw bytes: the first byte alone
+ * rejects most entries (it holds the type and, for short strings, the
+ * length), and the other entries are compared LP_FIND_PREFIX bytes at a
+ * time, without ever decoding them. */
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *s, uint32_t slen, unsigned int skip) {
+    unsigned char needle[LP_FIND_PREFIX] = {0};
+    unsigned char *lpend = lp+lpGetTotalBytes(lp);
+    uint64_t enclen;
+    uint32_t hdrlen, prefix;
+    unsigned int skipcnt = 0;
+
+    if (p == NULL) return NULL;
+    if (lpEncodeGetType(s,slen,needle,&enclen) == LP_ENCODING_INT) {
+        /* An integer encoding always fits the needle: compare it all. */
+        hdrlen = prefix = enclen;
+    } else {
+        hdrlen = lpEncodeStringHeader(needle,slen);
+        prefix = enclen < LP_FIND_PREFIX ? enclen : LP_FIND_PREFIX;
+        memcpy(needle+hdrlen,s,prefix-hdrlen);
+    }
+
+    while (p[0] != LP_EOF) {
+        if (skipcnt == 0) {
+            /* Same first byte means same type and same header size, so
+             * once the header matches the lengths match as well. */
+            if (p[0] == needle[0]) {
+                if (p+LP_FIND_PREFIX <= lpend) {
+                    if (lpFindPrefixMatch(p,needle,prefix) &&
+                        (enclen == prefix ||
+                         memcmp(p+prefix,s+(prefix-hdrlen),enclen-prefix) == 0))
+                        return p;
+                } else if (memcmp(p,needle,hdrlen) == 0 &&
+                           memcmp(p+hdrlen,s,enclen-hdrlen) == 0)
+                {
+                    return p;
+                }
+            }
+            skipcnt = skip;
+        } else {
+            skipcnt--;
+        }
+        /* Short strings and small integers are the common case in small
+         * hashes and sorted sets: their backlen is always a single byte. */
+        if (LP_ENCODING_IS_6BIT_STR(p[0]))
+            p += 2+LP_ENCODING_6BIT_STR_LEN(p);
+        else if (LP_ENCODING_IS_7BIT_UINT(p[0]))
+            p += 2;
+        else
+            p = lpSkip(p);
+    }
+    return NULL;
+}
+
+/* Validate a listpack of 'size' bytes, as read from an untrusted source
+ * like an RDB file or a RESTORE payload: the header must match the size,
+ * every entry must be inside the allocation and have a matching backlen,
+ * and the element count must be right. Returns 1 if valid, 0 otherwise. */
+int lpValidateIntegrity(unsigned char *lp, size_t size) {
+    if (size < LP_HDR_SIZE+1) return 0;
+    if (lpGetTotalBytes(lp) != size) return 0;
+    if (lp[size-1] != LP_EOF) return 0;
+
+    unsigned char *p = lp+LP_HDR_SIZE;
+    unsigned char *end = lp+size-1;
+    uint32_t count = 0;
+    while (p < end) {
+        if ((size_t)(end-p) < lpCurrentEncodedSizeBytes(p)) return 0;
+        uint32_t enclen = lpCurrentEncodedSizeUnsafe(p);
+        if (enclen == 0 || p[0] == LP_EOF) return 0;
+        unsigned long backlen = lpEncodeBacklen(NULL,enclen);
+        if ((uint64_t)enclen+backlen > (uint64_t)(end-p)) return 0;
+        if (lpDecodeBacklen(p+enclen+backlen-1) != enclen) return 0;
+        p += enclen+backlen;
+        count++;
+    }
+    if (p != end) return 0;
+
+    uint32_t numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN && numele != count) return 0;
+    return 1;
+}
+
+/* Print the listpack content, used by DEBUG LISTPACK. */
+void lpRepr(unsigned char *lp) {
+    unsigned char *p, *vstr;
+    int64_t vlen;
+    unsigned char intbuf[LP_INTBUF_SIZE];
+    int index = 0;
+
+    printf("{total bytes %d} {num entries %lu}\n",
+           (int)lpBytes(lp), lpLength(lp));
+
+    p = lpFirst(lp);
+    while(p) {
+        uint32_t encoded_size = lpCurrentEncodedSizeUnsafe(p);
+        unsigned long back_len = lpEncodeBacklen(NULL,encoded_size);
+        printf("{\n"
+                "\taddr: 0x%08lx,\n"
+                "\tindex: %2d,\n"
+                "\toffset: %1lu,\n"
+                "\thdr+entrylen+backlen: %2lu,\n"
+                "\thdrlen: %3u,\n"
+                "\tbacklen: %2lu,\n"
+                "\tpayload: %1u\n",
+                (long unsigned)p,
+                index,
+                (unsigned long)(p-lp),
+                encoded_size+back_len,
+                encoded_size-lpCurrentEncodedSizeBytes(p),
+                back_len,
+                encoded_size);
+        printf("\tbytes: ");
+        for (unsigned int i = 0; i < (encoded_size+back_len); i++) {
+            printf("%02x|",p[i]);
+        }
+        printf("\n");
+
+        vstr = lpGet(p,&vlen,intbuf);
+        printf("\t[str]");
+        if (vlen > 40) {
+            if (fwrite(vstr,40,1,stdout) == 0) perror("fwrite");
+            printf("...");
+        } else {
+            if (fwrite(vstr,vlen,1,stdout) == 0) perror("fwrite");
+        }
+        printf("\n}\n");
+        index++;
+        p = lpNext(lp,p);
+    }
+    printf("{end}\n\n");
+}
+
+#ifdef REDIS_TEST
+
+#include <sys/time.h>
+
+#define TEST(name) printf("test — %s\n", name);
+
+static unsigned char *lpTestEntry(unsigned char *lp, long index, char *buf) {
+    int64_t len;
+    unsigned char *p = lpSeek(lp,index);
+    if (!p) return NULL;
+    unsigned char *v = lpGet(p,&len,(unsigned char*)buf);
+    memmove(buf,v,len);
+    buf[len] = '\0';
+    return p;
+}
+
+int listpackTest(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+    unsigned char *lp, *p;
+    char buf[LP_INTBUF_SIZE+64];
+    int64_t vlen;
+    unsigned char *vstr;
+
+    TEST("Integer encodings round trip") {
+        long long values[] = {0,1,127,128,-1,-4096,4095,-4097,4096,
+                              -32768,32767,32768,-32769,
+                              -8388608,8388607,8388608,
+                              -2147483648LL,2147483647LL,2147483648LL,
+                              LLONG_MIN,LLONG_MAX};
+        int n = sizeof(values)/sizeof(values[0]);
+        lp = lpNew(0);
+        for (int j = 0; j < n; j++) lp = lpAppendInteger(lp,values[j]);
+        assert(lpLength(lp) == (unsigned long)n);
+        assert(lpValidateIntegrity(lp,lpBytes(lp)));
+        p = lpFirst(lp);
+        for (int j = 0; j < n; j++) {
+            assert(lpGet(p,&vlen,NULL) == NULL && vlen == values[j]);
+            p = lpNext(lp,p);
+        }
+        assert(p == NULL);
+        /* And backward. */
+        p = lpLast(lp);
+        for (int j = n-1; j >= 0; j--) {
+            assert(lpGet(p,&vlen,NULL) == NULL && vlen == values[j]);
+            p = lpPrev(lp,p);
+        }
+        assert(p == NULL);
+        lpFree(lp);
+    }
+
+    TEST("String encodings and backlen sizes") {
+        size_t sizes[] = {0,1,63,64,127,128,4095,4096,16383,16384,100000};
+        int n = sizeof(sizes)/sizeof(sizes[0]);
+        lp = lpNew(0);
+        for (int j = 0; j < n; j++) {
+            unsigned char *s = zmalloc(sizes[j]+1);
+            memset(s,'a'+j,sizes[j]);
+            lp = lpAppend(lp,s,sizes[j]);
+            zfree(s);
+        }
+        assert(lpValidateIntegrity(lp,lpBytes(lp)));
+        p = lpLast(lp);
+        for (int j = n-1; j >= 0; j--) {
+            vstr = lpGet(p,&vlen,NULL);
+            assert(vstr && (size_t)vlen == sizes[j]);
+            if (vlen) assert(vstr[0] == 'a'+j && vstr[vlen-1] == 'a'+j);
+            p = lpPrev(lp,p);
+        }
+        lpFree(lp);
+    }
+
+    TEST("Insert, replace, delete and seek") {
+        lp = lpNew(0);
+        lp = lpAppend(lp,(unsigned char*)"b",1);
+        lp = lpPrepend(lp,(unsigned char*)"a",1);
+        lp = lpAppend(lp,(unsigned char*)"1024",4);
+        lp = lpAppend(lp,(unsigned char*)"d",1);
+        assert(lpLength(lp) == 4);
+        assert(lpTestEntry(lp,2,buf) && !strcmp(buf,"1024"));
+        assert(lpTestEntry(lp,-1,buf) && !strcmp(buf,"d"));
+        assert(lpSeek(lp,4) == NULL && lpSeek(lp,-5) == NULL);
+
+        p = lpSeek(lp,1);
+        lp = lpInsertString(lp,(unsigned char*)"x",1,p,LP_AFTER,&p);
+        assert(lpCompare(p,(unsigned char*)"x",1));
+        lp = lpReplace(lp,&p,(unsigned char*)"a much longer string",20);
+        assert(lpCompare(p,(unsigned char*)"a much longer string",20));
+        assert(lpTestEntry(lp,3,buf) && !strcmp(buf,"1024"));
+
+        p = lpFind(lp,lpFirst(lp),(unsigned char*)"1024",4,0);
+        assert(p && lpCompare(p,(unsigned char*)"1024",4));
+        assert(lpFind(lp,lpFirst(lp),(unsigned char*)"01024",5,0) == NULL);
+        lp = lpDelete(lp,p,&p);
+        assert(lpCompare(p,(unsigned char*)"d",1));
+        lp = lpDelete(lp,p,&p);
+        assert(p == NULL && lpLength(lp) == 3);
+        assert(lpValidateIntegrity(lp,lpBytes(lp)));
+
+        lp = lpDeleteRange(lp,1,10);
+        assert(lpLength(lp) == 1 && lpBytes(lp) == LP_HDR_SIZE+1+2+1);
+        lpFree(lp);
+    }
+
+    TEST("Find with skip") {
+        lp = lpNew(0);
+        lp = lpAppend(lp,(unsigned char*)"f1",2);
+        lp = lpAppend(lp,(unsigned char*)"f2",2);
+        lp = lpAppend(lp,(unsigned char*)"f2",2);
+        lp = lpAppend(lp,(unsigned char*)"v2",2);
+        p = lpFind(lp,lpFirst(lp),(unsigned char*)"f2",2,1);
+        assert(p == lpSeek(lp,2));
+        assert(lpFind(lp,lpFirst(lp),(unsigned char*)"v2",2,1) == NULL);
+        lpFree(lp);
+    }
+
+    TEST("Find against a linear scan") {
+        /* Mix every encoding, with strings longer than the prefix lpFind()
+         * compares at once and matches close to the end of the listpack. */
+        char *ele[300];
+        int n = sizeof(ele)/sizeof(ele[0]);
+        srand(4321);
+        lp = lpNew(0);
+        for (int j = 0; j < n; j++) {
+            char tmp[5000];
+            int l;
+            switch(rand() % 5) {
+            case 0: l = snprintf(tmp,sizeof(tmp),"%d",rand() % 200 - 100); break;
+            case 1: l = snprintf(tmp,sizeof(tmp),"%lld",
+                                 (long long)rand()*rand()-RAND_MAX); break;
+            case 2: l = snprintf(tmp,sizeof(tmp),"k%d",rand() % 50); break;
+            case 3: l = rand() % 40 + 14;
+                    memset(tmp,'a'+rand()%3,l); tmp[l] = '\0'; break;
+            default: l = rand() % 4500 + 60;
+                     memset(tmp,'x',l); tmp[l-1] = 'a'+rand()%3; tmp[l] = '\0';
+            }
+            lp = lpAppend(lp,(unsigned char*)tmp,l);
+            ele[j] = zstrdup(tmp);
+        }
+        for (int j = 0; j < n; j++) {
+            for (unsigned int skip = 0; skip < 2; skip++) {
+                unsigned char *expected = NULL;
+                int k = 0;
+                for (p = lpFirst(lp); p; p = lpNext(lp,p), k++) {
+                    if (k % (skip+1) == 0 && !strcmp(ele[k],ele[j])) {
+                        expected = p;
+                        break;
+                    }
+                }
+                p = lpFind(lp,lpFirst(lp),(unsigned char*)ele[j],
+                           strlen(ele[j]),skip);
+                assert(p == expected);
+            }
+        }
+        assert(lpFind(lp,lpFirst(lp),(unsigned char*)"missing",7,0) == NULL);
+        assert(lpFind(lp,lpFirst(lp),(unsigned char*)"-100000",7,0) == NULL);
+        for (int j = 0; j < n; j++) zfree(ele[j]);
+        lpFree(lp);
+    }
+
+    TEST("Merge") {
+        unsigned char *a = lpNew(0), *b = lpNew(0);
+        a = lpAppend(a,(unsigned char*)"a1",2);
+        b = lpAppend(b,(unsigned char*)"b1",2);
+        b = lpAppend(b,(unsigned char*)"b2",2);
+        lp = lpMerge(&a,&b);
+        assert(a == NULL && b == lp && lpLength(lp) == 3);
+        assert(lpTestEntry(lp,0,buf) && !strcmp(buf,"a1"));
+        assert(lpTestEntry(lp,2,buf) && !strcmp(buf,"b2"));
+        assert(lpValidateIntegrity(lp,lpBytes(lp)));
+        lpFree(lp);
+    }
+
+    TEST("More than 65535 elements") {
+        lp = lpNew(0);
+        for (long j = 0; j < 70000; j++) lp = lpAppendInteger(lp,j);
+        assert(lpLength(lp) == 70000);
+        assert(lpTestEntry(lp,69999,buf) && !strcmp(buf,"69999"));
+        assert(lpTestEntry(lp,-70000,buf) && !strcmp(buf,"0"));
+        lp = lpDeleteRange(lp,0,5000);
+        assert(lpLength(lp) == 65000);
+        assert(lpTestEntry(lp,0,buf) && !strcmp(buf,"5000"));
+        lpFree(lp);
+    }
+
+    TEST("Stress against an array") {
+        char *ref[512];
+        int len = 0;
+        srand(1234);
+        lp = lpNew(0);
+        for (int iter = 0; iter < 20000; iter++) {
+            int op = rand() % 3;
+            if (op < 2 || len == 0) {
+                if (len == 512) continue;
+                char ele[64];
+                int l;
+                if (rand() % 2) l = snprintf(ele,sizeof(ele),"%lld",
+                                             (long long)rand()-RAND_MAX/2);
+                else l = snprintf(ele,sizeof(ele),"s%d",rand());
+                int pos = rand() % (len+1);
+                if (pos == len) {
+                    lp = lpAppend(lp,(unsigned char*)ele,l);
+                } else {
+                    p = lpSeek(lp,pos);
+                    lp = lpInsertString(lp,(unsigned char*)ele,l,p,LP_BEFORE,NULL);
+                }
+                memmove(ref+pos+1,ref+pos,sizeof(char*)*(len-pos));
+                ref[pos] = zstrdup(ele);
+                len++;
+            } else {
+                int pos = rand() % len;
+                p = lpSeek(lp,pos);
+                lp = lpDelete(lp,p,NULL);
+                zfree(ref[pos]);
+                memmove(ref+pos,ref+pos+1,sizeof(char*)*(len-pos-1));
+                len--;
+            }
+        }
+        assert(lpLength(lp) == (unsigned long)len);
+        assert(lpValidateIntegrity(lp,lpBytes(lp)));
+        for (int j = 0; j < len; j++) {
+            assert(lpTestEntry(lp,j,buf) && !strcmp(buf,ref[j]));
+            zfree(ref[j]);
+        }
+        lpFree(lp);
+    }
+
+    printf("ALL TESTS PASSED!\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,251 @@
+/* LZ4 block format compression, see lz4.h.
+ *
+ * 一个LZ4块由若干个序列组成, 每个序列包含一段字面量和一个匹配:
+ *
+ * A block is a list of sequences, each one made of some literals followed by
+ * a match, that is a copy of previously decompressed data:
+ *
+ * <token> [literals length] <literals> <offset> [match length]
+ *
+ * The high 4 bits of the token are the number of literals, the low 4 bits the
+ * match length minus 4: when a field is 15 the length continues in the
+ * following bytes, each one added to it, until a byte different from 255.
+ * The offset is a 16 bit little endian distance back into the output.
+ * The last sequence has only literals: the last 5 bytes of a block are always
+ * literals, and the last match starts at least 12 bytes before the end.
+ *
+ * The compressor is a single pass greedy matcher with a hash table of the
+ * positions of the last 4 bytes sequences seen, skipping faster and faster
+ * over data that doesn't compress, like the liblz4 fast mode.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "lz4.h"
+
+#define LZ4_MINMATCH 4
+#define LZ4_LASTLITERALS 5
+#define LZ4_MFLIMIT 12
+#define LZ4_MAX_DISTANCE 65535
+#define LZ4_RUN_MASK 15
+#define LZ4_ML_MASK 15
+#define LZ4_HASHLOG 12
+#define LZ4_SKIP_TRIGGER 6
+
+static inline uint32_t lz4Read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v,p,sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz4Hash(uint32_t v) {
+    return (v * 2654435761U) >> (32-LZ4_HASHLOG);
+}
+
+/* Return the number of equal bytes at 'p' and 'm', not going past 'limit'. */
+static inline size_t lz4Count(const unsigned char *p, const unsigned char *m,
+                              const unsigned char *limit)
+{
+    const unsigned char *start = p;
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (limit - p >= 8) {
+        uint64_t a, b;
+
+        memcpy(&a,p,sizeof(a));
+        memcpy(&b,m,sizeof(b));
+        if (a != b) return (p - start) + (__builtin_ctzll(a ^ b) >> 3);
+        p += 8;
+        m += 8;
+    }
+#endif
+    while (p < limit && *p == *m) {
+        p++;
+        m++;
+    }
+    return p - start;
+}
+
+/* Write the continuation bytes of a length. */
+static inline unsigned char *lz4WriteLen(unsigned char *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+int LZ4_compress_default(const char *source, char *dest, int srcSize,
+                         int dstCapacity)
+{
+    const unsigned char *src = (const unsigned char *)source;
+    const unsigned char *ip = src, *anchor = src;
+    const unsigned char *iend = src + srcSize;
+    const unsigned char *mflimit = iend - LZ4_MFLIMIT;
+    const unsigned char *matchlimit = iend - LZ4_LASTLITERALS;
+    unsigned char *op = (unsigned char *)dest;
+    unsigned char *oend = op + dstCapacity;
+    unsigned char *token;
+    uint32_t table[1<<LZ4_HASHLOG];
+    size_t lastrun;
+
+    if (srcSize < 0 || srcSize > LZ4_MAX_INPUT_SIZE || dstCapacity <= 0)
+        return 0;
+    /* Too short to contain a match: only literals. */
+    if (srcSize < LZ4_MFLIMIT+1) goto last_literals;
+
+    memset(table,0,sizeof(table));
+    ip++;
+    while (1) {
+        const unsigned char *ref;
+        unsigned searches = 1 << LZ4_SKIP_TRIGGER;
+        size_t litlen, mlen, offset;
+
+        /* Find a match, moving forward faster the more we fail. */
+        while (1) {
+            uint32_t h = lz4Hash(lz4Read32(ip));
+
+            ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if (ref < ip && ip - ref <= LZ4_MAX_DISTANCE &&
+                lz4Read32(ref) == lz4Read32(ip)) break;
+            ip += searches++ >> LZ4_SKIP_TRIGGER;
+            if (ip >= mflimit) goto last_literals;
+        }
+
+        /* Extend the match backwards over the pending literals. */
+        while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+            ip--;
+            ref--;
+        }
+        litlen = ip - anchor;
+        mlen = lz4Count(ip+LZ4_MINMATCH,ref+LZ4_MINMATCH,matchlimit);
+
+        /* Token, literals with their length, offset, match length. */
+        if ((size_t)(oend - op) <
+            1 + litlen/255 + 1 + litlen + 2 + mlen/255 + 1) return 0;
+        token = op++;
+        if (litlen >= LZ4_RUN_MASK) {
+            *token = LZ4_RUN_MASK << 4;
+            op = lz4WriteLen(op,litlen-LZ4_RUN_MASK);
+        } else {
+            *token = (unsigned char)(litlen << 4);
+        }
+        memcpy(op,anchor,litlen);
+        op += litlen;
+        offset = ip - ref;
+        *op++ = (unsigned char)(offset & 0xff);
+        *op++ = (unsigned char)(offset >> 8);
+        if (mlen >= LZ4_ML_MASK) {
+            *token |= LZ4_ML_MASK;
+            op = lz4WriteLen(op,mlen-LZ4_ML_MASK);
+        } else {
+            *token |= (unsigned char)mlen;
+        }
+
+        ip += LZ4_MINMATCH + mlen;
+        anchor = ip;
+        if (ip >= mflimit) break;
+        table[lz4Hash(lz4Read32(ip-2))] = (uint32_t)(ip - 2 - src);
+    }
+
+last_literals:
+    lastrun = iend - anchor;
+    if ((size_t)(oend - op) < 1 + lastrun/255 + 1 + lastrun) return 0;
+    token = op++;
+    if (lastrun >= LZ4_RUN_MASK) {
+        *token = LZ4_RUN_MASK << 4;
+        op = lz4WriteLen(op,lastrun-LZ4_RUN_MASK);
+    } else {
+        *token = (unsigned char)(lastrun << 4);
+    }
+    memcpy(op,anchor,lastrun);
+    op += lastrun;
+    return (int)(op - (unsigned char *)dest);
+}
+
+/* Copy 'len' bytes in 8 bytes chunks, writing up to 7 bytes past them. The
+ * source may overlap the destination if it is at least 8 bytes before it. */
+static inline void lz4WildCopy(unsigned char *dst, const unsigned char *src,
+                               size_t len)
+{
+    unsigned char *end = dst + len;
+
+    while (dst < end) {
+        memcpy(dst,src,8);
+        dst += 8;
+        src += 8;
+    }
+}
+
+int LZ4_decompress_safe(const char *source, char *dest, int compressedSize,
+                        int dstCapacity)
+{
+    const unsigned char *ip = (const unsigned char *)source;
+    const unsigned char *iend = ip + compressedSize;
+    unsigned char *op = (unsigned char *)dest;
+    unsigned char *oend = op + dstCapacity;
+
+    if (compressedSize <= 0 || dstCapacity < 0) return -1;
+    while (1) {
+        unsigned token, s;
+        size_t length, offset;
+        const unsigned char *match;
+
+        /* A block always ends with literals. */
+        if (ip >= iend) return -1;
+        token = *ip++;
+
+        length = token >> 4;
+        if (length == LZ4_RUN_MASK) {
+            do {
+                if (ip >= iend) return -1;
+                s = *ip++;
+                length += s;
+            } while (s == 255);
+        }
+        if (length > (size_t)(iend - ip) || length > (size_t)(oend - op))
+            return -1;
+        if ((size_t)(iend - ip) >= length + 16 &&
+            (size_t)(oend - op) >= length + 16)
+        {
+            lz4WildCopy(op,ip,length);
+        } else {
+            memcpy(op,ip,length);
+        }
+        op += length;
+        ip += length;
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (unsigned char *)dest))
+            return -1;
+        match = op - offset;
+
+        length = token & LZ4_ML_MASK;
+        if (length == LZ4_ML_MASK) {
+            do {
+                if (ip >= iend) return -1;
+                s = *ip++;
+                length += s;
+            } while (s == 255);
+        }
+        length += LZ4_MINMATCH;
+        if (length > (size_t)(oend - op)) return -1;
+        if (offset >= 8 && (size_t)(oend - op) >= length + 8) {
+            lz4WildCopy(op,match,length);
+            op += length;
+        } else if (offset >= length) {
+            memcpy(op,match,length);
+            op += length;
+        } else {
+            /* Overlapping copy: repeats the last 'offset' bytes. */
+            while (length--) *op++ = *match++;
+        }
+    }
+    return (int)(op - (unsigned char *)dest);
+}
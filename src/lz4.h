@@ -0,0 +1,36 @@
+/* LZ4 block format compression.
+ *
+ * LZ4 块格式的压缩和解压. 压缩结果可以被参考实现(liblz4)的 LZ4_decompress_safe()
+ * 解压, 反之亦然.
+ *
+ * A small, self contained implementation of the LZ4 block format, with the
+ * same signatures of the two liblz4 functions Redis needs: blocks produced
+ * here can be decoded by the reference implementation and the other way
+ * around. It favours decompression speed over ratio, which is what it is
+ * used for in Redis (see codec.c).
+ */
+
+#ifndef __LZ4_H
+#define __LZ4_H
+
+/* Largest input accepted by LZ4_compress_default(), like in liblz4. */
+#define LZ4_MAX_INPUT_SIZE 0x7E000000
+
+/* Worst case size of the compressed output of 'isize' bytes. */
+#define LZ4_COMPRESSBOUND(isize) \
+    ((unsigned)(isize) > (unsigned)LZ4_MAX_INPUT_SIZE ? 0 : \
+     (isize) + ((isize)/255) + 16)
+
+/* Compress 'srcSize' bytes from 'src' into 'dst'. Returns the number of
+ * bytes written, or 0 if the result doesn't fit in 'dstCapacity' bytes. */
+int LZ4_compress_default(const char *src, char *dst, int srcSize,
+                         int dstCapacity);
+
+/* Decompress the 'compressedSize' bytes block at 'src' into 'dst'. Returns
+ * the number of bytes decompressed, or a negative value if the block is
+ * malformed or doesn't fit in 'dstCapacity' bytes. Never reads or writes
+ * outside of the given buffers. */
+int LZ4_decompress_safe(const char *src, char *dst, int compressedSize,
+                        int dstCapacity);
+
+#endif
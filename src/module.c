@@ -144,6 +144,8 @@ struct RedisModuleKey {
     uint32_t zstart;        /* Start pos for positional ranges. */
     uint32_t zend;          /* End pos for positional ranges. */
     void *zcurrent;         /* Zset iterator current node. */
+    zbtCursor zcursor;      /* Current entry of B+tree encoded zsets,
+                               zcurrent points here when valid. */
     int zer;                /* Zset iterator end reached flag
                                (true if end was reached). */
 };
@@ -349,11 +351,11 @@ int moduleCreateEmptyKey(RedisModuleKey *key, int type) {
     switch(type) {
     case REDISMODULE_KEYTYPE_LIST:
         obj = createQuicklistObject();
-        quicklistSetOptions(obj->ptr, server.list_max_ziplist_size,
+        quicklistSetOptions(obj->ptr, server.list_max_listpack_size,
                             server.list_compress_depth);
         break;
     case REDISMODULE_KEYTYPE_ZSET:
-        obj = createZsetZiplistObject();
+        obj = createZsetListpackObject();
         break;
     case REDISMODULE_KEYTYPE_HASH:
         obj = createHashObject();
@@ -639,6 +641,8 @@ int RM_CreateCommand(RedisModuleCtx *ctx, const char *name, RedisModuleCmdFunc c
     cp->rediscmd->keystep = keystep;
     cp->rediscmd->microseconds = 0;
     cp->rediscmd->calls = 0;
+    cp->rediscmd->latency_histogram = NULL;
+    cp->rediscmd->queue_microseconds = 0;
     dictAdd(server.commands,sdsdup(cmdname),cp->rediscmd);
     dictAdd(server.orig_commands,sdsdup(cmdname),cp->rediscmd);
     return REDISMODULE_OK;
@@ -1836,14 +1840,14 @@ int zsetInitScoreRange(RedisModuleKey *key, double min, double max, int minex, i
     zrs->minex = minex;
     zrs->maxex = maxex;
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         key->zcurrent = first ? zzlFirstInRange(key->value->ptr,zrs) :
                                 zzlLastInRange(key->value->ptr,zrs);
-    } else if (key->value->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = key->value->ptr;
-        zskiplist *zsl = zs->zsl;
-        key->zcurrent = first ? zslFirstInRange(zsl,zrs) :
-                                zslLastInRange(zsl,zrs);
+        int found = first ? zbtFirstInRange(zs->zbt,zrs,&key->zcursor) :
+                            zbtLastInRange(zs->zbt,zrs,&key->zcursor);
+        key->zcurrent = found ? &key->zcursor : NULL;
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -1900,14 +1904,14 @@ int zsetInitLexRange(RedisModuleKey *key, RedisModuleString *min, RedisModuleStr
      * otherwise we don't want the zlexrangespec to be freed. */
     key->ztype = REDISMODULE_ZSET_RANGE_LEX;
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         key->zcurrent = first ? zzlFirstInLexRange(key->value->ptr,zlrs) :
                                 zzlLastInLexRange(key->value->ptr,zlrs);
-    } else if (key->value->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = key->value->ptr;
-        zskiplist *zsl = zs->zsl;
-        key->zcurrent = first ? zslFirstInLexRange(zsl,zlrs) :
-                                zslLastInLexRange(zsl,zlrs);
+        int found = first ? zbtFirstInLexRange(zs->zbt,zlrs,&key->zcursor) :
+                            zbtLastInLexRange(zs->zbt,zlrs,&key->zcursor);
+        key->zcurrent = found ? &key->zcursor : NULL;
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -1945,19 +1949,19 @@ RedisModuleString *RM_ZsetRangeCurrentElement(RedisModuleKey *key, double *score
     RedisModuleString *str;
 
     if (key->zcurrent == NULL) return NULL;
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *eptr, *sptr;
         eptr = key->zcurrent;
-        sds ele = ziplistGetObject(eptr);
+        sds ele = lpGetObject(eptr);
         if (score) {
-            sptr = ziplistNext(key->value->ptr,eptr);
+            sptr = lpNext(key->value->ptr,eptr);
             *score = zzlGetScore(sptr);
         }
         str = createObject(OBJ_STRING,ele);
-    } else if (key->value->encoding == OBJ_ENCODING_SKIPLIST) {
-        zskiplistNode *ln = key->zcurrent;
-        if (score) *score = ln->score;
-        str = createStringObject(ln->ele,sdslen(ln->ele));
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtEntry *e = zbtCursorEntry(&key->zcursor);
+        if (score) *score = e->score;
+        str = createStringObject(e->ele,sdslen(e->ele));
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -1971,12 +1975,12 @@ RedisModuleString *RM_ZsetRangeCurrentElement(RedisModuleKey *key, double *score
 int RM_ZsetRangeNext(RedisModuleKey *key) {
     if (!key->ztype || !key->zcurrent) return 0; /* No active iterator. */
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = key->value->ptr;
         unsigned char *eptr = key->zcurrent;
         unsigned char *next;
-        next = ziplistNext(zl,eptr); /* Skip element. */
-        if (next) next = ziplistNext(zl,next); /* Skip score. */
+        next = lpNext(zl,eptr); /* Skip element. */
+        if (next) next = lpNext(zl,next); /* Skip score. */
         if (next == NULL) {
             key->zer = 1;
             return 0;
@@ -1986,7 +1990,7 @@ int RM_ZsetRangeNext(RedisModuleKey *key) {
                 /* Fetch the next element score for the
                  * range check. */
                 unsigned char *saved_next = next;
-                next = ziplistNext(zl,next); /* Skip next element. */
+                next = lpNext(zl,next); /* Skip next element. */
                 double score = zzlGetScore(next); /* Obtain the next score. */
                 if (!zslValueLteMax(score,&key->zrs)) {
                     key->zer = 1;
@@ -2002,25 +2006,26 @@ int RM_ZsetRangeNext(RedisModuleKey *key) {
             key->zcurrent = next;
             return 1;
         }
-    } else if (key->value->encoding == OBJ_ENCODING_SKIPLIST) {
-        zskiplistNode *ln = key->zcurrent, *next = ln->level[0].forward;
-        if (next == NULL) {
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtCursor next = key->zcursor;
+        if (!zbtNext(&next)) {
             key->zer = 1;
             return 0;
         } else {
+            zbtEntry *e = zbtCursorEntry(&next);
             /* Are we still within the range? */
             if (key->ztype == REDISMODULE_ZSET_RANGE_SCORE &&
-                !zslValueLteMax(next->score,&key->zrs))
+                !zslValueLteMax(e->score,&key->zrs))
             {
                 key->zer = 1;
                 return 0;
             } else if (key->ztype == REDISMODULE_ZSET_RANGE_LEX) {
-                if (!zslLexValueLteMax(next->ele,&key->zlrs)) {
+                if (!zslLexValueLteMax(e->ele,&key->zlrs)) {
                     key->zer = 1;
                     return 0;
                 }
             }
-            key->zcurrent = next;
+            key->zcursor = next;
             return 1;
         }
     } else {
@@ -2034,12 +2039,12 @@ int RM_ZsetRangeNext(RedisModuleKey *key) {
 int RM_ZsetRangePrev(RedisModuleKey *key) {
     if (!key->ztype || !key->zcurrent) return 0; /* No active iterator. */
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = key->value->ptr;
         unsigned char *eptr = key->zcurrent;
         unsigned char *prev;
-        prev = ziplistPrev(zl,eptr); /* Go back to previous score. */
-        if (prev) prev = ziplistPrev(zl,prev); /* Back to previous ele. */
+        prev = lpPrev(zl,eptr); /* Go back to previous score. */
+        if (prev) prev = lpPrev(zl,prev); /* Back to previous ele. */
         if (prev == NULL) {
             key->zer = 1;
             return 0;
@@ -2049,7 +2054,7 @@ int RM_ZsetRangePrev(RedisModuleKey *key) {
                 /* Fetch the previous element score for the
                  * range check. */
                 unsigned char *saved_prev = prev;
-                prev = ziplistNext(zl,prev); /* Skip element to get the score.*/
+                prev = lpNext(zl,prev); /* Skip element to get the score.*/
                 double score = zzlGetScore(prev); /* Obtain the prev score. */
                 if (!zslValueGteMin(score,&key->zrs)) {
                     key->zer = 1;
@@ -2065,25 +2070,26 @@ int RM_ZsetRangePrev(RedisModuleKey *key) {
             key->zcurrent = prev;
             return 1;
         }
-    } else if (key->value->encoding == OBJ_ENCODING_SKIPLIST) {
-        zskiplistNode *ln = key->zcurrent, *prev = ln->backward;
-        if (prev == NULL) {
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtCursor prev = key->zcursor;
+        if (!zbtPrev(&prev)) {
             key->zer = 1;
             return 0;
         } else {
+            zbtEntry *e = zbtCursorEntry(&prev);
             /* Are we still within the range? */
             if (key->ztype == REDISMODULE_ZSET_RANGE_SCORE &&
-                !zslValueGteMin(prev->score,&key->zrs))
+                !zslValueGteMin(e->score,&key->zrs))
             {
                 key->zer = 1;
                 return 0;
             } else if (key->ztype == REDISMODULE_ZSET_RANGE_LEX) {
-                if (!zslLexValueGteMin(prev->ele,&key->zlrs)) {
+                if (!zslLexValueGteMin(e->ele,&key->zlrs)) {
                     key->zer = 1;
                     return 0;
                 }
             }
-            key->zcurrent = prev;
+            key->zcursor = prev;
             return 1;
         }
     } else {
@@ -2660,9 +2666,9 @@ RedisModuleCallReply *RM_Call(RedisModuleCtx *ctx, const char *cmdname, const ch
     sds proto = sdsnewlen(c->buf,c->bufpos);
     c->bufpos = 0;
     while(listLength(c->reply)) {
-        sds o = listNodeValue(listFirst(c->reply));
+        robj *o = listNodeValue(listFirst(c->reply));
 
-        proto = sdscatsds(proto,o);
+        proto = sdscatsds(proto,o->ptr);
         listDelNode(c->reply,listFirst(c->reply));
     }
     reply = moduleCreateCallReplyFromProto(ctx,proto);
@@ -3669,6 +3675,132 @@ void moduleReleaseGIL(void) {
     pthread_mutex_unlock(&moduleGIL);
 }
 
+/* --------------------------------------------------------------------------
+ * Modules Timers API
+ *
+ * Module timers are one shot time events of the Redis event loop, so that
+ * modules can schedule work in the main thread without running their own
+ * timer threads. The callback is called with a context whose selected
+ * database is the one selected when the timer was created.
+ * -------------------------------------------------------------------------- */
+
+typedef void (*RedisModuleTimerProc)(RedisModuleCtx *ctx, void *data);
+
+/* The structure representing a module timer. */
+typedef struct RedisModuleTimer {
+    RedisModule *module;            /* Module owning the timer. */
+    RedisModuleTimerProc callback;  /* Callback to call on expire. */
+    void *data;                     /* Private data for the callback. */
+    int dbid;                       /* Database number selected by the
+                                       original client. */
+    mstime_t expire;                /* Unix time in milliseconds. */
+    aeTimeEvent *te;                /* Time event, to stop the timer without
+                                       searching the timers heap. */
+} RedisModuleTimer;
+
+/* Timer ID -> RedisModuleTimer. The key is the 64 bit ID of the time event
+ * in native byte order. */
+static rax *Timers;
+
+/* Fake client used as the context client of timer callbacks. */
+static client *moduleTimerClient;
+
+/* Time event handler of module timers. */
+int moduleTimerHandler(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    RedisModuleTimer *timer = clientData;
+    RedisModuleCtx ctx = REDISMODULE_CTX_INIT;
+    uint64_t key = id;
+    UNUSED(eventLoop);
+
+    raxRemove(Timers,(unsigned char*)&key,sizeof(key),NULL);
+    if (moduleTimerClient == NULL) moduleTimerClient = createClient(-1);
+    ctx.module = timer->module;
+    ctx.client = moduleTimerClient;
+    selectDb(ctx.client,timer->dbid);
+    timer->callback(&ctx,timer->data);
+    moduleFreeContext(&ctx);
+    zfree(timer);
+    return AE_NOMORE;
+}
+
+/* Create a new timer that will fire after `period` milliseconds, and will call
+ * the specified function using `data` as argument. The returned timer ID can be
+ * used to get information from the timer or to stop it before it fires.
+ *
+ * The callback has the following prototype:
+ *
+ *     void callback(RedisModuleCtx *ctx, void *data);
+ *
+ * Timers are one shot: to run something periodically, create a new timer
+ * from the callback. */
+RedisModuleTimerID RM_CreateTimer(RedisModuleCtx *ctx, mstime_t period, RedisModuleTimerProc callback, void *data) {
+    RedisModuleTimer *timer = zmalloc(sizeof(*timer));
+    uint64_t key;
+
+    if (period < 0) period = 0;
+    timer->module = ctx->module;
+    timer->callback = callback;
+    timer->data = data;
+    timer->dbid = ctx->client ? ctx->client->db->id : 0;
+    timer->expire = mstime()+period;
+    timer->te = aeCreateTimeEventRef(server.el,period,moduleTimerHandler,
+                                     timer,NULL);
+    key = timer->te->id;
+    raxInsert(Timers,(unsigned char*)&key,sizeof(key),timer,NULL);
+    return key;
+}
+
+/* Stop a timer, returns REDISMODULE_OK if the timer was found, belonged to the
+ * calling module, and was stopped, otherwise REDISMODULE_ERR is returned.
+ * If not NULL, the data pointer is set to the value of the data argument when
+ * the timer was created. */
+int RM_StopTimer(RedisModuleCtx *ctx, RedisModuleTimerID id, void **data) {
+    RedisModuleTimer *timer = raxFind(Timers,(unsigned char*)&id,sizeof(id));
+    if (timer == raxNotFound || timer->module != ctx->module)
+        return REDISMODULE_ERR;
+    if (data) *data = timer->data;
+    aeDeleteTimeEventRef(server.el,timer->te);
+    raxRemove(Timers,(unsigned char*)&id,sizeof(id),NULL);
+    zfree(timer);
+    return REDISMODULE_OK;
+}
+
+/* Obtain information about a timer: its remaining time before firing
+ * (in milliseconds), and the private data pointer associated with the timer.
+ * If the timer specified does not exist or belongs to a different module
+ * no information is returned and the function returns REDISMODULE_ERR, otherwise
+ * REDISMODULE_OK is returned. The arguments remaining or data can be NULL if
+ * the caller does not need certain information. */
+int RM_GetTimerInfo(RedisModuleCtx *ctx, RedisModuleTimerID id, uint64_t *remaining, void **data) {
+    RedisModuleTimer *timer = raxFind(Timers,(unsigned char*)&id,sizeof(id));
+    if (timer == raxNotFound || timer->module != ctx->module)
+        return REDISMODULE_ERR;
+    if (remaining) {
+        mstime_t rem = timer->expire - mstime();
+        *remaining = rem < 0 ? 0 : rem;
+    }
+    if (data) *data = timer->data;
+    return REDISMODULE_OK;
+}
+
+/* Return true if the module has timers that did not fire yet. */
+int moduleHasTimers(RedisModule *module) {
+    raxIterator ri;
+    int found = 0;
+
+    raxStart(&ri,Timers);
+    raxSeek(&ri,"^",NULL,0);
+    while (raxNext(&ri)) {
+        RedisModuleTimer *timer = ri.data;
+        if (timer->module == module) {
+            found = 1;
+            break;
+        }
+    }
+    raxStop(&ri);
+    return found;
+}
+
 /* --------------------------------------------------------------------------
  * Modules API internals
  * -------------------------------------------------------------------------- */
@@ -3706,6 +3838,7 @@ void moduleRegisterCoreAPI(void);
 
 void moduleInitModulesSystem(void) {
     moduleUnblockedClients = listCreate();
+    Timers = raxNew();
 
     server.loadmodule_queue = listCreate();
     modules = dictCreate(&modulesDictType,NULL);
@@ -3773,6 +3906,7 @@ void moduleUnregisterCommands(struct RedisModule *module) {
                 dictDelete(server.commands,cmdname);
                 dictDelete(server.orig_commands,cmdname);
                 sdsfree(cmdname);
+                zfree(cp->rediscmd->latency_histogram);
                 zfree(cp->rediscmd);
                 zfree(cp);
             }
@@ -3824,7 +3958,8 @@ int moduleLoad(const char *path, void **module_argv, int module_argc) {
  * to the following values depending on the type of error:
  *
  * * ENONET: No such module having the specified name.
- * * EBUSY: The module exports a new data type and can only be reloaded. */
+ * * EBUSY: The module exports a new data type and can only be reloaded,
+ *          or it has timers that did not fire yet. */
 int moduleUnload(sds name) {
     struct RedisModule *module = dictFetchValue(modules,name);
 
@@ -3833,7 +3968,7 @@ int moduleUnload(sds name) {
         return REDISMODULE_ERR;
     }
 
-    if (listLength(module->types)) {
+    if (listLength(module->types) || moduleHasTimers(module)) {
         errno = EBUSY;
         return REDISMODULE_ERR;
     }
@@ -3889,7 +4024,7 @@ void moduleCommand(client *c) {
                 errmsg = "no such module with that name";
                 break;
             case EBUSY:
-                errmsg = "the module exports one or more module-side data types, can't unload";
+                errmsg = "the module exports one or more module-side data types or has pending timers, can't unload";
                 break;
             default:
                 errmsg = "operation not possible.";
@@ -4034,6 +4169,9 @@ void moduleRegisterCoreAPI(void) {
     REGISTER_API(FreeThreadSafeContext);
     REGISTER_API(ThreadSafeContextLock);
     REGISTER_API(ThreadSafeContextUnlock);
+    REGISTER_API(CreateTimer);
+    REGISTER_API(StopTimer);
+    REGISTER_API(GetTimerInfo);
     REGISTER_API(DigestAddStringBuffer);
     REGISTER_API(DigestAddLongLong);
     REGISTER_API(DigestEndSequence);
@@ -34,6 +34,19 @@
 #include <ctype.h>
 
 static void setProtocolError(const char *errstr, client *c, long pos);
+int postponeClientRead(client *c);
+
+/* Operation the I/O threads are currently performing, see the
+ * "Threaded I/O" section at the end of this file. */
+#define IO_THREADS_OP_IDLE 0
+#define IO_THREADS_OP_READ 1
+#define IO_THREADS_OP_WRITE 2
+static int io_threads_op = IO_THREADS_OP_IDLE;
+
+/* Set to 1 while processEventsWhileBlocked() is running: in this context
+ * we can't postpone reads to the I/O threads, since beforeSleep() is not
+ * going to be called. */
+static int ProcessingEventsWhileBlocked = 0;
 
 /* Return the size consumed from the allocator, for the specified SDS string,
  * including internal fragmentation. This function is used in order to compute
@@ -54,13 +67,200 @@ size_t getStringObjectSdsUsedMemory(robj *o) {
     }
 }
 
-/* Client.reply list dup and free methods. */
+/* -----------------------------------------------------------------------------
+ * Pool of client buffers
+ *
+ * 客户端的回复缓冲区和查询缓冲区只在需要时分配, 用完后归还到这个池中,
+ * 供其他客户端复用, 这样空闲的连接只占用client结构本身的内存.
+ *
+ * Clients hold a reply buffer and a query buffer only while there is
+ * something to send or to parse: once drained, the buffers go back to this
+ * pool to be reused by other clients, so that idle connections just cost
+ * the client structure. Reply buffers come in power of two sizes from
+ * PROTO_REPLY_MIN_BYTES to PROTO_REPLY_CHUNK_BYTES, picked after the recent
+ * replies of the client. Query buffers are sds strings with room for a
+ * PROTO_IOBUF_LEN read.
+ *
+ * The pool is only accessed by the main thread, outside of threaded I/O
+ * rounds, see clientBufPoolUsable(). Every second the buffers that stayed
+ * unused in the pool for the whole period are freed, see clientBufPoolTrim().
+ * -------------------------------------------------------------------------- */
+
+#define CLIENT_BUF_REPLY_CLASSES 5 /* 1k, 2k, 4k, 8k, 16k. */
+#define CLIENT_BUF_QUERY_CLASS CLIENT_BUF_REPLY_CLASSES
+#define CLIENT_BUF_CLASSES (CLIENT_BUF_REPLY_CLASSES+1)
+#define CLIENT_BUF_POOL_SIZE 256 /* Max buffers kept for every class. */
+
+typedef struct clientBufPool {
+    void *bufs[CLIENT_BUF_POOL_SIZE];
+    int count;
+    int lowest;     /* Lowest count since the last clientBufPoolTrim(). */
+} clientBufPool;
+
+static clientBufPool client_buf_pool[CLIENT_BUF_CLASSES];
+static size_t client_buf_pool_bytes = 0;
+
+/* The pool is not protected by a lock: only the main thread can use it, and
+ * only when I/O threads are not running. Other threads, that is I/O threads
+ * replying to protocol errors and module threads replying to or freeing the
+ * fake clients of thread safe contexts (even without holding the GIL), just
+ * allocate and free their buffers. */
+static int clientBufPoolUsable(void) {
+    return io_threads_op == IO_THREADS_OP_IDLE &&
+           pthread_equal(pthread_self(),server.main_thread_id);
+}
+
+static void *clientBufPoolPop(int class) {
+    clientBufPool *pool = client_buf_pool+class;
+
+    if (pool->count == 0) return NULL;
+    pool->count--;
+    if (pool->count < pool->lowest) pool->lowest = pool->count;
+    return pool->bufs[pool->count];
+}
+
+/* Return 0 if the pool is full and the caller should free the buffer. */
+static int clientBufPoolPush(int class, void *buf) {
+    clientBufPool *pool = client_buf_pool+class;
+
+    if (pool->count == CLIENT_BUF_POOL_SIZE) return 0;
+    pool->bufs[pool->count++] = buf;
+    return 1;
+}
+
+/* Return the class of the smallest reply buffer that can hold 'size'
+ * bytes, or of the biggest one. */
+static int clientReplyBufClass(size_t size) {
+    int class = 0;
+
+    while (class < CLIENT_BUF_REPLY_CLASSES-1 &&
+           ((size_t)PROTO_REPLY_MIN_BYTES << class) < size) class++;
+    return class;
+}
+
+/* Give the client a reply buffer, big enough for its recent replies and,
+ * if possible, for 'len' more bytes. */
+static void clientGetReplyBuffer(client *c, size_t len) {
+    int class = clientReplyBufClass(c->buf_peak > len ? c->buf_peak : len);
+    size_t size = (size_t)PROTO_REPLY_MIN_BYTES << class;
+
+    c->buf = NULL;
+    if (clientBufPoolUsable()) c->buf = clientBufPoolPop(class);
+    if (c->buf)
+        client_buf_pool_bytes -= size;
+    else
+        c->buf = zmalloc(size);
+    c->buf_usable_size = size;
+}
+
+static void clientReleaseReplyBuffer(client *c) {
+    if (c->buf == NULL) return;
+    if (clientBufPoolUsable() &&
+        clientBufPoolPush(clientReplyBufClass(c->buf_usable_size),c->buf))
+        client_buf_pool_bytes += c->buf_usable_size;
+    else
+        zfree(c->buf);
+    c->buf = NULL;
+    c->buf_usable_size = 0;
+    c->bufpos = 0;
+}
+
+/* Return an empty query buffer with room for a PROTO_IOBUF_LEN read. */
+static sds clientGetQueryBuffer(void) {
+    sds s = NULL;
+
+    if (clientBufPoolUsable())
+        s = clientBufPoolPop(CLIENT_BUF_QUERY_CLASS);
+    if (s) {
+        client_buf_pool_bytes -= sdsAllocSize(s);
+    } else {
+        s = sdsnewlen(NULL,PROTO_IOBUF_LEN);
+        sdsclear(s);
+    }
+    return s;
+}
+
+static void clientReleaseQueryBuffer(client *c) {
+    size_t size = sdsAllocSize(c->querybuf);
+
+    /* Only buffers of the usual size are worth keeping. */
+    if (clientBufPoolUsable() &&
+        sdsalloc(c->querybuf) >= PROTO_IOBUF_LEN &&
+        sdsalloc(c->querybuf) <= PROTO_IOBUF_LEN*2 &&
+        clientBufPoolPush(CLIENT_BUF_QUERY_CLASS,c->querybuf))
+    {
+        sdsclear(c->querybuf);
+        client_buf_pool_bytes += size;
+    } else {
+        sdsfree(c->querybuf);
+    }
+    c->querybuf = NULL;
+}
+
+/* Return to the pool the buffers the client is not using. Main thread only.
+ *
+ * The query buffer of masters is kept: it is needed to compute the applied
+ * replication offset. The query buffer is also kept in the middle of a
+ * multi bulk request, since it may be sized for a big argument. */
+void releaseClientBuffersIfIdle(client *c) {
+    if (c->buf && c->bufpos == 0) clientReleaseReplyBuffer(c);
+    if (c->querybuf && sdslen(c->querybuf) == 0 && c->multibulklen == 0 &&
+        !(c->flags & (CLIENT_MASTER|CLIENT_PENDING_READ)))
+    {
+        clientReleaseQueryBuffer(c);
+    }
+}
+
+/* Free the pooled buffers that were not used since the last call, that is
+ * the lowest number of free buffers seen in the meantime. Called every
+ * second by serverCron(), so that the pool follows the load. */
+void clientBufPoolTrim(void) {
+    int class;
+
+    for (class = 0; class < CLIENT_BUF_CLASSES; class++) {
+        clientBufPool *pool = client_buf_pool+class;
+
+        while (pool->lowest > 0) {
+            void *buf = pool->bufs[--pool->count];
+
+            pool->lowest--;
+            if (class == CLIENT_BUF_QUERY_CLASS) {
+                client_buf_pool_bytes -= sdsAllocSize(buf);
+                sdsfree(buf);
+            } else {
+                client_buf_pool_bytes -= (size_t)PROTO_REPLY_MIN_BYTES<<class;
+                zfree(buf);
+            }
+        }
+        pool->lowest = pool->count;
+    }
+}
+
+/* Return the memory used by the buffers waiting in the pool. */
+size_t clientBufPoolMemory(void) {
+    return client_buf_pool_bytes;
+}
+
+/* Client.reply list dup and free methods.
+ *
+ * The reply list is made of RAW string objects. Objects up to
+ * PROTO_REPLY_CHUNK_BYTES are owned by the client, and more protocol can be
+ * appended to the one at the tail. Bigger objects may be shared with the
+ * keyspace or with other clients (see _addReplyObjectToList()), so they are
+ * never modified, only released. */
 void *dupClientReplyValue(void *o) {
-    return sdsdup(o);
+    robj *obj = o;
+
+    if (sdslen(obj->ptr) > PROTO_REPLY_CHUNK_BYTES) {
+        incrRefCount(obj);
+        return obj;
+    }
+    return dupStringObject(obj);
 }
 
 void freeClientReplyValue(void *o) {
-    sdsfree(o);
+    /* NULL is the placeholder of addDeferredMultiBulkLength(). */
+    if (o) decrRefCount(o);
 }
 
 int listMatchObjects(void *a, void *b) {
@@ -96,7 +296,10 @@ client *createClient(int fd) {
     c->fd = fd;
     c->name = NULL;
     c->bufpos = 0;
-    c->querybuf = sdsempty();
+    c->buf_usable_size = 0;
+    c->buf_peak = 0;
+    c->buf = NULL;
+    c->querybuf = NULL;
     c->pending_querybuf = sdsempty();
     c->querybuf_peak = 0;
     c->reqtype = 0;
@@ -108,6 +311,7 @@ client *createClient(int fd) {
     c->sentlen = 0;
     c->flags = 0;
     c->ctime = c->lastinteraction = server.unixtime;
+    c->read_time = c->cmd_read_time = c->queue_delay = 0;
     c->authenticated = 0;
     c->replstate = REPL_STATE_NONE;
     c->repl_put_online_on_ack = 0;
@@ -119,6 +323,7 @@ client *createClient(int fd) {
     c->slave_ip[0] = '\0';
     c->slave_capa = SLAVE_CAPA_NONE;
     c->reply = listCreate();
+    c->reply_unref = NULL;
     c->reply_bytes = 0;
     c->obuf_soft_limit_reached_time = 0;
     listSetFreeMethod(c->reply,freeClientReplyValue);
@@ -141,6 +346,32 @@ client *createClient(int fd) {
     return c;
 }
 
+/* This function puts the client in the queue of clients that should write
+ * their output buffers to the socket. Note that it does not *yet* install
+ * the write handler, to start clients are put in a queue of clients that need
+ * to write, so we try to do that before returning in the event loop (see the
+ * handleClientsWithPendingWrites() function).
+ * If we fail and there is more data to write, compared to what the socket
+ * buffers can hold, then we'll really install the handler. */
+void clientInstallWriteHandler(client *c) {
+    /* Schedule the client to write the output buffers to the socket only
+     * if not already done and, for slaves, if the slave can actually receive
+     * writes at this stage. */
+    if (!(c->flags & CLIENT_PENDING_WRITE) &&
+        (c->replstate == REPL_STATE_NONE ||
+         (c->replstate == SLAVE_STATE_ONLINE && !c->repl_put_online_on_ack)))
+    {
+        /* Here instead of installing the write handler, we just flag the
+         * client and put it into a list of clients that have something
+         * to write to the socket. This way before re-entering the event
+         * loop, we can try to directly write to the client sockets avoiding
+         * a system call. We'll only really install the write handler if
+         * we'll not be able to write the whole reply at once. */
+        c->flags |= CLIENT_PENDING_WRITE;
+        listAddNodeHead(server.clients_pending_write,c);
+    }
+}
+
 /* This function is called every time we are going to transmit new data
  * to the client. The behavior is the following:
  *
@@ -178,24 +409,14 @@ int prepareClientToWrite(client *c) {
 
     if (c->fd <= 0) return C_ERR; /* Fake client for AOF loading. */
 
-    /* Schedule the client to write the output buffers to the socket only
-     * if not already done (there were no pending writes already and the client
-     * was yet not flagged), and, for slaves, if the slave can actually
-     * receive writes at this stage. */
-    if (!clientHasPendingReplies(c) &&
-        !(c->flags & CLIENT_PENDING_WRITE) &&
-        (c->replstate == REPL_STATE_NONE ||
-         (c->replstate == SLAVE_STATE_ONLINE && !c->repl_put_online_on_ack)))
-    {
-        /* Here instead of installing the write handler, we just flag the
-         * client and put it into a list of clients that have something
-         * to write to the socket. This way before re-entering the event
-         * loop, we can try to directly write to the client sockets avoiding
-         * a system call. We'll only really install the write handler if
-         * we'll not be able to write the whole reply at once. */
-        c->flags |= CLIENT_PENDING_WRITE;
-        listAddNodeHead(server.clients_pending_write,c);
-    }
+    /* Schedule the client to write the output buffers to the socket, unless
+     * it should already be setup to do so (it has already pending data).
+     *
+     * If CLIENT_PENDING_READ is set, we're in an I/O thread and should
+     * not touch the shared list of pending writes: the main thread will
+     * install the write handler once the read round is over. */
+    if (!clientHasPendingReplies(c) && !(c->flags & CLIENT_PENDING_READ))
+        clientInstallWriteHandler(c);
 
     /* Authorize the caller to queue in the output buffer of this client. */
     return C_OK;
@@ -206,7 +427,7 @@ int prepareClientToWrite(client *c) {
  * -------------------------------------------------------------------------- */
 
 int _addReplyToBuffer(client *c, const char *s, size_t len) {
-    size_t available = sizeof(c->buf)-c->bufpos;
+    size_t available;
 
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return C_OK;
 
@@ -214,7 +435,15 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
      * add anything more to the static buffer. */
     if (listLength(c->reply) > 0) return C_ERR;
 
+    /* Remember how big the replies are, to size the next buffer. */
+    if (c->buf_peak < c->bufpos+len) c->buf_peak = c->bufpos+len;
+    if (c->buf == NULL) {
+        if (len > PROTO_REPLY_CHUNK_BYTES) return C_ERR;
+        clientGetReplyBuffer(c,len);
+    }
+
     /* Check that the buffer has enough space available for this string. */
+    available = c->buf_usable_size-c->bufpos;
     if (len > available) return C_ERR;
 
     memcpy(c->buf+c->bufpos,s,len);
@@ -222,88 +451,76 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
     return C_OK;
 }
 
-void _addReplyObjectToList(client *c, robj *o) {
-    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
-
-    if (listLength(c->reply) == 0) {
-        sds s = sdsdup(o->ptr);
-        listAddNodeTail(c->reply,s);
-        c->reply_bytes += sdslen(s);
-    } else {
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        /* Append to this object when possible. If tail == NULL it was
-         * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+sdslen(o->ptr) <= PROTO_REPLY_CHUNK_BYTES) {
-            tail = sdscatsds(tail,o->ptr);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += sdslen(o->ptr);
-        } else {
-            sds s = sdsdup(o->ptr);
-            listAddNodeTail(c->reply,s);
-            c->reply_bytes += sdslen(s);
-        }
-    }
-    asyncCloseClientOnOutputBufferLimitReached(c);
+/* Return true if 'len' bytes can be appended to the reply object 'tail'.
+ * If tail == NULL it was set via addDeferredMultiBulkLength(). */
+static int _replyObjectCanAppend(robj *tail, size_t len) {
+    return tail && tail->refcount == 1 &&
+           sdslen(tail->ptr)+len <= PROTO_REPLY_CHUNK_BYTES;
 }
 
 /* This method takes responsibility over the sds. When it is no longer
  * needed it will be free'd, otherwise it ends up in a robj. */
 void _addReplySdsToList(client *c, sds s) {
+    listNode *ln;
+
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
         sdsfree(s);
         return;
     }
 
-    if (listLength(c->reply) == 0) {
-        listAddNodeTail(c->reply,s);
+    ln = listLast(c->reply);
+    if (ln && _replyObjectCanAppend(listNodeValue(ln),sdslen(s))) {
+        robj *tail = listNodeValue(ln);
+
+        tail->ptr = sdscatsds(tail->ptr,s);
         c->reply_bytes += sdslen(s);
+        sdsfree(s);
     } else {
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        /* Append to this object when possible. If tail == NULL it was
-         * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+sdslen(s) <= PROTO_REPLY_CHUNK_BYTES) {
-            tail = sdscatsds(tail,s);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += sdslen(s);
-            sdsfree(s);
-        } else {
-            listAddNodeTail(c->reply,s);
-            c->reply_bytes += sdslen(s);
-        }
+        listAddNodeTail(c->reply,createObject(OBJ_STRING,s));
+        c->reply_bytes += sdslen(s);
     }
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
 void _addReplyStringToList(client *c, const char *s, size_t len) {
+    listNode *ln;
+
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
 
-    if (listLength(c->reply) == 0) {
-        sds node = sdsnewlen(s,len);
-        listAddNodeTail(c->reply,node);
-        c->reply_bytes += len;
+    ln = listLast(c->reply);
+    if (ln && _replyObjectCanAppend(listNodeValue(ln),len)) {
+        robj *tail = listNodeValue(ln);
+
+        tail->ptr = sdscatlen(tail->ptr,s,len);
     } else {
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        /* Append to this object when possible. If tail == NULL it was
-         * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+len <= PROTO_REPLY_CHUNK_BYTES) {
-            tail = sdscatlen(tail,s,len);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += len;
-        } else {
-            sds node = sdsnewlen(s,len);
-            listAddNodeTail(c->reply,node);
-            c->reply_bytes += len;
-        }
+        listAddNodeTail(c->reply,createRawStringObject(s,len));
     }
+    c->reply_bytes += len;
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
+void _addReplyObjectToList(client *c, robj *o) {
+    size_t len = sdslen(o->ptr);
+
+    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+
+    /* Values bigger than a chunk are never glued to the tail anyway: instead
+     * of copying them in a new node, reference the object itself, so that
+     * writeToClient() sends it straight from the keyspace. Shared objects
+     * are small and their refcount never changes, so they are copied. */
+    if (len > PROTO_REPLY_CHUNK_BYTES &&
+        o->encoding == OBJ_ENCODING_RAW &&
+        o->refcount != OBJ_SHARED_REFCOUNT)
+    {
+        incrRefCount(o);
+        listAddNodeTail(c->reply,o);
+        c->reply_bytes += len;
+        asyncCloseClientOnOutputBufferLimitReached(c);
+    } else {
+        _addReplyStringToList(c,o->ptr,len);
+    }
+}
+
 /* -----------------------------------------------------------------------------
  * Higher level functions to queue data on the client output buffer.
  * The following functions are the ones that commands implementations will call.
@@ -326,7 +543,9 @@ void addReply(client *c, robj *obj) {
         /* Optimization: if there is room in the static buffer for 32 bytes
          * (more than the max chars a 64 bit integer can take as string) we
          * avoid decoding the object and go for the lower level approach. */
-        if (listLength(c->reply) == 0 && (sizeof(c->buf) - c->bufpos) >= 32) {
+        if (listLength(c->reply) == 0 && c->buf &&
+            (c->buf_usable_size - c->bufpos) >= 32)
+        {
             char buf[32];
             int len;
 
@@ -432,23 +651,24 @@ void *addDeferredMultiBulkLength(client *c) {
 /* Populate the length object and try gluing it to the next chunk. */
 void setDeferredMultiBulkLength(client *c, void *node, long length) {
     listNode *ln = (listNode*)node;
-    sds len, next;
+    robj *len, *next;
 
     /* Abort when *node is NULL: when the client should not accept writes
      * we return NULL in addDeferredMultiBulkLength() */
     if (node == NULL) return;
 
-    len = sdscatprintf(sdsnewlen("*",1),"%ld\r\n",length);
+    len = createObject(OBJ_STRING,
+                       sdscatprintf(sdsnewlen("*",1),"%ld\r\n",length));
     listNodeValue(ln) = len;
-    c->reply_bytes += sdslen(len);
+    c->reply_bytes += sdslen(len->ptr);
     if (ln->next != NULL) {
         next = listNodeValue(ln->next);
 
-        /* Only glue when the next node is non-NULL (an sds in this case) */
-        if (next != NULL) {
-            len = sdscatsds(len,next);
+        /* Only glue when the next node is non-NULL (an object in this case)
+         * and owned by the client: big shared values are not copied. */
+        if (next != NULL && sdslen(next->ptr) <= PROTO_REPLY_CHUNK_BYTES) {
+            len->ptr = sdscatsds(len->ptr,next->ptr);
             listDelNode(c->reply,ln->next);
-            listNodeValue(ln) = len;
             /* No need to update c->reply_bytes: we are just moving the same
              * amount of bytes from one node to another. */
         }
@@ -591,11 +811,39 @@ void addReplyBulkLongLong(client *c, long long ll) {
 void copyClientOutputBuffer(client *dst, client *src) {
     listRelease(dst->reply);
     dst->reply = listDup(src->reply);
-    memcpy(dst->buf,src->buf,src->bufpos);
+    clientReleaseReplyBuffer(dst);
+    if (src->bufpos) {
+        clientGetReplyBuffer(dst,src->bufpos);
+        memcpy(dst->buf,src->buf,src->bufpos);
+    }
     dst->bufpos = src->bufpos;
     dst->reply_bytes = src->reply_bytes;
 }
 
+/* Replace every reply object shared with the keyspace (or with other
+ * clients) by a private copy. Called before a whole database is handed to
+ * the lazyfree thread, that would otherwise race with the main thread on
+ * the refcount of the values still referenced by the reply lists. */
+void unshareClientsReplyObjects(void) {
+    listIter li, ri;
+    listNode *ln, *rn;
+
+    listRewind(server.clients,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        listRewind(c->reply,&ri);
+        while((rn = listNext(&ri))) {
+            robj *o = listNodeValue(rn);
+
+            if (o && o->refcount > 1) {
+                listNodeValue(rn) = dupStringObject(o);
+                decrRefCount(o);
+            }
+        }
+    }
+}
+
 /* Return true if the specified client has pending reply buffers to write to
  * the socket. */
 int clientHasPendingReplies(client *c) {
@@ -763,6 +1011,14 @@ void unlinkClient(client *c) {
         c->flags &= ~CLIENT_PENDING_WRITE;
     }
 
+    /* Remove from the list of pending reads if needed. */
+    if (c->flags & CLIENT_PENDING_READ) {
+        ln = listSearchKey(server.clients_pending_read,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.clients_pending_read,ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+    }
+
     /* When client was just unblocked because of a blocking operation,
      * remove it from the list of unblocked clients. */
     if (c->flags & CLIENT_UNBLOCKED) {
@@ -820,6 +1076,8 @@ void freeClient(client *c) {
 
     /* Free data structures. */
     listRelease(c->reply);
+    if (c->reply_unref) listRelease(c->reply_unref);
+    clientReleaseReplyBuffer(c);
     freeClientArgv(c);
 
     /* Unlink the client: this will close the socket, remove the I/O
@@ -870,11 +1128,33 @@ void freeClient(client *c) {
 /* Schedule a client to free it at a safe time in the serverCron() function.
  * This function is useful when we need to terminate a client but we are in
  * a context where calling freeClient() is not possible, because the client
- * should be valid for the continuation of the flow of the program. */
+ * should be valid for the continuation of the flow of the program.
+ *
+ * This function may be called by the I/O threads, so when a threaded
+ * read or write round is in progress the queue is protected by a mutex. */
+static pthread_mutex_t async_free_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 void freeClientAsync(client *c) {
     if (c->flags & CLIENT_CLOSE_ASAP || c->flags & CLIENT_LUA) return;
     c->flags |= CLIENT_CLOSE_ASAP;
-    listAddNodeTail(server.clients_to_close,c);
+    if (io_threads_op == IO_THREADS_OP_IDLE) {
+        listAddNodeTail(server.clients_to_close,c);
+    } else {
+        pthread_mutex_lock(&async_free_queue_mutex);
+        listAddNodeTail(server.clients_to_close,c);
+        pthread_mutex_unlock(&async_free_queue_mutex);
+    }
+}
+
+/* Free the client from the read/write handlers. When we are called by an
+ * I/O thread (or by the main thread while it is doing its share of a
+ * threaded round) the client is still referenced by the lists the threads
+ * are iterating, so we can only schedule it for asynchronous freeing. */
+static void freeClientFromIOHandler(client *c) {
+    if (io_threads_op == IO_THREADS_OP_IDLE)
+        freeClient(c);
+    else
+        freeClientAsync(c);
 }
 
 void freeClientsInAsyncFreeQueue(void) {
@@ -888,76 +1168,114 @@ void freeClientsInAsyncFreeQueue(void) {
     }
 }
 
-/* Write data in output buffers to client. Return C_OK if the client
- * is still valid after the call, C_ERR if it was freed. */
-int writeToClient(int fd, client *c, int handler_installed) {
-    ssize_t nwritten = 0, totwritten = 0;
-    size_t objlen;
-    sds o;
+/* Remove the fully sent reply object at the head of the list.
+ *
+ * When called by an I/O thread, other threads may be sending the same
+ * shared object to other clients: the refcount can't be touched here, so
+ * the object is moved in c->reply_unref, and the main thread releases it
+ * after the round, see releaseClientReplyUnref(). If we hold the only
+ * reference nobody else can see the object, and it is freed right away. */
+static void _clientReplyDelHead(client *c) {
+    listNode *ln = listFirst(c->reply);
+    robj *o = listNodeValue(ln);
+
+    c->reply_bytes -= sdslen(o->ptr);
+    if (io_threads_op != IO_THREADS_OP_IDLE && o->refcount > 1) {
+        if (c->reply_unref == NULL) {
+            c->reply_unref = listCreate();
+            listSetFreeMethod(c->reply_unref,decrRefCountVoid);
+        }
+        listAddNodeTail(c->reply_unref,o);
+        listNodeValue(ln) = NULL;
+    }
+    listDelNode(c->reply,ln);
 
-    while(clientHasPendingReplies(c)) {
-        if (c->bufpos > 0) {
-            nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
+    /* If there are no longer objects in the list, we expect
+     * the count of reply bytes to be exactly zero. */
+    if (listLength(c->reply) == 0)
+        serverAssert(c->reply_bytes == 0);
+}
 
-            /* If the buffer was sent, set bufpos to zero to continue with
-             * the remainder of the reply. */
-            if ((int)c->sentlen == c->bufpos) {
-                c->bufpos = 0;
-                c->sentlen = 0;
-            }
-        } else {
-            o = listNodeValue(listFirst(c->reply));
-            objlen = sdslen(o);
+/* Release the shared reply objects sent by an I/O thread. Main thread only. */
+static void releaseClientReplyUnref(client *c) {
+    if (c->reply_unref) listEmpty(c->reply_unref);
+}
 
-            if (objlen == 0) {
-                listDelNode(c->reply,listFirst(c->reply));
-                continue;
-            }
+/* Fill 'iov' with the pending output of the client, the static buffer
+ * first and then the objects of the reply list, up to 'maxcnt' entries or
+ * NET_MAX_WRITES_PER_EVENT bytes. Returns the number of entries, and the
+ * number of bytes by reference. */
+static int _writeToClientPrepare(client *c, struct iovec *iov, int maxcnt,
+                                 size_t *iovbytes)
+{
+    int iovcnt = 0;
+    size_t offset = c->sentlen;
+    listIter li;
+    listNode *ln;
 
-            nwritten = write(fd, o + c->sentlen, objlen - c->sentlen);
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
+    *iovbytes = 0;
+    if (c->bufpos > 0) {
+        iov[iovcnt].iov_base = c->buf+c->sentlen;
+        iov[iovcnt].iov_len = c->bufpos-c->sentlen;
+        *iovbytes += iov[iovcnt++].iov_len;
+        offset = 0;
+    }
+    listRewind(c->reply,&li);
+    while(iovcnt < maxcnt &&
+          *iovbytes < NET_MAX_WRITES_PER_EVENT &&
+          (ln = listNext(&li)) != NULL)
+    {
+        robj *o = listNodeValue(ln);
 
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == objlen) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                c->reply_bytes -= objlen;
-                /* If there are no longer objects in the list, we expect
-                 * the count of reply bytes to be exactly zero. */
-                if (listLength(c->reply) == 0)
-                    serverAssert(c->reply_bytes == 0);
-            }
+        iov[iovcnt].iov_base = (char*)o->ptr+offset;
+        iov[iovcnt].iov_len = sdslen(o->ptr)-offset;
+        *iovbytes += iov[iovcnt++].iov_len;
+        offset = 0;
+    }
+    return iovcnt;
+}
+
+/* Consume 'written' bytes of the client output: the static buffer first,
+ * then the objects on head that were fully sent. Empty objects on head are
+ * removed as well. */
+static void _writeToClientConsume(client *c, size_t written) {
+    if (c->bufpos > 0) {
+        if (written < c->bufpos-c->sentlen) {
+            c->sentlen += written;
+            return;
         }
-        /* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
-         * bytes, in a single threaded server it's a good idea to serve
-         * other clients as well, even if a very large request comes from
-         * super fast link that is always able to accept data (in real world
-         * scenario think about 'KEYS *' against the loopback interface).
-         *
-         * However if we are over the maxmemory limit we ignore that and
-         * just deliver as much data as it is possible to deliver.
-         *
-         * Moreover, we also send as much as possible if the client is
-         * a slave (otherwise, on high-speed traffic, the replication
-         * buffer will grow indefinitely) */
-        if (totwritten > NET_MAX_WRITES_PER_EVENT &&
-            (server.maxmemory == 0 ||
-             zmalloc_used_memory() < server.maxmemory) &&
-            !(c->flags & CLIENT_SLAVE)) break;
+        written -= c->bufpos-c->sentlen;
+        c->bufpos = 0;
+        c->sentlen = 0;
     }
-    server.stat_net_output_bytes += totwritten;
+    while(listLength(c->reply)) {
+        robj *o = listNodeValue(listFirst(c->reply));
+        size_t remaining = sdslen(o->ptr)-c->sentlen;
+
+        if (written < remaining) {
+            c->sentlen += written;
+            break;
+        }
+        written -= remaining;
+        c->sentlen = 0;
+        _clientReplyDelHead(c);
+    }
+}
+
+/* Conclude a write to the client: 'nwritten' is the result of the last
+ * system call (-1 with errno set on error), 'totwritten' the bytes sent in
+ * total. Return C_OK if the client is still valid, C_ERR if it was freed. */
+static int _writeToClientFinish(client *c, ssize_t nwritten,
+                                ssize_t totwritten, int handler_installed)
+{
+    atomicIncr(server.stat_net_output_bytes,totwritten);
     if (nwritten == -1) {
         if (errno == EAGAIN) {
             nwritten = 0;
         } else {
             serverLog(LL_VERBOSE,
                 "Error writing to client: %s", strerror(errno));
-            freeClient(c);
+            freeClientFromIOHandler(c);
             return C_ERR;
         }
     }
@@ -971,16 +1289,60 @@ int writeToClient(int fd, client *c, int handler_installed) {
     if (!clientHasPendingReplies(c)) {
         c->sentlen = 0;
         if (handler_installed) aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
+        if (io_threads_op == IO_THREADS_OP_IDLE) releaseClientBuffersIfIdle(c);
 
         /* Close connection after entire reply has been sent. */
         if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
-            freeClient(c);
+            freeClientFromIOHandler(c);
             return C_ERR;
         }
     }
     return C_OK;
 }
 
+/* Write data in output buffers to client. Return C_OK if the client
+ * is still valid after the call, C_ERR if it was freed.
+ *
+ * The static buffer and the objects of the reply list are sent together
+ * with writev(), so that a pipeline of replies, or a big value referenced
+ * from the keyspace after its bulk length, costs a single system call. */
+int writeToClient(int fd, client *c, int handler_installed) {
+    ssize_t nwritten = 0, totwritten = 0;
+
+    while(clientHasPendingReplies(c)) {
+        struct iovec iov[NET_MAX_WRITEV_IOVCNT];
+        size_t iovbytes;
+        int iovcnt;
+
+        iovcnt = _writeToClientPrepare(c,iov,NET_MAX_WRITEV_IOVCNT,&iovbytes);
+        /* Only empty objects are pending: just remove them below. */
+        if (iovbytes > 0) {
+            nwritten = writev(fd,iov,iovcnt);
+            if (nwritten <= 0) break;
+            totwritten += nwritten;
+        }
+        _writeToClientConsume(c,iovbytes ? (size_t)nwritten : 0);
+
+        /* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
+         * bytes, in a single threaded server it's a good idea to serve
+         * other clients as well, even if a very large request comes from
+         * super fast link that is always able to accept data (in real world
+         * scenario think about 'KEYS *' against the loopback interface).
+         *
+         * However if we are over the maxmemory limit we ignore that and
+         * just deliver as much data as it is possible to deliver.
+         *
+         * Moreover, we also send as much as possible if the client is
+         * a slave (otherwise, on high-speed traffic, the replication
+         * buffer will grow indefinitely) */
+        if (totwritten > NET_MAX_WRITES_PER_EVENT &&
+            (server.maxmemory == 0 ||
+             zmalloc_used_memory() < server.maxmemory) &&
+            !(c->flags & CLIENT_SLAVE)) break;
+    }
+    return _writeToClientFinish(c,nwritten,totwritten,handler_installed);
+}
+
 /* Write event handler. Just send data to the client. */
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     UNUSED(el);
@@ -988,6 +1350,82 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     writeToClient(fd,privdata,1);
 }
 
+/* Send the pending output of all the clients in the pending writes queue
+ * with a single aeBatchIO() call. Clients that accepted everything and have
+ * more to send are served again by writeToClient(), and the write handler
+ * is installed for the clients with output left, like in
+ * handleClientsWithPendingWrites(). Returns C_ERR, without touching the
+ * queue, if the batch could not be run. */
+static int handleClientsWithPendingWritesBatched(void) {
+    static aeIORequest *reqs = NULL;
+    static struct iovec *iov = NULL;
+    static client **clients = NULL;
+    static int allocated = 0;
+    int count = 0, j;
+    listIter li;
+    listNode *ln;
+
+    if (allocated < (int)listLength(server.clients_pending_write)) {
+        allocated = listLength(server.clients_pending_write);
+        reqs = zrealloc(reqs,sizeof(aeIORequest)*allocated);
+        iov = zrealloc(iov,sizeof(struct iovec)*NET_BATCH_IOVCNT*allocated);
+        clients = zrealloc(clients,sizeof(client*)*allocated);
+    }
+
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        size_t iovbytes;
+
+        reqs[count].fd = c->fd;
+        reqs[count].write = 1;
+        reqs[count].iov = iov+count*NET_BATCH_IOVCNT;
+        reqs[count].iovcnt = _writeToClientPrepare(c,reqs[count].iov,
+                                                   NET_BATCH_IOVCNT,&iovbytes);
+        /* Nothing to send: writeToClient() will take care of the client. */
+        if (iovbytes == 0) reqs[count].iovcnt = 0;
+        clients[count++] = c;
+    }
+    if (aeBatchIO(server.el,reqs,count) == AE_ERR) return C_ERR;
+
+    for (j = 0; j < count; j++) {
+        client *c = clients[j];
+        ssize_t nwritten = reqs[j].res;
+        size_t iovbytes = 0;
+        int k;
+
+        c->flags &= ~CLIENT_PENDING_WRITE;
+        if (reqs[j].iovcnt == 0) {
+            if (writeToClient(c->fd,c,0) == C_ERR) continue;
+        } else {
+            for (k = 0; k < reqs[j].iovcnt; k++)
+                iovbytes += reqs[j].iov[k].iov_len;
+            if (nwritten < 0) {
+                errno = -nwritten;
+                nwritten = -1;
+            } else {
+                _writeToClientConsume(c,nwritten);
+            }
+            if (_writeToClientFinish(c,nwritten,nwritten > 0 ? nwritten : 0,
+                                     0) == C_ERR) continue;
+            /* The socket accepted everything: keep going synchronously. */
+            if ((size_t)nwritten == iovbytes && clientHasPendingReplies(c) &&
+                writeToClient(c->fd,c,0) == C_ERR) continue;
+        }
+
+        /* If there is nothing left, do nothing. Otherwise install
+         * the write handler. */
+        if (clientHasPendingReplies(c) &&
+            aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+                sendReplyToClient, c) == AE_ERR)
+        {
+            freeClientAsync(c);
+        }
+    }
+    listEmpty(server.clients_pending_write);
+    return C_OK;
+}
+
 /* This function is called just before entering the event loop, in the hope
  * we can just write the replies to the client output buffer without any
  * need to use a syscall in order to install the writable event handler,
@@ -997,6 +1435,9 @@ int handleClientsWithPendingWrites(void) {
     listNode *ln;
     int processed = listLength(server.clients_pending_write);
 
+    if (processed > 1 && aeCanBatchIO(server.el) &&
+        handleClientsWithPendingWritesBatched() == C_OK) return processed;
+
     listRewind(server.clients_pending_write,&li);
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
@@ -1296,11 +1737,19 @@ int processMultibulkBuffer(client *c) {
  * or because a client was blocked and later reactivated, so there could be
  * pending query buffer, already representing a full command, to process. */
 void processInputBuffer(client *c) {
-    server.current_client = c;
-    /* Keep processing while there is something in the input buffer */
-    while(sdslen(c->querybuf)) {
+    /* When called by an I/O thread we only parse the next command, so we
+     * must not touch any global state here. */
+    int threaded = c->flags & CLIENT_PENDING_READ;
+
+    if (!threaded) server.current_client = c;
+    /* Keep processing while there is something in the input buffer, or a
+     * command already parsed by an I/O thread waiting to be executed. */
+    while((c->querybuf && sdslen(c->querybuf)) ||
+          (c->flags & CLIENT_PENDING_COMMAND))
+    {
         /* Return if clients are paused. */
-        if (!(c->flags & CLIENT_SLAVE) && clientsArePaused()) break;
+        if (!threaded && !(c->flags & CLIENT_SLAVE) && clientsArePaused())
+            break;
 
         /* Immediately abort if the client is in the middle of something. */
         if (c->flags & CLIENT_BLOCKED) break;
@@ -1312,27 +1761,48 @@ void processInputBuffer(client *c) {
          * The same applies for clients we want to terminate ASAP. */
         if (c->flags & (CLIENT_CLOSE_AFTER_REPLY|CLIENT_CLOSE_ASAP)) break;
 
-        /* Determine request type when unknown. */
-        if (!c->reqtype) {
-            if (c->querybuf[0] == '*') {
-                c->reqtype = PROTO_REQ_MULTIBULK;
+        if (c->flags & CLIENT_PENDING_COMMAND) {
+            /* The command was already parsed by an I/O thread. */
+            c->flags &= ~CLIENT_PENDING_COMMAND;
+        } else {
+            /* Determine request type when unknown. */
+            if (!c->reqtype) {
+                if (c->querybuf[0] == '*') {
+                    c->reqtype = PROTO_REQ_MULTIBULK;
+                } else {
+                    c->reqtype = PROTO_REQ_INLINE;
+                }
+            }
+
+            if (c->reqtype == PROTO_REQ_INLINE) {
+                if (processInlineBuffer(c) != C_OK) break;
+            } else if (c->reqtype == PROTO_REQ_MULTIBULK) {
+                if (processMultibulkBuffer(c) != C_OK) break;
             } else {
-                c->reqtype = PROTO_REQ_INLINE;
+                serverPanic("Unknown request type");
             }
-        }
 
-        if (c->reqtype == PROTO_REQ_INLINE) {
-            if (processInlineBuffer(c) != C_OK) break;
-        } else if (c->reqtype == PROTO_REQ_MULTIBULK) {
-            if (processMultibulkBuffer(c) != C_OK) break;
-        } else {
-            serverPanic("Unknown request type");
+            /* A command is complete: it was read at the latest with the
+             * first read that followed the previous command. The next
+             * commands already in the buffer share the same read time. */
+            if (c->read_time) {
+                c->cmd_read_time = c->read_time;
+                c->read_time = 0;
+            }
         }
 
         /* Multibulk processing could see a <= 0 length. */
         if (c->argc == 0) {
             resetClient(c);
         } else {
+            /* If we are in the context of an I/O thread, we can't really
+             * execute the command here. All we can do is to flag the client
+             * as one that needs to process the command. */
+            if (threaded) {
+                c->flags |= CLIENT_PENDING_COMMAND;
+                break;
+            }
+
             /* Only reset the client when the command was executed. */
             if (processCommand(c) == C_OK) {
                 if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI)) {
@@ -1350,20 +1820,24 @@ void processInputBuffer(client *c) {
             /* freeMemoryIfNeeded may flush slave output buffers. This may
              * result into a slave, that may be the active client, to be
              * freed. */
-            if (server.current_client == NULL) break;
+            if (server.current_client == NULL) return;
         }
     }
-    server.current_client = NULL;
+    if (!threaded) {
+        server.current_client = NULL;
+        /* Don't keep the query buffer of idle clients. */
+        if (c->querybuf && sdslen(c->querybuf) == 0)
+            releaseClientBuffersIfIdle(c);
+    }
 }
 
-void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    client *c = (client*) privdata;
-    int nread, readlen;
-    size_t qblen;
-    UNUSED(el);
-    UNUSED(mask);
+/* Make room in the query buffer of the client for the next read. Returns
+ * the number of bytes to read, and the current length of the buffer by
+ * reference. */
+static int _readQueryFromClientPrepare(client *c, size_t *qblen) {
+    int readlen = PROTO_IOBUF_LEN;
 
-    readlen = PROTO_IOBUF_LEN;
+    if (c->querybuf == NULL) c->querybuf = clientGetQueryBuffer();
     /* If this is a multi bulk request, and we are processing a bulk reply
      * that is large enough, try to maximize the probability that the query
      * buffer contains exactly the SDS string representing the object, even
@@ -1378,22 +1852,28 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         if (remaining < readlen) readlen = remaining;
     }
 
-    qblen = sdslen(c->querybuf);
-    if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
+    *qblen = sdslen(c->querybuf);
+    if (c->querybuf_peak < *qblen) c->querybuf_peak = *qblen;
     c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
-    nread = read(fd, c->querybuf+qblen, readlen);
+    return readlen;
+}
+
+/* Account the 'nread' bytes read at offset 'qblen' of the query buffer
+ * (-1 with errno set on error). Return C_OK if there is new data to
+ * process, C_ERR if there is nothing to do or the client was freed. */
+static int _readQueryFromClientDone(client *c, ssize_t nread, size_t qblen) {
     if (nread == -1) {
         if (errno == EAGAIN) {
-            return;
+            return C_ERR;
         } else {
             serverLog(LL_VERBOSE, "Reading from client: %s",strerror(errno));
-            freeClient(c);
-            return;
+            freeClientFromIOHandler(c);
+            return C_ERR;
         }
     } else if (nread == 0) {
         serverLog(LL_VERBOSE, "Client closed connection");
-        freeClient(c);
-        return;
+        freeClientFromIOHandler(c);
+        return C_ERR;
     } else if (c->flags & CLIENT_MASTER) {
         /* Append the query buffer to the pending (not applied) buffer
          * of the master. We'll use this buffer later in order to have a
@@ -1404,8 +1884,9 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
 
     sdsIncrLen(c->querybuf,nread);
     c->lastinteraction = server.unixtime;
+    if (c->read_time == 0) c->read_time = ustime();
     if (c->flags & CLIENT_MASTER) c->read_reploff += nread;
-    server.stat_net_input_bytes += nread;
+    atomicIncr(server.stat_net_input_bytes,nread);
     if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
         sds ci = catClientInfoString(sdsempty(),c), bytes = sdsempty();
 
@@ -1413,9 +1894,26 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         serverLog(LL_WARNING,"Closing client that reached max query buffer length: %s (qbuf initial bytes: %s)", ci, bytes);
         sdsfree(ci);
         sdsfree(bytes);
-        freeClient(c);
-        return;
+        freeClientFromIOHandler(c);
+        return C_ERR;
     }
+    return C_OK;
+}
+
+void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    client *c = (client*) privdata;
+    int nread, readlen;
+    size_t qblen;
+    UNUSED(el);
+    UNUSED(mask);
+
+    /* Check if we want to read from the client later when exiting from
+     * the event loop. This is the case if threaded I/O is enabled. */
+    if (postponeClientRead(c)) return;
+
+    readlen = _readQueryFromClientPrepare(c,&qblen);
+    nread = read(fd, c->querybuf+qblen, readlen);
+    if (_readQueryFromClientDone(c,nread,qblen) == C_ERR) return;
 
     /* Time to process the buffer. If the client is a master we need to
      * compute the difference between the applied offset before and after
@@ -1449,7 +1947,8 @@ void getClientsMaxBuffers(unsigned long *longest_output_list,
         c = listNodeValue(ln);
 
         if (listLength(c->reply) > lol) lol = listLength(c->reply);
-        if (sdslen(c->querybuf) > bib) bib = sdslen(c->querybuf);
+        if (c->querybuf && sdslen(c->querybuf) > bib)
+            bib = sdslen(c->querybuf);
     }
     *longest_output_list = lol;
     *biggest_input_buffer = bib;
@@ -1534,8 +2033,8 @@ sds catClientInfoString(sds s, client *client) {
         (int) dictSize(client->pubsub_channels),
         (int) listLength(client->pubsub_patterns),
         (client->flags & CLIENT_MULTI) ? client->mstate.count : -1,
-        (unsigned long long) sdslen(client->querybuf),
-        (unsigned long long) sdsavail(client->querybuf),
+        (unsigned long long) (client->querybuf ? sdslen(client->querybuf) : 0),
+        (unsigned long long) (client->querybuf ? sdsavail(client->querybuf) : 0),
         (unsigned long long) client->bufpos,
         (unsigned long long) listLength(client->reply),
         (unsigned long long) getClientOutputBufferMemoryUsage(client),
@@ -1818,13 +2317,18 @@ void rewriteClientCommandArgument(client *c, int i, robj *newval) {
  * the caller wishes. The main usage of this function currently is
  * enforcing the client output length limits. */
 unsigned long getClientOutputBufferMemoryUsage(client *c) {
-    unsigned long list_item_size = sizeof(listNode)+5;
+    unsigned long list_item_size = sizeof(listNode)+sizeof(robj)+5;
     /* The +5 above means we assume an sds16 hdr, may not be true
      * but is not going to be a problem. */
 
     return c->reply_bytes + (list_item_size*listLength(c->reply));
 }
 
+/* Return the memory used by the reply and query buffers of the client. */
+size_t getClientBuffersMemoryUsage(client *c) {
+    return c->buf_usable_size + (c->querybuf ? sdsAllocSize(c->querybuf) : 0);
+}
+
 /* Get the class of a client, used in order to enforce limits to different
  * classes of clients.
  *
@@ -2018,6 +2522,11 @@ int clientsArePaused(void) {
 int processEventsWhileBlocked(void) {
     int iterations = 4; /* See the function top-comment. */
     int count = 0;
+
+    /* Note: when we are processing events while blocked (for instance during
+     * busy Lua scripts), we don't want to call the I/O threads rounds since
+     * the main thread is in the middle of something. */
+    ProcessingEventsWhileBlocked = 1;
     while (iterations--) {
         int events = 0;
         events += aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
@@ -2025,5 +2534,423 @@ int processEventsWhileBlocked(void) {
         if (!events) break;
         count += events;
     }
+    ProcessingEventsWhileBlocked = 0;
     return count;
 }
+
+/* ==========================================================================
+ * Threaded I/O
+ * ========================================================================== */
+
+/* When io-threads is greater than one, the main thread offloads the socket
+ * reads (and the parsing of the query buffer) and the socket writes to a
+ * set of I/O threads. Commands are always executed by the main thread.
+ *
+ * The threads never run at the same time as the main thread is touching the
+ * dataset: every read or write round works like this:
+ *
+ * 1. The main thread distributes the clients among the threads lists (the
+ *    list with index 0 is handled by the main thread itself).
+ * 2. It sets the 'pending' counter of every thread to the number of clients
+ *    assigned to it, this is what starts the threads.
+ * 3. It processes its own clients, and then busy waits for all the counters
+ *    to drop to zero.
+ *
+ * When there are not enough clients with pending writes to justify the
+ * threads, they are stopped by the main thread holding their mutex, so
+ * that they don't burn CPU spinning on the counters. */
+typedef struct ioThread {
+    pthread_t tid;
+    pthread_mutex_t mutex;      /* Locked by the main thread to stop us. */
+    list *clients;              /* Clients to handle in the next round. */
+    unsigned long pending;      /* Clients still to process in this round. */
+    pthread_mutex_t pending_mutex; /* Only used by the atomicvar.h fallback. */
+} ioThread;
+
+static ioThread io_threads[IO_THREADS_MAX_NUM];
+
+void *IOThreadMain(void *myid) {
+    /* The ID is the thread number (from 0 to server.io_threads_num-1), and is
+     * used by the thread to just manipulate a single sub-array of clients. */
+    long id = (unsigned long)myid;
+    ioThread *t = io_threads+id;
+    sigset_t sigset;
+
+    /* Make the thread killable at any time, so that killIOThreads()
+     * can work reliably. */
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+
+    /* Block SIGALRM so we are sure that only the main thread will
+     * receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        serverLog(LL_WARNING,
+            "Warning: can't mask SIGALRM in I/O thread: %s", strerror(errno));
+
+    while(1) {
+        unsigned long pending = 0;
+        listIter li;
+        listNode *ln;
+        int j;
+
+        /* Wait for start */
+        for (j = 0; j < 1000000; j++) {
+            atomicGetWithSync(t->pending,pending);
+            if (pending != 0) break;
+        }
+
+        /* Give the main thread a chance to stop this thread. */
+        if (pending == 0) {
+            pthread_mutex_lock(&t->mutex);
+            pthread_mutex_unlock(&t->mutex);
+            continue;
+        }
+
+        serverAssert(pending == listLength(t->clients));
+
+        /* Process: note that the main thread will never touch our list
+         * before we drop the pending count to 0. */
+        listRewind(t->clients,&li);
+        while((ln = listNext(&li))) {
+            client *c = listNodeValue(ln);
+            if (io_threads_op == IO_THREADS_OP_WRITE) {
+                writeToClient(c->fd,c,0);
+            } else if (io_threads_op == IO_THREADS_OP_READ) {
+                readQueryFromClient(NULL,c->fd,c,0);
+            } else {
+                serverPanic("io_threads_op value is unknown");
+            }
+        }
+        listEmpty(t->clients);
+        atomicSetWithSync(t->pending,0);
+    }
+}
+
+/* Initialize the data structures needed for threaded I/O. */
+void initThreadedIO(void) {
+    int j;
+
+    server.io_threads_active = 0; /* We start with threads not active. */
+
+    /* Don't spawn any thread if the user selected a single thread:
+     * we'll handle I/O directly from the main thread. */
+    if (server.io_threads_num == 1) return;
+
+    /* Spawn and initialize the I/O threads. */
+    for (j = 0; j < server.io_threads_num; j++) {
+        ioThread *t = io_threads+j;
+
+        t->clients = listCreate();
+        t->pending = 0;
+        pthread_mutex_init(&t->pending_mutex,NULL);
+
+        /* Thread 0 is the main thread. */
+        if (j == 0) continue;
+
+        pthread_mutex_init(&t->mutex,NULL);
+        pthread_mutex_lock(&t->mutex); /* Thread will be stopped. */
+        if (pthread_create(&t->tid,NULL,IOThreadMain,(void*)(long)j) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize IO thread.");
+            exit(1);
+        }
+    }
+}
+
+/* Kill the running I/O threads in an unclean way. Like bioKillThreads()
+ * this is only used on crash, before the fast memory test. */
+void killIOThreads(void) {
+    int err, j;
+
+    for (j = 1; j < server.io_threads_num; j++) {
+        if (pthread_cancel(io_threads[j].tid) == 0) {
+            if ((err = pthread_join(io_threads[j].tid,NULL)) != 0) {
+                serverLog(LL_WARNING,
+                    "IO thread(tid:%lu) can not be joined: %s",
+                        (unsigned long)io_threads[j].tid, strerror(err));
+            } else {
+                serverLog(LL_WARNING,
+                    "IO thread(tid:%lu) terminated",
+                        (unsigned long)io_threads[j].tid);
+            }
+        }
+    }
+}
+
+void startThreadedIO(void) {
+    int j;
+
+    serverAssert(server.io_threads_active == 0);
+    for (j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_unlock(&io_threads[j].mutex);
+    server.io_threads_active = 1;
+}
+
+void stopThreadedIO(void) {
+    int j;
+
+    /* We may have still clients with pending reads when this function
+     * is called: handle them before stopping the threads. */
+    handleClientsWithPendingReadsUsingThreads();
+    serverAssert(server.io_threads_active == 1);
+    for (j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_lock(&io_threads[j].mutex);
+    server.io_threads_active = 0;
+}
+
+/* This function checks if there are not enough pending clients to justify
+ * taking the I/O threads active: in that case I/O threads are stopped if
+ * currently active. We track the pending writes as a measure of clients
+ * we need to handle in parallel, however the I/O threading is disabled
+ * globally for reads as well if we have too little pending clients.
+ *
+ * The function returns 0 if the I/O threading should be used because there
+ * are enough active threads, otherwise 1 is returned and the I/O threads
+ * could be possibly stopped (if already active) as a side effect. */
+int stopThreadedIOIfNeeded(void) {
+    int pending = listLength(server.clients_pending_write);
+
+    /* Return ASAP if IO threads are disabled (single threaded mode). */
+    if (server.io_threads_num == 1) return 1;
+
+    if (pending < (server.io_threads_num*2)) {
+        if (server.io_threads_active) stopThreadedIO();
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* Run a read or write round: 'l' is the list of clients to distribute among
+ * the threads. The list itself is not modified. */
+static void runIOThreadsRound(list *l, int op) {
+    listIter li;
+    listNode *ln;
+    int item_id = 0, j;
+
+    listRewind(l,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        int target_id = item_id % server.io_threads_num;
+        listAddNodeTail(io_threads[target_id].clients,c);
+        item_id++;
+    }
+
+    /* Give the start condition to the waiting threads, by setting the
+     * start condition atomic var. */
+    io_threads_op = op;
+    for (j = 1; j < server.io_threads_num; j++) {
+        unsigned long count = listLength(io_threads[j].clients);
+        atomicSetWithSync(io_threads[j].pending,count);
+    }
+
+    /* Also use the main thread to process a slice of clients. */
+    listRewind(io_threads[0].clients,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        if (op == IO_THREADS_OP_WRITE)
+            writeToClient(c->fd,c,0);
+        else
+            readQueryFromClient(NULL,c->fd,c,0);
+    }
+    listEmpty(io_threads[0].clients);
+
+    /* Wait for all the other threads to end their work. */
+    while(1) {
+        unsigned long pending = 0;
+        for (j = 1; j < server.io_threads_num; j++) {
+            unsigned long count;
+            atomicGetWithSync(io_threads[j].pending,count);
+            pending += count;
+        }
+        if (pending == 0) break;
+    }
+    io_threads_op = IO_THREADS_OP_IDLE;
+}
+
+/* Like handleClientsWithPendingWrites() but using the I/O threads when
+ * there are enough clients to serve. Called by beforeSleep(). */
+int handleClientsWithPendingWritesUsingThreads(void) {
+    int processed = listLength(server.clients_pending_write);
+    listIter li;
+    listNode *ln;
+
+    /* If I/O threads are disabled or we have few clients to serve, don't
+     * use I/O threads, but the boring synchronous code. */
+    if (server.io_threads_num == 1 || stopThreadedIOIfNeeded()) {
+        return handleClientsWithPendingWrites();
+    }
+
+    /* Start threads if needed. */
+    if (!server.io_threads_active) startThreadedIO();
+
+    /* Clear the flag before the round: writeToClient() may queue new
+     * writes only from the main thread. */
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_WRITE;
+    }
+    runIOThreadsRound(server.clients_pending_write,IO_THREADS_OP_WRITE);
+
+    /* Run the list of clients again to install the write handler where
+     * needed. Clients that were closed by the threads are already in the
+     * queue of clients to free. */
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        releaseClientReplyUnref(c);
+        if (c->flags & CLIENT_CLOSE_ASAP) continue;
+        releaseClientBuffersIfIdle(c);
+        if (clientHasPendingReplies(c) &&
+            aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+                sendReplyToClient, c) == AE_ERR)
+        {
+            freeClientAsync(c);
+        }
+    }
+    listEmpty(server.clients_pending_write);
+
+    /* Update processed count on server */
+    server.stat_io_writes_processed += processed;
+    return processed;
+}
+
+/* Return 1 if we want to handle the client read later using threaded I/O,
+ * or batched with the reads of the other clients when the event loop
+ * supports it, see handleClientsWithPendingReadsBatched().
+ * This is called by the readable handler of the event loop.
+ * As a side effect of calling this function the client is put in the
+ * pending read clients and flagged as such. */
+int postponeClientRead(client *c) {
+    if (((server.io_threads_active && server.io_threads_do_reads) ||
+         aeCanBatchIO(server.el)) &&
+        !ProcessingEventsWhileBlocked &&
+        !(c->flags & (CLIENT_MASTER|CLIENT_SLAVE|CLIENT_PENDING_READ)))
+    {
+        c->flags |= CLIENT_PENDING_READ;
+        listAddNodeTail(server.clients_pending_read,c);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* Read from all the clients in the pending reads queue with a single
+ * aeBatchIO() call, then process their query buffers. */
+static int handleClientsWithPendingReadsBatched(void) {
+    static aeIORequest *reqs = NULL;
+    static struct iovec *iov = NULL;
+    static size_t *qblen = NULL;
+    static int allocated = 0;
+    int processed = listLength(server.clients_pending_read), count = 0, j;
+    listIter li;
+    listNode *ln;
+
+    if (allocated < processed) {
+        allocated = processed;
+        reqs = zrealloc(reqs,sizeof(aeIORequest)*allocated);
+        iov = zrealloc(iov,sizeof(struct iovec)*allocated);
+        qblen = zrealloc(qblen,sizeof(size_t)*allocated);
+    }
+
+    listRewind(server.clients_pending_read,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        int readlen = _readQueryFromClientPrepare(c,qblen+count);
+
+        iov[count].iov_base = c->querybuf+qblen[count];
+        iov[count].iov_len = readlen;
+        reqs[count].fd = c->fd;
+        reqs[count].write = 0;
+        reqs[count].iov = iov+count;
+        reqs[count].iovcnt = 1;
+        count++;
+    }
+
+    /* If the batch can't be run, fall back to one read(2) per client. */
+    if (aeBatchIO(server.el,reqs,count) == AE_ERR) {
+        for (j = 0; j < count; j++) {
+            reqs[j].res = read(reqs[j].fd,iov[j].iov_base,iov[j].iov_len);
+            if (reqs[j].res == -1) reqs[j].res = -errno;
+        }
+    }
+
+    /* Account the reads like an I/O thread would do: clients are only
+     * scheduled for freeing, so the queue stays valid. */
+    io_threads_op = IO_THREADS_OP_READ;
+    j = 0;
+    listRewind(server.clients_pending_read,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        ssize_t nread = reqs[j].res;
+
+        if (nread < 0) {
+            errno = -nread;
+            nread = -1;
+        }
+        _readQueryFromClientDone(c,nread,qblen[j++]);
+    }
+    io_threads_op = IO_THREADS_OP_IDLE;
+
+    /* Process the new buffers. Executing a command may free other clients
+     * of the queue (for instance CLIENT KILL), so we always restart from
+     * the head. */
+    while(listLength(server.clients_pending_read)) {
+        client *c;
+
+        ln = listFirst(server.clients_pending_read);
+        c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+        listDelNode(server.clients_pending_read,ln);
+        if (c->flags & CLIENT_CLOSE_ASAP) continue;
+        processInputBuffer(c);
+    }
+    return processed;
+}
+
+/* When threaded I/O is also enabled for the reading + parsing side, the
+ * readable handler will just put normal clients into a queue of clients to
+ * process (instead of serving them synchronously). This function runs
+ * the queue using the I/O threads, and process them in order to accumulate
+ * the reads in the buffers, and also parse the first command available
+ * rendering it in the client structures. The commands are then executed
+ * here by the main thread. Called by beforeSleep(). */
+int handleClientsWithPendingReadsUsingThreads(void) {
+    int processed = listLength(server.clients_pending_read);
+
+    if (processed == 0) return 0;
+    if (!server.io_threads_active || !server.io_threads_do_reads) {
+        if (aeCanBatchIO(server.el))
+            return handleClientsWithPendingReadsBatched();
+        return 0;
+    }
+
+    runIOThreadsRound(server.clients_pending_read,IO_THREADS_OP_READ);
+
+    /* Run the list of clients again to process the new buffers. Note that
+     * executing a command may free other clients of the list (for instance
+     * CLIENT KILL), so we always restart from the head. */
+    while(listLength(server.clients_pending_read)) {
+        listNode *ln = listFirst(server.clients_pending_read);
+        client *c = listNodeValue(ln);
+
+        c->flags &= ~CLIENT_PENDING_READ;
+        listDelNode(server.clients_pending_read,ln);
+
+        /* Clients closed by the threads are already in the queue of
+         * clients to free. */
+        if (c->flags & CLIENT_CLOSE_ASAP) continue;
+
+        /* The thread may have produced replies (protocol errors) without
+         * being able to queue the client for writing. */
+        if (clientHasPendingReplies(c)) clientInstallWriteHandler(c);
+        processInputBuffer(c);
+    }
+
+    /* Update processed count on server */
+    server.stat_io_reads_processed += processed;
+    return processed;
+}
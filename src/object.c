@@ -198,10 +198,10 @@ robj *createQuicklistObject(void) {
 }
 
 /* 创建一个压缩列表对象 */
-robj *createZiplistObject(void) {
-    unsigned char *zl = ziplistNew();
+robj *createListpackObject(void) {
+    unsigned char *zl = lpNew(0);
     robj *o = createObject(OBJ_LIST,zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -221,11 +221,18 @@ robj *createIntsetObject(void) {
     return o;
 }
 
+/* 创建一个roaring位图集合对象 */
+robj *createRoaringSetObject(roaring *r) {
+    robj *o = createObject(OBJ_SET,r ? r : roaringNew());
+    o->encoding = OBJ_ENCODING_ROARING;
+    return o;
+}
+
 /* 创建一个哈希表对象 */
 robj *createHashObject(void) {
-    unsigned char *zl = ziplistNew();
+    unsigned char *zl = lpNew(0);
     robj *o = createObject(OBJ_HASH, zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -235,17 +242,17 @@ robj *createZsetObject(void) {
     robj *o;
 
     zs->dict = dictCreate(&zsetDictType,NULL);
-    zs->zsl = zslCreate();
+    zs->zbt = zbtCreate();
     o = createObject(OBJ_ZSET,zs);
-    o->encoding = OBJ_ENCODING_SKIPLIST;
+    o->encoding = OBJ_ENCODING_BTREE;
     return o;
 }
 
 /* 创建一个有序集合的压缩列表对象 */
-robj *createZsetZiplistObject(void) {
-    unsigned char *zl = ziplistNew();
+robj *createZsetListpackObject(void) {
+    unsigned char *zl = lpNew(0);
     robj *o = createObject(OBJ_ZSET,zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -279,6 +286,9 @@ void freeSetObject(robj *o) {
     case OBJ_ENCODING_INTSET:
         zfree(o->ptr);
         break;
+    case OBJ_ENCODING_ROARING:
+        roaringFree(o->ptr);
+        break;
     default:
         serverPanic("Unknown set encoding type");
     }
@@ -287,13 +297,13 @@ void freeSetObject(robj *o) {
 void freeZsetObject(robj *o) {
     zset *zs;
     switch (o->encoding) {
-    case OBJ_ENCODING_SKIPLIST:
+    case OBJ_ENCODING_BTREE:
         zs = o->ptr;
         dictRelease(zs->dict);
-        zslFree(zs->zsl);
+        zbtFree(zs->zbt);
         zfree(zs);
         break;
-    case OBJ_ENCODING_ZIPLIST:
+    case OBJ_ENCODING_LISTPACK:
         zfree(o->ptr);
         break;
     default:
@@ -306,7 +316,7 @@ void freeHashObject(robj *o) {
     case OBJ_ENCODING_HT:
         dictRelease((dict*) o->ptr);
         break;
-    case OBJ_ENCODING_ZIPLIST:
+    case OBJ_ENCODING_LISTPACK:
         zfree(o->ptr);
         break;
     default:
@@ -719,8 +729,11 @@ char *strEncoding(int encoding) {
     case OBJ_ENCODING_HT: return "hashtable";
     case OBJ_ENCODING_QUICKLIST: return "quicklist";
     case OBJ_ENCODING_ZIPLIST: return "ziplist";
+    case OBJ_ENCODING_LISTPACK: return "listpack";
     case OBJ_ENCODING_INTSET: return "intset";
+    case OBJ_ENCODING_ROARING: return "roaring";
     case OBJ_ENCODING_SKIPLIST: return "skiplist";
+    case OBJ_ENCODING_BTREE: return "btree";
     case OBJ_ENCODING_EMBSTR: return "embstr";
     default: return "unknown";
     }
@@ -756,12 +769,12 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
             quicklistNode *node = ql->head;
             asize = sizeof(*o)+sizeof(quicklist);
             do {
-                elesize += sizeof(quicklistNode)+ziplistBlobLen(node->zl);
+                elesize += sizeof(quicklistNode)+lpBytes(node->entry);
                 samples++;
             } while ((node = node->next) && samples < sample_size);
             asize += (double)elesize/samples*ql->len;
-        } else if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            asize = sizeof(*o)+ziplistBlobLen(o->ptr);
+        } else if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+lpBytes(o->ptr);
         } else {
             serverPanic("Unknown list encoding");
         }
@@ -780,30 +793,34 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
         } else if (o->encoding == OBJ_ENCODING_INTSET) {
             intset *is = o->ptr;
             asize = sizeof(*o)+sizeof(*is)+is->encoding*is->length;
+        } else if (o->encoding == OBJ_ENCODING_ROARING) {
+            asize = sizeof(*o)+roaringBlobLen(o->ptr);
         } else {
             serverPanic("Unknown set encoding");
         }
     } else if (o->type == OBJ_ZSET) {
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            asize = sizeof(*o)+(ziplistBlobLen(o->ptr));
-        } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes(o->ptr));
+        } else if (o->encoding == OBJ_ENCODING_BTREE) {
             d = ((zset*)o->ptr)->dict;
-            zskiplist *zsl = ((zset*)o->ptr)->zsl;
-            zskiplistNode *znode = zsl->header->level[0].forward;
-            asize = sizeof(*o)+sizeof(zset)+(sizeof(struct dictEntry*)*dictSlots(d));
-            while(znode != NULL && samples < sample_size) {
-                elesize += sdsAllocSize(znode->ele);
-                elesize += sizeof(struct dictEntry) + zmalloc_size(znode);
+            zbtree *zbt = ((zset*)o->ptr)->zbt;
+            zbtCursor cur;
+            int valid = zbtFirst(zbt,&cur);
+            asize = sizeof(*o)+sizeof(zset)+zbtBlobLen(zbt)+
+                    (sizeof(struct dictEntry*)*dictSlots(d));
+            while(valid && samples < sample_size) {
+                elesize += sdsAllocSize(zbtCursorEntry(&cur)->ele);
+                elesize += sizeof(struct dictEntry);
                 samples++;
-                znode = znode->level[0].forward;
+                valid = zbtNext(&cur);
             }
             if (samples) asize += (double)elesize/samples*dictSize(d);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (o->type == OBJ_HASH) {
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            asize = sizeof(*o)+(ziplistBlobLen(o->ptr));
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes(o->ptr));
         } else if (o->encoding == OBJ_ENCODING_HT) {
             d = o->ptr;
             di = dictGetIterator(d);
@@ -847,6 +864,7 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
     int j;
     size_t mem_total = 0;
     size_t mem = 0;
+    size_t bufmem = 0;
     size_t zmalloc_used = zmalloc_used_memory();
     struct redisMemOverhead *mh = zcalloc(sizeof(*mh));
 
@@ -872,8 +890,9 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
         while((ln = listNext(&li))) {
             client *c = listNodeValue(ln);
             mem += getClientOutputBufferMemoryUsage(c);
-            mem += sdsAllocSize(c->querybuf);
+            mem += getClientBuffersMemoryUsage(c);
             mem += sizeof(client);
+            bufmem += getClientBuffersMemoryUsage(c);
         }
     }
     mh->clients_slaves = mem;
@@ -890,13 +909,20 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
             if (c->flags & CLIENT_SLAVE)
                 continue;
             mem += getClientOutputBufferMemoryUsage(c);
-            mem += sdsAllocSize(c->querybuf);
+            mem += getClientBuffersMemoryUsage(c);
             mem += sizeof(client);
+            bufmem += getClientBuffersMemoryUsage(c);
         }
     }
     mh->clients_normal = mem;
     mem_total+=mem;
 
+    /* Already accounted above, reported on its own. The buffers in the
+     * pool are not owned by any client. */
+    mh->clients_buffers = bufmem;
+    mh->clients_buffers_pool = clientBufPoolMemory();
+    mem_total+=mh->clients_buffers_pool;
+
     mem = 0;
     if (server.aof_state != AOF_OFF) {
         mem += sdslen(server.aof_buf);
@@ -914,14 +940,14 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
         mh->db = zrealloc(mh->db,sizeof(mh->db[0])*(mh->num_dbs+1));
         mh->db[mh->num_dbs].dbid = j;
 
-        mem = dictSize(db->dict) * sizeof(dictEntry) +
+        mem = dictSize(db->dict) * (sizeof(dictEntry)+dictHashBytes(db->dict)+
+                                    dictMetadataSize(db->dict)) +
               dictSlots(db->dict) * sizeof(dictEntry*) +
               dictSize(db->dict) * sizeof(robj);
         mh->db[mh->num_dbs].overhead_ht_main = mem;
         mem_total+=mem;
 
-        mem = dictSize(db->expires) * sizeof(dictEntry) +
-              dictSlots(db->expires) * sizeof(dictEntry*);
+        mem = ttlWheelMemory(db->expires);
         mh->db[mh->num_dbs].overhead_ht_expires = mem;
         mem_total+=mem;
 
@@ -1131,7 +1157,7 @@ void memoryCommand(client *c) {
     } else if (!strcasecmp(c->argv[1]->ptr,"stats") && c->argc == 2) {
         struct redisMemOverhead *mh = getMemoryOverheadData();
 
-        addReplyMultiBulkLen(c,(14+mh->num_dbs)*2);
+        addReplyMultiBulkLen(c,(16+mh->num_dbs)*2);
 
         addReplyBulkCString(c,"peak.allocated");
         addReplyLongLong(c,mh->peak_allocated);
@@ -1151,6 +1177,12 @@ void memoryCommand(client *c) {
         addReplyBulkCString(c,"clients.normal");
         addReplyLongLong(c,mh->clients_normal);
 
+        addReplyBulkCString(c,"clients.buffers");
+        addReplyLongLong(c,mh->clients_buffers);
+
+        addReplyBulkCString(c,"clients.buffers.pool");
+        addReplyLongLong(c,mh->clients_buffers_pool);
+
         addReplyBulkCString(c,"aof.buffer");
         addReplyLongLong(c,mh->aof_buffer);
 
@@ -283,13 +283,28 @@ int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc) {
     return rdbEncodeInteger(value,enc);
 }
 
-ssize_t rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
-                       size_t original_len) {
+/* RDB string encoding of the strings compressed with 'codec'. */
+static int rdbCodecEncoding(int codec) {
+    switch(codec) {
+    case CODEC_LZ4: return RDB_ENC_LZ4;
+    case CODEC_ZSTD: return RDB_ENC_ZSTD;
+    default: return RDB_ENC_LZF;
+    }
+}
+
+/* Codec of the strings saved to 'rdb'. A NULL rio (used to compute the
+ * serialized length of an object) stands for the default LZF. */
+static int rdbCodec(rio *rdb) {
+    return rdb ? rdb->codec : CODEC_LZF;
+}
+
+ssize_t rdbSaveCompressedBlob(rio *rdb, int codec, void *data,
+                              size_t compress_len, size_t original_len) {
     unsigned char byte;
     ssize_t n, nwritten = 0;
 
     /* Data compressed! Let's save it on disk */
-    byte = (RDB_ENCVAL<<6)|RDB_ENC_LZF;
+    byte = (RDB_ENCVAL<<6)|rdbCodecEncoding(codec);
     if ((n = rdbWriteRaw(rdb,&byte,1)) == -1) goto writeerr;
     nwritten += n;
 
@@ -308,28 +323,31 @@ writeerr:
     return -1;
 }
 
-ssize_t rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
+/* Compress the string with the codec of the rio and save it. Returns 0 if
+ * the string doesn't compress. */
+ssize_t rdbSaveCompressedStringObject(rio *rdb, unsigned char *s, size_t len) {
     size_t comprlen, outlen;
+    int codec = rdbCodec(rdb);
     void *out;
 
     /* We require at least four bytes compression for this to be worth it */
     if (len <= 4) return 0;
     outlen = len-4;
     if ((out = zmalloc(outlen+1)) == NULL) return 0;
-    comprlen = lzf_compress(s, len, out, outlen);
+    comprlen = codecCompress(codec, s, len, out, outlen);
     if (comprlen == 0) {
         zfree(out);
         return 0;
     }
-    ssize_t nwritten = rdbSaveLzfBlob(rdb, out, comprlen, len);
+    ssize_t nwritten = rdbSaveCompressedBlob(rdb, codec, out, comprlen, len);
     zfree(out);
     return nwritten;
 }
 
-/* Load an LZF compressed string in RDB format. The returned value
+/* Load a string compressed with 'codec' in RDB format. The returned value
  * changes according to 'flags'. For more info check the
  * rdbGenericLoadStringObject() function. */
-void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
+void *rdbLoadCompressedStringObject(rio *rdb, int codec, int flags, size_t *lenptr) {
     int plain = flags & RDB_LOAD_PLAIN;
     int sds = flags & RDB_LOAD_SDS;
     uint64_t len, clen;
@@ -350,8 +368,9 @@ void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
 
     /* Load the compressed representation and uncompress it to target. */
     if (rioRead(rdb,c,clen) == 0) goto err;
-    if (lzf_decompress(c,clen,val,len) == 0) {
-        if (rdbCheckMode) rdbCheckSetError("Invalid LZF compressed string");
+    if (codecDecompress(codec,c,clen,val,len) != len) {
+        if (rdbCheckMode)
+            rdbCheckSetError("Invalid %s compressed string",codecName(codec));
         goto err;
     }
     zfree(c);
@@ -385,10 +404,10 @@ ssize_t rdbSaveRawString(rio *rdb, unsigned char *s, size_t len) {
         }
     }
 
-    /* Try LZF compression - under 20 bytes it's unable to compress even
+    /* Try compression - under 20 bytes it's unable to compress even
      * aaaaaaaaaaaaaaaaaa so skip it */
     if (server.rdb_compression && len > 20) {
-        n = rdbSaveLzfStringObject(rdb,s,len);
+        n = rdbSaveCompressedStringObject(rdb,s,len);
         if (n == -1) return -1;
         if (n > 0) return n;
         /* Return value of 0 means data can't be compressed, save the old way */
@@ -463,7 +482,11 @@ void *rdbGenericLoadStringObject(rio *rdb, int flags, size_t *lenptr) {
         case RDB_ENC_INT32:
             return rdbLoadIntegerObject(rdb,len,flags,lenptr);
         case RDB_ENC_LZF:
-            return rdbLoadLzfStringObject(rdb,flags,lenptr);
+            return rdbLoadCompressedStringObject(rdb,CODEC_LZF,flags,lenptr);
+        case RDB_ENC_LZ4:
+            return rdbLoadCompressedStringObject(rdb,CODEC_LZ4,flags,lenptr);
+        case RDB_ENC_ZSTD:
+            return rdbLoadCompressedStringObject(rdb,CODEC_ZSTD,flags,lenptr);
         default:
             rdbExitReportCorruptRDB("Unknown RDB string encoding type %d",len);
         }
@@ -598,26 +621,28 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
         return rdbSaveType(rdb,RDB_TYPE_STRING);
     case OBJ_LIST:
         if (o->encoding == OBJ_ENCODING_QUICKLIST)
-            return rdbSaveType(rdb,RDB_TYPE_LIST_QUICKLIST);
+            return rdbSaveType(rdb,RDB_TYPE_LIST_QUICKLIST_2);
         else
             serverPanic("Unknown list encoding");
     case OBJ_SET:
         if (o->encoding == OBJ_ENCODING_INTSET)
             return rdbSaveType(rdb,RDB_TYPE_SET_INTSET);
+        else if (o->encoding == OBJ_ENCODING_ROARING)
+            return rdbSaveType(rdb,RDB_TYPE_SET_ROARING);
         else if (o->encoding == OBJ_ENCODING_HT)
             return rdbSaveType(rdb,RDB_TYPE_SET);
         else
             serverPanic("Unknown set encoding");
     case OBJ_ZSET:
-        if (o->encoding == OBJ_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,RDB_TYPE_ZSET_ZIPLIST);
-        else if (o->encoding == OBJ_ENCODING_SKIPLIST)
+        if (o->encoding == OBJ_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,RDB_TYPE_ZSET_LISTPACK);
+        else if (o->encoding == OBJ_ENCODING_BTREE)
             return rdbSaveType(rdb,RDB_TYPE_ZSET_2);
         else
             serverPanic("Unknown sorted set encoding");
     case OBJ_HASH:
-        if (o->encoding == OBJ_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,RDB_TYPE_HASH_ZIPLIST);
+        if (o->encoding == OBJ_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,RDB_TYPE_HASH_LISTPACK);
         else if (o->encoding == OBJ_ENCODING_HT)
             return rdbSaveType(rdb,RDB_TYPE_HASH);
         else
@@ -657,13 +682,32 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
             nwritten += n;
 
             while(node) {
-                if (quicklistNodeIsCompressed(node)) {
+                if ((n = rdbSaveLen(rdb,node->container)) == -1) return -1;
+                nwritten += n;
+
+                if (quicklistNodeIsCompressed(node) &&
+                    quicklistNodeCodec(node) == rdbCodec(rdb))
+                {
                     void *data;
-                    size_t compress_len = quicklistGetLzf(node, &data);
-                    if ((n = rdbSaveLzfBlob(rdb,data,compress_len,node->sz)) == -1) return -1;
+                    size_t compress_len = quicklistGetCompressed(node, &data);
+                    if ((n = rdbSaveCompressedBlob(rdb,rdbCodec(rdb),data,compress_len,node->sz)) == -1) return -1;
+                    nwritten += n;
+                } else if (quicklistNodeIsCompressed(node)) {
+                    /* Compressed with a different codec than the one of
+                     * this RDB: save it as a plain string. */
+                    void *data, *zl = zmalloc(node->sz);
+                    size_t compress_len = quicklistGetCompressed(node, &data);
+                    if (codecDecompress(quicklistNodeCodec(node),data,
+                                        compress_len,zl,node->sz) != node->sz)
+                    {
+                        serverPanic("Corrupted compressed list node");
+                    }
+                    n = rdbSaveRawString(rdb,zl,node->sz);
+                    zfree(zl);
+                    if (n == -1) return -1;
                     nwritten += n;
                 } else {
-                    if ((n = rdbSaveRawString(rdb,node->zl,node->sz)) == -1) return -1;
+                    if ((n = rdbSaveRawString(rdb,node->entry,node->sz)) == -1) return -1;
                     nwritten += n;
                 }
                 node = node->next;
@@ -693,49 +737,59 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
+        } else if (o->encoding == OBJ_ENCODING_ROARING) {
+            size_t l = roaringSerializedLen(o->ptr);
+            unsigned char *buf = zmalloc(l);
+
+            roaringSerialize(o->ptr,buf);
+            n = rdbSaveRawString(rdb,buf,l);
+            zfree(buf);
+            if (n == -1) return -1;
+            nwritten += n;
         } else {
             serverPanic("Unknown set encoding");
         }
     } else if (o->type == OBJ_ZSET) {
         /* Save a sorted set value */
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)o->ptr);
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
-        } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (o->encoding == OBJ_ENCODING_BTREE) {
             zset *zs = o->ptr;
-            zskiplist *zsl = zs->zsl;
+            zbtCursor cur;
+            int valid;
 
-            if ((n = rdbSaveLen(rdb,zsl->length)) == -1) return -1;
+            if ((n = rdbSaveLen(rdb,zbtLength(zs->zbt))) == -1) return -1;
             nwritten += n;
 
-            /* We save the skiplist elements from the greatest to the smallest
-             * (that's trivial since the elements are already ordered in the
-             * skiplist): this improves the load process, since the next loaded
-             * element will always be the smaller, so adding to the skiplist
-             * will always immediately stop at the head, making the insertion
-             * O(1) instead of O(log(N)). */
-            zskiplistNode *zn = zsl->tail;
-            while (zn != NULL) {
+            /* We save the elements from the greatest to the smallest (that's
+             * trivial since the elements are already ordered in the tree):
+             * the next loaded element will always be the smallest, so the
+             * load process always prepends to the first leaf, and the tree
+             * splits the leaves so that every one of them ends up full. */
+            valid = zbtLast(zs->zbt,&cur);
+            while (valid) {
+                zbtEntry *e = zbtCursorEntry(&cur);
                 if ((n = rdbSaveRawString(rdb,
-                    (unsigned char*)zn->ele,sdslen(zn->ele))) == -1)
+                    (unsigned char*)e->ele,sdslen(e->ele))) == -1)
                 {
                     return -1;
                 }
                 nwritten += n;
-                if ((n = rdbSaveBinaryDoubleValue(rdb,zn->score)) == -1)
+                if ((n = rdbSaveBinaryDoubleValue(rdb,e->score)) == -1)
                     return -1;
                 nwritten += n;
-                zn = zn->backward;
+                valid = zbtPrev(&cur);
             }
         } else {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (o->type == OBJ_HASH) {
         /* Save a hash value */
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)o->ptr);
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
@@ -874,6 +928,269 @@ int rdbSaveInfoAuxFields(rio *rdb, int flags, rdbSaveInfo *rsi) {
     return 1;
 }
 
+/* A segment is a self contained slice of the keyspace of a DB: the keys of a
+ * range of hash table buckets, encoded like in the classic RDB layout and
+ * optionally LZF compressed as a whole. Segments are encoded in parallel by
+ * rdb-segment-threads threads, while the calling thread writes them in order:
+ *
+ * SEGMENT <dbid> <nkeys> <rawlen> <compressed len or 0> <payload>
+ *
+ * After the last segment, SEGMENT_INDEX <count> <offset> ... lists the
+ * offsets of the segments from the start of the RDB, so that a reader can
+ * access them directly. */
+typedef struct rdbSegmentRange {
+    int dbid;
+    unsigned long start, end;   /* Buckets [start,end) of ht[0] then ht[1]. */
+} rdbSegmentRange;
+
+typedef struct rdbSegmentEncoder {
+    rdbSegmentRange *ranges;
+    unsigned long numranges;
+    unsigned long next;         /* Next range to encode. */
+    unsigned long written;      /* Ranges written by the calling thread. */
+    int window;                 /* Max ranges encoded and not yet written. */
+    sds *encoded;               /* Ring of 'window' encoded segments. */
+    int *ready;
+    int stop;                   /* Set on write error. */
+    long long now;
+    int codec;                  /* Codec of the strings, see codec.h. */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} rdbSegmentEncoder;
+
+/* Encode the keys in the range as a segment record. Returns NULL if all
+ * the keys in the range are already expired or there are none. */
+static sds rdbEncodeSegment(rdbSegmentRange *range, long long now, int codec) {
+    dict *d = server.db[range->dbid].dict;
+    unsigned long b;
+    uint64_t nkeys = 0;
+    rio payload, record;
+    size_t rawlen, clen = 0;
+    void *out = NULL;
+
+    rioInitWithBuffer(&payload,sdsempty());
+    payload.codec = codec;
+    for (b = range->start; b < range->end; b++) {
+        dictEntry *de = (b < d->ht[0].size) ? d->ht[0].table[b] :
+                        d->ht[1].table[b - d->ht[0].size];
+        while(de) {
+            robj key;
+
+            initStaticStringObject(key,dictGetKey(de));
+            /* Writing to a buffer can't fail. */
+            if (rdbSaveKeyValuePair(&payload,&key,dictGetVal(de),
+                                    dbEntryGetExpire(de),now) == 1) nkeys++;
+            de = de->next;
+        }
+    }
+    if (nkeys == 0) {
+        sdsfree(payload.io.buffer.ptr);
+        return NULL;
+    }
+
+    rawlen = sdslen(payload.io.buffer.ptr);
+    if (server.rdb_compression && rawlen > 20 && rawlen <= UINT_MAX) {
+        out = zmalloc(rawlen);
+        clen = lzf_compress(payload.io.buffer.ptr,rawlen,out,rawlen-4);
+    }
+    rioInitWithBuffer(&record,sdsempty());
+    rdbSaveType(&record,RDB_OPCODE_SEGMENT);
+    rdbSaveLen(&record,range->dbid);
+    rdbSaveLen(&record,nkeys);
+    rdbSaveLen(&record,rawlen);
+    rdbSaveLen(&record,clen);
+    if (clen)
+        rioWrite(&record,out,clen);
+    else
+        rioWrite(&record,payload.io.buffer.ptr,rawlen);
+    zfree(out);
+    sdsfree(payload.io.buffer.ptr);
+    return record.io.buffer.ptr;
+}
+
+static void *rdbSegmentEncoderMain(void *arg) {
+    rdbSegmentEncoder *enc = arg;
+
+    pthread_mutex_lock(&enc->mutex);
+    while(1) {
+        unsigned long idx;
+        sds segment;
+
+        while (!enc->stop && enc->next < enc->numranges &&
+               enc->next >= enc->written + enc->window)
+            pthread_cond_wait(&enc->cond,&enc->mutex);
+        if (enc->stop || enc->next == enc->numranges) break;
+        idx = enc->next++;
+        pthread_mutex_unlock(&enc->mutex);
+
+        segment = rdbEncodeSegment(enc->ranges+idx,enc->now,enc->codec);
+
+        pthread_mutex_lock(&enc->mutex);
+        enc->encoded[idx % enc->window] = segment;
+        enc->ready[idx % enc->window] = 1;
+        pthread_cond_broadcast(&enc->cond);
+    }
+    pthread_mutex_unlock(&enc->mutex);
+    return NULL;
+}
+
+/* Split the keyspace in ranges of buckets holding about
+ * RDB_SEGMENT_TARGET_BYTES of data each. */
+static rdbSegmentRange *rdbSegmentRanges(unsigned long *numranges) {
+    rdbSegmentRange *ranges = NULL;
+    unsigned long count = 0, keys = 0;
+    size_t bytes_per_key;
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) keys += dictSize(server.db[j].dict);
+    bytes_per_key = keys ? zmalloc_used_memory()/keys : 1;
+    if (bytes_per_key == 0) bytes_per_key = 1;
+
+    for (j = 0; j < server.dbnum; j++) {
+        dict *d = server.db[j].dict;
+        unsigned long buckets = d->ht[0].size + d->ht[1].size;
+        unsigned long segkeys, step, b;
+
+        if (dictSize(d) == 0) continue;
+        segkeys = RDB_SEGMENT_TARGET_BYTES/bytes_per_key;
+        if (segkeys < RDB_SEGMENT_MIN_KEYS) segkeys = RDB_SEGMENT_MIN_KEYS;
+        if (segkeys > RDB_SEGMENT_MAX_KEYS) segkeys = RDB_SEGMENT_MAX_KEYS;
+        /* Keys are spread over the buckets of both the tables. */
+        step = (unsigned long)((double)buckets*segkeys/dictSize(d));
+        if (step == 0) step = 1;
+        for (b = 0; b < buckets; b += step) {
+            ranges = zrealloc(ranges,sizeof(*ranges)*(count+1));
+            ranges[count].dbid = j;
+            ranges[count].start = b;
+            ranges[count].end = (buckets - b > step) ? b+step : buckets;
+            count++;
+        }
+    }
+    *numranges = count;
+    return ranges;
+}
+
+/* Write the keyspace as segments, see rdbEncodeSegment(). 'base' is the
+ * offset of the RDB header in the rio stream. Returns -1 on write error. */
+static int rdbSaveSegments(rio *rdb, int flags, off_t base, long long now) {
+    rdbSegmentEncoder enc;
+    pthread_t threads[RDB_SEGMENT_THREADS_MAX_NUM];
+    int numthreads = server.rdb_segment_threads, j, dbid = -1, retval = 0;
+    uint64_t *offsets = NULL, numsegments = 0;
+    size_t processed = 0;
+    unsigned long i;
+
+    enc.ranges = rdbSegmentRanges(&enc.numranges);
+    enc.next = 0;
+    enc.written = 0;
+    enc.window = numthreads*2;
+    enc.encoded = zcalloc(sizeof(sds)*enc.window);
+    enc.ready = zcalloc(sizeof(int)*enc.window);
+    enc.stop = 0;
+    enc.now = now;
+    enc.codec = rdb->codec;
+    pthread_mutex_init(&enc.mutex,NULL);
+    pthread_cond_init(&enc.cond,NULL);
+    for (j = 0; j < numthreads; j++) {
+        if (pthread_create(threads+j,NULL,rdbSegmentEncoderMain,&enc) != 0)
+            break;
+    }
+    numthreads = j;
+    if (numthreads == 0) {
+        serverLog(LL_WARNING,"Can't create the RDB segment encoders.");
+        retval = -1;
+        goto cleanup;
+    }
+
+    for (i = 0; i < enc.numranges; i++) {
+        rdbSegmentRange *range = enc.ranges+i;
+        sds segment;
+
+        pthread_mutex_lock(&enc.mutex);
+        while (!enc.ready[i % enc.window])
+            pthread_cond_wait(&enc.cond,&enc.mutex);
+        segment = enc.encoded[i % enc.window];
+        enc.encoded[i % enc.window] = NULL;
+        enc.ready[i % enc.window] = 0;
+        enc.written = i+1;
+        pthread_cond_broadcast(&enc.cond);
+        pthread_mutex_unlock(&enc.mutex);
+
+        if (range->dbid != dbid) {
+            redisDb *db = server.db+range->dbid;
+            uint32_t db_size, expires_size;
+
+            dbid = range->dbid;
+            /* Write the SELECT DB and RESIZE DB opcodes like rdbSaveRio()
+             * does, they are still useful to the loader. */
+            db_size = (dictSize(db->dict) <= UINT32_MAX) ?
+                                    dictSize(db->dict) :
+                                    UINT32_MAX;
+            expires_size = (ttlWheelSize(db->expires) <= UINT32_MAX) ?
+                                    ttlWheelSize(db->expires) :
+                                    UINT32_MAX;
+            if (rdbSaveType(rdb,RDB_OPCODE_SELECTDB) == -1 ||
+                rdbSaveLen(rdb,dbid) == -1 ||
+                rdbSaveType(rdb,RDB_OPCODE_RESIZEDB) == -1 ||
+                rdbSaveLen(rdb,db_size) == -1 ||
+                rdbSaveLen(rdb,expires_size) == -1)
+            {
+                sdsfree(segment);
+                retval = -1;
+                break;
+            }
+        }
+        if (segment == NULL) continue;
+
+        offsets = zrealloc(offsets,sizeof(uint64_t)*(numsegments+1));
+        offsets[numsegments++] = rdb->processed_bytes - base;
+        if (rdbWriteRaw(rdb,segment,sdslen(segment)) == -1) {
+            sdsfree(segment);
+            retval = -1;
+            break;
+        }
+        sdsfree(segment);
+
+        /* When this RDB is produced as part of an AOF rewrite, move
+         * accumulated diff from parent to child while rewriting in
+         * order to have a smaller final write. */
+        if (flags & RDB_SAVE_AOF_PREAMBLE &&
+            rdb->processed_bytes > processed+AOF_READ_DIFF_INTERVAL_BYTES)
+        {
+            processed = rdb->processed_bytes;
+            aofReadDiffFromParent();
+        }
+    }
+
+    /* Stop the encoders and release what they may have encoded after an
+     * error. */
+    pthread_mutex_lock(&enc.mutex);
+    enc.stop = 1;
+    pthread_cond_broadcast(&enc.cond);
+    pthread_mutex_unlock(&enc.mutex);
+    for (j = 0; j < numthreads; j++) pthread_join(threads[j],NULL);
+    for (j = 0; j < enc.window; j++) sdsfree(enc.encoded[j]);
+
+    if (retval == 0) {
+        if (rdbSaveType(rdb,RDB_OPCODE_SEGMENT_INDEX) == -1 ||
+            rdbSaveLen(rdb,numsegments) == -1)
+        {
+            retval = -1;
+        }
+        for (i = 0; retval == 0 && i < numsegments; i++)
+            if (rdbSaveLen(rdb,offsets[i]) == -1) retval = -1;
+    }
+
+cleanup:
+    pthread_mutex_destroy(&enc.mutex);
+    pthread_cond_destroy(&enc.cond);
+    zfree(enc.ranges);
+    zfree(enc.encoded);
+    zfree(enc.ready);
+    zfree(offsets);
+    return retval;
+}
+
 /* Produces a dump of the database in RDB format sending it to the specified
  * Redis I/O channel. On success C_OK is returned, otherwise C_ERR
  * is returned and part of the output, or all the output, can be
@@ -890,6 +1207,9 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
     long long now = mstime();
     uint64_t cksum;
     size_t processed = 0;
+    off_t base = rdb->processed_bytes;
+    /* Modules data types are not required to be thread safe. */
+    int segments = server.rdb_segment_threads > 1 && moduleCount() == 0;
 
     if (server.rdb_checksum)
         rdb->update_cksum = rioGenericUpdateChecksum;
@@ -897,7 +1217,9 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
     if (rdbWriteRaw(rdb,magic,9) == -1) goto werr;
     if (rdbSaveInfoAuxFields(rdb,flags,rsi) == -1) goto werr;
 
-    for (j = 0; j < server.dbnum; j++) {
+    if (segments && rdbSaveSegments(rdb,flags,base,now) == -1) goto werr;
+
+    for (j = 0; !segments && j < server.dbnum; j++) {
         redisDb *db = server.db+j;
         dict *d = db->dict;
         if (dictSize(d) == 0) continue;
@@ -916,8 +1238,8 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
         db_size = (dictSize(db->dict) <= UINT32_MAX) ?
                                 dictSize(db->dict) :
                                 UINT32_MAX;
-        expires_size = (dictSize(db->expires) <= UINT32_MAX) ?
-                                dictSize(db->expires) :
+        expires_size = (ttlWheelSize(db->expires) <= UINT32_MAX) ?
+                                ttlWheelSize(db->expires) :
                                 UINT32_MAX;
         if (rdbSaveType(rdb,RDB_OPCODE_RESIZEDB) == -1) goto werr;
         if (rdbSaveLen(rdb,db_size) == -1) goto werr;
@@ -1025,6 +1347,7 @@ int rdbSave(char *filename, rdbSaveInfo *rsi) {
     }
 
     rioInitWithFile(&rdb,fp);
+    rdb.codec = server.rdb_compression_codec;
     if (rdbSaveRio(&rdb,&error,RDB_SAVE_NONE,rsi) == C_ERR) {
         errno = error;
         goto werr;
@@ -1071,6 +1394,11 @@ int rdbSaveBackground(char *filename, rdbSaveInfo *rsi) {
 
     server.dirty_before_bgsave = server.dirty;
     server.lastbgsave_try = time(NULL);
+
+    /* 不fork, 由主线程增量地保存.
+     * Save incrementally from the main thread instead of forking. */
+    if (server.rdb_forkless_save) return rdbSaveForklessStart(filename,rsi);
+
     openChildInfoPipe();
 
     start = ustime();
@@ -1119,10 +1447,25 @@ int rdbSaveBackground(char *filename, rdbSaveInfo *rsi) {
 void rdbRemoveTempFile(pid_t childpid) {
     char tmpfile[256];
 
-    snprintf(tmpfile,sizeof(tmpfile),"temp-%d.rdb", (int) childpid);
+    if (childpid == RDB_CHILD_PID_FORKLESS)
+        snprintf(tmpfile,sizeof(tmpfile),"temp-forkless-%d.rdb",
+            (int) getpid());
+    else
+        snprintf(tmpfile,sizeof(tmpfile),"temp-%d.rdb", (int) childpid);
     unlink(tmpfile);
 }
 
+/* Stop the BGSAVE in progress, killing the saving child or aborting the
+ * forkless snapshot. */
+void killRDBChild(void) {
+    if (rdbForklessSaveInProgress()) {
+        rdbSaveForklessAbort();
+    } else {
+        kill(server.rdb_child_pid,SIGUSR1);
+        rdbRemoveTempFile(server.rdb_child_pid);
+    }
+}
+
 /* This function is called by rdbLoadObject() when the code is in RDB-check
  * mode and we find a module value of type 2 that can be parsed without
  * the need of the actual module. The value is parsed for errors, finally
@@ -1162,6 +1505,26 @@ robj *rdbLoadCheckModuleValue(rio *rdb, char *modulename) {
     return createStringObject("module-dummy-value",18);
 }
 
+/* Convert a ziplist loaded from an older RDB file into a listpack with the
+ * same entries. The ziplist is freed. */
+static unsigned char *rdbZiplistToListpack(unsigned char *zl) {
+    unsigned char *lp = lpNew(ziplistBlobLen(zl));
+    unsigned char *p = ziplistIndex(zl,0);
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vll;
+
+    while (ziplistGet(p,&vstr,&vlen,&vll)) {
+        if (vstr)
+            lp = lpAppend(lp,vstr,vlen);
+        else
+            lp = lpAppendInteger(lp,vll);
+        p = ziplistNext(zl,p);
+    }
+    zfree(zl);
+    return lpShrinkToFit(lp);
+}
+
 /* Load a Redis object of the specified type from the specified file.
  * On success a newly allocated object is returned, otherwise NULL. */
 robj *rdbLoadObject(int rdbtype, rio *rdb) {
@@ -1178,7 +1541,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
 
         o = createQuicklistObject();
-        quicklistSetOptions(o->ptr, server.list_max_ziplist_size,
+        quicklistSetOptions(o->ptr, server.list_max_listpack_size,
                             server.list_compress_depth);
 
         /* Load every single element of the list */
@@ -1194,8 +1557,13 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         /* Read Set value */
         if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
 
-        /* Use a regular set when there are too many entries. */
-        if (len > server.set_max_intset_entries) {
+        /* Use a regular set when there are too many entries, or a roaring
+         * bitmap until the first member that is not an integer. */
+        if (len > server.set_max_intset_entries &&
+            server.set_roaring_encoding)
+        {
+            o = createRoaringSetObject(NULL);
+        } else if (len > server.set_max_intset_entries) {
             o = createSetObject();
             /* It's faster to expand the dict to the right size asap in order
              * to avoid rehashing */
@@ -1221,6 +1589,13 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     setTypeConvert(o,OBJ_ENCODING_HT);
                     dictExpand(o->ptr,len);
                 }
+            } else if (o->encoding == OBJ_ENCODING_ROARING) {
+                if (isSdsRepresentableAsLongLong(sdsele,&llval) == C_OK) {
+                    roaringAdd(o->ptr,llval);
+                } else {
+                    setTypeConvert(o,OBJ_ENCODING_HT);
+                    dictExpand(o->ptr,len);
+                }
             }
 
             /* This will also be called when the set was just converted
@@ -1240,33 +1615,69 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         if ((zsetlen = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
         o = createZsetObject();
         zs = o->ptr;
+        if (zsetlen > DICT_HT_INITIAL_SIZE) dictExpand(zs->dict,zsetlen);
+
+        /* The tree is built at once after loading all the entries. The
+         * array grows as entries are read, so that a corrupted length can't
+         * allocate it all upfront. */
+        uint64_t count = 0, alloc = zsetlen < 1024 ? zsetlen : 1024;
+        zbtEntry *entries = zmalloc(sizeof(zbtEntry)*alloc);
 
         /* Load every single element of the sorted set. */
         while(zsetlen--) {
             sds sdsele;
             double score;
-            zskiplistNode *znode;
+            dictEntry *de;
 
             if ((sdsele = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
-                == NULL) return NULL;
+                == NULL) {
+                zfree(entries);
+                return NULL;
+            }
 
             if (rdbtype == RDB_TYPE_ZSET_2) {
-                if (rdbLoadBinaryDoubleValue(rdb,&score) == -1) return NULL;
+                if (rdbLoadBinaryDoubleValue(rdb,&score) == -1) {
+                    zfree(entries);
+                    return NULL;
+                }
             } else {
-                if (rdbLoadDoubleValue(rdb,&score) == -1) return NULL;
+                if (rdbLoadDoubleValue(rdb,&score) == -1) {
+                    zfree(entries);
+                    return NULL;
+                }
             }
 
             /* Don't care about integer-encoded strings. */
             if (sdslen(sdsele) > maxelelen) maxelelen = sdslen(sdsele);
 
-            znode = zslInsert(zs->zsl,score,sdsele);
-            dictAdd(zs->dict,sdsele,&znode->score);
+            /* The tree can't tell duplicated members, only the hash
+             * table can. */
+            if ((de = dictAddRaw(zs->dict,sdsele,NULL)) == NULL)
+                rdbExitReportCorruptRDB("Duplicate zset fields detected");
+            dictSetDoubleVal(de,score);
+            if (count == alloc) {
+                alloc *= 2;
+                entries = zrealloc(entries,sizeof(zbtEntry)*alloc);
+            }
+            entries[count].score = score;
+            entries[count].ele = sdsele;
+            count++;
+        }
+
+        /* Sorted sets are saved from the greatest element to the smallest:
+         * reversed, the array is usually sorted already. */
+        for (uint64_t j = 0; j < count/2; j++) {
+            zbtEntry tmp = entries[j];
+            entries[j] = entries[count-1-j];
+            entries[count-1-j] = tmp;
         }
+        zbtBuild(zs->zbt,entries,count);
+        zfree(entries);
 
         /* Convert *after* loading, since sorted sets are not stored ordered. */
-        if (zsetLength(o) <= server.zset_max_ziplist_entries &&
-            maxelelen <= server.zset_max_ziplist_value)
-                zsetConvert(o,OBJ_ENCODING_ZIPLIST);
+        if (zsetLength(o) <= server.zset_max_listpack_entries &&
+            maxelelen <= server.zset_max_listpack_value)
+                zsetConvert(o,OBJ_ENCODING_LISTPACK);
     } else if (rdbtype == RDB_TYPE_HASH) {
         uint64_t len;
         int ret;
@@ -1277,12 +1688,14 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 
         o = createHashObject();
 
-        /* Too many entries? Use a hash table. */
-        if (len > server.hash_max_ziplist_entries)
+        /* Too many entries? Use a hash table, sized for all of them. */
+        if (len > server.hash_max_listpack_entries) {
             hashTypeConvert(o, OBJ_ENCODING_HT);
+            dictExpand(o->ptr,len);
+        }
 
-        /* Load every field and value into the ziplist */
-        while (o->encoding == OBJ_ENCODING_ZIPLIST && len > 0) {
+        /* Load every field and value into the listpack */
+        while (o->encoding == OBJ_ENCODING_LISTPACK && len > 0) {
             len--;
             /* Load raw strings */
             if ((field = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
@@ -1290,15 +1703,13 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
             if ((value = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
                 == NULL) return NULL;
 
-            /* Add pair to ziplist */
-            o->ptr = ziplistPush(o->ptr, (unsigned char*)field,
-                    sdslen(field), ZIPLIST_TAIL);
-            o->ptr = ziplistPush(o->ptr, (unsigned char*)value,
-                    sdslen(value), ZIPLIST_TAIL);
+            /* Add pair to listpack */
+            o->ptr = lpAppend(o->ptr, (unsigned char*)field, sdslen(field));
+            o->ptr = lpAppend(o->ptr, (unsigned char*)value, sdslen(value));
 
             /* Convert to hash table if size threshold is exceeded */
-            if (sdslen(field) > server.hash_max_ziplist_value ||
-                sdslen(value) > server.hash_max_ziplist_value)
+            if (sdslen(field) > server.hash_max_listpack_value ||
+                sdslen(value) > server.hash_max_listpack_value)
             {
                 sdsfree(field);
                 sdsfree(value);
@@ -1327,26 +1738,66 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 
         /* All pairs should be read by now */
         serverAssert(len == 0);
-    } else if (rdbtype == RDB_TYPE_LIST_QUICKLIST) {
+    } else if (rdbtype == RDB_TYPE_LIST_QUICKLIST ||
+               rdbtype == RDB_TYPE_LIST_QUICKLIST_2)
+    {
         if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
         o = createQuicklistObject();
-        quicklistSetOptions(o->ptr, server.list_max_ziplist_size,
+        quicklistSetOptions(o->ptr, server.list_max_listpack_size,
                             server.list_compress_depth);
 
         while (len--) {
-            unsigned char *zl =
-                rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,NULL);
-            if (zl == NULL) return NULL;
-            quicklistAppendZiplist(o->ptr, zl);
+            unsigned char *lp;
+            size_t lplen;
+
+            if (rdbtype == RDB_TYPE_LIST_QUICKLIST_2) {
+                uint64_t container = rdbLoadLen(rdb,NULL);
+                if (container == RDB_LENERR) return NULL;
+                if (container != QUICKLIST_NODE_CONTAINER_PACKED)
+                    rdbExitReportCorruptRDB("Unknown quicklist node container %llu",
+                        (unsigned long long)container);
+            }
+            lp = rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&lplen);
+            if (lp == NULL) return NULL;
+
+            /* Nodes of older files are ziplists. */
+            if (rdbtype == RDB_TYPE_LIST_QUICKLIST)
+                lp = rdbZiplistToListpack(lp);
+            else if (!lpValidateIntegrity(lp,lplen))
+                rdbExitReportCorruptRDB("Listpack integrity check failed.");
+
+            /* Silently skip empty nodes, a list is never saved with them
+             * but a corrupted file may contain them. */
+            if (lpLength(lp) == 0) {
+                zfree(lp);
+                continue;
+            }
+            quicklistAppendListpack(o->ptr, lp);
         }
+        if (quicklistCount(o->ptr) == 0)
+            rdbExitReportCorruptRDB("Empty list loaded.");
+    } else if (rdbtype == RDB_TYPE_SET_ROARING) {
+        size_t encoded_len;
+        unsigned char *encoded =
+            rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&encoded_len);
+        if (encoded == NULL) return NULL;
+
+        roaring *r = roaringDeserialize(encoded,encoded_len);
+        zfree(encoded);
+        if (r == NULL || roaringLen(r) == 0)
+            rdbExitReportCorruptRDB("Roaring set integrity check failed.");
+        o = createRoaringSetObject(r);
     } else if (rdbtype == RDB_TYPE_HASH_ZIPMAP  ||
                rdbtype == RDB_TYPE_LIST_ZIPLIST ||
                rdbtype == RDB_TYPE_SET_INTSET   ||
                rdbtype == RDB_TYPE_ZSET_ZIPLIST ||
-               rdbtype == RDB_TYPE_HASH_ZIPLIST)
+               rdbtype == RDB_TYPE_HASH_ZIPLIST ||
+               rdbtype == RDB_TYPE_ZSET_LISTPACK ||
+               rdbtype == RDB_TYPE_HASH_LISTPACK)
     {
+        size_t encoded_len;
         unsigned char *encoded =
-            rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,NULL);
+            rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&encoded_len);
         if (encoded == NULL) return NULL;
         o = createObject(OBJ_STRING,encoded); /* Obj type fixed below. */
 
@@ -1358,10 +1809,10 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
          * converted. */
         switch(rdbtype) {
             case RDB_TYPE_HASH_ZIPMAP:
-                /* Convert to ziplist encoded hash. This must be deprecated
+                /* Convert to listpack encoded hash. This must be deprecated
                  * when loading dumps created by Redis 2.4 gets deprecated. */
                 {
-                    unsigned char *zl = ziplistNew();
+                    unsigned char *lp = lpNew(0);
                     unsigned char *zi = zipmapRewind(o->ptr);
                     unsigned char *fstr, *vstr;
                     unsigned int flen, vlen;
@@ -1370,17 +1821,17 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     while ((zi = zipmapNext(zi, &fstr, &flen, &vstr, &vlen)) != NULL) {
                         if (flen > maxlen) maxlen = flen;
                         if (vlen > maxlen) maxlen = vlen;
-                        zl = ziplistPush(zl, fstr, flen, ZIPLIST_TAIL);
-                        zl = ziplistPush(zl, vstr, vlen, ZIPLIST_TAIL);
+                        lp = lpAppend(lp, fstr, flen);
+                        lp = lpAppend(lp, vstr, vlen);
                     }
 
                     zfree(o->ptr);
-                    o->ptr = zl;
+                    o->ptr = lp;
                     o->type = OBJ_HASH;
-                    o->encoding = OBJ_ENCODING_ZIPLIST;
+                    o->encoding = OBJ_ENCODING_LISTPACK;
 
-                    if (hashTypeLength(o) > server.hash_max_ziplist_entries ||
-                        maxlen > server.hash_max_ziplist_value)
+                    if (hashTypeLength(o) > server.hash_max_listpack_entries ||
+                        maxlen > server.hash_max_listpack_value)
                     {
                         hashTypeConvert(o, OBJ_ENCODING_HT);
                     }
@@ -1395,18 +1846,29 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                 o->type = OBJ_SET;
                 o->encoding = OBJ_ENCODING_INTSET;
                 if (intsetLen(o->ptr) > server.set_max_intset_entries)
-                    setTypeConvert(o,OBJ_ENCODING_HT);
+                    setTypeConvert(o,server.set_roaring_encoding ?
+                        OBJ_ENCODING_ROARING : OBJ_ENCODING_HT);
                 break;
             case RDB_TYPE_ZSET_ZIPLIST:
+            case RDB_TYPE_ZSET_LISTPACK:
+                if (rdbtype == RDB_TYPE_ZSET_ZIPLIST)
+                    o->ptr = rdbZiplistToListpack(o->ptr);
+                else if (!lpValidateIntegrity(o->ptr,encoded_len))
+                    rdbExitReportCorruptRDB("Zset listpack integrity check failed.");
                 o->type = OBJ_ZSET;
-                o->encoding = OBJ_ENCODING_ZIPLIST;
-                if (zsetLength(o) > server.zset_max_ziplist_entries)
-                    zsetConvert(o,OBJ_ENCODING_SKIPLIST);
+                o->encoding = OBJ_ENCODING_LISTPACK;
+                if (zsetLength(o) > server.zset_max_listpack_entries)
+                    zsetConvert(o,OBJ_ENCODING_BTREE);
                 break;
             case RDB_TYPE_HASH_ZIPLIST:
+            case RDB_TYPE_HASH_LISTPACK:
+                if (rdbtype == RDB_TYPE_HASH_ZIPLIST)
+                    o->ptr = rdbZiplistToListpack(o->ptr);
+                else if (!lpValidateIntegrity(o->ptr,encoded_len))
+                    rdbExitReportCorruptRDB("Hash listpack integrity check failed.");
                 o->type = OBJ_HASH;
-                o->encoding = OBJ_ENCODING_ZIPLIST;
-                if (hashTypeLength(o) > server.hash_max_ziplist_entries)
+                o->encoding = OBJ_ENCODING_LISTPACK;
+                if (hashTypeLength(o) > server.hash_max_listpack_entries)
                     hashTypeConvert(o, OBJ_ENCODING_HT);
                 break;
             default:
@@ -1467,6 +1929,7 @@ void startLoading(FILE *fp) {
     server.loading = 1;
     server.loading_start_time = time(NULL);
     server.loading_loaded_bytes = 0;
+    server.loading_loaded_keys = 0;
     if (fstat(fileno(fp), &sb) == -1) {
         server.loading_total_bytes = 0;
     } else {
@@ -1484,6 +1947,20 @@ void loadingProgress(off_t pos) {
 /* Loading finished */
 void stopLoading(void) {
     server.loading = 0;
+    server.loading_threaded = 0;
+}
+
+/* The DB can take some non trivial amount of time to load: serve the clients
+ * and refresh the loading progress info. Called every
+ * loading_process_events_interval_bytes of RDB payload processed. */
+static void rdbLoadProcessEvents(off_t processed_bytes) {
+    /* Update our cached time since it is used to create and update the last
+     * interaction time with clients and for other important things. */
+    updateCachedTime();
+    if (server.masterhost && server.repl_state == REPL_STATE_TRANSFER)
+        replicationSendNewlineToMaster();
+    loadingProgress(processed_bytes);
+    processEventsWhileBlocked();
 }
 
 /* Track loading progress in order to serve client's from time to time
@@ -1494,73 +1971,368 @@ void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
     if (server.loading_process_events_interval_bytes &&
         (r->processed_bytes + len)/server.loading_process_events_interval_bytes > r->processed_bytes/server.loading_process_events_interval_bytes)
     {
-        /* The DB can take some non trivial amount of time to load. Update
-         * our cached time since it is used to create and update the last
-         * interaction time with clients and for other important things. */
-        updateCachedTime();
-        if (server.masterhost && server.repl_state == REPL_STATE_TRANSFER)
-            replicationSendNewlineToMaster();
-        loadingProgress(r->processed_bytes);
-        processEventsWhileBlocked();
+        rdbLoadProcessEvents(r->processed_bytes);
     }
 }
 
-/* Load an RDB file from the rio stream 'rdb'. On success C_OK is returned,
- * otherwise C_ERR is returned and 'errno' is set accordingly. */
-int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
-    uint64_t dbid;
-    int type, rdbver;
-    redisDb *db = server.db+0;
-    char buf[1024];
-    long long expiretime, now = mstime();
+/* Everything rdbLoadRioPayload() decodes from the RDB stream that must be
+ * applied to the server state, in the order it was found. */
+#define RDB_LOAD_ITEM_KEY 0         /* Key 'key' with value 'val'. */
+#define RDB_LOAD_ITEM_AUX 1         /* AUX field 'key' with value 'val'. */
+#define RDB_LOAD_ITEM_RESIZEDB 2    /* Size hint 'size' for DB 'dbid'. */
 
-    rdb->update_cksum = rdbLoadProgressCallback;
-    rdb->max_processing_chunk = server.loading_process_events_interval_bytes;
-    if (rioRead(rdb,buf,9) == 0) goto eoferr;
-    buf[9] = '\0';
-    if (memcmp(buf,"REDIS",5) != 0) {
-        serverLog(LL_WARNING,"Wrong signature trying to load DB from file");
-        errno = EINVAL;
-        return C_ERR;
+typedef struct rdbLoadItem {
+    int type;
+    int dbid;
+    robj *key, *val;
+    long long expiretime;   /* Expire of the key or -1. */
+    uint64_t size;          /* RESIZEDB hint. */
+} rdbLoadItem;
+
+/* State of a threaded load: the loader thread runs rdbLoadRioPayload() and
+ * passes the decoded items to the main thread in batches. */
+#define RDB_LOAD_BATCH_ITEMS 256
+#define RDB_LOAD_MAX_PENDING_BATCHES 64
+
+typedef struct rdbLoadBatch {
+    int count;
+    off_t processed_bytes;  /* RDB payload processed when the batch ended. */
+    rdbLoadItem items[RDB_LOAD_BATCH_ITEMS];
+} rdbLoadBatch;
+
+typedef struct rdbLoader {
+    rio *rdb;
+    int rdbver;
+    int retval;             /* Return value of rdbLoadRioPayload(). */
+    int done;               /* Set by the loader thread when it exits. */
+    pthread_t tid;
+    pthread_mutex_t mutex;
+    pthread_cond_t filled;  /* A batch was queued or the loader is done. */
+    pthread_cond_t drained; /* A batch was consumed by the main thread. */
+    list *batches;          /* Batches ready for the main thread. */
+    rdbLoadBatch *current;  /* Batch being filled by the loader thread. */
+    /* Segments of the keyspace are decoded by 'numdecoders' threads, started
+     * when the first segment is found. */
+    int numdecoders;
+    pthread_t *decoders;
+    pthread_cond_t segments_cond;   /* Segments queue changed. */
+    list *segments;         /* Segments waiting for a decoder. */
+    int pending_segments;   /* Segments queued or being decoded. */
+    int stop_decoders;      /* No more segments will be queued. */
+} rdbLoader;
+
+/* A keyspace segment read from the RDB stream, see rdbSaveSegments(). */
+typedef struct rdbLoadSegment {
+    int dbid;
+    uint64_t nkeys;
+    size_t rawlen;          /* Length of the encoded keys. */
+    int compressed;         /* Is 'payload' LZF compressed? */
+    sds payload;
+    off_t processed_bytes;  /* RDB payload processed at the end of it. */
+} rdbLoadSegment;
+
+/* Apply an item decoded from the RDB stream. This is always executed in
+ * the main thread. */
+static void rdbLoadApplyItem(rdbLoadItem *item, rdbSaveInfo *rsi, long long now) {
+    redisDb *db = server.db+item->dbid;
+
+    if (item->type == RDB_LOAD_ITEM_RESIZEDB) {
+        dictExpand(db->dict,item->size);
+    } else if (item->type == RDB_LOAD_ITEM_AUX) {
+        robj *auxkey = item->key, *auxval = item->val;
+
+        if (((char*)auxkey->ptr)[0] == '%') {
+            /* All the fields with a name staring with '%' are considered
+             * information fields and are logged at startup with a log
+             * level of NOTICE. */
+            serverLog(LL_NOTICE,"RDB '%s': %s",
+                (char*)auxkey->ptr,
+                (char*)auxval->ptr);
+        } else if (!strcasecmp(auxkey->ptr,"repl-stream-db")) {
+            if (rsi) rsi->repl_stream_db = atoi(auxval->ptr);
+        } else if (!strcasecmp(auxkey->ptr,"repl-id")) {
+            if (rsi && sdslen(auxval->ptr) == CONFIG_RUN_ID_SIZE) {
+                memcpy(rsi->repl_id,auxval->ptr,CONFIG_RUN_ID_SIZE+1);
+                rsi->repl_id_is_set = 1;
+            }
+        } else if (!strcasecmp(auxkey->ptr,"repl-offset")) {
+            if (rsi) rsi->repl_offset = strtoll(auxval->ptr,NULL,10);
+        } else if (!strcasecmp(auxkey->ptr,"lua")) {
+            /* Load the script back in memory. */
+            if (luaCreateFunction(NULL,server.lua,auxval) == NULL) {
+                rdbExitReportCorruptRDB(
+                    "Can't load Lua script from RDB file! "
+                    "BODY: %s", auxval->ptr);
+            }
+        } else {
+            /* We ignore fields we don't understand, as by AUX field
+             * contract. */
+            serverLog(LL_DEBUG,"Unrecognized RDB AUX field: '%s'",
+                (char*)auxkey->ptr);
+        }
+
+        decrRefCount(auxkey);
+        decrRefCount(auxval);
+    } else {
+        /* Check if the key already expired. This function is used when
+         * loading an RDB file from disk, either at startup, or when an RDB
+         * was received from the master. In the latter case, the master is
+         * responsible for key expiry. If we would expire keys here, the
+         * snapshot taken by the master may not be reflected on the slave. */
+        if (server.masterhost == NULL && item->expiretime != -1 &&
+            item->expiretime < now)
+        {
+            decrRefCount(item->key);
+            decrRefCount(item->val);
+            return;
+        }
+        /* Add the new object in the hash table */
+        dbAdd(db,item->key,item->val);
+
+        /* Set the expire time if needed */
+        if (item->expiretime != -1)
+            setExpire(NULL,db,item->key,item->expiretime);
+
+        decrRefCount(item->key);
+        server.loading_loaded_keys++;
     }
-    rdbver = atoi(buf+5);
-    if (rdbver < 1 || rdbver > RDB_VERSION) {
-        serverLog(LL_WARNING,"Can't handle RDB format version %d",rdbver);
-        errno = EINVAL;
-        return C_ERR;
+}
+
+/* Hand '*batch' to the main thread, waiting if too many batches are
+ * already pending, and start a new one. Called by the loader thread and by
+ * the segment decoders, each one filling its own batch. */
+static void rdbLoaderPushBatch(rdbLoader *l, rdbLoadBatch **batch, off_t processed_bytes) {
+    if ((*batch)->count == 0) return;
+    (*batch)->processed_bytes = processed_bytes;
+    pthread_mutex_lock(&l->mutex);
+    while (listLength(l->batches) >= RDB_LOAD_MAX_PENDING_BATCHES)
+        pthread_cond_wait(&l->drained,&l->mutex);
+    listAddNodeTail(l->batches,*batch);
+    pthread_cond_signal(&l->filled);
+    pthread_mutex_unlock(&l->mutex);
+    *batch = zmalloc(sizeof(rdbLoadBatch));
+    (*batch)->count = 0;
+}
+
+static void rdbLoaderFlushBatch(rdbLoader *l) {
+    rdbLoaderPushBatch(l,&l->current,l->rdb->processed_bytes);
+}
+
+/* Emit an item decoded from the RDB stream: it is applied ASAP when
+ * loading in the main thread, or added to '*batch' otherwise. */
+static void rdbLoadEmitItemToBatch(rdbLoader *l, rdbLoadBatch **batch, off_t processed_bytes, rdbLoadItem *item, rdbSaveInfo *rsi, long long now) {
+    if (l == NULL) {
+        rdbLoadApplyItem(item,rsi,now);
+        return;
+    }
+    (*batch)->items[(*batch)->count++] = *item;
+    if ((*batch)->count == RDB_LOAD_BATCH_ITEMS)
+        rdbLoaderPushBatch(l,batch,processed_bytes);
+}
+
+static void rdbLoadEmitItem(rdbLoader *l, rdbLoadItem *item, rdbSaveInfo *rsi, long long now) {
+    if (l == NULL) {
+        rdbLoadApplyItem(item,rsi,now);
+        return;
+    }
+    rdbLoadEmitItemToBatch(l,&l->current,l->rdb->processed_bytes,item,rsi,now);
+}
+
+/* Read a segment header and its payload from the RDB stream. Returns NULL
+ * on short read. */
+static rdbLoadSegment *rdbLoadSegmentRead(rio *rdb) {
+    uint64_t dbid, nkeys, rawlen, clen;
+    rdbLoadSegment *seg;
+
+    if ((dbid = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
+    if ((nkeys = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
+    if ((rawlen = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
+    if ((clen = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
+    if (dbid >= (unsigned)server.dbnum) {
+        serverLog(LL_WARNING,
+            "FATAL: Data file was created with a Redis "
+            "server configured to handle more than %d "
+            "databases. Exiting\n", server.dbnum);
+        exit(1);
+    }
+    if (clen > rawlen) rdbExitReportCorruptRDB("Bad RDB segment length");
+
+    seg = zmalloc(sizeof(*seg));
+    seg->dbid = dbid;
+    seg->nkeys = nkeys;
+    seg->rawlen = rawlen;
+    seg->compressed = clen != 0;
+    seg->payload = sdsnewlen(NULL,clen ? clen : rawlen);
+    if (sdslen(seg->payload) &&
+        rioRead(rdb,seg->payload,sdslen(seg->payload)) == 0)
+    {
+        sdsfree(seg->payload);
+        zfree(seg);
+        return NULL;
+    }
+    seg->processed_bytes = rdb->processed_bytes;
+    return seg;
+}
+
+/* Decode the keys of a segment, emitting them like rdbLoadRioPayload()
+ * does, and free the segment. A segment is self contained: a damaged one
+ * is reported as a corrupted RDB. */
+static void rdbLoadSegmentDecode(rdbLoadSegment *seg, rdbLoader *l, rdbLoadBatch **batch, rdbSaveInfo *rsi, long long now) {
+    rio r;
+    rdbLoadItem item;
+    uint64_t j;
+    sds raw = seg->payload;
+
+    if (seg->compressed) {
+        raw = sdsnewlen(NULL,seg->rawlen);
+        if (lzf_decompress(seg->payload,sdslen(seg->payload),raw,seg->rawlen)
+            != seg->rawlen)
+        {
+            rdbExitReportCorruptRDB("Invalid LZF compressed RDB segment");
+        }
+        sdsfree(seg->payload);
+    }
+    rioInitWithBuffer(&r,raw);
+
+    for (j = 0; j < seg->nkeys; j++) {
+        long long expiretime = -1;
+        int type;
+
+        if ((type = rdbLoadType(&r)) == -1) goto corrupt;
+        if (type == RDB_OPCODE_EXPIRETIME_MS) {
+            if ((expiretime = rdbLoadMillisecondTime(&r)) == -1) goto corrupt;
+            if ((type = rdbLoadType(&r)) == -1) goto corrupt;
+        }
+        if (!rdbIsObjectType(type)) goto corrupt;
+        item.type = RDB_LOAD_ITEM_KEY;
+        item.dbid = seg->dbid;
+        item.expiretime = expiretime;
+        if ((item.key = rdbLoadStringObject(&r)) == NULL) goto corrupt;
+        if ((item.val = rdbLoadObject(type,&r)) == NULL) goto corrupt;
+        rdbLoadEmitItemToBatch(l,batch,seg->processed_bytes,&item,rsi,now);
+    }
+    if ((size_t)r.io.buffer.pos != sdslen(raw)) goto corrupt;
+    sdsfree(raw);
+    zfree(seg);
+    return;
+
+corrupt:
+    rdbExitReportCorruptRDB("Bad data format in RDB segment");
+}
+
+static void *rdbLoaderDecoderMain(void *arg) {
+    rdbLoader *l = arg;
+    rdbLoadBatch *batch = zmalloc(sizeof(rdbLoadBatch));
+    off_t processed_bytes = 0;
+
+    batch->count = 0;
+    pthread_mutex_lock(&l->mutex);
+    while(1) {
+        rdbLoadSegment *seg;
+        listNode *ln;
+
+        while (listLength(l->segments) == 0 && !l->stop_decoders)
+            pthread_cond_wait(&l->segments_cond,&l->mutex);
+        if (listLength(l->segments) == 0) break;
+        ln = listFirst(l->segments);
+        seg = listNodeValue(ln);
+        listDelNode(l->segments,ln);
+        pthread_mutex_unlock(&l->mutex);
+
+        processed_bytes = seg->processed_bytes;
+        rdbLoadSegmentDecode(seg,l,&batch,NULL,0);
+        rdbLoaderPushBatch(l,&batch,processed_bytes);
+
+        pthread_mutex_lock(&l->mutex);
+        l->pending_segments--;
+        pthread_cond_broadcast(&l->segments_cond);
+    }
+    pthread_mutex_unlock(&l->mutex);
+    zfree(batch);
+    return NULL;
+}
+
+/* Queue a segment for the decoder threads, starting them if needed, and
+ * waiting if enough segments are already pending. Called by the loader
+ * thread, so the decoders inherit its signal mask. */
+static void rdbLoaderQueueSegment(rdbLoader *l, rdbLoadSegment *seg) {
+    int j;
+
+    if (l->decoders == NULL) {
+        l->decoders = zmalloc(sizeof(pthread_t)*l->numdecoders);
+        for (j = 0; j < l->numdecoders; j++) {
+            if (pthread_create(l->decoders+j,NULL,rdbLoaderDecoderMain,l) != 0) {
+                serverLog(LL_WARNING,"Fatal: Can't initialize RDB segment decoders.");
+                exit(1);
+            }
+        }
     }
+    pthread_mutex_lock(&l->mutex);
+    while (l->pending_segments >= l->numdecoders*2)
+        pthread_cond_wait(&l->segments_cond,&l->mutex);
+    listAddNodeTail(l->segments,seg);
+    l->pending_segments++;
+    pthread_cond_broadcast(&l->segments_cond);
+    pthread_mutex_unlock(&l->mutex);
+}
+
+/* Wait for the decoder threads to process all the queued segments. */
+static void rdbLoaderStopDecoders(rdbLoader *l) {
+    int j;
+
+    if (l->decoders == NULL) return;
+    pthread_mutex_lock(&l->mutex);
+    l->stop_decoders = 1;
+    pthread_cond_broadcast(&l->segments_cond);
+    pthread_mutex_unlock(&l->mutex);
+    for (j = 0; j < l->numdecoders; j++) pthread_join(l->decoders[j],NULL);
+    zfree(l->decoders);
+    l->decoders = NULL;
+}
+
+/* Decode the RDB payload that follows the header, up to the EOF opcode and
+ * the checksum, emitting every key, AUX field and resize hint found with
+ * rdbLoadEmitItem(). 'l' is the loader state when executed by the loader
+ * thread, or NULL when loading in the main thread.
+ *
+ * C_ERR is returned on a short read, C_OK otherwise. */
+static int rdbLoadRioPayload(rio *rdb, int rdbver, rdbLoader *l, rdbSaveInfo *rsi, long long now) {
+    uint64_t dbid = 0;
+    int type;
+    long long expiretime;
+    rdbLoadItem item;
 
     while(1) {
         robj *key, *val;
         expiretime = -1;
 
         /* Read type. */
-        if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
+        if ((type = rdbLoadType(rdb)) == -1) return C_ERR;
 
         /* Handle special types. */
         if (type == RDB_OPCODE_EXPIRETIME) {
             /* EXPIRETIME: load an expire associated with the next key
              * to load. Note that after loading an expire we need to
              * load the actual type, and continue. */
-            if ((expiretime = rdbLoadTime(rdb)) == -1) goto eoferr;
+            if ((expiretime = rdbLoadTime(rdb)) == -1) return C_ERR;
             /* We read the time so we need to read the object type again. */
-            if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
+            if ((type = rdbLoadType(rdb)) == -1) return C_ERR;
             /* the EXPIRETIME opcode specifies time in seconds, so convert
              * into milliseconds. */
             expiretime *= 1000;
         } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
             /* EXPIRETIME_MS: milliseconds precision expire times introduced
              * with RDB v3. Like EXPIRETIME but no with more precision. */
-            if ((expiretime = rdbLoadMillisecondTime(rdb)) == -1) goto eoferr;
+            if ((expiretime = rdbLoadMillisecondTime(rdb)) == -1) return C_ERR;
             /* We read the time so we need to read the object type again. */
-            if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
+            if ((type = rdbLoadType(rdb)) == -1) return C_ERR;
         } else if (type == RDB_OPCODE_EOF) {
             /* EOF: End of file, exit the main loop. */
             break;
         } else if (type == RDB_OPCODE_SELECTDB) {
             /* SELECTDB: Select the specified database. */
             if ((dbid = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
-                goto eoferr;
+                return C_ERR;
             if (dbid >= (unsigned)server.dbnum) {
                 serverLog(LL_WARNING,
                     "FATAL: Data file was created with a Redis "
@@ -1568,18 +2340,39 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
                     "databases. Exiting\n", server.dbnum);
                 exit(1);
             }
-            db = server.db+dbid;
             continue; /* Read type again. */
         } else if (type == RDB_OPCODE_RESIZEDB) {
             /* RESIZEDB: Hint about the size of the keys in the currently
              * selected data base, in order to avoid useless rehashing. */
-            uint64_t db_size, expires_size;
+            uint64_t db_size;
             if ((db_size = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
-                goto eoferr;
-            if ((expires_size = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
-                goto eoferr;
-            dictExpand(db->dict,db_size);
-            dictExpand(db->expires,expires_size);
+                return C_ERR;
+            /* The expires index is a radix tree: there is nothing to
+             * presize, so the expires size hint is just skipped. */
+            if (rdbLoadLen(rdb,NULL) == RDB_LENERR)
+                return C_ERR;
+            item.type = RDB_LOAD_ITEM_RESIZEDB;
+            item.dbid = dbid;
+            item.size = db_size;
+            rdbLoadEmitItem(l,&item,rsi,now);
+            continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_SEGMENT) {
+            /* SEGMENT: a self contained slice of the keyspace of a DB,
+             * decoded by the segment decoders when there are any. */
+            rdbLoadSegment *seg;
+            if ((seg = rdbLoadSegmentRead(rdb)) == NULL) return C_ERR;
+            if (l && l->numdecoders)
+                rdbLoaderQueueSegment(l,seg);
+            else
+                rdbLoadSegmentDecode(seg,l,l ? &l->current : NULL,rsi,now);
+            continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_SEGMENT_INDEX) {
+            /* SEGMENT_INDEX: offsets of the segments in the file, only
+             * useful to tools accessing the segments directly. */
+            uint64_t count, j;
+            if ((count = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return C_ERR;
+            for (j = 0; j < count; j++)
+                if (rdbLoadLen(rdb,NULL) == RDB_LENERR) return C_ERR;
             continue; /* Read type again. */
         } else if (type == RDB_OPCODE_AUX) {
             /* AUX: generic string-string fields. Use to add state to RDB
@@ -1588,71 +2381,32 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
              *
              * An AUX field is composed of two strings: key and value. */
             robj *auxkey, *auxval;
-            if ((auxkey = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
-            if ((auxval = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
-
-            if (((char*)auxkey->ptr)[0] == '%') {
-                /* All the fields with a name staring with '%' are considered
-                 * information fields and are logged at startup with a log
-                 * level of NOTICE. */
-                serverLog(LL_NOTICE,"RDB '%s': %s",
-                    (char*)auxkey->ptr,
-                    (char*)auxval->ptr);
-            } else if (!strcasecmp(auxkey->ptr,"repl-stream-db")) {
-                if (rsi) rsi->repl_stream_db = atoi(auxval->ptr);
-            } else if (!strcasecmp(auxkey->ptr,"repl-id")) {
-                if (rsi && sdslen(auxval->ptr) == CONFIG_RUN_ID_SIZE) {
-                    memcpy(rsi->repl_id,auxval->ptr,CONFIG_RUN_ID_SIZE+1);
-                    rsi->repl_id_is_set = 1;
-                }
-            } else if (!strcasecmp(auxkey->ptr,"repl-offset")) {
-                if (rsi) rsi->repl_offset = strtoll(auxval->ptr,NULL,10);
-            } else if (!strcasecmp(auxkey->ptr,"lua")) {
-                /* Load the script back in memory. */
-                if (luaCreateFunction(NULL,server.lua,auxval) == NULL) {
-                    rdbExitReportCorruptRDB(
-                        "Can't load Lua script from RDB file! "
-                        "BODY: %s", auxval->ptr);
-                }
-            } else {
-                /* We ignore fields we don't understand, as by AUX field
-                 * contract. */
-                serverLog(LL_DEBUG,"Unrecognized RDB AUX field: '%s'",
-                    (char*)auxkey->ptr);
-            }
-
-            decrRefCount(auxkey);
-            decrRefCount(auxval);
+            if ((auxkey = rdbLoadStringObject(rdb)) == NULL) return C_ERR;
+            if ((auxval = rdbLoadStringObject(rdb)) == NULL) return C_ERR;
+            item.type = RDB_LOAD_ITEM_AUX;
+            item.dbid = dbid;
+            item.key = auxkey;
+            item.val = auxval;
+            rdbLoadEmitItem(l,&item,rsi,now);
             continue; /* Read type again. */
         }
 
         /* Read key */
-        if ((key = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+        if ((key = rdbLoadStringObject(rdb)) == NULL) return C_ERR;
         /* Read value */
-        if ((val = rdbLoadObject(type,rdb)) == NULL) goto eoferr;
-        /* Check if the key already expired. This function is used when loading
-         * an RDB file from disk, either at startup, or when an RDB was
-         * received from the master. In the latter case, the master is
-         * responsible for key expiry. If we would expire keys here, the
-         * snapshot taken by the master may not be reflected on the slave. */
-        if (server.masterhost == NULL && expiretime != -1 && expiretime < now) {
-            decrRefCount(key);
-            decrRefCount(val);
-            continue;
-        }
-        /* Add the new object in the hash table */
-        dbAdd(db,key,val);
-
-        /* Set the expire time if needed */
-        if (expiretime != -1) setExpire(NULL,db,key,expiretime);
-
-        decrRefCount(key);
+        if ((val = rdbLoadObject(type,rdb)) == NULL) return C_ERR;
+        item.type = RDB_LOAD_ITEM_KEY;
+        item.dbid = dbid;
+        item.key = key;
+        item.val = val;
+        item.expiretime = expiretime;
+        rdbLoadEmitItem(l,&item,rsi,now);
     }
     /* Verify the checksum if RDB version is >= 5 */
     if (rdbver >= 5 && server.rdb_checksum) {
         uint64_t cksum, expected = rdb->cksum;
 
-        if (rioRead(rdb,&cksum,8) == 0) goto eoferr;
+        if (rioRead(rdb,&cksum,8) == 0) return C_ERR;
         memrev64ifbe(&cksum);
         if (cksum == 0) {
             serverLog(LL_WARNING,"RDB file was saved with checksum disabled: no check performed.");
@@ -1662,6 +2416,163 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
         }
     }
     return C_OK;
+}
+
+/* The loader thread only computes the checksum while reading: serving the
+ * clients and updating the progress is up to the main thread. */
+static void rdbLoaderChecksumCallback(rio *r, const void *buf, size_t len) {
+    if (server.rdb_checksum)
+        rioGenericUpdateChecksum(r, buf, len);
+}
+
+static void *rdbLoaderThreadMain(void *arg) {
+    rdbLoader *l = arg;
+    sigset_t sigset;
+
+    /* Make sure the watchdog signal is delivered to the main thread. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        serverLog(LL_WARNING,
+            "Warning: can't mask SIGALRM in RDB loader thread: %s", strerror(errno));
+
+    l->retval = rdbLoadRioPayload(l->rdb,l->rdbver,l,NULL,0);
+    rdbLoaderStopDecoders(l);
+    rdbLoaderFlushBatch(l);
+    pthread_mutex_lock(&l->mutex);
+    l->done = 1;
+    pthread_cond_signal(&l->filled);
+    pthread_mutex_unlock(&l->mutex);
+    return NULL;
+}
+
+/* Load the RDB payload using a loader thread that reads the stream,
+ * decompresses the strings and builds the values, while the main thread
+ * adds the keys to the DB and keeps serving the clients, exactly like
+ * rdbLoadProgressCallback() does when loading in a single thread. */
+static int rdbLoadRioThreaded(rio *rdb, int rdbver, rdbSaveInfo *rsi, long long now) {
+    rdbLoader l;
+    off_t events_bytes = 0;
+    int j;
+
+    l.rdb = rdb;
+    l.rdbver = rdbver;
+    l.retval = C_OK;
+    l.done = 0;
+    l.batches = listCreate();
+    l.current = zmalloc(sizeof(rdbLoadBatch));
+    l.current->count = 0;
+    l.numdecoders = server.rdb_segment_threads > 1 ? server.rdb_segment_threads : 0;
+    l.decoders = NULL;
+    l.segments = listCreate();
+    l.pending_segments = 0;
+    l.stop_decoders = 0;
+    pthread_mutex_init(&l.mutex,NULL);
+    pthread_cond_init(&l.filled,NULL);
+    pthread_cond_init(&l.drained,NULL);
+    pthread_cond_init(&l.segments_cond,NULL);
+    rdb->update_cksum = rdbLoaderChecksumCallback;
+    if (pthread_create(&l.tid,NULL,rdbLoaderThreadMain,&l) != 0) {
+        serverLog(LL_WARNING,"Can't create the RDB loader thread, loading in the main thread.");
+        rdb->update_cksum = rdbLoadProgressCallback;
+        zfree(l.current);
+        listRelease(l.batches);
+        listRelease(l.segments);
+        return rdbLoadRioPayload(rdb,rdbver,NULL,rsi,now);
+    }
+    server.loading_threaded = 1;
+
+    while(1) {
+        rdbLoadBatch *batch = NULL;
+
+        pthread_mutex_lock(&l.mutex);
+        while (listLength(l.batches) == 0 && !l.done) {
+            /* Don't stop serving clients while the loader thread is busy
+             * with a big value. */
+            struct timespec ts;
+            struct timeval tv;
+
+            gettimeofday(&tv,NULL);
+            ts.tv_sec = tv.tv_sec;
+            ts.tv_nsec = (tv.tv_usec+100000)*1000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            if (pthread_cond_timedwait(&l.filled,&l.mutex,&ts) == ETIMEDOUT) {
+                pthread_mutex_unlock(&l.mutex);
+                rdbLoadProcessEvents(server.loading_loaded_bytes);
+                pthread_mutex_lock(&l.mutex);
+            }
+        }
+        if (listLength(l.batches)) {
+            listNode *ln = listFirst(l.batches);
+            batch = listNodeValue(ln);
+            listDelNode(l.batches,ln);
+            pthread_cond_signal(&l.drained);
+        }
+        pthread_mutex_unlock(&l.mutex);
+        if (batch == NULL) break; /* Loader done and nothing left. */
+
+        for (j = 0; j < batch->count; j++)
+            rdbLoadApplyItem(batch->items+j,rsi,now);
+        if (server.loading_process_events_interval_bytes &&
+            batch->processed_bytes/server.loading_process_events_interval_bytes >
+            events_bytes/server.loading_process_events_interval_bytes)
+        {
+            events_bytes = batch->processed_bytes;
+            rdbLoadProcessEvents(batch->processed_bytes);
+        }
+        zfree(batch);
+    }
+
+    pthread_join(l.tid,NULL);
+    zfree(l.current);
+    listRelease(l.batches);
+    listRelease(l.segments);
+    pthread_mutex_destroy(&l.mutex);
+    pthread_cond_destroy(&l.filled);
+    pthread_cond_destroy(&l.drained);
+    pthread_cond_destroy(&l.segments_cond);
+    rdb->update_cksum = rdbLoadProgressCallback;
+    loadingProgress(rdb->processed_bytes);
+    return l.retval;
+}
+
+/* Load an RDB file from the rio stream 'rdb'. On success C_OK is returned,
+ * otherwise C_ERR is returned and 'errno' is set accordingly.
+ *
+ * Unless rdb-threaded-loading is disabled, the payload is decoded by a
+ * loader thread. Modules data types are loaded with callbacks that are not
+ * required to be thread safe, so when modules are loaded the main thread
+ * does all the work. */
+int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
+    int rdbver, retval;
+    char buf[1024];
+    long long now = mstime();
+
+    rdb->update_cksum = rdbLoadProgressCallback;
+    rdb->max_processing_chunk = server.loading_process_events_interval_bytes;
+    if (rioRead(rdb,buf,9) == 0) goto eoferr;
+    buf[9] = '\0';
+    if (memcmp(buf,"REDIS",5) != 0) {
+        serverLog(LL_WARNING,"Wrong signature trying to load DB from file");
+        errno = EINVAL;
+        return C_ERR;
+    }
+    rdbver = atoi(buf+5);
+    if (rdbver < 1 || rdbver > RDB_VERSION) {
+        serverLog(LL_WARNING,"Can't handle RDB format version %d",rdbver);
+        errno = EINVAL;
+        return C_ERR;
+    }
+
+    if (server.rdb_threaded_loading && moduleCount() == 0)
+        retval = rdbLoadRioThreaded(rdb,rdbver,rsi,now);
+    else
+        retval = rdbLoadRioPayload(rdb,rdbver,NULL,rsi,now);
+    if (retval == C_ERR) goto eoferr;
+    return C_OK;
 
 eoferr: /* unexpected end of file is handled here with a fatal exit */
     serverLog(LL_WARNING,"Short read or OOM loading DB. Unrecoverable error, aborting now.");
@@ -1890,6 +2801,7 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
         rio slave_sockets;
 
         rioInitWithFdset(&slave_sockets,fds,numfds);
+        slave_sockets.codec = server.repl_diskless_compression_codec;
         zfree(fds);
 
         closeListeningSockets(0);
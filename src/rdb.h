@@ -37,8 +37,20 @@
 #include "server.h"
 
 /* The current RDB version. When the format changes in a way that is no longer
- * backward compatible this number gets incremented. */
-#define RDB_VERSION 8
+ * backward compatible this number gets incremented.
+ *
+ * Version 9 added keyspace segments (see rdbSaveSegments()) and strings
+ * compressed with a codec other than LZF (see codec.h). Version 10 stores
+ * hashes, sorted sets and quicklist nodes as listpacks. */
+#define RDB_VERSION 10
+
+/* Size of the keyspace slices encoded in a single segment: a segment is
+ * closed after covering enough hash table buckets to hold about
+ * RDB_SEGMENT_TARGET_BYTES of data, considering the average memory used by
+ * the keys of the instance. */
+#define RDB_SEGMENT_TARGET_BYTES (4*1024*1024)
+#define RDB_SEGMENT_MIN_KEYS 64
+#define RDB_SEGMENT_MAX_KEYS 65536
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -68,6 +80,8 @@
 #define RDB_ENC_INT16 1       /* 16 bit signed integer */
 #define RDB_ENC_INT32 2       /* 32 bit signed integer */
 #define RDB_ENC_LZF 3         /* string compressed with FASTLZ */
+#define RDB_ENC_LZ4 4         /* string compressed with LZ4 */
+#define RDB_ENC_ZSTD 5        /* string compressed with Zstandard */
 
 /* Dup object types to RDB object types. Only reason is readability (are we
  * dealing with RDB types or with in-memory object types?). */
@@ -89,12 +103,20 @@
 #define RDB_TYPE_ZSET_ZIPLIST  12
 #define RDB_TYPE_HASH_ZIPLIST  13
 #define RDB_TYPE_LIST_QUICKLIST 14
+#define RDB_TYPE_HASH_LISTPACK 16
+#define RDB_TYPE_ZSET_LISTPACK 17
+#define RDB_TYPE_LIST_QUICKLIST_2 18 /* Quicklist of listpacks, each node
+                                        prefixed by its container type. */
+#define RDB_TYPE_SET_ROARING 19
 /* NOTE: WHEN ADDING NEW RDB TYPE, UPDATE rdbIsObjectType() BELOW */
 
 /* Test if a type is an object type. */
-#define rdbIsObjectType(t) ((t >= 0 && t <= 7) || (t >= 9 && t <= 14))
+#define rdbIsObjectType(t) ((t >= 0 && t <= 7) || (t >= 9 && t <= 14) || \
+                            (t >= 16 && t <= 19))
 
 /* Special RDB opcodes (saved/loaded with rdbSaveType/rdbLoadType). */
+#define RDB_OPCODE_SEGMENT_INDEX 246
+#define RDB_OPCODE_SEGMENT    247
 #define RDB_OPCODE_AUX        250
 #define RDB_OPCODE_RESIZEDB   251
 #define RDB_OPCODE_EXPIRETIME_MS 252
@@ -132,12 +154,15 @@ int rdbLoad(char *filename, rdbSaveInfo *rsi);
 int rdbSaveBackground(char *filename, rdbSaveInfo *rsi);
 int rdbSaveToSlavesSockets(rdbSaveInfo *rsi);
 void rdbRemoveTempFile(pid_t childpid);
+void killRDBChild(void);
 int rdbSave(char *filename, rdbSaveInfo *rsi);
 ssize_t rdbSaveObject(rio *rdb, robj *o);
 size_t rdbSavedObjectLen(robj *o);
 robj *rdbLoadObject(int type, rio *rdb);
 void backgroundSaveDoneHandler(int exitcode, int bysignal);
 int rdbSaveKeyValuePair(rio *rdb, robj *key, robj *val, long long expiretime, long long now);
+int rdbSaveInfoAuxFields(rio *rdb, int flags, rdbSaveInfo *rsi);
+ssize_t rdbSaveAuxField(rio *rdb, void *key, size_t keylen, void *val, size_t vallen);
 robj *rdbLoadStringObject(rio *rdb);
 ssize_t rdbSaveStringObject(rio *rdb, robj *obj);
 ssize_t rdbSaveRawString(rio *rdb, unsigned char *s, size_t len);
@@ -29,6 +29,7 @@
 
 #include "server.h"
 #include "rdb.h"
+#include "lzf.h"
 
 #include <stdarg.h>
 
@@ -59,6 +60,7 @@ struct {
 #define RDB_CHECK_DOING_CHECK_SUM 5
 #define RDB_CHECK_DOING_READ_LEN 6
 #define RDB_CHECK_DOING_READ_AUX 7
+#define RDB_CHECK_DOING_READ_SEGMENT 8
 
 char *rdb_check_doing_string[] = {
     "start",
@@ -68,7 +70,8 @@ char *rdb_check_doing_string[] = {
     "read-object-value",
     "check-sum",
     "read-len",
-    "read-aux"
+    "read-aux",
+    "read-segment"
 };
 
 char *rdb_type_string[] = {
@@ -85,7 +88,12 @@ char *rdb_type_string[] = {
     "set-intset",
     "zset-ziplist",
     "hash-ziplist",
-    "quicklist"
+    "quicklist",
+    "",
+    "hash-listpack",
+    "zset-listpack",
+    "quicklist-v2",
+    "set-roaring"
 };
 
 /* Show a few stats collected into 'rdbstate' */
@@ -172,6 +180,113 @@ void rdbCheckSetupSignals(void) {
     sigaction(SIGILL, &act, NULL);
 }
 
+/* Check the key stored at the current position of 'rdb', once its type and
+ * expire were read. Returns -1 on errors. */
+static int rdbCheckKey(rio *rdb, int type, long long expiretime, long long now) {
+    robj *key, *val;
+
+    /* Read key */
+    rdbstate.doing = RDB_CHECK_DOING_READ_KEY;
+    if ((key = rdbLoadStringObject(rdb)) == NULL) return -1;
+    rdbstate.key = key;
+    rdbstate.keys++;
+    /* Read value */
+    rdbstate.doing = RDB_CHECK_DOING_READ_OBJECT_VALUE;
+    if ((val = rdbLoadObject(type,rdb)) == NULL) return -1;
+    /* Check if the key already expired. This function is used when loading
+     * an RDB file from disk, either at startup, or when an RDB was
+     * received from the master. In the latter case, the master is
+     * responsible for key expiry. If we would expire keys here, the
+     * snapshot taken by the master may not be reflected on the slave. */
+    if (server.masterhost == NULL && expiretime != -1 && expiretime < now)
+        rdbstate.already_expired++;
+    if (expiretime != -1) rdbstate.expires++;
+    rdbstate.key = NULL;
+    decrRefCount(key);
+    decrRefCount(val);
+    rdbstate.key_type = -1;
+    return 0;
+}
+
+/* Check a keyspace segment, after its opcode. The keys are decoded from a
+ * buffer, so the offsets reported while checking them are relative to the
+ * uncompressed segment. Returns -1 on errors, that are already reported. */
+static int rdbCheckSegment(rio *rdb, long long now) {
+    uint64_t dbid, nkeys, rawlen, clen, j;
+    sds payload = NULL, raw = NULL;
+    rio seg;
+
+    rdbstate.doing = RDB_CHECK_DOING_READ_LEN;
+    if ((dbid = rdbLoadLen(rdb,NULL)) == RDB_LENERR ||
+        (nkeys = rdbLoadLen(rdb,NULL)) == RDB_LENERR ||
+        (rawlen = rdbLoadLen(rdb,NULL)) == RDB_LENERR ||
+        (clen = rdbLoadLen(rdb,NULL)) == RDB_LENERR) goto eoferr;
+    if (clen > rawlen) {
+        rdbCheckError("Invalid segment length: %llu compressed to %llu",
+            (unsigned long long) rawlen, (unsigned long long) clen);
+        return -1;
+    }
+    rdbCheckInfo("Segment of DB ID %d with %llu keys, %llu bytes",
+        (int) dbid, (unsigned long long) nkeys, (unsigned long long) rawlen);
+
+    rdbstate.doing = RDB_CHECK_DOING_READ_SEGMENT;
+    payload = sdsnewlen(NULL,clen ? clen : rawlen);
+    if (sdslen(payload) && rioRead(rdb,payload,sdslen(payload)) == 0)
+        goto eoferr;
+    if (clen) {
+        raw = sdsnewlen(NULL,rawlen);
+        if (lzf_decompress(payload,clen,raw,rawlen) != rawlen) {
+            rdbCheckError("Invalid LZF compressed segment");
+            goto err;
+        }
+        sdsfree(payload);
+    } else {
+        raw = payload;
+    }
+    payload = NULL;
+
+    rioInitWithBuffer(&seg,raw);
+    rdbstate.rio = &seg;
+    for (j = 0; j < nkeys; j++) {
+        long long expiretime = -1;
+        int type;
+
+        rdbstate.doing = RDB_CHECK_DOING_READ_TYPE;
+        if ((type = rdbLoadType(&seg)) == -1) goto eoferr;
+        if (type == RDB_OPCODE_EXPIRETIME_MS) {
+            rdbstate.doing = RDB_CHECK_DOING_READ_EXPIRE;
+            if ((expiretime = rdbLoadMillisecondTime(&seg)) == -1) goto eoferr;
+            rdbstate.doing = RDB_CHECK_DOING_READ_TYPE;
+            if ((type = rdbLoadType(&seg)) == -1) goto eoferr;
+        }
+        if (!rdbIsObjectType(type)) {
+            rdbCheckError("Invalid object type in segment: %d", type);
+            goto err;
+        }
+        rdbstate.key_type = type;
+        if (rdbCheckKey(&seg,type,expiretime,now) == -1) goto eoferr;
+    }
+    if ((size_t)seg.io.buffer.pos != sdslen(raw)) {
+        rdbCheckError("Trailing data after the keys of the segment");
+        goto err;
+    }
+    rdbstate.rio = rdb;
+    sdsfree(raw);
+    return 0;
+
+eoferr:
+    if (rdbstate.error_set) {
+        rdbCheckError(rdbstate.error);
+    } else {
+        rdbCheckError("Unexpected EOF reading RDB segment");
+    }
+err:
+    rdbstate.rio = rdb;
+    sdsfree(payload);
+    sdsfree(raw);
+    return -1;
+}
+
 /* Check the specified RDB file. Return 0 if the RDB looks sane, otherwise
  * 1 is returned.
  * The file is specified as a filename in 'rdbfilename' if 'fp' is not NULL,
@@ -182,6 +297,7 @@ int redis_check_rdb(char *rdbfilename, FILE *fp) {
     char buf[1024];
     long long expiretime, now = mstime();
     static rio rdb; /* Pointed by global struct riostate. */
+    uint64_t *segments = NULL, numsegments = 0;
 
     int closefile = (fp == NULL);
     if (fp == NULL && (fp = fopen(rdbfilename,"r")) == NULL) return 1;
@@ -203,7 +319,6 @@ int redis_check_rdb(char *rdbfilename, FILE *fp) {
 
     startLoading(fp);
     while(1) {
-        robj *key, *val;
         expiretime = -1;
 
         /* Read type. */
@@ -251,6 +366,37 @@ int redis_check_rdb(char *rdbfilename, FILE *fp) {
             if ((expires_size = rdbLoadLen(&rdb,NULL)) == RDB_LENERR)
                 goto eoferr;
             continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_SEGMENT) {
+            /* SEGMENT: a self contained slice of the keyspace of a DB.
+             * Remember where it starts to verify the segments index. */
+            segments = zrealloc(segments,sizeof(uint64_t)*(numsegments+1));
+            segments[numsegments++] = rdb.processed_bytes-1;
+            if (rdbCheckSegment(&rdb,now) == -1) goto err;
+            continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_SEGMENT_INDEX) {
+            /* SEGMENT_INDEX: offsets of the segments written so far. */
+            uint64_t count, offset, j;
+            rdbstate.doing = RDB_CHECK_DOING_READ_LEN;
+            if ((count = rdbLoadLen(&rdb,NULL)) == RDB_LENERR) goto eoferr;
+            if (count != numsegments) {
+                rdbCheckError("Segments index lists %llu segments, %llu found",
+                    (unsigned long long) count,
+                    (unsigned long long) numsegments);
+                goto err;
+            }
+            for (j = 0; j < count; j++) {
+                if ((offset = rdbLoadLen(&rdb,NULL)) == RDB_LENERR)
+                    goto eoferr;
+                if (offset != segments[j]) {
+                    rdbCheckError("Segments index points segment %llu at "
+                        "offset %llu instead of %llu",
+                        (unsigned long long) j, (unsigned long long) offset,
+                        (unsigned long long) segments[j]);
+                    goto err;
+                }
+            }
+            rdbCheckInfo("Segments index OK");
+            continue; /* Read type again. */
         } else if (type == RDB_OPCODE_AUX) {
             /* AUX: generic string-string fields. Use to add state to RDB
              * which is backward compatible. Implementations of RDB loading
@@ -275,26 +421,7 @@ int redis_check_rdb(char *rdbfilename, FILE *fp) {
             rdbstate.key_type = type;
         }
 
-        /* Read key */
-        rdbstate.doing = RDB_CHECK_DOING_READ_KEY;
-        if ((key = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
-        rdbstate.key = key;
-        rdbstate.keys++;
-        /* Read value */
-        rdbstate.doing = RDB_CHECK_DOING_READ_OBJECT_VALUE;
-        if ((val = rdbLoadObject(type,&rdb)) == NULL) goto eoferr;
-        /* Check if the key already expired. This function is used when loading
-         * an RDB file from disk, either at startup, or when an RDB was
-         * received from the master. In the latter case, the master is
-         * responsible for key expiry. If we would expire keys here, the
-         * snapshot taken by the master may not be reflected on the slave. */
-        if (server.masterhost == NULL && expiretime != -1 && expiretime < now)
-            rdbstate.already_expired++;
-        if (expiretime != -1) rdbstate.expires++;
-        rdbstate.key = NULL;
-        decrRefCount(key);
-        decrRefCount(val);
-        rdbstate.key_type = -1;
+        if (rdbCheckKey(&rdb,type,expiretime,now) == -1) goto eoferr;
     }
     /* Verify the checksum if RDB version is >= 5 */
     if (rdbver >= 5 && server.rdb_checksum) {
@@ -314,6 +441,7 @@ int redis_check_rdb(char *rdbfilename, FILE *fp) {
     }
 
     if (closefile) fclose(fp);
+    zfree(segments);
     return 0;
 
 eoferr: /* unexpected end of file is handled here with a fatal exit */
@@ -324,6 +452,7 @@ eoferr: /* unexpected end of file is handled here with a fatal exit */
     }
 err:
     if (closefile) fclose(fp);
+    zfree(segments);
     return 1;
 }
 
@@ -0,0 +1,3 @@
+#define REDIS_GIT_SHA1 "74c3020c"
+#define REDIS_GIT_DIRTY "88"
+#define REDIS_BUILD_ID "vm-1792124130"
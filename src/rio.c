@@ -94,6 +94,7 @@ static const rio rioBufferIO = {
     0,              /* current checksum */
     0,              /* bytes read or written */
     0,              /* read/write chunk size */
+    0,              /* compression codec (LZF) */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
@@ -147,6 +148,7 @@ static const rio rioFileIO = {
     0,              /* current checksum */
     0,              /* bytes read or written */
     0,              /* read/write chunk size */
+    0,              /* compression codec (LZF) */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
@@ -260,6 +262,7 @@ static const rio rioFdsetIO = {
     0,              /* current checksum */
     0,              /* bytes read or written */
     0,              /* read/write chunk size */
+    0,              /* compression codec (LZF) */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
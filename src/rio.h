@@ -60,6 +60,10 @@ struct _rio {
     /* maximum single read or write chunk size */
     size_t max_processing_chunk;
 
+    /* Codec used to compress the RDB strings written to the stream (see
+     * codec.h). LZF unless the caller sets it after the initialization. */
+    int codec;
+
     /* Backend-specific vars. */
     union {
         /* In-memory buffer target. */
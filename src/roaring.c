@@ -0,0 +1,934 @@
+/* Roaring bitmap -- a compressed set of 64 bit signed integers.
+ *
+ * Values are biased flipping the sign bit, so that the unsigned order of the
+ * biased values is the signed order of the values. The high 48 bits of a
+ * biased value select its container, the low 16 bits are stored inside it.
+ *
+ * A container is an array while it holds up to ROARING_ARRAY_MAX values
+ * (8192 bytes at most) and a bitmap of 65536 bits (always 8192 bytes) when
+ * it holds more, so the encoding of a container only depends on its
+ * cardinality and is never ambiguous.
+ *
+ * 序列化格式 / Serialized format, little endian:
+ *
+ * <count:32> <key:64 card:32> ... <key:64 card:32> <data> ... <data>
+ *
+ * where the data of every container is either 'card' 16 bit values or 1024
+ * 64 bit words, according to the rule above.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "roaring.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+
+#define ROARING_ARRAY_MAX 4096
+#define ROARING_BITMAP_WORDS 1024
+#define ROARING_BITMAP_BYTES (ROARING_BITMAP_WORDS*sizeof(uint64_t))
+#define ROARING_SIGN_BIT (1ULL<<63)
+#define ROARING_MAX_KEY ((1ULL<<48)-1)
+
+#define containerIsBitmap(c) ((c)->card > ROARING_ARRAY_MAX)
+
+static inline uint64_t roaringBias(int64_t v) {
+    return (uint64_t)v ^ ROARING_SIGN_BIT;
+}
+
+static inline int64_t roaringUnbias(uint64_t key, uint16_t low) {
+    return (int64_t)(((key<<16)|low) ^ ROARING_SIGN_BIT);
+}
+
+/* ----------------------------- Containers --------------------------------- */
+
+/* Return the index of 'low' in the array, or -(insertion point)-1. */
+static int32_t arraySearch(const uint16_t *a, uint32_t card, uint16_t low) {
+    int32_t lo = 0, hi = (int32_t)card-1;
+
+    /* Values are often added in ascending order: check the tail first. */
+    if (card && a[card-1] < low) return -(int32_t)card-1;
+    while (lo <= hi) {
+        int32_t mid = (lo+hi) >> 1;
+        if (a[mid] < low) lo = mid+1;
+        else if (a[mid] > low) hi = mid-1;
+        else return mid;
+    }
+    return -lo-1;
+}
+
+static uint32_t bitmapCount(const uint64_t *words) {
+    uint32_t count = 0;
+    for (int j = 0; j < ROARING_BITMAP_WORDS; j++)
+        count += __builtin_popcountll(words[j]);
+    return count;
+}
+
+static void containerToBitmap(roaringContainer *c) {
+    uint16_t *a = c->data;
+    uint64_t *words = zcalloc(ROARING_BITMAP_BYTES);
+
+    for (uint32_t j = 0; j < c->card; j++)
+        words[a[j]>>6] |= 1ULL<<(a[j]&63);
+    zfree(a);
+    c->data = words;
+    c->cap = 0;
+}
+
+/* Store the 'card' values of the bitmap 'words' into an array of the
+ * right size. The bitmap is not freed. */
+static uint16_t *bitmapToArray(const uint64_t *words, uint32_t card) {
+    uint16_t *a = zmalloc(sizeof(uint16_t)*(card ? card : 1));
+    uint32_t n = 0;
+
+    for (uint32_t j = 0; j < ROARING_BITMAP_WORDS; j++) {
+        uint64_t w = words[j];
+        while (w) {
+            a[n++] = (j<<6) + __builtin_ctzll(w);
+            w &= w-1;
+        }
+    }
+    return a;
+}
+
+/* Turn the result of a bitmap operation into a container, converting it
+ * into an array if it is small enough. The words are owned by the
+ * container, or freed. Returns 0 if the result is empty. */
+static int containerFromWords(roaringContainer *c, uint64_t key, uint64_t *words) {
+    uint32_t card = bitmapCount(words);
+
+    if (card == 0) {
+        zfree(words);
+        return 0;
+    }
+    c->key = key;
+    c->card = card;
+    if (card <= ROARING_ARRAY_MAX) {
+        c->data = bitmapToArray(words,card);
+        c->cap = card;
+        zfree(words);
+    } else {
+        c->data = words;
+        c->cap = 0;
+    }
+    return 1;
+}
+
+static int containerFind(const roaringContainer *c, uint16_t low) {
+    if (containerIsBitmap(c)) {
+        const uint64_t *words = c->data;
+        return (words[low>>6] >> (low&63)) & 1;
+    }
+    return arraySearch(c->data,c->card,low) >= 0;
+}
+
+/* Return 1 if 'low' was added, 0 if it was already there. */
+static int containerAdd(roaringContainer *c, uint16_t low) {
+    if (containerIsBitmap(c)) {
+        uint64_t *words = c->data;
+        uint64_t bit = 1ULL<<(low&63);
+        if (words[low>>6] & bit) return 0;
+        words[low>>6] |= bit;
+        c->card++;
+        return 1;
+    }
+
+    int32_t idx = arraySearch(c->data,c->card,low);
+    if (idx >= 0) return 0;
+    idx = -idx-1;
+
+    if (c->card == ROARING_ARRAY_MAX) {
+        containerToBitmap(c);
+        ((uint64_t*)c->data)[low>>6] |= 1ULL<<(low&63);
+        c->card++;
+        return 1;
+    }
+    if (c->card == c->cap) {
+        uint32_t cap = c->cap < 64 ? c->cap*2 : c->cap+c->cap/2;
+        if (cap < 4) cap = 4;
+        if (cap > ROARING_ARRAY_MAX) cap = ROARING_ARRAY_MAX;
+        c->data = zrealloc(c->data,sizeof(uint16_t)*cap);
+        c->cap = cap;
+    }
+    uint16_t *a = c->data;
+    memmove(a+idx+1,a+idx,sizeof(uint16_t)*(c->card-idx));
+    a[idx] = low;
+    c->card++;
+    return 1;
+}
+
+/* Return 1 if 'low' was removed, 0 if it was not there. */
+static int containerRemove(roaringContainer *c, uint16_t low) {
+    if (containerIsBitmap(c)) {
+        uint64_t *words = c->data;
+        uint64_t bit = 1ULL<<(low&63);
+        if (!(words[low>>6] & bit)) return 0;
+        words[low>>6] &= ~bit;
+        c->card--;
+        if (c->card == ROARING_ARRAY_MAX) {
+            c->data = bitmapToArray(words,c->card);
+            c->cap = c->card;
+            zfree(words);
+        }
+        return 1;
+    }
+
+    int32_t idx = arraySearch(c->data,c->card,low);
+    if (idx < 0) return 0;
+    uint16_t *a = c->data;
+    memmove(a+idx,a+idx+1,sizeof(uint16_t)*(c->card-idx-1));
+    c->card--;
+    if (c->cap > 64 && c->card < c->cap/4) {
+        c->cap /= 2;
+        c->data = zrealloc(c->data,sizeof(uint16_t)*c->cap);
+    }
+    return 1;
+}
+
+static void containerDup(roaringContainer *dst, const roaringContainer *src) {
+    size_t bytes = containerIsBitmap(src) ? ROARING_BITMAP_BYTES :
+                                            sizeof(uint16_t)*src->card;
+    dst->key = src->key;
+    dst->card = src->card;
+    dst->cap = containerIsBitmap(src) ? 0 : src->card;
+    dst->data = zmalloc(bytes ? bytes : 1);
+    memcpy(dst->data,src->data,bytes);
+}
+
+/* Copy the values of the container into a new bitmap. */
+static uint64_t *containerWords(const roaringContainer *c) {
+    uint64_t *words;
+
+    if (containerIsBitmap(c)) {
+        words = zmalloc(ROARING_BITMAP_BYTES);
+        memcpy(words,c->data,ROARING_BITMAP_BYTES);
+    } else {
+        const uint16_t *a = c->data;
+        words = zcalloc(ROARING_BITMAP_BYTES);
+        for (uint32_t j = 0; j < c->card; j++)
+            words[a[j]>>6] |= 1ULL<<(a[j]&63);
+    }
+    return words;
+}
+
+/* Intersection of two containers with the same key. Returns 0 if empty. */
+static int containerAnd(roaringContainer *dst, const roaringContainer *a, const roaringContainer *b) {
+    if (containerIsBitmap(a) && containerIsBitmap(b)) {
+        uint64_t *words = zmalloc(ROARING_BITMAP_BYTES);
+        const uint64_t *wa = a->data, *wb = b->data;
+        for (int j = 0; j < ROARING_BITMAP_WORDS; j++) words[j] = wa[j] & wb[j];
+        return containerFromWords(dst,a->key,words);
+    }
+
+    /* At least one is an array: the result is never bigger than it. */
+    if (containerIsBitmap(a)) {
+        const roaringContainer *tmp = a;
+        a = b;
+        b = tmp;
+    }
+    const uint16_t *aa = a->data;
+    uint16_t *out = zmalloc(sizeof(uint16_t)*a->card);
+    uint32_t n = 0;
+
+    if (containerIsBitmap(b)) {
+        for (uint32_t j = 0; j < a->card; j++)
+            if (containerFind(b,aa[j])) out[n++] = aa[j];
+    } else {
+        const uint16_t *ba = b->data;
+        uint32_t i = 0, j = 0;
+        while (i < a->card && j < b->card) {
+            if (aa[i] < ba[j]) i++;
+            else if (aa[i] > ba[j]) j++;
+            else {
+                out[n++] = aa[i];
+                i++;
+                j++;
+            }
+        }
+    }
+    if (n == 0) {
+        zfree(out);
+        return 0;
+    }
+    dst->key = a->key;
+    dst->card = n;
+    dst->cap = a->card;
+    dst->data = out;
+    return 1;
+}
+
+/* Union of two containers with the same key. Never empty. */
+static void containerOr(roaringContainer *dst, const roaringContainer *a, const roaringContainer *b) {
+    if (!containerIsBitmap(a) && !containerIsBitmap(b) &&
+        a->card+b->card <= ROARING_ARRAY_MAX)
+    {
+        const uint16_t *aa = a->data, *ba = b->data;
+        uint16_t *out = zmalloc(sizeof(uint16_t)*(a->card+b->card));
+        uint32_t i = 0, j = 0, n = 0;
+        while (i < a->card && j < b->card) {
+            if (aa[i] < ba[j]) out[n++] = aa[i++];
+            else if (aa[i] > ba[j]) out[n++] = ba[j++];
+            else {
+                out[n++] = aa[i++];
+                j++;
+            }
+        }
+        while (i < a->card) out[n++] = aa[i++];
+        while (j < b->card) out[n++] = ba[j++];
+        dst->key = a->key;
+        dst->card = n;
+        dst->cap = a->card+b->card;
+        dst->data = out;
+        return;
+    }
+
+    uint64_t *words = containerWords(a);
+    if (containerIsBitmap(b)) {
+        const uint64_t *wb = b->data;
+        for (int j = 0; j < ROARING_BITMAP_WORDS; j++) words[j] |= wb[j];
+    } else {
+        const uint16_t *ba = b->data;
+        for (uint32_t j = 0; j < b->card; j++)
+            words[ba[j]>>6] |= 1ULL<<(ba[j]&63);
+    }
+    containerFromWords(dst,a->key,words);
+}
+
+/* Values of 'a' not in 'b', with the same key. Returns 0 if empty. */
+static int containerAndNot(roaringContainer *dst, const roaringContainer *a, const roaringContainer *b) {
+    if (containerIsBitmap(a)) {
+        uint64_t *words = containerWords(a);
+        if (containerIsBitmap(b)) {
+            const uint64_t *wb = b->data;
+            for (int j = 0; j < ROARING_BITMAP_WORDS; j++) words[j] &= ~wb[j];
+        } else {
+            const uint16_t *ba = b->data;
+            for (uint32_t j = 0; j < b->card; j++)
+                words[ba[j]>>6] &= ~(1ULL<<(ba[j]&63));
+        }
+        return containerFromWords(dst,a->key,words);
+    }
+
+    const uint16_t *aa = a->data;
+    uint16_t *out = zmalloc(sizeof(uint16_t)*a->card);
+    uint32_t n = 0;
+
+    if (containerIsBitmap(b)) {
+        for (uint32_t j = 0; j < a->card; j++)
+            if (!containerFind(b,aa[j])) out[n++] = aa[j];
+    } else {
+        const uint16_t *ba = b->data;
+        uint32_t i = 0, j = 0;
+        while (i < a->card) {
+            if (j == b->card || aa[i] < ba[j]) out[n++] = aa[i++];
+            else if (aa[i] > ba[j]) j++;
+            else {
+                i++;
+                j++;
+            }
+        }
+    }
+    if (n == 0) {
+        zfree(out);
+        return 0;
+    }
+    dst->key = a->key;
+    dst->card = n;
+    dst->cap = a->card;
+    dst->data = out;
+    return 1;
+}
+
+/* ------------------------------ Roaring ----------------------------------- */
+
+roaring *roaringNew(void) {
+    roaring *r = zmalloc(sizeof(*r));
+    r->card = 0;
+    r->len = 0;
+    r->alloc = 0;
+    r->c = NULL;
+    return r;
+}
+
+void roaringFree(roaring *r) {
+    for (uint32_t j = 0; j < r->len; j++) zfree(r->c[j].data);
+    zfree(r->c);
+    zfree(r);
+}
+
+/* Return the index of the container with 'key', or -(insertion point)-1. */
+static int64_t roaringSearch(const roaring *r, uint64_t key) {
+    int64_t lo = 0, hi = (int64_t)r->len-1;
+
+    if (r->len && r->c[r->len-1].key == key) return r->len-1;
+    if (r->len && r->c[r->len-1].key < key) return -(int64_t)r->len-1;
+    while (lo <= hi) {
+        int64_t mid = (lo+hi) >> 1;
+        if (r->c[mid].key < key) lo = mid+1;
+        else if (r->c[mid].key > key) hi = mid-1;
+        else return mid;
+    }
+    return -lo-1;
+}
+
+/* Make room for a container at index 'idx' and return it. */
+static roaringContainer *roaringInsertContainer(roaring *r, uint32_t idx) {
+    if (r->len == r->alloc) {
+        r->alloc = r->alloc ? r->alloc*2 : 4;
+        r->c = zrealloc(r->c,sizeof(roaringContainer)*r->alloc);
+    }
+    memmove(r->c+idx+1,r->c+idx,sizeof(roaringContainer)*(r->len-idx));
+    r->len++;
+    return r->c+idx;
+}
+
+/* Append a container built by a set operation, keys are ascending. */
+static void roaringAppendContainer(roaring *r, roaringContainer *c) {
+    *roaringInsertContainer(r,r->len) = *c;
+    r->card += c->card;
+}
+
+roaring *roaringDup(const roaring *r) {
+    roaring *dup = roaringNew();
+
+    if (r->len) {
+        dup->alloc = r->len;
+        dup->c = zmalloc(sizeof(roaringContainer)*r->len);
+        for (uint32_t j = 0; j < r->len; j++) containerDup(dup->c+j,r->c+j);
+        dup->len = r->len;
+        dup->card = r->card;
+    }
+    return dup;
+}
+
+/* Add 'value' to the set. Returns 1 if it was added, 0 if it was already
+ * a member. */
+int roaringAdd(roaring *r, int64_t value) {
+    uint64_t u = roaringBias(value);
+    int64_t idx = roaringSearch(r,u>>16);
+    roaringContainer *c;
+
+    if (idx < 0) {
+        c = roaringInsertContainer(r,-idx-1);
+        c->key = u>>16;
+        c->card = 0;
+        c->cap = 4;
+        c->data = zmalloc(sizeof(uint16_t)*c->cap);
+    } else {
+        c = r->c+idx;
+    }
+    if (!containerAdd(c,u&0xffff)) return 0;
+    r->card++;
+    return 1;
+}
+
+/* Remove 'value' from the set. Returns 1 if it was removed, 0 if it was not
+ * a member. */
+int roaringRemove(roaring *r, int64_t value) {
+    uint64_t u = roaringBias(value);
+    int64_t idx = roaringSearch(r,u>>16);
+
+    if (idx < 0 || !containerRemove(r->c+idx,u&0xffff)) return 0;
+    r->card--;
+    if (r->c[idx].card == 0) {
+        zfree(r->c[idx].data);
+        memmove(r->c+idx,r->c+idx+1,sizeof(roaringContainer)*(r->len-idx-1));
+        r->len--;
+        if (r->alloc > 16 && r->len < r->alloc/4) {
+            r->alloc /= 2;
+            r->c = zrealloc(r->c,sizeof(roaringContainer)*r->alloc);
+        }
+    }
+    return 1;
+}
+
+int roaringFind(const roaring *r, int64_t value) {
+    uint64_t u = roaringBias(value);
+    int64_t idx = roaringSearch(r,u>>16);
+    return idx >= 0 && containerFind(r->c+idx,u&0xffff);
+}
+
+uint64_t roaringLen(const roaring *r) {
+    return r->card;
+}
+
+/* Store in '*value' the value with the given rank, 0 being the smallest.
+ * Returns 0 if 'rank' is out of range. */
+int roaringSelect(const roaring *r, uint64_t rank, int64_t *value) {
+    if (rank >= r->card) return 0;
+    for (uint32_t j = 0; j < r->len; j++) {
+        const roaringContainer *c = r->c+j;
+        if (rank >= c->card) {
+            rank -= c->card;
+            continue;
+        }
+        if (!containerIsBitmap(c)) {
+            *value = roaringUnbias(c->key,((uint16_t*)c->data)[rank]);
+            return 1;
+        }
+        const uint64_t *words = c->data;
+        for (uint32_t w = 0; w < ROARING_BITMAP_WORDS; w++) {
+            uint64_t bits = words[w];
+            uint32_t count = __builtin_popcountll(bits);
+            if (rank >= count) {
+                rank -= count;
+                continue;
+            }
+            while (rank--) bits &= bits-1;
+            *value = roaringUnbias(c->key,(w<<6)+__builtin_ctzll(bits));
+            return 1;
+        }
+    }
+    return 0; /* Not reached with a consistent cardinality. */
+}
+
+/* Return a random member of a non empty set. */
+int64_t roaringRandom(const roaring *r) {
+    uint64_t rank = ((uint64_t)rand()<<31) ^ (uint64_t)rand();
+    int64_t value = 0;
+
+    roaringSelect(r,rank % r->card,&value);
+    return value;
+}
+
+void roaringInitIterator(const roaring *r, roaringIterator *it) {
+    it->r = r;
+    it->ci = 0;
+    it->pos = 0;
+}
+
+/* Move the iterator to the first member greater than or equal to 'value'. */
+void roaringIteratorSeek(roaringIterator *it, int64_t value) {
+    uint64_t u = roaringBias(value);
+    int64_t idx = roaringSearch(it->r,u>>16);
+
+    if (idx < 0) {
+        it->ci = -idx-1;
+        it->pos = 0;
+        return;
+    }
+    const roaringContainer *c = it->r->c+idx;
+    it->ci = idx;
+    if (containerIsBitmap(c)) {
+        it->pos = u&0xffff;
+    } else {
+        int32_t pos = arraySearch(c->data,c->card,u&0xffff);
+        it->pos = pos >= 0 ? pos : -pos-1;
+    }
+}
+
+/* Store the next member in '*value'. Returns 0 when there are no more. */
+int roaringNext(roaringIterator *it, int64_t *value) {
+    while (it->ci < it->r->len) {
+        const roaringContainer *c = it->r->c+it->ci;
+        if (!containerIsBitmap(c)) {
+            if (it->pos < c->card) {
+                *value = roaringUnbias(c->key,((uint16_t*)c->data)[it->pos++]);
+                return 1;
+            }
+        } else {
+            const uint64_t *words = c->data;
+            uint32_t pos = it->pos;
+            while (pos < 65536) {
+                uint64_t bits = words[pos>>6] >> (pos&63);
+                if (bits) {
+                    pos += __builtin_ctzll(bits);
+                    *value = roaringUnbias(c->key,pos);
+                    it->pos = pos+1;
+                    return 1;
+                }
+                pos = (pos|63)+1;
+            }
+        }
+        it->ci++;
+        it->pos = 0;
+    }
+    return 0;
+}
+
+/* Return a new set with the members of both 'a' and 'b'. */
+roaring *roaringAnd(const roaring *a, const roaring *b) {
+    roaring *r = roaringNew();
+    uint32_t i = 0, j = 0;
+    roaringContainer c;
+
+    while (i < a->len && j < b->len) {
+        if (a->c[i].key < b->c[j].key) {
+            i++;
+        } else if (a->c[i].key > b->c[j].key) {
+            j++;
+        } else {
+            if (containerAnd(&c,a->c+i,b->c+j)) roaringAppendContainer(r,&c);
+            i++;
+            j++;
+        }
+    }
+    return r;
+}
+
+/* Return a new set with the members of 'a' or 'b'. */
+roaring *roaringOr(const roaring *a, const roaring *b) {
+    roaring *r = roaringNew();
+    uint32_t i = 0, j = 0;
+    roaringContainer c;
+
+    while (i < a->len || j < b->len) {
+        if (j == b->len || (i < a->len && a->c[i].key < b->c[j].key)) {
+            containerDup(&c,a->c+i++);
+        } else if (i == a->len || a->c[i].key > b->c[j].key) {
+            containerDup(&c,b->c+j++);
+        } else {
+            containerOr(&c,a->c+i++,b->c+j++);
+        }
+        roaringAppendContainer(r,&c);
+    }
+    return r;
+}
+
+/* Return a new set with the members of 'a' that are not in 'b'. */
+roaring *roaringAndNot(const roaring *a, const roaring *b) {
+    roaring *r = roaringNew();
+    uint32_t i = 0, j = 0;
+    roaringContainer c;
+
+    while (i < a->len) {
+        if (j == b->len || a->c[i].key < b->c[j].key) {
+            containerDup(&c,a->c+i++);
+            roaringAppendContainer(r,&c);
+        } else if (a->c[i].key > b->c[j].key) {
+            j++;
+        } else {
+            if (containerAndNot(&c,a->c+i,b->c+j)) roaringAppendContainer(r,&c);
+            i++;
+            j++;
+        }
+    }
+    return r;
+}
+
+/* Return the memory used by the set. */
+size_t roaringBlobLen(const roaring *r) {
+    size_t bytes = sizeof(*r)+sizeof(roaringContainer)*r->alloc;
+    for (uint32_t j = 0; j < r->len; j++) {
+        bytes += containerIsBitmap(r->c+j) ? ROARING_BITMAP_BYTES :
+                                             sizeof(uint16_t)*r->c[j].cap;
+    }
+    return bytes;
+}
+
+/* ---------------------------- Serialization ------------------------------- */
+
+#define ROARING_HDR_SIZE 4
+#define ROARING_CONTAINER_HDR_SIZE 12
+
+size_t roaringSerializedLen(const roaring *r) {
+    size_t len = ROARING_HDR_SIZE+(size_t)ROARING_CONTAINER_HDR_SIZE*r->len;
+    for (uint32_t j = 0; j < r->len; j++) {
+        len += containerIsBitmap(r->c+j) ? ROARING_BITMAP_BYTES :
+                                           sizeof(uint16_t)*r->c[j].card;
+    }
+    return len;
+}
+
+/* Write the set into 'buf', that must be roaringSerializedLen() bytes. */
+void roaringSerialize(const roaring *r, unsigned char *buf) {
+    uint32_t v32 = intrev32ifbe(r->len);
+
+    memcpy(buf,&v32,4);
+    buf += ROARING_HDR_SIZE;
+    for (uint32_t j = 0; j < r->len; j++) {
+        uint64_t key = intrev64ifbe(r->c[j].key);
+        uint32_t card = intrev32ifbe(r->c[j].card);
+        memcpy(buf,&key,8);
+        memcpy(buf+8,&card,4);
+        buf += ROARING_CONTAINER_HDR_SIZE;
+    }
+    for (uint32_t j = 0; j < r->len; j++) {
+        const roaringContainer *c = r->c+j;
+        if (containerIsBitmap(c)) {
+            const uint64_t *words = c->data;
+            for (int w = 0; w < ROARING_BITMAP_WORDS; w++) {
+                uint64_t v = intrev64ifbe(words[w]);
+                memcpy(buf,&v,8);
+                buf += 8;
+            }
+        } else {
+            const uint16_t *a = c->data;
+            for (uint32_t k = 0; k < c->card; k++) {
+                uint16_t v = intrev16ifbe(a[k]);
+                memcpy(buf,&v,2);
+                buf += 2;
+            }
+        }
+    }
+}
+
+/* Create a set from its serialized form. The input may come from an
+ * untrusted source like a RESTORE payload, so everything is validated:
+ * NULL is returned if the buffer is not a valid set. */
+roaring *roaringDeserialize(const unsigned char *buf, size_t len) {
+    const unsigned char *data;
+    size_t left;
+    uint32_t count;
+    roaring *r;
+
+    if (len < ROARING_HDR_SIZE) return NULL;
+    memcpy(&count,buf,4);
+    count = intrev32ifbe(count);
+    if ((len-ROARING_HDR_SIZE)/ROARING_CONTAINER_HDR_SIZE < count) return NULL;
+    data = buf+ROARING_HDR_SIZE+(size_t)ROARING_CONTAINER_HDR_SIZE*count;
+    left = len-ROARING_HDR_SIZE-(size_t)ROARING_CONTAINER_HDR_SIZE*count;
+
+    r = roaringNew();
+    if (count) {
+        r->c = zmalloc(sizeof(roaringContainer)*count);
+        r->alloc = count;
+    }
+    for (uint32_t j = 0; j < count; j++) {
+        const unsigned char *hdr = buf+ROARING_HDR_SIZE+
+                                   (size_t)ROARING_CONTAINER_HDR_SIZE*j;
+        roaringContainer *c = r->c+j;
+        uint64_t key;
+        uint32_t card;
+
+        memcpy(&key,hdr,8);
+        memcpy(&card,hdr+8,4);
+        key = intrev64ifbe(key);
+        card = intrev32ifbe(card);
+        if (key > ROARING_MAX_KEY || card == 0 || card > 65536) goto err;
+        if (j && key <= r->c[j-1].key) goto err;
+
+        c->key = key;
+        c->card = card;
+        if (containerIsBitmap(c)) {
+            if (left < ROARING_BITMAP_BYTES) goto err;
+            uint64_t *words = zmalloc(ROARING_BITMAP_BYTES);
+            for (int w = 0; w < ROARING_BITMAP_WORDS; w++) {
+                memcpy(words+w,data+w*8,8);
+                words[w] = intrev64ifbe(words[w]);
+            }
+            c->data = words;
+            c->cap = 0;
+            r->len++;
+            if (bitmapCount(words) != card) goto err;
+            data += ROARING_BITMAP_BYTES;
+            left -= ROARING_BITMAP_BYTES;
+        } else {
+            if (left < sizeof(uint16_t)*card) goto err;
+            uint16_t *a = zmalloc(sizeof(uint16_t)*card);
+            for (uint32_t k = 0; k < card; k++) {
+                memcpy(a+k,data+k*2,2);
+                a[k] = intrev16ifbe(a[k]);
+            }
+            c->data = a;
+            c->cap = card;
+            r->len++;
+            for (uint32_t k = 1; k < card; k++)
+                if (a[k] <= a[k-1]) goto err;
+            data += sizeof(uint16_t)*card;
+            left -= sizeof(uint16_t)*card;
+        }
+        r->card += card;
+    }
+    if (left != 0) goto err;
+    return r;
+
+err:
+    roaringFree(r);
+    return NULL;
+}
+
+#ifdef REDIS_TEST
+#include <assert.h>
+#include "intset.h"
+
+#define UNUSED(x) (void)(x)
+#define TEST(name) printf("test — %s\n", name);
+
+/* Values clustered around a few points, so that containers are filled
+ * enough to switch between arrays and bitmaps. */
+static int64_t roaringTestValue(void) {
+    static const int64_t base[] = {0,-70000,1LL<<40,INT64_MIN,INT64_MAX-9000};
+    return base[rand()%5]+rand()%9000;
+}
+
+static roaring *roaringTestCreate(int n, intset **ref) {
+    roaring *r = roaringNew();
+    *ref = intsetNew();
+    for (int j = 0; j < n; j++) {
+        int64_t v = roaringTestValue();
+        uint8_t added;
+        *ref = intsetAdd(*ref,v,&added);
+        assert(roaringAdd(r,v) == added);
+    }
+    assert(roaringLen(r) == intsetLen(*ref));
+    return r;
+}
+
+/* Check that the set has exactly the members of the intset, in order. */
+static void roaringTestCheck(const roaring *r, intset *ref) {
+    roaringIterator it;
+    int64_t v, expected;
+    uint32_t pos = 0;
+
+    roaringInitIterator(r,&it);
+    while (roaringNext(&it,&v)) {
+        assert(intsetGet(ref,pos++,&expected) && v == expected);
+    }
+    assert(pos == intsetLen(ref) && roaringLen(r) == pos);
+}
+
+int roaringTest(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+    roaring *r;
+    intset *ref;
+    int64_t v;
+
+    srand(1234);
+
+    TEST("Add, find and remove against an intset") {
+        r = roaringTestCreate(40000,&ref);
+        roaringTestCheck(r,ref);
+        for (int j = 0; j < 40000; j++) {
+            int64_t x = roaringTestValue();
+            assert(roaringFind(r,x) == intsetFind(ref,x));
+            if (j % 2) {
+                int removed;
+                ref = intsetRemove(ref,x,&removed);
+                assert(roaringRemove(r,x) == removed);
+            }
+        }
+        roaringTestCheck(r,ref);
+        roaringFree(r);
+        zfree(ref);
+    }
+
+    TEST("Containers switch between array and bitmap") {
+        r = roaringNew();
+        for (int j = 0; j < 10000; j++) assert(roaringAdd(r,j*2));
+        assert(roaringLen(r) == 10000 && r->len == 1);
+        assert(r->c[0].card > 4096 && r->c[0].cap == 0);
+        for (int j = 0; j < 10000; j++) {
+            if (j >= 10) assert(roaringRemove(r,j*2));
+        }
+        assert(roaringLen(r) == 10 && r->c[0].card == 10 && r->c[0].cap);
+        for (int j = 0; j < 10; j++) assert(roaringRemove(r,j*2));
+        assert(roaringLen(r) == 0 && r->len == 0);
+        roaringFree(r);
+    }
+
+    TEST("Select, random and seek") {
+        r = roaringTestCreate(20000,&ref);
+        for (uint32_t j = 0; j < intsetLen(ref); j += 7) {
+            int64_t expected;
+            intsetGet(ref,j,&expected);
+            assert(roaringSelect(r,j,&v) && v == expected);
+        }
+        assert(!roaringSelect(r,roaringLen(r),&v));
+        for (int j = 0; j < 1000; j++) assert(roaringFind(r,roaringRandom(r)));
+
+        roaringIterator it;
+        int64_t first;
+        roaringInitIterator(r,&it);
+        roaringIteratorSeek(&it,INT64_MIN);
+        assert(roaringSelect(r,0,&first));
+        assert(roaringNext(&it,&v) && v == first);
+        for (int j = 0; j < 1000; j++) {
+            int64_t from = roaringTestValue(), expected;
+            roaringInitIterator(r,&it);
+            roaringIteratorSeek(&it,from);
+            int found = roaringNext(&it,&v);
+            /* The first member not smaller than 'from'. */
+            uint32_t k;
+            for (k = 0; k < intsetLen(ref); k++) {
+                intsetGet(ref,k,&expected);
+                if (expected >= from) break;
+            }
+            if (k == intsetLen(ref)) assert(!found);
+            else assert(found && v == expected);
+        }
+        roaringFree(r);
+        zfree(ref);
+    }
+
+    TEST("And, or, and not against intsets") {
+        for (int round = 0; round < 20; round++) {
+            intset *ra, *rb, *expected = intsetNew();
+            roaring *a = roaringTestCreate(rand()%30000,&ra);
+            roaring *b = roaringTestCreate(rand()%30000,&rb);
+            int64_t x;
+
+            r = roaringAnd(a,b);
+            for (uint32_t j = 0; intsetGet(ra,j,&x); j++)
+                if (intsetFind(rb,x)) expected = intsetAdd(expected,x,NULL);
+            roaringTestCheck(r,expected);
+            roaringFree(r);
+            zfree(expected);
+
+            r = roaringOr(a,b);
+            expected = intsetNew();
+            for (uint32_t j = 0; intsetGet(ra,j,&x); j++)
+                expected = intsetAdd(expected,x,NULL);
+            for (uint32_t j = 0; intsetGet(rb,j,&x); j++)
+                expected = intsetAdd(expected,x,NULL);
+            roaringTestCheck(r,expected);
+            roaringFree(r);
+            zfree(expected);
+
+            r = roaringAndNot(a,b);
+            expected = intsetNew();
+            for (uint32_t j = 0; intsetGet(ra,j,&x); j++)
+                if (!intsetFind(rb,x)) expected = intsetAdd(expected,x,NULL);
+            roaringTestCheck(r,expected);
+            roaringFree(r);
+            zfree(expected);
+
+            roaringFree(a);
+            roaringFree(b);
+            zfree(ra);
+            zfree(rb);
+        }
+    }
+
+    TEST("Serialize, deserialize and reject corrupted input") {
+        r = roaringTestCreate(30000,&ref);
+        size_t len = roaringSerializedLen(r);
+        unsigned char *buf = zmalloc(len);
+        roaringSerialize(r,buf);
+
+        roaring *copy = roaringDeserialize(buf,len);
+        assert(copy != NULL);
+        roaringTestCheck(copy,ref);
+        roaringFree(copy);
+        copy = roaringDup(r);
+        roaringTestCheck(copy,ref);
+        roaringFree(copy);
+
+        assert(roaringDeserialize(buf,len-1) == NULL);
+        for (int j = 0; j < 2000; j++) {
+            size_t pos = rand() % len;
+            unsigned char old = buf[pos];
+            buf[pos] ^= 1 << (rand()%8);
+            copy = roaringDeserialize(buf,len);
+            /* A flipped bit may still be a valid set, but never a set
+             * with a different cardinality than its containers. */
+            if (copy) {
+                uint64_t card = 0;
+                roaringIterator it;
+                roaringInitIterator(copy,&it);
+                while (roaringNext(&it,&v)) card++;
+                assert(card == roaringLen(copy));
+                roaringFree(copy);
+            }
+            buf[pos] = old;
+        }
+        zfree(buf);
+        roaringFree(r);
+        zfree(ref);
+    }
+
+    printf("ALL TESTS PASSED!\n");
+    return 0;
+}
+#endif
@@ -0,0 +1,66 @@
+/* Roaring bitmap -- a compressed set of 64 bit signed integers.
+ *
+ * 值按高48位分组, 每组(container)只保存低16位: 元素少时是有序的uint16_t
+ * 数组, 元素多时是65536位的位图. 这样稠密的整数集合每个元素只占几个bit.
+ *
+ * Values are grouped by their high 48 bits, and every group (a container)
+ * only stores the low 16 bits of its values: as a sorted array of uint16_t
+ * while it holds up to ROARING_ARRAY_MAX values, as a 65536 bits bitmap
+ * after that. Dense sets of integers take a few bits per value, and
+ * intersections, unions and differences work a container at a time.
+ */
+
+#ifndef __ROARING_H
+#define __ROARING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* 一个container保存高48位相同的所有值 */
+typedef struct roaringContainer {
+    uint64_t key;       /* High 48 bits shared by all the values. */
+    uint32_t card;      /* Number of values, from 1 to 65536. */
+    uint32_t cap;       /* Allocated array slots, 0 for bitmaps. */
+    void *data;         /* Sorted uint16_t array, or 1024 uint64_t words. */
+} roaringContainer;
+
+typedef struct roaring {
+    uint64_t card;          /* Number of values of the whole set. */
+    uint32_t len;           /* Number of containers. */
+    uint32_t alloc;         /* Allocated containers. */
+    roaringContainer *c;    /* Containers, sorted by key. */
+} roaring;
+
+/* Iterates the values in ascending order. Not valid after the set is
+ * modified. */
+typedef struct roaringIterator {
+    const roaring *r;
+    uint32_t ci;        /* Current container. */
+    uint32_t pos;       /* Index in an array, or bit in a bitmap. */
+} roaringIterator;
+
+roaring *roaringNew(void);
+void roaringFree(roaring *r);
+roaring *roaringDup(const roaring *r);
+int roaringAdd(roaring *r, int64_t value);
+int roaringRemove(roaring *r, int64_t value);
+int roaringFind(const roaring *r, int64_t value);
+uint64_t roaringLen(const roaring *r);
+int roaringSelect(const roaring *r, uint64_t rank, int64_t *value);
+int64_t roaringRandom(const roaring *r);
+void roaringInitIterator(const roaring *r, roaringIterator *it);
+void roaringIteratorSeek(roaringIterator *it, int64_t value);
+int roaringNext(roaringIterator *it, int64_t *value);
+roaring *roaringAnd(const roaring *a, const roaring *b);
+roaring *roaringOr(const roaring *a, const roaring *b);
+roaring *roaringAndNot(const roaring *a, const roaring *b);
+size_t roaringBlobLen(const roaring *r);
+size_t roaringSerializedLen(const roaring *r);
+void roaringSerialize(const roaring *r, unsigned char *buf);
+roaring *roaringDeserialize(const unsigned char *buf, size_t len);
+
+#ifdef REDIS_TEST
+int roaringTest(int argc, char *argv[]);
+#endif
+
+#endif
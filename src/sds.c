@@ -157,6 +157,65 @@ sds sdsnewlen(const void *init, size_t initlen) {
     return s;
 }
 
+/* 返回在调用者提供的内存中创建长度为initlen的sds所需的字节数，包括结构头和'\0' */
+/* Return the number of bytes sdsnewplacement() needs in order to create
+ * a string of length 'initlen': header, string and implicit null term. */
+size_t sdsPlacementSize(size_t initlen) {
+    return sdsHdrSize(sdsReqType(initlen))+initlen+1;
+}
+
+/* 在调用者提供的buf中创建sds，buf至少要有sdsPlacementSize(initlen)字节。
+ * 这样创建的sds没有空闲空间，并且属于包含它的内存块，不能调用sdsfree释放，
+ * 也不能使用sdsMakeRoomFor等会重新分配内存的函数修改。 */
+/* Create an sds string inside the buffer 'buf', that must be at least
+ * sdsPlacementSize(initlen) bytes. The string has no free space and is
+ * owned by the allocation containing 'buf': it must never be passed to
+ * sdsfree() or to any function that may reallocate it. */
+sds sdsnewplacement(void *buf, const void *init, size_t initlen) {
+    char type = sdsReqType(initlen);
+    int hdrlen = sdsHdrSize(type);
+    sds s = (char*)buf+hdrlen;
+    unsigned char *fp = ((unsigned char*)s)-1;
+
+    switch(type) {
+        case SDS_TYPE_5: {
+            *fp = type | (initlen << SDS_TYPE_BITS);
+            break;
+        }
+        case SDS_TYPE_8: {
+            SDS_HDR_VAR(8,s);
+            sh->len = initlen;
+            sh->alloc = initlen;
+            *fp = type;
+            break;
+        }
+        case SDS_TYPE_16: {
+            SDS_HDR_VAR(16,s);
+            sh->len = initlen;
+            sh->alloc = initlen;
+            *fp = type;
+            break;
+        }
+        case SDS_TYPE_32: {
+            SDS_HDR_VAR(32,s);
+            sh->len = initlen;
+            sh->alloc = initlen;
+            *fp = type;
+            break;
+        }
+        case SDS_TYPE_64: {
+            SDS_HDR_VAR(64,s);
+            sh->len = initlen;
+            sh->alloc = initlen;
+            *fp = type;
+            break;
+        }
+    }
+    if (initlen) memcpy(s, init, initlen);
+    s[initlen] = '\0';
+    return s;
+}
+
 /* 创建一个空的sds，即使这样其也会存储一个'\0' */
 /* Create an empty (zero length) sds string. Even in this case the string
  * always has an implicit null term. */
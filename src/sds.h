@@ -228,6 +228,8 @@ static inline void sdssetalloc(sds s, size_t newlen) {
 sds sdsnewlen(const void *init, size_t initlen);
 sds sdsnew(const char *init);
 sds sdsempty(void);
+size_t sdsPlacementSize(size_t initlen);
+sds sdsnewplacement(void *buf, const void *init, size_t initlen);
 sds sdsdup(const sds s);
 void sdsfree(sds s);
 sds sdsgrowzero(sds s, size_t len);
@@ -483,6 +483,21 @@ void dictSdsDestructor(void *privdata, void *val)
     sdsfree(val);
 }
 
+/* 数据库字典的键嵌入在dictEntry中，避免为每个键单独分配一次内存 */
+size_t dictSdsEmbedLen(const void *key) {
+    return sdsPlacementSize(sdslen((sds)key));
+}
+
+void *dictSdsEmbed(void *buf, const void *key) {
+    return sdsnewplacement(buf,key,sdslen((sds)key));
+}
+
+/* 数据库字典实体的附加数据保存键的过期时间，见dbEntryGetExpire() */
+size_t dictExpireMetadataBytes(dict *d) {
+    DICT_NOTUSED(d);
+    return sizeof(int64_t);
+}
+
 int dictObjKeyCompare(void *privdata, const void *key1,
         const void *key2)
 {
@@ -575,14 +590,21 @@ dictType zsetDictType = {
     NULL                       /* val destructor */
 };
 
-/* Db->dict, keys are sds strings, vals are Redis objects. */
+/* Db->dict, keys are sds strings embedded in the dict entries, vals are
+ * Redis objects. The entry metadata holds the expire time of the key. The
+ * hash of the key is cached in the entries: the keyspace is the only dict
+ * big enough for the saved key accesses to be worth 8 bytes per entry. */
 dictType dbDictType = {
     dictSdsHash,                /* hash function */
     NULL,                       /* key dup */
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
-    dictSdsDestructor,          /* key destructor */
-    dictObjectDestructor   /* val destructor */
+    NULL,                       /* key destructor */
+    dictObjectDestructor,       /* val destructor */
+    dictSdsEmbedLen,            /* key embed len */
+    dictSdsEmbed,               /* key embed */
+    dictExpireMetadataBytes,    /* entry metadata bytes */
+    1                           /* store hash */
 };
 
 /* server.lua_scripts sha (as sds string) -> scripts (as robj) cache. */
@@ -595,16 +617,6 @@ dictType shaScriptObjectDictType = {
     dictObjectDestructor        /* val destructor */
 };
 
-/* Db->expires */
-dictType keyptrDictType = {
-    dictSdsHash,                /* hash function */
-    NULL,                       /* key dup */
-    NULL,                       /* val dup */
-    dictSdsKeyCompare,          /* key compare */
-    NULL,                       /* key destructor */
-    NULL                        /* val destructor */
-};
-
 /* Command table. sds string -> command struct pointer. */
 dictType commandTableDictType = {
     dictSdsCaseHash,            /* hash function */
@@ -615,7 +627,7 @@ dictType commandTableDictType = {
     NULL                        /* val destructor */
 };
 
-/* Hash type hash table (note that small hashes are represented with ziplists) */
+/* Hash type hash table (note that small hashes are represented with listpacks) */
 dictType hashDictType = {
     dictSdsHash,                /* hash function */
     NULL,                       /* key dup */
@@ -704,33 +716,62 @@ int htNeedsResize(dict *dict) {
 }
 
 /* If the percentage of used slots in the HT reaches HASHTABLE_MIN_FILL
- * we resize the hash table to save memory */
+ * we resize the hash table to save memory. Allocating the new table of a
+ * large dictionary is not free, so the time spent is reported to the latency
+ * monitor as the "rehash-resize" event. */
 void tryResizeHashTables(int dbid) {
+    mstime_t latency;
+
+    latencyStartMonitor(latency);
     if (htNeedsResize(server.db[dbid].dict))
         dictResize(server.db[dbid].dict);
-    if (htNeedsResize(server.db[dbid].expires))
-        dictResize(server.db[dbid].expires);
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("rehash-resize",latency);
+}
+
+/* Return the time budget, in microseconds, for the active rehashing performed
+ * at every databasesCron() call. We want to spend ACTIVE_REHASH_CPU_PERC
+ * percent of the CPU time regardless of the configured "hz" (that is one
+ * millisecond per call with the default hz of 10): with an higher hz the
+ * work is split in more, shorter, steps.
+ *
+ * When the latency monitor is enabled we also never use more than half of
+ * its threshold, since a rehashing step is not something the user can
+ * avoid, while the threshold is the latency the user is willing to accept. */
+long long activeRehashingBudget(void) {
+    long long budget = 1000000/server.hz*ACTIVE_REHASH_CPU_PERC/100;
+
+    if (server.latency_monitor_threshold &&
+        budget > server.latency_monitor_threshold*1000/2)
+        budget = server.latency_monitor_threshold*1000/2;
+    if (budget < ACTIVE_REHASH_MIN_BUDGET) budget = ACTIVE_REHASH_MIN_BUDGET;
+    return budget;
 }
 
 /* Our hash table implementation performs rehashing incrementally while
  * we write/read from the hash table. Still if the server is idle, the hash
- * table will use two tables for a long time. So we try to use 1 millisecond
- * of CPU time at every call of this function to perform some rehahsing.
+ * table will use two tables for a long time. So we try to use a small
+ * amount of CPU time (see activeRehashingBudget()) at every call of this
+ * function to perform some rehahsing. Every step is reported to the latency
+ * monitor as the "rehash-cron" event.
  *
  * The function returns 1 if some rehashing was performed, otherwise 0
  * is returned. */
 int incrementallyRehash(int dbid) {
-    /* Keys dictionary */
-    if (dictIsRehashing(server.db[dbid].dict)) {
-        dictRehashMilliseconds(server.db[dbid].dict,1);
-        return 1; /* already used our millisecond for this loop... */
-    }
-    /* Expires */
-    if (dictIsRehashing(server.db[dbid].expires)) {
-        dictRehashMilliseconds(server.db[dbid].expires,1);
-        return 1; /* already used our millisecond for this loop... */
-    }
-    return 0;
+    dict *d = server.db[dbid].dict;
+    ttlWheel *expires = server.db[dbid].expires;
+    mstime_t latency;
+
+    if (!dictIsRehashing(d) && !ttlWheelIsRehashing(expires)) return 0;
+
+    latencyStartMonitor(latency);
+    if (dictIsRehashing(d)) /* Keys dictionary */
+        dictRehashMicroseconds(d,activeRehashingBudget());
+    else /* Expires */
+        ttlWheelRehashMicroseconds(expires,activeRehashingBudget());
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("rehash-cron",latency);
+    return 1; /* already used our budget for this loop... */
 }
 
 /* This function is called once a background process of some kind terminates,
@@ -816,9 +857,20 @@ int clientsCronHandleTimeout(client *c, mstime_t now_ms) {
  *
  * The function always returns 0 as it never terminates the client. */
 int clientsCronResizeQueryBuffer(client *c) {
-    size_t querybuf_size = sdsAllocSize(c->querybuf);
+    size_t querybuf_size;
     time_t idletime = server.unixtime - c->lastinteraction;
 
+    /* Give back the buffers of clients with nothing to parse or to send.
+     * Reset the peak of the replies, so that the size of the next reply
+     * buffer follows the recent traffic of the client. */
+    releaseClientBuffersIfIdle(c);
+    c->buf_peak = c->bufpos;
+    if (c->querybuf == NULL) {
+        c->querybuf_peak = 0;
+        return 0;
+    }
+    querybuf_size = sdsAllocSize(c->querybuf);
+
     /* There are two conditions to resize the query buffer:
      * 1) Query buffer is > BIG_ARG and too big for latest peak.
      * 2) Client is inactive and the buffer is bigger than 1k. */
@@ -1013,7 +1065,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 
             size = dictSlots(server.db[j].dict);
             used = dictSize(server.db[j].dict);
-            vkeys = dictSize(server.db[j].expires);
+            vkeys = ttlWheelSize(server.db[j].expires);
             if (used || vkeys) {
                 serverLog(LL_VERBOSE,"DB %d: %lld keys (%lld volatile) in %lld slots HT.",j,used,vkeys,size);
                 /* dictPrintStats(server.dict); */
@@ -1046,14 +1098,23 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
         rewriteAppendOnlyFileBackground();
     }
 
+    /* 无 fork 快照在这里推进一部分.
+     * Make progress with the forkless snapshot in progress, if any. */
+    if (rdbForklessSaveInProgress())
+        rdbSaveForklessCron(RDB_FORKLESS_SAVE_SLOW);
+
     /* Check if a background saving or AOF rewrite in progress terminated. */
     if (server.rdb_child_pid != -1 || server.aof_child_pid != -1 ||
         ldbPendingChildren())
     {
         int statloc;
         pid_t pid;
+        /* A forkless snapshot has no child to wait for. */
+        int haschild = (server.rdb_child_pid != -1 &&
+                        !rdbForklessSaveInProgress()) ||
+                       server.aof_child_pid != -1 || ldbPendingChildren();
 
-        if ((pid = wait3(&statloc,WNOHANG,NULL)) != 0) {
+        if (haschild && (pid = wait3(&statloc,WNOHANG,NULL)) != 0) {
             int exitcode = WEXITSTATUS(statloc);
             int bysignal = 0;
 
@@ -1162,6 +1223,9 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
         migrateCloseTimedoutSockets();
     }
 
+    /* Free the client buffers that stayed unused in the pool. */
+    run_with_period(1000) clientBufPoolTrim();
+
     /* Start a scheduled BGSAVE if the corresponding flag is set. This is
      * useful when we are forced to postpone a BGSAVE because an AOF
      * rewrite is in progress.
@@ -1190,6 +1254,11 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 void beforeSleep(struct aeEventLoop *eventLoop) {
     UNUSED(eventLoop);
 
+    /* Process the clients with pending reads queued by the readable handler
+     * when threaded I/O is active: this reads and parses the queries using
+     * the I/O threads, then executes the commands. */
+    handleClientsWithPendingReadsUsingThreads();
+
     /* Call the Redis Cluster before sleep function. Note that this function
      * may change the state of Redis Cluster (from ok to fail or vice versa),
      * so it's a good idea to call it before serving the unblocked clients
@@ -1201,6 +1270,10 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     if (server.active_expire_enabled && server.masterhost == NULL)
         activeExpireCycle(ACTIVE_EXPIRE_CYCLE_FAST);
 
+    /* Save a few more keys of the forkless snapshot in progress. */
+    if (rdbForklessSaveInProgress())
+        rdbSaveForklessCron(RDB_FORKLESS_SAVE_FAST);
+
     /* Send all the slaves an ACK request if at least one client blocked
      * during the previous event loop iteration. */
     if (server.get_ack_from_slaves) {
@@ -1233,7 +1306,11 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     flushAppendOnlyFile(0);
 
     /* Handle writes with pending output buffers. */
-    handleClientsWithPendingWrites();
+    handleClientsWithPendingWritesUsingThreads();
+
+    /* Close clients that need to be closed asynchronously: with threaded
+     * I/O this is also where clients that got an I/O error are released. */
+    freeClientsInAsyncFreeQueue();
 
     /* Before we are going to sleep, let the threads access the dataset by
      * releasing the GIL. Redis main thread will not touch anything at this
@@ -1352,6 +1429,8 @@ void initServerConfig(void) {
     pthread_mutex_init(&server.next_client_id_mutex,NULL);
     pthread_mutex_init(&server.lruclock_mutex,NULL);
     pthread_mutex_init(&server.unixtime_mutex,NULL);
+    pthread_mutex_init(&server.stat_net_input_bytes_mutex,NULL);
+    pthread_mutex_init(&server.stat_net_output_bytes_mutex,NULL);
 
     /* 随机一个运行id */
     getRandomHexChars(server.runid,CONFIG_RUN_ID_SIZE);
@@ -1410,12 +1489,21 @@ void initServerConfig(void) {
     server.aof_rewrite_incremental_fsync = CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC;
     server.aof_load_truncated = CONFIG_DEFAULT_AOF_LOAD_TRUNCATED;
     server.aof_use_rdb_preamble = CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE;
+    server.aof_multi_part = CONFIG_DEFAULT_AOF_MULTI_PART;
+    server.aof_dirname = zstrdup(CONFIG_DEFAULT_AOF_DIRNAME);
+    server.aof_manifest = NULL;
+    server.aof_last_incr_size = 0;
+    server.aof_rewrite_incr_seq = -1;
     server.pidfile = NULL;
     server.rdb_filename = zstrdup(CONFIG_DEFAULT_RDB_FILENAME);
     server.aof_filename = zstrdup(CONFIG_DEFAULT_AOF_FILENAME);
     server.requirepass = NULL;
     server.rdb_compression = CONFIG_DEFAULT_RDB_COMPRESSION;
     server.rdb_checksum = CONFIG_DEFAULT_RDB_CHECKSUM;
+    server.rdb_threaded_loading = CONFIG_DEFAULT_RDB_THREADED_LOADING;
+    server.rdb_segment_threads = CONFIG_DEFAULT_RDB_SEGMENT_THREADS;
+    server.rdb_forkless_save = CONFIG_DEFAULT_RDB_FORKLESS_SAVE;
+    server.rdb_compression_codec = CONFIG_DEFAULT_RDB_COMPRESSION_CODEC;
     server.stop_writes_on_bgsave_err = CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     server.activerehashing = CONFIG_DEFAULT_ACTIVE_REHASHING;
     server.active_defrag_running = 0;
@@ -1427,13 +1515,15 @@ void initServerConfig(void) {
     server.maxmemory_samples = CONFIG_DEFAULT_MAXMEMORY_SAMPLES;
     server.lfu_log_factor = CONFIG_DEFAULT_LFU_LOG_FACTOR;
     server.lfu_decay_time = CONFIG_DEFAULT_LFU_DECAY_TIME;
-    server.hash_max_ziplist_entries = OBJ_HASH_MAX_ZIPLIST_ENTRIES;
-    server.hash_max_ziplist_value = OBJ_HASH_MAX_ZIPLIST_VALUE;
-    server.list_max_ziplist_size = OBJ_LIST_MAX_ZIPLIST_SIZE;
+    server.hash_max_listpack_entries = OBJ_HASH_MAX_LISTPACK_ENTRIES;
+    server.hash_max_listpack_value = OBJ_HASH_MAX_LISTPACK_VALUE;
+    server.list_max_listpack_size = OBJ_LIST_MAX_LISTPACK_SIZE;
     server.list_compress_depth = OBJ_LIST_COMPRESS_DEPTH;
+    server.list_compression_codec = OBJ_LIST_COMPRESSION_CODEC;
     server.set_max_intset_entries = OBJ_SET_MAX_INTSET_ENTRIES;
-    server.zset_max_ziplist_entries = OBJ_ZSET_MAX_ZIPLIST_ENTRIES;
-    server.zset_max_ziplist_value = OBJ_ZSET_MAX_ZIPLIST_VALUE;
+    server.set_roaring_encoding = CONFIG_DEFAULT_SET_ROARING_ENCODING;
+    server.zset_max_listpack_entries = OBJ_ZSET_MAX_LISTPACK_ENTRIES;
+    server.zset_max_listpack_value = OBJ_ZSET_MAX_LISTPACK_VALUE;
     server.hll_sparse_max_bytes = CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES;
     server.shutdown_asap = 0;
     server.cluster_enabled = 0;
@@ -1451,6 +1541,9 @@ void initServerConfig(void) {
     server.lazyfree_lazy_eviction = CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION;
     server.lazyfree_lazy_expire = CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE;
     server.lazyfree_lazy_server_del = CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL;
+    server.io_threads_num = CONFIG_DEFAULT_IO_THREADS_NUM;
+    server.io_threads_do_reads = CONFIG_DEFAULT_IO_THREADS_DO_READS;
+    server.io_uring = CONFIG_DEFAULT_IO_URING;
     server.always_show_logo = CONFIG_DEFAULT_ALWAYS_SHOW_LOGO;
     server.lua_time_limit = LUA_SCRIPT_TIME_LIMIT;
 
@@ -1480,6 +1573,7 @@ void initServerConfig(void) {
     server.repl_disable_tcp_nodelay = CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY;
     server.repl_diskless_sync = CONFIG_DEFAULT_REPL_DISKLESS_SYNC;
     server.repl_diskless_sync_delay = CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY;
+    server.repl_diskless_compression_codec = CONFIG_DEFAULT_REPL_DISKLESS_COMPRESSION_CODEC;
     server.repl_ping_slave_period = CONFIG_DEFAULT_REPL_PING_SLAVE_PERIOD;
     server.repl_timeout = CONFIG_DEFAULT_REPL_TIMEOUT;
     server.repl_min_slaves_to_write = CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE;
@@ -1526,10 +1620,14 @@ void initServerConfig(void) {
 
     /* Slow log */
     server.slowlog_log_slower_than = CONFIG_DEFAULT_SLOWLOG_LOG_SLOWER_THAN;
+    server.slowlog_log_queue_delay_slower_than = CONFIG_DEFAULT_SLOWLOG_LOG_QUEUE_DELAY_SLOWER_THAN;
     server.slowlog_max_len = CONFIG_DEFAULT_SLOWLOG_MAX_LEN;
 
     /* Latency monitor */
     server.latency_monitor_threshold = CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD;
+    server.latency_tracking = CONFIG_DEFAULT_LATENCY_TRACKING;
+    server.latency_tracking_info_percentiles = NULL;
+    latencySetInfoPercentiles(CONFIG_DEFAULT_LATENCY_TRACKING_INFO_PERCENTILES);
 
     /* Debugging */
     server.assert_failed = "<no assertion failed>";
@@ -1541,6 +1639,17 @@ void initServerConfig(void) {
 
 extern char **environ;
 
+/* Unregister all the file events of the server, before closing the
+ * descriptors to exit or restart: the io_uring backend keeps the polled
+ * sockets open until their polls are cancelled, so without this clients
+ * could still connect for a moment after the listening sockets are closed. */
+void deleteAllFileEvents(void) {
+    int j;
+
+    for (j = 0; j <= server.el->maxfd; j++)
+        aeDeleteFileEvent(server.el,j,AE_READABLE|AE_WRITABLE);
+}
+
 /* Restart the server, executing the same executable that started this
  * instance, with the same arguments and configuration file.
  *
@@ -1585,6 +1694,8 @@ int restartServer(int flags, mstime_t delay) {
         return C_ERR;
     }
 
+    deleteAllFileEvents();
+
     /* Close all file descriptors, with the exception of stdin, stdout, strerr
      * which are useful if we restart a Redis server which is not daemonized. */
     for (j = 3; j < (int)server.maxclients + 1024; j++) {
@@ -1794,6 +1905,10 @@ void resetServerStats(void) {
     int j;
 
     server.stat_numcommands = 0;
+    server.stat_queue_delay = 0;
+    server.stat_queue_delay_max = 0;
+    zfree(server.queue_delay_histogram);
+    server.queue_delay_histogram = NULL;
     server.stat_numconnections = 0;
     server.stat_expiredkeys = 0;
     server.stat_evictedkeys = 0;
@@ -1818,6 +1933,8 @@ void resetServerStats(void) {
     }
     server.stat_net_input_bytes = 0;
     server.stat_net_output_bytes = 0;
+    server.stat_io_reads_processed = 0;
+    server.stat_io_writes_processed = 0;
     server.aof_delayed_fsync = 0;
 }
 
@@ -1835,12 +1952,14 @@ void initServer(void) {
     }
 
     server.pid = getpid();
+    server.main_thread_id = pthread_self();
     server.current_client = NULL;
     server.clients = listCreate();
     server.clients_to_close = listCreate();
     server.slaves = listCreate();
     server.monitors = listCreate();
     server.clients_pending_write = listCreate();
+    server.clients_pending_read = listCreate();
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */
     server.unblocked_clients = listCreate();
     server.ready_keys = listCreate();
@@ -1859,6 +1978,11 @@ void initServer(void) {
             strerror(errno));
         exit(1);
     }
+    if (server.io_uring && aeUseIouring(server.el) == AE_ERR) {
+        serverLog(LL_WARNING,
+            "io_uring is not supported by this build or kernel, "
+            "using %s instead.", aeGetApiName(server.el));
+    }
     server.db = zmalloc(sizeof(redisDb)*server.dbnum); /* 申请数据库结构内存 */
 
     /* 监听端口 */
@@ -1891,7 +2015,7 @@ void initServer(void) {
     /* Create the Redis databases, and initialize other internal state. */
     for (j = 0; j < server.dbnum; j++) {
         server.db[j].dict = dictCreate(&dbDictType,NULL);
-        server.db[j].expires = dictCreate(&keyptrDictType,NULL);
+        server.db[j].expires = expiresIndexCreate(server.db[j].dict);
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].ready_keys = dictCreate(&objectKeyPointerValueDictType,NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
@@ -1965,7 +2089,9 @@ void initServer(void) {
     }
 
     /* Open the AOF file if needed. */
-    if (server.aof_state == AOF_ON) {
+    if (server.aof_multi_part) {
+        aofOpenIfNeededOnServerStart();
+    } else if (server.aof_state == AOF_ON) {
         server.aof_fd = open(server.aof_filename,
                                O_WRONLY|O_APPEND|O_CREAT,0644);
         if (server.aof_fd == -1) {
@@ -1991,6 +2117,7 @@ void initServer(void) {
     slowlogInit();
     latencyMonitorInit();
     bioInit();
+    initThreadedIO();
     server.initial_memory_usage = zmalloc_used_memory();
 }
 
@@ -2043,6 +2170,9 @@ void resetCommandTableStats(void) {
         c = (struct redisCommand *) dictGetVal(de);
         c->microseconds = 0;
         c->calls = 0;
+        c->queue_microseconds = 0;
+        zfree(c->latency_histogram);
+        c->latency_histogram = NULL;
     }
     dictReleaseIterator(di);
 
@@ -2225,9 +2355,13 @@ void preventCommandReplication(client *c) {
  *
  */
 void call(client *c, int flags) {
-    long long dirty, start, duration;
+    long long dirty, start, duration, queue_delay = c->queue_delay;
     int client_old_flags = c->flags;
 
+    /* The queue delay only belongs to the command read from the client, not
+     * to the commands it may call, like the ones queued by MULTI. */
+    c->queue_delay = 0;
+
     /* Sent the command to clients in MONITOR mode, only if the commands are
      * not generated from reading an AOF. */
     if (listLength(server.monitors) &&
@@ -2272,11 +2406,17 @@ void call(client *c, int flags) {
         char *latency_event = (c->cmd->flags & CMD_FAST) ?
                               "fast-command" : "command";
         latencyAddSampleIfNeeded(latency_event,duration/1000);
-        slowlogPushEntryIfNeeded(c,c->argv,c->argc,duration);
+        slowlogPushEntryIfNeeded(c,c->argv,c->argc,duration,queue_delay);
     }
     if (flags & CMD_CALL_STATS) {
         c->lastcmd->microseconds += duration;
         c->lastcmd->calls++;
+        if (server.latency_tracking) {
+            if (c->lastcmd->latency_histogram == NULL)
+                c->lastcmd->latency_histogram = latencyHistogramCreate();
+            latencyHistogramRecord(c->lastcmd->latency_histogram,
+                                   duration > 0 ? duration : 0);
+        }
     }
 
     /* Propagate the command into the AOF and replication link */
@@ -2341,6 +2481,27 @@ void call(client *c, int flags) {
     server.stat_numcommands++;
 }
 
+/* Account the queue delay of the command about to be executed by the client,
+ * that is the time elapsed since the command was read from the socket. The
+ * delay is also stored in the client so that call() can log the command in
+ * the slow log if needed. */
+void trackQueueDelay(client *c) {
+    long long delay = ustime() - c->cmd_read_time;
+
+    if (delay < 0) delay = 0;
+    c->queue_delay = delay;
+    c->cmd->queue_microseconds += delay;
+    server.stat_queue_delay += delay;
+    if (delay > server.stat_queue_delay_max)
+        server.stat_queue_delay_max = delay;
+    if (server.latency_tracking) {
+        if (server.queue_delay_histogram == NULL)
+            server.queue_delay_histogram = latencyHistogramCreate();
+        latencyHistogramRecord(server.queue_delay_histogram,delay);
+    }
+    latencyAddSampleIfNeeded("queue-delay",delay/1000);
+}
+
 /* If this function gets called we already read a whole
  * command, arguments are in the client argv/argc fields.
  * processCommand() execute the command or prepare the
@@ -2519,11 +2680,16 @@ int processCommand(client *c) {
         return C_OK;
     }
 
+    /* Account the time the command waited in the query buffer, behind
+     * other commands of the same client or of other clients. */
+    if (c->cmd_read_time) trackQueueDelay(c);
+
     /* Exec the command */
     if (c->flags & CLIENT_MULTI &&
         c->cmd->proc != execCommand && c->cmd->proc != discardCommand &&
         c->cmd->proc != multiCommand && c->cmd->proc != watchCommand)
     {
+        c->queue_delay = 0;
         queueMultiCommand(c);
         addReply(c,shared.queued);
     } else {
@@ -2566,8 +2732,7 @@ int prepareForShutdown(int flags) {
        overwrite the synchronous saving did by SHUTDOWN. */
     if (server.rdb_child_pid != -1) {
         serverLog(LL_WARNING,"There is a child saving an .rdb. Killing it!");
-        kill(server.rdb_child_pid,SIGUSR1);
-        rdbRemoveTempFile(server.rdb_child_pid);
+        killRDBChild();
     }
 
     if (server.aof_state != AOF_OFF) {
@@ -2618,6 +2783,7 @@ int prepareForShutdown(int flags) {
     flushSlavesOutputBuffers();
 
     /* Close the listening sockets. Apparently this allows faster restarts. */
+    deleteAllFileEvents();
     closeListeningSockets(1);
     serverLog(LL_WARNING,"%s is now ready to exit, bye bye...",
         server.sentinel_mode ? "Sentinel" : "Redis");
@@ -2910,7 +3076,7 @@ sds genRedisInfoString(char *section) {
             mode,
             name.sysname, name.release, name.machine,
             server.arch_bits,
-            aeGetApiName(),
+            aeGetApiName(server.el),
             REDIS_ATOMIC_API,
 #ifdef __GNUC__
             __GNUC__,__GNUC_MINOR__,__GNUC_PATCHLEVEL__,
@@ -2994,7 +3160,9 @@ sds genRedisInfoString(char *section) {
             "mem_fragmentation_ratio:%.2f\r\n"
             "mem_allocator:%s\r\n"
             "active_defrag_running:%d\r\n"
-            "lazyfree_pending_objects:%zu\r\n",
+            "lazyfree_pending_objects:%zu\r\n"
+            "mem_clients_buffers:%zu\r\n"
+            "mem_clients_buffers_pool:%zu\r\n",
             zmalloc_used,
             hmem,
             server.resident_set_size,
@@ -3016,7 +3184,9 @@ sds genRedisInfoString(char *section) {
             mh->fragmentation,
             ZMALLOC_LIB,
             server.active_defrag_running,
-            lazyfreeGetPendingObjectsCount()
+            lazyfreeGetPendingObjectsCount(),
+            mh->clients_buffers,
+            mh->clients_buffers_pool
         );
         freeMemoryOverheadData(mh);
     }
@@ -3061,6 +3231,14 @@ sds genRedisInfoString(char *section) {
             (server.aof_last_write_status == C_OK) ? "ok" : "err",
             server.stat_aof_cow_bytes);
 
+        if (rdbForklessSaveInProgress()) {
+            info = sdscatprintf(info,
+                "rdb_forkless_saved_on_write:%llu\r\n"
+                "rdb_forkless_overhead:%zu\r\n",
+                rdbSaveForklessSavedOnWrite(),
+                rdbSaveForklessOverhead());
+        }
+
         if (server.aof_state != AOF_OFF) {
             info = sdscatprintf(info,
                 "aof_current_size:%lld\r\n"
@@ -3101,12 +3279,20 @@ sds genRedisInfoString(char *section) {
                 "loading_total_bytes:%llu\r\n"
                 "loading_loaded_bytes:%llu\r\n"
                 "loading_loaded_perc:%.2f\r\n"
-                "loading_eta_seconds:%jd\r\n",
+                "loading_eta_seconds:%jd\r\n"
+                "loading_loaded_keys:%lld\r\n"
+                "loading_bytes_per_sec:%lld\r\n"
+                "loading_keys_per_sec:%lld\r\n"
+                "loading_threaded:%d\r\n",
                 (intmax_t) server.loading_start_time,
                 (unsigned long long) server.loading_total_bytes,
                 (unsigned long long) server.loading_loaded_bytes,
                 perc,
-                (intmax_t)eta
+                (intmax_t)eta,
+                server.loading_loaded_keys,
+                (long long) (elapsed ? server.loading_loaded_bytes/elapsed : 0),
+                (long long) (elapsed ? server.loading_loaded_keys/elapsed : 0),
+                server.loading_threaded
             );
         }
     }
@@ -3139,7 +3325,12 @@ sds genRedisInfoString(char *section) {
             "active_defrag_hits:%lld\r\n"
             "active_defrag_misses:%lld\r\n"
             "active_defrag_key_hits:%lld\r\n"
-            "active_defrag_key_misses:%lld\r\n",
+            "active_defrag_key_misses:%lld\r\n"
+            "io_threads_active:%d\r\n"
+            "io_threaded_reads_processed:%lld\r\n"
+            "io_threaded_writes_processed:%lld\r\n"
+            "total_queue_delay_usec:%lld\r\n"
+            "max_queue_delay_usec:%lld\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getInstantaneousMetric(STATS_METRIC_COMMAND),
@@ -3163,7 +3354,12 @@ sds genRedisInfoString(char *section) {
             server.stat_active_defrag_hits,
             server.stat_active_defrag_misses,
             server.stat_active_defrag_key_hits,
-            server.stat_active_defrag_key_misses);
+            server.stat_active_defrag_key_misses,
+            server.io_threads_active,
+            server.stat_io_reads_processed,
+            server.stat_io_writes_processed,
+            server.stat_queue_delay,
+            server.stat_queue_delay_max);
     }
 
     /* Replication */
@@ -3322,13 +3518,56 @@ sds genRedisInfoString(char *section) {
             c = (struct redisCommand *) dictGetVal(de);
             if (!c->calls) continue;
             info = sdscatprintf(info,
-                "cmdstat_%s:calls=%lld,usec=%lld,usec_per_call=%.2f\r\n",
+                "cmdstat_%s:calls=%lld,usec=%lld,usec_per_call=%.2f,"
+                "queue_usec=%lld,queue_usec_per_call=%.2f\r\n",
                 c->name, c->calls, c->microseconds,
-                (c->calls == 0) ? 0 : ((float)c->microseconds/c->calls));
+                (c->calls == 0) ? 0 : ((float)c->microseconds/c->calls),
+                c->queue_microseconds,
+                (c->calls == 0) ? 0 : ((float)c->queue_microseconds/c->calls));
         }
         dictReleaseIterator(di);
     }
 
+    /* Latency percentiles of every command, from the latency histograms. */
+    if (allsections || !strcasecmp(section,"latencystats")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info, "# Latencystats\r\n");
+
+        struct redisCommand *c;
+        dictEntry *de;
+        dictIterator *di;
+        int j;
+        di = dictGetSafeIterator(server.commands);
+        while((de = dictNext(di)) != NULL) {
+            c = (struct redisCommand *) dictGetVal(de);
+            if (!c->latency_histogram || !c->latency_histogram->count)
+                continue;
+            info = sdscatprintf(info,"latency_percentiles_usec_%s:",c->name);
+            for (j = 0; j < server.latency_tracking_info_percentiles_len; j++) {
+                double p = server.latency_tracking_info_percentiles[j];
+                info = sdscatprintf(info,"%sp%g=%llu", j ? "," : "", p,
+                    (unsigned long long)
+                    latencyHistogramPercentile(c->latency_histogram,p));
+            }
+            info = sdscatlen(info,"\r\n",2);
+        }
+        dictReleaseIterator(di);
+
+        /* Queue delay of all the commands. */
+        if (server.queue_delay_histogram &&
+            server.queue_delay_histogram->count)
+        {
+            info = sdscat(info,"queue_delay_percentiles_usec:");
+            for (j = 0; j < server.latency_tracking_info_percentiles_len; j++) {
+                double p = server.latency_tracking_info_percentiles[j];
+                info = sdscatprintf(info,"%sp%g=%llu", j ? "," : "", p,
+                    (unsigned long long)
+                    latencyHistogramPercentile(server.queue_delay_histogram,p));
+            }
+            info = sdscatlen(info,"\r\n",2);
+        }
+    }
+
     /* Cluster */
     if (allsections || defsections || !strcasecmp(section,"cluster")) {
         if (sections++) info = sdscat(info,"\r\n");
@@ -3346,7 +3585,7 @@ sds genRedisInfoString(char *section) {
             long long keys, vkeys;
 
             keys = dictSize(server.db[j].dict);
-            vkeys = dictSize(server.db[j].expires);
+            vkeys = ttlWheelSize(server.db[j].expires);
             if (keys || vkeys) {
                 info = sdscatprintf(info,
                     "db%d:keys=%lld,expires=%lld,avg_ttl=%lld\r\n",
@@ -3571,7 +3810,7 @@ int checkForSentinelMode(int argc, char **argv) {
 void loadDataFromDisk(void) {
     long long start = ustime();
     if (server.aof_state == AOF_ON) {
-        if (loadAppendOnlyFile(server.aof_filename) == C_OK)
+        if (loadAppendOnlyFiles() == C_OK)
             serverLog(LL_NOTICE,"DB loaded from append only file: %.3f seconds",(float)(ustime()-start)/1000000);
     } else {
         rdbSaveInfo rsi = RDB_SAVE_INFO_INIT;
@@ -3730,10 +3969,18 @@ int main(int argc, char **argv) {
     if (argc == 3 && !strcasecmp(argv[1], "test")) {
         if (!strcasecmp(argv[2], "ziplist")) {
             return ziplistTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "listpack")) {
+            return listpackTest(argc, argv);
         } else if (!strcasecmp(argv[2], "quicklist")) {
             quicklistTest(argc, argv);
         } else if (!strcasecmp(argv[2], "intset")) {
             return intsetTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "roaring")) {
+            return roaringTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "zbtree")) {
+            return zbtreeTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "ttlwheel")) {
+            return ttlwheelTest(argc, argv);
         } else if (!strcasecmp(argv[2], "zipmap")) {
             return zipmapTest(argc, argv);
         } else if (!strcasecmp(argv[2], "sha1test")) {
@@ -3746,6 +3993,8 @@ int main(int argc, char **argv) {
             return endianconvTest(argc, argv);
         } else if (!strcasecmp(argv[2], "crc64")) {
             return crc64Test(argc, argv);
+        } else if (!strcasecmp(argv[2], "ae")) {
+            return aeTest(argc, argv);
         }
 
         return -1; /* test not found */
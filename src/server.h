@@ -58,7 +58,10 @@ typedef long long mstime_t; /* millisecond time type. */ /* 表示毫秒时间
 #include "zmalloc.h" /* total memory usage aware version of malloc/free */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
+#include "listpack.h" /* Compact list data structure without cascade updates */
 #include "intset.h"  /* Compact integer set structure */
+#include "roaring.h" /* Compressed bitmap of integers */
+#include "zbtree.h"  /* Ordered index of sorted sets */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
 #include "latency.h" /* Latency monitor API */
@@ -66,6 +69,8 @@ typedef long long mstime_t; /* millisecond time type. */ /* 表示毫秒时间
 #include "quicklist.h"  /* Lists are encoded as linked lists of
                            N-elements flat arrays */
 #include "rax.h"     /* Radix tree */
+#include "ttlwheel.h" /* Timing wheel of the keys with an expire */
+#include "codec.h"   /* Compression codecs */
 
 /* Following includes allow test functions to be called from Redis main() */
 #include "zipmap.h"
@@ -88,6 +93,8 @@ typedef long long mstime_t; /* millisecond time type. */ /* 表示毫秒时间
 #define CONFIG_MAX_LINE    1024
 #define CRON_DBS_PER_CALL 16
 #define NET_MAX_WRITES_PER_EVENT (1024*64)
+#define NET_MAX_WRITEV_IOVCNT 128 /* Max iovecs per writev() to a client. */
+#define NET_BATCH_IOVCNT 16 /* Max iovecs per client in a batched write. */
 #define PROTO_SHARED_SELECT_CMDS 10
 #define OBJ_SHARED_INTEGERS 10000
 #define OBJ_SHARED_BULKHDR_LEN 32
@@ -97,6 +104,7 @@ typedef long long mstime_t; /* millisecond time type. */ /* 表示毫秒时间
 #define AOF_REWRITE_ITEMS_PER_CMD 64
 #define AOF_READ_DIFF_INTERVAL_BYTES (1024*10)
 #define CONFIG_DEFAULT_SLOWLOG_LOG_SLOWER_THAN 10000
+#define CONFIG_DEFAULT_SLOWLOG_LOG_QUEUE_DELAY_SLOWER_THAN -1
 #define CONFIG_DEFAULT_SLOWLOG_MAX_LEN 128
 #define CONFIG_DEFAULT_MAX_CLIENTS 10000 /* 默认最大同时连接10000个客户端 */
 #define CONFIG_AUTHPASS_MAX_LEN 512
@@ -124,6 +132,12 @@ typedef long long mstime_t; /* millisecond time type. */ /* 表示毫秒时间
 #define CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR 1 /* bgsave错误时是否停止写入 */
 #define CONFIG_DEFAULT_RDB_COMPRESSION 1 /* 默认rdb文件是需要压缩的 */
 #define CONFIG_DEFAULT_RDB_CHECKSUM 1
+#define CONFIG_DEFAULT_RDB_THREADED_LOADING 1 /* 默认使用单独的线程读取和解析rdb文件 */
+#define CONFIG_DEFAULT_RDB_SEGMENT_THREADS 1 /* 默认不使用分段的rdb格式 */
+#define RDB_SEGMENT_THREADS_MAX_NUM 64
+#define CONFIG_DEFAULT_RDB_FORKLESS_SAVE 0 /* 默认BGSAVE使用fork */
+#define CONFIG_DEFAULT_RDB_COMPRESSION_CODEC CODEC_LZF /* 默认使用lzf压缩rdb中的字符串 */
+#define CONFIG_DEFAULT_REPL_DISKLESS_COMPRESSION_CODEC CODEC_LZF
 #define CONFIG_DEFAULT_RDB_FILENAME "dump.rdb" /* 默认rdb文件 */
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC 0
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY 5
@@ -140,6 +154,8 @@ typedef long long mstime_t; /* millisecond time type. */ /* 表示毫秒时间
 #define CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE 0
 #define CONFIG_DEFAULT_AOF_LOAD_TRUNCATED 1
 #define CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE 0
+#define CONFIG_DEFAULT_AOF_MULTI_PART 0 /* 默认使用单个aof文件 */
+#define CONFIG_DEFAULT_AOF_DIRNAME "appendonlydir"
 #define CONFIG_DEFAULT_ACTIVE_REHASHING 1
 #define CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC 1
 #define CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE 0
@@ -149,6 +165,8 @@ typedef long long mstime_t; /* millisecond time type. */ /* 表示毫秒时间
 #define CONFIG_BINDADDR_MAX 16 /* 最多配置16个绑定地址 */
 #define CONFIG_MIN_RESERVED_FDS 32 /* 最少要保留32个文件描述符给redis自己用 */
 #define CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD 0
+#define CONFIG_DEFAULT_LATENCY_TRACKING 1
+#define CONFIG_DEFAULT_LATENCY_TRACKING_INFO_PERCENTILES "50 99 99.9"
 #define CONFIG_DEFAULT_SLAVE_LAZY_FLUSH 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE 0
@@ -161,13 +179,32 @@ typedef long long mstime_t; /* millisecond time type. */ /* 表示毫秒时间
 #define CONFIG_DEFAULT_DEFRAG_CYCLE_MIN 25 /* 25% CPU min (at lower threshold) */
 #define CONFIG_DEFAULT_DEFRAG_CYCLE_MAX 75 /* 75% CPU max (at upper threshold) */
 #define CONFIG_DEFAULT_PROTO_MAX_BULK_LEN (512ll*1024*1024) /* Bulk request max size */
+#define CONFIG_DEFAULT_IO_THREADS_NUM 1 /* Single threaded by default */
+#define CONFIG_DEFAULT_IO_THREADS_DO_READS 0 /* Read + parse from threads? */
+#define IO_THREADS_MAX_NUM 128
+#define CONFIG_DEFAULT_IO_URING 0 /* Use the io_uring event loop backend? */
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 20 /* Loopkups per loop. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
 #define ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC 25 /* CPU max % for keys collection */
+#define ACTIVE_EXPIRE_CYCLE_TTL_SAMPLES 5 /* Keys sampled for the avg TTL stat. */
 #define ACTIVE_EXPIRE_CYCLE_SLOW 0
 #define ACTIVE_EXPIRE_CYCLE_FAST 1
 
+/* Forkless RDB snapshots, see snapshot.c */
+#define RDB_FORKLESS_SAVE_FAST_DURATION 1000 /* Microseconds */
+#define RDB_FORKLESS_SAVE_SLOW_TIME_PERC 25 /* CPU max % for saving in cron */
+#define RDB_FORKLESS_SAVE_SLOW 0
+#define RDB_FORKLESS_SAVE_FAST 1
+/* rdb_child_pid while a forkless snapshot is in progress: there is no child,
+ * but the rest of the server handles it like a BGSAVE in progress. */
+#define RDB_CHILD_PID_FORKLESS 0
+#define rdbForklessSaveInProgress() \
+    (server.rdb_child_pid == RDB_CHILD_PID_FORKLESS)
+
+#define ACTIVE_REHASH_CPU_PERC 1 /* CPU max % for active rehashing */
+#define ACTIVE_REHASH_MIN_BUDGET 100 /* Microseconds */
+
 /* Instantaneous metrics tracking. */
 #define STATS_METRIC_SAMPLES 16     /* Number of samples per metric. */
 #define STATS_METRIC_COMMAND 0      /* Number of commands executed. */
@@ -179,6 +216,7 @@ typedef long long mstime_t; /* millisecond time type. */ /* 表示毫秒时间
 #define PROTO_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
 #define PROTO_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
+#define PROTO_REPLY_MIN_BYTES   (1024) /* Smallest client reply buffer. */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
@@ -218,6 +256,10 @@ typedef long long mstime_t; /* millisecond time type. */ /* 表示毫秒时间
 #define AOF_ON 1              /* AOF is on */
 #define AOF_WAIT_REWRITE 2    /* AOF waits rewrite to start appending */
 
+/* Multi part AOF file types, see aofInfo. */
+#define AOF_FILE_TYPE_BASE 'b' /* Base file: RDB or rewritten AOF. */
+#define AOF_FILE_TYPE_INCR 'i' /* Commands appended after the base. */
+
 /* Client flags */
 #define CLIENT_SLAVE (1<<0)   /* This client is a slave server */
 #define CLIENT_MASTER (1<<1)  /* This client is a master server */
@@ -250,6 +292,12 @@ typedef long long mstime_t; /* millisecond time type. */ /* 表示毫秒时间
 #define CLIENT_LUA_DEBUG (1<<25)  /* Run EVAL in debug mode. */
 #define CLIENT_LUA_DEBUG_SYNC (1<<26)  /* EVAL debugging without fork() */
 #define CLIENT_MODULE (1<<27) /* Non connected client used by some module. */
+#define CLIENT_PENDING_READ (1<<28) /* The client has pending reads and was put
+                                       in the list of clients we can read
+                                       from using the I/O threads. */
+#define CLIENT_PENDING_COMMAND (1<<29) /* A command was parsed by an I/O thread
+                                          and is ready to be executed by the
+                                          main thread. */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -335,8 +383,6 @@ typedef long long mstime_t; /* millisecond time type. */ /* 表示毫秒时间
 /* Anti-warning macro... */
 #define UNUSED(V) ((void) V)
 
-#define ZSKIPLIST_MAXLEVEL 32 /* Should be enough for 2^32 elements */
-#define ZSKIPLIST_P 0.25      /* Skiplist P = 1/4 */
 
 /* Append only defines */
 #define AOF_FSYNC_NO 0
@@ -345,15 +391,17 @@ typedef long long mstime_t; /* millisecond time type. */ /* 表示毫秒时间
 #define CONFIG_DEFAULT_AOF_FSYNC AOF_FSYNC_EVERYSEC
 
 /* Zip structure related defaults */
-#define OBJ_HASH_MAX_ZIPLIST_ENTRIES 512
-#define OBJ_HASH_MAX_ZIPLIST_VALUE 64
+#define OBJ_HASH_MAX_LISTPACK_ENTRIES 512
+#define OBJ_HASH_MAX_LISTPACK_VALUE 64
 #define OBJ_SET_MAX_INTSET_ENTRIES 512
-#define OBJ_ZSET_MAX_ZIPLIST_ENTRIES 128
-#define OBJ_ZSET_MAX_ZIPLIST_VALUE 64
+#define CONFIG_DEFAULT_SET_ROARING_ENCODING 1
+#define OBJ_ZSET_MAX_LISTPACK_ENTRIES 128
+#define OBJ_ZSET_MAX_LISTPACK_VALUE 64
 
 /* List defaults */
-#define OBJ_LIST_MAX_ZIPLIST_SIZE -2
+#define OBJ_LIST_MAX_LISTPACK_SIZE -2
 #define OBJ_LIST_COMPRESS_DEPTH 0
+#define OBJ_LIST_COMPRESSION_CODEC CODEC_LZF
 
 /* HyperLogLog defines */
 #define CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES 3000
@@ -576,11 +624,14 @@ typedef struct RedisModuleDigest {
 #define OBJ_ENCODING_HT 2      /* Encoded as hash table */
 #define OBJ_ENCODING_ZIPMAP 3  /* Encoded as zipmap */
 #define OBJ_ENCODING_LINKEDLIST 4 /* No longer used: old list encoding. */
-#define OBJ_ENCODING_ZIPLIST 5 /* Encoded as ziplist */
+#define OBJ_ENCODING_ZIPLIST 5 /* No longer used: old hash/zset encoding. */
 #define OBJ_ENCODING_INTSET 6  /* Encoded as intset */
-#define OBJ_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
+#define OBJ_ENCODING_SKIPLIST 7  /* No longer used: old zset encoding. */
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
-#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
+#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of listpacks */
+#define OBJ_ENCODING_LISTPACK 10 /* Encoded as a listpack */
+#define OBJ_ENCODING_ROARING 11 /* Encoded as a roaring bitmap */
+#define OBJ_ENCODING_BTREE 12 /* Encoded as a B+tree with subtree counts */
 
 #define LRU_BITS 24 /* lru占24位 */
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */ /* lru的最大值 */
@@ -618,7 +669,7 @@ struct evictionPoolEntry; /* Defined in evict.c */
  * database. The database number is the 'id' field in the structure. */
 typedef struct redisDb {
     dict *dict;                 /* The keyspace for this DB */ /* 键空间，保存数据库中所有的键值对 */
-    dict *expires;              /* Timeout of keys with a timeout set */ /* 过期键 保存所有的过期键和时间 */
+    ttlWheel *expires;          /* Keys with a timeout set, by expire time */ /* 过期键 按过期时间分桶，过期时间保存在键空间的实体中 */
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP)*/
     dict *ready_keys;           /* Blocked keys that received a PUSH */
     dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
@@ -626,6 +677,13 @@ typedef struct redisDb {
     long long avg_ttl;          /* Average TTL, just for stats */
 } redisDb;
 
+/* 键空间字典实体的附加数据中保存键的过期时间(毫秒)，-1表示没有设置过期时间 */
+/* The metadata of the entries of db->dict holds the expire time of the key
+ * as an unix time in milliseconds, or -1 if the key is not volatile. It comes
+ * after the cached hash of the key, as dbDictType sets storeHash. */
+#define dbEntryGetExpire(de) ((long long)(de)->metadata[1].s64)
+#define dbEntrySetExpire(de,when) ((de)->metadata[1].s64 = (when))
+
 /* Client MULTI/EXEC state */
 typedef struct multiCmd {
     robj **argv;
@@ -698,11 +756,18 @@ typedef struct client {
     int multibulklen;       /* Number of multi bulk arguments left to read. */
     long bulklen;           /* Length of bulk argument in multi bulk request. */
     list *reply;            /* List of reply objects to send to the client. */
+    list *reply_unref;      /* Shared reply objects sent by an I/O thread, to
+                               release in the main thread. NULL if none. */
     unsigned long long reply_bytes; /* Tot bytes of objects in reply list. */
     size_t sentlen;         /* Amount of bytes already sent in the current
                                buffer or object being sent. */
     time_t ctime;           /* Client creation time. */
     time_t lastinteraction; /* Time of the last interaction, used for timeout */
+    long long read_time;    /* Time of the first read after the last parsed
+                               command, in microseconds. 0 if none. */
+    long long cmd_read_time; /* Time of the read of the current command. */
+    long long queue_delay;  /* Microseconds the current command waited
+                               between its read and its execution. */
     time_t obuf_soft_limit_reached_time;
     int flags;              /* Client flags: CLIENT_* macros. */
     int authenticated;      /* When requirepass is non-NULL. */
@@ -732,9 +797,13 @@ typedef struct client {
     list *pubsub_patterns;  /* patterns a client is interested in (SUBSCRIBE) */
     sds peerid;             /* Cached peer ID. */
 
-    /* Response buffer */
+    /* Response buffer: taken from the pool of client buffers only while
+     * there is something to send, see clientGetReplyBuffer(). */
     int bufpos;
-    char buf[PROTO_REPLY_CHUNK_BYTES];
+    size_t buf_usable_size; /* Size of 'buf', 0 if not allocated. */
+    size_t buf_peak;        /* Recent peak of replies size, used to pick the
+                               size of the next buffer. */
+    char *buf;
 } client;
 
 /* 保存条件的参数  多少秒内有多少次改变就保存一次*/
@@ -766,29 +835,11 @@ struct sharedObjectsStruct {
     sds minstring, maxstring;
 };
 
-/* 跳跃表的节点 */
-/* ZSETs use a specialized version of Skiplists */
-typedef struct zskiplistNode {
-    sds ele; /* 元素 动态字符串 */
-    double score; /* 分值 */
-    struct zskiplistNode *backward; /* 后退指针 */
-    /* 层 */
-    struct zskiplistLevel { 
-        struct zskiplistNode *forward; /* 前进指针 */
-        unsigned int span; /* 跨度 */
-    } level[];
-} zskiplistNode;
-
-/* 跳跃表结构 */
-typedef struct zskiplist {
-    struct zskiplistNode *header, *tail; /* 跳跃表的表头 表尾 */
-    unsigned long length; /* 跳跃表中节点的数量，不包括表头 */
-    int level; /* 跳跃表中节点层数最大的 那个节点的层数， 不包括表头 */
-} zskiplist;
-
+/* ZSETs use a hash table from members to scores, and a B+tree (zbtree.h)
+ * ordered by score that shares the member SDS strings. */
 typedef struct zset {
-    dict *dict;
-    zskiplist *zsl;
+    dict *dict; /* 成员 -> 分值(按值保存) */
+    zbtree *zbt;
 } zset;
 
 typedef struct clientBufferLimitsConfig {
@@ -832,6 +883,8 @@ struct redisMemOverhead {
     size_t repl_backlog;
     size_t clients_slaves;
     size_t clients_normal;
+    size_t clients_buffers;
+    size_t clients_buffers_pool;
     size_t aof_buffer;
     size_t overhead_total;
     size_t dataset;
@@ -868,6 +921,24 @@ typedef struct rdbSaveInfo {
 
 #define RDB_SAVE_INFO_INIT {-1,0,"000000000000000000000000000000",-1}
 
+/* A file of the multi part AOF, as listed in the manifest.
+ * 多文件aof中的一个文件: 一个基础文件(rdb格式或者重写后的命令), 以及之后追加
+ * 命令的若干增量文件. */
+typedef struct aofInfo {
+    sds file_name;          /* Name of the file inside aof_dirname. */
+    long long file_seq;     /* Sequence number, grows with every new file. */
+    int file_type;          /* AOF_FILE_TYPE_(BASE|INCR) */
+} aofInfo;
+
+/* The manifest lists the files that, loaded in order, rebuild the dataset:
+ * the base file, if any, followed by the incr files. */
+typedef struct aofManifest {
+    aofInfo *base;                  /* Base file, NULL if none. */
+    list *incr_list;                /* aofInfo of the incr files, in order. */
+    long long curr_base_file_seq;   /* Last base file sequence number. */
+    long long curr_incr_file_seq;   /* Last incr file sequence number. */
+} aofManifest;
+
 /*-----------------------------------------------------------------------------
  * Global server state
  *----------------------------------------------------------------------------*/
@@ -888,6 +959,7 @@ struct clusterState;
 struct redisServer {
     /* General */
     pid_t pid;                  /* Main process pid. */ /* 进程id */
+    pthread_t main_thread_id;   /* Thread running the event loop. */
     char *configfile;           /* Absolute config file path, or NULL */ /* 配置文件绝对路径 */
     char *executable;           /* Absolute executable file path. */ /* 执行文件的绝对路径*/
     char **exec_argv;           /* Executable argv vector (copy). */
@@ -929,6 +1001,7 @@ struct redisServer {
     list *clients;              /* List of active clients */
     list *clients_to_close;     /* Clients to close asynchronously */
     list *clients_pending_write; /* There is to write or install handler. */
+    list *clients_pending_read;  /* Client has pending read socket buffers. */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
     client *current_client; /* Current client, only used on crash report */
     int clients_paused;         /* True if clients are currently paused */
@@ -941,7 +1014,9 @@ struct redisServer {
     int loading;                /* We are loading data from disk if true */
     off_t loading_total_bytes;
     off_t loading_loaded_bytes;
+    long long loading_loaded_keys;
     time_t loading_start_time;
+    int loading_threaded;       /* The load in progress uses a loader thread */
     off_t loading_process_events_interval_bytes;
     /* Fast pointers to often looked up command */
     struct redisCommand *delCommand, *multiCommand, *lpushCommand, *lpopCommand,
@@ -950,6 +1025,10 @@ struct redisServer {
     /* Fields used only for stats */
     time_t stat_starttime;          /* Server start time */
     long long stat_numcommands;     /* Number of processed commands */
+    long long stat_queue_delay;     /* Total queue delay of commands (usec) */
+    long long stat_queue_delay_max; /* Max queue delay of a command (usec) */
+    struct latencyHistogram *queue_delay_histogram; /* Queue delay of all
+                                                       the commands. */
     long long stat_numconnections;  /* Number of connections received */
     long long stat_expiredkeys;     /* Number of expired keys */
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
@@ -969,10 +1048,14 @@ struct redisServer {
     list *slowlog;                  /* SLOWLOG list of commands */
     long long slowlog_entry_id;     /* SLOWLOG current entry ID */
     long long slowlog_log_slower_than; /* SLOWLOG time limit (to get logged) */
+    long long slowlog_log_queue_delay_slower_than; /* SLOWLOG queue delay
+                                                      limit (to get logged) */
     unsigned long slowlog_max_len;     /* SLOWLOG max number of items logged */
     size_t resident_set_size;       /* RSS sampled in serverCron(). */
     long long stat_net_input_bytes; /* Bytes read from network. */
     long long stat_net_output_bytes; /* Bytes written to network. */
+    long long stat_io_reads_processed; /* Number of read events processed by IO threads */
+    long long stat_io_writes_processed; /* Number of write events processed by IO threads */
     size_t stat_rdb_cow_bytes;      /* Copy on write bytes during RDB saving. */
     size_t stat_aof_cow_bytes;      /* Copy on write bytes during AOF rewrite. */
     /* The following two are used to track instantaneous metrics, like
@@ -996,6 +1079,10 @@ struct redisServer {
     int active_defrag_cycle_max;       /* maximal effort for defrag in CPU percentage */
     size_t client_max_querybuf_len; /* Limit for client query buffer length */
     int dbnum;                      /* Total number of configured DBs */
+    int io_threads_num;             /* Number of IO threads to use. */
+    int io_threads_do_reads;        /* Read and parse from IO threads? */
+    int io_threads_active;          /* Are the IO threads currently spinning? */
+    int io_uring;                   /* Use the io_uring event loop backend? */
     int supervised;                 /* 1 if supervised, 0 otherwise. */
     int supervised_mode;            /* See SUPERVISED_* */
     int daemonize;                  /* True if running as a daemon */
@@ -1026,6 +1113,12 @@ struct redisServer {
     int aof_last_write_errno;       /* Valid if aof_last_write_status is ERR */
     int aof_load_truncated;         /* Don't stop on unexpected AOF EOF. */
     int aof_use_rdb_preamble;       /* Use RDB preamble on AOF rewrites. */
+    int aof_multi_part;             /* Base and incr files listed by a manifest. */
+    char *aof_dirname;              /* Directory of the multi part AOF files. */
+    struct aofManifest *aof_manifest; /* Files of the multi part AOF. */
+    off_t aof_last_incr_size;       /* Size of the incr file being written. */
+    long long aof_rewrite_incr_seq; /* First incr file after the rewrite base,
+                                       -1 if AOF was off at rewrite start. */
     /* AOF pipes used to communicate between parent and child during rewrite. */
     int aof_pipe_write_data_to_child;
     int aof_pipe_read_data_from_parent;
@@ -1045,6 +1138,10 @@ struct redisServer {
     char *rdb_filename;             /* Name of RDB file */
     int rdb_compression;            /* Use compression in RDB? */
     int rdb_checksum;               /* Use RDB checksum? */
+    int rdb_threaded_loading;       /* Decode the RDB in a loader thread? */
+    int rdb_segment_threads;        /* Threads encoding/decoding RDB segments. */
+    int rdb_forkless_save;          /* BGSAVE in the main thread, no fork? */
+    int rdb_compression_codec;      /* Codec of the RDB strings, see codec.h */
     time_t lastsave;                /* Unix time of last successful save */
     time_t lastbgsave_try;          /* Unix time of last attempted bgsave */
     time_t rdb_save_time_last;      /* Time used by last RDB save run. */
@@ -1092,6 +1189,7 @@ struct redisServer {
     int repl_good_slaves_count;     /* Number of slaves with lag <= max_lag. */
     int repl_diskless_sync;         /* Send RDB to slaves sockets directly. */
     int repl_diskless_sync_delay;   /* Delay to start a diskless repl BGSAVE. */
+    int repl_diskless_compression_codec; /* Codec of the diskless RDB strings. */
     /* Replication (slave) */
     char *masterauth;               /* AUTH with this password with master */
     char *masterhost;               /* Hostname of master */
@@ -1147,15 +1245,17 @@ struct redisServer {
     int sort_bypattern;
     int sort_store;
     /* Zip structure config, see redis.conf for more information  */
-    size_t hash_max_ziplist_entries;
-    size_t hash_max_ziplist_value;
+    size_t hash_max_listpack_entries;
+    size_t hash_max_listpack_value;
     size_t set_max_intset_entries;
-    size_t zset_max_ziplist_entries;
-    size_t zset_max_ziplist_value;
+    int set_roaring_encoding;   /* Big integer sets become roaring bitmaps */
+    size_t zset_max_listpack_entries;
+    size_t zset_max_listpack_value;
     size_t hll_sparse_max_bytes;
     /* List parameters */
-    int list_max_ziplist_size;
+    int list_max_listpack_size;
     int list_compress_depth;
+    int list_compression_codec;
     /* time cache */
     time_t unixtime;    /* Unix time sampled every cron cycle. */
     long long mstime;   /* Like 'unixtime' but with milliseconds resolution. */
@@ -1201,6 +1301,10 @@ struct redisServer {
     /* Latency monitor */
     long long latency_monitor_threshold;
     dict *latency_events;
+    /* Per command latency histograms */
+    int latency_tracking; /* Record the latency histogram of commands. */
+    double *latency_tracking_info_percentiles; /* Percentiles in INFO. */
+    int latency_tracking_info_percentiles_len;
     /* Assert & bug reporting */
     const char *assert_failed;
     const char *assert_file;
@@ -1215,6 +1319,8 @@ struct redisServer {
     pthread_mutex_t lruclock_mutex;
     pthread_mutex_t next_client_id_mutex;
     pthread_mutex_t unixtime_mutex;
+    pthread_mutex_t stat_net_input_bytes_mutex;
+    pthread_mutex_t stat_net_output_bytes_mutex;
 };
 
 typedef struct pubsubPattern {
@@ -1252,6 +1358,8 @@ struct redisCommand {
     int lastkey;  /* The last argument that's a key */
     int keystep;  /* The step between first and last key */
     long long microseconds, calls;
+    struct latencyHistogram *latency_histogram; /* Created on first call. */
+    long long queue_microseconds; /* Time spent waiting to be executed. */
 };
 
 struct redisFunctionSym {
@@ -1292,8 +1400,14 @@ typedef struct {
     int encoding;
     int ii; /* intset iterator */
     dictIterator *di;
+    roaringIterator ri;
 } setTypeIterator;
 
+/* Set encodings whose members are returned as int64_t values instead of
+ * SDS strings by setTypeNext() and setTypeRandomElement(). */
+#define setEncodingIsInt(enc) ((enc) == OBJ_ENCODING_INTSET || \
+                               (enc) == OBJ_ENCODING_ROARING)
+
 /* Structure to hold hash iteration abstraction. Note that iteration over
  * hashes involves both fields and values. Because it is possible that
  * not both are required, store pointers in the iterator to avoid
@@ -1327,7 +1441,6 @@ extern dictType shaScriptObjectDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
 extern dictType replScriptCacheDictType;
-extern dictType keyptrDictType;
 extern dictType modulesDictType;
 
 /*-----------------------------------------------------------------------------
@@ -1391,6 +1504,11 @@ void copyClientOutputBuffer(client *dst, client *src);
 size_t sdsZmallocSize(sds s);
 size_t getStringObjectSdsUsedMemory(robj *o);
 void *dupClientReplyValue(void *o);
+void freeClientReplyValue(void *o);
+void unshareClientsReplyObjects(void);
+void releaseClientBuffersIfIdle(client *c);
+void clientBufPoolTrim(void);
+size_t clientBufPoolMemory(void);
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer);
 char *getClientPeerId(client *client);
@@ -1400,6 +1518,7 @@ void rewriteClientCommandVector(client *c, int argc, ...);
 void rewriteClientCommandArgument(client *c, int i, robj *newval);
 void replaceClientCommandVector(client *c, int argc, robj **argv);
 unsigned long getClientOutputBufferMemoryUsage(client *c);
+size_t getClientBuffersMemoryUsage(client *c);
 void freeClientsInAsyncFreeQueue(void);
 void asyncCloseClientOnOutputBufferLimitReached(client *c);
 int getClientType(client *c);
@@ -1412,6 +1531,10 @@ void pauseClients(mstime_t duration);
 int clientsArePaused(void);
 int processEventsWhileBlocked(void);
 int handleClientsWithPendingWrites(void);
+int handleClientsWithPendingWritesUsingThreads(void);
+int handleClientsWithPendingReadsUsingThreads(void);
+void initThreadedIO(void);
+void killIOThreads(void);
 int clientHasPendingReplies(client *c);
 void unlinkClient(client *c);
 int writeToClient(int fd, client *c, int handler_installed);
@@ -1479,12 +1602,13 @@ size_t stringObjectLen(robj *o);
 robj *createStringObjectFromLongLong(long long value);
 robj *createStringObjectFromLongDouble(long double value, int humanfriendly);
 robj *createQuicklistObject(void);
-robj *createZiplistObject(void);
+robj *createListpackObject(void);
 robj *createSetObject(void);
 robj *createIntsetObject(void);
+robj *createRoaringSetObject(roaring *r);
 robj *createHashObject(void);
 robj *createZsetObject(void);
-robj *createZsetZiplistObject(void);
+robj *createZsetListpackObject(void);
 robj *createModuleObject(moduleType *mt, void *value);
 int getLongFromObjectOrReply(client *c, robj *o, long *target, const char *msg);
 int checkType(client *c, robj *o, int type);
@@ -1550,7 +1674,9 @@ void flushAppendOnlyFile(int force);
 void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc);
 void aofRemoveTempFile(pid_t childpid);
 int rewriteAppendOnlyFileBackground(void);
-int loadAppendOnlyFile(char *filename);
+int loadAppendOnlyFiles(void);
+void aofLoadManifestFromDisk(void);
+void aofOpenIfNeededOnServerStart(void);
 void stopAppendOnly(void);
 int startAppendOnly(void);
 void backgroundRewriteDoneHandler(int exitcode, int bysignal);
@@ -1595,13 +1721,10 @@ typedef struct {
     int minex, maxex; /* are min or max exclusive? */ /* 标记是否不包括最大最小值 */
 } zlexrangespec;
 
-zskiplist *zslCreate(void);
-void zslFree(zskiplist *zsl);
-zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele);
 unsigned char *zzlInsert(unsigned char *zl, sds ele, double score);
-int zslDelete(zskiplist *zsl, double score, sds ele, zskiplistNode **node);
-zskiplistNode *zslFirstInRange(zskiplist *zsl, zrangespec *range);
-zskiplistNode *zslLastInRange(zskiplist *zsl, zrangespec *range);
+unsigned char *zzlUpdateScore(unsigned char *zl, unsigned char *eptr, sds ele, double score);
+int zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtCursor *c);
+int zbtLastInRange(zbtree *zbt, zrangespec *range, zbtCursor *c);
 double zzlGetScore(unsigned char *sptr);
 void zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr);
 void zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr);
@@ -1609,21 +1732,23 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range);
 unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range);
 unsigned int zsetLength(const robj *zobj);
 void zsetConvert(robj *zobj, int encoding);
-void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen);
+void zsetConvertToListpackIfNeeded(robj *zobj, size_t maxelelen);
+robj *zsetTypeCreate(size_t size_hint, size_t val_len_hint);
+void zsetTypeExpand(robj *zobj, size_t size_hint);
 int zsetScore(robj *zobj, sds member, double *score);
-unsigned long zslGetRank(zskiplist *zsl, double score, sds o);
+void zsetDictAdd(dict *d, sds ele, double score);
 int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore);
 long zsetRank(robj *zobj, sds ele, int reverse);
 int zsetDel(robj *zobj, sds ele);
-sds ziplistGetObject(unsigned char *sptr);
+sds lpGetObject(unsigned char *sptr);
 int zslValueGteMin(double value, zrangespec *spec);
 int zslValueLteMax(double value, zrangespec *spec);
 void zslFreeLexRange(zlexrangespec *spec);
 int zslParseLexRange(robj *min, robj *max, zlexrangespec *spec);
 unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range);
 unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range);
-zskiplistNode *zslFirstInLexRange(zskiplist *zsl, zlexrangespec *range);
-zskiplistNode *zslLastInLexRange(zskiplist *zsl, zlexrangespec *range);
+int zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range, zbtCursor *c);
+int zbtLastInLexRange(zbtree *zbt, zlexrangespec *range, zbtCursor *c);
 int zzlLexValueGteMin(unsigned char *p, zlexrangespec *spec);
 int zzlLexValueLteMax(unsigned char *p, zlexrangespec *spec);
 int zslLexValueGteMin(sds value, zlexrangespec *spec);
@@ -1637,6 +1762,7 @@ struct redisCommand *lookupCommand(sds name);
 struct redisCommand *lookupCommandByCString(char *s);
 struct redisCommand *lookupCommandOrOriginal(sds name);
 void call(client *c, int flags);
+void trackQueueDelay(client *c);
 void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int flags);
 void alsoPropagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int target);
 void forceCommandPropagation(client *c, int flags);
@@ -1671,10 +1797,12 @@ void freeMemoryOverheadData(struct redisMemOverhead *mh);
 #define RESTART_SERVER_NONE 0
 #define RESTART_SERVER_GRACEFULLY (1<<0)     /* Do proper shutdown. */
 #define RESTART_SERVER_CONFIG_REWRITE (1<<1) /* CONFIG REWRITE before restart.*/
+void deleteAllFileEvents(void);
 int restartServer(int flags, mstime_t delay);
 
 /* Set data type */
-robj *setTypeCreate(sds value);
+robj *setTypeCreate(sds value, size_t size_hint);
+void setTypeExpand(robj *set, size_t size_hint);
 int setTypeAdd(robj *subject, sds value);
 int setTypeRemove(robj *subject, sds value);
 int setTypeIsMember(robj *subject, sds value);
@@ -1686,6 +1814,7 @@ int setTypeRandomElement(robj *setobj, sds *sdsele, int64_t *llele);
 unsigned long setTypeRandomElements(robj *set, unsigned long count, robj *aux_set);
 unsigned long setTypeSize(const robj *subject);
 void setTypeConvert(robj *subject, int enc);
+robj *setTypeFromRoaring(roaring *r);
 
 /* Hash data type */
 #define HASH_SET_TAKE_FIELD (1<<0)
@@ -1701,7 +1830,7 @@ unsigned long hashTypeLength(const robj *o);
 hashTypeIterator *hashTypeInitIterator(robj *subject);
 void hashTypeReleaseIterator(hashTypeIterator *hi);
 int hashTypeNext(hashTypeIterator *hi);
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
                                 unsigned char **vstr,
                                 unsigned int *vlen,
                                 long long *vll);
@@ -1734,6 +1863,9 @@ int rewriteConfig(char *path);
 
 /* db.c -- Keyspace access API */
 int removeExpire(redisDb *db, robj *key);
+ttlWheel *expiresIndexCreate(dict *keyspace);
+void expiresIndexAdd(redisDb *db, sds key, long long when);
+void expiresIndexDel(redisDb *db, sds key, long long when);
 void propagateExpire(redisDb *db, robj *key, int lazy);
 int expireIfNeeded(redisDb *db, robj *key);
 long long getExpire(redisDb *db, robj *key);
@@ -1830,6 +1962,16 @@ void rememberSlaveKeyWithExpire(redisDb *db, robj *key);
 void flushSlaveKeysWithExpireList(void);
 size_t getSlaveKeyWithExpireCount(void);
 
+/* snapshot.c -- Forkless RDB snapshots */
+int rdbSaveForklessStart(char *filename, rdbSaveInfo *rsi);
+void rdbSaveForklessCron(int type);
+void rdbSaveForklessAbort(void);
+void rdbSaveForklessKeyWillChange(redisDb *db, sds key);
+void rdbSaveForklessKeyAdded(redisDb *db, sds key);
+void rdbSaveForklessDbWillChange(int dbid);
+size_t rdbSaveForklessOverhead(void);
+unsigned long long rdbSaveForklessSavedOnWrite(void);
+
 /* evict.c -- maxmemory handling and LRU eviction. */
 void evictionPoolAlloc(void);
 #define LFU_INIT_VAL 5
@@ -45,7 +45,7 @@
 /* Create a new slowlog entry.
  * Incrementing the ref count of all the objects retained is up to
  * this function. */
-slowlogEntry *slowlogCreateEntry(client *c, robj **argv, int argc, long long duration) {
+slowlogEntry *slowlogCreateEntry(client *c, robj **argv, int argc, long long duration, long long queue_delay) {
     slowlogEntry *se = zmalloc(sizeof(*se));
     int j, slargc = argc;
 
@@ -87,6 +87,7 @@ slowlogEntry *slowlogCreateEntry(client *c, robj **argv, int argc, long long dur
     }
     se->time = time(NULL);
     se->duration = duration;
+    se->queue_delay = queue_delay;
     se->id = server.slowlog_entry_id++;
     se->peerid = sdsnew(getClientPeerId(c));
     se->cname = c->name ? sdsnew(c->name->ptr) : sdsempty();
@@ -117,14 +118,17 @@ void slowlogInit(void) {
     listSetFreeMethod(server.slowlog,slowlogFreeEntry);
 }
 
-/* Push a new entry into the slow log.
+/* Push a new entry into the slow log if the command took too much time to
+ * execute, or waited too much time to be executed after it was read.
  * This function will make sure to trim the slow log accordingly to the
  * configured max length. */
-void slowlogPushEntryIfNeeded(client *c, robj **argv, int argc, long long duration) {
+void slowlogPushEntryIfNeeded(client *c, robj **argv, int argc, long long duration, long long queue_delay) {
     if (server.slowlog_log_slower_than < 0) return; /* Slowlog disabled */
-    if (duration >= server.slowlog_log_slower_than)
+    if (duration >= server.slowlog_log_slower_than ||
+        (server.slowlog_log_queue_delay_slower_than >= 0 &&
+         queue_delay >= server.slowlog_log_queue_delay_slower_than))
         listAddNodeHead(server.slowlog,
-                        slowlogCreateEntry(c,argv,argc,duration));
+                        slowlogCreateEntry(c,argv,argc,duration,queue_delay));
 
     /* Remove old entries if needed. */
     while (listLength(server.slowlog) > server.slowlog_max_len)
@@ -164,7 +168,7 @@ void slowlogCommand(client *c) {
             int j;
 
             se = ln->value;
-            addReplyMultiBulkLen(c,6);
+            addReplyMultiBulkLen(c,7);
             addReplyLongLong(c,se->id);
             addReplyLongLong(c,se->time);
             addReplyLongLong(c,se->duration);
@@ -173,6 +177,7 @@ void slowlogCommand(client *c) {
                 addReplyBulk(c,se->argv[j]);
             addReplyBulkCBuffer(c,se->peerid,sdslen(se->peerid));
             addReplyBulkCBuffer(c,se->cname,sdslen(se->cname));
+            addReplyLongLong(c,se->queue_delay);
             sent++;
         }
         setDeferredMultiBulkLength(c,totentries,sent);
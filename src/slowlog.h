@@ -36,6 +36,8 @@ typedef struct slowlogEntry {
     int argc;
     long long id;       /* Unique entry identifier. */
     long long duration; /* Time spent by the query, in microseconds. */
+    long long queue_delay; /* Time the query waited to be executed since it
+                              was read, in microseconds. */
     time_t time;        /* Unix time at which the query was executed. */
     sds cname;          /* Client name. */
     sds peerid;         /* Client network address. */
@@ -43,7 +45,7 @@ typedef struct slowlogEntry {
 
 /* Exported API */
 void slowlogInit(void);
-void slowlogPushEntryIfNeeded(client *c, robj **argv, int argc, long long duration);
+void slowlogPushEntryIfNeeded(client *c, robj **argv, int argc, long long duration, long long queue_delay);
 
 /* Exported commands */
 void slowlogCommand(client *c);
@@ -0,0 +1,403 @@
+/* Forkless RDB snapshots.
+ *
+ * 不使用fork的rdb快照: 主线程增量地扫描键空间并将其写入rdb文件, 在修改或者
+ * 删除一个还没有被扫描到的键之前, 先将它当前的值写入文件(写时保存), 这样得到的
+ * 文件和fork时刻的数据集是一致的.
+ *
+ * When rdb-forkless-save is enabled, BGSAVE doesn't fork: the main thread
+ * scans the keyspace incrementally with dictScan(), a few milliseconds at a
+ * time, appending the keys to the RDB file. Before a key that the scan did
+ * not reach yet is modified or deleted, its current value is written to the
+ * file (copy-on-modify, where the copy is the serialization itself), and the
+ * key is remembered so that the scan will skip it. Keys created after the
+ * snapshot started are remembered as well. The result is the same RDB stream
+ * a forked child would produce, with the only difference that keys from
+ * different DBs may be interleaved, with SELECTDB opcodes as needed.
+ *
+ * The extra memory used is the set of keys remembered this way, reported as
+ * rdb_forkless_overhead in INFO and as rdb_last_cow_size once done.
+ */
+
+#include "server.h"
+#include <fcntl.h>
+
+/* Sync the file on disk every few megabytes, like the slaves do while
+ * receiving the RDB from the master, otherwise the final fsync() may block
+ * the server for a long time. */
+#define RDB_FORKLESS_MAX_WRITTEN_BEFORE_FSYNC (1024*1024*8)
+
+static struct {
+    FILE *fp;
+    rio rdb;
+    char tmpfile[256];
+    char *filename;
+    int with_scripts;       /* Save the Lua scripts (rsi was given)? */
+    long long now;          /* Keys expired at this time are not saved. */
+    int dbid;               /* DB being scanned. */
+    int scanning;           /* Did the scan of 'dbid' start? */
+    unsigned long cursor;   /* dictScan() cursor in 'dbid'. */
+    int *db_done;           /* DBs completely saved. */
+    dict **seen;            /* Per DB keys the scan must skip. */
+    int selected;           /* Last DB selected in the RDB stream. */
+    int error;              /* errno of a write error, or 0. */
+    size_t last_fsync_off;  /* Bytes already synced on disk. */
+    size_t *seen_bytes;     /* Per DB memory used by the keys in 'seen'. */
+    size_t overhead;        /* Memory used by all the 'seen' dicts. */
+    size_t peak_overhead;
+    unsigned long long saved_on_write;
+} snap;
+
+/* Write a key to the snapshot. */
+static void snapshotSaveKey(int dbid, const dictEntry *de) {
+    robj key;
+
+    if (snap.error) return;
+    if (snap.selected != dbid) {
+        if (rdbSaveType(&snap.rdb,RDB_OPCODE_SELECTDB) == -1 ||
+            rdbSaveLen(&snap.rdb,dbid) == -1)
+        {
+            snap.error = errno;
+            return;
+        }
+        snap.selected = dbid;
+    }
+    initStaticStringObject(key,dictGetKey(de));
+    if (rdbSaveKeyValuePair(&snap.rdb,&key,dictGetVal(de),
+                            dbEntryGetExpire(de),snap.now) == -1)
+    {
+        snap.error = errno;
+    }
+}
+
+static int snapshotSeen(int dbid, sds key) {
+    return snap.seen[dbid] && dictFind(snap.seen[dbid],key) != NULL;
+}
+
+/* Memory used to track the keys of 'dbid' the scan must skip. */
+static size_t snapshotSeenOverhead(int dbid) {
+    dict *d = snap.seen[dbid];
+
+    if (d == NULL) return 0;
+    return snap.seen_bytes[dbid] + sizeof(dict) +
+           dictSize(d)*sizeof(dictEntry) + dictSlots(d)*sizeof(dictEntry*);
+}
+
+/* Remember that the scan must skip 'key'. The overhead is updated with the
+ * difference of the DB alone, since this is called on every write. */
+static void snapshotSetSeen(int dbid, sds key) {
+    size_t before = snapshotSeenOverhead(dbid);
+
+    if (snap.seen[dbid] == NULL) snap.seen[dbid] = dictCreate(&setDictType,NULL);
+    key = sdsdup(key);
+    if (dictAdd(snap.seen[dbid],key,NULL) != DICT_OK) {
+        sdsfree(key);
+        return;
+    }
+    snap.seen_bytes[dbid] += sdsZmallocSize(key);
+    snap.overhead = snap.overhead - before + snapshotSeenOverhead(dbid);
+    if (snap.overhead > snap.peak_overhead) snap.peak_overhead = snap.overhead;
+}
+
+/* Return true if the scan already saved the slot of 'key' in 'db' (or the
+ * whole DB). */
+static int snapshotPassed(redisDb *db, sds key) {
+    if (snap.db_done[db->id]) return 1;
+    if (db->id != snap.dbid || !snap.scanning) return 0;
+    return dictScanCursorPassed(db->dict,snap.cursor,
+                                dictHashKey(db->dict,key));
+}
+
+static void snapshotScanCallback(void *privdata, const dictEntry *de) {
+    int dbid = *(int*)privdata;
+
+    if (snapshotSeen(dbid,dictGetKey(de))) return;
+    snapshotSaveKey(dbid,de);
+}
+
+/* The DB was completely saved: its keys are no longer tracked. */
+static void snapshotDbDone(int dbid) {
+    snap.db_done[dbid] = 1;
+    snap.overhead -= snapshotSeenOverhead(dbid);
+    if (snap.seen[dbid]) {
+        dictRelease(snap.seen[dbid]);
+        snap.seen[dbid] = NULL;
+    }
+    snap.seen_bytes[dbid] = 0;
+}
+
+/* The scan of the current DB completed: move to the next one. */
+static void snapshotNextDb(void) {
+    snapshotDbDone(snap.dbid);
+    snap.dbid++;
+    snap.scanning = 0;
+    snap.cursor = 0;
+}
+
+/* Scan the current DB for a bit, starting it if needed. */
+static void snapshotScanStep(void) {
+    redisDb *db = server.db+snap.dbid;
+
+    if (snap.db_done[snap.dbid]) {
+        snapshotNextDb();
+        return;
+    }
+    if (!snap.scanning) {
+        uint32_t db_size, expires_size;
+
+        if (dictSize(db->dict) == 0) {
+            snapshotNextDb();
+            return;
+        }
+        /* Write the SELECT DB and RESIZE DB opcodes like rdbSaveRio()
+         * does. */
+        db_size = (dictSize(db->dict) <= UINT32_MAX) ?
+                                dictSize(db->dict) :
+                                UINT32_MAX;
+        expires_size = (ttlWheelSize(db->expires) <= UINT32_MAX) ?
+                                ttlWheelSize(db->expires) :
+                                UINT32_MAX;
+        if (rdbSaveType(&snap.rdb,RDB_OPCODE_SELECTDB) == -1 ||
+            rdbSaveLen(&snap.rdb,snap.dbid) == -1 ||
+            rdbSaveType(&snap.rdb,RDB_OPCODE_RESIZEDB) == -1 ||
+            rdbSaveLen(&snap.rdb,db_size) == -1 ||
+            rdbSaveLen(&snap.rdb,expires_size) == -1)
+        {
+            snap.error = errno;
+            return;
+        }
+        snap.selected = snap.dbid;
+        snap.scanning = 1;
+    }
+    snap.cursor = dictScan(db->dict,snap.cursor,snapshotScanCallback,NULL,
+                           &snap.dbid);
+    if (snap.cursor == 0) snapshotNextDb();
+}
+
+/* Release the snapshot state. */
+static void snapshotRelease(void) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++)
+        if (snap.seen[j]) dictRelease(snap.seen[j]);
+    zfree(snap.seen);
+    zfree(snap.seen_bytes);
+    zfree(snap.db_done);
+    sdsfree(snap.filename);
+    snap.seen = NULL;
+    snap.seen_bytes = NULL;
+    snap.db_done = NULL;
+    snap.filename = NULL;
+    snap.overhead = 0;
+}
+
+/* Write the trailer of the RDB, sync and rename the file. */
+static int snapshotFinish(void) {
+    uint64_t cksum;
+
+    if (snap.with_scripts && dictSize(server.lua_scripts)) {
+        dictIterator *di = dictGetIterator(server.lua_scripts);
+        dictEntry *de;
+
+        while((de = dictNext(di)) != NULL) {
+            robj *body = dictGetVal(de);
+            if (rdbSaveAuxField(&snap.rdb,"lua",3,body->ptr,
+                                sdslen(body->ptr)) == -1) break;
+        }
+        dictReleaseIterator(di);
+        if (de) return C_ERR;
+    }
+    if (rdbSaveType(&snap.rdb,RDB_OPCODE_EOF) == -1) return C_ERR;
+    cksum = snap.rdb.cksum;
+    memrev64ifbe(&cksum);
+    if (rioWrite(&snap.rdb,&cksum,8) == 0) return C_ERR;
+
+    if (fflush(snap.fp) == EOF) return C_ERR;
+    if (fsync(fileno(snap.fp)) == -1) return C_ERR;
+    if (fclose(snap.fp) == EOF) {
+        snap.fp = NULL;
+        return C_ERR;
+    }
+    snap.fp = NULL;
+    if (rename(snap.tmpfile,snap.filename) == -1) return C_ERR;
+    return C_OK;
+}
+
+/* Start a forkless snapshot of the dataset into 'filename'. Called by
+ * rdbSaveBackground() when rdb-forkless-save is enabled. */
+int rdbSaveForklessStart(char *filename, rdbSaveInfo *rsi) {
+    char magic[10];
+    int j;
+
+    snprintf(snap.tmpfile,sizeof(snap.tmpfile),"temp-forkless-%d.rdb",
+        (int) getpid());
+    snap.fp = fopen(snap.tmpfile,"w");
+    if (!snap.fp) {
+        server.lastbgsave_status = C_ERR;
+        serverLog(LL_WARNING,"Failed opening the RDB file %s for forkless "
+            "saving: %s", snap.tmpfile, strerror(errno));
+        return C_ERR;
+    }
+    rioInitWithFile(&snap.rdb,snap.fp);
+    snap.rdb.codec = server.rdb_compression_codec;
+    if (server.rdb_checksum)
+        snap.rdb.update_cksum = rioGenericUpdateChecksum;
+    snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
+    if (rioWrite(&snap.rdb,magic,9) == 0 ||
+        rdbSaveInfoAuxFields(&snap.rdb,RDB_SAVE_NONE,rsi) == -1)
+    {
+        server.lastbgsave_status = C_ERR;
+        serverLog(LL_WARNING,"Write error starting forkless saving: %s",
+            strerror(errno));
+        fclose(snap.fp);
+        unlink(snap.tmpfile);
+        return C_ERR;
+    }
+
+    snap.filename = sdsnew(filename);
+    snap.with_scripts = rsi != NULL;
+    snap.now = mstime();
+    snap.dbid = 0;
+    snap.scanning = 0;
+    snap.cursor = 0;
+    snap.db_done = zcalloc(sizeof(int)*server.dbnum);
+    snap.seen = zcalloc(sizeof(dict*)*server.dbnum);
+    snap.seen_bytes = zcalloc(sizeof(size_t)*server.dbnum);
+    snap.selected = -1;
+    snap.error = 0;
+    snap.last_fsync_off = 0;
+    snap.overhead = 0;
+    snap.peak_overhead = 0;
+    snap.saved_on_write = 0;
+
+    /* dictScan() may return elements already returned when the table
+     * shrinks: complete any shrinking in progress, no resize will start
+     * while saving, see updateDictResizePolicy(). */
+    for (j = 0; j < server.dbnum; j++) {
+        dict *d = server.db[j].dict;
+        while (dictIsRehashing(d) && d->ht[1].size < d->ht[0].size)
+            dictRehash(d,1000);
+    }
+
+    serverLog(LL_NOTICE,"Background forkless saving started");
+    server.rdb_save_time_start = time(NULL);
+    server.rdb_child_pid = RDB_CHILD_PID_FORKLESS;
+    server.rdb_child_type = RDB_CHILD_TYPE_DISK;
+    updateDictResizePolicy();
+    return C_OK;
+}
+
+/* Save the keyspace for up to 'budget' microseconds. Called from
+ * serverCron() and beforeSleep() while a forkless snapshot is in progress,
+ * see the RDB_FORKLESS_SAVE_* defines. */
+void rdbSaveForklessCron(int type) {
+    long long start = ustime(), budget;
+    int iterations = 0, retval;
+
+    if (type == RDB_FORKLESS_SAVE_FAST)
+        budget = RDB_FORKLESS_SAVE_FAST_DURATION;
+    else
+        budget = RDB_FORKLESS_SAVE_SLOW_TIME_PERC*1000000/server.hz/100;
+
+    while (snap.dbid < server.dbnum && !snap.error) {
+        snapshotScanStep();
+        if ((++iterations & 15) == 0 && ustime()-start > budget) break;
+    }
+
+    if (!snap.error &&
+        snap.rdb.processed_bytes >=
+        snap.last_fsync_off + RDB_FORKLESS_MAX_WRITTEN_BEFORE_FSYNC)
+    {
+        size_t sync_size = snap.rdb.processed_bytes - snap.last_fsync_off;
+
+        if (fflush(snap.fp) == EOF) {
+            snap.error = errno;
+        } else {
+            rdb_fsync_range(fileno(snap.fp),snap.last_fsync_off,sync_size);
+            snap.last_fsync_off += sync_size;
+        }
+    }
+    if (snap.dbid < server.dbnum && !snap.error) return;
+
+    retval = snap.error ? C_ERR : snapshotFinish();
+    if (retval == C_ERR) {
+        serverLog(LL_WARNING,"Write error in forkless saving: %s",
+            strerror(snap.error ? snap.error : errno));
+        if (snap.fp) fclose(snap.fp);
+        unlink(snap.tmpfile);
+    } else {
+        serverLog(LL_NOTICE,
+            "Forkless saving used %zu MB of memory for keys modified "
+            "while saving (%llu keys saved on write)",
+            snap.peak_overhead/(1024*1024), snap.saved_on_write);
+        server.stat_rdb_cow_bytes = snap.peak_overhead;
+    }
+    snap.fp = NULL;
+    snapshotRelease();
+    backgroundSaveDoneHandler(retval == C_OK ? 0 : 1, 0);
+    updateDictResizePolicy();
+}
+
+/* Stop the forkless snapshot in progress, like killing a saving child. */
+void rdbSaveForklessAbort(void) {
+    if (snap.fp) fclose(snap.fp);
+    snap.fp = NULL;
+    unlink(snap.tmpfile);
+    snapshotRelease();
+    backgroundSaveDoneHandler(0, SIGUSR1);
+    updateDictResizePolicy();
+}
+
+/* Called before 'key' in 'db' is modified, has its expire changed or is
+ * deleted: if the scan didn't save it yet, save it now. */
+void rdbSaveForklessKeyWillChange(redisDb *db, sds key) {
+    dictEntry *de;
+
+    if (snap.error || snapshotPassed(db,key) || snapshotSeen(db->id,key))
+        return;
+    if ((de = dictFind(db->dict,key)) == NULL) return;
+    snapshotSaveKey(db->id,de);
+    snapshotSetSeen(db->id,key);
+    snap.saved_on_write++;
+}
+
+/* Called when 'key' is added to 'db': the scan must not save it. */
+void rdbSaveForklessKeyAdded(redisDb *db, sds key) {
+    if (snap.error || snapshotPassed(db,key)) return;
+    snapshotSetSeen(db->id,key);
+}
+
+/* Called before the content of 'dbid' (every DB if -1) is replaced as a
+ * whole, by FLUSHDB or SWAPDB for instance: save what is left of it now. */
+void rdbSaveForklessDbWillChange(int dbid) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+
+        if ((dbid != -1 && dbid != j) || snap.db_done[j]) continue;
+        if (j == snap.dbid) {
+            do {
+                snapshotScanStep();
+            } while (snap.dbid == j && !snap.error);
+        } else {
+            dictIterator *di = dictGetIterator(db->dict);
+            dictEntry *de;
+
+            while((de = dictNext(di)) != NULL) {
+                if (!snapshotSeen(j,dictGetKey(de))) snapshotSaveKey(j,de);
+            }
+            dictReleaseIterator(di);
+            snapshotDbDone(j);
+        }
+    }
+}
+
+/* Memory used by the forkless snapshot in progress to track the keys
+ * modified while saving. */
+size_t rdbSaveForklessOverhead(void) {
+    return snap.overhead;
+}
+
+unsigned long long rdbSaveForklessSavedOnWrite(void) {
+    return snap.saved_on_write;
+}
@@ -33,8 +33,6 @@
 #include "pqsort.h" /* Partial qsort for SORT+LIMIT */
 #include <math.h> /* isnan() */
 
-zskiplistNode* zslGetElementByRank(zskiplist *zsl, unsigned long rank);
-
 redisSortOperation *createSortOperation(int type, robj *pattern) {
     redisSortOperation *so = zmalloc(sizeof(*so));
     so->type = type;
@@ -303,7 +301,7 @@ void sortCommand(client *c) {
 
     /* Destructively convert encoded sorted sets for SORT. */
     if (sortval->type == OBJ_ZSET)
-        zsetConvert(sortval, OBJ_ENCODING_SKIPLIST);
+        zsetConvert(sortval, OBJ_ENCODING_BTREE);
 
     /* Objtain the length of the object to sort. */
     switch(sortval->type) {
@@ -397,32 +395,20 @@ void sortCommand(client *c) {
          * way, just getting the required range, as an optimization. */
 
         zset *zs = sortval->ptr;
-        zskiplist *zsl = zs->zsl;
-        zskiplistNode *ln;
+        zbtCursor cur;
         sds sdsele;
         int rangelen = vectorlen;
-
-        /* Check if starting point is trivial, before doing log(N) lookup. */
-        if (desc) {
-            long zsetlen = dictSize(((zset*)sortval->ptr)->dict);
-
-            ln = zsl->tail;
-            if (start > 0)
-                ln = zslGetElementByRank(zsl,zsetlen-start);
-        } else {
-            ln = zsl->header->level[0].forward;
-            if (start > 0)
-                ln = zslGetElementByRank(zsl,start+1);
-        }
+        long zsetlen = zbtLength(zs->zbt);
+        int valid = zbtSeekRank(zs->zbt,desc ? zsetlen-start : start+1,&cur);
 
         while(rangelen--) {
-            serverAssertWithInfo(c,sortval,ln != NULL);
-            sdsele = ln->ele;
+            serverAssertWithInfo(c,sortval,valid);
+            sdsele = zbtCursorEntry(&cur)->ele;
             vector[j].obj = createStringObject(sdsele,sdslen(sdsele));
             vector[j].u.score = 0;
             vector[j].u.cmpobj = NULL;
             j++;
-            ln = desc ? ln->backward : ln->level[0].forward;
+            valid = desc ? zbtPrev(&cur) : zbtNext(&cur);
         }
         /* Fix start/end: output code is not aware of this optimization. */
         end -= start;
@@ -38,11 +38,27 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
 
 /* Factory method to return a set that *can* hold "value". When the object has
  * an integer-encodable value, an intset will be returned. Otherwise a regular
- * hash table. */
-robj *setTypeCreate(sds value) {
+ * hash table.
+ *
+ * 'size_hint' is the number of members the caller is about to add: the hash
+ * table is created with room for them. The encoding is not picked from it,
+ * as some of the members may be repeated: setTypeAdd() converts the set once
+ * it really grows too big for an intset. */
+robj *setTypeCreate(sds value, size_t size_hint) {
     if (isSdsRepresentableAsLongLong(value,NULL) == C_OK)
         return createIntsetObject();
-    return createSetObject();
+
+    robj *o = createSetObject();
+    if (size_hint > DICT_HT_INITIAL_SIZE) dictExpand(o->ptr,size_hint);
+    return o;
+}
+
+/* Expand the hash table of an existing set for 'size_hint' more members, so
+ * that adding them does not rehash it again and again. As members may already
+ * be in the set the hash table can end up larger than needed. */
+void setTypeExpand(robj *set, size_t size_hint) {
+    if (set->encoding == OBJ_ENCODING_HT && size_hint > DICT_HT_INITIAL_SIZE)
+        dictExpand(set->ptr,dictSize((dict*)set->ptr)+size_hint);
 }
 
 /* Add the specified value into a set.
@@ -64,10 +80,11 @@ int setTypeAdd(robj *subject, sds value) {
             uint8_t success = 0;
             subject->ptr = intsetAdd(subject->ptr,llval,&success);
             if (success) {
-                /* Convert to regular set when the intset contains
-                 * too many entries. */
+                /* Convert to a roaring bitmap, or to a regular set, when
+                 * the intset contains too many entries. */
                 if (intsetLen(subject->ptr) > server.set_max_intset_entries)
-                    setTypeConvert(subject,OBJ_ENCODING_HT);
+                    setTypeConvert(subject,server.set_roaring_encoding ?
+                        OBJ_ENCODING_ROARING : OBJ_ENCODING_HT);
                 return 1;
             }
         } else {
@@ -79,6 +96,15 @@ int setTypeAdd(robj *subject, sds value) {
             serverAssert(dictAdd(subject->ptr,sdsdup(value),NULL) == DICT_OK);
             return 1;
         }
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
+            return roaringAdd(subject->ptr,llval);
+        } else {
+            /* Same as above: only integers fit a roaring bitmap. */
+            setTypeConvert(subject,OBJ_ENCODING_HT);
+            serverAssert(dictAdd(subject->ptr,sdsdup(value),NULL) == DICT_OK);
+            return 1;
+        }
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -98,12 +124,24 @@ int setTypeRemove(robj *setobj, sds value) {
             setobj->ptr = intsetRemove(setobj->ptr,llval,&success);
             if (success) return 1;
         }
+    } else if (setobj->encoding == OBJ_ENCODING_ROARING) {
+        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK)
+            return roaringRemove(setobj->ptr,llval);
     } else {
         serverPanic("Unknown set encoding");
     }
     return 0;
 }
 
+/* Remove a member returned as an integer by setTypeNext() or
+ * setTypeRandomElement(). */
+static void setTypeRemoveInteger(robj *setobj, int64_t llele) {
+    if (setobj->encoding == OBJ_ENCODING_INTSET)
+        setobj->ptr = intsetRemove(setobj->ptr,llele,NULL);
+    else
+        roaringRemove(setobj->ptr,llele);
+}
+
 int setTypeIsMember(robj *subject, sds value) {
     long long llval;
     if (subject->encoding == OBJ_ENCODING_HT) {
@@ -112,6 +150,9 @@ int setTypeIsMember(robj *subject, sds value) {
         if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
             return intsetFind((intset*)subject->ptr,llval);
         }
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK)
+            return roaringFind(subject->ptr,llval);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -126,6 +167,8 @@ setTypeIterator *setTypeInitIterator(robj *subject) {
         si->di = dictGetIterator(subject->ptr);
     } else if (si->encoding == OBJ_ENCODING_INTSET) {
         si->ii = 0;
+    } else if (si->encoding == OBJ_ENCODING_ROARING) {
+        roaringInitIterator(subject->ptr,&si->ri);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -161,6 +204,10 @@ int setTypeNext(setTypeIterator *si, sds *sdsele, int64_t *llele) {
         if (!intsetGet(si->subject->ptr,si->ii++,llele))
             return -1;
         *sdsele = NULL; /* Not needed. Defensive. */
+    } else if (si->encoding == OBJ_ENCODING_ROARING) {
+        if (!roaringNext(&si->ri,llele))
+            return -1;
+        *sdsele = NULL; /* Not needed. Defensive. */
     } else {
         serverPanic("Wrong set encoding in setTypeNext");
     }
@@ -183,6 +230,7 @@ sds setTypeNextObject(setTypeIterator *si) {
     switch(encoding) {
         case -1:    return NULL;
         case OBJ_ENCODING_INTSET:
+        case OBJ_ENCODING_ROARING:
             return sdsfromlonglong(intele);
         case OBJ_ENCODING_HT:
             return sdsdup(sdsele);
@@ -194,8 +242,8 @@ sds setTypeNextObject(setTypeIterator *si) {
 
 /* Return random element from a non empty set.
  * The returned element can be a int64_t value if the set is encoded
- * as an "intset" blob of integers, or an SDS string if the set
- * is a regular set.
+ * as an "intset" blob of integers or as a roaring bitmap, or an SDS string
+ * if the set is a regular set.
  *
  * The caller provides both pointers to be populated with the right
  * object. The return value of the function is the object->encoding
@@ -213,6 +261,9 @@ int setTypeRandomElement(robj *setobj, sds *sdsele, int64_t *llele) {
     } else if (setobj->encoding == OBJ_ENCODING_INTSET) {
         *llele = intsetRandom(setobj->ptr);
         *sdsele = NULL; /* Not needed. Defensive. */
+    } else if (setobj->encoding == OBJ_ENCODING_ROARING) {
+        *llele = roaringRandom(setobj->ptr);
+        *sdsele = NULL; /* Not needed. Defensive. */
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -224,6 +275,8 @@ unsigned long setTypeSize(const robj *subject) {
         return dictSize((const dict*)subject->ptr);
     } else if (subject->encoding == OBJ_ENCODING_INTSET) {
         return intsetLen((const intset*)subject->ptr);
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        return roaringLen((const roaring*)subject->ptr);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -231,11 +284,13 @@ unsigned long setTypeSize(const robj *subject) {
 
 /* Convert the set to specified encoding. The resulting dict (when converting
  * to a hash table) is presized to hold the number of elements in the original
- * set. */
+ * set. An intset can become a roaring bitmap or a hash table, a roaring
+ * bitmap can only become a hash table. */
 void setTypeConvert(robj *setobj, int enc) {
     setTypeIterator *si;
     serverAssertWithInfo(NULL,setobj,setobj->type == OBJ_SET &&
-                             setobj->encoding == OBJ_ENCODING_INTSET);
+                             (setobj->encoding == OBJ_ENCODING_INTSET ||
+                              setobj->encoding == OBJ_ENCODING_ROARING));
 
     if (enc == OBJ_ENCODING_HT) {
         int64_t intele;
@@ -243,7 +298,7 @@ void setTypeConvert(robj *setobj, int enc) {
         sds element;
 
         /* Presize the dict to avoid rehashing */
-        dictExpand(d,intsetLen(setobj->ptr));
+        dictExpand(d,setTypeSize(setobj));
 
         /* To add the elements we extract integers and create redis objects */
         si = setTypeInitIterator(setobj);
@@ -253,27 +308,57 @@ void setTypeConvert(robj *setobj, int enc) {
         }
         setTypeReleaseIterator(si);
 
+        freeSetObject(setobj);
         setobj->encoding = OBJ_ENCODING_HT;
-        zfree(setobj->ptr);
         setobj->ptr = d;
+    } else if (enc == OBJ_ENCODING_ROARING &&
+               setobj->encoding == OBJ_ENCODING_INTSET)
+    {
+        roaring *r = roaringNew();
+        int64_t intele;
+        uint32_t ii = 0;
+
+        /* The intset is sorted, so every add is an append. */
+        while (intsetGet(setobj->ptr,ii++,&intele)) roaringAdd(r,intele);
+        zfree(setobj->ptr);
+        setobj->encoding = OBJ_ENCODING_ROARING;
+        setobj->ptr = r;
     } else {
         serverPanic("Unsupported set conversion");
     }
 }
 
+/* Return a set object holding the members of 'r', that is owned by the
+ * returned object or released. Small results are stored as intsets, like
+ * any set built adding the same members one after the other. */
+robj *setTypeFromRoaring(roaring *r) {
+    if (roaringLen(r) > server.set_max_intset_entries)
+        return createRoaringSetObject(r);
+
+    robj *o = createIntsetObject();
+    roaringIterator it;
+    int64_t intele;
+
+    roaringInitIterator(r,&it);
+    while (roaringNext(&it,&intele)) o->ptr = intsetAdd(o->ptr,intele,NULL);
+    roaringFree(r);
+    return o;
+}
+
 void saddCommand(client *c) {
     robj *set;
     int j, added = 0;
 
     set = lookupKeyWrite(c->db,c->argv[1]);
     if (set == NULL) {
-        set = setTypeCreate(c->argv[2]->ptr);
+        set = setTypeCreate(c->argv[2]->ptr,c->argc-2);
         dbAdd(c->db,c->argv[1],set);
     } else {
         if (set->type != OBJ_SET) {
             addReply(c,shared.wrongtypeerr);
             return;
         }
+        setTypeExpand(set,c->argc-2);
     }
 
     for (j = 2; j < c->argc; j++) {
@@ -354,7 +439,7 @@ void smoveCommand(client *c) {
 
     /* Create the destination set when it doesn't exist */
     if (!dstset) {
-        dstset = setTypeCreate(ele->ptr);
+        dstset = setTypeCreate(ele->ptr,1);
         dbAdd(c->db,c->argv[2],dstset);
     }
 
@@ -475,10 +560,10 @@ void spopWithCountCommand(client *c) {
         while(count--) {
             /* Emit and remove. */
             encoding = setTypeRandomElement(set,&sdsele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (setEncodingIsInt(encoding)) {
                 addReplyBulkLongLong(c,llele);
                 objele = createStringObjectFromLongLong(llele);
-                set->ptr = intsetRemove(set->ptr,llele,NULL);
+                setTypeRemoveInteger(set,llele);
             } else {
                 addReplyBulkCBuffer(c,sdsele,sdslen(sdsele));
                 objele = createStringObject(sdsele,sdslen(sdsele));
@@ -505,12 +590,12 @@ void spopWithCountCommand(client *c) {
         /* Create a new set with just the remaining elements. */
         while(remaining--) {
             encoding = setTypeRandomElement(set,&sdsele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (setEncodingIsInt(encoding)) {
                 sdsele = sdsfromlonglong(llele);
             } else {
                 sdsele = sdsdup(sdsele);
             }
-            if (!newset) newset = setTypeCreate(sdsele);
+            if (!newset) newset = setTypeCreate(sdsele,remaining+1);
             setTypeAdd(newset,sdsele);
             setTypeRemove(set,sdsele);
             sdsfree(sdsele);
@@ -524,7 +609,7 @@ void spopWithCountCommand(client *c) {
         setTypeIterator *si;
         si = setTypeInitIterator(set);
         while((encoding = setTypeNext(si,&sdsele,&llele)) != -1) {
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (setEncodingIsInt(encoding)) {
                 addReplyBulkLongLong(c,llele);
                 objele = createStringObjectFromLongLong(llele);
             } else {
@@ -575,9 +660,9 @@ void spopCommand(client *c) {
     encoding = setTypeRandomElement(set,&sdsele,&llele);
 
     /* Remove the element from the set */
-    if (encoding == OBJ_ENCODING_INTSET) {
+    if (setEncodingIsInt(encoding)) {
         ele = createStringObjectFromLongLong(llele);
-        set->ptr = intsetRemove(set->ptr,llele,NULL);
+        setTypeRemoveInteger(set,llele);
     } else {
         ele = createStringObject(sdsele,sdslen(sdsele));
         setTypeRemove(set,ele->ptr);
@@ -652,7 +737,7 @@ void srandmemberWithCountCommand(client *c) {
         addReplyMultiBulkLen(c,count);
         while(count--) {
             encoding = setTypeRandomElement(set,&ele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (setEncodingIsInt(encoding)) {
                 addReplyBulkLongLong(c,llele);
             } else {
                 addReplyBulkCBuffer(c,ele,sdslen(ele));
@@ -689,7 +774,7 @@ void srandmemberWithCountCommand(client *c) {
         while((encoding = setTypeNext(si,&ele,&llele)) != -1) {
             int retval = DICT_ERR;
 
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (setEncodingIsInt(encoding)) {
                 retval = dictAdd(d,createStringObjectFromLongLong(llele),NULL);
             } else {
                 retval = dictAdd(d,createStringObject(ele,sdslen(ele)),NULL);
@@ -719,7 +804,7 @@ void srandmemberWithCountCommand(client *c) {
 
         while(added < count) {
             encoding = setTypeRandomElement(set,&ele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (setEncodingIsInt(encoding)) {
                 objele = createStringObjectFromLongLong(llele);
             } else {
                 objele = createStringObject(ele,sdslen(ele));
@@ -766,13 +851,106 @@ void srandmemberCommand(client *c) {
         checkType(c,set,OBJ_SET)) return;
 
     encoding = setTypeRandomElement(set,&ele,&llele);
-    if (encoding == OBJ_ENCODING_INTSET) {
+    if (setEncodingIsInt(encoding)) {
         addReplyBulkLongLong(c,llele);
     } else {
         addReplyBulkCBuffer(c,ele,sdslen(ele));
     }
 }
 
+/* Return the encoding shared by all the sets, or -1 when they don't use the
+ * same one or there are no sets at all. NULL entries (missing keys) are
+ * skipped. */
+static int setsCommonEncoding(robj **sets, unsigned long setnum) {
+    unsigned long j;
+    int enc = -1;
+
+    for (j = 0; j < setnum; j++) {
+        if (!sets[j]) continue;
+        if (enc != -1 && sets[j]->encoding != enc) return -1;
+        enc = sets[j]->encoding;
+    }
+    return enc;
+}
+
+/* Compute SET_OP_INTER, SET_OP_UNION or SET_OP_DIFF of sets that are all
+ * roaring bitmaps (or NULL, that is empty), a container at a time instead
+ * of a member at a time. Returns a new roaring bitmap. */
+static roaring *setsRoaringOp(robj **sets, unsigned long setnum, int op) {
+    roaring *r = NULL, *next;
+    unsigned long j;
+
+    if (op == SET_OP_DIFF && sets[0] == NULL) return roaringNew();
+    for (j = 0; j < setnum; j++) {
+        if (!sets[j]) continue;
+        if (r == NULL) {
+            r = roaringDup(sets[j]->ptr);
+            continue;
+        }
+        if (op == SET_OP_INTER)
+            next = roaringAnd(r,sets[j]->ptr);
+        else if (op == SET_OP_UNION)
+            next = roaringOr(r,sets[j]->ptr);
+        else
+            next = roaringAndNot(r,sets[j]->ptr);
+        roaringFree(r);
+        r = next;
+
+        /* Nothing can be added back to an empty intersection or diff. */
+        if (op != SET_OP_UNION && roaringLen(r) == 0) break;
+    }
+    return r;
+}
+
+/* Same as setsRoaringOp() for sets that are all intsets: the sorted arrays
+ * are merged, or galloped through when their sizes are very different. */
+static intset *setsIntsetOp(robj **sets, unsigned long setnum, int op) {
+    intset *is = NULL, *next;
+    unsigned long j;
+
+    if (op == SET_OP_DIFF && sets[0] == NULL) return intsetNew();
+    for (j = 0; j < setnum; j++) {
+        if (!sets[j]) continue;
+        if (is == NULL) {
+            is = intsetDup(sets[j]->ptr);
+            continue;
+        }
+        if (op == SET_OP_INTER)
+            next = intsetIntersect(is,sets[j]->ptr);
+        else if (op == SET_OP_UNION)
+            next = intsetUnion(is,sets[j]->ptr);
+        else
+            next = intsetDifference(is,sets[j]->ptr);
+        zfree(is);
+        is = next;
+
+        if (op != SET_OP_UNION && intsetLen(is) == 0) break;
+    }
+    return is;
+}
+
+/* Compute the SET_OP_INTER, SET_OP_UNION or SET_OP_DIFF of sets that are
+ * all intsets or all roaring bitmaps (NULL entries are missing keys, that
+ * is empty sets) working on the encoded integers directly. Returns a new
+ * set object with the result, or NULL when the encodings of the sets don't
+ * allow it, and the generic member at a time algorithms must be used. */
+static robj *setsIntegerOp(robj **sets, unsigned long setnum, int op) {
+    int enc = setsCommonEncoding(sets,setnum);
+
+    if (enc == OBJ_ENCODING_ROARING)
+        return setTypeFromRoaring(setsRoaringOp(sets,setnum,op));
+    if (enc == OBJ_ENCODING_INTSET) {
+        robj *o = createObject(OBJ_SET,setsIntsetOp(sets,setnum,op));
+        o->encoding = OBJ_ENCODING_INTSET;
+        /* A union may outgrow the intset limit. */
+        if (intsetLen(o->ptr) > server.set_max_intset_entries)
+            setTypeConvert(o,server.set_roaring_encoding ?
+                OBJ_ENCODING_ROARING : OBJ_ENCODING_HT);
+        return o;
+    }
+    return NULL;
+}
+
 int qsortCompareSetsByCardinality(const void *s1, const void *s2) {
     if (setTypeSize(*(robj**)s1) > setTypeSize(*(robj**)s2)) return 1;
     if (setTypeSize(*(robj**)s1) < setTypeSize(*(robj**)s2)) return -1;
@@ -795,7 +973,7 @@ void sinterGenericCommand(client *c, robj **setkeys,
                           unsigned long setnum, robj *dstkey) {
     robj **sets = zmalloc(sizeof(robj*)*setnum);
     setTypeIterator *si;
-    robj *dstset = NULL;
+    robj *dstset = NULL, *interset = NULL;
     sds elesds;
     int64_t intobj;
     void *replylen = NULL;
@@ -842,19 +1020,38 @@ void sinterGenericCommand(client *c, robj **setkeys,
         dstset = createIntsetObject();
     }
 
+    /* When all the sets are intsets or roaring bitmaps intersect them
+     * directly: the members of the result are then handled as the ones of
+     * the first set in the loop below, without looking them up again. */
+    if ((interset = setsIntegerOp(sets,setnum,SET_OP_INTER)) != NULL) {
+        if (dstkey) {
+            decrRefCount(dstset);
+            dstset = interset;
+            interset = NULL;
+            setnum = 0; /* The result is ready, skip the loop. */
+        } else {
+            sets[0] = interset;
+            setnum = 1;
+        }
+    }
+
     /* Iterate all the elements of the first (smallest) set, and test
      * the element against all the other sets, if at least one set does
      * not include the element it is discarded */
     si = setTypeInitIterator(sets[0]);
-    while((encoding = setTypeNext(si,&elesds,&intobj)) != -1) {
+    while(setnum && (encoding = setTypeNext(si,&elesds,&intobj)) != -1) {
         for (j = 1; j < setnum; j++) {
             if (sets[j] == sets[0]) continue;
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (setEncodingIsInt(encoding)) {
                 /* intset with intset is simple... and fast */
                 if (sets[j]->encoding == OBJ_ENCODING_INTSET &&
                     !intsetFind((intset*)sets[j]->ptr,intobj))
                 {
                     break;
+                } else if (sets[j]->encoding == OBJ_ENCODING_ROARING &&
+                           !roaringFind(sets[j]->ptr,intobj))
+                {
+                    break;
                 /* in order to compare an integer with an object we
                  * have to use the generic function, creating an object
                  * for this */
@@ -882,7 +1079,7 @@ void sinterGenericCommand(client *c, robj **setkeys,
                     addReplyBulkLongLong(c,intobj);
                 cardinality++;
             } else {
-                if (encoding == OBJ_ENCODING_INTSET) {
+                if (setEncodingIsInt(encoding)) {
                     elesds = sdsfromlonglong(intobj);
                     setTypeAdd(dstset,elesds);
                     sdsfree(elesds);
@@ -893,6 +1090,7 @@ void sinterGenericCommand(client *c, robj **setkeys,
         }
     }
     setTypeReleaseIterator(si);
+    if (interset) decrRefCount(interset);
 
     if (dstkey) {
         /* Store the resulting set into the target, if the intersection
@@ -934,7 +1132,7 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
                               robj *dstkey, int op) {
     robj **sets = zmalloc(sizeof(robj*)*setnum);
     setTypeIterator *si;
-    robj *dstset = NULL;
+    robj *dstset = NULL, *intresult;
     sds ele;
     int j, cardinality = 0;
     int diff_algo = 1;
@@ -992,7 +1190,13 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
      * this set object will be the resulting object to set into the target key*/
     dstset = createIntsetObject();
 
-    if (op == SET_OP_UNION) {
+    if ((intresult = setsIntegerOp(sets,setnum,op)) != NULL) {
+        /* All the inputs are intsets or roaring bitmaps: merge them
+         * directly instead of adding or removing one element at a time. */
+        decrRefCount(dstset);
+        dstset = intresult;
+        cardinality = setTypeSize(dstset);
+    } else if (op == SET_OP_UNION) {
         /* Union is trivial, just add every element of every set to the
          * temporary set. */
         for (j = 0; j < setnum; j++) {
@@ -1037,6 +1241,7 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
          *
          * This is O(N) where N is the sum of all the elements in every
          * set. */
+        dstset = createIntsetObject();
         for (j = 0; j < setnum; j++) {
             if (!sets[j]) continue; /* non existing keys are like empty sets */
 
@@ -37,257 +37,34 @@
  * data structure.
  *
  * The elements are added to a hash table mapping Redis objects to scores.
- * At the same time the elements are added to a skip list mapping scores
- * to Redis objects (so objects are sorted by scores in this "view").
+ * At the same time the elements are added to a B+tree (see zbtree.c) mapping
+ * scores to Redis objects (so objects are sorted by scores in this "view").
  *
  * Note that the SDS string representing the element is the same in both
- * the hash table and skiplist in order to save memory. What we do in order
+ * the hash table and the B+tree in order to save memory. What we do in order
  * to manage the shared SDS string more easily is to free the SDS string
- * only in zslFreeNode(). The dictionary has no value free method set.
- * So we should always remove an element from the dictionary, and later from
- * the skiplist.
+ * only when it is deleted from the B+tree. The dictionary has no key free
+ * method set. So we should always remove an element from the dictionary,
+ * and later from the B+tree.
  *
- * This skiplist implementation is almost a C translation of the original
- * algorithm described by William Pugh in "Skip Lists: A Probabilistic
- * Alternative to Balanced Trees", modified in three ways:
- * a) this implementation allows for repeated scores.
- * b) the comparison is not just by key (our 'score') but by satellite data.
- * c) there is a back pointer, so it's a doubly linked list with the back
- * pointers being only at "level 1". This allows to traverse the list
- * from tail to head, useful for ZREVRANGE. */
+ * The B+tree moves entries between its nodes as it splits and merges them,
+ * so the hash table stores the scores by value rather than pointing to
+ * them. */
 
 #include "server.h"
 #include <math.h>
 
 /*-----------------------------------------------------------------------------
- * Skiplist implementation of the low level API
+ * B+tree range operations
  *----------------------------------------------------------------------------*/
 
-/* wiki: https://zh.wikipedia.org/wiki/%E8%B7%B3%E8%B7%83%E5%88%97%E8%A1%A8
- * 跳跃表的思想
- * SkipList结合了链表和二分查找的思想
- * 将原始链表和一些通过“跳跃”生成的链表组成层
- * 第0层是原始链表，越上层“跳跃”的步距越大，链表元素越少
- * 上层链表是下层链表的子序列
- * 查找时从顶层向下，不断缩小搜索范围
- */
+/* 有序集合的B+树每个叶子连续存放多个(score, member), 内部节点记录子树的
+ * 元素个数: 按score/字典序查找一个范围的起点只需从根到叶子走一次, 排名
+ * 则是沿途左侧子树元素个数之和. */
 
 int zslLexValueGteMin(sds value, zlexrangespec *spec);
 int zslLexValueLteMax(sds value, zlexrangespec *spec);
 
-/* 创建一个跳跃表的节点，使用指定的层数 同时指定分值和sds*/
-/* Create a skiplist node with the specified number of levels.
- * The SDS string 'ele' is referenced by the node after the call. */
-zskiplistNode *zslCreateNode(int level, double score, sds ele) {
-    zskiplistNode *zn =
-        zmalloc(sizeof(*zn)+level*sizeof(struct zskiplistLevel));
-    zn->score = score;
-    zn->ele = ele;
-    return zn;
-}
-
-/* 创建一个跳跃表 */
-/* Create a new skiplist. */
-zskiplist *zslCreate(void) {
-    int j;
-    zskiplist *zsl;
-    /* 申请zskiplist空间，创建表头，表头的层为32层 */
-    zsl = zmalloc(sizeof(*zsl));
-    zsl->level = 1;
-    zsl->length = 0;
-    zsl->header = zslCreateNode(ZSKIPLIST_MAXLEVEL,0,NULL);
-    for (j = 0; j < ZSKIPLIST_MAXLEVEL; j++) {
-        zsl->header->level[j].forward = NULL;
-        zsl->header->level[j].span = 0;
-    }
-    zsl->header->backward = NULL;
-    zsl->tail = NULL;
-    return zsl;
-}
-
-/* 释放跳跃表的指定节点 */
-/* Free the specified skiplist node. The referenced SDS string representation
- * of the element is freed too, unless node->ele is set to NULL before calling
- * this function. */
-void zslFreeNode(zskiplistNode *node) {
-    sdsfree(node->ele);
-    zfree(node);
-}
-
-/* 释放整个跳跃表 */
-/* Free a whole skiplist. */
-void zslFree(zskiplist *zsl) {
-    zskiplistNode *node = zsl->header->level[0].forward, *next;
-
-    zfree(zsl->header);
-    while(node) {
-        next = node->level[0].forward;
-        zslFreeNode(node);
-        node = next;
-    }
-    zfree(zsl);
-}
-
-/* 返回一个随机值，用作新跳跃表节点的层数。
- * 返回的值介于 1 - 32之间，包括这两个值本身
- * 根据随机算法所使用的幂次定律，越大的值生成的几率越小。
- * http://blog.csdn.net/men_wen/article/details/70040026 算法解析
-*/
-/* Returns a random level for the new skiplist node we are going to create.
- * The return value of this function is between 1 and ZSKIPLIST_MAXLEVEL
- * (both inclusive), with a powerlaw-alike distribution where higher
- * levels are less likely to be returned. */
-int zslRandomLevel(void) {
-    int level = 1;
-    while ((random()&0xFFFF) < (ZSKIPLIST_P * 0xFFFF))
-        level += 1;
-    return (level<ZSKIPLIST_MAXLEVEL) ? level : ZSKIPLIST_MAXLEVEL;
-}
-
-/* 向跳跃表中插入一个新的节点， 分值为score, sds为ele */
-/* Insert a new node in the skiplist. Assumes the element does not already
- * exist (up to the caller to enforce that). The skiplist takes ownership
- * of the passed SDS string 'ele'. */
-zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele) {
-    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
-    unsigned int rank[ZSKIPLIST_MAXLEVEL];
-    int i, level;
-
-    serverAssert(!isnan(score));
-    x = zsl->header; /* 表头节点 */
-
-    /* 从最高层往下层遍历 找到所有层中，比新节点小但离的最近的节点 
-     * update[i]中保存的是当前层的最近的节点
-    */
-    for (i = zsl->level-1; i >= 0; i--) {
-        /* store rank that is crossed to reach the insert position */
-        rank[i] = i == (zsl->level-1) ? 0 : rank[i+1]; /* rank[i]记录上一层遍历的跨度 最高层跨度为0 */
-        /* 遍历每一层，找到最后一个小于插入节点的节点 */
-        while (x->level[i].forward && //当前层的向前指针不为空
-                (x->level[i].forward->score < score || //下一个节点的评分小于要插入节点的评分
-                    (x->level[i].forward->score == score && //下一个节点的评分等于要插入节点的评分
-                    sdscmp(x->level[i].forward->ele,ele) < 0))) //下一个节点sds小于要插入节点的sds
-        {
-            rank[i] += x->level[i].span; /* rank[i]中记录最后一个节点到上一个节点的跨度 加上 上一层的跨度 */
-            x = x->level[i].forward; /* 同层向前移动 */
-        }
-        update[i] = x; /* 用update保存每层遍历到的最后节点 */
-    }
-    
-    /* we assume the element is not already inside, since we allow duplicated
-     * scores, reinserting the same element should never happen since the
-     * caller of zslInsert() should test in the hash table if the element is
-     * already inside or not. */
-    level = zslRandomLevel(); /* 获取随机一个层数 */
-    if (level > zsl->level) { /* 获取的层数比当前的最高层数还要大 */
-        for (i = zsl->level; i < level; i++) {
-            rank[i] = 0; /* 将level及以上的rank跨度记录为0 */
-            update[i] = zsl->header; /* 记录的最后一个几点为表头 */
-            update[i]->level[i].span = zsl->length; /* 表头第i层记录的跨度为总节点数 */
-        }
-        zsl->level = level; /* 更新最高层数 */
-    }
-    x = zslCreateNode(level,score,ele); /* 创建新的节点 */
-    /* 新的节点有level层，从底向上依次遍历 */
-    for (i = 0; i < level; i++) {
-        /* 将第i层的向前指针，指向刚才找到的每层最后一个小于该节点的下一个节点
-         * 然后将刚才最后一个节点的下一个节点指向新创建的节点。
-         * 类似于将新的节点有序的插入每层的链表中。
-         */
-        x->level[i].forward = update[i]->level[i].forward;
-        update[i]->level[i].forward = x;
-
-        /* 然后更新节点每层的跨度 */
-        /* update span covered by update[i] as x is inserted here */
-        x->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
-        update[i]->level[i].span = (rank[0] - rank[i]) + 1;
-    }
-
-    /* 增加新层数到最高层数，每层最近节点该层的跨度 */
-    /* increment span for untouched levels */
-    for (i = level; i < zsl->level; i++) {
-        update[i]->level[i].span++;
-    }
-
-    /* 赋值前后指针 */
-    x->backward = (update[0] == zsl->header) ? NULL : update[0];
-    if (x->level[0].forward)
-        x->level[0].forward->backward = x;
-    else
-        zsl->tail = x;
-    zsl->length++; //节点数增加
-    return x;
-}
-
-/* 内部的辅助删除函数 供zslDelete， zslDeleteRangeByScore， zslDeleteRangeByRank调用 
- * 该函数没有释放x节点，由调用者处理
- * 该函数根据要删除的节点，更新了跳跃表的跨度和节点的前后指针
-*/
-/* Internal function used by zslDelete, zslDeleteByScore and zslDeleteByRank */
-void zslDeleteNode(zskiplist *zsl, zskiplistNode *x, zskiplistNode **update) {
-    int i;
-    /* 遍历所有层，更新跨度 */
-    for (i = 0; i < zsl->level; i++) {
-        if (update[i]->level[i].forward == x) {
-            update[i]->level[i].span += x->level[i].span - 1;
-            update[i]->level[i].forward = x->level[i].forward;
-        } else {
-            update[i]->level[i].span -= 1;
-        }
-    }
-    /* 处理前后指针 */
-    if (x->level[0].forward) {
-        x->level[0].forward->backward = x->backward;
-    } else {
-        zsl->tail = x->backward;
-    }
-    while(zsl->level > 1 && zsl->header->level[zsl->level-1].forward == NULL)
-        zsl->level--;
-    zsl->length--; //节点数减一
-}
-
-/* 删除在跳跃表中匹配到的元素节点，如果节点找到并删除返回1，否则返回0 */
-/* Delete an element with matching score/element from the skiplist.
- * The function returns 1 if the node was found and deleted, otherwise
- * 0 is returned.
- *
- * If 'node' is NULL the deleted node is freed by zslFreeNode(), otherwise
- * it is not freed (but just unlinked) and *node is set to the node pointer,
- * so that it is possible for the caller to reuse the node (including the
- * referenced SDS string at node->ele). */
-int zslDelete(zskiplist *zsl, double score, sds ele, zskiplistNode **node) {
-    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
-    int i;
-
-    /* 找到每层离删除积分节点最近的节点，保存在update中 */
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        while (x->level[i].forward &&
-                (x->level[i].forward->score < score ||
-                    (x->level[i].forward->score == score &&
-                     sdscmp(x->level[i].forward->ele,ele) < 0)))
-        {
-            x = x->level[i].forward;
-        }
-        update[i] = x;
-    }
-
-    /* 删除找到的节点，或者用node节点返回 */
-    /* We may have multiple elements with the same score, what we need
-     * is to find the element with both the right score and object. */
-    x = x->level[0].forward;
-    /* 判断找到的节点 */
-    if (x && score == x->score && sdscmp(x->ele,ele) == 0) {
-        zslDeleteNode(zsl, x, update); /* 处理跨度，前后指向指针 */
-        if (!node)
-            zslFreeNode(x); /* 如果没有指定参数node， 则直接删除找到的节点 */
-        else
-            *node = x; /* 如果有指定参数node，则用node参数返回 */
-        return 1;
-    }
-    return 0; /* not found */
-}
-
 /* 判断给定的值是否大于范围的最小值 */
 int zslValueGteMin(double value, zrangespec *spec) {
     return spec->minex ? (value > spec->min) : (value >= spec->min);
@@ -298,225 +75,6 @@ int zslValueLteMax(double value, zrangespec *spec) {
     return spec->maxex ? (value < spec->max) : (value <= spec->max);
 }
 
-/* 判断跳跃表的评分是否在指定范围内 */
-/* Returns if there is a part of the zset is in range. */
-int zslIsInRange(zskiplist *zsl, zrangespec *range) {
-    zskiplistNode *x;
-
-    /* Test for ranges that will always be empty. */
-    if (range->min > range->max ||
-            (range->min == range->max && (range->minex || range->maxex)))
-        return 0;
-    x = zsl->tail;
-    if (x == NULL || !zslValueGteMin(x->score,range))
-        return 0;
-    x = zsl->header->level[0].forward;
-    if (x == NULL || !zslValueLteMax(x->score,range))
-        return 0;
-    return 1;
-}
-
-/* 找到跳跃表中评分在指定范围内的第一个节点 */
-/* Find the first node that is contained in the specified range.
- * Returns NULL when no element is contained in the range. */
-zskiplistNode *zslFirstInRange(zskiplist *zsl, zrangespec *range) {
-    zskiplistNode *x;
-    int i;
-
-    /* If everything is out of range, return early. */
-    if (!zslIsInRange(zsl,range)) return NULL;
-
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        /* Go forward while *OUT* of range. */
-        while (x->level[i].forward &&
-            !zslValueGteMin(x->level[i].forward->score,range))
-                x = x->level[i].forward;
-    }
-
-    /* This is an inner range, so the next node cannot be NULL. */
-    x = x->level[0].forward;
-    serverAssert(x != NULL);
-
-    /* Check if score <= max. */
-    if (!zslValueLteMax(x->score,range)) return NULL;
-    return x;
-}
-
-/* 同上，找到最后一个 */
-/* Find the last node that is contained in the specified range.
- * Returns NULL when no element is contained in the range. */
-zskiplistNode *zslLastInRange(zskiplist *zsl, zrangespec *range) {
-    zskiplistNode *x;
-    int i;
-
-    /* If everything is out of range, return early. */
-    if (!zslIsInRange(zsl,range)) return NULL;
-
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        /* Go forward while *IN* range. */
-        while (x->level[i].forward &&
-            zslValueLteMax(x->level[i].forward->score,range))
-                x = x->level[i].forward;
-    }
-
-    /* This is an inner range, so this node cannot be NULL. */
-    serverAssert(x != NULL);
-
-    /* Check if score >= min. */
-    if (!zslValueGteMin(x->score,range)) return NULL;
-    return x;
-}
-
-/* 删除跳跃表中，所有评分在指定范围内的节点 */
-/* Delete all the elements with score between min and max from the skiplist.
- * Min and max are inclusive, so a score >= min || score <= max is deleted.
- * Note that this function takes the reference to the hash table view of the
- * sorted set, in order to remove the elements from the hash table too. */
-unsigned long zslDeleteRangeByScore(zskiplist *zsl, zrangespec *range, dict *dict) {
-    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
-    unsigned long removed = 0;
-    int i;
-
-    /* 找到每层离最小积分最近的节点 */
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        while (x->level[i].forward && (range->minex ?
-            x->level[i].forward->score <= range->min :
-            x->level[i].forward->score < range->min))
-                x = x->level[i].forward;
-        update[i] = x;
-    }
-
-    /* Current node is the last with score < or <= min. */
-    x = x->level[0].forward;
-
-    /* 从最小评分的开始，一直删除到最大评分的节点 */
-    /* Delete nodes while in range. */
-    while (x &&
-           (range->maxex ? x->score < range->max : x->score <= range->max))
-    {
-        zskiplistNode *next = x->level[0].forward;
-        zslDeleteNode(zsl,x,update);
-        dictDelete(dict,x->ele);
-        zslFreeNode(x); /* Here is where x->ele is actually released. */
-        removed++;
-        x = next;
-    }
-    return removed; /* 返回删除节点的数量 */
-}
-
-/* 删除跳跃表中元素在指定范围内的所有节点 */
-unsigned long zslDeleteRangeByLex(zskiplist *zsl, zlexrangespec *range, dict *dict) {
-    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
-    unsigned long removed = 0;
-    int i;
-
-
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        while (x->level[i].forward &&
-            !zslLexValueGteMin(x->level[i].forward->ele,range))
-                x = x->level[i].forward;
-        update[i] = x;
-    }
-
-    /* Current node is the last with score < or <= min. */
-    x = x->level[0].forward;
-
-    /* Delete nodes while in range. */
-    while (x && zslLexValueLteMax(x->ele,range)) {
-        zskiplistNode *next = x->level[0].forward;
-        zslDeleteNode(zsl,x,update);
-        dictDelete(dict,x->ele);
-        zslFreeNode(x); /* Here is where x->ele is actually released. */
-        removed++;
-        x = next;
-    }
-    return removed;
-}
-
-/* 删除跳跃表中， 跨度在start和end之间的所有节点 */
-/* Delete all the elements with rank between start and end from the skiplist.
- * Start and end are inclusive. Note that start and end need to be 1-based */
-unsigned long zslDeleteRangeByRank(zskiplist *zsl, unsigned int start, unsigned int end, dict *dict) {
-    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
-    unsigned long traversed = 0, removed = 0;
-    int i;
-
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        while (x->level[i].forward && (traversed + x->level[i].span) < start) {
-            traversed += x->level[i].span;
-            x = x->level[i].forward;
-        }
-        update[i] = x;
-    }
-
-    traversed++;
-    x = x->level[0].forward;
-    while (x && traversed <= end) {
-        zskiplistNode *next = x->level[0].forward;
-        zslDeleteNode(zsl,x,update);
-        dictDelete(dict,x->ele);
-        zslFreeNode(x);
-        removed++;
-        traversed++;
-        x = next;
-    }
-    return removed;
-}
-
-/* 获取跳跃表中指定评分和元素的节点的排行，也就是总跨度 */
-/* Find the rank for an element by both score and key.
- * Returns 0 when the element cannot be found, rank otherwise.
- * Note that the rank is 1-based due to the span of zsl->header to the
- * first element. */
-unsigned long zslGetRank(zskiplist *zsl, double score, sds ele) {
-    zskiplistNode *x;
-    unsigned long rank = 0;
-    int i;
-
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        while (x->level[i].forward &&
-            (x->level[i].forward->score < score ||
-                (x->level[i].forward->score == score &&
-                sdscmp(x->level[i].forward->ele,ele) <= 0))) {
-            rank += x->level[i].span;
-            x = x->level[i].forward;
-        }
-
-        /* x might be equal to zsl->header, so test if obj is non-NULL */
-        if (x->ele && sdscmp(x->ele,ele) == 0) {
-            return rank;
-        }
-    }
-    return 0;
-}
-
-/* 根据元素的排行来获取元素所在的节点 */
-/* Finds an element by its rank. The rank argument needs to be 1-based. */
-zskiplistNode* zslGetElementByRank(zskiplist *zsl, unsigned long rank) {
-    zskiplistNode *x;
-    unsigned long traversed = 0;
-    int i;
-
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        while (x->level[i].forward && (traversed + x->level[i].span) <= rank)
-        {
-            traversed += x->level[i].span;
-            x = x->level[i].forward;
-        }
-        if (traversed == rank) {
-            return x;
-        }
-    }
-    return NULL;
-}
-
 /* Populate the rangespec according to the objects min and max. */
 static int zslParseRange(robj *min, robj *max, zrangespec *spec) {
     char *eptr;
@@ -651,85 +209,145 @@ int zslLexValueLteMax(sds value, zlexrangespec *spec) {
         (sdscmplex(value,spec->max) <= 0);
 }
 
-/* 判断跳跃表的值是否在指定范围内，即判断第一个节点是否大于最小范围，
- * 最后一个节点是否小于最大节点
- */
-/* Returns if there is a part of the zset is in the lex range. */
-int zslIsInLexRange(zskiplist *zsl, zlexrangespec *range) {
-    zskiplistNode *x;
+/* zbtLowerBound() predicates: the entries before a range, and the entries
+ * up to the end of a range. */
+static int zbtBelowRange(const zbtEntry *e, void *range) {
+    return !zslValueGteMin(e->score,range);
+}
 
-    /* Test for ranges that will always be empty. */
-    if (sdscmplex(range->min,range->max) > 1 ||
-            (sdscmp(range->min,range->max) == 0 &&
-            (range->minex || range->maxex)))
-        return 0;
-    x = zsl->tail;
-    if (x == NULL || !zslLexValueGteMin(x->ele,range))
-        return 0;
-    x = zsl->header->level[0].forward;
-    if (x == NULL || !zslLexValueLteMax(x->ele,range))
-        return 0;
-    return 1;
+static int zbtNotAboveRange(const zbtEntry *e, void *range) {
+    return zslValueLteMax(e->score,range);
 }
 
-/* 找到跳跃表中在指定范围内的第一个节点 */
-/* Find the first node that is contained in the specified lex range.
- * Returns NULL when no element is contained in the range. */
-zskiplistNode *zslFirstInLexRange(zskiplist *zsl, zlexrangespec *range) {
-    zskiplistNode *x;
-    int i;
+static int zbtBelowLexRange(const zbtEntry *e, void *range) {
+    return !zslLexValueGteMin(e->ele,range);
+}
 
-    /* 判断跳跃表是否在范围内 */
-    /* If everything is out of range, return early. */
-    if (!zslIsInLexRange(zsl,range)) return NULL;
+static int zbtNotAboveLexRange(const zbtEntry *e, void *range) {
+    return zslLexValueLteMax(e->ele,range);
+}
+
+/* Test for ranges that will always be empty. */
+static int zslIsEmptyRange(zrangespec *range) {
+    return range->min > range->max ||
+           (range->min == range->max && (range->minex || range->maxex));
+}
 
-    /* 根据层判断，找到大于最小值的第一个节点 */
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        /* Go forward while *OUT* of range. */
-        while (x->level[i].forward &&
-            !zslLexValueGteMin(x->level[i].forward->ele,range))
-                x = x->level[i].forward;
+static int zslIsEmptyLexRange(zlexrangespec *range) {
+    return sdscmplex(range->min,range->max) > 1 ||
+           (sdscmp(range->min,range->max) == 0 &&
+           (range->minex || range->maxex));
+}
+
+/* 找到B+树中评分在指定范围内的第一个元素 */
+/* Point the cursor to the first entry that is contained in the specified
+ * range. Returns 0 when no element is contained in the range. */
+int zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtCursor *c) {
+    if (zslIsEmptyRange(range)) return 0;
+    if (!zbtLowerBound(zbt,zbtBelowRange,range,c)) return 0;
+    return zslValueLteMax(zbtCursorEntry(c)->score,range);
+}
+
+/* 同上，找到最后一个 */
+/* Point the cursor to the last entry that is contained in the specified
+ * range. Returns 0 when no element is contained in the range. */
+int zbtLastInRange(zbtree *zbt, zrangespec *range, zbtCursor *c) {
+    if (zslIsEmptyRange(range)) return 0;
+    /* The entry before the first one past the range. */
+    if (!zbtLowerBound(zbt,zbtNotAboveRange,range,c)) {
+        if (!zbtLast(zbt,c)) return 0;
+    } else if (!zbtPrev(c)) {
+        return 0;
     }
+    return zslValueGteMin(zbtCursorEntry(c)->score,range);
+}
 
-    /* This is an inner range, so the next node cannot be NULL. */
-    x = x->level[0].forward;
-    serverAssert(x != NULL);
+/* Point the cursor to the first entry that is contained in the specified
+ * lex range. Returns 0 when no element is contained in the range. */
+int zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range, zbtCursor *c) {
+    if (zslIsEmptyLexRange(range)) return 0;
+    if (!zbtLowerBound(zbt,zbtBelowLexRange,range,c)) return 0;
+    return zslLexValueLteMax(zbtCursorEntry(c)->ele,range);
+}
 
-    /* 判断是否超出了最大值 */
-    /* Check if score <= max. */
-    if (!zslLexValueLteMax(x->ele,range)) return NULL;
-    return x;
+/* Point the cursor to the last entry that is contained in the specified
+ * lex range. Returns 0 when no element is contained in the range. */
+int zbtLastInLexRange(zbtree *zbt, zlexrangespec *range, zbtCursor *c) {
+    if (zslIsEmptyLexRange(range)) return 0;
+    if (!zbtLowerBound(zbt,zbtNotAboveLexRange,range,c)) {
+        if (!zbtLast(zbt,c)) return 0;
+    } else if (!zbtPrev(c)) {
+        return 0;
+    }
+    return zslLexValueGteMin(zbtCursorEntry(c)->ele,range);
 }
 
-/* 找到跳跃表中在指定范围内最后一个节点 */
-/* Find the last node that is contained in the specified range.
- * Returns NULL when no element is contained in the range. */
-zskiplistNode *zslLastInLexRange(zskiplist *zsl, zlexrangespec *range) {
-    zskiplistNode *x;
-    int i;
+/* Move the cursor 'offset' entries forward, or backward if 'reverse' is
+ * true, using the subtree counts rather than visiting the entries. Returns
+ * 0 when moving past the end of the tree, or when 'offset' is negative,
+ * which like an offset past the end selects nothing. */
+static int zbtSkip(zbtree *zbt, zbtCursor *c, long offset, int reverse) {
+    if (offset == 0) return 1;
+    if (offset < 0) return 0;
 
-    /* If everything is out of range, return early. */
-    if (!zslIsInLexRange(zsl,range)) return NULL;
+    zbtEntry *e = zbtCursorEntry(c);
+    unsigned long rank = zbtGetRank(zbt,e->score,e->ele);
+    if (reverse) {
+        if ((unsigned long)offset >= rank) return 0;
+        return zbtSeekRank(zbt,rank-offset,c);
+    }
+    return zbtSeekRank(zbt,rank+offset,c);
+}
+
+/* Delete the entry at the cursor from both the views of the sorted set. */
+static void zbtDeleteEntry(zbtree *zbt, dict *dict, zbtCursor *c) {
+    zbtEntry e = *zbtCursorEntry(c);
+    dictDelete(dict,e.ele);
+    /* Here is where e.ele is actually released. */
+    serverAssert(zbtDelete(zbt,e.score,e.ele,NULL));
+}
+
+/* 删除B+树中，所有评分在指定范围内的元素 */
+/* Delete all the elements with score between min and max from the tree.
+ * Note that this function takes the reference to the hash table view of the
+ * sorted set, in order to remove the elements from the hash table too. */
+unsigned long zbtDeleteRangeByScore(zbtree *zbt, zrangespec *range, dict *dict) {
+    unsigned long removed = 0;
+    zbtCursor c;
 
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        /* Go forward while *IN* range. */
-        while (x->level[i].forward &&
-            zslLexValueLteMax(x->level[i].forward->ele,range))
-                x = x->level[i].forward;
+    while (zbtFirstInRange(zbt,range,&c)) {
+        zbtDeleteEntry(zbt,dict,&c);
+        removed++;
     }
+    return removed;
+}
 
-    /* This is an inner range, so this node cannot be NULL. */
-    serverAssert(x != NULL);
+unsigned long zbtDeleteRangeByLex(zbtree *zbt, zlexrangespec *range, dict *dict) {
+    unsigned long removed = 0;
+    zbtCursor c;
 
-    /* Check if score >= min. */
-    if (!zslLexValueGteMin(x->ele,range)) return NULL;
-    return x;
+    while (zbtFirstInLexRange(zbt,range,&c)) {
+        zbtDeleteEntry(zbt,dict,&c);
+        removed++;
+    }
+    return removed;
+}
+
+/* Delete all the elements with rank between start and end from the tree.
+ * Start and end are inclusive. Note that start and end need to be 1-based */
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned long start, unsigned long end, dict *dict) {
+    unsigned long removed = 0;
+    zbtCursor c;
+
+    while (start+removed <= end && zbtSeekRank(zbt,start,&c)) {
+        zbtDeleteEntry(zbt,dict,&c);
+        removed++;
+    }
+    return removed;
 }
 
 /*-----------------------------------------------------------------------------
- * Ziplist-backed sorted set API
+ * Listpack-backed sorted set API
  *----------------------------------------------------------------------------*/
 
 double zzlGetScore(unsigned char *sptr) {
@@ -740,7 +358,7 @@ double zzlGetScore(unsigned char *sptr) {
     double score;
 
     serverAssert(sptr != NULL);
-    serverAssert(ziplistGet(sptr,&vstr,&vlen,&vlong));
+    vstr = lpGetValue(sptr,&vlen,&vlong);
 
     if (vstr) {
         memcpy(buf,vstr,vlen);
@@ -753,14 +371,14 @@ double zzlGetScore(unsigned char *sptr) {
     return score;
 }
 
-/* Return a ziplist element as an SDS string. */
-sds ziplistGetObject(unsigned char *sptr) {
+/* Return a listpack element as an SDS string. */
+sds lpGetObject(unsigned char *sptr) {
     unsigned char *vstr;
     unsigned int vlen;
     long long vlong;
 
     serverAssert(sptr != NULL);
-    serverAssert(ziplistGet(sptr,&vstr,&vlen,&vlong));
+    vstr = lpGetValue(sptr,&vlen,&vlong);
 
     if (vstr) {
         return sdsnewlen((char*)vstr,vlen);
@@ -777,7 +395,7 @@ int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int cl
     unsigned char vbuf[32];
     int minlen, cmp;
 
-    serverAssert(ziplistGet(eptr,&vstr,&vlen,&vlong));
+    vstr = lpGetValue(eptr,&vlen,&vlong);
     if (vstr == NULL) {
         /* Store string representation of long long in buf. */
         vlen = ll2string((char*)vbuf,sizeof(vbuf),vlong);
@@ -791,7 +409,7 @@ int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int cl
 }
 
 unsigned int zzlLength(unsigned char *zl) {
-    return ziplistLen(zl)/2;
+    return lpLength(zl)/2;
 }
 
 /* Move to next entry based on the values in eptr and sptr. Both are set to
@@ -800,9 +418,9 @@ void zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
     unsigned char *_eptr, *_sptr;
     serverAssert(*eptr != NULL && *sptr != NULL);
 
-    _eptr = ziplistNext(zl,*sptr);
+    _eptr = lpNext(zl,*sptr);
     if (_eptr != NULL) {
-        _sptr = ziplistNext(zl,_eptr);
+        _sptr = lpNext(zl,_eptr);
         serverAssert(_sptr != NULL);
     } else {
         /* No next entry. */
@@ -819,9 +437,9 @@ void zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
     unsigned char *_eptr, *_sptr;
     serverAssert(*eptr != NULL && *sptr != NULL);
 
-    _sptr = ziplistPrev(zl,*eptr);
+    _sptr = lpPrev(zl,*eptr);
     if (_sptr != NULL) {
-        _eptr = ziplistPrev(zl,_sptr);
+        _eptr = lpPrev(zl,_sptr);
         serverAssert(_eptr != NULL);
     } else {
         /* No previous entry. */
@@ -843,13 +461,13 @@ int zzlIsInRange(unsigned char *zl, zrangespec *range) {
             (range->min == range->max && (range->minex || range->maxex)))
         return 0;
 
-    p = ziplistIndex(zl,-1); /* Last score. */
+    p = lpSeek(zl,-1); /* Last score. */
     if (p == NULL) return 0; /* Empty sorted set */
     score = zzlGetScore(p);
     if (!zslValueGteMin(score,range))
         return 0;
 
-    p = ziplistIndex(zl,1); /* First score. */
+    p = lpSeek(zl,1); /* First score. */
     serverAssert(p != NULL);
     score = zzlGetScore(p);
     if (!zslValueLteMax(score,range))
@@ -861,14 +479,14 @@ int zzlIsInRange(unsigned char *zl, zrangespec *range) {
 /* Find pointer to the first element contained in the specified range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
     double score;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInRange(zl,range)) return NULL;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
 
         score = zzlGetScore(sptr);
@@ -880,7 +498,7 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
 
     return NULL;
@@ -889,14 +507,14 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
 /* Find pointer to the last element contained in the specified range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,-2), *sptr;
+    unsigned char *eptr = lpSeek(zl,-2), *sptr;
     double score;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInRange(zl,range)) return NULL;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
 
         score = zzlGetScore(sptr);
@@ -909,9 +527,9 @@ unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
 
         /* Move to previous element by moving to the score of previous element.
          * When this returns NULL, we know there also is no element. */
-        sptr = ziplistPrev(zl,eptr);
+        sptr = lpPrev(zl,eptr);
         if (sptr != NULL)
-            serverAssert((eptr = ziplistPrev(zl,sptr)) != NULL);
+            serverAssert((eptr = lpPrev(zl,sptr)) != NULL);
         else
             eptr = NULL;
     }
@@ -920,14 +538,14 @@ unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
 }
 
 int zzlLexValueGteMin(unsigned char *p, zlexrangespec *spec) {
-    sds value = ziplistGetObject(p);
+    sds value = lpGetObject(p);
     int res = zslLexValueGteMin(value,spec);
     sdsfree(value);
     return res;
 }
 
 int zzlLexValueLteMax(unsigned char *p, zlexrangespec *spec) {
-    sds value = ziplistGetObject(p);
+    sds value = lpGetObject(p);
     int res = zslLexValueLteMax(value,spec);
     sdsfree(value);
     return res;
@@ -944,12 +562,12 @@ int zzlIsInLexRange(unsigned char *zl, zlexrangespec *range) {
             (range->minex || range->maxex)))
         return 0;
 
-    p = ziplistIndex(zl,-2); /* Last element. */
+    p = lpSeek(zl,-2); /* Last element. */
     if (p == NULL) return 0;
     if (!zzlLexValueGteMin(p,range))
         return 0;
 
-    p = ziplistIndex(zl,0); /* First element. */
+    p = lpSeek(zl,0); /* First element. */
     serverAssert(p != NULL);
     if (!zzlLexValueLteMax(p,range))
         return 0;
@@ -960,7 +578,7 @@ int zzlIsInLexRange(unsigned char *zl, zlexrangespec *range) {
 /* Find pointer to the first element contained in the specified lex range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInLexRange(zl,range)) return NULL;
@@ -974,9 +592,9 @@ unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
         }
 
         /* Move to next element. */
-        sptr = ziplistNext(zl,eptr); /* This element score. Skip it. */
+        sptr = lpNext(zl,eptr); /* This element score. Skip it. */
         serverAssert(sptr != NULL);
-        eptr = ziplistNext(zl,sptr); /* Next element. */
+        eptr = lpNext(zl,sptr); /* Next element. */
     }
 
     return NULL;
@@ -985,7 +603,7 @@ unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
 /* Find pointer to the last element contained in the specified lex range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,-2), *sptr;
+    unsigned char *eptr = lpSeek(zl,-2), *sptr;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInLexRange(zl,range)) return NULL;
@@ -1000,9 +618,9 @@ unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
 
         /* Move to previous element by moving to the score of previous element.
          * When this returns NULL, we know there also is no element. */
-        sptr = ziplistPrev(zl,eptr);
+        sptr = lpPrev(zl,eptr);
         if (sptr != NULL)
-            serverAssert((eptr = ziplistPrev(zl,sptr)) != NULL);
+            serverAssert((eptr = lpPrev(zl,sptr)) != NULL);
         else
             eptr = NULL;
     }
@@ -1011,66 +629,55 @@ unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
 }
 
 unsigned char *zzlFind(unsigned char *zl, sds ele, double *score) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr, *sptr;
 
-    while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+    /* Only the elements are compared, the scores are skipped. */
+    if ((eptr = lpFirst(zl)) == NULL) return NULL;
+    eptr = lpFind(zl,eptr,(unsigned char*)ele,sdslen(ele),1);
+    if (eptr) {
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
 
-        if (ziplistCompare(eptr,(unsigned char*)ele,sdslen(ele))) {
-            /* Matching element, pull out score. */
-            if (score != NULL) *score = zzlGetScore(sptr);
-            return eptr;
-        }
-
-        /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        /* Matching element, pull out score. */
+        if (score != NULL) *score = zzlGetScore(sptr);
+        return eptr;
     }
     return NULL;
 }
 
-/* Delete (element,score) pair from ziplist. Use local copy of eptr because we
+/* Delete (element,score) pair from listpack. Use local copy of eptr because we
  * don't want to modify the one given as argument. */
 unsigned char *zzlDelete(unsigned char *zl, unsigned char *eptr) {
-    unsigned char *p = eptr;
-
-    /* TODO: add function to ziplist API to delete N elements from offset. */
-    zl = ziplistDelete(zl,&p);
-    zl = ziplistDelete(zl,&p);
-    return zl;
+    return lpDeleteRangeWithEntry(zl,&eptr,2);
 }
 
 unsigned char *zzlInsertAt(unsigned char *zl, unsigned char *eptr, sds ele, double score) {
     unsigned char *sptr;
     char scorebuf[128];
     int scorelen;
-    size_t offset;
 
     scorelen = d2string(scorebuf,sizeof(scorebuf),score);
     if (eptr == NULL) {
-        zl = ziplistPush(zl,(unsigned char*)ele,sdslen(ele),ZIPLIST_TAIL);
-        zl = ziplistPush(zl,(unsigned char*)scorebuf,scorelen,ZIPLIST_TAIL);
+        zl = lpAppend(zl,(unsigned char*)ele,sdslen(ele));
+        zl = lpAppend(zl,(unsigned char*)scorebuf,scorelen);
     } else {
-        /* Keep offset relative to zl, as it might be re-allocated. */
-        offset = eptr-zl;
-        zl = ziplistInsert(zl,eptr,(unsigned char*)ele,sdslen(ele));
-        eptr = zl+offset;
+        /* Insert the element, 'sptr' is set to the inserted entry. */
+        zl = lpInsertString(zl,(unsigned char*)ele,sdslen(ele),eptr,LP_BEFORE,&sptr);
 
         /* Insert score after the element. */
-        serverAssert((sptr = ziplistNext(zl,eptr)) != NULL);
-        zl = ziplistInsert(zl,sptr,(unsigned char*)scorebuf,scorelen);
+        zl = lpInsertString(zl,(unsigned char*)scorebuf,scorelen,sptr,LP_AFTER,NULL);
     }
     return zl;
 }
 
-/* Insert (element,score) pair in ziplist. This function assumes the element is
+/* Insert (element,score) pair in listpack. This function assumes the element is
  * not yet present in the list. */
 unsigned char *zzlInsert(unsigned char *zl, sds ele, double score) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
     double s;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
         s = zzlGetScore(sptr);
 
@@ -1089,7 +696,7 @@ unsigned char *zzlInsert(unsigned char *zl, sds ele, double score) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
 
     /* Push on tail of list when it was not yet inserted. */
@@ -1098,6 +705,38 @@ unsigned char *zzlInsert(unsigned char *zl, sds ele, double score) {
     return zl;
 }
 
+/* Change the score of the element at 'eptr' to 'score'. When the element
+ * keeps its position, that is the new score still sorts it between its
+ * neighbours, only the score entry is replaced, otherwise the element is
+ * deleted and inserted again. */
+unsigned char *zzlUpdateScore(unsigned char *zl, unsigned char *eptr, sds ele, double score) {
+    unsigned char *sptr = lpNext(zl,eptr), *p;
+    char scorebuf[128];
+    int scorelen;
+    double s;
+
+    serverAssert(sptr != NULL);
+    if ((p = lpPrev(zl,eptr)) != NULL) {
+        s = zzlGetScore(p);
+        p = lpPrev(zl,p);
+        if (s > score || (s == score &&
+            zzlCompareElements(p,(unsigned char*)ele,sdslen(ele)) > 0))
+            goto move;
+    }
+    if ((p = lpNext(zl,sptr)) != NULL) {
+        s = zzlGetScore(lpNext(zl,p));
+        if (s < score || (s == score &&
+            zzlCompareElements(p,(unsigned char*)ele,sdslen(ele)) < 0))
+            goto move;
+    }
+    scorelen = d2string(scorebuf,sizeof(scorebuf),score);
+    return lpReplace(zl,&sptr,(unsigned char*)scorebuf,scorelen);
+
+move:
+    zl = zzlDelete(zl,eptr);
+    return zzlInsert(zl,ele,score);
+}
+
 unsigned char *zzlDeleteRangeByScore(unsigned char *zl, zrangespec *range, unsigned long *deleted) {
     unsigned char *eptr, *sptr;
     double score;
@@ -1108,14 +747,12 @@ unsigned char *zzlDeleteRangeByScore(unsigned char *zl, zrangespec *range, unsig
     eptr = zzlFirstInRange(zl,range);
     if (eptr == NULL) return zl;
 
-    /* When the tail of the ziplist is deleted, eptr will point to the sentinel
-     * byte and ziplistNext will return NULL. */
-    while ((sptr = ziplistNext(zl,eptr)) != NULL) {
+    /* When the tail of the listpack is deleted, eptr will be NULL. */
+    while (eptr && (sptr = lpNext(zl,eptr)) != NULL) {
         score = zzlGetScore(sptr);
         if (zslValueLteMax(score,range)) {
             /* Delete both the element and the score. */
-            zl = ziplistDelete(zl,&eptr);
-            zl = ziplistDelete(zl,&eptr);
+            zl = lpDeleteRangeWithEntry(zl,&eptr,2);
             num++;
         } else {
             /* No longer in range. */
@@ -1136,13 +773,11 @@ unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsi
     eptr = zzlFirstInLexRange(zl,range);
     if (eptr == NULL) return zl;
 
-    /* When the tail of the ziplist is deleted, eptr will point to the sentinel
-     * byte and ziplistNext will return NULL. */
-    while ((sptr = ziplistNext(zl,eptr)) != NULL) {
+    /* When the tail of the listpack is deleted, eptr will be NULL. */
+    while (eptr && (sptr = lpNext(zl,eptr)) != NULL) {
         if (zzlLexValueLteMax(eptr,range)) {
             /* Delete both the element and the score. */
-            zl = ziplistDelete(zl,&eptr);
-            zl = ziplistDelete(zl,&eptr);
+            zl = lpDeleteRangeWithEntry(zl,&eptr,2);
             num++;
         } else {
             /* No longer in range. */
@@ -1159,7 +794,7 @@ unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsi
 unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsigned int end, unsigned long *deleted) {
     unsigned int num = (end-start)+1;
     if (deleted) *deleted = num;
-    zl = ziplistDeleteRange(zl,2*(start-1),2*num);
+    zl = lpDeleteRange(zl,2*(start-1),2*num);
     return zl;
 }
 
@@ -1167,12 +802,20 @@ unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsig
  * Common sorted set API
  *----------------------------------------------------------------------------*/
 
+/* Add 'ele' with 'score' to the hash table view of a sorted set. The element
+ * must not be already there. */
+void zsetDictAdd(dict *d, sds ele, double score) {
+    dictEntry *de = dictAddRaw(d,ele,NULL);
+    serverAssert(de != NULL);
+    dictSetDoubleVal(de,score);
+}
+
 unsigned int zsetLength(const robj *zobj) {
     int length = -1;
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         length = zzlLength(zobj->ptr);
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
-        length = ((const zset*)zobj->ptr)->zsl->length;
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        length = zbtLength(((const zset*)zobj->ptr)->zbt);
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1181,85 +824,105 @@ unsigned int zsetLength(const robj *zobj) {
 
 void zsetConvert(robj *zobj, int encoding) {
     zset *zs;
-    zskiplistNode *node, *next;
     sds ele;
     double score;
 
     if (zobj->encoding == encoding) return;
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
         unsigned int vlen;
         long long vlong;
 
-        if (encoding != OBJ_ENCODING_SKIPLIST)
+        if (encoding != OBJ_ENCODING_BTREE)
             serverPanic("Unknown target encoding");
 
         zs = zmalloc(sizeof(*zs));
         zs->dict = dictCreate(&zsetDictType,NULL);
-        zs->zsl = zslCreate();
+        zs->zbt = zbtCreate();
+        dictExpand(zs->dict,zzlLength(zl));
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         serverAssertWithInfo(NULL,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssertWithInfo(NULL,zobj,sptr != NULL);
 
         while (eptr != NULL) {
             score = zzlGetScore(sptr);
-            serverAssertWithInfo(NULL,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
             if (vstr == NULL)
                 ele = sdsfromlonglong(vlong);
             else
                 ele = sdsnewlen((char*)vstr,vlen);
 
-            node = zslInsert(zs->zsl,score,ele);
-            serverAssert(dictAdd(zs->dict,ele,&node->score) == DICT_OK);
+            zbtInsert(zs->zbt,score,ele);
+            zsetDictAdd(zs->dict,ele,score);
             zzlNext(zl,&eptr,&sptr);
         }
 
         zfree(zobj->ptr);
         zobj->ptr = zs;
-        zobj->encoding = OBJ_ENCODING_SKIPLIST;
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
-        unsigned char *zl = ziplistNew();
+        zobj->encoding = OBJ_ENCODING_BTREE;
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        unsigned char *zl = lpNew(0);
+        zbtCursor c;
 
-        if (encoding != OBJ_ENCODING_ZIPLIST)
+        if (encoding != OBJ_ENCODING_LISTPACK)
             serverPanic("Unknown target encoding");
 
-        /* Approach similar to zslFree(), since we want to free the skiplist at
-         * the same time as creating the ziplist. */
         zs = zobj->ptr;
         dictRelease(zs->dict);
-        node = zs->zsl->header->level[0].forward;
-        zfree(zs->zsl->header);
-        zfree(zs->zsl);
-
-        while (node) {
-            zl = zzlInsertAt(zl,NULL,node->ele,node->score);
-            next = node->level[0].forward;
-            zslFreeNode(node);
-            node = next;
+        for (int ok = zbtFirst(zs->zbt,&c); ok; ok = zbtNext(&c)) {
+            zbtEntry *e = zbtCursorEntry(&c);
+            zl = zzlInsertAt(zl,NULL,e->ele,e->score);
         }
-
+        zbtFree(zs->zbt);
         zfree(zs);
         zobj->ptr = zl;
-        zobj->encoding = OBJ_ENCODING_ZIPLIST;
+        zobj->encoding = OBJ_ENCODING_LISTPACK;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
 }
 
-/* Convert the sorted set object into a ziplist if it is not already a ziplist
+/* Convert the sorted set object into a listpack if it is not already a listpack
  * and if the number of elements and the maximum element size is within the
  * expected ranges. */
-void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen) {
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) return;
+void zsetConvertToListpackIfNeeded(robj *zobj, size_t maxelelen) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) return;
     zset *zset = zobj->ptr;
 
-    if (zset->zsl->length <= server.zset_max_ziplist_entries &&
-        maxelelen <= server.zset_max_ziplist_value)
-            zsetConvert(zobj,OBJ_ENCODING_ZIPLIST);
+    if (zbtLength(zset->zbt) <= server.zset_max_listpack_entries &&
+        maxelelen <= server.zset_max_listpack_value)
+            zsetConvert(zobj,OBJ_ENCODING_LISTPACK);
+}
+
+/* Factory method to return a sorted set that can hold 'size_hint' members,
+ * the longest of them 'val_len_hint' bytes long. The encoding they would end
+ * up in is picked right away, and the hash table of the B+tree encoding is
+ * created with the right size. As some of the members may be repeated, the
+ * caller should call zsetConvertToListpackIfNeeded() once they are added. */
+robj *zsetTypeCreate(size_t size_hint, size_t val_len_hint) {
+    if (size_hint <= server.zset_max_listpack_entries &&
+        val_len_hint <= server.zset_max_listpack_value)
+        return createZsetListpackObject();
+
+    robj *zobj = createZsetObject();
+    zset *zs = zobj->ptr;
+    if (size_hint > DICT_HT_INITIAL_SIZE) dictExpand(zs->dict,size_hint);
+    return zobj;
+}
+
+/* Expand the hash table of an existing B+tree encoded sorted set for
+ * 'size_hint' more members. As members may already be in the set the hash
+ * table can end up larger than needed. A listpack is left alone: zsetAdd()
+ * converts it once it really grows too long. */
+void zsetTypeExpand(robj *zobj, size_t size_hint) {
+    if (zobj->encoding == OBJ_ENCODING_BTREE && size_hint > DICT_HT_INITIAL_SIZE) {
+        zset *zs = zobj->ptr;
+        dictExpand(zs->dict,dictSize(zs->dict)+size_hint);
+    }
 }
 
 /* Return (by reference) the score of the specified member of the sorted set
@@ -1269,13 +932,13 @@ void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen) {
 int zsetScore(robj *zobj, sds member, double *score) {
     if (!zobj || !member) return C_ERR;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         if (zzlFind(zobj->ptr, member, score) == NULL) return C_ERR;
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
         dictEntry *de = dictFind(zs->dict, member);
         if (de == NULL) return C_ERR;
-        *score = *(double*)dictGetVal(de);
+        *score = dictGetDoubleVal(de);
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1319,7 +982,7 @@ int zsetScore(robj *zobj, sds member, double *score) {
  * start.
  *
  * The commad as a side effect of adding a new element may convert the sorted
- * set internal encoding from ziplist to hashtable+skiplist.
+ * set internal encoding from listpack to hashtable+btree.
  *
  * Memory managemnet of 'ele':
  *
@@ -1340,7 +1003,7 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
     }
 
     /* Update the sorted set according to its encoding. */
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *eptr;
 
         if ((eptr = zzlFind(zobj->ptr,ele,&curscore)) != NULL) {
@@ -1360,10 +1023,9 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
                 if (newscore) *newscore = score;
             }
 
-            /* Remove and re-insert when score changed. */
+            /* Update the score, moving the element only if needed. */
             if (score != curscore) {
-                zobj->ptr = zzlDelete(zobj->ptr,eptr);
-                zobj->ptr = zzlInsert(zobj->ptr,ele,score);
+                zobj->ptr = zzlUpdateScore(zobj->ptr,eptr,ele,score);
                 *flags |= ZADD_UPDATED;
             }
             return 1;
@@ -1371,10 +1033,10 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
             /* Optimize: check if the element is too large or the list
              * becomes too long *before* executing zzlInsert. */
             zobj->ptr = zzlInsert(zobj->ptr,ele,score);
-            if (zzlLength(zobj->ptr) > server.zset_max_ziplist_entries)
-                zsetConvert(zobj,OBJ_ENCODING_SKIPLIST);
-            if (sdslen(ele) > server.zset_max_ziplist_value)
-                zsetConvert(zobj,OBJ_ENCODING_SKIPLIST);
+            if (zzlLength(zobj->ptr) > server.zset_max_listpack_entries)
+                zsetConvert(zobj,OBJ_ENCODING_BTREE);
+            if (sdslen(ele) > server.zset_max_listpack_value)
+                zsetConvert(zobj,OBJ_ENCODING_BTREE);
             if (newscore) *newscore = score;
             *flags |= ZADD_ADDED;
             return 1;
@@ -1382,9 +1044,8 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
             *flags |= ZADD_NOP;
             return 1;
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
-        zskiplistNode *znode;
         dictEntry *de;
 
         de = dictFind(zs->dict,ele);
@@ -1394,7 +1055,7 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
                 *flags |= ZADD_NOP;
                 return 1;
             }
-            curscore = *(double*)dictGetVal(de);
+            curscore = dictGetDoubleVal(de);
 
             /* Prepare the score for the increment if needed. */
             if (incr) {
@@ -1406,26 +1067,19 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
                 if (newscore) *newscore = score;
             }
 
-            /* Remove and re-insert when score changes. */
+            /* Update the score, moving the entry only as far as needed.
+             * The member SDS, which is also the key of the hash table
+             * entry, stays the same: we just update the score there. */
             if (score != curscore) {
-                zskiplistNode *node;
-                serverAssert(zslDelete(zs->zsl,curscore,ele,&node));
-                znode = zslInsert(zs->zsl,score,node->ele);
-                /* We reused the node->ele SDS string, free the node now
-                 * since zslInsert created a new one. */
-                node->ele = NULL;
-                zslFreeNode(node);
-                /* Note that we did not removed the original element from
-                 * the hash table representing the sorted set, so we just
-                 * update the score. */
-                dictGetVal(de) = &znode->score; /* Update score ptr. */
+                serverAssert(zbtUpdateScore(zs->zbt,curscore,ele,score));
+                dictSetDoubleVal(de,score);
                 *flags |= ZADD_UPDATED;
             }
             return 1;
         } else if (!xx) {
             ele = sdsdup(ele);
-            znode = zslInsert(zs->zsl,score,ele);
-            serverAssert(dictAdd(zs->dict,ele,&znode->score) == DICT_OK);
+            zbtInsert(zs->zbt,score,ele);
+            zsetDictAdd(zs->dict,ele,score);
             *flags |= ZADD_ADDED;
             if (newscore) *newscore = score;
             return 1;
@@ -1442,32 +1096,32 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
 /* Delete the element 'ele' from the sorted set, returning 1 if the element
  * existed and was deleted, 0 otherwise (the element was not there). */
 int zsetDel(robj *zobj, sds ele) {
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *eptr;
 
         if ((eptr = zzlFind(zobj->ptr,ele,NULL)) != NULL) {
             zobj->ptr = zzlDelete(zobj->ptr,eptr);
             return 1;
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
         dictEntry *de;
         double score;
 
         de = dictUnlink(zs->dict,ele);
         if (de != NULL) {
-            /* Get the score in order to delete from the skiplist later. */
-            score = *(double*)dictGetVal(de);
+            /* Get the score in order to delete from the tree later. */
+            score = dictGetDoubleVal(de);
 
-            /* Delete from the hash table and later from the skiplist.
-             * Note that the order is important: deleting from the skiplist
+            /* Delete from the hash table and later from the tree.
+             * Note that the order is important: deleting from the tree
              * actually releases the SDS string representing the element,
-             * which is shared between the skiplist and the hash table, so
-             * we need to delete from the skiplist as the final step. */
+             * which is shared between the tree and the hash table, so
+             * we need to delete from the tree as the final step. */
             dictFreeUnlinkedEntry(zs->dict,de);
 
-            /* Delete from skiplist. */
-            int retval = zslDelete(zs->zsl,score,ele,NULL);
+            /* Delete from the tree. */
+            int retval = zbtDelete(zs->zbt,score,ele,NULL);
             serverAssert(retval);
 
             if (htNeedsResize(zs->dict)) dictResize(zs->dict);
@@ -1496,18 +1150,18 @@ long zsetRank(robj *zobj, sds ele, int reverse) {
 
     llen = zsetLength(zobj);
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         serverAssert(eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
 
         rank = 1;
         while(eptr != NULL) {
-            if (ziplistCompare(eptr,(unsigned char*)ele,sdslen(ele)))
+            if (lpCompare(eptr,(unsigned char*)ele,sdslen(ele)))
                 break;
             rank++;
             zzlNext(zl,&eptr,&sptr);
@@ -1521,16 +1175,15 @@ long zsetRank(robj *zobj, sds ele, int reverse) {
         } else {
             return -1;
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
-        zskiplist *zsl = zs->zsl;
         dictEntry *de;
         double score;
 
         de = dictFind(zs->dict,ele);
         if (de != NULL) {
-            score = *(double*)dictGetVal(de);
-            rank = zslGetRank(zsl,score,ele);
+            score = dictGetDoubleVal(de);
+            rank = zbtGetRank(zs->zbt,score,ele);
             /* Existing elements always have a rank. */
             serverAssert(rank != 0);
             if (reverse)
@@ -1550,6 +1203,49 @@ long zsetRank(robj *zobj, sds ele, int reverse) {
  *----------------------------------------------------------------------------*/
 
 /* This generic command implements both ZADD and ZINCRBY. */
+/* Add the score-element pairs of a ZADD to a new, B+tree encoded sorted set
+ * in one go: the hash table is filled first, which also finds the repeated
+ * members, then the tree is built from all the entries at once instead of
+ * being descended for every member. Like with zsetAdd() called for every
+ * pair, the last score of a repeated member wins, or the first one with NX.
+ * Return the number of members added, and set '*updated' to the number of
+ * times a repeated member changed score. */
+static int zsetBulkAdd(robj *zobj, double *scores, robj **argv, int elements,
+                       int nx, int *updated)
+{
+    zset *zs = zobj->ptr;
+    zbtEntry *entries = zmalloc(sizeof(zbtEntry)*elements);
+    dictEntry **des = zmalloc(sizeof(dictEntry*)*elements);
+    int j, count = 0;
+
+    serverAssert(zbtLength(zs->zbt) == 0);
+    *updated = 0;
+    for (j = 0; j < elements; j++) {
+        sds ele = argv[j*2+1]->ptr;
+        dictEntry *de, *existing;
+
+        if ((de = dictAddRaw(zs->dict,ele,&existing)) != NULL) {
+            ele = sdsdup(ele);
+            dictSetKey(zs->dict,de,ele);
+            dictSetDoubleVal(de,scores[j]);
+            entries[count].ele = ele;
+            des[count] = de;
+            count++;
+        } else if (!nx && dictGetDoubleVal(existing) != scores[j]) {
+            dictSetDoubleVal(existing,scores[j]);
+            (*updated)++;
+        }
+    }
+
+    /* Entries are not moved when the hash table is rehashed: take the final
+     * scores from them. */
+    for (j = 0; j < count; j++) entries[j].score = dictGetDoubleVal(des[j]);
+    zbtBuild(zs->zbt,entries,count);
+    zfree(des);
+    zfree(entries);
+    return count;
+}
+
 void zaddGenericCommand(client *c, int flags) {
     static char *nanerr = "resulting score is not a number (NaN)";
     robj *key = c->argv[1];
@@ -1557,6 +1253,7 @@ void zaddGenericCommand(client *c, int flags) {
     sds ele;
     double score = 0, *scores = NULL;
     int j, elements;
+    size_t maxelelen = 0;
     int scoreidx = 0;
     /* The following vars are used in order to track what the command actually
      * did during the execution, to reply to the client and to trigger the
@@ -1614,25 +1311,32 @@ void zaddGenericCommand(client *c, int flags) {
     for (j = 0; j < elements; j++) {
         if (getDoubleFromObjectOrReply(c,c->argv[scoreidx+j*2],&scores[j],NULL)
             != C_OK) goto cleanup;
+        size_t elelen = sdslen(c->argv[scoreidx+1+j*2]->ptr);
+        if (elelen > maxelelen) maxelelen = elelen;
     }
 
     /* Lookup the key and create the sorted set if does not exist. */
     zobj = lookupKeyWrite(c->db,key);
     if (zobj == NULL) {
         if (xx) goto reply_to_client; /* No key + XX option: nothing to do. */
-        if (server.zset_max_ziplist_entries == 0 ||
-            server.zset_max_ziplist_value < sdslen(c->argv[scoreidx+1]->ptr))
-        {
-            zobj = createZsetObject();
-        } else {
-            zobj = createZsetZiplistObject();
-        }
+        zobj = zsetTypeCreate(elements,maxelelen);
         dbAdd(c->db,key,zobj);
+
+        /* Many members for a new key: build the sorted set in one go. */
+        if (zobj->encoding == OBJ_ENCODING_BTREE && !incr) {
+            added = zsetBulkAdd(zobj,scores,c->argv+scoreidx,elements,nx,
+                                &updated);
+            server.dirty += (added+updated);
+            zsetConvertToListpackIfNeeded(zobj,maxelelen);
+            goto reply_to_client;
+        }
     } else {
         if (zobj->type != OBJ_ZSET) {
             addReply(c,shared.wrongtypeerr);
             goto cleanup;
         }
+        /* With XX no member is added. */
+        if (!xx) zsetTypeExpand(zobj,elements);
     }
 
     for (j = 0; j < elements; j++) {
@@ -1758,7 +1462,7 @@ void zremrangeGenericCommand(client *c, int rangetype) {
     }
 
     /* Step 3: Perform the range deletion operation. */
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         switch(rangetype) {
         case ZRANGE_RANK:
             zobj->ptr = zzlDeleteRangeByRank(zobj->ptr,start+1,end+1,&deleted);
@@ -1774,17 +1478,17 @@ void zremrangeGenericCommand(client *c, int rangetype) {
             dbDelete(c->db,key);
             keyremoved = 1;
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
         switch(rangetype) {
         case ZRANGE_RANK:
-            deleted = zslDeleteRangeByRank(zs->zsl,start+1,end+1,zs->dict);
+            deleted = zbtDeleteRangeByRank(zs->zbt,start+1,end+1,zs->dict);
             break;
         case ZRANGE_SCORE:
-            deleted = zslDeleteRangeByScore(zs->zsl,&range,zs->dict);
+            deleted = zbtDeleteRangeByScore(zs->zbt,&range,zs->dict);
             break;
         case ZRANGE_LEX:
-            deleted = zslDeleteRangeByLex(zs->zsl,&lexrange,zs->dict);
+            deleted = zbtDeleteRangeByLex(zs->zbt,&lexrange,zs->dict);
             break;
         }
         if (htNeedsResize(zs->dict)) dictResize(zs->dict);
@@ -1836,6 +1540,7 @@ typedef struct {
                 intset *is;
                 int ii;
             } is;
+            roaringIterator ri;
             struct {
                 dict *dict;
                 dictIterator *di;
@@ -1851,8 +1556,9 @@ typedef struct {
             } zl;
             struct {
                 zset *zs;
-                zskiplistNode *node;
-            } sl;
+                zbtCursor cur;
+                int valid;
+            } bt;
         } zset;
     } iter;
 } zsetopsrc;
@@ -1891,6 +1597,8 @@ void zuiInitIterator(zsetopsrc *op) {
         if (op->encoding == OBJ_ENCODING_INTSET) {
             it->is.is = op->subject->ptr;
             it->is.ii = 0;
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            roaringInitIterator(op->subject->ptr,&it->ri);
         } else if (op->encoding == OBJ_ENCODING_HT) {
             it->ht.dict = op->subject->ptr;
             it->ht.di = dictGetIterator(op->subject->ptr);
@@ -1900,16 +1608,16 @@ void zuiInitIterator(zsetopsrc *op) {
         }
     } else if (op->type == OBJ_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             it->zl.zl = op->subject->ptr;
-            it->zl.eptr = ziplistIndex(it->zl.zl,0);
+            it->zl.eptr = lpSeek(it->zl.zl,0);
             if (it->zl.eptr != NULL) {
-                it->zl.sptr = ziplistNext(it->zl.zl,it->zl.eptr);
+                it->zl.sptr = lpNext(it->zl.zl,it->zl.eptr);
                 serverAssert(it->zl.sptr != NULL);
             }
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
-            it->sl.zs = op->subject->ptr;
-            it->sl.node = it->sl.zs->zsl->header->level[0].forward;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            it->bt.zs = op->subject->ptr;
+            it->bt.valid = zbtFirst(it->bt.zs->zbt,&it->bt.cur);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1924,7 +1632,8 @@ void zuiClearIterator(zsetopsrc *op) {
 
     if (op->type == OBJ_SET) {
         iterset *it = &op->iter.set;
-        if (op->encoding == OBJ_ENCODING_INTSET) {
+        if (op->encoding == OBJ_ENCODING_INTSET ||
+            op->encoding == OBJ_ENCODING_ROARING) {
             UNUSED(it); /* skip */
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dictReleaseIterator(it->ht.di);
@@ -1933,9 +1642,9 @@ void zuiClearIterator(zsetopsrc *op) {
         }
     } else if (op->type == OBJ_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             UNUSED(it); /* skip */
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
             UNUSED(it); /* skip */
         } else {
             serverPanic("Unknown sorted set encoding");
@@ -1952,6 +1661,8 @@ int zuiLength(zsetopsrc *op) {
     if (op->type == OBJ_SET) {
         if (op->encoding == OBJ_ENCODING_INTSET) {
             return intsetLen(op->subject->ptr);
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            return roaringLen(op->subject->ptr);
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dict *ht = op->subject->ptr;
             return dictSize(ht);
@@ -1959,11 +1670,11 @@ int zuiLength(zsetopsrc *op) {
             serverPanic("Unknown set encoding");
         }
     } else if (op->type == OBJ_ZSET) {
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             return zzlLength(op->subject->ptr);
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
             zset *zs = op->subject->ptr;
-            return zs->zsl->length;
+            return zbtLength(zs->zbt);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1996,6 +1707,13 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
             /* Move to next element. */
             it->is.ii++;
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            int64_t ell;
+
+            if (!roaringNext(&it->ri,&ell))
+                return 0;
+            val->ell = ell;
+            val->score = 1.0;
         } else if (op->encoding == OBJ_ENCODING_HT) {
             if (it->ht.de == NULL)
                 return 0;
@@ -2009,23 +1727,23 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
         }
     } else if (op->type == OBJ_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             /* No need to check both, but better be explicit. */
             if (it->zl.eptr == NULL || it->zl.sptr == NULL)
                 return 0;
-            serverAssert(ziplistGet(it->zl.eptr,&val->estr,&val->elen,&val->ell));
+            val->estr = lpGetValue(it->zl.eptr,&val->elen,&val->ell);
             val->score = zzlGetScore(it->zl.sptr);
 
             /* Move to next element. */
             zzlNext(it->zl.zl,&it->zl.eptr,&it->zl.sptr);
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
-            if (it->sl.node == NULL)
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            if (!it->bt.valid)
                 return 0;
-            val->ele = it->sl.node->ele;
-            val->score = it->sl.node->score;
+            val->ele = zbtCursorEntry(&it->bt.cur)->ele;
+            val->score = zbtCursorEntry(&it->bt.cur)->score;
 
             /* Move to next element. */
-            it->sl.node = it->sl.node->level[0].forward;
+            it->bt.valid = zbtNext(&it->bt.cur);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -2112,6 +1830,15 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
             } else {
                 return 0;
             }
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            if (zuiLongLongFromValue(val) &&
+                roaringFind(op->subject->ptr,val->ell))
+            {
+                *score = 1.0;
+                return 1;
+            } else {
+                return 0;
+            }
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dict *ht = op->subject->ptr;
             zuiSdsFromValue(val);
@@ -2127,18 +1854,18 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
     } else if (op->type == OBJ_ZSET) {
         zuiSdsFromValue(val);
 
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             if (zzlFind(op->subject->ptr,val->ele,score) != NULL) {
                 /* Score is already set by zzlFind. */
                 return 1;
             } else {
                 return 0;
             }
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
             zset *zs = op->subject->ptr;
             dictEntry *de;
             if ((de = dictFind(zs->dict,val->ele)) != NULL) {
-                *score = *(double*)dictGetVal(de);
+                *score = dictGetDoubleVal(de);
                 return 1;
             } else {
                 return 0;
@@ -2177,18 +1904,6 @@ inline static void zunionInterAggregate(double *target, double val, int aggregat
     }
 }
 
-uint64_t dictSdsHash(const void *key);
-int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2);
-
-dictType setAccumulatorDictType = {
-    dictSdsHash,               /* hash function */
-    NULL,                      /* key dup */
-    NULL,                      /* val dup */
-    dictSdsKeyCompare,         /* key compare */
-    NULL,                      /* key destructor */
-    NULL                       /* val destructor */
-};
-
 void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
     int i, j;
     long setnum;
@@ -2199,7 +1914,9 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
     unsigned int maxelelen = 0;
     robj *dstobj;
     zset *dstzset;
-    zskiplistNode *znode;
+    zbtEntry *entries = NULL;
+    unsigned long count = 0;
+    mstime_t latency;
     int touched = 0;
 
     /* expect setnum input keys to be given */
@@ -2288,12 +2005,18 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
     dstobj = createZsetObject();
     dstzset = dstobj->ptr;
     memset(&zval, 0, sizeof(zval));
+    latencyStartMonitor(latency);
 
+    /* The result is collected in the dictionary of the destination, that
+     * shares the member SDS strings with the tree, and the tree is built at
+     * once in the end from the sorted entries: the aggregated scores are in
+     * no particular order, so the inputs can't simply be merged. */
     if (op == SET_OP_INTER) {
         /* Skip everything if the smallest input is empty. */
         if (zuiLength(&src[0]) > 0) {
             /* Precondition: as src[0] is non-empty and the inputs are ordered
              * by size, all src[i > 0] are non-empty too. */
+            entries = zmalloc(sizeof(zbtEntry)*zuiLength(&src[0]));
             zuiInitIterator(&src[0]);
             while (zuiNext(&src[0],&zval)) {
                 double score, value;
@@ -2301,6 +2024,8 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                 score = src[0].weight * zval.score;
                 if (isnan(score)) score = 0;
 
+                /* Probe the inputs from the smallest one, the most likely
+                 * to miss the element. */
                 for (j = 1; j < setnum; j++) {
                     /* It is not safe to access the zset we are
                      * iterating, so explicitly check for equal object. */
@@ -2318,24 +2043,23 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                 /* Only continue when present in every input. */
                 if (j == setnum) {
                     tmp = zuiNewSdsFromValue(&zval);
-                    znode = zslInsert(dstzset->zsl,score,tmp);
-                    dictAdd(dstzset->dict,tmp,&znode->score);
+                    zsetDictAdd(dstzset->dict,tmp,score);
+                    entries[count].score = score;
+                    entries[count].ele = tmp;
+                    count++;
                     if (sdslen(tmp) > maxelelen) maxelelen = sdslen(tmp);
                 }
             }
             zuiClearIterator(&src[0]);
         }
     } else if (op == SET_OP_UNION) {
-        dict *accumulator = dictCreate(&setAccumulatorDictType,NULL);
         dictIterator *di;
         dictEntry *de, *existing;
         double score;
 
-        if (setnum) {
-            /* Our union is at least as large as the largest set.
-             * Resize the dictionary ASAP to avoid useless rehashing. */
-            dictExpand(accumulator,zuiLength(&src[setnum-1]));
-        }
+        /* Our union is at least as large as the largest set.
+         * Resize the dictionary ASAP to avoid useless rehashing. */
+        dictExpand(dstzset->dict,zuiLength(&src[setnum-1]));
 
         /* Step 1: Create a dictionary of elements -> aggregated-scores
          * by iterating one sorted set after the other. */
@@ -2349,16 +2073,16 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                 if (isnan(score)) score = 0;
 
                 /* Search for this element in the accumulating dictionary. */
-                de = dictAddRaw(accumulator,zuiSdsFromValue(&zval),&existing);
+                de = dictAddRaw(dstzset->dict,zuiSdsFromValue(&zval),&existing);
                 /* If we don't have it, we need to create a new entry. */
                 if (!existing) {
                     tmp = zuiNewSdsFromValue(&zval);
                     /* Remember the longest single element encountered,
-                     * to understand if it's possible to convert to ziplist
+                     * to understand if it's possible to convert to listpack
                      * at the end. */
                      if (sdslen(tmp) > maxelelen) maxelelen = sdslen(tmp);
                     /* Update the element with its initial score. */
-                    dictSetKey(accumulator, de, tmp);
+                    dictSetKey(dstzset->dict, de, tmp);
                     dictSetDoubleVal(de,score);
                 } else {
                     /* Update the score with the score of the new instance
@@ -2373,30 +2097,31 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
             zuiClearIterator(&src[i]);
         }
 
-        /* Step 2: convert the dictionary into the final sorted set. */
-        di = dictGetIterator(accumulator);
-
-        /* We now are aware of the final size of the resulting sorted set,
-         * let's resize the dictionary embedded inside the sorted set to the
-         * right size, in order to save rehashing time. */
-        dictExpand(dstzset->dict,dictSize(accumulator));
-
+        /* Step 2: collect the entries the tree is built from. */
+        entries = zmalloc(sizeof(zbtEntry)*dictSize(dstzset->dict));
+        di = dictGetIterator(dstzset->dict);
         while((de = dictNext(di)) != NULL) {
-            sds ele = dictGetKey(de);
-            score = dictGetDoubleVal(de);
-            znode = zslInsert(dstzset->zsl,score,ele);
-            dictAdd(dstzset->dict,ele,&znode->score);
+            entries[count].score = dictGetDoubleVal(de);
+            entries[count].ele = dictGetKey(de);
+            count++;
         }
         dictReleaseIterator(di);
-        dictRelease(accumulator);
     } else {
         serverPanic("Unknown operator");
     }
 
+    if (entries) {
+        zbtBuild(dstzset->zbt,entries,count);
+        zfree(entries);
+    }
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded(op == SET_OP_UNION ? "zunionstore" : "zinterstore",
+                             latency);
+
     if (dbDelete(c->db,dstkey))
         touched = 1;
-    if (dstzset->zsl->length) {
-        zsetConvertToZiplistIfNeeded(dstobj,maxelelen);
+    if (zbtLength(dstzset->zbt)) {
+        zsetConvertToListpackIfNeeded(dstobj,maxelelen);
         dbAdd(c->db,dstkey,dstobj);
         addReplyLongLong(c,zsetLength(dstobj));
         signalModifiedKey(c->db,dstkey);
@@ -2464,7 +2189,7 @@ void zrangeGenericCommand(client *c, int reverse) {
     /* Return the result in form of a multi-bulk reply */
     addReplyMultiBulkLen(c, withscores ? (rangelen*2) : rangelen);
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -2472,16 +2197,16 @@ void zrangeGenericCommand(client *c, int reverse) {
         long long vlong;
 
         if (reverse)
-            eptr = ziplistIndex(zl,-2-(2*start));
+            eptr = lpSeek(zl,-2-(2*start));
         else
-            eptr = ziplistIndex(zl,2*start);
+            eptr = lpSeek(zl,2*start);
 
         serverAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         while (rangelen--) {
             serverAssertWithInfo(c,zobj,eptr != NULL && sptr != NULL);
-            serverAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
             if (vstr == NULL)
                 addReplyBulkLongLong(c,vlong);
             else
@@ -2496,30 +2221,19 @@ void zrangeGenericCommand(client *c, int reverse) {
                 zzlNext(zl,&eptr,&sptr);
         }
 
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
-        zskiplist *zsl = zs->zsl;
-        zskiplistNode *ln;
-        sds ele;
-
-        /* Check if starting point is trivial, before doing log(N) lookup. */
-        if (reverse) {
-            ln = zsl->tail;
-            if (start > 0)
-                ln = zslGetElementByRank(zsl,llen-start);
-        } else {
-            ln = zsl->header->level[0].forward;
-            if (start > 0)
-                ln = zslGetElementByRank(zsl,start+1);
-        }
+        zbtCursor cur;
+        int valid;
 
+        valid = zbtSeekRank(zs->zbt,reverse ? llen-start : start+1,&cur);
         while(rangelen--) {
-            serverAssertWithInfo(c,zobj,ln != NULL);
-            ele = ln->ele;
-            addReplyBulkCBuffer(c,ele,sdslen(ele));
+            serverAssertWithInfo(c,zobj,valid);
+            zbtEntry *e = zbtCursorEntry(&cur);
+            addReplyBulkCBuffer(c,e->ele,sdslen(e->ele));
             if (withscores)
-                addReplyDouble(c,ln->score);
-            ln = reverse ? ln->backward : ln->level[0].forward;
+                addReplyDouble(c,e->score);
+            valid = reverse ? zbtPrev(&cur) : zbtNext(&cur);
         }
     } else {
         serverPanic("Unknown sorted set encoding");
@@ -2589,7 +2303,7 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
     if ((zobj = lookupKeyReadOrReply(c,key,shared.emptymultibulk)) == NULL ||
         checkType(c,zobj,OBJ_ZSET)) return;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -2612,7 +2326,7 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
 
         /* Get score pointer for the first element. */
         serverAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
@@ -2639,8 +2353,7 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
                 if (!zslValueLteMax(score,&range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always succeed */
-            serverAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
 
             rangelen++;
             if (vstr == NULL) {
@@ -2660,20 +2373,20 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
                 zzlNext(zl,&eptr,&sptr);
             }
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
-        zskiplist *zsl = zs->zsl;
-        zskiplistNode *ln;
+        zbtCursor cur;
+        int valid;
 
-        /* If reversed, get the last node in range as starting point. */
+        /* If reversed, get the last entry in range as starting point. */
         if (reverse) {
-            ln = zslLastInRange(zsl,&range);
+            valid = zbtLastInRange(zs->zbt,&range,&cur);
         } else {
-            ln = zslFirstInRange(zsl,&range);
+            valid = zbtFirstInRange(zs->zbt,&range,&cur);
         }
 
         /* No "first" element in the specified interval. */
-        if (ln == NULL) {
+        if (!valid) {
             addReply(c, shared.emptymultibulk);
             return;
         }
@@ -2683,37 +2396,29 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
          * length in the output buffer, and will "fix" it later */
         replylen = addDeferredMultiBulkLength(c);
 
-        /* If there is an offset, just traverse the number of elements without
-         * checking the score because that is done in the next loop. */
-        while (ln && offset--) {
-            if (reverse) {
-                ln = ln->backward;
-            } else {
-                ln = ln->level[0].forward;
-            }
-        }
+        /* If there is an offset, jump by rank without checking the score
+         * because that is done in the next loop. */
+        valid = zbtSkip(zs->zbt,&cur,offset,reverse);
 
-        while (ln && limit--) {
-            /* Abort when the node is no longer in range. */
+        while (valid && limit--) {
+            zbtEntry *e = zbtCursorEntry(&cur);
+
+            /* Abort when the entry is no longer in range. */
             if (reverse) {
-                if (!zslValueGteMin(ln->score,&range)) break;
+                if (!zslValueGteMin(e->score,&range)) break;
             } else {
-                if (!zslValueLteMax(ln->score,&range)) break;
+                if (!zslValueLteMax(e->score,&range)) break;
             }
 
             rangelen++;
-            addReplyBulkCBuffer(c,ln->ele,sdslen(ln->ele));
+            addReplyBulkCBuffer(c,e->ele,sdslen(e->ele));
 
             if (withscores) {
-                addReplyDouble(c,ln->score);
+                addReplyDouble(c,e->score);
             }
 
-            /* Move to next node */
-            if (reverse) {
-                ln = ln->backward;
-            } else {
-                ln = ln->level[0].forward;
-            }
+            /* Move to next entry */
+            valid = reverse ? zbtPrev(&cur) : zbtNext(&cur);
         }
     } else {
         serverPanic("Unknown sorted set encoding");
@@ -2750,7 +2455,7 @@ void zcountCommand(client *c) {
     if ((zobj = lookupKeyReadOrReply(c, key, shared.czero)) == NULL ||
         checkType(c, zobj, OBJ_ZSET)) return;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         double score;
@@ -2765,7 +2470,7 @@ void zcountCommand(client *c) {
         }
 
         /* First element is in range */
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         score = zzlGetScore(sptr);
         serverAssertWithInfo(c,zobj,zslValueLteMax(score,&range));
 
@@ -2781,27 +2486,22 @@ void zcountCommand(client *c) {
                 zzlNext(zl,&eptr,&sptr);
             }
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
-        zskiplist *zsl = zs->zsl;
-        zskiplistNode *zn;
+        zbtree *zbt = zs->zbt;
+        zbtCursor cur;
         unsigned long rank;
 
         /* Find first element in range */
-        zn = zslFirstInRange(zsl, &range);
-
-        /* Use rank of first element, if any, to determine preliminary count */
-        if (zn != NULL) {
-            rank = zslGetRank(zsl, zn->score, zn->ele);
-            count = (zsl->length - (rank - 1));
-
-            /* Find last element in range */
-            zn = zslLastInRange(zsl, &range);
+        if (zbtFirstInRange(zbt, &range, &cur)) {
+            /* Use rank of first element to determine preliminary count */
+            rank = zbtGetRank(zbt, zbtCursorEntry(&cur)->score, zbtCursorEntry(&cur)->ele);
+            count = (zbtLength(zbt) - (rank - 1));
 
             /* Use rank of last element, if any, to determine the actual count */
-            if (zn != NULL) {
-                rank = zslGetRank(zsl, zn->score, zn->ele);
-                count -= (zsl->length - rank);
+            if (zbtLastInRange(zbt, &range, &cur)) {
+                rank = zbtGetRank(zbt, zbtCursorEntry(&cur)->score, zbtCursorEntry(&cur)->ele);
+                count -= (zbtLength(zbt) - rank);
             }
         }
     } else {
@@ -2831,7 +2531,7 @@ void zlexcountCommand(client *c) {
         return;
     }
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
 
@@ -2846,7 +2546,7 @@ void zlexcountCommand(client *c) {
         }
 
         /* First element is in range */
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssertWithInfo(c,zobj,zzlLexValueLteMax(eptr,&range));
 
         /* Iterate over elements in range */
@@ -2859,27 +2559,22 @@ void zlexcountCommand(client *c) {
                 zzlNext(zl,&eptr,&sptr);
             }
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
-        zskiplist *zsl = zs->zsl;
-        zskiplistNode *zn;
+        zbtree *zbt = zs->zbt;
+        zbtCursor cur;
         unsigned long rank;
 
         /* Find first element in range */
-        zn = zslFirstInLexRange(zsl, &range);
-
-        /* Use rank of first element, if any, to determine preliminary count */
-        if (zn != NULL) {
-            rank = zslGetRank(zsl, zn->score, zn->ele);
-            count = (zsl->length - (rank - 1));
-
-            /* Find last element in range */
-            zn = zslLastInLexRange(zsl, &range);
+        if (zbtFirstInLexRange(zbt, &range, &cur)) {
+            /* Use rank of first element to determine preliminary count */
+            rank = zbtGetRank(zbt, zbtCursorEntry(&cur)->score, zbtCursorEntry(&cur)->ele);
+            count = (zbtLength(zbt) - (rank - 1));
 
             /* Use rank of last element, if any, to determine the actual count */
-            if (zn != NULL) {
-                rank = zslGetRank(zsl, zn->score, zn->ele);
-                count -= (zsl->length - rank);
+            if (zbtLastInLexRange(zbt, &range, &cur)) {
+                rank = zbtGetRank(zbt, zbtCursorEntry(&cur)->score, zbtCursorEntry(&cur)->ele);
+                count -= (zbtLength(zbt) - rank);
             }
         }
     } else {
@@ -2941,7 +2636,7 @@ void genericZrangebylexCommand(client *c, int reverse) {
         return;
     }
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -2964,7 +2659,7 @@ void genericZrangebylexCommand(client *c, int reverse) {
 
         /* Get score pointer for the first element. */
         serverAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
@@ -2989,9 +2684,7 @@ void genericZrangebylexCommand(client *c, int reverse) {
                 if (!zzlLexValueLteMax(eptr,&range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always
-             * succeed. */
-            serverAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
 
             rangelen++;
             if (vstr == NULL) {
@@ -3007,20 +2700,20 @@ void genericZrangebylexCommand(client *c, int reverse) {
                 zzlNext(zl,&eptr,&sptr);
             }
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
-        zskiplist *zsl = zs->zsl;
-        zskiplistNode *ln;
+        zbtCursor cur;
+        int valid;
 
-        /* If reversed, get the last node in range as starting point. */
+        /* If reversed, get the last entry in range as starting point. */
         if (reverse) {
-            ln = zslLastInLexRange(zsl,&range);
+            valid = zbtLastInLexRange(zs->zbt,&range,&cur);
         } else {
-            ln = zslFirstInLexRange(zsl,&range);
+            valid = zbtFirstInLexRange(zs->zbt,&range,&cur);
         }
 
         /* No "first" element in the specified interval. */
-        if (ln == NULL) {
+        if (!valid) {
             addReply(c, shared.emptymultibulk);
             zslFreeLexRange(&range);
             return;
@@ -3031,33 +2724,25 @@ void genericZrangebylexCommand(client *c, int reverse) {
          * length in the output buffer, and will "fix" it later */
         replylen = addDeferredMultiBulkLength(c);
 
-        /* If there is an offset, just traverse the number of elements without
-         * checking the score because that is done in the next loop. */
-        while (ln && offset--) {
-            if (reverse) {
-                ln = ln->backward;
-            } else {
-                ln = ln->level[0].forward;
-            }
-        }
+        /* If there is an offset, jump by rank without checking the element
+         * because that is done in the next loop. */
+        valid = zbtSkip(zs->zbt,&cur,offset,reverse);
 
-        while (ln && limit--) {
-            /* Abort when the node is no longer in range. */
+        while (valid && limit--) {
+            zbtEntry *e = zbtCursorEntry(&cur);
+
+            /* Abort when the entry is no longer in range. */
             if (reverse) {
-                if (!zslLexValueGteMin(ln->ele,&range)) break;
+                if (!zslLexValueGteMin(e->ele,&range)) break;
             } else {
-                if (!zslLexValueLteMax(ln->ele,&range)) break;
+                if (!zslLexValueLteMax(e->ele,&range)) break;
             }
 
             rangelen++;
-            addReplyBulkCBuffer(c,ln->ele,sdslen(ln->ele));
+            addReplyBulkCBuffer(c,e->ele,sdslen(e->ele));
 
-            /* Move to next node */
-            if (reverse) {
-                ln = ln->backward;
-            } else {
-                ln = ln->level[0].forward;
-            }
+            /* Move to next entry */
+            valid = reverse ? zbtPrev(&cur) : zbtNext(&cur);
         }
     } else {
         serverPanic("Unknown sorted set encoding");
@@ -0,0 +1,639 @@
+/* Ttlwheel -- a hierarchical timing wheel indexing items by expire time.
+ *
+ * Invariants:
+ *
+ * 1. An item is in exactly one bucket, whose range contains its expire time.
+ * 2. Buckets are never empty: a bucket is released with its last item.
+ * 3. The items of a level 0 bucket are all due once the bucket ended, and
+ *    the items of a coarser bucket are cascaded to the finer levels once it
+ *    started: ttlWheelNext() only looks at the first buckets of the radix
+ *    tree, the ones that started, and at most one of them is skipped.
+ * 4. Cascading an item moves it to a finer level. Because of this an item
+ *    is never in a level finer than the one its distance from the current
+ *    time selects, that is the first level ttlWheelDel() looks at.
+ *
+ * 桶内的哈希表使用线性探测, 删除时把后面的元素往回移, 不留墓碑. 只有在扩容
+ * 或缩容的渐进式迁移期间, 旧表中被删除或已迁移的槽位才标记为TW_DELETED,
+ * 使得旧表中的查找可以越过它们继续探测.
+ *
+ * Bucket tables use linear probing, and deletions shift the following items
+ * back instead of leaving tombstones. The only exception is table[0] while
+ * a bucket is rehashing: there the slots of migrated or deleted items are
+ * set to TW_DELETED, so that lookups of the items not yet migrated can probe
+ * past them. table[0] is released when the migration completes, taking the
+ * tombstones with it.
+ */
+
+#include "fmacros.h"
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "ttlwheel.h"
+#include "zmalloc.h"
+#include "redisassert.h"
+
+#define TW_MIN_BITS 2           /* Smallest bucket table: 4 slots. */
+#define TW_REHASH_STEP 16       /* Slots migrated by every bucket update. */
+#define TW_REHASH_BATCH 1024    /* Slots migrated between two clock checks. */
+#define TW_KEYLEN 9             /* Start time and level of a bucket. */
+#define TW_DELETED ((void*)1)
+
+#define twLive(p) ((p) != NULL && (p) != TW_DELETED)
+
+/* ----------------------------- Bucket tables ----------------------------- */
+
+/* Fibonacci hashing of the item pointer: the low bits of pointers are often
+ * the same, the high bits of the product depend on all of them. */
+static inline unsigned long twSlot(void *item, int bits) {
+    return (unsigned long)(((uint64_t)(uintptr_t)item*0x9E3779B97F4A7C15ULL) >>
+                           (64-bits));
+}
+
+/* Return the slot of 'item' in the table, or -1 if it is not there. */
+static long twTableFind(void **table, int bits, void *item) {
+    unsigned long mask = (1UL<<bits)-1, i = twSlot(item,bits);
+
+    while (table[i] != NULL) {
+        if (table[i] == item) return i;
+        i = (i+1) & mask;
+    }
+    return -1;
+}
+
+/* Store 'item' in the first free slot after its home, returning the slot.
+ * The table must have no tombstones. */
+static unsigned long twTableInsert(void **table, int bits, void *item) {
+    unsigned long mask = (1UL<<bits)-1, i = twSlot(item,bits);
+
+    while (table[i] != NULL) i = (i+1) & mask;
+    table[i] = item;
+    return i;
+}
+
+/* Empty slot 'i', moving back the items of the probe sequence that follows
+ * it when the hole is between their home and their current slot. Items are
+ * only moved to slots that were in use, never before the first used one. */
+static void twTableDelete(void **table, int bits, unsigned long i) {
+    unsigned long mask = (1UL<<bits)-1, j = i;
+
+    while (1) {
+        j = (j+1) & mask;
+        if (table[j] == NULL) break;
+        unsigned long home = twSlot(table[j],bits);
+        if (((j-home) & mask) >= ((j-i) & mask)) {
+            table[i] = table[j];
+            i = j;
+        }
+    }
+    table[i] = NULL;
+}
+
+static twBucket *twBucketCreate(ttlWheel *w) {
+    twBucket *b = zmalloc(sizeof(*b));
+
+    b->size = 0;
+    b->cursor = 1UL<<TW_MIN_BITS;
+    b->rehashidx = -1;
+    b->bits[0] = TW_MIN_BITS;
+    b->bits[1] = 0;
+    b->table[0] = zcalloc(sizeof(void*)<<TW_MIN_BITS);
+    b->table[1] = NULL;
+    w->alloc += sizeof(*b)+(sizeof(void*)<<TW_MIN_BITS);
+    return b;
+}
+
+static void twBucketFree(void *ptr) {
+    twBucket *b = ptr;
+
+    zfree(b->table[0]);
+    zfree(b->table[1]);
+    zfree(b);
+}
+
+/* Migrate up to 'n' slots of table[0] to table[1], or all of them if 'n' is
+ * zero. table[0] is released once every slot was migrated. */
+static void twBucketRehash(ttlWheel *w, twBucket *b, int n) {
+    unsigned long slots;
+    int all = n == 0;
+
+    if (b->rehashidx == -1) return;
+    slots = 1UL<<b->bits[0];
+    while ((unsigned long)b->rehashidx < slots && (all || n--)) {
+        void **slot = b->table[0]+b->rehashidx;
+
+        if (twLive(*slot)) {
+            unsigned long i = twTableInsert(b->table[1],b->bits[1],*slot);
+            if (i < b->cursor) b->cursor = i;
+        }
+        if (*slot != NULL) *slot = TW_DELETED;
+        b->rehashidx++;
+    }
+    if ((unsigned long)b->rehashidx == slots) {
+        zfree(b->table[0]);
+        w->alloc -= sizeof(void*)<<b->bits[0];
+        b->table[0] = b->table[1];
+        b->bits[0] = b->bits[1];
+        b->table[1] = NULL;
+        b->rehashidx = -1;
+        w->rehashing--;
+    }
+}
+
+/* Start migrating the items to a table of 2^bits slots. */
+static void twBucketResize(ttlWheel *w, twBucket *b, int bits) {
+    b->table[1] = zcalloc(sizeof(void*)<<bits);
+    w->alloc += sizeof(void*)<<bits;
+    b->bits[1] = bits;
+    b->cursor = 1UL<<bits;
+    b->rehashidx = 0;
+    w->rehashing++;
+}
+
+static void twBucketAdd(ttlWheel *w, twBucket *b, void *item) {
+    unsigned long i;
+    int t;
+
+    /* The table new items go to is kept at most 3/4 full. Migrating a table
+     * takes less updates than filling the next one, so the first branch is
+     * only taken when a shrinking bucket starts growing again. */
+    if (b->rehashidx != -1 && (b->size+1)*4 > (3UL<<b->bits[1]))
+        twBucketRehash(w,b,0);
+    if (b->rehashidx == -1 && (b->size+1)*4 > (3UL<<b->bits[0]))
+        twBucketResize(w,b,b->bits[0]+1);
+
+    t = b->rehashidx != -1;
+    i = twTableInsert(b->table[t],b->bits[t],item);
+    if (i < b->cursor) b->cursor = i;
+    b->size++;
+    twBucketRehash(w,b,TW_REHASH_STEP);
+}
+
+/* Remove 'item' from the bucket. Returns 1 if it was found, otherwise 0. */
+static int twBucketDelete(ttlWheel *w, twBucket *b, void *item) {
+    long i;
+
+    if (b->rehashidx != -1 &&
+        (i = twTableFind(b->table[1],b->bits[1],item)) != -1)
+    {
+        twTableDelete(b->table[1],b->bits[1],i);
+    } else if ((i = twTableFind(b->table[0],b->bits[0],item)) != -1) {
+        if (b->rehashidx != -1)
+            b->table[0][i] = TW_DELETED;
+        else
+            twTableDelete(b->table[0],b->bits[0],i);
+    } else {
+        return 0;
+    }
+    b->size--;
+
+    if (b->rehashidx == -1 && b->bits[0] > TW_MIN_BITS &&
+        b->size*8 < (1UL<<b->bits[0]))
+    {
+        twBucketResize(w,b,b->bits[0]-1);
+    }
+    twBucketRehash(w,b,TW_REHASH_STEP);
+    return 1;
+}
+
+/* Return one of the items of a non empty bucket. Calling it again after the
+ * item is deleted costs O(1) amortized: the items of table[0] are found from
+ * rehashidx while migrating, and from the cursor afterwards. */
+static void *twBucketAny(ttlWheel *w, twBucket *b) {
+    if (b->rehashidx != -1) {
+        unsigned long slots = 1UL<<b->bits[0];
+
+        /* Skipping the slots with no item is migrating them. */
+        while ((unsigned long)b->rehashidx < slots &&
+               !twLive(b->table[0][b->rehashidx])) b->rehashidx++;
+        if ((unsigned long)b->rehashidx < slots)
+            return b->table[0][b->rehashidx];
+        twBucketRehash(w,b,0);
+    }
+    while (b->table[0][b->cursor] == NULL) b->cursor++;
+    return b->table[0][b->cursor];
+}
+
+/* Store up to 'count' items of the bucket in 'items', visiting the slots of
+ * the tables in order from the first one, or from a random one. Returns the
+ * number of items stored, that is only less than 'count' if the bucket holds
+ * less items: the tables are kept at least 1/8 full, so about 8 slots are
+ * visited per item. */
+static unsigned int twBucketSample(twBucket *b, void **items, unsigned int count,
+                                   int random_start)
+{
+    unsigned long slots0 = 1UL<<b->bits[0];
+    unsigned long total = slots0 + (b->rehashidx != -1 ? 1UL<<b->bits[1] : 0);
+    unsigned long idx = random_start ? (unsigned long)random() % total : 0;
+    unsigned long steps = total;
+    unsigned int stored = 0;
+
+    while (steps-- && stored < count) {
+        void *item = idx < slots0 ? b->table[0][idx] : b->table[1][idx-slots0];
+
+        if (twLive(item)) items[stored++] = item;
+        if (++idx == total) idx = 0;
+    }
+    return stored;
+}
+
+/* --------------------------------- Wheel --------------------------------- */
+
+/* Buckets are keyed by their start time, big endian with the sign bit
+ * flipped so that the order of the radix tree is the numerical one, then by
+ * level. */
+static void twEncodeKey(unsigned char *buf, long long start, int level) {
+    uint64_t ordered = (uint64_t)start ^ ((uint64_t)1<<63);
+    int j;
+
+    for (j = 7; j >= 0; j--) {
+        buf[j] = ordered & 0xff;
+        ordered >>= 8;
+    }
+    buf[8] = level;
+}
+
+static long long twDecodeKey(unsigned char *buf, int *level) {
+    uint64_t ordered = 0;
+    int j;
+
+    for (j = 0; j < 8; j++) ordered = (ordered << 8) | buf[j];
+    *level = buf[8];
+    return (long long)(ordered ^ ((uint64_t)1<<63));
+}
+
+#define twStart(when,level) ((when) & ~(TW_SPAN(level)-1))
+
+/* Return the level of an item expiring at 'when', at time 'now'. */
+static int twLevel(long long when, long long now) {
+    int level;
+
+    if (when <= now) return 0;
+    for (level = 0; level < TW_LEVELS-1; level++)
+        if (when-now < TW_WHEEL_SPAN(level)) break;
+    return level;
+}
+
+/* Return the bucket of the given level containing 'when'. If it does not
+ * exist it is created when 'create' is true, otherwise NULL is returned. */
+static twBucket *twLookup(ttlWheel *w, long long when, int level, int create) {
+    unsigned char key[TW_KEYLEN];
+    twBucket *b;
+
+    twEncodeKey(key,twStart(when,level),level);
+    b = raxFind(w->buckets,key,sizeof(key));
+    if (b != raxNotFound) return b;
+    if (!create) return NULL;
+    b = twBucketCreate(w);
+    raxInsert(w->buckets,key,sizeof(key),b,NULL);
+    return b;
+}
+
+/* Delete 'item' from the bucket of the given level containing 'when',
+ * releasing the bucket if it is left empty. */
+static int twDelete(ttlWheel *w, twBucket *b, void *item, long long when,
+                    int level)
+{
+    unsigned char key[TW_KEYLEN];
+
+    if (!twBucketDelete(w,b,item)) return 0;
+    w->size--;
+    if (b->size == 0) {
+        twEncodeKey(key,twStart(when,level),level);
+        raxRemove(w->buckets,key,sizeof(key),NULL);
+        w->alloc -= sizeof(*b)+(sizeof(void*)<<b->bits[0]);
+        if (b->rehashidx != -1) {
+            w->alloc -= sizeof(void*)<<b->bits[1];
+            w->rehashing--;
+        }
+        twBucketFree(b);
+    }
+    return 1;
+}
+
+/* Create a new wheel. 'getexpire' returns the expire time of an item, it
+ * is called with 'privdata' as second argument. */
+ttlWheel *ttlWheelCreate(long long (*getexpire)(void *item, void *privdata),
+                         void *privdata)
+{
+    ttlWheel *w = zmalloc(sizeof(*w));
+
+    w->buckets = raxNew();
+    w->size = 0;
+    w->rehashing = 0;
+    w->alloc = 0;
+    w->getExpire = getexpire;
+    w->privdata = privdata;
+    return w;
+}
+
+void ttlWheelRelease(ttlWheel *w) {
+    raxFreeWithCallback(w->buckets,twBucketFree);
+    zfree(w);
+}
+
+/* Add 'item' expiring at 'when'. The item must not be in the wheel. */
+void ttlWheelAdd(ttlWheel *w, void *item, long long when, long long now) {
+    twBucketAdd(w,twLookup(w,when,twLevel(when,now),1),item);
+    w->size++;
+}
+
+/* Delete 'item', that was added expiring at 'when'. The item pointer is
+ * only compared, never dereferenced. Returns 1 if the item was found,
+ * otherwise 0. */
+int ttlWheelDel(ttlWheel *w, void *item, long long when, long long now) {
+    int first = twLevel(when,now), j;
+
+    /* The item is at the level selected by its distance from now or at a
+     * coarser one (invariant 4). Try the finer ones last, in case the clock
+     * went backward since the item was added. */
+    for (j = 0; j < TW_LEVELS; j++) {
+        int level = (first+j) % TW_LEVELS;
+        twBucket *b = twLookup(w,when,level,0);
+
+        if (b && twDelete(w,b,item,when,level)) return 1;
+    }
+    return 0;
+}
+
+/* Make progress reclaiming the items due at time 'now'. Returns 0 if no
+ * item is due. Otherwise 1 is returned and '*item' is set to an item due,
+ * that the caller should delete, or to NULL if an item of a coarse bucket
+ * was cascaded instead: the work done by a call is always O(1). */
+int ttlWheelNext(ttlWheel *w, long long now, void **item) {
+    raxIterator ri;
+    long long start, when;
+    twBucket *b;
+    void *moved;
+    int level;
+
+    /* Find the first bucket that started, skipping the level 0 bucket
+     * containing 'now': its items are not all due yet. */
+    b = NULL;
+    raxStart(&ri,w->buckets);
+    raxSeek(&ri,"^",NULL,0);
+    while (raxNext(&ri)) {
+        start = twDecodeKey(ri.key,&level);
+        if (start > now) break;
+        if (level == 0 && start > now-TW_SPAN(0)) continue;
+        b = ri.data;
+        break;
+    }
+    raxStop(&ri);
+    if (b == NULL) return 0;
+
+    /* The items of a level 0 bucket are all due once it ended. */
+    if (level == 0) {
+        *item = twBucketAny(w,b);
+        return 1;
+    }
+
+    /* The start of a coarse bucket was reached: move one of its items to
+     * the level selected by the time left, that is a finer one. */
+    moved = twBucketAny(w,b);
+    when = w->getExpire(moved,w->privdata);
+    assert(twStart(when,level) == start);
+    twDelete(w,b,moved,when,level);
+    ttlWheelAdd(w,moved,when,now);
+    *item = NULL;
+    return 1;
+}
+
+/* Store up to 'count' items in 'items', returning how many were stored.
+ * If 'first' is true the items are taken from the first buckets, that are
+ * the ones expiring sooner, otherwise from a bucket picked at random. */
+unsigned int ttlWheelSample(ttlWheel *w, void **items, unsigned int count,
+                            int first)
+{
+    unsigned int stored = 0;
+    raxIterator ri;
+
+    raxStart(&ri,w->buckets);
+    raxSeek(&ri,"^",NULL,0);
+    if (first) {
+        while (stored < count && raxNext(&ri))
+            stored += twBucketSample(ri.data,items+stored,count-stored,0);
+    } else if (raxRandomWalk(&ri,0)) {
+        stored = twBucketSample(ri.data,items,count,1);
+    }
+    raxStop(&ri);
+    return stored;
+}
+
+static long long twUstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* Migrate the tables of the buckets being resized for about 'us'
+ * microseconds, so that buckets that are not updated anymore do not keep
+ * two tables. Returns the number of slots migrated. */
+long long ttlWheelRehashMicroseconds(ttlWheel *w, long long us) {
+    long long start = twUstime(), migrated = 0;
+    raxIterator ri;
+
+    if (w->rehashing == 0) return 0;
+    raxStart(&ri,w->buckets);
+    raxSeek(&ri,"^",NULL,0);
+    while (w->rehashing && raxNext(&ri)) {
+        twBucket *b = ri.data;
+
+        while (b->rehashidx != -1) {
+            twBucketRehash(w,b,TW_REHASH_BATCH);
+            migrated += TW_REHASH_BATCH;
+            if (twUstime()-start > us) goto done;
+        }
+    }
+done:
+    raxStop(&ri);
+    return migrated;
+}
+
+/* Return the memory used by the wheel. The radix tree does not track its
+ * allocations: estimate them as the node header, the child pointer
+ * referencing the node in its parent, and about as much for the key bytes
+ * and padding. */
+size_t ttlWheelMemory(ttlWheel *w) {
+    return sizeof(*w) + w->alloc +
+           w->buckets->numnodes*(sizeof(raxNode)+sizeof(raxNode*)*2);
+}
+
+#ifdef REDIS_TEST
+#include <stdio.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#define UNUSED(x) (void)(x)
+#define TEST(name) printf("test — %s\n", name);
+
+#define TW_TEST_ITEMS 20000
+
+static long long twTestExpire[TW_TEST_ITEMS];
+static char twTestItems[TW_TEST_ITEMS];
+
+static long long twTestGetExpire(void *item, void *privdata) {
+    UNUSED(privdata);
+    return twTestExpire[(char*)item-twTestItems];
+}
+
+/* Check the invariants of every bucket and return the number of items. */
+static unsigned long long twTestCheck(ttlWheel *w, long long now) {
+    unsigned long long total = 0;
+    raxIterator ri;
+
+    raxStart(&ri,w->buckets);
+    raxSeek(&ri,"^",NULL,0);
+    while (raxNext(&ri)) {
+        twBucket *b = ri.data;
+        unsigned long live = 0, j;
+        int level, t;
+        long long start = twDecodeKey(ri.key,&level);
+
+        assert(b->size > 0);
+        for (t = 0; t < 2; t++) {
+            if (t == 1 && b->rehashidx == -1) break;
+            for (j = 0; j < (1UL<<b->bits[t]); j++) {
+                void *item = b->table[t][j];
+                long long when;
+
+                if (!twLive(item)) continue;
+                when = twTestGetExpire(item,NULL);
+                assert(twStart(when,level) == start);
+                assert(level >= twLevel(when,now));
+                assert(twTableFind(b->table[t],b->bits[t],item) == (long)j);
+                if (t == 0 && b->rehashidx != -1)
+                    assert(j >= (unsigned long)b->rehashidx);
+                if (t == (b->rehashidx != -1)) assert(j >= b->cursor);
+                live++;
+            }
+        }
+        assert(live == b->size);
+        total += live;
+    }
+    raxStop(&ri);
+    assert(total == w->size);
+    return total;
+}
+
+/* Reclaim the items due, checking that they are all and only those that
+ * expired at least a level 0 bucket ago. */
+static unsigned long twTestDrain(ttlWheel *w, long long now) {
+    unsigned long reclaimed = 0;
+    void *item;
+    int j;
+
+    while (ttlWheelNext(w,now,&item)) {
+        if (item == NULL) continue;
+        j = (char*)item-twTestItems;
+        assert(twTestExpire[j] != -1 && twTestExpire[j] < now);
+        assert(ttlWheelDel(w,item,twTestExpire[j],now));
+        twTestExpire[j] = -1;
+        reclaimed++;
+    }
+    for (j = 0; j < TW_TEST_ITEMS; j++)
+        assert(twTestExpire[j] == -1 || twTestExpire[j] > now-TW_SPAN(0));
+    return reclaimed;
+}
+
+int ttlwheelTest(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+    long long now = 1500000000000LL;
+    ttlWheel *w;
+    int j, i;
+
+    srandom(1234);
+    for (j = 0; j < TW_TEST_ITEMS; j++) twTestExpire[j] = -1;
+
+    TEST("ttlwheel: items sharing an expire time are found and reclaimed") {
+        w = ttlWheelCreate(twTestGetExpire,NULL);
+        for (j = 0; j < TW_TEST_ITEMS; j++) {
+            twTestExpire[j] = now+1000;
+            ttlWheelAdd(w,twTestItems+j,twTestExpire[j],now);
+        }
+        assert(twTestCheck(w,now) == TW_TEST_ITEMS);
+        for (j = 0; j < TW_TEST_ITEMS; j += 2) {
+            assert(ttlWheelDel(w,twTestItems+j,twTestExpire[j],now));
+            assert(!ttlWheelDel(w,twTestItems+j,twTestExpire[j],now));
+            twTestExpire[j] = -1;
+        }
+        assert(twTestCheck(w,now) == TW_TEST_ITEMS/2);
+        assert(twTestDrain(w,now+1000) == 0);
+        assert(twTestDrain(w,now+1000+TW_SPAN(0)) == TW_TEST_ITEMS/2);
+        assert(ttlWheelSize(w) == 0 && raxSize(w->buckets) == 0);
+        assert(w->alloc == 0 && w->rehashing == 0);
+        ttlWheelRelease(w);
+    }
+
+    TEST("ttlwheel: random updates while time goes by") {
+        long long t = now;
+        unsigned long long count = 0;
+        void *samples[16];
+
+        w = ttlWheelCreate(twTestGetExpire,NULL);
+        for (i = 0; i < 200; i++) {
+            for (j = 0; j < 2000; j++) {
+                int k = random() % TW_TEST_ITEMS;
+                long long when;
+
+                /* Expire times from the past to a few years ahead. */
+                switch(random() % 4) {
+                case 0: when = t-1000+random()%20000; break;
+                case 1: when = t+random()%10000000; break;
+                case 2: when = t+(long long)random()*64; break;
+                default: when = -1; break;
+                }
+                if (twTestExpire[k] != -1) {
+                    assert(ttlWheelDel(w,twTestItems+k,twTestExpire[k],t));
+                    count--;
+                }
+                twTestExpire[k] = when;
+                if (when != -1) {
+                    ttlWheelAdd(w,twTestItems+k,when,t);
+                    count++;
+                }
+            }
+            assert(twTestCheck(w,t) == count);
+            if (i % 10 == 0) {
+                ttlWheelRehashMicroseconds(w,1000000);
+                assert(w->rehashing == 0);
+            }
+            unsigned int n = ttlWheelSample(w,samples,16,i & 1);
+            assert(n <= 16 && (count == 0 || n > 0));
+            while (n--)
+                assert(twTestExpire[(char*)samples[n]-twTestItems] != -1);
+            t += random() % 600000;
+            count -= twTestDrain(w,t);
+            assert(twTestCheck(w,t) == count);
+        }
+        for (j = 0; j < TW_TEST_ITEMS; j++) {
+            if (twTestExpire[j] == -1) continue;
+            assert(ttlWheelDel(w,twTestItems+j,twTestExpire[j],t));
+            twTestExpire[j] = -1;
+        }
+        assert(ttlWheelSize(w) == 0 && w->alloc == 0 && w->rehashing == 0);
+        ttlWheelRelease(w);
+    }
+
+    TEST("ttlwheel: items are found after the clock goes backward") {
+        long long base = twStart(now,TW_LEVELS-1);
+
+        w = ttlWheelCreate(twTestGetExpire,NULL);
+        for (j = 0; j < 100; j++) {
+            twTestExpire[j] = base+TW_WHEEL_SPAN(1)+j;
+            ttlWheelAdd(w,twTestItems+j,twTestExpire[j],base);
+        }
+        /* Cascade the items to level 0, then go back in time. */
+        assert(twTestDrain(w,base+TW_WHEEL_SPAN(1)) == 0);
+        for (j = 0; j < 100; j++) {
+            assert(twLookup(w,twTestExpire[j],0,0) != NULL);
+            assert(ttlWheelDel(w,twTestItems+j,twTestExpire[j],base));
+            twTestExpire[j] = -1;
+        }
+        assert(ttlWheelSize(w) == 0);
+        ttlWheelRelease(w);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,76 @@
+/* Ttlwheel -- a hierarchical timing wheel indexing items by expire time.
+ *
+ * 按过期时间把元素放进桶里: 每个桶覆盖一段对齐的时间, 近的桶细, 远的桶粗.
+ * 桶内是以元素指针为键的开放寻址哈希表, 所以每个元素只占一个指针的空间.
+ *
+ * Items are opaque pointers, stored in buckets covering an aligned range of
+ * expire times. Level 0 buckets span TW_SPAN(0) milliseconds and hold the
+ * items expiring within the next TW_WHEEL_SPAN(0) milliseconds; every other
+ * level is TW_LEVEL_BITS bits coarser and holds the items too far away for
+ * the level below it. When the start of a coarse bucket is reached its items
+ * are cascaded to the finer levels, so that items are reclaimed at most
+ * TW_SPAN(0) milliseconds after their expire time, while the number of
+ * buckets stays bounded whatever the expire times are.
+ *
+ * The buckets are kept in a radix tree ordered by start time. Inside a
+ * bucket the items are in no particular order: they live in an open
+ * addressing hash table keyed by the pointer itself, that is resized
+ * incrementally like the tables of dict.c: a few slots are migrated at every
+ * update of the bucket, and ttlWheelRehashMicroseconds() completes the
+ * migrations of the buckets that are not updated anymore. An item costs the
+ * slot of its pointer in the table, that is kept between 1/8 and 3/4 full.
+ *
+ * The wheel does not store the expire times: the caller provides them when
+ * adding and deleting an item, and the getExpire callback is used to find
+ * where an item goes when its bucket is cascaded.
+ */
+
+#ifndef __TTLWHEEL_H
+#define __TTLWHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "rax.h"
+
+#define TW_LEVELS 4
+#define TW_LEVEL_BITS 7
+#define TW_SHIFT(level) (7+(level)*TW_LEVEL_BITS)
+#define TW_SPAN(level) (1LL<<TW_SHIFT(level)) /* Bucket span in milliseconds. */
+#define TW_WHEEL_SPAN(level) (1LL<<(TW_SHIFT(level)+TW_LEVEL_BITS))
+
+typedef struct twBucket {
+    unsigned long size;         /* Number of items in both tables. */
+    unsigned long cursor;       /* No item of the newest table is before it. */
+    long rehashidx;             /* Next slot of table[0] to migrate, or -1. */
+    unsigned char bits[2];      /* log2 of the number of slots of the tables. */
+    void **table[2];            /* table[1] is only used while rehashing. */
+} twBucket;
+
+typedef struct ttlWheel {
+    rax *buckets;               /* (start time, level) -> twBucket. */
+    unsigned long long size;    /* Number of items. */
+    unsigned long rehashing;    /* Number of buckets being resized. */
+    size_t alloc;               /* Bytes used by the buckets and their tables. */
+    long long (*getExpire)(void *item, void *privdata);
+    void *privdata;
+} ttlWheel;
+
+#define ttlWheelSize(w) ((w)->size)
+#define ttlWheelIsRehashing(w) ((w)->rehashing != 0)
+
+ttlWheel *ttlWheelCreate(long long (*getexpire)(void *item, void *privdata),
+                         void *privdata);
+void ttlWheelRelease(ttlWheel *w);
+void ttlWheelAdd(ttlWheel *w, void *item, long long when, long long now);
+int ttlWheelDel(ttlWheel *w, void *item, long long when, long long now);
+int ttlWheelNext(ttlWheel *w, long long now, void **item);
+unsigned int ttlWheelSample(ttlWheel *w, void **items, unsigned int count,
+                            int first);
+long long ttlWheelRehashMicroseconds(ttlWheel *w, long long us);
+size_t ttlWheelMemory(ttlWheel *w);
+
+#ifdef REDIS_TEST
+int ttlwheelTest(int argc, char *argv[]);
+#endif
+
+#endif
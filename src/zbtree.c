@@ -0,0 +1,1102 @@
+/* Zbtree -- the ordered index of sorted sets, a B+tree with subtree counts.
+ *
+ * Entries are ordered by score, then by member with sdscmp(), like the
+ * skiplist that used to index sorted sets. Invariants:
+ *
+ * 1. All the leaves are at the same depth, 'height' levels below the root.
+ * 2. key[i] of an inner node is exactly the first entry below child[i],
+ *    including i = 0, so that the keys of a node can be binary searched and
+ *    the lower bound of any predicate found in a single descent.
+ * 3. count[i] of an inner node is the number of entries below child[i].
+ * 4. Only the root may be empty. Other nodes are kept at least a quarter
+ *    full by deletions; insertions split full nodes in halves, except when
+ *    appending at the tail or prepending at the head, where the full node is
+ *    left untouched so that sorted loads fill every leaf.
+ *
+ * 没有父指针: 修改时沿路径记录经过的内部节点和子节点下标(zbtPath),
+ * 分裂与合并再沿这条路径往上处理.
+ *
+ * There are no parent pointers: updates record the path of inner nodes and
+ * child indexes on the way down, and splits and merges walk it back up.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include "zbtree.h"
+#include "zmalloc.h"
+#include "redisassert.h"
+
+#define ZBT_LEAF_MIN (ZBT_LEAF_CAP/4)
+#define ZBT_INNER_MIN (ZBT_INNER_CAP/4)
+
+typedef struct zbtPath {
+    zbtInner *node[ZBT_MAX_HEIGHT];
+    uint32_t idx[ZBT_MAX_HEIGHT];
+} zbtPath;
+
+static inline int zbtCompare(const zbtEntry *e, double score, sds ele) {
+    if (e->score < score) return -1;
+    if (e->score > score) return 1;
+    if (e->ele == ele) return 0;
+    return sdscmp(e->ele,ele);
+}
+
+static zbtLeaf *zbtLeafNew(zbtree *t) {
+    zbtLeaf *l = zmalloc(sizeof(*l));
+    l->prev = l->next = NULL;
+    l->num = 0;
+    t->leaves++;
+    return l;
+}
+
+static zbtInner *zbtInnerNew(zbtree *t) {
+    zbtInner *n = zmalloc(sizeof(*n));
+    n->num = 0;
+    t->inners++;
+    return n;
+}
+
+zbtree *zbtCreate(void) {
+    zbtree *t = zmalloc(sizeof(*t));
+    t->leaves = t->inners = 0;
+    t->root = t->head = t->tail = zbtLeafNew(t);
+    t->length = 0;
+    t->height = 0;
+    return t;
+}
+
+static void zbtFreeNode(void *node, int height) {
+    if (height == 0) {
+        zbtLeaf *l = node;
+        for (uint32_t j = 0; j < l->num; j++) sdsfree(l->e[j].ele);
+    } else {
+        zbtInner *n = node;
+        for (uint32_t j = 0; j < n->num; j++) zbtFreeNode(n->child[j],height-1);
+    }
+    zfree(node);
+}
+
+void zbtFree(zbtree *t) {
+    zbtFreeNode(t->root,t->height);
+    zfree(t);
+}
+
+/* Index of the first entry of the leaf not smaller than (score,ele). */
+static uint32_t zbtLeafSearch(const zbtLeaf *l, double score, sds ele) {
+    uint32_t lo = 0, hi = l->num;
+    while (lo < hi) {
+        uint32_t mid = (lo+hi)/2;
+        if (zbtCompare(&l->e[mid],score,ele) < 0) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Index of the child that may hold (score,ele): the last one whose first
+ * entry is not greater, or the first child. */
+static uint32_t zbtInnerSearch(const zbtInner *n, double score, sds ele) {
+    uint32_t lo = 1, hi = n->num;
+    while (lo < hi) {
+        uint32_t mid = (lo+hi)/2;
+        if (zbtCompare(&n->key[mid],score,ele) <= 0) lo = mid+1;
+        else hi = mid;
+    }
+    return lo-1;
+}
+
+static zbtLeaf *zbtDescend(zbtree *t, double score, sds ele, zbtPath *p) {
+    void *node = t->root;
+    for (int h = 0; h < t->height; h++) {
+        zbtInner *n = node;
+        uint32_t i = zbtInnerSearch(n,score,ele);
+        p->node[h] = n;
+        p->idx[h] = i;
+        node = n->child[i];
+    }
+    return node;
+}
+
+/* The first entry of the node at depth 'level' of the path changed: update
+ * the keys of the ancestors it is the first entry of. */
+static void zbtUpdateMin(zbtPath *p, int level, const zbtEntry *first) {
+    while (level-- > 0) {
+        p->node[level]->key[p->idx[level]] = *first;
+        if (p->idx[level] != 0) break;
+    }
+}
+
+/* Return true if the node at depth 'level' of the path is the first (or the
+ * last, if 'last' is true) node of its level. */
+static int zbtPathIsEdge(zbtPath *p, int level, int last) {
+    for (int h = 0; h < level; h++) {
+        uint32_t edge = last ? p->node[h]->num-1 : 0;
+        if (p->idx[h] != edge) return 0;
+    }
+    return 1;
+}
+
+static void zbtLeafInsertAt(zbtLeaf *l, uint32_t pos, const zbtEntry *e) {
+    memmove(l->e+pos+1,l->e+pos,sizeof(zbtEntry)*(l->num-pos));
+    l->e[pos] = *e;
+    l->num++;
+}
+
+static void zbtInnerInsertAt(zbtInner *n, uint32_t pos, void *child,
+                             const zbtEntry *key, unsigned long count)
+{
+    uint32_t tail = n->num-pos;
+    memmove(n->key+pos+1,n->key+pos,sizeof(zbtEntry)*tail);
+    memmove(n->count+pos+1,n->count+pos,sizeof(unsigned long)*tail);
+    memmove(n->child+pos+1,n->child+pos,sizeof(void*)*tail);
+    n->key[pos] = *key;
+    n->count[pos] = count;
+    n->child[pos] = child;
+    n->num++;
+}
+
+/* Where to split a full node that is receiving a new entry (or child) at
+ * 'pos': in halves, unless the node is the last one and we are appending,
+ * or the first one and we are prepending, where the full node is kept as
+ * it is. Nodes [0,split) stay in the left node. */
+static uint32_t zbtSplitPoint(uint32_t cap, uint32_t pos, int first, int last) {
+    if (pos == cap && last) return cap;
+    if (pos == 0 && first) return 0;
+    return cap/2;
+}
+
+static unsigned long zbtInnerSum(const zbtInner *n) {
+    unsigned long sum = 0;
+    for (uint32_t j = 0; j < n->num; j++) sum += n->count[j];
+    return sum;
+}
+
+/* The node 'left' at depth 'level' of the path was split, and 'right' must
+ * be added to its parent right after it. Split the ancestors as needed. */
+static void zbtInsertChild(zbtree *t, zbtPath *p, int level, void *left,
+                           void *right, unsigned long lcount, unsigned long rcount)
+{
+    int isleaf = (level == t->height);
+
+    while (level > 0) {
+        zbtInner *parent = p->node[level-1];
+        uint32_t ins = p->idx[level-1]+1;
+        const zbtEntry *rkey = isleaf ? &((zbtLeaf*)right)->e[0] :
+                                        &((zbtInner*)right)->key[0];
+
+        parent->count[ins-1] = lcount;
+        if (parent->num < ZBT_INNER_CAP) {
+            zbtInnerInsertAt(parent,ins,right,rkey,rcount);
+            return;
+        }
+
+        zbtInner *sibling = zbtInnerNew(t);
+        uint32_t s = zbtSplitPoint(ZBT_INNER_CAP,ins,
+                                   zbtPathIsEdge(p,level-1,0),
+                                   zbtPathIsEdge(p,level-1,1));
+        uint32_t moved = ZBT_INNER_CAP-s;
+        memcpy(sibling->key,parent->key+s,sizeof(zbtEntry)*moved);
+        memcpy(sibling->count,parent->count+s,sizeof(unsigned long)*moved);
+        memcpy(sibling->child,parent->child+s,sizeof(void*)*moved);
+        sibling->num = moved;
+        parent->num = s;
+        if (ins < s || (ins == s && s < ZBT_INNER_CAP))
+            zbtInnerInsertAt(parent,ins,right,rkey,rcount);
+        else
+            zbtInnerInsertAt(sibling,ins-s,right,rkey,rcount);
+
+        left = parent;
+        right = sibling;
+        lcount = zbtInnerSum(parent);
+        rcount = zbtInnerSum(sibling);
+        isleaf = 0;
+        level--;
+    }
+
+    /* The root was split: the tree grows one level. */
+    zbtInner *root = zbtInnerNew(t);
+    root->num = 2;
+    root->key[0] = isleaf ? ((zbtLeaf*)left)->e[0] : ((zbtInner*)left)->key[0];
+    root->key[1] = isleaf ? ((zbtLeaf*)right)->e[0] : ((zbtInner*)right)->key[0];
+    root->count[0] = lcount;
+    root->count[1] = rcount;
+    root->child[0] = left;
+    root->child[1] = right;
+    t->root = root;
+    t->height++;
+    assert(t->height < ZBT_MAX_HEIGHT);
+}
+
+/* Insert a new entry. The caller must make sure that the member is not
+ * already in the tree: the tree takes ownership of 'ele'. */
+void zbtInsert(zbtree *t, double score, sds ele) {
+    zbtPath p;
+    zbtLeaf *leaf = zbtDescend(t,score,ele,&p);
+    uint32_t pos = zbtLeafSearch(leaf,score,ele);
+    zbtEntry e = {score, ele};
+
+    for (int h = 0; h < t->height; h++) p.node[h]->count[p.idx[h]]++;
+    t->length++;
+
+    if (leaf->num < ZBT_LEAF_CAP) {
+        zbtLeafInsertAt(leaf,pos,&e);
+        if (pos == 0) zbtUpdateMin(&p,t->height,&leaf->e[0]);
+        return;
+    }
+
+    zbtLeaf *right = zbtLeafNew(t);
+    uint32_t s = zbtSplitPoint(ZBT_LEAF_CAP,pos,leaf->prev == NULL,
+                               leaf->next == NULL);
+    memcpy(right->e,leaf->e+s,sizeof(zbtEntry)*(ZBT_LEAF_CAP-s));
+    right->num = ZBT_LEAF_CAP-s;
+    leaf->num = s;
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next) leaf->next->prev = right;
+    else t->tail = right;
+    leaf->next = right;
+
+    if (pos < s || (pos == s && s < ZBT_LEAF_CAP))
+        zbtLeafInsertAt(leaf,pos,&e);
+    else
+        zbtLeafInsertAt(right,pos-s,&e);
+    if (pos == 0) zbtUpdateMin(&p,t->height,&leaf->e[0]);
+    zbtInsertChild(t,&p,t->height,leaf,right,leaf->num,right->num);
+}
+
+static int zbtEntryCompare(const void *a, const void *b) {
+    const zbtEntry *eb = b;
+    return zbtCompare(a,eb->score,eb->ele);
+}
+
+/* Fill an empty tree with 'len' entries at once, bottom up, instead of
+ * descending from the root for every entry. The members must be unique and
+ * the tree takes ownership of them. The array is sorted first, unless it is
+ * already in order, and is left untouched otherwise.
+ *
+ * 节点按层从左到右依次填满, 每层的元素均匀分配到最少的节点中, 所以除了根
+ * 节点以外每个节点都至少半满. */
+void zbtBuild(zbtree *t, zbtEntry *e, unsigned long len) {
+    assert(t->length == 0);
+    if (len == 0) return;
+
+    for (unsigned long j = 1; j < len; j++) {
+        if (zbtCompare(&e[j-1],e[j].score,e[j].ele) > 0) {
+            qsort(e,len,sizeof(zbtEntry),zbtEntryCompare);
+            break;
+        }
+    }
+
+    /* The first leaf is the empty root the tree was created with. */
+    unsigned long n = (len+ZBT_LEAF_CAP-1)/ZBT_LEAF_CAP;
+    void **nodes = zmalloc(sizeof(void*)*n);
+    zbtLeaf *prev = NULL;
+    for (unsigned long j = 0, used = 0; j < n; j++) {
+        zbtLeaf *l = j ? zbtLeafNew(t) : t->root;
+        l->num = len/n + (j < len%n);
+        memcpy(l->e,e+used,sizeof(zbtEntry)*l->num);
+        used += l->num;
+        l->prev = prev;
+        if (prev) prev->next = l;
+        prev = l;
+        nodes[j] = l;
+    }
+    t->tail = prev;
+    t->length = len;
+
+    /* Group the nodes of every level under new inner nodes, in place. */
+    while (n > 1) {
+        int isleaf = (t->height == 0);
+        unsigned long parents = (n+ZBT_INNER_CAP-1)/ZBT_INNER_CAP;
+        for (unsigned long j = 0, used = 0; j < parents; j++) {
+            zbtInner *p = zbtInnerNew(t);
+            p->num = n/parents + (j < n%parents);
+            for (uint32_t k = 0; k < p->num; k++) {
+                void *child = nodes[used+k];
+                if (isleaf) {
+                    zbtLeaf *l = child;
+                    p->key[k] = l->e[0];
+                    p->count[k] = l->num;
+                } else {
+                    zbtInner *c = child;
+                    p->key[k] = c->key[0];
+                    p->count[k] = zbtInnerSum(c);
+                }
+                p->child[k] = child;
+            }
+            used += p->num;
+            nodes[j] = p;
+        }
+        n = parents;
+        t->height++;
+    }
+    t->root = nodes[0];
+    zfree(nodes);
+}
+
+/* Remove child 'i' of 'n' and free it. Leaves are unlinked. */
+static void zbtRemoveChild(zbtree *t, zbtInner *n, uint32_t i, int isleaf) {
+    if (isleaf) {
+        zbtLeaf *l = n->child[i];
+        if (l->prev) l->prev->next = l->next;
+        else t->head = l->next;
+        if (l->next) l->next->prev = l->prev;
+        else t->tail = l->prev;
+        t->leaves--;
+    } else {
+        t->inners--;
+    }
+    zfree(n->child[i]);
+
+    uint32_t tail = n->num-i-1;
+    memmove(n->key+i,n->key+i+1,sizeof(zbtEntry)*tail);
+    memmove(n->count+i,n->count+i+1,sizeof(unsigned long)*tail);
+    memmove(n->child+i,n->child+i+1,sizeof(void*)*tail);
+    n->num--;
+}
+
+/* Merge children 'i' and 'i+1' of 'n' if they fit a single node, otherwise
+ * move entries from the bigger to the smaller so that they hold the same
+ * number. Return 1 if they were merged, 0 otherwise. */
+static int zbtMergeOrBorrow(zbtree *t, zbtInner *n, uint32_t i, int isleaf) {
+    if (isleaf) {
+        zbtLeaf *l = n->child[i], *r = n->child[i+1];
+        uint32_t total = l->num+r->num;
+
+        if (total <= ZBT_LEAF_CAP) {
+            memcpy(l->e+l->num,r->e,sizeof(zbtEntry)*r->num);
+            l->num = total;
+            n->count[i] += n->count[i+1];
+            n->key[i] = l->e[0];
+            zbtRemoveChild(t,n,i+1,1);
+            return 1;
+        }
+        if (l->num > total/2) {
+            uint32_t moved = l->num-total/2;
+            memmove(r->e+moved,r->e,sizeof(zbtEntry)*r->num);
+            memcpy(r->e,l->e+l->num-moved,sizeof(zbtEntry)*moved);
+            l->num -= moved;
+            r->num += moved;
+            n->count[i] -= moved;
+            n->count[i+1] += moved;
+        } else {
+            uint32_t moved = total/2-l->num;
+            memcpy(l->e+l->num,r->e,sizeof(zbtEntry)*moved);
+            memmove(r->e,r->e+moved,sizeof(zbtEntry)*(r->num-moved));
+            l->num += moved;
+            r->num -= moved;
+            n->count[i] += moved;
+            n->count[i+1] -= moved;
+        }
+        n->key[i] = l->e[0];
+        n->key[i+1] = r->e[0];
+        return 0;
+    }
+
+    zbtInner *l = n->child[i], *r = n->child[i+1];
+    uint32_t total = l->num+r->num;
+
+    if (total <= ZBT_INNER_CAP) {
+        memcpy(l->key+l->num,r->key,sizeof(zbtEntry)*r->num);
+        memcpy(l->count+l->num,r->count,sizeof(unsigned long)*r->num);
+        memcpy(l->child+l->num,r->child,sizeof(void*)*r->num);
+        l->num = total;
+        n->count[i] += n->count[i+1];
+        n->key[i] = l->key[0];
+        zbtRemoveChild(t,n,i+1,0);
+        return 1;
+    }
+    unsigned long delta = 0;
+    if (l->num > total/2) {
+        uint32_t moved = l->num-total/2, from = l->num-moved;
+        for (uint32_t j = from; j < l->num; j++) delta += l->count[j];
+        memmove(r->key+moved,r->key,sizeof(zbtEntry)*r->num);
+        memmove(r->count+moved,r->count,sizeof(unsigned long)*r->num);
+        memmove(r->child+moved,r->child,sizeof(void*)*r->num);
+        memcpy(r->key,l->key+from,sizeof(zbtEntry)*moved);
+        memcpy(r->count,l->count+from,sizeof(unsigned long)*moved);
+        memcpy(r->child,l->child+from,sizeof(void*)*moved);
+        l->num -= moved;
+        r->num += moved;
+        n->count[i] -= delta;
+        n->count[i+1] += delta;
+    } else {
+        uint32_t moved = total/2-l->num, rest = r->num-moved;
+        for (uint32_t j = 0; j < moved; j++) delta += r->count[j];
+        memcpy(l->key+l->num,r->key,sizeof(zbtEntry)*moved);
+        memcpy(l->count+l->num,r->count,sizeof(unsigned long)*moved);
+        memcpy(l->child+l->num,r->child,sizeof(void*)*moved);
+        memmove(r->key,r->key+moved,sizeof(zbtEntry)*rest);
+        memmove(r->count,r->count+moved,sizeof(unsigned long)*rest);
+        memmove(r->child,r->child+moved,sizeof(void*)*rest);
+        l->num += moved;
+        r->num -= moved;
+        n->count[i] += delta;
+        n->count[i+1] -= delta;
+    }
+    n->key[i] = l->key[0];
+    n->key[i+1] = r->key[0];
+    return 0;
+}
+
+/* An entry was removed below the node at depth 'level' of the path: fix the
+ * nodes that are now less than a quarter full, bottom up. */
+static void zbtRebalance(zbtree *t, zbtPath *p, int level) {
+    while (level > 0) {
+        int isleaf = (level == t->height);
+        zbtInner *parent = p->node[level-1];
+        uint32_t i = p->idx[level-1];
+        void *node = parent->child[i];
+        uint32_t num = isleaf ? ((zbtLeaf*)node)->num : ((zbtInner*)node)->num;
+
+        if (num >= (isleaf ? ZBT_LEAF_MIN : ZBT_INNER_MIN)) break;
+        if (parent->num == 1) {
+            /* No sibling to merge with: an only child is kept until it
+             * gets empty, then the parent gets empty too. */
+            if (num) break;
+            zbtRemoveChild(t,parent,0,isleaf);
+            level--;
+            continue;
+        }
+
+        uint32_t li = i ? i-1 : 0;
+        int merged = zbtMergeOrBorrow(t,parent,li,isleaf);
+        if (li == 0) zbtUpdateMin(p,level-1,&parent->key[0]);
+        if (!merged) break;
+        level--;
+    }
+
+    /* Drop the roots left with a single child. */
+    while (t->height > 0) {
+        zbtInner *root = t->root;
+        if (root->num > 1) break;
+        if (root->num == 1) {
+            t->root = root->child[0];
+            t->height--;
+        } else {
+            t->root = t->head = t->tail = zbtLeafNew(t);
+            t->height = 0;
+        }
+        zfree(root);
+        t->inners--;
+    }
+}
+
+/* Delete the entry with the given score and member. Return 1 if it was
+ * found, 0 otherwise. The member SDS stored in the tree is freed, unless
+ * 'deleted' is not NULL, in which case it is returned there. */
+int zbtDelete(zbtree *t, double score, sds ele, sds *deleted) {
+    zbtPath p;
+    zbtLeaf *leaf = zbtDescend(t,score,ele,&p);
+    uint32_t pos = zbtLeafSearch(leaf,score,ele);
+
+    if (pos == leaf->num || zbtCompare(&leaf->e[pos],score,ele) != 0)
+        return 0;
+
+    /* Separators may still reference the member until the tree is
+     * rebalanced: free it at the end. */
+    sds old = leaf->e[pos].ele;
+    memmove(leaf->e+pos,leaf->e+pos+1,sizeof(zbtEntry)*(leaf->num-pos-1));
+    leaf->num--;
+    for (int h = 0; h < t->height; h++) p.node[h]->count[p.idx[h]]--;
+    t->length--;
+    if (pos == 0 && leaf->num) zbtUpdateMin(&p,t->height,&leaf->e[0]);
+    zbtRebalance(t,&p,t->height);
+
+    if (deleted) *deleted = old;
+    else sdsfree(old);
+    return 1;
+}
+
+/* Change the score of an existing entry from 'curscore' to 'newscore'.
+ *
+ * 分数的小幅变化(例如ZINCRBY)通常不会让元素离开它所在的叶子: 这时只在叶子
+ * 内部移动它, 不需要删除再插入, 也不需要调整计数或分裂合并节点.
+ *
+ * When the new score keeps the entry between the last entry of the previous
+ * leaf and the first entry of the next one, the entry is just moved inside
+ * its leaf, as far as needed: the counts do not change and no node is split
+ * or merged. Otherwise it is deleted and inserted again, reusing the same
+ * member SDS. Return 1 if the entry was found, 0 otherwise. */
+int zbtUpdateScore(zbtree *t, double curscore, sds ele, double newscore) {
+    zbtPath p;
+    zbtLeaf *leaf = zbtDescend(t,curscore,ele,&p);
+    uint32_t pos = zbtLeafSearch(leaf,curscore,ele);
+
+    if (pos == leaf->num || zbtCompare(&leaf->e[pos],curscore,ele) != 0)
+        return 0;
+
+    zbtEntry e = leaf->e[pos];
+    e.score = newscore;
+    zbtLeaf *prev = leaf->prev, *next = leaf->next;
+    if ((prev && zbtCompare(&prev->e[prev->num-1],newscore,e.ele) > 0) ||
+        (next && zbtCompare(&next->e[0],newscore,e.ele) < 0))
+    {
+        sds old;
+        zbtDelete(t,curscore,ele,&old);
+        zbtInsert(t,newscore,old);
+        return 1;
+    }
+
+    uint32_t newpos = pos;
+    if (newscore > curscore) {
+        while (newpos+1 < leaf->num &&
+               zbtCompare(&leaf->e[newpos+1],newscore,e.ele) < 0) newpos++;
+        memmove(leaf->e+pos,leaf->e+pos+1,sizeof(zbtEntry)*(newpos-pos));
+    } else {
+        while (newpos > 0 &&
+               zbtCompare(&leaf->e[newpos-1],newscore,e.ele) > 0) newpos--;
+        memmove(leaf->e+newpos+1,leaf->e+newpos,sizeof(zbtEntry)*(pos-newpos));
+    }
+    leaf->e[newpos] = e;
+    if (pos == 0 || newpos == 0) zbtUpdateMin(&p,t->height,&leaf->e[0]);
+    return 1;
+}
+
+/* Return the 1-based rank of the entry, or 0 if it is not in the tree. */
+unsigned long zbtGetRank(zbtree *t, double score, sds ele) {
+    void *node = t->root;
+    unsigned long rank = 0;
+
+    for (int h = 0; h < t->height; h++) {
+        zbtInner *n = node;
+        uint32_t i = zbtInnerSearch(n,score,ele);
+        for (uint32_t j = 0; j < i; j++) rank += n->count[j];
+        node = n->child[i];
+    }
+    zbtLeaf *l = node;
+    uint32_t pos = zbtLeafSearch(l,score,ele);
+    if (pos == l->num || zbtCompare(&l->e[pos],score,ele) != 0) return 0;
+    return rank+pos+1;
+}
+
+/* Point the cursor to the entry with the given 1-based rank. Return 0 if
+ * the rank is out of range. */
+int zbtSeekRank(zbtree *t, unsigned long rank, zbtCursor *c) {
+    if (rank == 0 || rank > t->length) return 0;
+    rank--;
+
+    void *node = t->root;
+    for (int h = 0; h < t->height; h++) {
+        zbtInner *n = node;
+        uint32_t i = 0;
+        while (rank >= n->count[i]) rank -= n->count[i++];
+        node = n->child[i];
+    }
+    c->leaf = node;
+    c->pos = rank;
+    return 1;
+}
+
+/* Point the cursor to the first entry for which 'below' returns false. The
+ * predicate must be monotonic: true for a prefix of the entries, false for
+ * all the others, like "score < min". Return 0 if there is no such entry. */
+int zbtLowerBound(zbtree *t, int (*below)(const zbtEntry *e, void *privdata),
+                  void *privdata, zbtCursor *c)
+{
+    void *node = t->root;
+    uint32_t lo, hi;
+
+    for (int h = 0; h < t->height; h++) {
+        zbtInner *n = node;
+        lo = 1, hi = n->num;
+        while (lo < hi) {
+            uint32_t mid = (lo+hi)/2;
+            if (below(&n->key[mid],privdata)) lo = mid+1;
+            else hi = mid;
+        }
+        node = n->child[lo-1];
+    }
+
+    zbtLeaf *l = node;
+    lo = 0, hi = l->num;
+    while (lo < hi) {
+        uint32_t mid = (lo+hi)/2;
+        if (below(&l->e[mid],privdata)) lo = mid+1;
+        else hi = mid;
+    }
+    /* Past the end of the leaf: the first entry of the next leaf is the
+     * key that stopped the descent at some level. */
+    if (lo == l->num) {
+        l = l->next;
+        lo = 0;
+        if (l == NULL) return 0;
+    }
+    c->leaf = l;
+    c->pos = lo;
+    return 1;
+}
+
+int zbtFirst(zbtree *t, zbtCursor *c) {
+    if (t->length == 0) return 0;
+    c->leaf = t->head;
+    c->pos = 0;
+    return 1;
+}
+
+int zbtLast(zbtree *t, zbtCursor *c) {
+    if (t->length == 0) return 0;
+    c->leaf = t->tail;
+    c->pos = t->tail->num-1;
+    return 1;
+}
+
+/* Move the cursor to the next entry. Return 0 at the end of the tree. */
+int zbtNext(zbtCursor *c) {
+    if (++c->pos < c->leaf->num) return 1;
+    c->leaf = c->leaf->next;
+    c->pos = 0;
+    return c->leaf != NULL;
+}
+
+/* Move the cursor to the previous entry. Return 0 at the start of the tree. */
+int zbtPrev(zbtCursor *c) {
+    if (c->pos > 0) {
+        c->pos--;
+        return 1;
+    }
+    c->leaf = c->leaf->prev;
+    if (c->leaf == NULL) return 0;
+    c->pos = c->leaf->num-1;
+    return 1;
+}
+
+/* Bytes allocated for the tree, not counting the members. */
+size_t zbtBlobLen(const zbtree *t) {
+    return sizeof(*t) + t->leaves*sizeof(zbtLeaf) + t->inners*sizeof(zbtInner);
+}
+
+static void *zbtDefragNode(zbtree *t, void *node, int height, unsigned long *moved,
+                           void *(*defragalloc)(void *ptr),
+                           sds (*defragele)(sds ele, void *privdata), void *privdata)
+{
+    void *newnode = defragalloc(node);
+    if (newnode) {
+        node = newnode;
+        (*moved)++;
+    }
+
+    if (height == 0) {
+        zbtLeaf *l = node;
+        if (newnode) {
+            if (l->prev) l->prev->next = l;
+            else t->head = l;
+            if (l->next) l->next->prev = l;
+            else t->tail = l;
+        }
+        for (uint32_t j = 0; j < l->num; j++) {
+            sds newele = defragele(l->e[j].ele,privdata);
+            if (newele) {
+                l->e[j].ele = newele;
+                (*moved)++;
+            }
+        }
+    } else {
+        /* Keys are refreshed after the children, since they may reference
+         * members that were just moved. */
+        zbtInner *n = node;
+        for (uint32_t j = 0; j < n->num; j++) {
+            n->child[j] = zbtDefragNode(t,n->child[j],height-1,moved,
+                                        defragalloc,defragele,privdata);
+            n->key[j] = height == 1 ? ((zbtLeaf*)n->child[j])->e[0] :
+                                      ((zbtInner*)n->child[j])->key[0];
+        }
+    }
+    return node;
+}
+
+/* Try to move every node with 'defragalloc', and every member with
+ * 'defragele', which returns the new SDS or NULL if the member was not
+ * moved. Return the number of pointers that changed. */
+unsigned long zbtDefrag(zbtree *t, void *(*defragalloc)(void *ptr),
+                        sds (*defragele)(sds ele, void *privdata), void *privdata)
+{
+    unsigned long moved = 0;
+    t->root = zbtDefragNode(t,t->root,t->height,&moved,
+                            defragalloc,defragele,privdata);
+    return moved;
+}
+
+#ifdef REDIS_TEST
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#define UNUSED(x) (void)(x)
+#define TEST(name) printf("test — %s\n", name);
+
+static long long zbtUstime(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* Check the invariants of the subtree and return the number of entries. */
+static unsigned long zbtCheckNode(zbtree *t, void *node, int height, int isroot,
+                                  zbtLeaf **prevleaf, const zbtEntry **last)
+{
+    if (height == 0) {
+        zbtLeaf *l = node;
+        assert(isroot || l->num >= 1);
+        assert(l->prev == *prevleaf);
+        if (*prevleaf) assert((*prevleaf)->next == l);
+        else assert(t->head == l);
+        for (uint32_t j = 0; j < l->num; j++) {
+            if (*last) assert(zbtCompare(*last,l->e[j].score,l->e[j].ele) < 0);
+            *last = &l->e[j];
+        }
+        *prevleaf = l;
+        return l->num;
+    }
+
+    zbtInner *n = node;
+    unsigned long total = 0;
+    assert(n->num >= (isroot ? 2 : 1) && n->num <= ZBT_INNER_CAP);
+    for (uint32_t j = 0; j < n->num; j++) {
+        const zbtEntry *first = height == 1 ? &((zbtLeaf*)n->child[j])->e[0] :
+                                              &((zbtInner*)n->child[j])->key[0];
+        assert(n->key[j].ele == first->ele && n->key[j].score == first->score);
+        unsigned long count = zbtCheckNode(t,n->child[j],height-1,0,prevleaf,last);
+        assert(n->count[j] == count);
+        total += count;
+    }
+    return total;
+}
+
+static void zbtCheck(zbtree *t) {
+    zbtLeaf *prevleaf = NULL;
+    const zbtEntry *last = NULL;
+    assert(zbtCheckNode(t,t->root,t->height,1,&prevleaf,&last) == t->length);
+    assert(t->tail == prevleaf && prevleaf->next == NULL);
+}
+
+/* The reference is a plain array of entries kept sorted. */
+typedef struct zbtTestRef {
+    zbtEntry *e;
+    unsigned long len;
+} zbtTestRef;
+
+static unsigned long zbtTestRefSearch(zbtTestRef *ref, double score, sds ele) {
+    unsigned long lo = 0, hi = ref->len;
+    while (lo < hi) {
+        unsigned long mid = (lo+hi)/2;
+        if (zbtCompare(&ref->e[mid],score,ele) < 0) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static sds zbtTestEle(void) {
+    return sdscatprintf(sdsempty(),"m%d",rand()%5000);
+}
+
+static int zbtTestBelowScore(const zbtEntry *e, void *privdata) {
+    return e->score < *(double*)privdata;
+}
+
+/* Move every node and member, to check that all the references to them
+ * are updated. The leaves of the tree are recorded before the defrag, to
+ * tell the size of the allocation. */
+static zbtLeaf **zbtTestLeaves;
+static unsigned long zbtTestLeavesCount;
+
+static void *zbtTestDefragAlloc(void *ptr) {
+    size_t size = sizeof(zbtInner);
+    for (unsigned long j = 0; j < zbtTestLeavesCount; j++)
+        if (zbtTestLeaves[j] == ptr) size = sizeof(zbtLeaf);
+    void *newptr = zmalloc(size);
+    memcpy(newptr,ptr,size);
+    zfree(ptr);
+    return newptr;
+}
+
+static sds zbtTestDefragEle(sds ele, void *privdata) {
+    UNUSED(privdata);
+    sds newele = sdsdup(ele);
+    sdsfree(ele);
+    return newele;
+}
+
+int zbtreeTest(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+    zbtree *t;
+    zbtCursor c;
+
+    srand(1234);
+
+    TEST("Insert and delete against a sorted array") {
+        zbtTestRef ref = {zmalloc(sizeof(zbtEntry)*20000), 0};
+        t = zbtCreate();
+        for (int j = 0; j < 200000; j++) {
+            double score = rand()%1000;
+            sds ele = zbtTestEle();
+            /* Grow while small, then keep the size around 10000. Most
+             * deletions target existing entries. */
+            int insert = ref.len < 10000 ? rand()%4 != 0 : rand()%3 == 0;
+            if (!insert && ref.len && rand()%4) {
+                unsigned long k = rand()%ref.len;
+                score = ref.e[k].score;
+                sdsfree(ele);
+                ele = sdsdup(ref.e[k].ele);
+            }
+            unsigned long pos = zbtTestRefSearch(&ref,score,ele);
+            int found = pos < ref.len &&
+                        zbtCompare(&ref.e[pos],score,ele) == 0;
+
+            if (insert && !found) {
+                zbtInsert(t,score,sdsdup(ele));
+                memmove(ref.e+pos+1,ref.e+pos,sizeof(zbtEntry)*(ref.len-pos));
+                ref.e[pos].score = score;
+                ref.e[pos].ele = ele;
+                ref.len++;
+                continue;
+            }
+            if (!insert) {
+                assert(zbtDelete(t,score,ele,NULL) == found);
+                if (found) {
+                    sdsfree(ref.e[pos].ele);
+                    memmove(ref.e+pos,ref.e+pos+1,sizeof(zbtEntry)*(ref.len-pos-1));
+                    ref.len--;
+                }
+            }
+            sdsfree(ele);
+            if (j % 1000 == 0) zbtCheck(t);
+        }
+        zbtCheck(t);
+        assert(zbtLength(t) == ref.len);
+
+        unsigned long j = 0;
+        for (int ok = zbtFirst(t,&c); ok; ok = zbtNext(&c), j++) {
+            zbtEntry *e = zbtCursorEntry(&c);
+            assert(e->score == ref.e[j].score && !sdscmp(e->ele,ref.e[j].ele));
+        }
+        assert(j == ref.len);
+        for (int ok = zbtLast(t,&c); ok; ok = zbtPrev(&c)) {
+            zbtEntry *e = zbtCursorEntry(&c);
+            j--;
+            assert(e->score == ref.e[j].score && !sdscmp(e->ele,ref.e[j].ele));
+        }
+        assert(j == 0);
+
+        for (j = 0; j < ref.len; j++) {
+            assert(zbtGetRank(t,ref.e[j].score,ref.e[j].ele) == j+1);
+            assert(zbtSeekRank(t,j+1,&c));
+            assert(zbtCursorEntry(&c)->score == ref.e[j].score);
+            assert(!sdscmp(zbtCursorEntry(&c)->ele,ref.e[j].ele));
+        }
+        assert(!zbtSeekRank(t,0,&c) && !zbtSeekRank(t,ref.len+1,&c));
+        sds missing = sdsnew("missing");
+        assert(zbtGetRank(t,1,missing) == 0);
+        sdsfree(missing);
+
+        for (double min = -1; min <= 1001; min += 0.5) {
+            unsigned long k = 0;
+            while (k < ref.len && ref.e[k].score < min) k++;
+            int ok = zbtLowerBound(t,zbtTestBelowScore,&min,&c);
+            if (k == ref.len) assert(!ok);
+            else assert(ok && zbtCursorEntry(&c)->ele != NULL &&
+                        !sdscmp(zbtCursorEntry(&c)->ele,ref.e[k].ele));
+        }
+
+        /* Empty the tree: it must shrink back to a single leaf. */
+        while (ref.len) {
+            unsigned long pos = rand() % ref.len;
+            assert(zbtDelete(t,ref.e[pos].score,ref.e[pos].ele,NULL));
+            sdsfree(ref.e[pos].ele);
+            memmove(ref.e+pos,ref.e+pos+1,sizeof(zbtEntry)*(ref.len-pos-1));
+            ref.len--;
+            if (ref.len % 500 == 0) zbtCheck(t);
+        }
+        assert(t->height == 0 && t->leaves == 1 && t->inners == 0);
+        assert(!zbtFirst(t,&c) && !zbtLast(t,&c));
+        zbtFree(t);
+        zfree(ref.e);
+    }
+
+    TEST("Sorted loads fill the leaves") {
+        t = zbtCreate();
+        for (int j = 0; j < 30000; j++)
+            zbtInsert(t,j,sdsfromlonglong(j));
+        zbtCheck(t);
+        assert(t->leaves == 1000);
+        zbtFree(t);
+
+        t = zbtCreate();
+        for (int j = 30000; j > 0; j--)
+            zbtInsert(t,j,sdsfromlonglong(j));
+        zbtCheck(t);
+        assert(t->leaves == 1000);
+
+        /* Equal scores are ordered by member. */
+        for (int j = 0; j < 100; j++)
+            zbtInsert(t,-1,sdscatprintf(sdsempty(),"e%02d",99-j));
+        zbtCheck(t);
+        assert(zbtFirst(t,&c) && !strcmp(zbtCursorEntry(&c)->ele,"e00"));
+        sds deleted, ele = sdsnew("e00");
+        assert(zbtDelete(t,-1,ele,&deleted) && deleted != ele);
+        sdsfree(ele);
+        sdsfree(deleted);
+        assert(zbtFirst(t,&c) && !strcmp(zbtCursorEntry(&c)->ele,"e01"));
+        zbtFree(t);
+    }
+
+    TEST("Update score against a sorted array") {
+        zbtTestRef ref = {zmalloc(sizeof(zbtEntry)*5000), 0};
+        t = zbtCreate();
+        for (int j = 0; j < 5000; j++) {
+            double score = rand()%1000;
+            sds ele = sdscatprintf(sdsempty(),"%d",j);
+            unsigned long pos = zbtTestRefSearch(&ref,score,ele);
+            zbtInsert(t,score,sdsdup(ele));
+            memmove(ref.e+pos+1,ref.e+pos,sizeof(zbtEntry)*(ref.len-pos));
+            ref.e[pos].score = score;
+            ref.e[pos].ele = ele;
+            ref.len++;
+        }
+        for (int j = 0; j < 100000; j++) {
+            unsigned long pos = rand()%ref.len;
+            zbtEntry e = ref.e[pos];
+            /* Mostly small steps, that keep the entry in its leaf. */
+            double score = rand()%10 ? e.score+rand()%5-2 : rand()%1000;
+            assert(zbtUpdateScore(t,e.score,e.ele,score));
+            memmove(ref.e+pos,ref.e+pos+1,sizeof(zbtEntry)*(ref.len-pos-1));
+            ref.len--;
+            pos = zbtTestRefSearch(&ref,score,e.ele);
+            memmove(ref.e+pos+1,ref.e+pos,sizeof(zbtEntry)*(ref.len-pos));
+            ref.e[pos].score = score;
+            ref.e[pos].ele = e.ele;
+            ref.len++;
+            if (j % 1000 == 0) zbtCheck(t);
+        }
+        zbtCheck(t);
+        unsigned long j = 0;
+        for (int ok = zbtFirst(t,&c); ok; ok = zbtNext(&c), j++) {
+            zbtEntry *e = zbtCursorEntry(&c);
+            assert(e->score == ref.e[j].score && !sdscmp(e->ele,ref.e[j].ele));
+            assert(zbtGetRank(t,e->score,e->ele) == j+1);
+        }
+        assert(j == ref.len);
+        sds missing = sdsnew("missing");
+        assert(!zbtUpdateScore(t,1,missing,2));
+        sdsfree(missing);
+        for (j = 0; j < ref.len; j++) sdsfree(ref.e[j].ele);
+        zfree(ref.e);
+        zbtFree(t);
+    }
+
+    TEST("Bulk build") {
+        unsigned long sizes[] = {0, 1, 29, 30, 31, 961, 12345, 100000};
+        for (unsigned long k = 0; k < sizeof(sizes)/sizeof(sizes[0]); k++) {
+            unsigned long len = sizes[k];
+            zbtEntry *e = zmalloc(sizeof(zbtEntry)*(len+1));
+            for (unsigned long j = 0; j < len; j++) {
+                e[j].score = k % 2 ? (double)j : (double)(rand()%100);
+                e[j].ele = sdsfromlonglong(j);
+            }
+            t = zbtCreate();
+            zbtBuild(t,e,len);
+            zbtCheck(t);
+            assert(zbtLength(t) == len);
+            for (unsigned long j = 0; j < len; j++) {
+                assert(zbtGetRank(t,e[j].score,e[j].ele) == j+1);
+                assert(k%2 == 0 || e[j].score == (double)j);
+            }
+            /* The tree can be modified as usual. */
+            for (unsigned long j = 0; j < len; j += 2)
+                assert(zbtDelete(t,e[j].score,e[j].ele,NULL));
+            zbtInsert(t,-1,sdsnew("new"));
+            zbtCheck(t);
+            zbtFree(t);
+            zfree(e);
+        }
+    }
+
+    TEST("Defrag moves nodes and members") {
+        t = zbtCreate();
+        for (int j = 0; j < 5000; j++)
+            zbtInsert(t,rand()%100,sdscatprintf(sdsempty(),"%d",j));
+        unsigned long nodes = t->leaves+t->inners;
+        zbtTestLeaves = zmalloc(sizeof(zbtLeaf*)*t->leaves);
+        zbtTestLeavesCount = 0;
+        for (zbtLeaf *l = t->head; l; l = l->next)
+            zbtTestLeaves[zbtTestLeavesCount++] = l;
+        assert(zbtDefrag(t,zbtTestDefragAlloc,zbtTestDefragEle,NULL) ==
+               nodes+zbtLength(t));
+        zbtCheck(t);
+        zfree(zbtTestLeaves);
+        zbtFree(t);
+    }
+
+    TEST("Benchmark: insert, rank and delete") {
+        int count = 1000000;
+        sds *ele = zmalloc(sizeof(sds)*count);
+        for (int j = 0; j < count; j++)
+            ele[j] = sdscatprintf(sdsempty(),"member:%d",j);
+
+        t = zbtCreate();
+        long long start = zbtUstime();
+        for (int j = 0; j < count; j++)
+            zbtInsert(t,(double)((j*7919LL)%count),sdsdup(ele[j]));
+        printf("%d inserts: %lld usec\n",count,zbtUstime()-start);
+
+        start = zbtUstime();
+        for (int j = 0; j < count; j++)
+            assert(zbtGetRank(t,(double)((j*7919LL)%count),ele[j]));
+        printf("%d ranks: %lld usec\n",count,zbtUstime()-start);
+
+        start = zbtUstime();
+        for (int j = 0; j < count; j++)
+            assert(zbtDelete(t,(double)((j*7919LL)%count),ele[j],NULL));
+        printf("%d deletes: %lld usec\n",count,zbtUstime()-start);
+
+        for (int j = 0; j < count; j++) sdsfree(ele[j]);
+        zfree(ele);
+        zbtFree(t);
+    }
+
+    TEST("Benchmark: small score increments") {
+        int count = 1000000, updates = 1000000;
+        sds *ele = zmalloc(sizeof(sds)*count);
+        double *score = zmalloc(sizeof(double)*count);
+        for (int j = 0; j < count; j++) {
+            ele[j] = sdscatprintf(sdsempty(),"member:%d",j);
+            score[j] = (double)((j*7919LL)%count);
+        }
+
+        /* The same increments, first as delete + insert, then in place. */
+        for (int inplace = 0; inplace <= 1; inplace++) {
+            t = zbtCreate();
+            for (int j = 0; j < count; j++)
+                zbtInsert(t,score[j],sdsdup(ele[j]));
+            srand(4321);
+            long long start = zbtUstime();
+            for (int j = 0; j < updates; j++) {
+                int k = rand()%count;
+                double newscore = score[k]+rand()%3;
+                if (inplace) {
+                    assert(zbtUpdateScore(t,score[k],ele[k],newscore));
+                } else {
+                    sds old;
+                    assert(zbtDelete(t,score[k],ele[k],&old));
+                    zbtInsert(t,newscore,old);
+                }
+                score[k] = newscore;
+            }
+            printf("%d increments (%s): %lld usec\n",updates,
+                inplace ? "in place" : "delete+insert",zbtUstime()-start);
+            zbtCheck(t);
+            zbtFree(t);
+            for (int j = 0; j < count; j++)
+                score[j] = (double)((j*7919LL)%count);
+        }
+
+        for (int j = 0; j < count; j++) sdsfree(ele[j]);
+        zfree(ele);
+        zfree(score);
+    }
+
+    printf("ALL TESTS PASSED!\n");
+    return 0;
+}
+#endif
@@ -0,0 +1,87 @@
+/* Zbtree -- the ordered index of sorted sets, a B+tree with subtree counts.
+ *
+ * 叶子节点连续存放(score, member)对并以双向链表相连, 内部节点为每个子节点
+ * 记录它的第一个元素和它下面的元素个数, 所以按score/按字典序查找和求排名
+ * 都只需要从根走到叶子, 每层访问一个节点.
+ *
+ * Leaves store up to ZBT_LEAF_CAP (score, member) pairs next to each other
+ * and are linked in both directions for range scans. Inner nodes store, for
+ * every child, its first entry and the number of entries below it, so that
+ * lookups by score, by member and by rank visit a single node per level.
+ *
+ * The member SDS strings belong to the tree: they are freed when an entry is
+ * deleted or the tree is released.
+ */
+
+#ifndef __ZBTREE_H
+#define __ZBTREE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sds.h"
+
+/* A leaf takes 504 bytes and an inner node 1000, so that both fit the 512
+ * and 1024 bytes allocator size classes. */
+#define ZBT_LEAF_CAP 30
+#define ZBT_INNER_CAP 31
+#define ZBT_MAX_HEIGHT 32
+
+typedef struct zbtEntry {
+    double score;
+    sds ele;
+} zbtEntry;
+
+typedef struct zbtLeaf {
+    struct zbtLeaf *prev, *next;
+    uint32_t num;                       /* Number of entries. */
+    zbtEntry e[ZBT_LEAF_CAP];           /* Sorted by score, then member. */
+} zbtLeaf;
+
+typedef struct zbtInner {
+    uint32_t num;                       /* Number of children. */
+    zbtEntry key[ZBT_INNER_CAP];        /* First entry below every child. */
+    unsigned long count[ZBT_INNER_CAP]; /* Entries below every child. */
+    void *child[ZBT_INNER_CAP];
+} zbtInner;
+
+typedef struct zbtree {
+    void *root;             /* A leaf while height is 0. */
+    zbtLeaf *head, *tail;
+    unsigned long length;   /* Number of entries. */
+    unsigned long leaves;   /* Number of leaves, for memory accounting. */
+    unsigned long inners;   /* Number of inner nodes. */
+    int height;             /* Levels of inner nodes above the leaves. */
+} zbtree;
+
+/* Points to an entry. Not valid after the tree is modified. */
+typedef struct zbtCursor {
+    zbtLeaf *leaf;
+    uint32_t pos;
+} zbtCursor;
+
+#define zbtCursorEntry(c) (&(c)->leaf->e[(c)->pos])
+#define zbtLength(t) ((t)->length)
+
+zbtree *zbtCreate(void);
+void zbtFree(zbtree *t);
+void zbtInsert(zbtree *t, double score, sds ele);
+void zbtBuild(zbtree *t, zbtEntry *e, unsigned long len);
+int zbtDelete(zbtree *t, double score, sds ele, sds *deleted);
+int zbtUpdateScore(zbtree *t, double curscore, sds ele, double newscore);
+unsigned long zbtGetRank(zbtree *t, double score, sds ele);
+int zbtSeekRank(zbtree *t, unsigned long rank, zbtCursor *c);
+int zbtLowerBound(zbtree *t, int (*below)(const zbtEntry *e, void *privdata),
+                  void *privdata, zbtCursor *c);
+int zbtFirst(zbtree *t, zbtCursor *c);
+int zbtLast(zbtree *t, zbtCursor *c);
+int zbtNext(zbtCursor *c);
+int zbtPrev(zbtCursor *c);
+size_t zbtBlobLen(const zbtree *t);
+unsigned long zbtDefrag(zbtree *t, void *(*defragalloc)(void *ptr),
+                        sds (*defragele)(sds ele, void *privdata), void *privdata);
+
+#ifdef REDIS_TEST
+int zbtreeTest(int argc, char *argv[]);
+#endif
+
+#endif
@@ -257,4 +257,104 @@ tags {"aof"} {
             r expire x -1
         }
     }
+    ## Multi part AOF: a single AOF file becomes the base of the multi part
+    ## AOF, in its own directory.
+    set server_path [tmpdir server.aof.multipart]
+    set aof_path "$server_path/appendonly.aof"
+    create_aof {
+        append_to_aof [formatCommand set foo hello]
+        append_to_aof [formatCommand rpush list a b c]
+    }
+
+    start_server_aof [list dir $server_path aof-multi-part yes] {
+        test "Multi part AOF: the single AOF file is used as base" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            wait_for_condition 50 100 {
+                [catch {$client ping} e] == 0
+            } else {
+                fail "Loading DB is taking too much time."
+            }
+            assert_equal hello [$client get foo]
+            assert_equal 3 [$client llen list]
+            assert_equal 0 [file exists $aof_path]
+            lsort [glob -tails -directory $server_path/appendonlydir *]
+        } {appendonly.aof.1.base.aof appendonly.aof.1.incr.aof appendonly.aof.manifest}
+
+        test "Multi part AOF: rewrite installs a new base keeping the incr" {
+            $client set bar world
+            $client bgrewriteaof
+            wait_for_condition 50 100 {
+                [status $client aof_rewrite_in_progress] eq 0
+            } else {
+                fail "AOF rewrite is taking too much time."
+            }
+            $client incr counter
+            lsort [glob -tails -directory $server_path/appendonlydir *]
+        } {appendonly.aof.2.base.aof appendonly.aof.2.incr.aof appendonly.aof.manifest}
+
+        test "Multi part AOF: DEBUG LOADAOF loads base and incr files" {
+            set digest [$client debug digest]
+            $client debug loadaof
+            assert_equal $digest [$client debug digest]
+        }
+    }
+
+    start_server_aof [list dir $server_path aof-multi-part yes] {
+        test "Multi part AOF: the dataset is reloaded on restart" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            wait_for_condition 50 100 {
+                [catch {$client ping} e] == 0
+            } else {
+                fail "Loading DB is taking too much time."
+            }
+            assert_equal $digest [$client debug digest]
+            list [$client get bar] [$client get counter]
+        } {world 1}
+    }
+
+    ## Multi part AOF: enabling the AOF at runtime.
+    set server_path [tmpdir server.aof.multipart]
+    start_server [list overrides [list dir $server_path aof-multi-part yes \
+                                       aof-use-rdb-preamble yes]] {
+        test "Multi part AOF: enable AOF at runtime" {
+            r debug populate 1000
+            r config set appendonly yes
+            r set foo bar
+            waitForBgrewriteaof r
+            r set bar foo
+            set digest [r debug digest]
+            r debug loadaof
+            assert_equal $digest [r debug digest]
+            lsort [glob -tails -directory $server_path/appendonlydir *]
+        } {appendonly.aof.1.base.rdb appendonly.aof.1.incr.aof appendonly.aof.manifest}
+    }
+
+    ## Multi part AOF: only the last incr file can be truncated.
+    set server_path [tmpdir server.aof.multipart]
+    file mkdir $server_path/appendonlydir
+    set aof_path "$server_path/appendonlydir/appendonly.aof.1.incr.aof"
+    create_aof {
+        append_to_aof [formatCommand set foo hello]
+    }
+    set aof_path "$server_path/appendonlydir/appendonly.aof.2.incr.aof"
+    create_aof {
+        append_to_aof [formatCommand set bar world]
+        append_to_aof [string range [formatCommand set baz world] 0 end-1]
+    }
+    set fp [open "$server_path/appendonlydir/appendonly.aof.manifest" w]
+    puts $fp "file appendonly.aof.1.incr.aof seq 1 type i"
+    puts $fp "file appendonly.aof.2.incr.aof seq 2 type i"
+    close $fp
+
+    start_server_aof [list dir $server_path aof-multi-part yes aof-load-truncated yes] {
+        test "Multi part AOF: truncated last incr file is loaded" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            wait_for_condition 50 100 {
+                [catch {$client ping} e] == 0
+            } else {
+                fail "Loading DB is taking too much time."
+            }
+            list [$client get foo] [$client get bar] [$client exists baz]
+        } {hello world 0}
+    }
 }
@@ -23,6 +23,155 @@ start_server [list overrides [list "dir" $server_path "dbfilename" "encodings.rd
 }
 }
 
+start_server {} {
+    test {Threaded and single threaded RDB loading produce the same dataset} {
+        r config set rdb-threaded-loading yes
+        createComplexDataset r 10000
+        r debug populate 10000
+        for {set j 0} {$j < 1000} {incr j} {
+            r expire key:$j 1000
+        }
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        r config set rdb-threaded-loading no
+        r debug reload
+        assert_equal $digest [r debug digest]
+        r config set rdb-threaded-loading yes
+        r debug reload
+        expr {[r debug digest] eq $digest}
+    } {1}
+}
+
+start_server {} {
+    test {Segmented RDB files are loaded with and without threads} {
+        createComplexDataset r 10000
+        r debug populate 10000
+        for {set j 0} {$j < 1000} {incr j} {
+            r expire key:$j 1000
+        }
+        set digest [r debug digest]
+        r config set rdb-segment-threads 4
+        r config set rdb-threaded-loading yes
+        r debug reload
+        assert_equal $digest [r debug digest]
+        r config set rdb-threaded-loading no
+        r debug reload
+        assert_equal $digest [r debug digest]
+        # Loading segments doesn't depend on the number of threads.
+        r config set rdb-threaded-loading yes
+        r config set rdb-segment-threads 1
+        r debug reload
+        expr {[r debug digest] eq $digest}
+    } {1}
+
+    test {Segmented RDB preamble of the AOF} {
+        r config set rdb-segment-threads 4
+        r config set aof-use-rdb-preamble yes
+        r config set appendonly yes
+        waitForBgrewriteaof r
+        r set foo bar
+        set digest [r debug digest]
+        r debug loadaof
+        r config set appendonly no
+        r config set rdb-segment-threads 1
+        expr {[r debug digest] eq $digest}
+    } {1}
+}
+
+start_server {} {
+    test {RDB strings and list nodes compressed with every codec} {
+        r config set list-compress-depth 1
+        createComplexDataset r 10000
+        r debug populate 10000 key 200
+        for {set j 0} {$j < 10} {incr j} {
+            for {set i 0} {$i < 1000} {incr i} {
+                r rpush biglist:$j [string repeat "element:$i " 4]
+            }
+        }
+        set digest [r debug digest]
+        foreach listcodec {lzf lz4 zstd} {
+            r config set list-compression-codec $listcodec
+            foreach codec {lz4 zstd lzf} {
+                r config set rdb-compression-codec $codec
+                r debug reload
+                assert_equal $digest [r debug digest]
+            }
+        }
+        r config set list-compression-codec lzf
+        r config set list-compress-depth 0
+    }
+
+    test {RDB preamble of the AOF compressed with LZ4} {
+        r config set rdb-compression-codec lz4
+        r config set aof-use-rdb-preamble yes
+        r config set appendonly yes
+        waitForBgrewriteaof r
+        set digest [r debug digest]
+        r debug loadaof
+        r config set appendonly no
+        r config set rdb-compression-codec lzf
+        expr {[r debug digest] eq $digest}
+    } {1}
+}
+
+start_server {} {
+    test {Forkless BGSAVE saves the dataset as it was when it started} {
+        r config set rdb-forkless-save yes
+        r debug populate 200000
+        for {set j 0} {$j < 1000} {incr j} {
+            r expire key:$j 10000
+            r rpush mylist $j
+            r hset myhash $j $j
+        }
+        r select 10
+        r debug populate 1000 other
+        r select 9
+        set digest [r debug digest]
+
+        # Modify the dataset while the snapshot is in progress.
+        r bgsave
+        set j 0
+        while {[s rdb_bgsave_in_progress]} {
+            r set key:$j changed
+            r del key:[expr {$j+100000}]
+            r expire key:[expr {$j+50000}] 100
+            r persist key:[expr {$j+500}]
+            r set new:$j new
+            r rpush mylist $j
+            r hdel myhash $j
+            if {$j == 10} {
+                r select 10
+                r flushdb
+                r select 9
+            }
+            incr j
+        }
+        assert {$j > 10}
+        assert_equal ok [s rdb_last_bgsave_status]
+
+        # Load the snapshot in a different server.
+        set dir [lindex [r config get dir] 1]
+        set server_path [tmpdir "server.forkless-save-test"]
+        file copy [file join $dir dump.rdb] $server_path
+        start_server [list overrides [list "dir" $server_path]] {
+            set loaded [r debug digest]
+        }
+        expr {$loaded eq $digest}
+    } {1}
+
+    test {FLUSHALL aborts the forkless BGSAVE in progress} {
+        r flushall
+        r debug populate 200000
+        r bgsave
+        assert_equal 1 [s rdb_bgsave_in_progress]
+        r flushall
+        set dir [lindex [r config get dir] 1]
+        list [s rdb_bgsave_in_progress] [s rdb_last_bgsave_status] \
+             [llength [glob -nocomplain -directory $dir temp-forkless-*.rdb]]
+    } {0 ok 0}
+}
+
 set server_path [tmpdir "server.rdb-startup-test"]
 
 start_server [list overrides [list "dir" $server_path]] {
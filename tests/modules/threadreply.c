@@ -0,0 +1,73 @@
+/* Test module replying to blocked clients from threads.
+ *
+ * THREADREPLY.ECHO <count> <string> -- Block the client, then reply from a
+ * thread with an array of <count> times <string>. The replies are added to
+ * the thread safe context without holding the GIL, while the main thread
+ * keeps serving other clients. */
+
+#define REDISMODULE_EXPERIMENTAL_API
+#include "redismodule.h"
+#include <pthread.h>
+#include <string.h>
+
+typedef struct {
+    RedisModuleBlockedClient *bc;
+    long long count;
+    char *buf;
+    size_t len;
+} echoArgs;
+
+void *ThreadReply_EchoThread(void *arg) {
+    echoArgs *ea = arg;
+    RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(ea->bc);
+
+    RedisModule_ReplyWithArray(ctx,ea->count);
+    for (long long j = 0; j < ea->count; j++)
+        RedisModule_ReplyWithStringBuffer(ctx,ea->buf,ea->len);
+    RedisModule_FreeThreadSafeContext(ctx);
+    RedisModule_UnblockClient(ea->bc,NULL);
+
+    RedisModule_Free(ea->buf);
+    RedisModule_Free(ea);
+    return NULL;
+}
+
+int ThreadReply_Echo(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc != 3) return RedisModule_WrongArity(ctx);
+
+    long long count;
+    if (RedisModule_StringToLongLong(argv[1],&count) != REDISMODULE_OK ||
+        count < 0)
+        return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+
+    size_t len;
+    const char *str = RedisModule_StringPtrLen(argv[2],&len);
+    echoArgs *ea = RedisModule_Alloc(sizeof(*ea));
+    ea->bc = RedisModule_BlockClient(ctx,NULL,NULL,NULL,0);
+    ea->count = count;
+    ea->buf = RedisModule_Alloc(len);
+    ea->len = len;
+    memcpy(ea->buf,str,len);
+
+    pthread_t tid;
+    if (pthread_create(&tid,NULL,ThreadReply_EchoThread,ea) != 0) {
+        RedisModule_AbortBlock(ea->bc);
+        RedisModule_Free(ea->buf);
+        RedisModule_Free(ea);
+        return RedisModule_ReplyWithError(ctx,"ERR can't start thread");
+    }
+    pthread_detach(tid);
+    return REDISMODULE_OK;
+}
+
+int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    REDISMODULE_NOT_USED(argv);
+    REDISMODULE_NOT_USED(argc);
+
+    if (RedisModule_Init(ctx,"threadreply",1,REDISMODULE_APIVER_1)
+        == REDISMODULE_ERR) return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"threadreply.echo",ThreadReply_Echo,
+        "",0,0,0) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    return REDISMODULE_OK;
+}
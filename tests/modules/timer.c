@@ -0,0 +1,83 @@
+/* Test module for the timers API.
+ *
+ * TEST.CREATETIMER <period> <key> -- Create a timer incrementing <key> when
+ *                                    it fires, and return its ID.
+ * TEST.GETTIMER <id>              -- Return the remaining time and the key of
+ *                                    the timer, or a null reply.
+ * TEST.STOPTIMER <id>             -- Stop the timer, return 1 if it was
+ *                                    stopped, 0 otherwise. */
+
+#define REDISMODULE_EXPERIMENTAL_API
+#include "redismodule.h"
+
+static void timerCallback(RedisModuleCtx *ctx, void *data) {
+    RedisModuleString *keyname = data;
+    RedisModuleCallReply *reply;
+
+    reply = RedisModule_Call(ctx,"INCR","s",keyname);
+    if (reply != NULL) RedisModule_FreeCallReply(reply);
+    RedisModule_FreeString(ctx,keyname);
+}
+
+int test_createtimer(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc != 3) return RedisModule_WrongArity(ctx);
+
+    long long period;
+    if (RedisModule_StringToLongLong(argv[1],&period) != REDISMODULE_OK)
+        return RedisModule_ReplyWithError(ctx,"ERR invalid period");
+
+    RedisModuleString *keyname = RedisModule_CreateStringFromString(ctx,argv[2]);
+    RedisModuleTimerID id = RedisModule_CreateTimer(ctx,period,timerCallback,
+                                                    keyname);
+    return RedisModule_ReplyWithLongLong(ctx,id);
+}
+
+int test_gettimer(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+
+    long long id;
+    if (RedisModule_StringToLongLong(argv[1],&id) != REDISMODULE_OK)
+        return RedisModule_ReplyWithError(ctx,"ERR invalid id");
+
+    uint64_t remaining;
+    RedisModuleString *keyname;
+    if (RedisModule_GetTimerInfo(ctx,id,&remaining,(void **)&keyname)
+        == REDISMODULE_ERR) return RedisModule_ReplyWithNull(ctx);
+
+    RedisModule_ReplyWithArray(ctx,2);
+    RedisModule_ReplyWithLongLong(ctx,remaining);
+    RedisModule_ReplyWithString(ctx,keyname);
+    return REDISMODULE_OK;
+}
+
+int test_stoptimer(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+
+    long long id;
+    if (RedisModule_StringToLongLong(argv[1],&id) != REDISMODULE_OK)
+        return RedisModule_ReplyWithError(ctx,"ERR invalid id");
+
+    RedisModuleString *keyname;
+    int stopped = 0;
+    if (RedisModule_StopTimer(ctx,id,(void **)&keyname) == REDISMODULE_OK) {
+        RedisModule_FreeString(ctx,keyname);
+        stopped = 1;
+    }
+    return RedisModule_ReplyWithLongLong(ctx,stopped);
+}
+
+int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    REDISMODULE_NOT_USED(argv);
+    REDISMODULE_NOT_USED(argc);
+
+    if (RedisModule_Init(ctx,"timer",1,REDISMODULE_APIVER_1)
+        == REDISMODULE_ERR) return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"test.createtimer",test_createtimer,
+        "",0,0,0) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx,"test.gettimer",test_gettimer,
+        "",0,0,0) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx,"test.stoptimer",test_stoptimer,
+        "",0,0,0) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    return REDISMODULE_OK;
+}
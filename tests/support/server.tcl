@@ -278,7 +278,8 @@ proc start_server {options {code undefined}} {
 
         while 1 {
             # check that the server actually started and is ready for connections
-            if {[exec grep -i "Ready to accept" | wc -l < $stdout] > 0} {
+            # (grep exits with an error while the server is still loading.)
+            if {[regexp -nocase {Ready to accept} [exec cat $stdout]]} {
                 break
             }
             after 10
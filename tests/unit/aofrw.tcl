@@ -106,9 +106,11 @@ start_server {tags {"aofrw"}} {
     }
 
     foreach d {string int} {
-        foreach e {intset hashtable} {
+        foreach e {intset roaring hashtable} {
+            if {$d eq {string} && $e eq {roaring}} continue
             test "AOF rewrite of set with $e encoding, $d data" {
                 r flushall
+                r config set set-roaring-encoding [expr {$e eq {roaring} ? "yes" : "no"}]
                 if {$e eq {intset}} {set len 10} else {set len 1000}
                 for {set j 0} {$j < $len} {incr j} {
                     if {$d eq {string}} {
@@ -132,12 +134,13 @@ start_server {tags {"aofrw"}} {
             }
         }
     }
+    r config set set-roaring-encoding yes
 
     foreach d {string int} {
-        foreach e {ziplist hashtable} {
+        foreach e {listpack hashtable} {
             test "AOF rewrite of hash with $e encoding, $d data" {
                 r flushall
-                if {$e eq {ziplist}} {set len 10} else {set len 1000}
+                if {$e eq {listpack}} {set len 10} else {set len 1000}
                 for {set j 0} {$j < $len} {incr j} {
                     if {$d eq {string}} {
                         set data [randstring 0 16 alpha]
@@ -160,10 +163,10 @@ start_server {tags {"aofrw"}} {
     }
 
     foreach d {string int} {
-        foreach e {ziplist skiplist} {
+        foreach e {listpack btree} {
             test "AOF rewrite of zset with $e encoding, $d data" {
                 r flushall
-                if {$e eq {ziplist}} {set len 10} else {set len 1000}
+                if {$e eq {listpack}} {set len 10} else {set len 1000}
                 for {set j 0} {$j < $len} {incr j} {
                     if {$d eq {string}} {
                         set data [randstring 0 16 alpha]
@@ -160,6 +160,23 @@ start_server {tags {"expire"}} {
         list $size1 $size2
     } {3 0}
 
+    test {Redis should actively expire keys in TTL order} {
+        r flushdb
+        # A few short lived keys hidden among many keys with a long TTL:
+        # sampling at random would almost never find them, while the keys
+        # are reclaimed in expire order from the head of the index.
+        r debug populate 10000
+        for {set j 0} {$j < 10000} {incr j} {
+            r expire key:$j 1000
+        }
+        for {set j 0} {$j < 100} {incr j} {
+            r psetex short:$j [expr {100+$j}] a
+        }
+        assert_equal 10100 [r dbsize]
+        after 1000
+        list [r dbsize] [expr {[r ttl key:0] > 0}]
+    } {10000 1}
+
     test {Redis should lazy expire keys} {
         r flushdb
         r debug set-active-expire 0
@@ -57,4 +57,22 @@ start_server {tags {"introspection"}} {
             fail "Client still listed in CLIENT LIST after SETNAME."
         }
     }
+
+    test {Idle clients give back their query and reply buffers} {
+        set rd [redis_deferring_client]
+        $rd client setname idleclient
+        assert_equal [$rd read] "OK"
+        $rd set foo [string repeat x 5000]
+        assert_equal [$rd read] "OK"
+        $rd get foo
+        assert_equal [string length [$rd read]] 5000
+        set line {}
+        foreach l [split [r client list] "\n"] {
+            if {[string match {*name=idleclient*} $l]} {set line $l}
+        }
+        $rd close
+        assert_match {*qbuf=0 qbuf-free=0 *} $line
+        assert {[s mem_clients_buffers] > 0}
+        r memory stats
+    } {*clients.buffers*clients.buffers.pool*}
 }
@@ -57,6 +57,24 @@ start_server {tags {"keyspace"}} {
         append res [r exists emptykey]
     } {10}
 
+    test {Key names of any length. SET/GET/RENAME/EXPIRE/DEL} {
+        # Cover all the sds header types of the key names embedded in the
+        # keyspace entries.
+        foreach len {0 1 31 32 255 256 65535 65536} {
+            set key [string repeat k $len]
+            r set $key $len
+            r expire $key 100
+            assert_equal $len [r get $key]
+            r rename $key dst
+            assert_equal 0 [r exists $key]
+            r rename dst $key
+            assert_equal $len [r get $key]
+            assert {[r ttl $key] > 0}
+            assert_equal 1 [r del $key]
+        }
+        r dbsize
+    } {0}
+
     test {Commands pipelining} {
         set fd [r channel]
         puts -nonewline $fd "SET k1 xyzk\r\nGET k1\r\nPING\r\n"
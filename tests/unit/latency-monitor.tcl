@@ -53,7 +53,7 @@ start_server {tags {"latency-monitor"}} {
         r eval {
             local i = 0
             while (i < 1000000) do
-                redis.call('sadd','mybigkey',i)
+                redis.call('sadd','mybigkey','e'..i)
                 i = i+1
              end
         } 0
@@ -61,4 +61,64 @@ start_server {tags {"latency-monitor"}} {
         after 500
         assert_match {*expire-cycle*} [r latency latest]
     }
+
+    test {LATENCY of ZUNIONSTORE and ZINTERSTORE is collected} {
+        r config set latency-monitor-threshold 1
+        r eval {
+            for i = 1, 200000 do
+                redis.call('zadd','bigzset',i,'e'..i)
+            end
+        } 0
+        r zunionstore dst 2 bigzset bigzset
+        r zinterstore dst 2 bigzset bigzset
+        set latest [r latency latest]
+        assert_match {*zunionstore*} $latest
+        assert_match {*zinterstore*} $latest
+        r config set latency-monitor-threshold 200
+    }
+}
+
+start_server {tags {"latency-monitor"}} {
+    test {LATENCY HISTOGRAM reports the calls of a command} {
+        r config resetstat
+        for {set j 0} {$j < 100} {incr j} {r set foo bar}
+        r debug sleep 0.1
+        set reply [r latency histogram set debug]
+        set set_hist [dict get [dict get $reply set] histogram_usec]
+        set debug_hist [dict get [dict get $reply debug] histogram_usec]
+        # The cumulative count of the last bucket is the number of calls,
+        # and the DEBUG SLEEP call is in a bucket above 100 milliseconds.
+        list [dict get [dict get $reply set] calls] [lindex $set_hist end] \
+             [expr {[lindex $debug_hist end-1] >= 100000}]
+    } {100 100 1}
+
+    test {LATENCY HISTOGRAM skips unknown and never called commands} {
+        r config resetstat
+        r latency histogram nosuchcommand lpush
+    } {}
+
+    test {INFO latencystats reports the configured percentiles} {
+        r config resetstat
+        r config set latency-tracking-info-percentiles "50 99.9"
+        r debug sleep 0.1
+        set info [r info latencystats]
+        regexp {latency_percentiles_usec_debug:p50=(\d+),p99.9=(\d+)} \
+            $info - p50 p999
+        r config set latency-tracking-info-percentiles "50 99 99.9"
+        expr {$p50 >= 100000 && $p999 >= $p50}
+    } {1}
+
+    test {Latency percentiles must be between 0 and 100} {
+        catch {r config set latency-tracking-info-percentiles "50 101"} e
+        list $e [r config get latency-tracking-info-percentiles]
+    } {*Invalid argument* {latency-tracking-info-percentiles {50 99 99.9}}}
+
+    test {No latency histograms are recorded if latency-tracking is off} {
+        r config resetstat
+        r config set latency-tracking no
+        r set foo bar
+        set reply [r latency histogram set]
+        r config set latency-tracking yes
+        set reply
+    } {}
 }
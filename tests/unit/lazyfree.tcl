@@ -1,4 +1,9 @@
-start_server {tags {"lazyfree"}} {
+start_server {
+    tags {"lazyfree"}
+    overrides {
+        "set-roaring-encoding" no
+    }
+} {
     test "UNLINK can reclaim memory in background" {
         set orig_mem [s used_memory]
         set args {}
@@ -0,0 +1,41 @@
+set testmodule [file normalize tests/modules/threadreply.so]
+
+start_server {tags {"modules"}} {
+    r module load $testmodule
+
+    test {Module threads can reply to blocked clients} {
+        assert_equal {} [r threadreply.echo 0 foo]
+        assert_equal {foo foo foo} [r threadreply.echo 3 foo]
+    }
+
+    test {Replies from module threads are intact while other clients reply} {
+        set clients {}
+        for {set j 0} {$j < 10} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+
+        # Module threads fill the reply buffers of their blocked clients
+        # while the main thread replies to the other ones.
+        set expected {}
+        for {set i 0} {$i < 50} {incr i} {
+            foreach rd $clients {
+                set count [randomInt 20]
+                set payload [string repeat x [randomInt 2000]]
+                $rd threadreply.echo $count $payload
+                lappend expected [lrepeat $count $payload]
+            }
+            r set foo [string repeat y [randomInt 4000]]
+            r get foo
+        }
+
+        set j 0
+        for {set i 0} {$i < 50} {incr i} {
+            foreach rd $clients {
+                assert_equal [lindex $expected $j] [$rd read]
+                incr j
+            }
+        }
+        foreach rd $clients { $rd close }
+        assert_equal PONG [r ping]
+    }
+}
@@ -0,0 +1,52 @@
+set testmodule [file normalize tests/modules/timer.so]
+
+start_server {tags {"modules"}} {
+    r module load $testmodule
+
+    test {RM_CreateTimer: a timer fires once} {
+        r del timer-incr-key
+        set id [r test.createtimer 100 timer-incr-key]
+        lassign [r test.gettimer $id] remaining key
+        assert {$remaining <= 100}
+        assert_equal timer-incr-key $key
+        wait_for_condition 50 20 {
+            [r get timer-incr-key] eq 1
+        } else {
+            fail "Timer did not fire"
+        }
+        assert_equal {} [r test.gettimer $id]
+        assert_equal 0 [r test.stoptimer $id]
+        after 200
+        assert_equal 1 [r get timer-incr-key]
+    }
+
+    test {RM_StopTimer: a stopped timer does not fire} {
+        r del timer-incr-key
+        set id [r test.createtimer 100 timer-incr-key]
+        assert_equal 1 [r test.stoptimer $id]
+        assert_equal {} [r test.gettimer $id]
+        assert_equal 0 [r test.stoptimer $id]
+        after 200
+        assert_equal 0 [r exists timer-incr-key]
+    }
+
+    test {RM_StopTimer: stopping many timers out of order} {
+        r del timer-incr-key
+        set ids {}
+        for {set j 0} {$j < 1000} {incr j} {
+            lappend ids [r test.createtimer [expr {50+[randomInt 200]}] timer-incr-key]
+        }
+        # Stop half of the timers, in random order.
+        foreach id [lsort -command {apply {{a b} {expr {int(rand()*3)-1}}}} $ids] {
+            if {$id % 2} {assert_equal 1 [r test.stoptimer $id]}
+        }
+        wait_for_condition 50 20 {
+            [r get timer-incr-key] eq 500
+        } else {
+            fail "Timers did not fire"
+        }
+        after 100
+        assert_equal 500 [r get timer-incr-key]
+        foreach id $ids { assert_equal {} [r test.gettimer $id] }
+    }
+}
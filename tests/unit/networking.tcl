@@ -0,0 +1,171 @@
+start_server {tags {"networking"} overrides {io-threads 4 io-threads-do-reads yes}} {
+    test {CONFIG GET io-threads} {
+        list [lindex [r config get io-threads] 1] \
+             [lindex [r config get io-threads-do-reads] 1]
+    } {4 yes}
+
+    test {io-threads can't be changed at runtime} {
+        catch {r config set io-threads 2} e
+        set e
+    } {*Unsupported*}
+
+    test {Pipelined commands from many clients with threaded I/O} {
+        r del counter
+        set clients {}
+        for {set j 0} {$j < 32} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+        # Run a few rounds so that at some point enough clients have
+        # pending output at the same time to activate the I/O threads.
+        set expected 0
+        for {set round 0} {$round < 20} {incr round} {
+            foreach c $clients {
+                for {set i 0} {$i < 50} {incr i} {
+                    $c incr counter
+                }
+                $c set key:$round [string repeat x 100]
+                $c flush
+            }
+            foreach c $clients {
+                for {set i 0} {$i < 50} {incr i} {
+                    set last [$c read]
+                }
+                assert_equal OK [$c read]
+            }
+            incr expected [expr {[llength $clients]*50}]
+            assert_equal $expected [r get counter]
+            if {[s io_threaded_writes_processed] > 0 &&
+                [s io_threaded_reads_processed] > 0} break
+        }
+        foreach c $clients {$c close}
+        list [expr {[s io_threaded_writes_processed] > 0}] \
+             [expr {[s io_threaded_reads_processed] > 0}]
+    } {1 1}
+
+    test {Big shared values are sent to many clients with threaded I/O} {
+        set big [string repeat z 200000]
+        r set big $big
+        set clients {}
+        for {set j 0} {$j < 32} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+        for {set round 0} {$round < 5} {incr round} {
+            foreach c $clients {
+                $c get big
+                $c get big
+                $c flush
+            }
+            foreach c $clients {
+                assert_equal $big [$c read]
+                assert_equal $big [$c read]
+            }
+        }
+        foreach c $clients {$c close}
+        r object refcount big
+    } {1}
+
+    test {Protocol errors are reported with threaded I/O} {
+        set s [socket [srv 0 host] [srv 0 port]]
+        fconfigure $s -translation binary
+        puts -nonewline $s "*1\r\n\$-10\r\n"
+        flush $s
+        set reply [gets $s]
+        close $s
+        set reply
+    } {*Protocol error*}
+
+    test {Threaded I/O counters are reset by CONFIG RESETSTAT} {
+        r config resetstat
+        list [s io_threaded_reads_processed] [s io_threaded_writes_processed]
+    } {0 0}
+}
+
+start_server {tags {"networking"} overrides {io-uring yes}} {
+    test {CONFIG GET io-uring} {
+        lindex [r config get io-uring] 1
+    } {yes}
+
+    # The server falls back to the default backend if the kernel doesn't
+    # support io_uring.
+    if {[s multiplexing_api] eq {io_uring}} {
+        test {Pipelined commands from many clients with io_uring} {
+            r del counter
+            set clients {}
+            for {set j 0} {$j < 32} {incr j} {
+                lappend clients [redis_deferring_client]
+            }
+            set expected 0
+            for {set round 0} {$round < 10} {incr round} {
+                foreach c $clients {
+                    for {set i 0} {$i < 50} {incr i} {
+                        $c incr counter
+                    }
+                    $c set key:$round [string repeat x 100]
+                    $c flush
+                }
+                foreach c $clients {
+                    for {set i 0} {$i < 50} {incr i} {
+                        set last [$c read]
+                    }
+                    assert_equal OK [$c read]
+                }
+                incr expected [expr {[llength $clients]*50}]
+                assert_equal $expected [r get counter]
+            }
+            foreach c $clients {$c close}
+            r get counter
+        } {16000}
+
+        test {Big values are sent and received with io_uring} {
+            set big [string repeat z 500000]
+            set clients {}
+            for {set j 0} {$j < 8} {incr j} {
+                lappend clients [redis_deferring_client]
+            }
+            set j 0
+            foreach c $clients {
+                $c set big:$j $big
+                $c get big:$j
+                $c flush
+                incr j
+            }
+            foreach c $clients {
+                assert_equal OK [$c read]
+                assert_equal $big [$c read]
+            }
+            foreach c $clients {$c close}
+            r strlen big:7
+        } {500000}
+
+        test {Closed connections are detected with io_uring} {
+            set before [s connected_clients]
+            set clients {}
+            for {set j 0} {$j < 10} {incr j} {
+                set s [socket [srv 0 host] [srv 0 port]]
+                fconfigure $s -translation binary
+                lappend clients $s
+            }
+            wait_for_condition 50 100 {
+                [s connected_clients] == $before+10
+            } else {
+                fail "Clients not connected"
+            }
+            foreach s $clients {close $s}
+            wait_for_condition 50 100 {
+                [s connected_clients] == $before
+            } else {
+                fail "Closed clients still connected"
+            }
+        }
+
+        test {Protocol errors are reported with io_uring} {
+            set s [socket [srv 0 host] [srv 0 port]]
+            fconfigure $s -translation binary
+            puts -nonewline $s "*1\r\n\$-10\r\n"
+            flush $s
+            set reply [gets $s]
+            close $s
+            set reply
+        } {*Protocol error*}
+    }
+}
@@ -244,3 +244,26 @@ start_server {tags {"other"}} {
         r save
     } {OK}
 }
+
+start_server {tags {"other"}} {
+    test {Active rehashing completes in the background} {
+        r config set hz 100
+        r flushall
+        # Create keys until the main dictionary is being rehashed.
+        r debug populate 30000
+        set j 0
+        while {![string match {*table 1*} [r debug htstats 9]]} {
+            r set k$j v
+            incr j
+            assert {$j < 100000}
+        }
+        # With no traffic the rehashing is completed by serverCron().
+        wait_for_condition 50 100 {
+            ![string match {*table 1*} [r debug htstats 9]]
+        } else {
+            fail "Active rehashing did not complete"
+        }
+        r config set hz 10
+        expr {[r dbsize] == 30000+$j}
+    } {1}
+}
@@ -34,7 +34,7 @@ start_server {tags {"slowlog"} overrides {slowlog-log-slower-than 1000000}} {
         r client setname foobar
         r debug sleep 0.2
         set e [lindex [r slowlog get] 0]
-        assert_equal [llength $e] 6
+        assert_equal [llength $e] 7
         assert_equal [lindex $e 0] 105
         assert_equal [expr {[lindex $e 2] > 100000}] 1
         assert_equal [lindex $e 3] {debug sleep 0.2}
@@ -78,4 +78,41 @@ start_server {tags {"slowlog"} overrides {slowlog-log-slower-than 1000000}} {
         set e [lindex [r slowlog get] 0]
         assert_equal {lastentry_client} [lindex $e 5]
     }
+
+    test {SLOWLOG - logs commands queued behind a slow command} {
+        r config set slowlog-log-slower-than 100000
+        r config set slowlog-log-queue-delay-slower-than 100000
+        r config set slowlog-max-len 10
+        r slowlog reset
+        # Send both commands with a single write, so that the SET waits in
+        # the query buffer while DEBUG SLEEP is executed.
+        set rd [redis_deferring_client]
+        $rd write "*3\r\n\$5\r\ndebug\r\n\$5\r\nsleep\r\n\$3\r\n0.2\r\n"
+        $rd write "*3\r\n\$3\r\nset\r\n\$3\r\nfoo\r\n\$3\r\nbar\r\n"
+        $rd flush
+        $rd read
+        $rd read
+        $rd close
+        r config set slowlog-log-queue-delay-slower-than -1
+        set e [lindex [r slowlog get] 0]
+        list [lindex $e 3] [expr {[lindex $e 2] < 100000}] \
+             [expr {[lindex $e 6] >= 100000}] [r slowlog len]
+    } {{set foo bar} 1 1 2}
+
+    test {Queue delay is reported by INFO} {
+        r config resetstat
+        set rd [redis_deferring_client]
+        $rd write "*3\r\n\$5\r\ndebug\r\n\$5\r\nsleep\r\n\$3\r\n0.1\r\n"
+        $rd write "*1\r\n\$4\r\nping\r\n"
+        $rd flush
+        $rd read
+        $rd read
+        $rd close
+        regexp {cmdstat_ping:[^\r]*queue_usec=(\d+)} \
+            [r info commandstats] - queue_usec
+        list [expr {$queue_usec >= 100000}] \
+             [expr {[s max_queue_delay_usec] >= 100000}] \
+             [string match {*queue_delay_percentiles_usec:p50=*} \
+                [r info latencystats]]
+    } {1 1 1}
 }
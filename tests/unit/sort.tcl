@@ -1,7 +1,7 @@
 start_server {
     tags {"sort"}
     overrides {
-        "list-max-ziplist-size" 32
+        "list-max-listpack-size" 32
         "set-max-intset-entries" 32
     }
 } {
@@ -41,7 +41,11 @@ start_server {
         16 sadd intset "Intset"
         1000 sadd hashtable "Hash table"
         10000 sadd hashtable "Big Hash table"
+        1000 sadd roaring "Roaring set"
+        10000 sadd roaring "Big roaring set"
     } {
+        # Integer members only become a hash table without roaring sets.
+        r config set set-roaring-encoding [expr {$enc eq {hashtable} ? "no" : "yes"}]
         set result [create_random_dataset $num $cmd]
         assert_encoding $enc tosort
 
@@ -1,7 +1,7 @@
 start_server {
     tags {"list"}
     overrides {
-        "list-max-ziplist-size" 4
+        "list-max-listpack-size" 4
     }
 } {
     source "tests/unit/type/list-common.tcl"
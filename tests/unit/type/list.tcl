@@ -1,37 +1,37 @@
 start_server {
     tags {"list"}
     overrides {
-        "list-max-ziplist-size" 5
+        "list-max-listpack-size" 5
     }
 } {
     source "tests/unit/type/list-common.tcl"
 
-    test {LPUSH, RPUSH, LLENGTH, LINDEX, LPOP - ziplist} {
+    test {LPUSH, RPUSH, LLENGTH, LINDEX, LPOP - listpack} {
         # first lpush then rpush
-        assert_equal 1 [r lpush myziplist1 aa]
-        assert_equal 2 [r rpush myziplist1 bb]
-        assert_equal 3 [r rpush myziplist1 cc]
-        assert_equal 3 [r llen myziplist1]
-        assert_equal aa [r lindex myziplist1 0]
-        assert_equal bb [r lindex myziplist1 1]
-        assert_equal cc [r lindex myziplist1 2]
-        assert_equal {} [r lindex myziplist2 3]
-        assert_equal cc [r rpop myziplist1]
-        assert_equal aa [r lpop myziplist1]
-        assert_encoding quicklist myziplist1
+        assert_equal 1 [r lpush mylistpack1 aa]
+        assert_equal 2 [r rpush mylistpack1 bb]
+        assert_equal 3 [r rpush mylistpack1 cc]
+        assert_equal 3 [r llen mylistpack1]
+        assert_equal aa [r lindex mylistpack1 0]
+        assert_equal bb [r lindex mylistpack1 1]
+        assert_equal cc [r lindex mylistpack1 2]
+        assert_equal {} [r lindex mylistpack2 3]
+        assert_equal cc [r rpop mylistpack1]
+        assert_equal aa [r lpop mylistpack1]
+        assert_encoding quicklist mylistpack1
 
         # first rpush then lpush
-        assert_equal 1 [r rpush myziplist2 a]
-        assert_equal 2 [r lpush myziplist2 b]
-        assert_equal 3 [r lpush myziplist2 c]
-        assert_equal 3 [r llen myziplist2]
-        assert_equal c [r lindex myziplist2 0]
-        assert_equal b [r lindex myziplist2 1]
-        assert_equal a [r lindex myziplist2 2]
-        assert_equal {} [r lindex myziplist2 3]
-        assert_equal a [r rpop myziplist2]
-        assert_equal c [r lpop myziplist2]
-        assert_encoding quicklist myziplist2
+        assert_equal 1 [r rpush mylistpack2 a]
+        assert_equal 2 [r lpush mylistpack2 b]
+        assert_equal 3 [r lpush mylistpack2 c]
+        assert_equal 3 [r llen mylistpack2]
+        assert_equal c [r lindex mylistpack2 0]
+        assert_equal b [r lindex mylistpack2 1]
+        assert_equal a [r lindex mylistpack2 2]
+        assert_equal {} [r lindex mylistpack2 3]
+        assert_equal a [r rpop mylistpack2]
+        assert_equal c [r lpop mylistpack2]
+        assert_encoding quicklist mylistpack2
     }
 
     test {LPUSH, RPUSH, LLENGTH, LINDEX, LPOP - regular list} {
@@ -56,9 +56,54 @@ start_server {
         for {set i 0} {$i < 512} {incr i} { r sadd myset $i }
         assert_encoding intset myset
         assert_equal 1 [r sadd myset 512]
+        assert_encoding roaring myset
+    }
+
+    test "SADD overflows an intset into a hashtable without roaring encoding" {
+        r config set set-roaring-encoding no
+        r del myset
+        for {set i 0} {$i < 513} {incr i} { r sadd myset $i }
+        r config set set-roaring-encoding yes
         assert_encoding hashtable myset
     }
 
+    test "SADD with more integers than an intset holds converts the set" {
+        r del myset
+        set ints {}
+        for {set i 0} {$i < 600} {incr i} { lappend ints $i }
+        assert_equal 600 [r sadd myset {*}$ints]
+        assert_encoding roaring myset
+        r config set set-roaring-encoding no
+        r del myset
+        assert_equal 600 [r sadd myset {*}$ints]
+        r config set set-roaring-encoding yes
+        assert_encoding hashtable myset
+        assert_equal 600 [r scard myset]
+    }
+
+    test "SADD with many repeated integers keeps an intset" {
+        r del myset
+        set ints {}
+        for {set i 0} {$i < 600} {incr i} { lappend ints 7 }
+        assert_equal 1 [r sadd myset {*}$ints]
+        assert_encoding intset myset
+        assert_equal 0 [r sadd myset {*}$ints]
+        assert_encoding intset myset
+        assert_equal 1 [r scard myset]
+    }
+
+    test "SADD a non-integer against a roaring set" {
+        r del myset
+        for {set i -600} {$i < 600} {incr i} { r sadd myset $i }
+        assert_encoding roaring myset
+        assert_equal 0 [r sadd myset 10]
+        assert_equal 1 [r sadd myset a]
+        assert_encoding hashtable myset
+        assert_equal 1201 [r scard myset]
+        assert_equal 1 [r sismember myset -600]
+        assert_equal 1 [r sismember myset a]
+    }
+
     test {Variadic SADD} {
         r del myset
         assert_equal 3 [r sadd myset a b c]
@@ -72,13 +117,14 @@ start_server {
         for {set i 0} {$i < 1280} {incr i} { r sadd mylargeintset $i }
         for {set i 0} {$i <  256} {incr i} { r sadd myhashset [format "i%03d" $i] }
         assert_encoding intset myintset
-        assert_encoding hashtable mylargeintset
+        assert_encoding roaring mylargeintset
         assert_encoding hashtable myhashset
 
         r debug reload
         assert_encoding intset myintset
-        assert_encoding hashtable mylargeintset
+        assert_encoding roaring mylargeintset
         assert_encoding hashtable myhashset
+        assert_equal 1280 [r scard mylargeintset]
     }
 
     test {SREM basics - regular set} {
@@ -207,6 +253,144 @@ start_server {
         }
     }
 
+    test "SINTER, SUNION and SDIFF against roaring sets" {
+        r del rset1 rset2 rset3 hset1 hset2 hset3
+        # Dense and sparse ranges, so that both array and bitmap
+        # containers are involved, and members of opposite signs.
+        for {set i 0} {$i < 6000} {incr i} {
+            set v [expr {$i*3 - 9000}]
+            r sadd rset1 $v
+            r sadd hset1 $v
+        }
+        for {set i 0} {$i < 6000} {incr i} {
+            set v [expr {$i*2 - 3000}]
+            r sadd rset2 $v
+            r sadd hset2 $v
+        }
+        for {set i 0} {$i < 1000} {incr i} {
+            set v [expr {$i*1000003}]
+            r sadd rset3 $v
+            r sadd hset3 $v
+        }
+        r sadd hset1 foo
+        r sadd hset2 foo
+        r sadd hset3 foo
+        assert_encoding roaring rset1
+        assert_encoding roaring rset2
+        assert_encoding roaring rset3
+        assert_encoding hashtable hset1
+
+        foreach cmd {sinter sunion sdiff} {
+            foreach keys {{1 2} {2 1} {1 2 3} {3 1}} {
+                set rkeys {}
+                set hkeys {}
+                foreach k $keys {
+                    lappend rkeys rset$k
+                    lappend hkeys hset$k
+                }
+                set expected [lsort [r $cmd {*}$hkeys]]
+                if {$cmd ne {sdiff}} {
+                    set expected [lsearch -all -inline -not $expected foo]
+                }
+                assert_equal $expected [lsort [r $cmd {*}$rkeys]]
+                assert_equal [llength $expected] [r ${cmd}store res {*}$rkeys]
+                assert_equal $expected [lsort [r smembers res]]
+                # Missing keys are empty sets, that SINTER short-circuits.
+                if {$cmd ne {sinter}} {
+                    assert_equal $expected [lsort [r $cmd {*}$rkeys nokey]]
+                }
+            }
+        }
+        assert_equal {} [r sdiff nokey rset1]
+        assert_equal 0 [r sinterstore res rset1 nokey]
+    }
+
+    test "SINTERSTORE of roaring sets with a small result is an intset" {
+        r del rset1 rset2
+        for {set i 0} {$i < 1000} {incr i} { r sadd rset1 $i }
+        for {set i 990} {$i < 2000} {incr i} { r sadd rset2 $i }
+        assert_equal 10 [r sinterstore res rset1 rset2]
+        assert_encoding intset res
+        assert_equal 2000 [r sunionstore res rset1 rset2]
+        assert_encoding roaring res
+    }
+
+    test "SINTER, SUNION and SDIFF against intsets of different encodings" {
+        for {set iter 0} {$iter < 20} {incr iter} {
+            r del iset1 iset2 iset3 hset1 hset2 hset3
+            foreach k {1 2 3} range {100 100000 10000000000} {
+                set n [randomInt 300]
+                for {set i 0} {$i < $n} {incr i} {
+                    set v [expr {[randomInt $range] - $range/2}]
+                    r sadd iset$k $v
+                    r sadd hset$k $v
+                }
+                r sadd hset$k foo
+            }
+            foreach cmd {sinter sunion sdiff} {
+                foreach keys {{1 2} {2 1} {1 2 3} {3 2 1}} {
+                    set ikeys {}
+                    set hkeys {}
+                    foreach k $keys {
+                        lappend ikeys iset$k
+                        lappend hkeys hset$k
+                    }
+                    set expected [lsearch -all -inline -not \
+                        [lsort [r $cmd {*}$hkeys]] foo]
+                    assert_equal $expected [lsort [r $cmd {*}$ikeys]]
+                    assert_equal [llength $expected] \
+                        [r ${cmd}store res {*}$ikeys]
+                    assert_equal $expected [lsort [r smembers res]]
+                }
+            }
+        }
+    }
+
+    test "SUNIONSTORE of intsets past the intset limit" {
+        r del iset1 iset2
+        for {set i 0} {$i < 400} {incr i} {
+            r sadd iset1 $i
+            r sadd iset2 [expr {$i+1000}]
+        }
+        assert_encoding intset iset1
+        assert_equal 800 [r sunionstore res iset1 iset2]
+        assert_encoding roaring res
+        assert_equal 0 [r sinterstore res iset1 iset2]
+        assert_equal 400 [r sdiffstore res iset1 iset2]
+        assert_encoding intset res
+    }
+
+    test "SSCAN against a roaring set" {
+        r del rset1
+        set members {}
+        for {set i 0} {$i < 5000} {incr i} {
+            set v [expr {($i % 2) ? $i*7 : -$i*65537}]
+            r sadd rset1 $v
+            lappend members $v
+        }
+        r sadd rset1 -9223372036854775808 9223372036854775807
+        lappend members -9223372036854775808 9223372036854775807
+        assert_encoding roaring rset1
+        set cur 0
+        set found {}
+        while 1 {
+            set res [r sscan rset1 $cur count 97]
+            set cur [lindex $res 0]
+            lappend found {*}[lindex $res 1]
+            if {$cur == 0} break
+        }
+        assert_equal [lsort -integer $members] [lsort -integer $found]
+    }
+
+    test "ZUNIONSTORE and ZINTERSTORE against roaring sets" {
+        r del rset1 zres
+        for {set i 0} {$i < 1000} {incr i} { r sadd rset1 $i }
+        r zadd zset1 5 10 5 2000
+        assert_equal 1001 [r zunionstore zres 2 rset1 zset1]
+        assert_equal 6 [r zscore zres 10]
+        assert_equal 1 [r zinterstore zres 2 rset1 zset1]
+    }
+
     test "SDIFF with first set empty" {
         r del set1 set2 set3
         r sadd set2 1 2 3 4
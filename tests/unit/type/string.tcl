@@ -419,4 +419,43 @@ start_server {tags {"string"}} {
         r set foo bar
         r getrange foo 0 4294967297
     } {bar}
+
+    test {Big values are sent by reference and released after the reply} {
+        r del foo
+        r set foo [string repeat x 1000000]
+        assert_equal 1000000 [string length [r get foo]]
+        assert_equal 1000000 [string length [r eval {return redis.call('get',KEYS[1])} 1 foo]]
+        r object refcount foo
+    } {1}
+
+    test {Pipelined big and small values are sent in order} {
+        r del big1 big2 small
+        set big1 [string repeat a 100000]
+        set big2 [string repeat b 2000000]
+        r set big1 $big1
+        r set big2 $big2
+        r set small c
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 20} {incr j} {
+            $rd get big1
+            $rd get small
+            $rd mget big2 small big1
+        }
+        for {set j 0} {$j < 20} {incr j} {
+            assert_equal $big1 [$rd read]
+            assert_equal c [$rd read]
+            assert_equal [list $big2 c $big1] [$rd read]
+        }
+        $rd close
+
+        # Overwrite a value while a reply may still reference it.
+        r set foo [string repeat y 500000]
+        set rd [redis_deferring_client]
+        $rd get foo
+        $rd set foo bar
+        $rd get foo
+        set res [list [string length [$rd read]] [$rd read] [$rd read]]
+        $rd close
+        set res
+    } {500000 OK bar}
 }
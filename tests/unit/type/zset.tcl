@@ -7,12 +7,12 @@ start_server {tags {"zset"}} {
     }
 
     proc basics {encoding} {
-        if {$encoding == "ziplist"} {
-            r config set zset-max-ziplist-entries 128
-            r config set zset-max-ziplist-value 64
-        } elseif {$encoding == "skiplist"} {
-            r config set zset-max-ziplist-entries 0
-            r config set zset-max-ziplist-value 0
+        if {$encoding == "listpack"} {
+            r config set zset-max-listpack-entries 128
+            r config set zset-max-listpack-value 64
+        } elseif {$encoding == "btree"} {
+            r config set zset-max-listpack-entries 0
+            r config set zset-max-listpack-value 0
         } else {
             puts "Unknown sorted set encoding"
             exit
@@ -148,6 +148,18 @@ start_server {tags {"zset"}} {
             assert_match {*ERR*syntax*} $e
         }
 
+        test "ZADD - Variadic version with repeated members - $encoding" {
+            r del myzset
+            assert_equal 2 [r zadd myzset 1 a 2 b 3 a]
+            assert_equal {b 2 a 3} [r zrange myzset 0 -1 withscores]
+            assert_encoding $encoding myzset
+            r del myzset
+            assert_equal 3 [r zadd myzset ch 1 a 2 b 3 a]
+            r del myzset
+            assert_equal 2 [r zadd myzset nx 1 a 2 b 3 a]
+            assert_equal {a 1 b 2} [r zrange myzset 0 -1 withscores]
+        }
+
         test {ZINCRBY does not work variadic even if shares ZADD implementation} {
             r del myzset
             catch {r zincrby myzset 10 a 20 b 30 c} e
@@ -290,6 +302,28 @@ start_server {tags {"zset"}} {
             assert_equal  6 [r zscore zset bar]
         }
 
+        test "ZINCRBY - small steps keep the set sorted - $encoding" {
+            r del zset
+            set scores {}
+            for {set j 0} {$j < 50} {incr j} {
+                r zadd zset $j m$j
+                dict set scores m$j $j
+            }
+            for {set j 0} {$j < 500} {incr j} {
+                set ele m[randomInt 50]
+                set incr [expr {[randomInt 5]-2}]
+                r zincrby zset $incr $ele
+                dict incr scores $ele $incr
+            }
+            assert_encoding $encoding zset
+            set expected {}
+            foreach {ele score} [lsort -stride 2 -index 1 -integer \
+                                 [lsort -stride 2 -index 0 $scores]] {
+                lappend expected $ele $score
+            }
+            assert_equal $expected [r zrange zset 0 -1 withscores]
+        }
+
         test "ZINCRBY return value" {
             r del ztmp
             set retval [r zincrby ztmp 1.0 x]
@@ -650,8 +684,51 @@ start_server {tags {"zset"}} {
         }
     }
 
-    basics ziplist
-    basics skiplist
+    basics listpack
+    basics btree
+
+    test {ZADD with more members than a listpack holds creates a btree} {
+        r config set zset-max-listpack-entries 128
+        r config set zset-max-listpack-value 64
+        r del myzset
+        set args {}
+        set expected {}
+        for {set j 0} {$j < 200} {incr j} {
+            lappend args [expr {200-$j}] m$j
+            lappend expected m[expr {199-$j}] [expr {$j+1}]
+        }
+        assert_equal 200 [r zadd myzset {*}$args]
+        assert_encoding btree myzset
+        assert_equal $expected [r zrange myzset 0 -1 withscores]
+        assert_equal 0 [r zrank myzset m199]
+
+        # An existing listpack is converted while adding the members.
+        r del myzset
+        r zadd myzset 0 first
+        assert_encoding listpack myzset
+        assert_equal 200 [r zadd myzset {*}$args]
+        assert_encoding btree myzset
+        assert_equal 201 [r zcard myzset]
+    }
+
+    test {ZADD with many repeated members keeps a listpack} {
+        r del myzset
+        set args {}
+        for {set j 0} {$j < 200} {incr j} { lappend args $j m }
+        assert_equal 1 [r zadd myzset {*}$args]
+        assert_encoding listpack myzset
+        assert_equal {m 199} [r zrange myzset 0 -1 withscores]
+    }
+
+    test {ZADD XX updating scores of a listpack does not convert it} {
+        r del myzset
+        for {set j 0} {$j < 100} {incr j} { r zadd myzset $j m$j }
+        set args {}
+        for {set j 0} {$j < 40} {incr j} { lappend args [expr {$j+1000}] m$j }
+        assert_equal 0 [r zadd myzset xx {*}$args]
+        assert_encoding listpack myzset
+        assert_equal 1000 [r zscore myzset m0]
+    }
 
     test {ZINTERSTORE regression with two sets, intset+hashtable} {
         r del seta setb setc
@@ -666,7 +743,7 @@ start_server {tags {"zset"}} {
         r zrange out 0 -1 withscores
     } {neginf 0}
 
-    test {ZINTERSTORE #516 regression, mixed sets and ziplist zsets} {
+    test {ZINTERSTORE #516 regression, mixed sets and listpack zsets} {
         r sadd one 100 101 102 103
         r sadd two 100 200 201 202
         r zadd three 1 500 1 501 1 502 1 503 1 100
@@ -701,14 +778,14 @@ start_server {tags {"zset"}} {
     }
 
     proc stressers {encoding} {
-        if {$encoding == "ziplist"} {
+        if {$encoding == "listpack"} {
             # Little extra to allow proper fuzzing in the sorting stresser
-            r config set zset-max-ziplist-entries 256
-            r config set zset-max-ziplist-value 64
+            r config set zset-max-listpack-entries 256
+            r config set zset-max-listpack-value 64
             set elements 128
-        } elseif {$encoding == "skiplist"} {
-            r config set zset-max-ziplist-entries 0
-            r config set zset-max-ziplist-value 0
+        } elseif {$encoding == "btree"} {
+            r config set zset-max-listpack-entries 0
+            r config set zset-max-listpack-value 0
             if {$::accurate} {set elements 1000} else {set elements 100}
         } else {
             puts "Unknown sorted set encoding"
@@ -981,7 +1058,7 @@ start_server {tags {"zset"}} {
             }
         }
 
-        test "ZSETs skiplist implementation backlink consistency test - $encoding" {
+        test "ZSETs btree implementation backlink consistency test - $encoding" {
             set diff 0
             for {set j 0} {$j < $elements} {incr j} {
                 r zadd myzset [expr rand()] "Element-$j"
@@ -999,7 +1076,7 @@ start_server {tags {"zset"}} {
             assert_equal 0 $diff
         }
 
-        test "ZSETs ZRANK augmented skip list stress testing - $encoding" {
+        test "ZSETs ZRANK counted btree stress testing - $encoding" {
             set err {}
             r del myzset
             for {set k 0} {$k < 2000} {incr k} {
@@ -1028,7 +1105,7 @@ start_server {tags {"zset"}} {
     }
 
     tags {"slow"} {
-        stressers ziplist
-        stressers skiplist
+        stressers listpack
+        stressers btree
     }
 }